@@ -13,6 +13,14 @@ app_runtime_config_t g_runtime_config = {
     .light_sleep_delay_ms = 20 * 60 * 1000,    // 20 minutes (prod default)
     .deep_sleep_delay_ms = 2 * 60 * 60 * 1000, // 2 hours
     .ir_is_enabled = true,
+    .display_dim_delay_ms = 60 * 1000,        // 1 minute
+    .display_blank_delay_ms = 10 * 60 * 1000, // 10 minutes
+    .visualizer_mode = VISUALIZER_OFF,
+    .relay_max_clients = 0,
+    .multiroom_mode = MULTIROOM_OFF,
+    .timeshift_minutes = 0,
+    .recorder_enabled = false,
+    .pipeline_graph = "",
 };
 
 void load_app_config(void) {
@@ -26,6 +34,7 @@ void load_app_config(void) {
 
   uint8_t u8_val;
   uint32_t u32_val;
+  size_t str_len;
 
   if (nvs_get_u8(nvs_handle, "anlg_attn", &u8_val) == ESP_OK) {
     g_runtime_config.analog_attenuation = (pcm5122_analog_atten_t)u8_val;
@@ -45,6 +54,32 @@ void load_app_config(void) {
   if (nvs_get_u8(nvs_handle, "ir_en", &u8_val) == ESP_OK) {
     g_runtime_config.ir_is_enabled = (u8_val != 0);
   }
+  if (nvs_get_u32(nvs_handle, "dim_dly", &u32_val) == ESP_OK) {
+    g_runtime_config.display_dim_delay_ms = u32_val;
+  }
+  if (nvs_get_u32(nvs_handle, "blank_dly", &u32_val) == ESP_OK) {
+    g_runtime_config.display_blank_delay_ms = u32_val;
+  }
+  if (nvs_get_u8(nvs_handle, "vis_mode", &u8_val) == ESP_OK) {
+    g_runtime_config.visualizer_mode = (visualizer_mode_t)u8_val;
+  }
+  if (nvs_get_u8(nvs_handle, "relay_max", &u8_val) == ESP_OK) {
+    g_runtime_config.relay_max_clients = u8_val;
+  }
+  if (nvs_get_u8(nvs_handle, "mr_mode", &u8_val) == ESP_OK) {
+    g_runtime_config.multiroom_mode = (multiroom_mode_t)u8_val;
+  }
+  if (nvs_get_u8(nvs_handle, "ts_min", &u8_val) == ESP_OK) {
+    g_runtime_config.timeshift_minutes = u8_val;
+  }
+  if (nvs_get_u8(nvs_handle, "rec_en", &u8_val) == ESP_OK) {
+    g_runtime_config.recorder_enabled = (u8_val != 0);
+  }
+  str_len = sizeof(g_runtime_config.pipeline_graph);
+  if (nvs_get_str(nvs_handle, "pipe_graph", g_runtime_config.pipeline_graph,
+                  &str_len) != ESP_OK) {
+    g_runtime_config.pipeline_graph[0] = '\0';
+  }
 
   nvs_close(nvs_handle);
   ESP_LOGI(TAG, "Configuration loaded from NVS");
@@ -67,6 +102,14 @@ void save_app_config(void) {
   nvs_set_u32(nvs_handle, "light_dly", g_runtime_config.light_sleep_delay_ms);
   nvs_set_u32(nvs_handle, "deep_dly", g_runtime_config.deep_sleep_delay_ms);
   nvs_set_u8(nvs_handle, "ir_en", (uint8_t)g_runtime_config.ir_is_enabled);
+  nvs_set_u32(nvs_handle, "dim_dly", g_runtime_config.display_dim_delay_ms);
+  nvs_set_u32(nvs_handle, "blank_dly", g_runtime_config.display_blank_delay_ms);
+  nvs_set_u8(nvs_handle, "vis_mode", (uint8_t)g_runtime_config.visualizer_mode);
+  nvs_set_u8(nvs_handle, "relay_max", g_runtime_config.relay_max_clients);
+  nvs_set_u8(nvs_handle, "mr_mode", (uint8_t)g_runtime_config.multiroom_mode);
+  nvs_set_u8(nvs_handle, "ts_min", g_runtime_config.timeshift_minutes);
+  nvs_set_u8(nvs_handle, "rec_en", (uint8_t)g_runtime_config.recorder_enabled);
+  nvs_set_str(nvs_handle, "pipe_graph", g_runtime_config.pipeline_graph);
 
   err = nvs_commit(nvs_handle);
   if (err != ESP_OK) {
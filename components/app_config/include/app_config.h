@@ -13,6 +13,24 @@ typedef enum {
   POWER_SAVE_LIGHT_DEEP
 } power_save_mode_t;
 
+/**
+ * @brief Home screen audio visualization.
+ */
+typedef enum {
+  VISUALIZER_OFF,
+  VISUALIZER_SPECTRUM,
+  VISUALIZER_VU,
+} visualizer_mode_t;
+
+/**
+ * @brief Role in multi-room sync (see main/multiroom.h).
+ */
+typedef enum {
+  MULTIROOM_OFF,
+  MULTIROOM_LEADER,   // plays stations and shares them
+  MULTIROOM_FOLLOWER, // plays what the leader shares
+} multiroom_mode_t;
+
 /**
  * @brief PCM5122 Analog Attenuation Options.
  */
@@ -36,6 +54,9 @@ typedef enum {
   PCM5122_DIGITAL_ATTEN_24DB = 48,
 } pcm5122_digital_atten_t;
 
+// Text of the pipeline graph (main/pipeline_graph.h), with the terminator
+#define APP_CONFIG_PIPELINE_GRAPH_LEN 96
+
 /**
  * @brief Consolidated runtime configuration structure.
  */
@@ -46,6 +67,15 @@ typedef struct {
   uint32_t light_sleep_delay_ms;
   uint32_t deep_sleep_delay_ms;
   bool ir_is_enabled;
+  uint32_t display_dim_delay_ms;   // 0 = never dim
+  uint32_t display_blank_delay_ms; // 0 = never blank
+  visualizer_mode_t visualizer_mode;
+  uint8_t relay_max_clients; // LAN relay listeners, 0 = relay off
+  multiroom_mode_t multiroom_mode; // read at boot
+  uint8_t timeshift_minutes; // time-shift buffer, 0 = off; next station
+  bool recorder_enabled;     // SD card recording
+  // Pipeline graph, "" = default; next station
+  char pipeline_graph[APP_CONFIG_PIPELINE_GRAPH_LEN];
 } app_runtime_config_t;
 
 extern app_runtime_config_t g_runtime_config;
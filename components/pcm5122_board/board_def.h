@@ -2,13 +2,14 @@
 #define _AUDIO_BOARD_DEFINITION_H_
 
 #include "audio_hal.h"
+#include "gpio_assignments.h"
 
-#define FUNC_SDCARD_EN (0)
+#define FUNC_SDCARD_EN (1)
 #define SDCARD_OPEN_FILE_NUM_MAX 5
 #define SDCARD_PWR_CTRL -1
-#define ESP_SD_PIN_CLK -1
-#define ESP_SD_PIN_CMD -1
-#define ESP_SD_PIN_D0 -1
+#define ESP_SD_PIN_CLK SD_CLK_GPIO
+#define ESP_SD_PIN_CMD SD_CMD_GPIO
+#define ESP_SD_PIN_D0 SD_D0_GPIO
 #define ESP_SD_PIN_D1 -1
 #define ESP_SD_PIN_D2 -1
 #define ESP_SD_PIN_D3 -1
@@ -1,43 +1,41 @@
 #include "audio_pipeline_manager.h"
-#include "aac_decoder.h"
 #include "audio_common.h"
+#include "decoder_registry.h"
 #include "board.h" // For CONFIG_ESP32_C3_LYRA_V2_BOARD and I2S_STREAM_PDM_TX_CFG_DEFAULT
 #include "driver/gpio.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_sleep.h"
-#include "flac_decoder.h"
+#include "hls_stream.h"
 #include "http_stream.h"
 #include "i2s_stream.h"
 #include "internet_radio_adf.h"
-#include "mp3_decoder.h"
-#include "ogg_decoder.h"
+#include "local_media.h"
+#include "multiroom.h"
+#include "recorder.h"
+#include "stream_relay.h"
+#include "timeshift.h"
+#include <inttypes.h>
+#include <stddef.h>
 #include <string.h>
+#include <sys/param.h>
 #include "esp_task_wdt.h"
 #include "sdkconfig.h"
 #include "app_config.h"
 #include "ir_remote.h"
 #include "audio_event_iface.h"
 #include "lvgl_ssd1306_setup.h"
+#include "visualizer.h"
 
 extern audio_pipeline_components_t audio_pipeline_components;
 extern volatile bool g_is_pipeline_running;
 
 static const char *TAG = "AUDIO_PIPELINE_MGR";
 volatile uint64_t g_bytes_read = 0;
+volatile int g_stream_buffer_fill = 0;
 
 const char *codec_type_to_string(codec_type_t codec) {
-  switch (codec) {
-  case CODEC_TYPE_MP3:
-    return "MP3";
-  case CODEC_TYPE_AAC:
-    return "AAC";
-  case CODEC_TYPE_OGG:
-    return "OGG";
-  case CODEC_TYPE_FLAC:
-    return "FLAC";
-  default:
-    return "Unknown Codec";
-  }
+  return decoder_registry_name(codec);
 }
 
 static int _http_stream_event_handle(http_stream_event_msg_t *msg) {
@@ -54,6 +52,14 @@ static int _http_stream_event_handle(http_stream_event_msg_t *msg) {
   case HTTP_STREAM_ON_RESPONSE:
     // This is called for each chunk of data received
     g_bytes_read += msg->buffer_len;
+    // With time-shift the decoder is fed from its buffer, which reports
+    if (audio_pipeline_components.time_shift == NULL) {
+      ringbuf_handle_t rb = audio_element_get_output_ringbuf(msg->el);
+      int size = rb ? rb_get_size(rb) : 0;
+      if (size > 0) {
+        g_stream_buffer_fill = rb_bytes_filled(rb) * 100 / size;
+      }
+    }
     // You could log it here, but it will be very verbose.
     // ESP_LOGI(TAG, "Bytes read: %llu", g_bytes_read);
     return ESP_OK;
@@ -81,10 +87,434 @@ static esp_err_t codec_event_cb(audio_element_handle_t el,
       ESP_ERROR_CHECK(i2s_stream_set_clk(
           audio_pipeline_components.i2s_stream_writer, music_info.sample_rates,
           music_info.bits, music_info.channels));
+      visualizer_set_format(music_info.sample_rates, music_info.bits,
+                            music_info.channels);
+      multiroom_playout_set_format(music_info.sample_rates, music_info.bits,
+                                   music_info.channels);
     }
   }
   return ESP_OK;
 }
+
+/* ---------- taps ---------- */
+
+typedef struct {
+  pipeline_stage_type_t stage;
+  int slot; // multi-output ring of the stage's element
+} tap_desc_t;
+
+static const tap_desc_t taps[PIPELINE_TAP_COUNT] = {
+    [PIPELINE_TAP_RELAY] = {PIPELINE_STAGE_SOURCE, 0},
+    [PIPELINE_TAP_MULTIROOM] = {PIPELINE_STAGE_SOURCE, 1},
+    [PIPELINE_TAP_RECORDER] = {PIPELINE_STAGE_SOURCE, 2},
+    [PIPELINE_TAP_VISUALIZER] = {PIPELINE_STAGE_I2S, 0},
+};
+
+// Bytes of the ring removed taps are switched to; full at once, and nobody
+// reads it
+#define TAP_PARKING_SIZE 64
+
+static portMUX_TYPE tap_lock = portMUX_INITIALIZER_UNLOCKED;
+// Under tap_lock: the elements of the pipeline that plays, by stage
+static audio_element_handle_t tap_elements[PIPELINE_STAGE_COUNT];
+static bool tap_connected[PIPELINE_TAP_COUNT];
+static ringbuf_handle_t tap_parking = NULL;
+
+static int tap_slots(pipeline_stage_type_t stage) {
+  int n = 0;
+  for (int i = 0; i < PIPELINE_TAP_COUNT; i++) {
+    if (taps[i].stage == stage) {
+      n = MAX(n, taps[i].slot + 1);
+    }
+  }
+  return n;
+}
+
+esp_err_t audio_pipeline_tap_insert(pipeline_tap_t tap, ringbuf_handle_t rb) {
+  if ((unsigned)tap >= PIPELINE_TAP_COUNT || rb == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&tap_lock);
+  audio_element_handle_t el = tap_elements[taps[tap].stage];
+  if (el) {
+    ret = audio_element_set_multi_output_ringbuf(el, rb, taps[tap].slot);
+    tap_connected[tap] = ret == ESP_OK;
+  }
+  portEXIT_CRITICAL(&tap_lock);
+  return ret;
+}
+
+void audio_pipeline_tap_remove(pipeline_tap_t tap) {
+  if ((unsigned)tap >= PIPELINE_TAP_COUNT) {
+    return;
+  }
+  // ADF has no way to empty a slot, so it is pointed at the parking ring;
+  // writes to it return at once
+  portENTER_CRITICAL(&tap_lock);
+  audio_element_handle_t el = tap_elements[taps[tap].stage];
+  if (el && tap_connected[tap] && tap_parking) {
+    audio_element_set_multi_output_ringbuf(el, tap_parking, taps[tap].slot);
+    tap_connected[tap] = false;
+  }
+  portEXIT_CRITICAL(&tap_lock);
+}
+
+/* Makes the pipeline's elements (or none) the ones taps connect to */
+static void taps_publish(const audio_pipeline_components_t *components) {
+  portENTER_CRITICAL(&tap_lock);
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    tap_elements[i] = NULL;
+  }
+  if (components) {
+    tap_elements[PIPELINE_STAGE_SOURCE] = components->http_stream_reader;
+    tap_elements[PIPELINE_STAGE_I2S] = components->i2s_stream_writer;
+  }
+  for (int i = 0; i < PIPELINE_TAP_COUNT; i++) {
+    tap_connected[i] = false;
+  }
+  portEXIT_CRITICAL(&tap_lock);
+}
+
+/* ---------- stages ---------- */
+
+// What a pipeline is built for
+typedef struct {
+  codec_type_t codec;
+  bool follower; // the decoder reads the multi-room leader's stream
+  bool local;    // the decoder reads a file (local_media.h)
+  bool hls;
+} build_ctx_t;
+
+// What a stage takes once it runs
+typedef struct {
+  int task_stack;
+  bool stack_in_ext; // the stack is in PSRAM
+  int out_rb_size;   // ring to the next stage, PSRAM when there is some
+  uint32_t internal; // anything else, in internal RAM
+  uint32_t psram;    // and in PSRAM
+} stage_sizes_t;
+
+typedef struct {
+  const char *tag; // in the ADF pipeline, and so the name of its task
+  size_t handle;   // offset of its element in audio_pipeline_components_t
+  bool optional;   // create() returns NULL when it has nothing to do
+  // Whether the station needs the stage; if not, it is never created
+  bool (*wanted)(const build_ctx_t *ctx);
+  audio_element_handle_t (*create)(const build_ctx_t *ctx,
+                                   const pipeline_stage_t *st,
+                                   const char *uri);
+  void (*sizes)(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                stage_sizes_t *s);
+} stage_type_t;
+
+static void element_sizes(stage_sizes_t *s, int task_stack) {
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  s->task_stack = task_stack;
+  s->stack_in_ext = cfg.stack_in_ext;
+  s->out_rb_size = cfg.out_rb_size;
+}
+
+static bool source_wanted(const build_ctx_t *ctx) {
+  return !ctx->follower && !ctx->local;
+}
+
+static audio_element_handle_t source_create(const build_ctx_t *ctx,
+                                            const pipeline_stage_t *st,
+                                            const char *uri) {
+  int slots = tap_slots(PIPELINE_STAGE_SOURCE);
+  if (ctx->hls) {
+    if (st->core >= 0 || st->stack) {
+      ESP_LOGW(TAG, "The HLS source keeps its own core and stack");
+    }
+    return hls_stream_init(ctx->codec, slots);
+  }
+  http_stream_cfg_t http_cfg = HTTP_STREAM_CFG_DEFAULT();
+  http_cfg.event_handle = _http_stream_event_handle;
+  http_cfg.type = AUDIO_STREAM_READER;
+  http_cfg.enable_playlist_parser = true;
+  http_cfg.multi_out_num = slots;
+  if (st->core >= 0) {
+    http_cfg.task_core = st->core;
+  }
+  if (st->stack) {
+    http_cfg.task_stack = st->stack;
+  }
+  return http_stream_init(&http_cfg);
+}
+
+static void source_sizes(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                         stage_sizes_t *s) {
+  if (ctx->hls) {
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    hls_stream_sizes(&s->task_stack, &s->out_rb_size, &s->internal,
+                     &s->psram);
+    s->stack_in_ext = cfg.stack_in_ext;
+    return;
+  }
+  http_stream_cfg_t cfg = HTTP_STREAM_CFG_DEFAULT();
+  s->task_stack = cfg.task_stack;
+  s->stack_in_ext = cfg.stack_in_ext;
+  s->out_rb_size = cfg.out_rb_size;
+}
+
+// Time-shift sits between the station and the decoder; it can't while
+// multi-room pacing follows the leader's schedule
+static bool shift_wanted(const build_ctx_t *ctx) {
+  return source_wanted(ctx) && !multiroom_paces(ctx->codec);
+}
+
+static audio_element_handle_t shift_create(const build_ctx_t *ctx,
+                                           const pipeline_stage_t *st,
+                                           const char *uri) {
+  return timeshift_element_init(ctx->codec);
+}
+
+// Its ring is kept from station to station, and is given up on its own
+// if there is no room for it
+static void shift_sizes(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                        stage_sizes_t *s) {
+  if (g_runtime_config.timeshift_minutes > 0) {
+    element_sizes(s, TIMESHIFT_ELEMENT_STACK);
+  }
+}
+
+static bool always_wanted(const build_ctx_t *ctx) { return true; }
+
+static audio_element_handle_t codec_create(const build_ctx_t *ctx,
+                                           const pipeline_stage_t *st,
+                                           const char *uri) {
+  decoder_desc_t d = *decoder_registry_find(ctx->codec);
+  if (st->core >= 0) {
+    d.task_core = st->core;
+  }
+  if (st->stack) {
+    d.task_stack = st->stack;
+  }
+  audio_element_handle_t el = decoder_registry_create(&d);
+  if (el == NULL) {
+    return NULL;
+  }
+  // codec callback filters for music info (sample rate, bits, channels) and
+  // sets i2s stream clock
+  audio_element_set_event_callback(el, codec_event_cb, NULL);
+  // A follower's decoder reads the leader's stream through a callback, a
+  // local file's decoder the read-ahead ring
+  if (ctx->follower) {
+    multiroom_source_prepare();
+    audio_element_set_read_cb(el, multiroom_source_read, NULL);
+  } else if (ctx->local) {
+    if (local_media_source_prepare(uri) != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to open %s", uri);
+      audio_element_deinit(el);
+      return NULL;
+    }
+    audio_element_set_read_cb(el, local_media_source_read, NULL);
+  }
+  return el;
+}
+
+static void codec_sizes(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                        stage_sizes_t *s) {
+  decoder_sizes_t ds;
+  decoder_registry_sizes(decoder_registry_find(ctx->codec), &ds);
+  s->task_stack = ds.task_stack;
+  s->stack_in_ext = ds.stack_in_ext;
+  s->out_rb_size = ds.out_rb_size;
+}
+
+// Multi-room playback is paced between the decoder and the I2S writer;
+// local files are not shared
+static bool sync_wanted(const build_ctx_t *ctx) {
+  return !ctx->local && multiroom_paces(ctx->codec);
+}
+
+static audio_element_handle_t sync_create(const build_ctx_t *ctx,
+                                          const pipeline_stage_t *st,
+                                          const char *uri) {
+  return multiroom_playout_init();
+}
+
+static void sync_sizes(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                       stage_sizes_t *s) {
+  element_sizes(s, MULTIROOM_PLAYOUT_STACK);
+}
+
+static audio_element_handle_t i2s_create(const build_ctx_t *ctx,
+                                         const pipeline_stage_t *st,
+                                         const char *uri) {
+#if defined CONFIG_ESP32_C3_LYRA_V2_BOARD
+  i2s_stream_cfg_t i2s_cfg = I2S_STREAM_PDM_TX_CFG_DEFAULT();
+#else
+  i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
+#endif
+  i2s_cfg.type = AUDIO_STREAM_WRITER;
+  i2s_cfg.multi_out_num = tap_slots(PIPELINE_STAGE_I2S);
+  if (st->core >= 0) {
+    i2s_cfg.task_core = st->core;
+  }
+  if (st->stack) {
+    i2s_cfg.task_stack = st->stack;
+  }
+  return i2s_stream_init(&i2s_cfg);
+}
+
+static void i2s_sizes(const build_ctx_t *ctx, const pipeline_stage_t *st,
+                      stage_sizes_t *s) {
+#if defined CONFIG_ESP32_C3_LYRA_V2_BOARD
+  i2s_stream_cfg_t cfg = I2S_STREAM_PDM_TX_CFG_DEFAULT();
+#else
+  i2s_stream_cfg_t cfg = I2S_STREAM_CFG_DEFAULT();
+#endif
+  s->task_stack = cfg.task_stack;
+  s->stack_in_ext = cfg.stack_in_ext;
+  s->out_rb_size = 0; // the last stage
+}
+
+#define HANDLE(field) offsetof(audio_pipeline_components_t, field)
+
+static const stage_type_t stage_types[PIPELINE_STAGE_COUNT] = {
+    [PIPELINE_STAGE_SOURCE] = {"http", HANDLE(http_stream_reader), false,
+                               source_wanted, source_create, source_sizes},
+    [PIPELINE_STAGE_SHIFT] = {"shift", HANDLE(time_shift), true, shift_wanted,
+                              shift_create, shift_sizes},
+    [PIPELINE_STAGE_CODEC] = {DECODER_TAG, HANDLE(codec_decoder), false,
+                              always_wanted, codec_create, codec_sizes},
+    [PIPELINE_STAGE_SYNC] = {"sync", HANDLE(sync_playout), false, sync_wanted,
+                             sync_create, sync_sizes},
+    [PIPELINE_STAGE_I2S] = {"i2s", HANDLE(i2s_stream_writer), false,
+                            always_wanted, i2s_create, i2s_sizes},
+};
+
+static audio_element_handle_t *stage_handle(audio_pipeline_components_t *c,
+                                            pipeline_stage_type_t type) {
+  return (audio_element_handle_t *)((char *)c + stage_types[type].handle);
+}
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static pipeline_build_stats_t stats;
+
+/* Memory the stages of a graph the station needs take once they run */
+static void estimate(const build_ctx_t *ctx, const pipeline_graph_t *g,
+                     pipeline_budget_t *need) {
+  *need = (pipeline_budget_t){0};
+  int last = -1;
+  for (int i = 0; i < g->count; i++) {
+    if (stage_types[g->stages[i].type].wanted(ctx)) {
+      last = i;
+    }
+  }
+  for (int i = 0; i <= last; i++) {
+    const pipeline_stage_t *st = &g->stages[i];
+    const stage_type_t *type = &stage_types[st->type];
+    if (!type->wanted(ctx)) {
+      continue;
+    }
+    stage_sizes_t s = {0};
+    type->sizes(ctx, st, &s);
+    if (st->stack) {
+      s.task_stack = st->stack;
+    }
+    if (st->rb) {
+      s.out_rb_size = st->rb;
+    }
+    if (s.stack_in_ext) {
+      need->psram += s.task_stack;
+    } else {
+      need->internal += s.task_stack;
+      need->largest_internal =
+          MAX(need->largest_internal, (uint32_t)s.task_stack);
+    }
+    // No ring follows the last stage
+    if (i < last) {
+      need->psram += s.out_rb_size;
+    }
+    need->internal += s.internal;
+    need->psram += s.psram;
+  }
+}
+
+typedef struct {
+  const build_ctx_t *ctx;
+  pipeline_budget_t need; // of the graph last tried
+} fit_arg_t;
+
+/* Whether the stages would leave the reserves free */
+static bool fits(const pipeline_graph_t *g, void *arg) {
+  fit_arg_t *fit = arg;
+  estimate(fit->ctx, g, &fit->need);
+  bool has_psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+  pipeline_budget_t free_mem = {
+      .internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+      .psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+      .largest_internal = heap_caps_get_largest_free_block(
+          MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT),
+  };
+  switch (pipeline_budget_check(&fit->need, &free_mem, has_psram)) {
+  case PIPELINE_SHORT_OF_PSRAM:
+    ESP_LOGW(TAG, "Pipeline needs %" PRIu32 " KB of PSRAM, %" PRIu32
+             " KB free", fit->need.psram / 1024, free_mem.psram / 1024);
+    return false;
+  case PIPELINE_SHORT_OF_INTERNAL:
+    // Without PSRAM, rings and the rest go to internal RAM too
+    ESP_LOGW(TAG, "Pipeline needs %" PRIu32 " KB of internal RAM, %" PRIu32
+             " KB free",
+             (fit->need.internal + (has_psram ? 0 : fit->need.psram)) / 1024,
+             free_mem.internal / 1024);
+    return false;
+  default:
+    return true;
+  }
+}
+
+/* The configured graph if it parses and fits, or else the default */
+static void choose_graph(const build_ctx_t *ctx, pipeline_graph_t *g) {
+  char err[PIPELINE_GRAPH_ERROR_LEN];
+  fit_arg_t fit = {.ctx = ctx};
+  pipeline_choice_t choice = pipeline_graph_choose(
+      g_runtime_config.pipeline_graph, fits, &fit, g, err, sizeof(err));
+  bool fallback = choice != PIPELINE_GRAPH_CONFIGURED;
+  if (choice == PIPELINE_GRAPH_REJECTED) {
+    ESP_LOGW(TAG, "Pipeline graph rejected (%s), using the default", err);
+  } else if (choice == PIPELINE_GRAPH_TOO_BIG) {
+    ESP_LOGW(TAG, "Pipeline graph does not fit, using the default");
+  }
+  // The default is tried anyway: it is what always played, and a stage
+  // that can't be allocated fails cleanly
+  if (fallback && !fits(g, &fit)) {
+    ESP_LOGW(TAG, "Short of memory even for the default pipeline");
+  }
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    if (stage_types[i].wanted(ctx) && !stage_types[i].optional &&
+        pipeline_graph_find(g, i) == NULL) {
+      ESP_LOGW(TAG, "Pipeline graph leaves out %s, which this station needs",
+               pipeline_stage_name(i));
+    }
+  }
+
+  portENTER_CRITICAL(&stats_lock);
+  pipeline_graph_format(g, stats.graph, sizeof(stats.graph));
+  stats.fallback = fallback;
+  stats.fallbacks += fallback;
+  stats.internal = fit.need.internal;
+  stats.psram = fit.need.psram;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void audio_pipeline_get_stats(pipeline_build_stats_t *out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+  portENTER_CRITICAL(&tap_lock);
+  out->taps = 0;
+  for (int i = 0; i < PIPELINE_TAP_COUNT; i++) {
+    out->taps += tap_connected[i];
+  }
+  portEXIT_CRITICAL(&tap_lock);
+}
+
+/* ---------- pipeline ---------- */
+
 esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
                                 codec_type_t codec_type, const char *uri) {
 
@@ -96,6 +526,10 @@ esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
     ESP_LOGE(TAG, "URI is NULL");
     return ESP_ERR_INVALID_ARG;
   }
+  if (decoder_registry_find(codec_type) == NULL) {
+    ESP_LOGE(TAG, "Unsupported codec type: %d", codec_type);
+    return ESP_ERR_INVALID_ARG;
+  }
   // board works here
   esp_err_t ret = ESP_OK;
 
@@ -107,6 +541,24 @@ esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
   strncpy(components->current_uri, uri, sizeof(components->current_uri) - 1);
   components->current_uri[sizeof(components->current_uri) - 1] = '\0';
 
+  build_ctx_t ctx = {
+      .codec = codec_type,
+      .follower = multiroom_is_source_uri(uri),
+      .local = local_media_is_source_uri(uri),
+  };
+  ctx.hls = source_wanted(&ctx) && hls_stream_is_source_uri(uri);
+  // The elements registered with the pipeline are deinitialized with it
+  bool registered[PIPELINE_STAGE_COUNT] = {false};
+
+  if (tap_parking == NULL) {
+    tap_parking = rb_create(TAP_PARKING_SIZE, 1);
+  }
+  // Lets the idle task free the stacks of a pipeline just destroyed before
+  // free memory is measured
+  vTaskDelay(1);
+  pipeline_graph_t graph;
+  choose_graph(&ctx, &graph);
+
   audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
   //   pipeline_cfg.rb_size = 64 * 1024;
   components->pipeline = audio_pipeline_init(&pipeline_cfg);
@@ -116,126 +568,88 @@ esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
     goto cleanup;
   }
 
-  http_stream_cfg_t http_cfg = HTTP_STREAM_CFG_DEFAULT();
-  http_cfg.event_handle = _http_stream_event_handle;
-  http_cfg.type = AUDIO_STREAM_READER;
-  http_cfg.enable_playlist_parser = true;
-  components->http_stream_reader = http_stream_init(&http_cfg);
-  if (components->http_stream_reader == NULL) {
-    ESP_LOGE(TAG, "Failed to initialize HTTP stream reader");
-    ret = ESP_FAIL;
-    goto cleanup;
-  }
-  // // custom reader to skip junk data before mp3 frames in shoutcast streams
-  // // this should be switchable.
-  // audio_element_set_read_cb(components->http_stream_reader, custom_read,
-  // NULL);
-
-#if defined CONFIG_ESP32_C3_LYRA_V2_BOARD
-  i2s_stream_cfg_t i2s_cfg = I2S_STREAM_PDM_TX_CFG_DEFAULT();
-#else
-  i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
-#endif
-  i2s_cfg.type = AUDIO_STREAM_WRITER;
-  components->i2s_stream_writer = i2s_stream_init(&i2s_cfg);
-  if (components->i2s_stream_writer == NULL) {
-    ESP_LOGE(TAG, "Failed to initialize I2S stream writer");
-    ret = ESP_FAIL;
-    goto cleanup;
+  // Stages the station doesn't need are never created
+  const char *link_tag[PIPELINE_STAGE_COUNT];
+  int link_count = 0;
+  for (int i = 0; i < graph.count; i++) {
+    const pipeline_stage_t *st = &graph.stages[i];
+    const stage_type_t *type = &stage_types[st->type];
+    if (!type->wanted(&ctx)) {
+      continue;
+    }
+    audio_element_handle_t el = type->create(&ctx, st, uri);
+    if (el == NULL) {
+      if (type->optional) {
+        continue;
+      }
+      ESP_LOGE(TAG, "Failed to create the %s stage",
+               pipeline_stage_name(st->type));
+      ret = ESP_FAIL;
+      goto cleanup;
+    }
+    *stage_handle(components, st->type) = el;
+    if (st->rb) {
+      audio_element_set_output_ringbuf_size(el, st->rb);
+    }
+    if (audio_pipeline_register(components->pipeline, el, type->tag) !=
+        ESP_OK) {
+      ESP_LOGE(TAG, "Failed to register %s to the pipeline", type->tag);
+      ret = ESP_FAIL;
+      goto cleanup;
+    }
+    registered[st->type] = true;
+    link_tag[link_count++] = type->tag;
   }
 
-  switch (codec_type) {
-  case CODEC_TYPE_AAC:
-    ESP_LOGD(TAG, "Creating AAC decoder");
-    aac_decoder_cfg_t aac_cfg = DEFAULT_AAC_DECODER_CONFIG();
-    aac_cfg.task_core = 1; // unacceptable clicking a popping on KXLU
-    aac_cfg.plus_enable = true;
-    components->codec_decoder = aac_decoder_init(&aac_cfg);
-    break;
-  case CODEC_TYPE_MP3:
-    ESP_LOGD(TAG, "Creating MP3 decoder");
-    mp3_decoder_cfg_t mp3_cfg = DEFAULT_MP3_DECODER_CONFIG();
-    mp3_cfg.task_core = 1;
-    components->codec_decoder = mp3_decoder_init(&mp3_cfg);
-    break;
-  case CODEC_TYPE_OGG:
-    ESP_LOGD(TAG, "Creating OGG decoder");
-    ogg_decoder_cfg_t ogg_cfg = DEFAULT_OGG_DECODER_CONFIG();
-    ogg_cfg.task_core = 1;
-    components->codec_decoder = ogg_decoder_init(&ogg_cfg);
-    break;
-  case CODEC_TYPE_FLAC:
-    ESP_LOGD(TAG, "Creating FLAC decoder");
-    flac_decoder_cfg_t flac_cfg = DEFAULT_FLAC_DECODER_CONFIG();
-    flac_cfg.task_core = 1;
-    components->codec_decoder = flac_decoder_init(&flac_cfg);
-    break;
-  default:
-    ESP_LOGE(TAG, "Unsupported codec type: %d", codec_type);
-    ret = ESP_ERR_INVALID_ARG;
-    goto cleanup;
-  }
-  if (components->codec_decoder == NULL) {
-    ESP_LOGE(TAG, "Failed to initialize %s decoder",
-             codec_type_to_string(codec_type));
-    ret = ESP_FAIL;
-    goto cleanup;
-  }
-  // codec callback filters for music info (sample rate, bits, channels) and
-  // sets i2s stream clock
-  audio_element_set_event_callback(components->codec_decoder, codec_event_cb,
-                                   NULL);
-
-  if (audio_pipeline_register(components->pipeline,
-                              components->http_stream_reader,
-                              "http") != ESP_OK ||
-      audio_pipeline_register(components->pipeline, components->codec_decoder,
-                              "codec") != ESP_OK ||
-      audio_pipeline_register(components->pipeline,
-                              components->i2s_stream_writer, "i2s") != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to register audio elements to pipeline");
+  if (audio_pipeline_link(components->pipeline, &link_tag[0], link_count) !=
+      ESP_OK) {
+    ESP_LOGE(TAG, "Failed to link the %d pipeline elements from %s",
+             link_count, link_tag[0]);
     ret = ESP_FAIL;
     goto cleanup;
   }
 
-  const char *link_tag[3] = {"http", "codec", "i2s"};
-  if (audio_pipeline_link(components->pipeline, &link_tag[0], 3) != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to link pipeline elements: http->%s->i2s",
-             codec_type_to_string(codec_type));
+  if (components->http_stream_reader &&
+      audio_element_set_uri(components->http_stream_reader, uri) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set URI for http_stream_reader");
     ret = ESP_FAIL;
     goto cleanup;
   }
 
-  if (audio_element_set_uri(components->http_stream_reader, uri) != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to set URI for http_stream_reader");
-    ret = ESP_FAIL;
-    goto cleanup;
+  taps_publish(components);
+  visualizer_attach();
+  if (components->http_stream_reader) {
+    stream_relay_attach(codec_type);
+    multiroom_attach(codec_type);
+    recorder_attach(codec_type);
   }
 
-  ESP_LOGI(TAG, "Audio pipeline with %s codec created successfully",
-           codec_type_to_string(codec_type));
+  portENTER_CRITICAL(&stats_lock);
+  stats.active = true;
+  stats.stages = link_count;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "Audio pipeline with %s codec created successfully: %d stages",
+           codec_type_to_string(codec_type), link_count);
   return ESP_OK;
 
 cleanup:
   ESP_LOGE(
       TAG,
       "Cleaning up audio pipeline components due to error during creation");
-  if (components->http_stream_reader) {
-    audio_element_deinit(components->http_stream_reader);
-    components->http_stream_reader = NULL;
-  }
-  if (components->codec_decoder) {
-    audio_element_deinit(components->codec_decoder);
-    components->codec_decoder = NULL;
-  }
-  if (components->i2s_stream_writer) {
-    audio_element_deinit(components->i2s_stream_writer);
-    components->i2s_stream_writer = NULL;
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    audio_element_handle_t *el = stage_handle(components, i);
+    if (*el && !registered[i]) {
+      audio_element_deinit(*el);
+    }
+    *el = NULL;
   }
   if (components->pipeline) {
     audio_pipeline_deinit(components->pipeline);
     components->pipeline = NULL;
   }
+  if (ctx.local) {
+    local_media_source_close();
+  }
   return ret;
 }
 
@@ -247,6 +661,11 @@ esp_err_t destroy_audio_pipeline(audio_pipeline_components_t *components) {
 
   ESP_LOGI(TAG, "Destroying audio pipeline");
 
+  // No tap is connected to the elements from here on
+  taps_publish(NULL);
+  stream_relay_detach();
+  multiroom_detach();
+  recorder_detach();
   if (components->pipeline) {
     audio_pipeline_stop(components->pipeline);
     audio_pipeline_wait_for_stop(components->pipeline);
@@ -254,9 +673,16 @@ esp_err_t destroy_audio_pipeline(audio_pipeline_components_t *components) {
     audio_pipeline_deinit(components->pipeline); // deinits all elements
     components->pipeline = NULL;
   }
-  components->http_stream_reader = NULL;
-  components->codec_decoder = NULL;
-  components->i2s_stream_writer = NULL;
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    *stage_handle(components, i) = NULL;
+  }
+  g_stream_buffer_fill = 0;
+  portENTER_CRITICAL(&stats_lock);
+  stats.active = false;
+  stats.stages = 0;
+  portEXIT_CRITICAL(&stats_lock);
+  // The decoder that read the file is gone
+  local_media_source_close();
 
   ESP_LOGI(TAG, "Audio pipeline destroyed successfully");
   return ESP_OK;
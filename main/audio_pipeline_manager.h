@@ -5,6 +5,9 @@
 #include "audio_pipeline.h"
 #include "audio_event_iface.h"
 #include "esp_err.h"
+#include "pipeline_graph.h"
+#include "ringbuf.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -12,13 +15,17 @@ extern "C" {
 #endif
 
 /**
- * @brief Enumeration for supported audio codec types.
+ * @brief Enumeration for supported audio codec types. The values are stored
+ * with the stations: new codecs go at the end, with an entry in the decoder
+ * registry (decoder_registry.h).
  */
 typedef enum {
   CODEC_TYPE_MP3,
   CODEC_TYPE_AAC,
   CODEC_TYPE_OGG,
-  CODEC_TYPE_FLAC
+  CODEC_TYPE_FLAC,
+  CODEC_TYPE_OPUS, // Ogg Opus
+  CODEC_TYPE_COUNT // not a codec
 } codec_type_t;
 
 /**
@@ -26,26 +33,68 @@ typedef enum {
  */
 typedef struct {
   audio_pipeline_handle_t pipeline;
-  audio_element_handle_t http_stream_reader;
+  audio_element_handle_t http_stream_reader; // or the HLS source
+  audio_element_handle_t time_shift;   // time-shift buffer, NULL if unused
   audio_element_handle_t codec_decoder;
+  audio_element_handle_t sync_playout; // multi-room pacing, NULL if unused
   audio_element_handle_t i2s_stream_writer;
   codec_type_t current_codec;
   char current_uri[256];
 } audio_pipeline_components_t;
 
+/**
+ * @brief Taps: rings a stage copies what it outputs to, besides passing it
+ * on, without ever waiting for them. Each tap has its slot on its stage.
+ */
+typedef enum {
+  PIPELINE_TAP_RELAY,      // compressed stream at the source, LAN relay
+  PIPELINE_TAP_MULTIROOM,  // compressed stream at the source, followers
+  PIPELINE_TAP_RECORDER,   // compressed stream at the source, SD card
+  PIPELINE_TAP_VISUALIZER, // PCM at the I2S writer
+  PIPELINE_TAP_COUNT
+} pipeline_tap_t;
+
+/**
+ * @brief How the pipeline that plays was built.
+ */
+typedef struct {
+  bool active;
+  char graph[PIPELINE_GRAPH_MAX_LEN]; // as built, before unwanted stages
+  bool fallback;     // the configured graph was rejected or didn't fit
+  uint8_t stages;    // elements built
+  uint8_t taps;      // connected
+  uint32_t internal; // bytes of internal RAM it was estimated to take
+  uint32_t psram;    // and of PSRAM
+  uint32_t fallbacks; // since boot
+} pipeline_build_stats_t;
+
 /**
  * @brief Global counter for bytes read from the HTTP stream.
  */
 extern volatile uint64_t g_bytes_read;
 
 /**
- * @brief Converts a codec_type_t enum to its string representation.
+ * @brief Fill level of the buffer after the HTTP stream, in percent. Updated
+ * as data arrives, 0 while no pipeline exists.
+ */
+extern volatile int g_stream_buffer_fill;
+
+/**
+ * @brief Converts a codec_type_t enum to its string representation, the
+ * name in its decoder registry entry.
  */
 const char *codec_type_to_string(codec_type_t codec);
 
 /**
  * @brief Creates and configures an audio pipeline with the specified codec and
- * URI.
+ * URI. With MULTIROOM_SOURCE_URI the decoder reads the multi-room leader's
+ * stream instead of an HTTP stream, with a LOCAL_MEDIA_URI_PREFIX URI the
+ * file (local_media.h), and with an .m3u8 URI the HLS source stands in for
+ * the HTTP stream (hls_stream.h).
+ *
+ * The stages are those of g_runtime_config.pipeline_graph (pipeline_graph.h)
+ * that the station needs. If the graph would not leave enough free internal
+ * RAM or PSRAM, the default graph is built instead.
  */
 esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
                                 codec_type_t codec_type, const char *uri);
@@ -56,6 +105,24 @@ esp_err_t create_audio_pipeline(audio_pipeline_components_t *components,
  */
 esp_err_t destroy_audio_pipeline(audio_pipeline_components_t *components);
 
+/**
+ * @brief Connects a tap to the pipeline that plays; it stays connected
+ * until removed or the pipeline is destroyed. Safe from any task.
+ * @return ESP_ERR_INVALID_STATE if no pipeline has the tap's stage.
+ */
+esp_err_t audio_pipeline_tap_insert(pipeline_tap_t tap, ringbuf_handle_t rb);
+
+/**
+ * @brief Disconnects a tap while the pipeline plays on: its ring is not
+ * written to any more.
+ */
+void audio_pipeline_tap_remove(pipeline_tap_t tap);
+
+/**
+ * @brief Copies the build figures.
+ */
+void audio_pipeline_get_stats(pipeline_build_stats_t *stats);
+
 /**
  * @brief Prepares the pipeline for sleep and enters light sleep.
  * @param components Pointer to audio pipeline components.
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Writes the audio of the decode benchmark's clip as a WAV file.
+
+Usage: synth_clip.py OUTPUT.wav
+
+20 s of 48 kHz stereo that keeps a music codec busy the way a station does:
+chords of decaying harmonic notes, a bass line, noise hi-hats and a kick,
+panned apart. Silence or a sine would be coded in a few bits and decode
+faster than anything on air. The signal is the same on every build, so
+figures from different builds compare.
+"""
+
+import array
+import math
+import random
+import sys
+import wave
+
+RATE = 48000
+SECONDS = 20
+BEAT = RATE // 4  # an eighth note at 120 bpm
+CHORDS = [(57, 60, 64), (53, 57, 60), (55, 59, 62), (52, 55, 59)]
+
+
+def freq(note):
+    return 440.0 * 2 ** ((note - 69) / 12)
+
+
+_tones = {}
+
+
+def tone(note, length, harmonics):
+    """A decaying note, made once: the notes repeat."""
+    key = (note, length, harmonics)
+    if key not in _tones:
+        step = 2 * math.pi * freq(note) / RATE
+        _tones[key] = [
+            math.exp(-3.0 * i / length) *
+            sum(math.sin(step * i * h) / h for h in range(1, harmonics + 1))
+            for i in range(length)]
+    return _tones[key]
+
+
+def add_note(left, right, start, note, length, level, pan, harmonics):
+    samples = tone(note, length, harmonics)
+    for i in range(min(length, len(left) - start)):
+        v = samples[i] * level
+        left[start + i] += v * (1 - pan)
+        right[start + i] += v * pan
+
+
+def main():
+    rng = random.Random(7)
+    n = RATE * SECONDS
+    left = [0.0] * n
+    right = [0.0] * n
+    for beat in range(n // BEAT):
+        at = beat * BEAT
+        chord = CHORDS[beat // 8 % len(CHORDS)]
+        if beat % 2 == 0:
+            for k, note in enumerate(chord):
+                add_note(left, right, at, note + 12 * (beat % 4 == 0),
+                         2 * BEAT, 0.2, 0.3 + 0.2 * k, 6)
+        add_note(left, right, at, chord[0] - 24, BEAT, 0.4, 0.5, 3)
+        # Hi-hat every eighth, kick on the quarters
+        for i in range(min(BEAT // 6, n - at)):
+            hat = rng.uniform(-1, 1) * 0.12 * math.exp(-8.0 * i * 6 / BEAT)
+            left[at + i] += hat * 0.7
+            right[at + i] += hat
+        if beat % 2 == 0:
+            add_note(left, right, at, 28 - beat % 3, BEAT // 2, 0.5, 0.5, 1)
+    pcm = array.array('h')
+    for l, r in zip(left, right):
+        pcm.append(int(max(-1.0, min(1.0, l)) * 32000))
+        pcm.append(int(max(-1.0, min(1.0, r)) * 32000))
+    if sys.byteorder == 'big':
+        pcm.byteswap()
+    with wave.open(sys.argv[1], 'wb') as w:
+        w.setnchannels(2)
+        w.setsampwidth(2)
+        w.setframerate(RATE)
+        w.writeframes(pcm.tobytes())
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,316 @@
+#include "button_gesture.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdlib.h>
+
+static const char *TAG = "BUTTON_GESTURE";
+
+#define MS_TO_US(ms) ((int64_t)(ms) * 1000)
+// Upper bound on gestures produced by one timer callback
+#define MAX_GESTURES_PER_CALLBACK 4
+
+// ---------------------------------------------------------------------------
+// State machine
+// ---------------------------------------------------------------------------
+
+void button_gesture_fsm_init(button_gesture_fsm_t *fsm,
+                             const button_gesture_timing_t *timing) {
+  fsm->timing = *timing;
+  fsm->state = BUTTON_FSM_IDLE;
+  fsm->raw_pressed = false;
+  fsm->stable_pressed = false;
+  fsm->raw_edge_us = 0;
+  fsm->settle_us = -1;
+  fsm->deadline_us = -1;
+}
+
+void button_gesture_fsm_reset(button_gesture_fsm_t *fsm, bool pressed,
+                              int64_t now_us) {
+  fsm->raw_pressed = pressed;
+  fsm->stable_pressed = pressed;
+  fsm->raw_edge_us = now_us;
+  fsm->settle_us = -1;
+  fsm->deadline_us = -1;
+  fsm->state = pressed ? BUTTON_FSM_SUPPRESSED : BUTTON_FSM_IDLE;
+}
+
+void button_gesture_fsm_edge(button_gesture_fsm_t *fsm, bool pressed,
+                             int64_t now_us) {
+  if (pressed == fsm->raw_pressed) {
+    return;
+  }
+  fsm->raw_pressed = pressed;
+  fsm->raw_edge_us = now_us;
+  // Every edge restarts the debounce window
+  fsm->settle_us = now_us + MS_TO_US(fsm->timing.debounce_ms);
+}
+
+// Applies a debounced level change. 'at_us' is the time of the raw edge that
+// started the change, so gesture timing is not skewed by the debounce delay.
+static button_gesture_t fsm_apply_level(button_gesture_fsm_t *fsm,
+                                        bool pressed, int64_t at_us) {
+  const button_gesture_timing_t *t = &fsm->timing;
+  fsm->stable_pressed = pressed;
+
+  switch (fsm->state) {
+  case BUTTON_FSM_IDLE:
+    if (pressed) {
+      fsm->state = BUTTON_FSM_PRESSED;
+      fsm->deadline_us = t->long_press_ms ? at_us + MS_TO_US(t->long_press_ms)
+                                          : -1;
+    }
+    break;
+  case BUTTON_FSM_PRESSED:
+    if (!pressed) {
+      if (t->double_click_ms) {
+        fsm->state = BUTTON_FSM_WAIT_SECOND;
+        fsm->deadline_us = at_us + MS_TO_US(t->double_click_ms);
+      } else {
+        fsm->state = BUTTON_FSM_IDLE;
+        fsm->deadline_us = -1;
+        return BUTTON_GESTURE_CLICK;
+      }
+    }
+    break;
+  case BUTTON_FSM_LONG_HELD:
+  case BUTTON_FSM_SUPPRESSED:
+    if (!pressed) {
+      fsm->state = BUTTON_FSM_IDLE;
+      fsm->deadline_us = -1;
+    }
+    break;
+  case BUTTON_FSM_WAIT_SECOND:
+    if (pressed) {
+      fsm->state = BUTTON_FSM_SECOND_PRESSED;
+      fsm->deadline_us = -1;
+    }
+    break;
+  case BUTTON_FSM_SECOND_PRESSED:
+    if (!pressed) {
+      fsm->state = BUTTON_FSM_IDLE;
+      return BUTTON_GESTURE_DOUBLE_CLICK;
+    }
+    break;
+  }
+  return BUTTON_GESTURE_NONE;
+}
+
+static button_gesture_t fsm_expire(button_gesture_fsm_t *fsm) {
+  const button_gesture_timing_t *t = &fsm->timing;
+  int64_t expired_at = fsm->deadline_us;
+  fsm->deadline_us = -1;
+
+  switch (fsm->state) {
+  case BUTTON_FSM_PRESSED:
+    fsm->state = BUTTON_FSM_LONG_HELD;
+    if (t->repeat_ms) {
+      fsm->deadline_us = expired_at + MS_TO_US(t->repeat_ms);
+    }
+    return BUTTON_GESTURE_LONG_PRESS;
+  case BUTTON_FSM_LONG_HELD:
+    // Schedule from the previous deadline so repeats do not drift
+    fsm->deadline_us = expired_at + MS_TO_US(t->repeat_ms);
+    return BUTTON_GESTURE_HOLD_REPEAT;
+  case BUTTON_FSM_WAIT_SECOND:
+    fsm->state = BUTTON_FSM_IDLE;
+    return BUTTON_GESTURE_CLICK;
+  default:
+    return BUTTON_GESTURE_NONE;
+  }
+}
+
+button_gesture_t button_gesture_fsm_timeout(button_gesture_fsm_t *fsm,
+                                            int64_t now_us) {
+  if (fsm->settle_us >= 0 && now_us >= fsm->settle_us) {
+    fsm->settle_us = -1;
+    if (fsm->raw_pressed != fsm->stable_pressed) {
+      // A gesture deadline that expired before the edge happened wins
+      if (fsm->deadline_us >= 0 && fsm->deadline_us <= fsm->raw_edge_us) {
+        fsm->settle_us = now_us; // re-apply the level on the next call
+        return fsm_expire(fsm);
+      }
+      button_gesture_t g =
+          fsm_apply_level(fsm, fsm->raw_pressed, fsm->raw_edge_us);
+      if (g != BUTTON_GESTURE_NONE) {
+        return g;
+      }
+    }
+  }
+  // While the level is still settling, a pending edge may cancel the gesture
+  // deadline, so hold it back until the debounce window closes.
+  if (fsm->settle_us >= 0) {
+    return BUTTON_GESTURE_NONE;
+  }
+  if (fsm->deadline_us >= 0 && now_us >= fsm->deadline_us) {
+    return fsm_expire(fsm);
+  }
+  return BUTTON_GESTURE_NONE;
+}
+
+int64_t button_gesture_fsm_next_deadline(const button_gesture_fsm_t *fsm) {
+  if (fsm->settle_us >= 0) {
+    return fsm->settle_us;
+  }
+  return fsm->deadline_us;
+}
+
+const char *button_gesture_to_string(button_gesture_t gesture) {
+  switch (gesture) {
+  case BUTTON_GESTURE_CLICK:
+    return "click";
+  case BUTTON_GESTURE_DOUBLE_CLICK:
+    return "double-click";
+  case BUTTON_GESTURE_LONG_PRESS:
+    return "long-press";
+  case BUTTON_GESTURE_HOLD_REPEAT:
+    return "hold-repeat";
+  default:
+    return "none";
+  }
+}
+
+// ---------------------------------------------------------------------------
+// GPIO interrupt + esp_timer driver
+// ---------------------------------------------------------------------------
+
+struct button_gesture_s {
+  button_gesture_config_t config;
+  button_gesture_fsm_t fsm;
+  esp_timer_handle_t timer;
+  portMUX_TYPE lock;
+};
+
+static bool read_pressed(const struct button_gesture_s *btn) {
+  int level = gpio_get_level(btn->config.gpio);
+  return btn->config.active_low ? (level == 0) : (level != 0);
+}
+
+// Must be called with btn->lock held. esp_timer start/stop are safe from ISR
+// and critical-section context.
+static void rearm_timer_locked(struct button_gesture_s *btn, int64_t now_us) {
+  esp_timer_stop(btn->timer);
+  int64_t deadline = button_gesture_fsm_next_deadline(&btn->fsm);
+  if (deadline >= 0) {
+    int64_t delay = deadline - now_us;
+    esp_timer_start_once(btn->timer, delay > 0 ? (uint64_t)delay : 1);
+  }
+}
+
+static void button_gesture_isr(void *arg) {
+  struct button_gesture_s *btn = (struct button_gesture_s *)arg;
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL_ISR(&btn->lock);
+  button_gesture_fsm_edge(&btn->fsm, read_pressed(btn), now);
+  rearm_timer_locked(btn, now);
+  portEXIT_CRITICAL_ISR(&btn->lock);
+}
+
+static void button_gesture_timer_cb(void *arg) {
+  struct button_gesture_s *btn = (struct button_gesture_s *)arg;
+  button_gesture_t gestures[MAX_GESTURES_PER_CALLBACK];
+  int count = 0;
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&btn->lock);
+  button_gesture_t g;
+  while (count < MAX_GESTURES_PER_CALLBACK &&
+         (g = button_gesture_fsm_timeout(&btn->fsm, now)) !=
+             BUTTON_GESTURE_NONE) {
+    gestures[count++] = g;
+  }
+  rearm_timer_locked(btn, now);
+  portEXIT_CRITICAL(&btn->lock);
+
+  for (int i = 0; i < count; i++) {
+    ESP_LOGD(TAG, "GPIO %d: %s", btn->config.gpio,
+             button_gesture_to_string(gestures[i]));
+    if (btn->config.callback) {
+      btn->config.callback(btn->config.button_id, gestures[i],
+                           btn->config.ctx);
+    }
+  }
+}
+
+esp_err_t button_gesture_create(const button_gesture_config_t *config,
+                                button_gesture_handle_t *out_handle) {
+  if (config == NULL || out_handle == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  struct button_gesture_s *btn = calloc(1, sizeof(struct button_gesture_s));
+  if (btn == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate button state");
+    return ESP_ERR_NO_MEM;
+  }
+  btn->config = *config;
+  portMUX_INITIALIZE(&btn->lock);
+  button_gesture_fsm_init(&btn->fsm, &config->timing);
+  button_gesture_fsm_reset(&btn->fsm, read_pressed(btn), esp_timer_get_time());
+
+  const esp_timer_create_args_t timer_args = {
+      .callback = button_gesture_timer_cb,
+      .arg = btn,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "btn_gesture",
+  };
+  esp_err_t err = esp_timer_create(&timer_args, &btn->timer);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create gesture timer (%s)", esp_err_to_name(err));
+    free(btn);
+    return err;
+  }
+
+  // The ISR service may already have been installed by another driver
+  err = gpio_install_isr_service(0);
+  if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+    ESP_LOGE(TAG, "Failed to install GPIO ISR service (%s)",
+             esp_err_to_name(err));
+    esp_timer_delete(btn->timer);
+    free(btn);
+    return err;
+  }
+
+  gpio_set_intr_type(config->gpio, GPIO_INTR_ANYEDGE);
+  err = gpio_isr_handler_add(config->gpio, button_gesture_isr, btn);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to add ISR handler for GPIO %d (%s)", config->gpio,
+             esp_err_to_name(err));
+    esp_timer_delete(btn->timer);
+    free(btn);
+    return err;
+  }
+  gpio_intr_enable(config->gpio);
+
+  ESP_LOGI(TAG, "Gesture recognizer attached to GPIO %d", config->gpio);
+  *out_handle = btn;
+  return ESP_OK;
+}
+
+void button_gesture_suspend(button_gesture_handle_t handle) {
+  if (handle == NULL) {
+    return;
+  }
+  gpio_intr_disable(handle->config.gpio);
+  portENTER_CRITICAL(&handle->lock);
+  esp_timer_stop(handle->timer);
+  portEXIT_CRITICAL(&handle->lock);
+}
+
+void button_gesture_resume(button_gesture_handle_t handle) {
+  if (handle == NULL) {
+    return;
+  }
+  // Light sleep setup switches the pin to a level-triggered wakeup source;
+  // restore edge interrupts before re-enabling them.
+  gpio_wakeup_disable(handle->config.gpio);
+  gpio_set_intr_type(handle->config.gpio, GPIO_INTR_ANYEDGE);
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&handle->lock);
+  button_gesture_fsm_reset(&handle->fsm, read_pressed(handle), now);
+  rearm_timer_locked(handle, now);
+  portEXIT_CRITICAL(&handle->lock);
+
+  gpio_intr_enable(handle->config.gpio);
+}
@@ -0,0 +1,144 @@
+#ifndef BUTTON_GESTURE_H
+#define BUTTON_GESTURE_H
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Gestures recognized on a push button.
+ */
+typedef enum {
+  BUTTON_GESTURE_NONE = 0,
+  BUTTON_GESTURE_CLICK,
+  BUTTON_GESTURE_DOUBLE_CLICK,
+  BUTTON_GESTURE_LONG_PRESS,
+  BUTTON_GESTURE_HOLD_REPEAT,
+} button_gesture_t;
+
+/**
+ * @brief Timing parameters for gesture recognition.
+ * A value of 0 disables the corresponding gesture (debounce excepted).
+ * With double_click_ms == 0 a click is reported as soon as the button is
+ * released instead of after the double-click window.
+ */
+typedef struct {
+  uint32_t debounce_ms;
+  uint32_t double_click_ms;
+  uint32_t long_press_ms;
+  uint32_t repeat_ms;
+} button_gesture_timing_t;
+
+typedef enum {
+  BUTTON_FSM_IDLE,
+  BUTTON_FSM_PRESSED,
+  BUTTON_FSM_LONG_HELD,
+  BUTTON_FSM_WAIT_SECOND,
+  BUTTON_FSM_SECOND_PRESSED,
+  BUTTON_FSM_SUPPRESSED, // held across a reset; ignored until released
+} button_fsm_state_t;
+
+/**
+ * @brief Gesture state machine. Pure logic with no hardware or OS
+ * dependencies: raw edges and timeouts are fed in with explicit timestamps,
+ * so the same code runs in the ISR/esp_timer driver and on the host.
+ */
+typedef struct {
+  button_gesture_timing_t timing;
+  button_fsm_state_t state;
+  bool raw_pressed;       // last raw level seen
+  bool stable_pressed;    // debounced level
+  int64_t raw_edge_us;    // time of the last raw edge
+  int64_t settle_us;      // debounce deadline, -1 if none
+  int64_t deadline_us;    // gesture deadline, -1 if none
+} button_gesture_fsm_t;
+
+/**
+ * @brief Initializes the state machine in the released, idle state.
+ */
+void button_gesture_fsm_init(button_gesture_fsm_t *fsm,
+                             const button_gesture_timing_t *timing);
+
+/**
+ * @brief Resets the state machine to the current level. If the button is
+ * held, the press is swallowed and no gesture is reported for it.
+ */
+void button_gesture_fsm_reset(button_gesture_fsm_t *fsm, bool pressed,
+                              int64_t now_us);
+
+/**
+ * @brief Feeds a raw (bouncy) edge into the state machine.
+ * Edges never produce a gesture directly; the debounced level is applied by
+ * button_gesture_fsm_timeout() once it has been stable for debounce_ms.
+ */
+void button_gesture_fsm_edge(button_gesture_fsm_t *fsm, bool pressed,
+                             int64_t now_us);
+
+/**
+ * @brief Processes any deadline that has expired at now_us.
+ * Call repeatedly until it returns BUTTON_GESTURE_NONE.
+ * @return The recognized gesture, or BUTTON_GESTURE_NONE.
+ */
+button_gesture_t button_gesture_fsm_timeout(button_gesture_fsm_t *fsm,
+                                            int64_t now_us);
+
+/**
+ * @brief Returns the next time at which button_gesture_fsm_timeout() must be
+ * called, or -1 if the state machine is waiting only for edges.
+ */
+int64_t button_gesture_fsm_next_deadline(const button_gesture_fsm_t *fsm);
+
+/**
+ * @brief Returns a short name for a gesture (for logging).
+ */
+const char *button_gesture_to_string(button_gesture_t gesture);
+
+typedef struct button_gesture_s *button_gesture_handle_t;
+
+/**
+ * @brief Called from the esp_timer task when a gesture is recognized.
+ * Keep it short: post to a queue rather than doing work here.
+ */
+typedef void (*button_gesture_cb_t)(int button_id, button_gesture_t gesture,
+                                    void *ctx);
+
+typedef struct {
+  gpio_num_t gpio;
+  bool active_low;
+  int button_id;
+  button_gesture_timing_t timing;
+  button_gesture_cb_t callback;
+  void *ctx;
+} button_gesture_config_t;
+
+/**
+ * @brief Attaches a gesture recognizer to a GPIO.
+ * The GPIO is driven by an any-edge interrupt and a single esp_timer one-shot
+ * that fires only when a debounce or gesture deadline is pending, so an idle
+ * button costs no CPU wakeups.
+ */
+esp_err_t button_gesture_create(const button_gesture_config_t *config,
+                                button_gesture_handle_t *out_handle);
+
+/**
+ * @brief Disables the button interrupt (e.g. before the GPIO is reconfigured
+ * as a light sleep wakeup source).
+ */
+void button_gesture_suspend(button_gesture_handle_t handle);
+
+/**
+ * @brief Restores edge interrupts after suspend/light sleep. A press that is
+ * still held (e.g. the one that woke the device) is ignored.
+ */
+void button_gesture_resume(button_gesture_handle_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BUTTON_GESTURE_H
@@ -0,0 +1,171 @@
+#include "decoder_bench.h"
+#include "decoder_registry.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "DECODER_BENCH";
+
+#define OGG_PAGE_HEADER 27
+#define OPUS_RATE 48000  // of the decoder's output and of granule positions
+#define PCM_BYTES 2      // per sample, as ADF's decoders put out
+
+typedef struct {
+  const uint8_t *clip;
+  size_t len;
+  size_t pos;
+  uint32_t pcm_rate; // bytes a second
+  int64_t start_us;  // first read
+  int64_t last_us;   // last read or write
+  uint64_t pcm_bytes;
+  uint32_t worst_permille;
+} bench_run_t;
+
+static uint64_t get_le64(const uint8_t *b) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = v << 8 | b[i];
+  }
+  return v;
+}
+
+/* Channels and length of an Ogg Opus clip: OpusHead on the first page,
+ * and the granule position of the last one less the pre-skip (RFC 7845).
+ * A page cut off at the end is left out. */
+static bool opus_clip_info(const uint8_t *clip, size_t len, int *channels,
+                           uint32_t *audio_ms) {
+  uint64_t granule = 0;
+  uint16_t pre_skip = 0;
+  *channels = 0;
+  size_t pos = 0;
+  while (pos + OGG_PAGE_HEADER <= len) {
+    const uint8_t *page = clip + pos;
+    if (memcmp(page, "OggS", 4) != 0) {
+      return false;
+    }
+    size_t segments = page[26];
+    size_t body = 0;
+    for (size_t i = 0; i < segments && pos + OGG_PAGE_HEADER + i < len; i++) {
+      body += page[OGG_PAGE_HEADER + i];
+    }
+    size_t body_pos = pos + OGG_PAGE_HEADER + segments;
+    if (body_pos + body > len) {
+      break;
+    }
+    if (pos == 0) {
+      if (body < 19 || memcmp(clip + body_pos, "OpusHead", 8) != 0) {
+        return false;
+      }
+      *channels = clip[body_pos + 9];
+      pre_skip = clip[body_pos + 10] | clip[body_pos + 11] << 8;
+    }
+    uint64_t g = get_le64(page + 6);
+    if (g != UINT64_MAX) {
+      granule = g;
+    }
+    pos = body_pos + body;
+  }
+  if (*channels == 0 || granule <= pre_skip) {
+    return false;
+  }
+  *audio_ms = (granule - pre_skip) * 1000 / OPUS_RATE;
+  return *audio_ms > 0;
+}
+
+static audio_element_err_t bench_read(audio_element_handle_t el, char *buf,
+                                      int len, TickType_t wait, void *ctx) {
+  bench_run_t *r = ctx;
+  if (r->start_us == 0) {
+    r->start_us = esp_timer_get_time();
+    r->last_us = r->start_us;
+  }
+  size_t n = MIN((size_t)len, r->len - r->pos);
+  if (n == 0) {
+    return AEL_IO_DONE;
+  }
+  memcpy(buf, r->clip + r->pos, n);
+  r->pos += n;
+  return n;
+}
+
+static audio_element_err_t bench_write(audio_element_handle_t el, char *buf,
+                                       int len, TickType_t wait, void *ctx) {
+  bench_run_t *r = ctx;
+  int64_t now = esp_timer_get_time();
+  // Time since the last chunk out, against this one's playing time
+  uint64_t play_us = (uint64_t)len * 1000000 / r->pcm_rate;
+  if (play_us > 0 && r->pcm_bytes > 0) {
+    uint32_t permille = (now - r->last_us) * 1000 / play_us;
+    r->worst_permille = MAX(r->worst_permille, permille);
+  }
+  r->last_us = now;
+  r->pcm_bytes += len;
+  return len;
+}
+
+/* One pass over the clip with a new decoder, as a station change makes */
+static esp_err_t bench_run(const decoder_desc_t *d, bench_run_t *r) {
+  audio_element_handle_t el = decoder_registry_create(d);
+  if (el == NULL) {
+    return ESP_FAIL;
+  }
+  audio_element_set_read_cb(el, bench_read, r);
+  audio_element_set_write_cb(el, bench_write, r);
+  esp_err_t err = audio_element_run(el);
+  if (err == ESP_OK) {
+    err = audio_element_resume(el, 0, portMAX_DELAY);
+  }
+  if (err == ESP_OK) {
+    audio_element_wait_for_stop(el);
+  }
+  audio_element_deinit(el);
+  return err == ESP_OK && r->pcm_bytes > 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t decoder_bench_opus(const uint8_t *clip, size_t len, int runs,
+                             decoder_bench_result_t *result) {
+  memset(result, 0, sizeof(*result));
+  int channels;
+  uint32_t audio_ms;
+  if (!opus_clip_info(clip, len, &channels, &audio_ms)) {
+    ESP_LOGE(TAG, "The clip is not Ogg Opus");
+    return ESP_ERR_INVALID_ARG;
+  }
+  const decoder_desc_t *d = decoder_registry_find(CODEC_TYPE_OPUS);
+  result->audio_ms = audio_ms;
+  result->channels = channels;
+  for (int i = 0; i < runs; i++) {
+    bench_run_t r = {.clip = clip,
+                     .len = len,
+                     .pcm_rate = OPUS_RATE * channels * PCM_BYTES};
+    if (bench_run(d, &r) != ESP_OK) {
+      ESP_LOGE(TAG, "Run %d: the %s decoder failed", i + 1, d->name);
+      return ESP_FAIL;
+    }
+    uint32_t ms = MAX((r.last_us - r.start_us) / 1000, 1);
+    ESP_LOGI(TAG, "Run %d: %" PRIu32 " ms of audio in %" PRIu32 " ms", i + 1,
+             audio_ms, ms);
+    if (i == 0 || ms < result->decode_ms) {
+      result->decode_ms = ms;
+    }
+    result->worst_permille = MAX(result->worst_permille, r.worst_permille);
+    result->pcm_bytes = r.pcm_bytes;
+  }
+  if (runs > 0) {
+    result->speed_x10 = MIN((uint64_t)audio_ms * 10 / result->decode_ms,
+                            UINT16_MAX);
+    result->cpu_permille = MIN((uint64_t)result->decode_ms * 1000 / audio_ms,
+                               UINT16_MAX);
+  }
+  ESP_LOGI(TAG,
+           "%s, %d ch, %" PRIu32 " ms: %u.%ux real time, %u.%u%% of core %d, "
+           "worst chunk %u.%u%% of its time, %" PRIu64 " PCM bytes",
+           d->name, channels, audio_ms, result->speed_x10 / 10,
+           result->speed_x10 % 10, result->cpu_permille / 10,
+           result->cpu_permille % 10, d->task_core,
+           result->worst_permille / 10, result->worst_permille % 10,
+           result->pcm_bytes);
+  return ESP_OK;
+}
@@ -0,0 +1,49 @@
+#ifndef DECODER_BENCH_H
+#define DECODER_BENCH_H
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Offline decode benchmark
+ *
+ * Runs the registry's Opus decoder over an Ogg Opus clip in memory as fast
+ * as it goes: the clip is the decoder's input and its PCM is counted and
+ * dropped, so nothing but the decoder runs on its core. With
+ * CONFIG_DECODER_BENCH the firmware does this at boot, before Wi-Fi, over
+ * a clip compiled in (main/bench/). decoder_registry_sample() measures the
+ * same decoder live, on whatever the stations send.
+ */
+
+/**
+ * @brief Figures of the best of the runs, and the worst output chunk of
+ * any of them.
+ */
+typedef struct {
+  uint32_t audio_ms;        // of the clip
+  uint32_t decode_ms;       // first input to last output
+  uint16_t speed_x10;       // tenths of real time
+  uint16_t cpu_permille;    // of one core, to keep up with real time
+  uint16_t worst_permille;  // longest chunk, against its playing time
+  uint8_t channels;
+  uint64_t pcm_bytes;       // out of one run
+} decoder_bench_result_t;
+
+/**
+ * @brief Decodes an Ogg Opus clip runs times and logs the figures.
+ * @return ESP_ERR_INVALID_ARG if clip isn't Ogg Opus, ESP_FAIL if the
+ * decoder can't be created or puts nothing out.
+ */
+esp_err_t decoder_bench_opus(const uint8_t *clip, size_t len, int runs,
+                             decoder_bench_result_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DECODER_BENCH_H
@@ -0,0 +1,242 @@
+#include "decoder_registry.h"
+#include "aac_decoder.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "flac_decoder.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mp3_decoder.h"
+#include "ogg_decoder.h"
+#include "opus_decoder.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "DECODER_REGISTRY";
+
+// The fields every ADF decoder config has
+#define APPLY_ENTRY(cfg, d)                                                    \
+  do {                                                                         \
+    (cfg).task_core = (d)->task_core;                                          \
+    if ((d)->task_stack > 0) {                                                 \
+      (cfg).task_stack = (d)->task_stack;                                      \
+    }                                                                          \
+    if ((d)->out_rb_size > 0) {                                                \
+      (cfg).out_rb_size = (d)->out_rb_size;                                    \
+    }                                                                          \
+  } while (0)
+
+// What a decoder so configured takes once it runs
+#define SIZES_OF(cfg, d, s)                                                    \
+  do {                                                                         \
+    APPLY_ENTRY(cfg, d);                                                       \
+    (s)->task_stack = (cfg).task_stack;                                        \
+    (s)->stack_in_ext = (cfg).stack_in_ext;                                    \
+    (s)->out_rb_size = (cfg).out_rb_size;                                      \
+  } while (0)
+
+/* ---------- decoders ---------- */
+
+static audio_element_handle_t mp3_init(const decoder_desc_t *d) {
+  mp3_decoder_cfg_t cfg = DEFAULT_MP3_DECODER_CONFIG();
+  APPLY_ENTRY(cfg, d);
+  return mp3_decoder_init(&cfg);
+}
+
+static void mp3_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  mp3_decoder_cfg_t cfg = DEFAULT_MP3_DECODER_CONFIG();
+  SIZES_OF(cfg, d, s);
+}
+
+static audio_element_handle_t aac_init(const decoder_desc_t *d) {
+  aac_decoder_cfg_t cfg = DEFAULT_AAC_DECODER_CONFIG();
+  APPLY_ENTRY(cfg, d);
+  cfg.plus_enable = true;
+  return aac_decoder_init(&cfg);
+}
+
+static void aac_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  aac_decoder_cfg_t cfg = DEFAULT_AAC_DECODER_CONFIG();
+  SIZES_OF(cfg, d, s);
+}
+
+static audio_element_handle_t ogg_init(const decoder_desc_t *d) {
+  ogg_decoder_cfg_t cfg = DEFAULT_OGG_DECODER_CONFIG();
+  APPLY_ENTRY(cfg, d);
+  return ogg_decoder_init(&cfg);
+}
+
+static void ogg_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  ogg_decoder_cfg_t cfg = DEFAULT_OGG_DECODER_CONFIG();
+  SIZES_OF(cfg, d, s);
+}
+
+static audio_element_handle_t flac_init(const decoder_desc_t *d) {
+  flac_decoder_cfg_t cfg = DEFAULT_FLAC_DECODER_CONFIG();
+  APPLY_ENTRY(cfg, d);
+  return flac_decoder_init(&cfg);
+}
+
+static void flac_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  flac_decoder_cfg_t cfg = DEFAULT_FLAC_DECODER_CONFIG();
+  SIZES_OF(cfg, d, s);
+}
+
+static audio_element_handle_t opus_init(const decoder_desc_t *d) {
+  opus_decoder_cfg_t cfg = DEFAULT_OPUS_DECODER_CONFIG();
+  APPLY_ENTRY(cfg, d);
+  return decoder_opus_init(&cfg);
+}
+
+static void opus_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  opus_decoder_cfg_t cfg = DEFAULT_OPUS_DECODER_CONFIG();
+  SIZES_OF(cfg, d, s);
+}
+
+// All decoders run on core 1, away from Wi-Fi and the web server: AAC on
+// core 0 gave unacceptable clicking and popping on KXLU. Opus is Ogg
+// encapsulated (RFC 7845), so it shares Ogg's framing and MIME type.
+static const decoder_desc_t decoders[] = {
+    [CODEC_TYPE_MP3] = {CODEC_TYPE_MP3, "MP3", "audio/mpeg", "mp3",
+                        STREAM_SYNC_MPEG, mp3_init, mp3_sizes, 1, 0, 0},
+    [CODEC_TYPE_AAC] = {CODEC_TYPE_AAC, "AAC", "audio/aac", "aac",
+                        STREAM_SYNC_ADTS, aac_init, aac_sizes, 1, 0, 0},
+    [CODEC_TYPE_OGG] = {CODEC_TYPE_OGG, "OGG", "audio/ogg", "ogg",
+                        STREAM_SYNC_OGG, ogg_init, ogg_sizes, 1, 0, 0},
+    [CODEC_TYPE_FLAC] = {CODEC_TYPE_FLAC, "FLAC", "audio/flac", "flac",
+                         STREAM_SYNC_FLAC, flac_init, flac_sizes, 1, 0, 0},
+    [CODEC_TYPE_OPUS] = {CODEC_TYPE_OPUS, "OPUS", "audio/ogg", "opus",
+                         STREAM_SYNC_OGG, opus_init, opus_sizes, 1, 0, 0},
+};
+_Static_assert(sizeof(decoders) / sizeof(decoders[0]) == CODEC_TYPE_COUNT,
+               "every codec_type_t needs a decoder entry");
+
+const decoder_desc_t *decoder_registry_find(codec_type_t codec) {
+  if ((unsigned)codec >= CODEC_TYPE_COUNT) {
+    return NULL;
+  }
+  return &decoders[codec];
+}
+
+size_t decoder_registry_count(void) { return CODEC_TYPE_COUNT; }
+
+const decoder_desc_t *decoder_registry_at(size_t i) {
+  return i < CODEC_TYPE_COUNT ? &decoders[i] : NULL;
+}
+
+const char *decoder_registry_name(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->name : "Unknown Codec";
+}
+
+stream_sync_t decoder_registry_sync(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->sync : STREAM_SYNC_MPEG;
+}
+
+bool decoder_registry_has_head(codec_type_t codec) {
+  stream_sync_t sync = decoder_registry_sync(codec);
+  return sync == STREAM_SYNC_OGG || sync == STREAM_SYNC_FLAC;
+}
+
+/* ---------- load ---------- */
+
+static atomic_int created_codec = -1; // of the last decoder created
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static decoder_stats_t stats;
+static uint64_t cpu_sum[CODEC_TYPE_COUNT]; // permille, over the seconds
+
+// Sampler only
+static TaskStatus_t *tasks;
+static UBaseType_t tasks_cap;
+static TaskHandle_t sampled_task;
+static configRUN_TIME_COUNTER_TYPE sampled_runtime;
+static int64_t sampled_us;
+static int settle;
+
+audio_element_handle_t decoder_registry_create(const decoder_desc_t *d) {
+  ESP_LOGD(TAG, "Creating %s decoder on core %d", d->name, d->task_core);
+  audio_element_handle_t el = d->init(d);
+  if (el != NULL) {
+    atomic_store(&created_codec, d->codec);
+  }
+  return el;
+}
+
+void decoder_registry_sizes(const decoder_desc_t *d, decoder_sizes_t *s) {
+  d->sizes(d, s);
+}
+
+/* The decoder task's entry in a snapshot of all tasks, NULL if none runs.
+ * The snapshot is taken with the scheduler suspended, so a pipeline torn
+ * down meanwhile can't leave a dangling handle. */
+static const TaskStatus_t *find_decoder_task(void) {
+  UBaseType_t n = uxTaskGetNumberOfTasks();
+  if (n > tasks_cap) {
+    free(tasks);
+    tasks_cap = n + 4;
+    tasks = malloc(tasks_cap * sizeof(*tasks));
+    if (tasks == NULL) {
+      tasks_cap = 0;
+      return NULL;
+    }
+  }
+  n = uxTaskGetSystemState(tasks, tasks_cap, NULL);
+  for (UBaseType_t i = 0; i < n; i++) {
+    if (strcmp(tasks[i].pcTaskName, DECODER_TAG) == 0) {
+      return &tasks[i];
+    }
+  }
+  return NULL;
+}
+
+void decoder_registry_sample(bool playing) {
+  const TaskStatus_t *t = find_decoder_task();
+  int64_t now = esp_timer_get_time();
+  if (t == NULL) {
+    sampled_task = NULL;
+    portENTER_CRITICAL(&stats_lock);
+    stats.active = false;
+    portEXIT_CRITICAL(&stats_lock);
+    return;
+  }
+  configRUN_TIME_COUNTER_TYPE busy = t->ulRunTimeCounter - sampled_runtime;
+  int64_t wall = now - sampled_us;
+  bool same = t->xHandle == sampled_task && (int64_t)busy <= wall;
+  sampled_task = t->xHandle;
+  sampled_runtime = t->ulRunTimeCounter;
+  sampled_us = now;
+  if (!same || !playing) {
+    // A new decoder, or one that waited: refills run ahead of real time
+    settle = DECODER_LOAD_SETTLE_S;
+  }
+  int codec = atomic_load(&created_codec);
+  uint16_t permille = same && wall > 0 ? (uint64_t)busy * 1000 / wall : 0;
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.active = true;
+  stats.codec = (codec_type_t)codec;
+  stats.stack_free = t->usStackHighWaterMark;
+  stats.cpu_permille = permille;
+  // Only while playing does the decoder keep pace with real time
+  stats.speed_x10 = playing && permille > 0 ? 10000 / permille : 0;
+  if (settle > 0) {
+    settle--;
+  } else if (permille > 0 && (unsigned)codec < CODEC_TYPE_COUNT) {
+    stats.codecs[codec].seconds++;
+    cpu_sum[codec] += permille;
+    stats.codecs[codec].cpu_permille =
+        cpu_sum[codec] / stats.codecs[codec].seconds;
+    if (permille > stats.codecs[codec].cpu_max_permille) {
+      stats.codecs[codec].cpu_max_permille = permille;
+    }
+  }
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+void decoder_registry_get_stats(decoder_stats_t *out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,142 @@
+#ifndef DECODER_REGISTRY_H
+#define DECODER_REGISTRY_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "stream_head.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Decoder registry: the codecs the radio can play
+ *
+ * One table entry per codec_type_t holds everything that depends on the
+ * codec: how to create its ADF decoder (init function, core, stack and
+ * output buffer), its name, MIME type and file extension, and how its
+ * stream is framed. The pipeline, the station editor, the relay, the
+ * recorder and time-shift all look codecs up here, so a codec is added by
+ * adding an entry (and its value at the end of codec_type_t, which is
+ * stored with the stations).
+ *
+ * The decoder task's CPU time is sampled once a second while it plays
+ * (decoder_registry_sample()), which gives the load of each codec on this
+ * hardware and how much faster than real time it decodes.
+ */
+
+// Pipeline tag of the decoder, and so the name of its task
+#define DECODER_TAG "codec"
+// Seconds of playback not measured after a decoder starts, while it fills
+// the buffers behind it faster than real time
+#define DECODER_LOAD_SETTLE_S 3
+
+typedef struct decoder_desc decoder_desc_t;
+
+/**
+ * @brief Memory a decoder takes once it runs.
+ */
+typedef struct {
+  int task_stack;
+  bool stack_in_ext; // the stack is in PSRAM
+  int out_rb_size;   // PCM buffer after it, PSRAM when there is some
+} decoder_sizes_t;
+
+/**
+ * @brief A codec: its decoder and the shape of its stream.
+ */
+struct decoder_desc {
+  codec_type_t codec;
+  const char *name; // as shown and as given in playlists, e.g. "OPUS"
+  const char *mime; // Content-Type of the compressed stream
+  const char *ext;  // file extension of a recording
+  stream_sync_t sync;
+  audio_element_handle_t (*init)(const decoder_desc_t *d);
+  void (*sizes)(const decoder_desc_t *d, decoder_sizes_t *s);
+  int task_core;
+  int task_stack;  // bytes, 0: the decoder's default
+  int out_rb_size; // PCM buffer after the decoder, 0: the decoder's default
+};
+
+/**
+ * @brief Load of the decoder that is playing, and of every codec so far.
+ */
+typedef struct {
+  bool active;             // a decoder is being measured
+  codec_type_t codec;
+  uint16_t cpu_permille;   // of one core, over the last second
+  uint16_t speed_x10;      // decoding speed, in tenths of real time
+  uint32_t stack_free;     // bytes of the decoder task's stack never used
+  struct {
+    uint32_t seconds;          // measured since boot
+    uint16_t cpu_permille;     // average
+    uint16_t cpu_max_permille; // worst second
+  } codecs[CODEC_TYPE_COUNT];
+} decoder_stats_t;
+
+/**
+ * @brief The entry of a codec, NULL for values no entry has (a station
+ * list from newer firmware).
+ */
+const decoder_desc_t *decoder_registry_find(codec_type_t codec);
+
+/**
+ * @brief Number of entries; with decoder_registry_at() for listing them.
+ */
+size_t decoder_registry_count(void);
+
+/**
+ * @brief Entry i, in codec_type_t order.
+ */
+const decoder_desc_t *decoder_registry_at(size_t i);
+
+/**
+ * @brief Name of a codec, "Unknown Codec" if there is no entry.
+ */
+const char *decoder_registry_name(codec_type_t codec);
+
+/**
+ * @brief Framing of a codec's stream; MPEG audio if there is no entry.
+ */
+stream_sync_t decoder_registry_sync(codec_type_t codec);
+
+/**
+ * @brief Whether a codec's stream starts with a header a decoder needs
+ * (Ogg header pages, FLAC metadata) before it can pick up mid-stream.
+ */
+bool decoder_registry_has_head(codec_type_t codec);
+
+/**
+ * @brief Creates the decoder element of an entry, configured from it. The
+ * pipeline passes a copy with the core, stack and buffer of its graph.
+ * @return NULL if the decoder can't be created.
+ */
+audio_element_handle_t decoder_registry_create(const decoder_desc_t *d);
+
+/**
+ * @brief The stack and buffer decoder_registry_create() would give the
+ * decoder of an entry, for the pipeline's memory check.
+ */
+void decoder_registry_sizes(const decoder_desc_t *d, decoder_sizes_t *s);
+
+/**
+ * @brief Takes one load sample of the decoder task. Call about once a
+ * second; cheap while nothing plays.
+ * @param playing Whether audio is flowing: paused or stalled seconds are
+ * not counted.
+ */
+void decoder_registry_sample(bool playing);
+
+/**
+ * @brief Copies the load figures.
+ */
+void decoder_registry_get_stats(decoder_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DECODER_REGISTRY_H
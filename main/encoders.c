@@ -24,21 +24,31 @@
 
 #include "app_config.h"
 #include "board.h"
+#include "button_gesture.h"
 #include "esp_netif.h"
 #include "esp_timer.h"
+#include "input_bus.h"
 #include "internet_radio_adf.h"
 #include "ir_remote.h"
+#include "local_media.h"
 #include "lvgl_ssd1306_setup.h"
 #include "pcm5122_driver.h"
+#include "recorder.h"
 #include "screens.h"
 #include "station_data.h"
+#include "station_index.h"
+#include "timeshift.h"
+#include "ui_state.h"
 #include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
 static const char *TAG = "encoders";
 
 // extern audio_board_handle_t board_handle;
 
-extern int station_count;
 extern int current_station;
 extern audio_pipeline_components_t audio_pipeline_components;
 
@@ -55,16 +65,19 @@ extern audio_pipeline_components_t audio_pipeline_components;
 
 // polling periods
 #define VOLUME_POLLING_PERIOD_MS 100
-#define VOLUME_PRESS_POLLING_PERIOD_MS 20
 
 #define STATION_POLLING_PERIOD_MS 100
-#define STATION_PRESS_POLLING_PERIOD_MS 100
+
+// press switches are edge driven; a level must be stable this long to count
+#define BUTTON_DEBOUNCE_MS 50
 
 // this pause allows the user to change the station multiple times before the
 // change takes effect
 #define DELAY_BEFORE_STATION_CHANGE_MS 2000
-// timing for long press on station switch to reboot
+// timing for long press on station switch to reboot, and on volume to pause
 #define LONG_PRESS_TIME_MS 1500
+// Holding the volume button on after a long press skips back this often
+#define SKIP_REPEAT_TIME_MS 1000
 // time to display IP address on screen
 #define IP_SCREEN_DISPLAY_TIME_MS 3000
 // reboot message is displayed for this time before rebooting
@@ -73,6 +86,23 @@ extern audio_pipeline_components_t audio_pipeline_components;
 #define DOUBLE_CLICK_TIMEOUT_MS 300
 // Lockout period after wakeup to ignore ghost pulses (500ms)
 #define WAKEUP_LOCKOUT_US (500 * 1000)
+// Longest the power save task sleeps before re-reading the configuration
+#define POWER_SAVE_RECHECK_MS (60 * 1000)
+// Fast scrolling: detents closer together than this count as a fast turn.
+// After FAST_SCROLL_STREAK fast moves each detent skips FAST_SCROLL_STEP
+// stations, and after JUMP_SCROLL_STREAK it jumps to the next initial letter
+// (lists of at least FAST_SCROLL_MIN_STATIONS only).
+#define FAST_SCROLL_INTERVAL_MS 60
+#define FAST_SCROLL_STREAK 4
+#define FAST_SCROLL_STEP 10
+#define JUMP_SCROLL_STREAK 12
+#define FAST_SCROLL_MIN_STATIONS 100
+// the search screen closes after this much inactivity
+#define SEARCH_TIMEOUT_MS 15000
+// number of matches shown on the search screen
+#define SEARCH_SHOWN_RESULTS 3
+// first entry of the folder list, back to the stations
+#define BROWSE_RADIO_ENTRY "Internet radio"
 
 typedef struct {
   pcnt_unit_handle_t pcnt_unit;
@@ -98,6 +128,34 @@ static limited_pulse_counter_t *g_volume_counter_ptr =
 
 static int64_t g_last_wakeup_time = 0;
 
+static button_gesture_handle_t s_volume_button = NULL;
+static button_gesture_handle_t s_station_button = NULL;
+static TaskHandle_t s_power_save_task = NULL;
+// Set by a sleep command: power save starts without waiting for the delay
+static volatile bool s_sleep_requested = false;
+static esp_timer_handle_t s_ip_screen_timer = NULL;
+
+// Type-ahead search state, owned by the dispatch task. Rotating the station
+// encoder picks the pending character, which is previewed in the query.
+static const char search_alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+static volatile bool s_search_active = false;
+static char s_search_query[24];
+static int s_search_len = 0;
+static int s_search_pending = -1; // alphabet index, -1 if none
+static int s_search_last = 0;     // alphabet index of the last character
+static int s_search_found = 0;
+// Id of the best match; the list may be replaced before it is selected
+static uint32_t s_search_top_id = 0;
+static esp_timer_handle_t s_search_timer = NULL;
+
+// Local playback browser, on the search screen: the folders (entry 0 is the
+// stations) or the tracks of the folder being played. Rotation moves the
+// cursor; it is played once the encoder rests, as a station is selected.
+static volatile bool s_browse_active = false;
+static volatile bool s_browse_folders = false;
+static volatile int s_browse_index = 0;
+static esp_timer_handle_t s_browse_timer = NULL;
+
 static void save_volume_to_nvs(int volume) {
   nvs_handle_t nvs_handle;
   esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
@@ -189,17 +247,9 @@ void update_volume_pulse_counter(void *pvParameters) {
                  counter->value, new_volume);
         counter->value = new_volume;
       } else {
-        // If muted and user changes volume, unmute first
-        audio_hal_set_mute(counter->board_handle->audio_hal, false);
-        is_muted = false;
-        ESP_LOGI(TAG, "Unmuted by volume change to %d", new_volume);
-        update_mute_state(false);
-        save_mute_state_to_nvs(false);
-
         counter->value = new_volume;
-        audio_hal_set_volume(counter->board_handle->audio_hal, new_volume);
-        update_volume_slider(new_volume);
-        save_volume_to_nvs(new_volume);
+        input_bus_post_simple(INPUT_EVENT_VOLUME_SET, INPUT_SOURCE_ENCODER,
+                              INPUT_CONTROL_VOLUME, new_volume);
       }
     }
 
@@ -208,258 +258,688 @@ void update_volume_pulse_counter(void *pvParameters) {
   }
 }
 
-static void volume_press_task(void *pvParameters) {
-  ESP_LOGI(
-      TAG,
-      "Volume press button task started. [BUILD_ID: robust_deep_sleep_v7]");
-  while (1) {
-    if (gpio_get_level(VOLUME_PRESS_GPIO) ==
-        0) { // Button is pressed (active low)
-      // Debounce delay
-      vTaskDelay(pdMS_TO_TICKS(50));
-      // Wait for button release (first click release)
-      while (gpio_get_level(VOLUME_PRESS_GPIO) == 0) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-      }
+// Applies a mute change from any input source and persists it. Also restarts
+// the power save countdown.
+static void set_mute(bool muted, const char *reason) {
+  is_muted = muted;
+  if (!muted) {
+    s_sleep_requested = false;
+  }
+  audio_hal_set_mute(g_volume_counter_ptr->board_handle->audio_hal, is_muted);
+  update_mute_state(is_muted);
+  save_mute_state_to_nvs(is_muted);
+  if (is_muted) {
+    mute_start_time = esp_timer_get_time();
+  }
+  ESP_LOGI(TAG, "Hardware %s (%s)", is_muted ? "muted" : "unmuted", reason);
+  if (s_power_save_task) {
+    xTaskNotifyGive(s_power_save_task);
+  }
+}
 
-      // First click happened. Now wait and see if there is a second click.
-      bool double_click = false;
-      int waited_ms = 0;
-      while (waited_ms < DOUBLE_CLICK_TIMEOUT_MS) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-        waited_ms += 10;
-        if (gpio_get_level(VOLUME_PRESS_GPIO) == 0) {
-          double_click = true;
-          break;
-        }
-      }
+static void apply_volume(int volume) {
+  if (is_muted) {
+    // If muted and user changes volume, unmute first
+    set_mute(false, "volume change");
+  }
+  audio_hal_set_volume(g_volume_counter_ptr->board_handle->audio_hal, volume);
+  update_volume_slider(volume);
+  save_volume_to_nvs(volume);
+}
 
-      if (double_click) {
-        ESP_LOGI(TAG, "Double click detected - Sending Audio Toggle signal");
-        // Debounce second click
-        vTaskDelay(pdMS_TO_TICKS(50));
-        // Wait for release of second click
-        while (gpio_get_level(VOLUME_PRESS_GPIO) == 0) {
-          vTaskDelay(pdMS_TO_TICKS(10));
-        }
+// Makes the volume encoder's current position read as volume, after a
+// change that did not come from the encoder. adjust is written before value:
+// the polling task may then see the new adjust with the old value (and post
+// the same volume again), never the old adjust with the new value (which
+// would post the old volume back).
+static void sync_volume_encoder(int volume) {
+  limited_pulse_counter_t *counter = g_volume_counter_ptr;
+  int count;
+  if (pcnt_unit_get_count(counter->pcnt_unit, &count) != ESP_OK) {
+    return;
+  }
+  counter->adjust = volume - count / 4 * counter->speed;
+  counter->value = volume;
+}
 
-        if (g_runtime_config.ir_is_enabled) {
-          ir_remote_toggle_audio();
-        }
-      } else {
-        // Timeout reached, no second click -> Single Click Action (Mute Toggle)
-        is_muted = !is_muted; // Toggle mute state
-        audio_hal_set_mute(g_volume_counter_ptr->board_handle->audio_hal,
-                           is_muted);
-
-        if (is_muted) {
-          ESP_LOGI(TAG, "Hardware muted");
-          update_mute_state(true);
-          save_mute_state_to_nvs(true);
-          mute_start_time = esp_timer_get_time();
-        } else {
-          ESP_LOGI(TAG, "Hardware unmuted");
-          update_mute_state(false);
-          save_mute_state_to_nvs(false);
-        }
-      }
+static esp_err_t step_station(int delta) {
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  int count = snapshot->count;
+  station_snapshot_release(snapshot);
+  if (count == 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return change_station(((current_station + delta) % count + count) % count);
+}
+
+static void show_ip_screen(void) {
+  switch_to_ip_screen();
+
+  esp_netif_ip_info_t ip_info;
+  esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  if (netif) {
+    esp_netif_get_ip_info(netif, &ip_info);
+    char ip_str[IP4ADDR_STRLEN_MAX];
+    esp_ip4addr_ntoa(&ip_info.ip, ip_str, IP4ADDR_STRLEN_MAX);
+    update_ip_label(ip_str);
+  } else {
+    update_ip_label("No Netif");
+  }
+
+  // Return to the home screen without holding up the dispatcher
+  esp_timer_stop(s_ip_screen_timer);
+  esp_timer_start_once(s_ip_screen_timer, IP_SCREEN_DISPLAY_TIME_MS * 1000);
+}
+
+static void ip_screen_timeout_cb(void *arg) { switch_to_home_screen(); }
+
+// Runs the query (with the pending character) and publishes it and the best
+// matches to the search screen
+static void search_refresh(void) {
+  char query[sizeof(s_search_query) + 1];
+  memcpy(query, s_search_query, s_search_len);
+  int len = s_search_len;
+  if (s_search_pending >= 0) {
+    query[len++] = search_alphabet[s_search_pending];
+  }
+  query[len] = '\0';
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  station_match_t matches[SEARCH_SHOWN_RESULTS];
+  s_search_found = station_index_search(snapshot->index, query, matches,
+                                        SEARCH_SHOWN_RESULTS);
+  if (s_search_found > 0) {
+    s_search_top_id = snapshot->stations[matches[0].index].id;
+  }
+
+  // Pending character in brackets, e.g. "jaz[z]"; a cursor otherwise
+  char line[UI_STATE_STR_MAX];
+  if (s_search_pending >= 0) {
+    snprintf(line, sizeof(line), "%.*s[%c]", s_search_len, s_search_query,
+             search_alphabet[s_search_pending]);
+  } else {
+    snprintf(line, sizeof(line), "%.*s_", s_search_len, s_search_query);
+  }
+  update_search_query(line);
+
+  char results[UI_STATE_STR_MAX] = "";
+  size_t used = 0;
+  for (int i = 0; i < s_search_found && used < sizeof(results) - 1; i++) {
+    used += snprintf(results + used, sizeof(results) - used, "%s%s",
+                     i ? "\n" : "",
+                     snapshot->stations[matches[i].index].call_sign);
+  }
+  station_snapshot_release(snapshot);
+  update_search_results(len > 0 && s_search_found == 0 ? "No match" : results);
+
+  esp_timer_stop(s_search_timer);
+  esp_timer_start_once(s_search_timer, SEARCH_TIMEOUT_MS * 1000);
+}
+
+static void search_open(void) {
+  ESP_LOGI(TAG, "Opening station search");
+  s_search_len = 0;
+  s_search_pending = -1;
+  s_search_active = true;
+  search_refresh();
+  switch_to_search_screen();
+}
+
+static void search_close(void) {
+  s_search_active = false;
+  esp_timer_stop(s_search_timer);
+  switch_to_home_screen();
+}
+
+static void search_timeout_cb(void *arg) {
+  s_search_active = false;
+  s_browse_active = false;
+  switch_to_home_screen();
+}
+
+static void search_step(int delta) {
+  int n = sizeof(search_alphabet) - 1;
+  int next = s_search_pending + delta;
+  if (s_search_pending < 0) {
+    // The first step shows the last character used, in either direction
+    next = s_search_last + delta + (delta > 0 ? -1 : 1);
+  }
+  s_search_pending = ((next % n) + n) % n;
+  search_refresh();
+}
+
+static void search_accept(void) {
+  if (s_search_pending >= 0 && s_search_len < (int)sizeof(s_search_query) - 1) {
+    s_search_query[s_search_len++] = search_alphabet[s_search_pending];
+    s_search_last = s_search_pending;
+    s_search_pending = -1;
+  }
+  search_refresh();
+}
+
+// Drops the pending character, then the last accepted one; closes the search
+// once the query is empty
+static void search_back(void) {
+  if (s_search_pending >= 0) {
+    s_search_pending = -1;
+  } else if (s_search_len > 0) {
+    s_search_len--;
+  } else {
+    search_close();
+    return;
+  }
+  search_refresh();
+}
+
+static void search_select(void) {
+  if (s_search_found == 0) {
+    return;
+  }
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  int index = station_snapshot_find_id(snapshot, s_search_top_id);
+  station_snapshot_release(snapshot);
+  if (index < 0) {
+    return;
+  }
+  search_close();
+  input_bus_post_simple(INPUT_EVENT_STATION_SELECT, INPUT_SOURCE_ENCODER,
+                        INPUT_CONTROL_STATION, index);
+}
+
+/* ---------- local playback browser ---------- */
+
+static int browse_count(void) {
+  if (s_browse_folders) {
+    return local_media_folder_count() + 1;
+  }
+  local_media_stats_t stats;
+  local_media_get_stats(&stats);
+  return stats.tracks;
+}
+
+static void browse_name(int index, char *buf, size_t len) {
+  if (!s_browse_folders) {
+    if (!local_media_track_name(index, buf, len)) {
+      buf[0] = '\0';
     }
+  } else if (index == 0) {
+    snprintf(buf, len, "%s", BROWSE_RADIO_ENTRY);
+  } else if (!local_media_folder_name(index - 1, buf, len)) {
+    buf[0] = '\0';
+  }
+}
 
-    // Check for light sleep timeout if muted and power saving is enabled
-    if (is_muted && g_runtime_config.power_save_mode != POWER_SAVE_NONE) {
-      int64_t now = esp_timer_get_time();
-      if (now - mute_start_time >
-          (int64_t)g_runtime_config.light_sleep_delay_ms * 1000) {
-        ESP_LOGI(TAG, "Muted for >%" PRIu32 " ms. Entering light sleep...",
-                 g_runtime_config.light_sleep_delay_ms);
-
-        // Disconnect WiFi before sleep to bypass bcn_timeout on wakeup
-        set_wifi_sleep_mode(true);
-
-        // Enter sleep (logic inside audio_pipeline_manager.c)
-        // Pass timer wakeup duration ONLY if Light+Deep mode is active
-        uint64_t requested_sleep_us =
-            (g_runtime_config.power_save_mode == POWER_SAVE_LIGHT_DEEP)
-                ? ((uint64_t)g_runtime_config.deep_sleep_delay_ms * 1000)
-                : 0;
-        int64_t sleep_start_time = esp_timer_get_time();
-
-        ESP_LOGI(TAG,
-                 "Entering light sleep stage (requested %llu us, mode: %d)...",
-                 requested_sleep_us, (int)g_runtime_config.power_save_mode);
-
-        // Set sentinel to ensure lockout is active during the sleep/wake
-        // transition
-        g_last_wakeup_time = LLONG_MAX;
-
-        audio_pipeline_manager_sleep(&audio_pipeline_components,
-                                     VOLUME_PRESS_GPIO, STATION_PRESS_GPIO,
-                                     requested_sleep_us);
-
-        // --- AFTER WAKEUP ---
-
-        // Set wakeup timestamp for lockout immediately to prevent race with
-        // polling tasks
-        g_last_wakeup_time = esp_timer_get_time();
-
-        // Check wakeup cause and duration
-        int64_t actual_sleep_duration_us =
-            esp_timer_get_time() - sleep_start_time;
-        esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
-
-        ESP_LOGI(TAG,
-                 "Woke from light sleep after %lld us. Cause: %d (1=EXT0, "
-                 "2=EXT1, 4=TIMER, 7=GPIO)",
-                 actual_sleep_duration_us, cause);
-
-        // Calculate safety threshold based on current delay (90%)
-        uint64_t min_sleep_threshold_us =
-            (uint64_t)g_runtime_config.deep_sleep_delay_ms * 900;
-
-        // ONLY enter deep sleep if in LIGHT_DEEP mode and it was a timer
-        // timeout
-        if (g_runtime_config.power_save_mode == POWER_SAVE_LIGHT_DEEP &&
-            cause == ESP_SLEEP_WAKEUP_TIMER &&
-            actual_sleep_duration_us >= min_sleep_threshold_us) {
-          ESP_LOGI(TAG, "Deep sleep timeout reached. Transitioning to system "
-                        "deep sleep...");
-
-          // Ensure Station button is released before entering deep sleep
-          while (gpio_get_level(STATION_PRESS_GPIO) == 0) {
-            ESP_LOGI(TAG, "Waiting for Station button release before deep sleep...");
-            vTaskDelay(pdMS_TO_TICKS(100));
-          }
-
-          // Ensure WiFi is stopped for a clean state
-          set_wifi_sleep_mode(true);
-          esp_wifi_stop();
-
-          // Disable all wakeup sources before re-configuring for deep sleep
-          esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
-
-          // Ensure RTC pull-up is enabled for deep sleep (using STATION_PRESS_GPIO which is RTCIO)
-          rtc_gpio_init(STATION_PRESS_GPIO);
-          rtc_gpio_set_direction(STATION_PRESS_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
-          rtc_gpio_pullup_en(STATION_PRESS_GPIO);
-          rtc_gpio_pulldown_dis(STATION_PRESS_GPIO);
-
-          // Configure deep sleep wakeup on Station Press GPIO
-          esp_sleep_enable_ext0_wakeup(STATION_PRESS_GPIO, 0); // Wake on LOW
-
-          ESP_LOGI(TAG, "Entering deep sleep NOW. Wake up with Station Press.");
-          esp_deep_sleep_start();
-        } else {
-          ESP_LOGI(TAG, "Light sleep interrupted (duration glitch or button "
-                        "press). Resuming...");
-        }
+// Shows the entry under the cursor between its neighbours
+static void browse_refresh(void) {
+  char name[UI_STATE_STR_MAX];
+  local_media_stats_t stats;
+  local_media_get_stats(&stats);
+  if (s_browse_folders) {
+    update_search_query("Folders");
+  } else if (stats.folder >= 0 &&
+             local_media_folder_name(stats.folder, name, sizeof(name))) {
+    update_search_query(name);
+  }
 
-        // If we reach here, it was a GPIO wakeup (or other)
-        ESP_LOGI(TAG, "Resuming from light sleep...");
+  int count = browse_count();
+  char lines[UI_STATE_STR_MAX] = "";
+  size_t used = 0;
+  int first = count > 2 ? -1 : 0;
+  int last = count > 2 ? 1 : count - 1;
+  for (int i = first; i <= last && used < sizeof(lines) - 1; i++) {
+    int index = ((s_browse_index + i) % count + count) % count;
+    browse_name(index, name, sizeof(name));
+    used += snprintf(lines + used, sizeof(lines) - used, "%s%s%s",
+                     used ? "\n" : "", index == s_browse_index ? "> " : "  ",
+                     name);
+  }
+  update_search_results(count > 0 ? lines : "No files");
 
-        // Trigger reconnection immediately (non-blocking)
-        set_wifi_sleep_mode(false);
+  esp_timer_stop(s_search_timer);
+  esp_timer_start_once(s_search_timer, SEARCH_TIMEOUT_MS * 1000);
+}
 
-        // Wake up display immediately for user feedback
-        lvgl_ssd1306_wakeup();
+// Opens on the folder or track being played
+static void browse_open(bool folders) {
+  local_media_stats_t stats;
+  local_media_get_stats(&stats);
+  s_browse_folders = folders;
+  s_browse_index = folders ? stats.folder + 1 : MAX(stats.track, 0);
+  s_browse_active = true;
+  browse_refresh();
+  switch_to_search_screen();
+}
 
-        // Wait for wifi before restarting pipeline
-        wait_for_wifi_connection();
+static void browse_close(void) {
+  s_browse_active = false;
+  esp_timer_stop(s_browse_timer);
+  esp_timer_stop(s_search_timer);
+  switch_to_home_screen();
+}
 
-        // Brief delay to let network stack settle
-        vTaskDelay(pdMS_TO_TICKS(100));
+static void browse_step(int delta) {
+  if (!s_browse_active) {
+    browse_open(false);
+  }
+  int count = browse_count();
+  if (count == 0) {
+    return;
+  }
+  s_browse_index = ((s_browse_index + delta) % count + count) % count;
+  browse_refresh();
+  esp_timer_stop(s_browse_timer);
+  esp_timer_start_once(s_browse_timer,
+                       DELAY_BEFORE_STATION_CHANGE_MS * 1000ULL);
+}
+
+// Plays the entry under the cursor (from the dispatch task or the timer)
+static void browse_select(void) {
+  bool folders = s_browse_folders;
+  int index = s_browse_index;
+  browse_close();
+  if (!folders) {
+    input_bus_post_simple(INPUT_EVENT_TRACK_SELECT, INPUT_SOURCE_ENCODER,
+                          INPUT_CONTROL_STATION, index);
+  } else if (index == 0) {
+    input_bus_post_simple(INPUT_EVENT_LOCAL, INPUT_SOURCE_ENCODER,
+                          INPUT_CONTROL_STATION, 0);
+  } else {
+    input_bus_post_simple(INPUT_EVENT_FOLDER_SELECT, INPUT_SOURCE_ENCODER,
+                          INPUT_CONTROL_STATION, index - 1);
+  }
+}
 
-        // Restart pipeline
-        extern audio_event_iface_handle_t evt;
-        audio_pipeline_manager_wakeup(&audio_pipeline_components, evt);
+static void browse_timeout_cb(void *arg) {
+  if (s_browse_active) {
+    browse_select();
+  }
+}
+
+static esp_err_t set_local(int state) {
+  bool on = state < 0 ? !local_media_is_active() : state != 0;
+  if (on == local_media_is_active()) {
+    return ESP_OK;
+  }
+  // Tuning the station that was playing before leaves local playback
+  return on ? local_media_enter() : change_station(current_station);
+}
 
-        // Reset watchdog to avoid spurious restarts
-        reset_watchdog_counter();
+static esp_err_t select_track(int track) {
+  local_media_stats_t stats;
+  local_media_get_stats(&stats);
+  if (stats.folder < 0) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return local_media_play(stats.folder, track);
+}
 
-        // Hardware is still muted from before sleep, but we might want to stay
-        // muted the user said: "The light sleep state should be awakened by a
-        // press on the volume switch along with unmuting." So we unmute on
-        // wakeup.
-        is_muted = false;
-        audio_hal_set_mute(g_volume_counter_ptr->board_handle->audio_hal,
-                           is_muted);
-        update_mute_state(is_muted);
-        save_mute_state_to_nvs(is_muted);
-        ESP_LOGI(TAG, "Hardware unmuted after wakeup");
+static void handle_volume_gesture(input_event_type_t type) {
+  if (s_search_active && type == INPUT_EVENT_CLICK) {
+    search_back();
+    return;
+  }
+  if (s_browse_active && type == INPUT_EVENT_CLICK) {
+    browse_close();
+    return;
+  }
+  bool local = local_media_is_active();
+  switch (type) {
+  case INPUT_EVENT_CLICK:
+    set_mute(!is_muted, "volume click");
+    break;
+  case INPUT_EVENT_DOUBLE_CLICK:
+    ESP_LOGI(TAG, "Double click detected - Sending Audio Toggle signal");
+    if (g_runtime_config.ir_is_enabled) {
+      ir_remote_toggle_audio();
+    }
+    break;
+  case INPUT_EVENT_LONG_PRESS:
+    if (local) {
+      local_media_pause(-1);
+    } else if (timeshift_pause(-1) != ESP_OK) {
+      ESP_LOGI(TAG, "Long press: time-shift is off");
+    }
+    break;
+  case INPUT_EVENT_HOLD_REPEAT:
+    // Held on past the pause: skip back and play from there
+    if (local) {
+      if (local_media_seek(-LOCAL_MEDIA_SKIP_S) == ESP_OK) {
+        local_media_pause(0);
       }
+    } else if (timeshift_seek(-TIMESHIFT_SKIP_S) == ESP_OK) {
+      timeshift_pause(0);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static void handle_station_gesture(input_event_type_t type) {
+  if (s_search_active && type == INPUT_EVENT_CLICK) {
+    search_accept();
+    return;
+  }
+  if (s_browse_active && type == INPUT_EVENT_CLICK) {
+    browse_select();
+    return;
+  }
+  switch (type) {
+  case INPUT_EVENT_CLICK:
+    if (is_muted) {
+      // Skip IP display when unmuting to act as a 'wake' action
+      set_mute(false, "station click");
+    } else {
+      ESP_LOGI(TAG, "Short press detected. Showing IP.");
+      show_ip_screen();
     }
+    break;
+  case INPUT_EVENT_DOUBLE_CLICK:
+    if (s_search_active) {
+      search_select();
+    } else if (s_browse_active) {
+      browse_open(!s_browse_folders); // folders <-> tracks
+    } else if (local_media_is_active()) {
+      browse_open(true);
+    } else {
+      search_open();
+    }
+    break;
+  case INPUT_EVENT_LONG_PRESS:
+    ESP_LOGI(TAG, "Long press detected. Rebooting sequence initiated...");
+    switch_to_reboot_screen();
+    vTaskDelay(pdMS_TO_TICKS(REBOOT_MESSAGE_DISPLAY_TIME_MS));
+    esp_restart();
+    break;
+  default:
+    break;
+  }
+}
 
-    // Debounce after everything
-    vTaskDelay(pdMS_TO_TICKS(50));
-    vTaskDelay(pdMS_TO_TICKS(VOLUME_PRESS_POLLING_PERIOD_MS));
-  }
-}
-
-static void station_press_task(void *pvParameters) {
-  ESP_LOGI(TAG, "Station press button task started.");
-  while (1) {
-    if (gpio_get_level(STATION_PRESS_GPIO) == 0) { // Button is pressed (active low)
-      int64_t press_start_time = esp_timer_get_time();
-      bool long_press_handled = false;
-
-      // Debounce delay
-      vTaskDelay(pdMS_TO_TICKS(50));
-
-      // Wait while button is pressed
-      while (gpio_get_level(STATION_PRESS_GPIO) == 0) {
-        vTaskDelay(pdMS_TO_TICKS(10));
-
-        // Check for long press during hold
-        int64_t current_duration = esp_timer_get_time() - press_start_time;
-        if (current_duration > LONG_PRESS_TIME_MS * 1000) {
-          ESP_LOGI(TAG,
-                   "Long press detected (%" PRId64
-                   " us). Rebooting sequence initiated...",
-                   current_duration);
-          switch_to_reboot_screen();
-          vTaskDelay(pdMS_TO_TICKS(REBOOT_MESSAGE_DISPLAY_TIME_MS));
-          esp_restart();
-          long_press_handled = true;
-          break;
-        }
+// Single consumer of the input bus. Buttons, encoders and remote sources all
+// end up here so that every action runs in one task context.
+static void input_dispatch_task(void *pvParameters) {
+  ESP_LOGI(TAG, "Input dispatch task started.");
+  input_event_t event;
+  for (;;) {
+    if (!input_bus_receive(&event, portMAX_DELAY)) {
+      continue;
+    }
+    ESP_LOGD(TAG, "Input event %s (source %d, control %d, value %d)",
+             input_event_type_to_string(event.type), event.source,
+             event.control, event.value);
+    if (input_source_is_user(event.source)) {
+      lvgl_ssd1306_notify_activity();
+    }
+
+    if (g_volume_counter_ptr == NULL) {
+      // Remote commands can arrive before the encoder tasks are up
+      input_bus_complete(&event, ESP_ERR_INVALID_STATE);
+      continue;
+    }
+    esp_err_t result = ESP_OK;
+    switch (event.type) {
+    case INPUT_EVENT_CLICK:
+    case INPUT_EVENT_DOUBLE_CLICK:
+    case INPUT_EVENT_LONG_PRESS:
+    case INPUT_EVENT_HOLD_REPEAT:
+      if (event.control == INPUT_CONTROL_VOLUME) {
+        handle_volume_gesture(event.type);
+      } else if (event.control == INPUT_CONTROL_STATION) {
+        handle_station_gesture(event.type);
+      }
+      break;
+    case INPUT_EVENT_VOLUME_SET:
+      if (event.source != INPUT_SOURCE_ENCODER) {
+        sync_volume_encoder(event.value);
       }
+      apply_volume(event.value);
+      break;
+    case INPUT_EVENT_VOLUME_STEP: {
+      int volume = MAX(0, MIN(100, g_volume_counter_ptr->value + event.value));
+      sync_volume_encoder(volume);
+      apply_volume(volume);
+      break;
+    }
+    case INPUT_EVENT_STATION_SELECT:
+      ESP_LOGI(TAG, "Changing station to index %d", event.value);
+      result = change_station(event.value);
+      switch_to_home_screen();
+      break;
+    case INPUT_EVENT_STATION_STEP:
+      // Next and previous mean tracks while files play
+      if (local_media_is_active()) {
+        result = local_media_step(event.value);
+      } else {
+        result = step_station(event.value);
+        switch_to_home_screen();
+      }
+      break;
+    case INPUT_EVENT_ENCODER_STEP:
+      if (event.control != INPUT_CONTROL_STATION) {
+        break;
+      } else if (s_search_active) {
+        search_step(event.value);
+      } else if (local_media_is_active()) {
+        browse_step(event.value);
+      }
+      break;
+    case INPUT_EVENT_MUTE:
+      set_mute(event.value < 0 ? !is_muted : event.value != 0, "remote");
+      break;
+    case INPUT_EVENT_SLEEP:
+      // Wakes the power save task, which sees the request
+      s_sleep_requested = true;
+      set_mute(true, "sleep");
+      break;
+    case INPUT_EVENT_WAKE:
+      set_mute(false, "wake");
+      break;
+    case INPUT_EVENT_FOLLOW:
+      result = follow_leader((codec_type_t)event.value);
+      break;
+    case INPUT_EVENT_PAUSE:
+      result = local_media_is_active() ? local_media_pause(event.value)
+                                       : timeshift_pause(event.value);
+      break;
+    case INPUT_EVENT_SEEK:
+      result = local_media_is_active() ? local_media_seek(event.value)
+                                       : timeshift_seek(event.value);
+      break;
+    case INPUT_EVENT_LIVE:
+      result = timeshift_live();
+      break;
+    case INPUT_EVENT_RECORD:
+      result = recorder_record(event.value);
+      break;
+    case INPUT_EVENT_LOCAL:
+      result = set_local(event.value);
+      break;
+    case INPUT_EVENT_TRACK_SELECT:
+      result = select_track(event.value);
+      break;
+    case INPUT_EVENT_TRACK_STEP:
+      result = local_media_step(event.value);
+      break;
+    case INPUT_EVENT_FOLDER_SELECT:
+      result = local_media_play(event.value, 0);
+      break;
+    }
+    input_bus_complete(&event, result);
+  }
+}
 
-      // Only process short press if long press wasn't handled (and device
-      // didn't restart)
-      if (!long_press_handled) {
-        if (is_muted) {
-          // Wake from mute
-          is_muted = false;
-          audio_hal_set_mute(g_volume_counter_ptr->board_handle->audio_hal,
-                             is_muted);
-          update_mute_state(is_muted);
-          save_mute_state_to_nvs(is_muted);
-          ESP_LOGI(TAG, "Hardware unmuted via Station button");
-          // Skip IP display when unmuting to act as a 'wake' action
-        } else {
-          int64_t press_duration = esp_timer_get_time() - press_start_time;
-          ESP_LOGI(TAG, "Short press detected (%" PRId64 " us). Showing IP.",
-                   press_duration);
-          switch_to_ip_screen();
-
-          // Get IP
-          esp_netif_ip_info_t ip_info;
-          esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
-          if (netif) {
-            esp_netif_get_ip_info(netif, &ip_info);
-            char ip_str[IP4ADDR_STRLEN_MAX];
-            esp_ip4addr_ntoa(&ip_info.ip, ip_str, IP4ADDR_STRLEN_MAX);
-            update_ip_label(ip_str);
-          } else {
-            update_ip_label("No Netif");
-          }
-
-          // Wait 5 seconds
-          vTaskDelay(pdMS_TO_TICKS(IP_SCREEN_DISPLAY_TIME_MS));
-          switch_to_home_screen();
-        }
+static void button_gesture_handler(int button_id, button_gesture_t gesture,
+                                   void *ctx) {
+  input_event_type_t type;
+  switch (gesture) {
+  case BUTTON_GESTURE_CLICK:
+    type = INPUT_EVENT_CLICK;
+    break;
+  case BUTTON_GESTURE_DOUBLE_CLICK:
+    type = INPUT_EVENT_DOUBLE_CLICK;
+    break;
+  case BUTTON_GESTURE_LONG_PRESS:
+    type = INPUT_EVENT_LONG_PRESS;
+    break;
+  case BUTTON_GESTURE_HOLD_REPEAT:
+    type = INPUT_EVENT_HOLD_REPEAT;
+    break;
+  default:
+    return;
+  }
+  input_bus_post_simple(type, INPUT_SOURCE_BUTTON, (input_control_t)button_id,
+                        0);
+}
+
+// Runs the light sleep / deep sleep sequence. Returns after waking from light
+// sleep; does not return if deep sleep is entered.
+static void enter_power_save(void) {
+  if (s_sleep_requested) {
+    ESP_LOGI(TAG, "Sleep requested. Entering light sleep...");
+  } else {
+    ESP_LOGI(TAG, "Muted for >%" PRIu32 " ms. Entering light sleep...",
+             g_runtime_config.light_sleep_delay_ms);
+  }
+  s_sleep_requested = false;
+
+  // Disconnect WiFi before sleep to bypass bcn_timeout on wakeup
+  set_wifi_sleep_mode(true);
+
+  // Enter sleep (logic inside audio_pipeline_manager.c)
+  // Pass timer wakeup duration ONLY if Light+Deep mode is active
+  uint64_t requested_sleep_us =
+      (g_runtime_config.power_save_mode == POWER_SAVE_LIGHT_DEEP)
+          ? ((uint64_t)g_runtime_config.deep_sleep_delay_ms * 1000)
+          : 0;
+  int64_t sleep_start_time = esp_timer_get_time();
+
+  ESP_LOGI(TAG, "Entering light sleep stage (requested %llu us, mode: %d)...",
+           requested_sleep_us, (int)g_runtime_config.power_save_mode);
+
+  // Set sentinel to ensure lockout is active during the sleep/wake
+  // transition
+  g_last_wakeup_time = LLONG_MAX;
+
+  // The press GPIOs become level-triggered wakeup sources while asleep
+  button_gesture_suspend(s_volume_button);
+  button_gesture_suspend(s_station_button);
+
+  audio_pipeline_manager_sleep(&audio_pipeline_components, VOLUME_PRESS_GPIO,
+                               STATION_PRESS_GPIO, requested_sleep_us);
+
+  // --- AFTER WAKEUP ---
+
+  // Set wakeup timestamp for lockout immediately to prevent race with
+  // polling tasks
+  g_last_wakeup_time = esp_timer_get_time();
+
+  // Check wakeup cause and duration
+  int64_t actual_sleep_duration_us = esp_timer_get_time() - sleep_start_time;
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+
+  ESP_LOGI(TAG,
+           "Woke from light sleep after %lld us. Cause: %d (1=EXT0, "
+           "2=EXT1, 4=TIMER, 7=GPIO)",
+           actual_sleep_duration_us, cause);
+
+  // Calculate safety threshold based on current delay (90%)
+  uint64_t min_sleep_threshold_us =
+      (uint64_t)g_runtime_config.deep_sleep_delay_ms * 900;
+
+  // ONLY enter deep sleep if in LIGHT_DEEP mode and it was a timer
+  // timeout
+  if (g_runtime_config.power_save_mode == POWER_SAVE_LIGHT_DEEP &&
+      cause == ESP_SLEEP_WAKEUP_TIMER &&
+      actual_sleep_duration_us >= min_sleep_threshold_us) {
+    ESP_LOGI(TAG, "Deep sleep timeout reached. Transitioning to system "
+                  "deep sleep...");
+
+    // Ensure Station button is released before entering deep sleep
+    while (gpio_get_level(STATION_PRESS_GPIO) == 0) {
+      ESP_LOGI(TAG, "Waiting for Station button release before deep sleep...");
+      vTaskDelay(pdMS_TO_TICKS(100));
+    }
+
+    // Ensure WiFi is stopped for a clean state
+    set_wifi_sleep_mode(true);
+    esp_wifi_stop();
+
+    // Disable all wakeup sources before re-configuring for deep sleep
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+
+    // Ensure RTC pull-up is enabled for deep sleep (using STATION_PRESS_GPIO
+    // which is RTCIO)
+    rtc_gpio_init(STATION_PRESS_GPIO);
+    rtc_gpio_set_direction(STATION_PRESS_GPIO, RTC_GPIO_MODE_INPUT_ONLY);
+    rtc_gpio_pullup_en(STATION_PRESS_GPIO);
+    rtc_gpio_pulldown_dis(STATION_PRESS_GPIO);
+
+    // Configure deep sleep wakeup on Station Press GPIO
+    esp_sleep_enable_ext0_wakeup(STATION_PRESS_GPIO, 0); // Wake on LOW
+
+    ESP_LOGI(TAG, "Entering deep sleep NOW. Wake up with Station Press.");
+    esp_deep_sleep_start();
+  } else {
+    ESP_LOGI(TAG, "Light sleep interrupted (duration glitch or button "
+                  "press). Resuming...");
+  }
+
+  // If we reach here, it was a GPIO wakeup (or other). The press that woke
+  // us is swallowed by the gesture engine.
+  button_gesture_resume(s_volume_button);
+  button_gesture_resume(s_station_button);
+  ESP_LOGI(TAG, "Resuming from light sleep...");
+
+  // Trigger reconnection immediately (non-blocking)
+  set_wifi_sleep_mode(false);
+
+  // Wake up display immediately for user feedback
+  lvgl_ssd1306_wakeup();
+
+  // Wait for wifi before restarting pipeline; files don't need it
+  if (!local_media_is_active()) {
+    wait_for_wifi_connection();
+  }
+
+  // Brief delay to let network stack settle
+  vTaskDelay(pdMS_TO_TICKS(100));
+
+  // Restart pipeline
+  extern audio_event_iface_handle_t evt;
+  audio_pipeline_manager_wakeup(&audio_pipeline_components, evt);
+
+  // Reset watchdog to avoid spurious restarts
+  reset_watchdog_counter();
+
+  // The light sleep state is awakened by a press on the volume switch along
+  // with unmuting.
+  set_mute(false, "wakeup");
+}
+
+// Waits for the mute timeout instead of polling. Woken early by every mute
+// change; the wait is capped so configuration changes are picked up. A
+// recording holds power save off until it ends.
+static void power_save_task(void *pvParameters) {
+  ESP_LOGI(TAG, "Power save task started.");
+  for (;;) {
+    TickType_t wait = portMAX_DELAY;
+    if (recorder_is_recording()) {
+      wait = pdMS_TO_TICKS(POWER_SAVE_RECHECK_MS);
+    } else if (is_muted &&
+               g_runtime_config.power_save_mode != POWER_SAVE_NONE) {
+      int64_t elapsed_ms = (esp_timer_get_time() - mute_start_time) / 1000;
+      int64_t remaining_ms =
+          (int64_t)g_runtime_config.light_sleep_delay_ms - elapsed_ms;
+      if (remaining_ms <= 0 || s_sleep_requested) {
+        enter_power_save();
+        continue;
+      }
+      wait = pdMS_TO_TICKS(MIN(remaining_ms, POWER_SAVE_RECHECK_MS));
+      if (wait == 0) {
+        wait = 1;
       }
     }
-    vTaskDelay(pdMS_TO_TICKS(STATION_PRESS_POLLING_PERIOD_MS));
+    ulTaskNotifyTake(pdTRUE, wait);
   }
 }
 
@@ -470,6 +950,7 @@ void update_station_select_pulse_counter(void *pvParameters) {
   last_step_count /= 4; // Each detent is 4 counts for a full cycle
 
   bool on_station_screen = false;
+  int fast_streak = 0; // signed count of consecutive fast moves
 
   for (;;) {
     const int fast_poll_ms = 20;
@@ -492,6 +973,22 @@ void update_station_select_pulse_counter(void *pvParameters) {
         continue;
       }
 
+      lvgl_ssd1306_notify_activity();
+
+      if (s_search_active || local_media_is_active()) {
+        // Rotation picks the next character of the search query, or moves
+        // through the files
+        input_bus_post_simple(INPUT_EVENT_ENCODER_STEP, INPUT_SOURCE_ENCODER,
+                              INPUT_CONTROL_STATION,
+                              current_step_count - last_step_count);
+        last_step_count = current_step_count;
+        on_station_screen = false;
+        current_poll_ms = fast_poll_ms;
+        last_change_time = xTaskGetTickCount();
+        vTaskDelay(pdMS_TO_TICKS(current_poll_ms));
+        continue;
+      }
+
       // A change occurred, switch to station screen if not already there
       if (!on_station_screen) {
         on_station_screen = true;
@@ -500,13 +997,44 @@ void update_station_select_pulse_counter(void *pvParameters) {
       }
 
       int step_delta = current_step_count - last_step_count;
+      // The list may have been replaced since the encoders were set up
+      const station_snapshot_t *snapshot = station_snapshot_acquire();
+      counter->num_values = snapshot->count;
+      if (counter->num_values == 0) {
+        station_snapshot_release(snapshot);
+        last_step_count = current_step_count;
+        continue;
+      }
 
-      // Update index with wrapping
-      int new_index =
-          (counter->current_index + step_delta) % counter->num_values;
-      if (new_index < 0) {
-        new_index += counter->num_values;
+      // Consecutive quick moves in one direction accelerate
+      TickType_t now = xTaskGetTickCount();
+      bool fast = abs(step_delta) > 1 ||
+                  now - last_change_time <
+                      pdMS_TO_TICKS(FAST_SCROLL_INTERVAL_MS);
+      if (fast && (step_delta > 0) == (fast_streak > 0)) {
+        fast_streak += step_delta > 0 ? 1 : -1;
+      } else {
+        fast_streak = step_delta > 0 ? 1 : -1;
       }
+      int streak = abs(fast_streak);
+
+      int new_index;
+      if (counter->num_values >= FAST_SCROLL_MIN_STATIONS &&
+          streak >= JUMP_SCROLL_STREAK) {
+        new_index = station_index_jump_initial(
+            snapshot->index, counter->current_index, step_delta);
+      } else {
+        if (counter->num_values >= FAST_SCROLL_MIN_STATIONS &&
+            streak >= FAST_SCROLL_STREAK) {
+          step_delta *= FAST_SCROLL_STEP;
+        }
+        // Update index with wrapping
+        new_index = (counter->current_index + step_delta) % counter->num_values;
+        if (new_index < 0) {
+          new_index += counter->num_values;
+        }
+      }
+      station_snapshot_release(snapshot);
       counter->current_index = new_index;
       ESP_LOGI(TAG, "Cyclic index: %d", counter->current_index);
       update_station_roller(counter->current_index);
@@ -519,13 +1047,14 @@ void update_station_select_pulse_counter(void *pvParameters) {
                (xTaskGetTickCount() - last_change_time) >
                    pdMS_TO_TICKS(inactivity_timeout_ms)) {
       // Inactivity timeout reached, perform action and switch back to slow
-      // polling
-      ESP_LOGI(TAG, "Inactivity timeout, changing station to index %d",
-               counter->current_index);
-
-      change_station(counter->current_index);
+      // polling. Rotation on the search screen selects nothing.
+      if (on_station_screen) {
+        ESP_LOGI(TAG, "Inactivity timeout, selecting station index %d",
+                 counter->current_index);
 
-      switch_to_home_screen();
+        input_bus_post_simple(INPUT_EVENT_STATION_SELECT, INPUT_SOURCE_ENCODER,
+                              INPUT_CONTROL_STATION, counter->current_index);
+      }
 
       current_poll_ms = slow_poll_ms;
       on_station_screen = false;
@@ -641,7 +1170,6 @@ void init_encoders(audio_board_handle_t board_handle, int initial_volume,
   xTaskCreate(update_volume_pulse_counter, "update_volume_pulse_counter",
               4 * 1024, volume_counter, 5, NULL);
 
-  xTaskCreate(volume_press_task, "volume_press_task", 6144, NULL, 5, NULL);
 
   // *********************  station encoder  **********************
   static gpio_config_t station_encoder_gpio_config = {
@@ -692,11 +1220,55 @@ void init_encoders(audio_board_handle_t board_handle, int initial_volume,
   // Use malloc to keep it in scope for the task and for sync function
   g_station_counter_ptr = malloc(sizeof(cyclic_pulse_counter_t));
   g_station_counter_ptr->pcnt_unit = station_pcnt_unit;
-  g_station_counter_ptr->num_values = station_count;
+  g_station_counter_ptr->num_values = 0; // set from the list on each turn
   g_station_counter_ptr->current_index = current_station;
 
   xTaskCreate(update_station_select_pulse_counter,
               "update_station_select_pulse_counter", 4 * 1024,
               g_station_counter_ptr, 5, NULL);
-  xTaskCreate(station_press_task, "station_press_task", 4096, NULL, 5, NULL);
+
+  // *********************  press switches  **********************
+  const esp_timer_create_args_t ip_timer_args = {
+      .callback = ip_screen_timeout_cb, .name = "ip_screen"};
+  ESP_ERROR_CHECK(esp_timer_create(&ip_timer_args, &s_ip_screen_timer));
+  const esp_timer_create_args_t search_timer_args = {
+      .callback = search_timeout_cb, .name = "search_screen"};
+  ESP_ERROR_CHECK(esp_timer_create(&search_timer_args, &s_search_timer));
+  const esp_timer_create_args_t browse_timer_args = {
+      .callback = browse_timeout_cb, .name = "browse_select"};
+  ESP_ERROR_CHECK(esp_timer_create(&browse_timer_args, &s_browse_timer));
+
+  xTaskCreate(input_dispatch_task, "input_dispatch_task", 6144, NULL, 5, NULL);
+  xTaskCreate(power_save_task, "power_save_task", 6144, NULL, 5,
+              &s_power_save_task);
+
+  // Volume: click toggles mute, double click toggles the IR audio device,
+  // long press pauses or resumes (time-shift, or a local file), holding on
+  // skips back
+  const button_gesture_config_t volume_button_config = {
+      .gpio = VOLUME_PRESS_GPIO,
+      .active_low = true,
+      .button_id = INPUT_CONTROL_VOLUME,
+      .timing = {.debounce_ms = BUTTON_DEBOUNCE_MS,
+                 .double_click_ms = DOUBLE_CLICK_TIMEOUT_MS,
+                 .long_press_ms = LONG_PRESS_TIME_MS,
+                 .repeat_ms = SKIP_REPEAT_TIME_MS},
+      .callback = button_gesture_handler,
+  };
+  ESP_ERROR_CHECK(
+      button_gesture_create(&volume_button_config, &s_volume_button));
+
+  // Station: click shows the IP, double click opens the station search (the
+  // folders while files play), long press reboots
+  const button_gesture_config_t station_button_config = {
+      .gpio = STATION_PRESS_GPIO,
+      .active_low = true,
+      .button_id = INPUT_CONTROL_STATION,
+      .timing = {.debounce_ms = BUTTON_DEBOUNCE_MS,
+                 .double_click_ms = DOUBLE_CLICK_TIMEOUT_MS,
+                 .long_press_ms = LONG_PRESS_TIME_MS},
+      .callback = button_gesture_handler,
+  };
+  ESP_ERROR_CHECK(
+      button_gesture_create(&station_button_config, &s_station_button));
 }
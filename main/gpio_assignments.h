@@ -42,4 +42,11 @@
 // ==========================================
 #define IR_TX_GPIO 8
 
+// ==========================================
+// SD CARD (SDMMC, 1-line; the display has the SPI bus)
+// ==========================================
+#define SD_CLK_GPIO 12
+#define SD_CMD_GPIO 11
+#define SD_D0_GPIO 13
+
 #endif // _GPIO_ASSIGNMENTS_H_
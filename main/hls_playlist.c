@@ -0,0 +1,392 @@
+#include "hls_playlist.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static bool has_prefix(const char *s, const char *prefix) {
+  return strncasecmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* Value of attribute name in an attribute list (NAME=VALUE,NAME="V,V"),
+ * quotes removed. Returns false if it isn't there or doesn't fit. */
+static bool attr_get(const char *attrs, const char *name, char *out,
+                     size_t len) {
+  size_t name_len = strlen(name);
+  const char *p = attrs;
+  while (*p) {
+    while (*p == ',' || *p == ' ') {
+      p++;
+    }
+    const char *eq = strchr(p, '=');
+    if (eq == NULL) {
+      return false;
+    }
+    bool match = (size_t)(eq - p) == name_len &&
+                 strncasecmp(p, name, name_len) == 0;
+    const char *value = eq + 1;
+    const char *end;
+    if (*value == '"') {
+      value++;
+      end = strchr(value, '"');
+      if (end == NULL) {
+        end = value + strlen(value);
+      }
+      p = *end ? end + 1 : end;
+    } else {
+      end = value + strcspn(value, ",");
+      p = end;
+    }
+    if (match) {
+      size_t n = end - value;
+      if (n >= len) {
+        return false;
+      }
+      memcpy(out, value, n);
+      out[n] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+/* "10", "9.984", "10.0," (and the title): milliseconds */
+static uint32_t parse_duration_ms(const char *s) {
+  uint32_t ms = strtoul(s, (char **)&s, 10) * 1000;
+  if (*s == '.') {
+    uint32_t scale = 100;
+    for (s++; isdigit((unsigned char)*s); s++) {
+      ms += (*s - '0') * scale;
+      scale /= 10;
+    }
+  }
+  return ms;
+}
+
+/* ---------- URIs ---------- */
+
+/* Removes "." and ".." segments from a path that starts with '/' */
+static void remove_dot_segments(char *path) {
+  char *out = path;
+  const char *in = path;
+  while (*in) {
+    const char *seg = in + 1;
+    const char *end = strchr(seg, '/');
+    size_t n = end ? (size_t)(end - seg) : strlen(seg);
+    in = seg + n;
+    if (n == 1 && seg[0] == '.') {
+      // dropped
+    } else if (n == 2 && seg[0] == '.' && seg[1] == '.') {
+      while (out > path && *--out != '/') {
+      }
+    } else {
+      *out++ = '/';
+      memmove(out, seg, n);
+      out += n;
+      continue;
+    }
+    if (end == NULL) {
+      *out++ = '/'; // "a/." and "a/.." name a directory
+    }
+  }
+  if (out == path) {
+    *out++ = '/';
+  }
+  *out = '\0';
+}
+
+static const char *skip_scheme(const char *uri) {
+  const char *p = uri;
+  while (isalnum((unsigned char)*p) || *p == '+' || *p == '-' || *p == '.') {
+    p++;
+  }
+  return p > uri && strncmp(p, "://", 3) == 0 ? p + 3 : NULL;
+}
+
+bool hls_resolve_uri(const char *base, const char *ref, char *out,
+                     size_t len) {
+  const char *host = skip_scheme(base);
+  int n;
+  if (skip_scheme(ref) != NULL || host == NULL) {
+    n = snprintf(out, len, "%s", ref);
+  } else if (ref[0] == '/' && ref[1] == '/') {
+    n = snprintf(out, len, "%.*s%s", (int)(host - 2 - base), base, ref);
+  } else {
+    const char *path = host + strcspn(host, "/?#");
+    const char *query = path + strcspn(path, "?#");
+    if (ref[0] == '/') {
+      n = snprintf(out, len, "%.*s%s", (int)(path - base), base, ref);
+    } else {
+      // Up to the last '/' of the base's path, if it has one
+      const char *dir = query;
+      while (dir > path && dir[-1] != '/') {
+        dir--;
+      }
+      n = dir > path
+              ? snprintf(out, len, "%.*s%s", (int)(dir - base), base, ref)
+              : snprintf(out, len, "%.*s/%s", (int)(path - base), base, ref);
+    }
+  }
+  if (n < 0 || (size_t)n >= len) {
+    return false;
+  }
+
+  // Dot segments of the path, the query left as it is
+  char *path = (char *)skip_scheme(out);
+  if (path == NULL) {
+    return true;
+  }
+  path += strcspn(path, "/?#");
+  if (*path != '/') {
+    return true;
+  }
+  char *query = path + strcspn(path, "?#");
+  char rest[HLS_URI_MAX];
+  if (strlen(query) >= sizeof(rest)) {
+    return false;
+  }
+  strcpy(rest, query);
+  *query = '\0';
+  remove_dot_segments(path);
+  strcat(path, rest); // no longer than before
+  return true;
+}
+
+/* ---------- parser ---------- */
+
+static void add_variant(hls_playlist_t *pl, const char *uri) {
+  if (pl->variant_count >= HLS_MAX_VARIANTS) {
+    return;
+  }
+  hls_variant_t *v = &pl->variants[pl->variant_count];
+  if (!hls_resolve_uri(pl->base, uri, v->uri, sizeof(v->uri))) {
+    return;
+  }
+  v->bandwidth = pl->variant_bandwidth;
+  strcpy(v->codecs, pl->variant_codecs);
+  pl->variant_count++;
+}
+
+static void add_segment(hls_playlist_t *pl, const char *uri) {
+  uint64_t sequence = pl->next_sequence++;
+  pl->total_segments++;
+  bool discontinuity = pl->seg_discontinuity;
+  uint32_t duration = pl->seg_duration_ms;
+  pl->seg_discontinuity = false;
+  pl->seg_duration_ms = 0;
+
+  hls_segment_t *seg;
+  if (pl->from == HLS_FROM_LIVE_EDGE) {
+    // A ring of the latest, until the end of the playlist shows where to
+    // start
+    if (pl->segment_count < HLS_MAX_SEGMENTS) {
+      seg = &pl->segments[(pl->first_kept + pl->segment_count++) %
+                          HLS_MAX_SEGMENTS];
+    } else {
+      seg = &pl->segments[pl->first_kept];
+      pl->first_kept = (pl->first_kept + 1) % HLS_MAX_SEGMENTS;
+      pl->truncated = true;
+    }
+  } else if (sequence < pl->from) {
+    return;
+  } else if (pl->segment_count < HLS_MAX_SEGMENTS) {
+    seg = &pl->segments[pl->segment_count++];
+  } else {
+    pl->truncated = true;
+    return;
+  }
+  if (!hls_resolve_uri(pl->base, uri, seg->uri, sizeof(seg->uri))) {
+    seg->uri[0] = '\0'; // fetching it fails, and the next one is tried
+  }
+  seg->sequence = sequence;
+  seg->duration_ms = duration;
+  seg->discontinuity = discontinuity;
+}
+
+static void parse_tag(hls_playlist_t *pl, const char *line) {
+  char value[16];
+  if (has_prefix(line, "#EXTINF:")) {
+    // Plain lists have these too, with -1 for a stream
+    pl->seg_duration_ms = line[8] == '-' ? 0 : parse_duration_ms(line + 8);
+    return;
+  }
+  if (!has_prefix(line, "#EXT-X-")) {
+    return; // #EXTM3U, comments
+  }
+  pl->tagged = true;
+  if (has_prefix(line, "#EXT-X-TARGETDURATION:")) {
+    pl->target_duration_ms = strtoul(line + 22, NULL, 10) * 1000;
+    pl->type = HLS_PLAYLIST_MEDIA;
+  } else if (has_prefix(line, "#EXT-X-MEDIA-SEQUENCE:")) {
+    pl->next_sequence = strtoull(line + 22, NULL, 10);
+    pl->first_sequence = pl->next_sequence;
+  } else if (has_prefix(line, "#EXT-X-DISCONTINUITY") &&
+             !has_prefix(line, "#EXT-X-DISCONTINUITY-SEQUENCE")) {
+    pl->seg_discontinuity = true;
+  } else if (has_prefix(line, "#EXT-X-ENDLIST")) {
+    pl->ended = true;
+  } else if (has_prefix(line, "#EXT-X-STREAM-INF:")) {
+    pl->type = HLS_PLAYLIST_MASTER;
+    pl->variant_pending = true;
+    pl->variant_bandwidth =
+        attr_get(line + 18, "BANDWIDTH", value, sizeof(value))
+            ? strtoul(value, NULL, 10)
+            : 0;
+    if (!attr_get(line + 18, "CODECS", pl->variant_codecs,
+                  sizeof(pl->variant_codecs))) {
+      pl->variant_codecs[0] = '\0';
+    }
+  } else if (has_prefix(line, "#EXT-X-KEY:")) {
+    if (attr_get(line + 11, "METHOD", value, sizeof(value)) &&
+        strcasecmp(value, "NONE") != 0) {
+      pl->unsupported = "encrypted segments";
+    }
+  } else if (has_prefix(line, "#EXT-X-MAP:")) {
+    pl->unsupported = "fragmented MP4 segments";
+  } else if (has_prefix(line, "#EXT-X-BYTERANGE:")) {
+    pl->unsupported = "byte range segments";
+  }
+}
+
+static void parse_line(hls_playlist_t *pl, char *line) {
+  while (isspace((unsigned char)*line)) {
+    line++;
+  }
+  size_t len = strlen(line);
+  while (len > 0 && isspace((unsigned char)line[len - 1])) {
+    line[--len] = '\0';
+  }
+  if (len == 0) {
+    return;
+  }
+  if (line[0] == '#') {
+    parse_tag(pl, line);
+  } else if (pl->variant_pending) {
+    pl->variant_pending = false;
+    add_variant(pl, line);
+  } else if (pl->type != HLS_PLAYLIST_MASTER) {
+    add_segment(pl, line);
+  }
+}
+
+void hls_playlist_begin(hls_playlist_t *pl, const char *base_uri,
+                        uint64_t from) {
+  memset(pl, 0, sizeof(*pl));
+  snprintf(pl->base, sizeof(pl->base), "%s", base_uri);
+  pl->from = from;
+}
+
+void hls_playlist_feed(hls_playlist_t *pl, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    if (c == '\n' || c == '\r') {
+      if (!pl->line_skip && pl->line_len > 0) {
+        pl->line[pl->line_len] = '\0';
+        parse_line(pl, pl->line);
+      }
+      pl->line_len = 0;
+      pl->line_skip = false;
+    } else if (pl->line_len < sizeof(pl->line) - 1) {
+      pl->line[pl->line_len++] = c;
+    } else {
+      pl->line_skip = true;
+    }
+  }
+}
+
+/* Puts a live edge ring in order */
+static void unroll(hls_playlist_t *pl) {
+  for (int k = 0; k < pl->first_kept; k++) {
+    hls_segment_t first = pl->segments[0];
+    memmove(&pl->segments[0], &pl->segments[1],
+            (HLS_MAX_SEGMENTS - 1) * sizeof(hls_segment_t));
+    pl->segments[HLS_MAX_SEGMENTS - 1] = first;
+  }
+  pl->first_kept = 0;
+}
+
+void hls_playlist_end(hls_playlist_t *pl) {
+  if (!pl->line_skip && pl->line_len > 0) {
+    pl->line[pl->line_len] = '\0';
+    parse_line(pl, pl->line);
+  }
+  pl->line_len = 0;
+
+  if (pl->type == HLS_PLAYLIST_UNKNOWN && pl->total_segments > 0) {
+    pl->type = pl->tagged ? HLS_PLAYLIST_MEDIA : HLS_PLAYLIST_PLAIN;
+  }
+  if (pl->type == HLS_PLAYLIST_PLAIN) {
+    pl->ended = true; // each entry is a stream of its own
+  }
+  if (pl->from != HLS_FROM_LIVE_EDGE) {
+    return;
+  }
+  unroll(pl);
+  if (!pl->ended && pl->segment_count > HLS_LIVE_START_SEGMENTS) {
+    int drop = pl->segment_count - HLS_LIVE_START_SEGMENTS;
+    memmove(&pl->segments[0], &pl->segments[drop],
+            HLS_LIVE_START_SEGMENTS * sizeof(hls_segment_t));
+    pl->segment_count = HLS_LIVE_START_SEGMENTS;
+    pl->truncated = false;
+  }
+}
+
+/* ---------- variants ---------- */
+
+static bool audio_only(const hls_variant_t *v) {
+  static const char *const video[] = {"avc1", "avc3", "hvc1", "hev1"};
+  if (v->codecs[0] == '\0') {
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(video) / sizeof(video[0]); i++) {
+    if (strstr(v->codecs, video[i]) != NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int hls_variant_select(const hls_playlist_t *pl, int current,
+                       uint32_t measured_bps) {
+  if (pl->variant_count == 0) {
+    return -1;
+  }
+  if (current < 0 || current >= pl->variant_count) {
+    for (int i = 0; i < pl->variant_count; i++) {
+      if (audio_only(&pl->variants[i])) {
+        return i;
+      }
+    }
+    return 0;
+  }
+  if (measured_bps == 0) {
+    return current;
+  }
+
+  const hls_variant_t *cur = &pl->variants[current];
+  uint64_t fit = (uint64_t)measured_bps * HLS_BANDWIDTH_SHARE / 100;
+  uint64_t keep = (uint64_t)measured_bps * HLS_BANDWIDTH_KEEP_SHARE / 100;
+  int best = -1;
+  int lowest = current;
+  for (int i = 0; i < pl->variant_count; i++) {
+    const hls_variant_t *v = &pl->variants[i];
+    if (strcmp(v->codecs, cur->codecs) != 0) {
+      continue;
+    }
+    if (v->bandwidth < pl->variants[lowest].bandwidth) {
+      lowest = i;
+    }
+    if (v->bandwidth <= fit &&
+        (best < 0 || v->bandwidth > pl->variants[best].bandwidth)) {
+      best = i;
+    }
+  }
+  if (best >= 0 && pl->variants[best].bandwidth > cur->bandwidth) {
+    return best;
+  }
+  if (cur->bandwidth <= keep) {
+    return current;
+  }
+  return best >= 0 ? best : lowest;
+}
@@ -0,0 +1,137 @@
+#ifndef HLS_PLAYLIST_H
+#define HLS_PLAYLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * HLS playlists (RFC 8216), parsed as they download
+ *
+ * A station's .m3u8 is either a master playlist, listing variants of the
+ * stream at different bitrates, or a media playlist, listing the segments
+ * of one variant. A live media playlist is a window that moves on as the
+ * station plays: it is loaded again every target duration, and only the
+ * segments from a given sequence number on are kept, so each load adds the
+ * segments not fetched yet. The body is taken in pieces of any size as it
+ * arrives; a playlist is never held whole.
+ *
+ * An .m3u8 without any HLS tags is a plain list of streams, as some
+ * stations serve; its entries are kept as segments without a duration.
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+#define HLS_URI_MAX 384
+#define HLS_LINE_MAX 512 // longer lines are skipped
+#define HLS_CODECS_MAX 48
+#define HLS_MAX_VARIANTS 8
+#define HLS_MAX_SEGMENTS 16
+// Where playback joins a live stream: this many segments from the end
+// (RFC 8216 6.3.3)
+#define HLS_LIVE_START_SEGMENTS 3
+// hls_playlist_begin() from: keep the live start
+#define HLS_FROM_LIVE_EDGE UINT64_MAX
+// Share of the measured throughput a variant may take, and the share at
+// which the playing one is given up
+#define HLS_BANDWIDTH_SHARE 70
+#define HLS_BANDWIDTH_KEEP_SHARE 85
+
+typedef enum {
+  HLS_PLAYLIST_UNKNOWN, // nothing recognizable
+  HLS_PLAYLIST_MASTER,
+  HLS_PLAYLIST_MEDIA,
+  HLS_PLAYLIST_PLAIN, // a list of streams
+} hls_playlist_type_t;
+
+typedef struct {
+  char uri[HLS_URI_MAX]; // absolute
+  uint32_t bandwidth;    // bits per second, as announced
+  char codecs[HLS_CODECS_MAX]; // CODECS attribute, "" if none
+} hls_variant_t;
+
+typedef struct {
+  char uri[HLS_URI_MAX]; // absolute
+  uint64_t sequence;
+  uint32_t duration_ms; // 0 in a plain list
+  bool discontinuity;   // the format or timestamps may change here
+} hls_segment_t;
+
+typedef struct {
+  hls_playlist_type_t type;
+  bool ended;     // EXT-X-ENDLIST: nothing will be added
+  bool truncated; // more segments from `from` on than were kept
+  const char *unsupported; // why the segments can't be played, or NULL
+  uint32_t target_duration_ms;
+  uint64_t first_sequence; // of the playlist
+  uint32_t total_segments; // in the playlist
+  int variant_count;
+  int segment_count;
+  hls_variant_t variants[HLS_MAX_VARIANTS];
+  hls_segment_t segments[HLS_MAX_SEGMENTS]; // in order
+
+  // Parser state
+  char base[HLS_URI_MAX];
+  uint64_t from;
+  char line[HLS_LINE_MAX];
+  size_t line_len;
+  bool line_skip; // rest of a line too long to keep
+  bool tagged;    // any #EXT-X- tag seen
+  uint64_t next_sequence;
+  int first_kept; // live edge: segments is a ring starting here
+  uint32_t seg_duration_ms;
+  bool seg_discontinuity;
+  bool variant_pending;
+  uint32_t variant_bandwidth;
+  char variant_codecs[HLS_CODECS_MAX];
+} hls_playlist_t;
+
+/**
+ * @brief Starts parsing a playlist downloaded from base_uri (the address
+ * after redirects: segment URIs are relative to it). Segments before
+ * sequence number from are left out; HLS_FROM_LIVE_EDGE keeps where a live
+ * stream starts, or all of an ended one if they fit.
+ */
+void hls_playlist_begin(hls_playlist_t *pl, const char *base_uri,
+                        uint64_t from);
+
+/**
+ * @brief Parses the next piece of the body.
+ */
+void hls_playlist_feed(hls_playlist_t *pl, const char *data, size_t len);
+
+/**
+ * @brief Parses what is left after the last line break and settles the
+ * type and the segments kept.
+ */
+void hls_playlist_end(hls_playlist_t *pl);
+
+/**
+ * @brief Resolves ref against the address base into out.
+ * @return false if the result doesn't fit.
+ */
+bool hls_resolve_uri(const char *base, const char *ref, char *out,
+                     size_t len);
+
+/**
+ * @brief Picks the variant of a master playlist to play at a measured
+ * throughput. Without a current one (-1) the first audio-only variant is
+ * picked, as listed (the station's choice), or the first one. Otherwise
+ * only variants with the current one's CODECS are considered, so the
+ * decoder never sees the profile change: the highest one taking at most
+ * HLS_BANDWIDTH_SHARE percent of the throughput, the lowest if none fits.
+ * The current one is kept while it takes at most HLS_BANDWIDTH_KEEP_SHARE
+ * percent and nothing higher fits.
+ */
+int hls_variant_select(const hls_playlist_t *pl, int current,
+                       uint32_t measured_bps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HLS_PLAYLIST_H
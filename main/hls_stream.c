@@ -0,0 +1,812 @@
+#include "hls_stream.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "hls_playlist.h"
+#include "mpegts_demux.h"
+#include "ringbuf.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+static const char *TAG = "HLS_STREAM";
+
+extern audio_pipeline_components_t audio_pipeline_components;
+
+// Read from the connection at a time, into internal RAM: TLS decrypts into
+// it, and PSRAM would slow every byte
+#define HLS_CHUNK (4 * 1024)
+// Connecting, and the longest a read blocks
+#define HLS_HTTP_TIMEOUT_MS 5000
+#define HLS_MAX_REDIRECTS 4
+// Longest opening the element waits for the playlists
+#define HLS_OPEN_TIMEOUT_MS 15000
+// Longest the decoder is kept waiting, so the pipeline can be stopped
+#define HLS_READ_TIMEOUT_MS 100
+// Audio gathered after the buffer ran dry before playing on, so a slow link
+// gives a few longer gaps rather than constant stutter
+#define HLS_RESUME_MS 2000
+// How often the fetch task looks for room in the buffer
+#define HLS_IDLE_MS 100
+// For playlists that don't say
+#define HLS_DEFAULT_TARGET_MS 6000
+// A segment that fails is tried this often, then skipped
+#define HLS_SEGMENT_TRIES 3
+#define HLS_RETRY_MIN_MS 500
+#define HLS_RETRY_MAX_MS 8000
+// Smaller downloads say little about the link
+#define HLS_MEASURE_MIN_BYTES (16 * 1024)
+#define HLS_TASK_STACK 6144 // TLS
+// As the HTTP reader it stands in for
+#define HLS_TASK_PRIORITY 4
+#define HLS_ELEMENT_STACK 3072
+#define HLS_OUT_RB_SIZE (20 * 1024)
+
+typedef struct {
+  hls_playlist_t lists[2];
+  hls_playlist_t *master; // variants, if the station's URL is a master list
+  hls_playlist_t *media;  // segments from next_sequence on
+  mpegts_demux_t demux;
+  esp_http_client_handle_t client;
+  uint8_t *chunk;         // internal RAM
+  ringbuf_handle_t queue; // PSRAM, demuxed audio
+  SemaphoreHandle_t ready; // given once the first playlists are loaded
+  esp_err_t open_result;
+  atomic_bool stopping;
+  atomic_bool ended; // all of the stream is in the buffer
+  bool task_done; // under session_lock, with detached
+  bool detached;  // the element is done with the session
+  codec_type_t codec;
+  bool warned; // about the audio the stream carries
+  char uri[HLS_URI_MAX];       // the station's
+  char media_uri[HLS_URI_MAX]; // the variant's
+  char base[HLS_URI_MAX];      // where the last body came from
+  char origin[HLS_URI_MAX];    // of the open connection, "" if none
+  bool conn_close;             // the server closes it after this response
+
+  int variant; // -1 without a master playlist
+  int next;    // in media->segments
+  uint64_t next_sequence; // first one not fetched
+  int64_t next_reload_ms;
+  int tries;
+  uint32_t retry_ms;
+  uint32_t measured_bps;
+  uint32_t es_rate;      // audio bytes per second, as the last segment
+  uint32_t expected;     // audio bytes of a segment, as the last one
+  uint32_t segment_out;  // audio bytes of the segment being fetched
+  int64_t write_wait_us; // of the segment being fetched, on a full buffer
+
+  // Element side
+  bool played;
+  bool starving;
+  int64_t starve_us;
+  int64_t open_us;
+} hls_session_t;
+
+static hls_session_t *session = NULL; // the element's
+static portMUX_TYPE session_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static hls_stream_stats_t stats = {.variant = -1};
+
+static void *hls_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+static int64_t now_ms(void) { return esp_timer_get_time() / 1000; }
+
+static bool stopping(hls_session_t *s) { return atomic_load(&s->stopping); }
+
+/* Sleeps, waking early to stop */
+static void pause_ms(hls_session_t *s, uint32_t ms) {
+  while (ms > 0 && !stopping(s)) {
+    uint32_t step = MIN(ms, HLS_IDLE_MS);
+    vTaskDelay(pdMS_TO_TICKS(step));
+    ms -= step;
+  }
+}
+
+static void count_error(hls_session_t *s) {
+  if (!stopping(s)) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.errors++;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+}
+
+/* ---------- HTTP ---------- */
+
+typedef int (*body_cb_t)(void *ctx, const uint8_t *data, size_t len);
+
+static esp_err_t http_event(esp_http_client_event_t *evt) {
+  hls_session_t *s = evt->user_data;
+  if (evt->event_id == HTTP_EVENT_ON_HEADER &&
+      strcasecmp(evt->header_key, "Connection") == 0 &&
+      strcasecmp(evt->header_value, "close") == 0) {
+    s->conn_close = true;
+  }
+  return ESP_OK;
+}
+
+/* Length of the scheme, host and port at the start of url */
+static size_t origin_len(const char *url) {
+  const char *host = strstr(url, "://");
+  host = host ? host + 3 : url;
+  return host - url + strcspn(host, "/?#");
+}
+
+static void disconnect(hls_session_t *s) {
+  esp_http_client_close(s->client);
+  s->origin[0] = '\0';
+}
+
+/* Sends the request and reads the response head, on the open connection
+ * if there is one to the host. A kept connection the server has closed
+ * meanwhile is replaced once. Returns the status, or -1. */
+static int request(hls_session_t *s, const char *url) {
+  size_t len = origin_len(url);
+  if (strlen(s->origin) != len || strncasecmp(s->origin, url, len) != 0) {
+    disconnect(s);
+  }
+  esp_http_client_set_url(s->client, url);
+  for (int attempt = 0; attempt < 2 && !stopping(s); attempt++) {
+    bool reused = s->origin[0] != '\0';
+    s->conn_close = false;
+    esp_err_t err = esp_http_client_open(s->client, 0);
+    if (err == ESP_OK && esp_http_client_fetch_headers(s->client) >= 0) {
+      portENTER_CRITICAL(&stats_lock);
+      stats.requests++;
+      stats.connections += !reused;
+      portEXIT_CRITICAL(&stats_lock);
+      snprintf(s->origin, sizeof(s->origin), "%.*s", (int)len, url);
+      return esp_http_client_get_status_code(s->client);
+    }
+    disconnect(s);
+    if (!reused) {
+      break;
+    }
+  }
+  return -1;
+}
+
+/* GETs url and passes the body to cb, following redirects; s->base gets the
+ * address the body came from. The connection is kept for the next request
+ * when the whole body was read and the server allows. */
+static esp_err_t http_get(hls_session_t *s, const char *url, body_cb_t cb,
+                          void *ctx, uint32_t *bytes) {
+  int status = request(s, url);
+  for (int hop = 0; hop < HLS_MAX_REDIRECTS && status >= 300 && status < 400;
+       hop++) {
+    int len = 0;
+    esp_http_client_flush_response(s->client, &len);
+    if (esp_http_client_set_redirection(s->client) != ESP_OK) {
+      break;
+    }
+    // The new address may be on another host
+    char next[HLS_URI_MAX];
+    esp_http_client_get_url(s->client, next, sizeof(next));
+    status = request(s, next);
+  }
+  if (status != 200) {
+    if (status > 0) {
+      ESP_LOGW(TAG, "HTTP %d for %s", status, url);
+      int len = 0;
+      esp_http_client_flush_response(s->client, &len);
+    }
+    count_error(s);
+    return ESP_FAIL;
+  }
+  esp_http_client_get_url(s->client, s->base, sizeof(s->base));
+
+  int64_t length = esp_http_client_get_content_length(s->client);
+  int64_t last_data = now_ms();
+  uint32_t total = 0;
+  int n;
+  for (;;) {
+    n = esp_http_client_read(s->client, (char *)s->chunk, HLS_CHUNK);
+    if (n > 0) {
+      total += n;
+      last_data = now_ms();
+      portENTER_CRITICAL(&stats_lock);
+      stats.bytes += n;
+      portEXIT_CRITICAL(&stats_lock);
+      if (cb(ctx, s->chunk, n) != 0) {
+        disconnect(s);
+        return ESP_ERR_INVALID_STATE;
+      }
+    } else if (n == -ESP_ERR_HTTP_EAGAIN && !stopping(s) &&
+               now_ms() - last_data < HLS_HTTP_TIMEOUT_MS) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  if (bytes) {
+    *bytes = total;
+  }
+  // A body without a length or chunks ends with the connection
+  bool received = esp_http_client_is_complete_data_received(s->client);
+  if (n < 0 || (!received && !(n == 0 && length < 0))) {
+    ESP_LOGW(TAG, "Body of %s cut short after %" PRIu32 " bytes", url, total);
+    disconnect(s);
+    count_error(s);
+    return ESP_FAIL;
+  }
+  if (s->conn_close || !received) {
+    disconnect(s);
+  }
+  return ESP_OK;
+}
+
+/* ---------- playlists ---------- */
+
+typedef struct {
+  hls_session_t *s;
+  hls_playlist_t *pl;
+  uint64_t from;
+  bool begun;
+} playlist_load_t;
+
+static int playlist_body(void *ctx, const uint8_t *data, size_t len) {
+  playlist_load_t *load = ctx;
+  if (!load->begun) {
+    hls_playlist_begin(load->pl, load->s->base, load->from);
+    load->begun = true;
+  }
+  hls_playlist_feed(load->pl, (const char *)data, len);
+  return stopping(load->s);
+}
+
+static esp_err_t load_playlist(hls_session_t *s, const char *uri,
+                               hls_playlist_t *pl, uint64_t from) {
+  playlist_load_t load = {.s = s, .pl = pl, .from = from};
+  esp_err_t err = http_get(s, uri, playlist_body, &load, NULL);
+  if (err != ESP_OK) {
+    if (!load.begun) {
+      hls_playlist_begin(pl, uri, from);
+    }
+    return err;
+  }
+  if (!load.begun) {
+    hls_playlist_begin(pl, s->base, from);
+  }
+  hls_playlist_end(pl);
+  return ESP_OK;
+}
+
+static uint32_t target_ms(const hls_session_t *s) {
+  uint32_t target = s->media->target_duration_ms;
+  return target ? target : HLS_DEFAULT_TARGET_MS;
+}
+
+static void publish_variant(hls_session_t *s) {
+  const hls_playlist_t *m = s->master;
+  portENTER_CRITICAL(&stats_lock);
+  stats.variant = s->variant;
+  stats.variants = m->variant_count;
+  stats.variant_kbps =
+      s->variant >= 0 ? m->variants[s->variant].bandwidth / 1000 : 0;
+  stats.target_ms = target_ms(s);
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+/* Loads the station's playlist, and the variant's if it lists variants */
+static esp_err_t load_first(hls_session_t *s) {
+  esp_err_t err = load_playlist(s, s->uri, s->master, HLS_FROM_LIVE_EDGE);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to load %s", s->uri);
+    return err;
+  }
+  if (s->master->type == HLS_PLAYLIST_MASTER) {
+    s->variant = hls_variant_select(s->master, -1, 0);
+    if (s->variant < 0) {
+      ESP_LOGE(TAG, "No variants in %s", s->uri);
+      return ESP_ERR_NOT_FOUND;
+    }
+    const hls_variant_t *v = &s->master->variants[s->variant];
+    strlcpy(s->media_uri, v->uri, sizeof(s->media_uri));
+    ESP_LOGI(TAG, "Variant %d of %d: %" PRIu32 " kb/s, %s", s->variant + 1,
+             s->master->variant_count, v->bandwidth / 1000,
+             v->codecs[0] ? v->codecs : "codecs not given");
+    err = load_playlist(s, s->media_uri, s->media, HLS_FROM_LIVE_EDGE);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to load %s", s->media_uri);
+      return err;
+    }
+  } else {
+    // The station's URL is the media playlist itself
+    hls_playlist_t *pl = s->master;
+    s->master = s->media;
+    s->media = pl;
+    s->master->type = HLS_PLAYLIST_UNKNOWN;
+    s->master->variant_count = 0;
+    s->variant = -1;
+    strlcpy(s->media_uri, s->uri, sizeof(s->media_uri));
+  }
+
+  hls_playlist_t *pl = s->media;
+  if (pl->type != HLS_PLAYLIST_MEDIA && pl->type != HLS_PLAYLIST_PLAIN) {
+    ESP_LOGE(TAG, "%s is not a media playlist", s->media_uri);
+    return ESP_ERR_INVALID_RESPONSE;
+  }
+  if (pl->unsupported) {
+    ESP_LOGE(TAG, "%s: %s are not supported", s->media_uri, pl->unsupported);
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  if (pl->ended && pl->truncated) {
+    // A recording longer than the list holds: from its start
+    err = load_playlist(s, s->media_uri, pl, pl->first_sequence);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  if (pl->segment_count == 0) {
+    ESP_LOGE(TAG, "No segments in %s", s->media_uri);
+    return ESP_ERR_NOT_FOUND;
+  }
+  s->next = 0;
+  s->next_sequence = pl->segments[0].sequence;
+  s->next_reload_ms = now_ms() + target_ms(s);
+  ESP_LOGI(TAG, "%s playlist, %" PRIu32 " segments of %" PRIu32
+                " ms, starting at %" PRIu64,
+           pl->type == HLS_PLAYLIST_PLAIN ? "Plain"
+           : pl->ended                    ? "Ended"
+                                          : "Live",
+           pl->total_segments, pl->target_duration_ms, s->next_sequence);
+  publish_variant(s);
+  return ESP_OK;
+}
+
+/* Loads the live playlist again, keeping the segments not fetched yet */
+static void reload(hls_session_t *s) {
+  int64_t start = now_ms();
+  hls_playlist_t *pl = s->media;
+  esp_err_t err = load_playlist(s, s->media_uri, pl, s->next_sequence);
+  s->next = 0;
+  if (err != ESP_OK || pl->type != HLS_PLAYLIST_MEDIA) {
+    // Tried again soon; segments still listed then are picked up from
+    // next_sequence
+    pl->segment_count = 0;
+    pl->ended = false;
+    s->next_reload_ms = start + MIN(target_ms(s) / 2, HLS_RETRY_MAX_MS);
+    return;
+  }
+  portENTER_CRITICAL(&stats_lock);
+  stats.reloads++;
+  portEXIT_CRITICAL(&stats_lock);
+  if (pl->segment_count > 0 && pl->segments[0].sequence > s->next_sequence) {
+    uint32_t missed = pl->segments[0].sequence - s->next_sequence;
+    ESP_LOGW(TAG, "Fell behind the live playlist: %" PRIu32 " segments lost",
+             missed);
+    portENTER_CRITICAL(&stats_lock);
+    stats.skipped += missed;
+    portEXIT_CRITICAL(&stats_lock);
+    s->next_sequence = pl->segments[0].sequence;
+  }
+  // Unchanged, the playlist is looked at again after half the time
+  s->next_reload_ms =
+      start + (pl->segment_count > 0 ? target_ms(s) : target_ms(s) / 2);
+}
+
+/* Moves to the variant that suits the measured throughput, from the next
+ * segment on */
+static void select_variant(hls_session_t *s) {
+  if (s->master->variant_count < 2 || s->measured_bps == 0) {
+    return;
+  }
+  int v = hls_variant_select(s->master, s->variant, s->measured_bps);
+  if (v == s->variant) {
+    return;
+  }
+  ESP_LOGI(TAG,
+           "Variant %" PRIu32 " kb/s -> %" PRIu32 " kb/s at %" PRIu32
+           " kb/s measured",
+           s->master->variants[s->variant].bandwidth / 1000,
+           s->master->variants[v].bandwidth / 1000, s->measured_bps / 1000);
+  s->variant = v;
+  strlcpy(s->media_uri, s->master->variants[v].uri, sizeof(s->media_uri));
+  // Sequence numbers line up across variants: the new list from the next
+  s->media->segment_count = 0;
+  s->media->ended = false;
+  s->next = 0;
+  s->next_reload_ms = 0;
+  portENTER_CRITICAL(&stats_lock);
+  stats.switches++;
+  portEXIT_CRITICAL(&stats_lock);
+  publish_variant(s);
+}
+
+/* ---------- segments ---------- */
+
+/* Demuxed audio into the buffer; blocks while it is full */
+static int queue_write(void *ctx, const uint8_t *data, size_t len) {
+  hls_session_t *s = ctx;
+  int64_t start = esp_timer_get_time();
+  s->segment_out += len;
+  while (len > 0) {
+    int n = rb_write(s->queue, (char *)data, len, portMAX_DELAY);
+    if (n <= 0) {
+      return -1; // aborted: the element is closing
+    }
+    data += n;
+    len -= n;
+  }
+  s->write_wait_us += esp_timer_get_time() - start;
+  return 0;
+}
+
+static int segment_body(void *ctx, const uint8_t *data, size_t len) {
+  hls_session_t *s = ctx;
+  return mpegts_demux_feed(&s->demux, data, len);
+}
+
+static void check_audio(hls_session_t *s) {
+  mpegts_audio_t audio = s->demux.audio;
+  if (s->warned || s->demux.packed || audio == MPEGTS_AUDIO_NONE) {
+    return;
+  }
+  if (audio == MPEGTS_AUDIO_OTHER) {
+    ESP_LOGE(TAG, "The stream has no AAC or MPEG audio");
+  } else if ((audio == MPEGTS_AUDIO_ADTS) != (s->codec == CODEC_TYPE_AAC)) {
+    ESP_LOGW(TAG, "The station is set to %s, the stream carries %s",
+             codec_type_to_string(s->codec),
+             audio == MPEGTS_AUDIO_ADTS ? "AAC" : "MPEG audio");
+  } else {
+    return;
+  }
+  s->warned = true;
+}
+
+static esp_err_t fetch_segment(hls_session_t *s, const hls_segment_t *seg) {
+  mpegts_demux_segment(&s->demux, seg->discontinuity);
+  s->segment_out = 0;
+  s->write_wait_us = 0;
+  int64_t start = esp_timer_get_time();
+  uint32_t bytes = 0;
+  esp_err_t err = http_get(s, seg->uri, segment_body, s, &bytes);
+  if (err != ESP_OK) {
+    return err;
+  }
+  int64_t elapsed = esp_timer_get_time() - start;
+  check_audio(s);
+
+  // The link's throughput: time spent waiting for room doesn't count
+  int64_t busy = elapsed - s->write_wait_us;
+  if (bytes >= HLS_MEASURE_MIN_BYTES && busy > 0) {
+    uint32_t bps = (uint64_t)bytes * 8 * 1000000 / busy;
+    // Down at once, up slowly
+    s->measured_bps = s->measured_bps == 0 || bps < s->measured_bps
+                          ? bps
+                          : (s->measured_bps * 7ULL + bps * 3ULL) / 10;
+  }
+  if (seg->duration_ms > 0 && s->segment_out > 0) {
+    s->es_rate = (uint64_t)s->segment_out * 1000 / seg->duration_ms;
+    s->expected = s->segment_out;
+  }
+
+  uint32_t ms = elapsed / 1000;
+  portENTER_CRITICAL(&stats_lock);
+  stats.segments++;
+  stats.segment_ms = ms;
+  stats.segment_max_ms = MAX(stats.segment_max_ms, ms);
+  stats.segment_avg_ms = stats.segment_avg_ms == 0
+                             ? ms
+                             : (stats.segment_avg_ms * 7 + ms) / 8;
+  stats.measured_kbps = s->measured_bps / 1000;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGD(TAG, "Segment %" PRIu64 ": %" PRIu32 " bytes in %" PRIu32 " ms",
+           seg->sequence, bytes, ms);
+  return ESP_OK;
+}
+
+/* Whether the next segment fits the buffer, going by the last one. One
+ * larger than half the buffer is started at half. */
+static bool room_for_segment(hls_session_t *s) {
+  uint32_t need = MIN(s->expected + s->expected / 4,
+                      (uint32_t)HLS_STREAM_BUFFER_SIZE / 2);
+  return rb_bytes_available(s->queue) >= (int)need;
+}
+
+/* Fetches the next segment, retrying, then skipping it. A retry may repeat
+ * audio that had arrived; the decoder resynchronizes. */
+static void next_segment(hls_session_t *s) {
+  hls_playlist_t *pl = s->media;
+  const hls_segment_t *seg = &pl->segments[s->next];
+  esp_err_t err = seg->uri[0] ? fetch_segment(s, seg) : ESP_FAIL;
+  if (stopping(s)) {
+    return;
+  }
+  if (pl->type == HLS_PLAYLIST_PLAIN) {
+    // A stream has no end: it went away. Again, or the next entry.
+    ESP_LOGW(TAG, "Stream %s ended", seg->uri);
+    err = ESP_FAIL;
+  }
+  if (err == ESP_OK) {
+    s->tries = 0;
+    s->retry_ms = 0;
+  } else if (++s->tries < HLS_SEGMENT_TRIES) {
+    s->retry_ms = s->retry_ms ? MIN(s->retry_ms * 2, HLS_RETRY_MAX_MS)
+                              : HLS_RETRY_MIN_MS;
+    pause_ms(s, s->retry_ms);
+    return;
+  } else {
+    ESP_LOGW(TAG, "Skipping segment %" PRIu64, seg->sequence);
+    s->tries = 0;
+    if (pl->type != HLS_PLAYLIST_PLAIN) {
+      portENTER_CRITICAL(&stats_lock);
+      stats.skipped++;
+      portEXIT_CRITICAL(&stats_lock);
+    }
+  }
+  s->next_sequence = seg->sequence + 1;
+  s->next++;
+  if (pl->type == HLS_PLAYLIST_PLAIN && s->next == pl->segment_count) {
+    s->next = 0;
+    s->next_sequence = pl->segments[0].sequence;
+  }
+  if (err == ESP_OK) {
+    select_variant(s);
+  }
+}
+
+/* ---------- fetch task ---------- */
+
+static void session_free(hls_session_t *s) {
+  if (s->client) {
+    esp_http_client_cleanup(s->client);
+  }
+  if (s->queue) {
+    rb_destroy(s->queue);
+  }
+  if (s->ready) {
+    vSemaphoreDelete(s->ready);
+  }
+  free(s->chunk);
+  free(s);
+}
+
+/* Called by the element and by the task; the last one frees */
+static void session_release(hls_session_t *s, bool task) {
+  portENTER_CRITICAL(&session_lock);
+  if (task) {
+    s->task_done = true;
+  } else {
+    s->detached = true;
+  }
+  bool last = s->task_done && s->detached;
+  portEXIT_CRITICAL(&session_lock);
+  if (last) {
+    session_free(s);
+  }
+}
+
+static void fetch_task(void *arg) {
+  hls_session_t *s = arg;
+  s->open_result = load_first(s);
+  xSemaphoreGive(s->ready);
+
+  while (s->open_result == ESP_OK && !stopping(s)) {
+    hls_playlist_t *pl = s->media;
+    int64_t now = now_ms();
+    if (!pl->ended && now >= s->next_reload_ms) {
+      reload(s);
+    } else if (s->next < pl->segment_count) {
+      if (room_for_segment(s)) {
+        next_segment(s);
+      } else {
+        pause_ms(s, HLS_IDLE_MS);
+      }
+    } else if (pl->ended && pl->truncated) {
+      // The rest of a long recording
+      if (load_playlist(s, s->media_uri, pl, s->next_sequence) != ESP_OK) {
+        pause_ms(s, HLS_RETRY_MAX_MS);
+      }
+      s->next = 0;
+    } else if (pl->ended) {
+      ESP_LOGI(TAG, "End of the stream");
+      atomic_store(&s->ended, true);
+      rb_done_write(s->queue);
+      break;
+    } else {
+      // Waiting for the live playlist to move on
+      pause_ms(s, MIN(s->next_reload_ms - now, HLS_IDLE_MS));
+    }
+  }
+  session_release(s, true);
+  vTaskDelete(NULL);
+}
+
+/* ---------- element ---------- */
+
+static esp_err_t hls_open(audio_element_handle_t self) {
+  const char *uri = audio_element_get_uri(self);
+  hls_session_t *s = hls_alloc(sizeof(hls_session_t));
+  if (s == NULL || uri == NULL) {
+    free(s);
+    return ESP_FAIL;
+  }
+  memset(s, 0, sizeof(*s));
+  s->master = &s->lists[0];
+  s->media = &s->lists[1];
+  s->variant = -1;
+  s->codec = (codec_type_t)(intptr_t)audio_element_getdata(self);
+  s->open_us = esp_timer_get_time();
+  strlcpy(s->uri, uri, sizeof(s->uri));
+  mpegts_demux_init(&s->demux, queue_write, s);
+
+  esp_http_client_config_t cfg = {
+      .url = uri,
+      .timeout_ms = HLS_HTTP_TIMEOUT_MS,
+      .event_handler = http_event,
+      .user_data = s,
+      .buffer_size = 2048, // CDN redirects carry long tokens
+  };
+  s->client = esp_http_client_init(&cfg);
+  s->chunk = heap_caps_malloc(HLS_CHUNK, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  s->queue = rb_create(HLS_STREAM_BUFFER_SIZE, 1);
+  s->ready = xSemaphoreCreateBinary();
+  if (s->client == NULL || s->chunk == NULL || s->queue == NULL ||
+      s->ready == NULL) {
+    ESP_LOGE(TAG, "No memory for the HLS buffers");
+    session_free(s);
+    return ESP_FAIL;
+  }
+  if (xTaskCreate(fetch_task, "hls_fetch", HLS_TASK_STACK, s,
+                  HLS_TASK_PRIORITY, NULL) != pdPASS) {
+    session_free(s);
+    return ESP_FAIL;
+  }
+
+  if (xSemaphoreTake(s->ready, pdMS_TO_TICKS(HLS_OPEN_TIMEOUT_MS)) !=
+          pdTRUE ||
+      s->open_result != ESP_OK) {
+    atomic_store(&s->stopping, true);
+    rb_abort(s->queue);
+    session_release(s, false);
+    return ESP_FAIL;
+  }
+  session = s;
+  portENTER_CRITICAL(&stats_lock);
+  stats.active = true;
+  stats.buffer_ms = 0;
+  stats.buffer_bytes = 0;
+  stats.memory = sizeof(hls_session_t) + HLS_CHUNK + HLS_STREAM_BUFFER_SIZE;
+  portEXIT_CRITICAL(&stats_lock);
+  return ESP_OK;
+}
+
+static esp_err_t hls_close(audio_element_handle_t self) {
+  hls_session_t *s = session;
+  session = NULL;
+  if (s) {
+    atomic_store(&s->stopping, true);
+    rb_abort(s->queue);
+    session_release(s, false);
+  }
+  portENTER_CRITICAL(&stats_lock);
+  stats.active = false;
+  stats.variant = -1;
+  stats.variants = 0;
+  stats.buffer_ms = 0;
+  stats.buffer_bytes = 0;
+  stats.memory = 0;
+  portEXIT_CRITICAL(&stats_lock);
+  return ESP_OK;
+}
+
+static void update_fill(hls_session_t *s) {
+  int filled = rb_bytes_filled(s->queue);
+  uint32_t rate = s->es_rate;
+  portENTER_CRITICAL(&stats_lock);
+  stats.buffer_bytes = filled;
+  stats.buffer_ms = rate ? (uint64_t)filled * 1000 / rate : 0;
+  portEXIT_CRITICAL(&stats_lock);
+  // With time-shift the decoder is fed from its buffer, which reports
+  if (audio_pipeline_components.time_shift == NULL) {
+    g_stream_buffer_fill = filled * 100 / HLS_STREAM_BUFFER_SIZE;
+  }
+}
+
+static int hls_process(audio_element_handle_t self, char *in_buffer,
+                       int in_len) {
+  hls_session_t *s = session;
+  if (s == NULL) {
+    return AEL_IO_FAIL;
+  }
+  int filled = rb_bytes_filled(s->queue);
+  if (s->starving && !atomic_load(&s->ended) &&
+      filled < (int)MIN((uint64_t)s->es_rate * HLS_RESUME_MS / 1000,
+                        HLS_STREAM_BUFFER_SIZE / 2)) {
+    vTaskDelay(pdMS_TO_TICKS(HLS_READ_TIMEOUT_MS));
+    update_fill(s);
+    return AEL_IO_TIMEOUT;
+  }
+  // Take what is there rather than wait for a full buffer
+  int n = rb_read(s->queue, in_buffer, filled > 0 ? MIN(in_len, filled) : in_len,
+                  pdMS_TO_TICKS(HLS_READ_TIMEOUT_MS));
+  int64_t now = esp_timer_get_time();
+  if (n > 0) {
+    if (!s->played) {
+      s->played = true;
+      portENTER_CRITICAL(&stats_lock);
+      stats.start_ms = (now - s->open_us) / 1000;
+      portEXIT_CRITICAL(&stats_lock);
+    } else if (s->starving) {
+      uint32_t ms = (now - s->starve_us) / 1000;
+      ESP_LOGW(TAG, "Rebuffered for %" PRIu32 " ms", ms);
+      portENTER_CRITICAL(&stats_lock);
+      stats.rebuffer_ms += ms;
+      portEXIT_CRITICAL(&stats_lock);
+    }
+    s->starving = false;
+    g_bytes_read += n; // bitrate display and stall watchdog
+    int w = audio_element_output(self, in_buffer, n);
+    audio_element_multi_output(self, in_buffer, n, 0);
+    update_fill(s);
+    return w;
+  }
+  if (n == RB_DONE) {
+    return AEL_IO_DONE;
+  }
+  if (n == RB_ABORT) {
+    return AEL_IO_ABORT;
+  }
+  // Until audio has come, a wait is part of starting up
+  if (s->played && !s->starving) {
+    s->starving = true;
+    s->starve_us = now;
+    portENTER_CRITICAL(&stats_lock);
+    stats.rebuffers++;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+  update_fill(s);
+  return AEL_IO_TIMEOUT;
+}
+
+/* ---------- interface ---------- */
+
+bool hls_stream_is_source_uri(const char *uri) {
+  if (uri == NULL) {
+    return false;
+  }
+  size_t len = strcspn(uri, "?#");
+  return len >= 5 && strncasecmp(uri + len - 5, ".m3u8", 5) == 0;
+}
+
+audio_element_handle_t hls_stream_init(codec_type_t codec, int multi_out) {
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  cfg.open = hls_open;
+  cfg.close = hls_close;
+  cfg.process = hls_process;
+  cfg.tag = "hls";
+  cfg.buffer_len = HLS_CHUNK;
+  cfg.out_rb_size = HLS_OUT_RB_SIZE;
+  cfg.task_stack = HLS_ELEMENT_STACK;
+  cfg.multi_out_rb_num = multi_out;
+  audio_element_handle_t el = audio_element_init(&cfg);
+  if (el) {
+    audio_element_setdata(el, (void *)(intptr_t)codec);
+  }
+  return el;
+}
+
+void hls_stream_sizes(int *task_stack, int *out_rb_size, uint32_t *internal,
+                      uint32_t *psram) {
+  *task_stack = HLS_ELEMENT_STACK;
+  *out_rb_size = HLS_OUT_RB_SIZE;
+  *internal = HLS_TASK_STACK + HLS_CHUNK;
+  *psram = sizeof(hls_session_t) + HLS_STREAM_BUFFER_SIZE;
+}
+
+void hls_stream_get_stats(hls_stream_stats_t *out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,95 @@
+#ifndef HLS_STREAM_H
+#define HLS_STREAM_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * HLS source: HTTP Live Streaming stations
+ *
+ * Stands in for the HTTP reader when a station's URL is an .m3u8 playlist
+ * (create_audio_pipeline()), and feeds the decoder and the taps the same
+ * elementary stream, so the AAC (or MP3) decoder, time-shift, the relay and
+ * the recorder work as with any station.
+ *
+ * A fetch task parses the playlists as they download (hls_playlist.h),
+ * picks the variant by measured throughput and loads the segments ahead of
+ * playback over one kept-alive connection, demuxing them (mpegts_demux.h)
+ * into HLS_STREAM_BUFFER_SIZE of PSRAM that the element reads from. A
+ * segment is requested once there is room for all of it, so downloads run
+ * at full speed and measure the link. Live playlists are loaded again every
+ * target duration (half that while they don't change, RFC 8216 6.3.4).
+ *
+ * The fetch task outlives the element if it is blocked on the network when
+ * the station changes, and cleans up after itself; changing stations never
+ * waits on a socket.
+ */
+
+// Downloaded audio ahead of the decoder: 32 s at 128 kb/s
+#define HLS_STREAM_BUFFER_SIZE (512 * 1024)
+
+/**
+ * @brief HLS figures: the current stream, and counters since boot.
+ */
+typedef struct {
+  bool active;
+  int8_t variant;          // playing, in the master playlist; -1 if none
+  uint8_t variants;
+  uint32_t variant_kbps;   // as announced
+  uint32_t measured_kbps;  // download throughput, smoothed
+  uint32_t target_ms;      // segment duration the playlist announces
+  uint32_t start_ms;       // last station: opening to first audio out
+  uint32_t buffer_ms;      // audio downloaded ahead of the decoder
+  uint32_t buffer_bytes;
+  uint32_t segment_ms;     // last segment: request to last byte
+  uint32_t segment_avg_ms;
+  uint32_t segment_max_ms;
+  uint32_t memory;         // bytes allocated
+  uint32_t segments;       // fetched
+  uint32_t reloads;        // of media playlists
+  uint32_t requests;
+  uint32_t connections;    // opened; the other requests reused one
+  uint32_t rebuffers;      // times the decoder found the buffer empty
+  uint32_t rebuffer_ms;    // waited for data in all
+  uint32_t skipped;        // segments missed: failed, or gone from the list
+  uint32_t switches;       // of variant
+  uint32_t errors;         // failed requests
+  uint64_t bytes;          // downloaded
+} hls_stream_stats_t;
+
+/**
+ * @brief Whether uri names an HLS playlist (an .m3u8 path).
+ */
+bool hls_stream_is_source_uri(const char *uri);
+
+/**
+ * @brief Creates the HLS source element with multi_out taps. The playlist
+ * is the element's URI (audio_element_set_uri()); codec is the station's,
+ * to warn when the stream carries something else.
+ */
+audio_element_handle_t hls_stream_init(codec_type_t codec, int multi_out);
+
+/**
+ * @brief What an HLS source takes once it plays, for the pipeline's memory
+ * check: its element's task stack and output ring, and the fetch task and
+ * buffers of its session in internal RAM and in PSRAM.
+ */
+void hls_stream_sizes(int *task_stack, int *out_rb_size, uint32_t *internal,
+                      uint32_t *psram);
+
+/**
+ * @brief Copies the HLS figures.
+ */
+void hls_stream_get_stats(hls_stream_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HLS_STREAM_H
@@ -0,0 +1,138 @@
+#include "input_bus.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+
+static const char *TAG = "INPUT_BUS";
+
+#define INPUT_BUS_DEPTH 16
+
+static QueueHandle_t s_input_queue = NULL;
+static input_complete_cb_t s_complete_cb = NULL;
+static _Atomic uint32_t s_next_request_id = 1;
+
+esp_err_t input_bus_init(void) {
+  if (s_input_queue != NULL) {
+    return ESP_OK;
+  }
+  s_input_queue = xQueueCreate(INPUT_BUS_DEPTH, sizeof(input_event_t));
+  if (s_input_queue == NULL) {
+    ESP_LOGE(TAG, "Failed to create input queue");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+bool input_bus_post(input_event_t *event) {
+  if (s_input_queue == NULL || event == NULL) {
+    return false;
+  }
+  event->timestamp_us = esp_timer_get_time();
+  if (xQueueSend(s_input_queue, event, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Input bus full, dropping %s",
+             input_event_type_to_string(event->type));
+    return false;
+  }
+  return true;
+}
+
+bool input_bus_post_simple(input_event_type_t type, input_source_t source,
+                           input_control_t control, int value) {
+  input_event_t event = {
+      .type = type,
+      .source = source,
+      .control = control,
+      .value = value,
+  };
+  return input_bus_post(&event);
+}
+
+bool input_bus_receive(input_event_t *event, TickType_t wait) {
+  if (s_input_queue == NULL) {
+    // Wait as on an empty bus, so a consumer started too early doesn't spin
+    ESP_LOGE(TAG, "Input bus not initialized");
+    vTaskDelay(wait);
+    return false;
+  }
+  return xQueueReceive(s_input_queue, event, wait) == pdTRUE;
+}
+
+uint32_t input_bus_new_request_id(void) {
+  uint32_t id;
+  do {
+    id = atomic_fetch_add(&s_next_request_id, 1);
+  } while (id == 0);
+  return id;
+}
+
+void input_bus_set_complete_cb(input_complete_cb_t cb) { s_complete_cb = cb; }
+
+void input_bus_complete(const input_event_t *event, esp_err_t result) {
+  input_complete_cb_t cb = s_complete_cb;
+  if (event->request_id != 0 && cb) {
+    cb(event, result, esp_timer_get_time());
+  }
+}
+
+bool input_source_is_user(input_source_t source) {
+  switch (source) {
+  case INPUT_SOURCE_BUTTON:
+  case INPUT_SOURCE_ENCODER:
+  case INPUT_SOURCE_WEB:
+  case INPUT_SOURCE_IR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+const char *input_event_type_to_string(input_event_type_t type) {
+  switch (type) {
+  case INPUT_EVENT_CLICK:
+    return "click";
+  case INPUT_EVENT_DOUBLE_CLICK:
+    return "double-click";
+  case INPUT_EVENT_LONG_PRESS:
+    return "long-press";
+  case INPUT_EVENT_HOLD_REPEAT:
+    return "hold-repeat";
+  case INPUT_EVENT_VOLUME_SET:
+    return "volume-set";
+  case INPUT_EVENT_STATION_SELECT:
+    return "station-select";
+  case INPUT_EVENT_ENCODER_STEP:
+    return "encoder-step";
+  case INPUT_EVENT_STATION_STEP:
+    return "station-step";
+  case INPUT_EVENT_VOLUME_STEP:
+    return "volume-step";
+  case INPUT_EVENT_MUTE:
+    return "mute";
+  case INPUT_EVENT_SLEEP:
+    return "sleep";
+  case INPUT_EVENT_WAKE:
+    return "wake";
+  case INPUT_EVENT_FOLLOW:
+    return "follow";
+  case INPUT_EVENT_PAUSE:
+    return "pause";
+  case INPUT_EVENT_SEEK:
+    return "seek";
+  case INPUT_EVENT_LIVE:
+    return "live";
+  case INPUT_EVENT_RECORD:
+    return "record";
+  case INPUT_EVENT_LOCAL:
+    return "local";
+  case INPUT_EVENT_TRACK_SELECT:
+    return "track-select";
+  case INPUT_EVENT_TRACK_STEP:
+    return "track-step";
+  case INPUT_EVENT_FOLDER_SELECT:
+    return "folder-select";
+  default:
+    return "unknown";
+  }
+}
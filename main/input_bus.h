@@ -0,0 +1,138 @@
+#ifndef INPUT_BUS_H
+#define INPUT_BUS_H
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Where an input event came from.
+ */
+typedef enum {
+  INPUT_SOURCE_BUTTON,
+  INPUT_SOURCE_ENCODER,
+  INPUT_SOURCE_WEB,
+  INPUT_SOURCE_IR,
+  INPUT_SOURCE_MULTIROOM,
+  INPUT_SOURCE_SCHEDULE, // recording schedules
+  INPUT_SOURCE_PLAYER,   // the player itself: end of a track, stream lost
+} input_source_t;
+
+/**
+ * @brief Physical control an input event refers to.
+ */
+typedef enum {
+  INPUT_CONTROL_NONE,
+  INPUT_CONTROL_VOLUME,
+  INPUT_CONTROL_STATION,
+} input_control_t;
+
+/**
+ * @brief Input event types. Gesture events carry the control they were
+ * recognized on; the remaining events are source independent commands.
+ */
+typedef enum {
+  INPUT_EVENT_CLICK,
+  INPUT_EVENT_DOUBLE_CLICK,
+  INPUT_EVENT_LONG_PRESS,
+  INPUT_EVENT_HOLD_REPEAT,
+  INPUT_EVENT_VOLUME_SET,     // value: volume 0-100
+  INPUT_EVENT_STATION_SELECT, // value: station index
+  INPUT_EVENT_ENCODER_STEP,   // value: detents turned, signed
+  INPUT_EVENT_STATION_STEP,   // value: stations to move, signed (wraps)
+  INPUT_EVENT_VOLUME_STEP,    // value: volume change, signed
+  INPUT_EVENT_MUTE,           // value: 1 mute, 0 unmute, -1 toggle
+  INPUT_EVENT_SLEEP,          // mute and enter power save now
+  INPUT_EVENT_WAKE,           // unmute
+  INPUT_EVENT_FOLLOW,         // value: codec_type_t of the leader's new stream
+  INPUT_EVENT_PAUSE,          // value: 1 pause, 0 resume, -1 toggle
+  INPUT_EVENT_SEEK,           // value: seconds to move, signed (back < 0)
+  INPUT_EVENT_LIVE,           // back to the live stream
+  INPUT_EVENT_RECORD,         // value: 1 start, 0 stop, -1 toggle
+  INPUT_EVENT_LOCAL,          // value: 1 play files, 0 stations, -1 toggle
+  INPUT_EVENT_TRACK_SELECT,   // value: track index in the current folder
+  INPUT_EVENT_TRACK_STEP,     // value: tracks to move, signed (wraps)
+  INPUT_EVENT_FOLDER_SELECT,  // value: folder index, played from the start
+} input_event_type_t;
+
+/**
+ * @brief A single event on the input bus.
+ */
+typedef struct {
+  input_event_type_t type;
+  input_source_t source;
+  input_control_t control;
+  int value;
+  uint32_t request_id;  // nonzero if the poster waits for completion
+  int64_t timestamp_us; // esp_timer time at which the event was posted
+} input_event_t;
+
+/**
+ * @brief Called by input_bus_complete() for events with a request id, from
+ * the dispatcher task. done_us is the esp_timer time the action finished.
+ */
+typedef void (*input_complete_cb_t)(const input_event_t *event,
+                                    esp_err_t result, int64_t done_us);
+
+/**
+ * @brief Creates the input bus. Must be called before any producer starts.
+ */
+esp_err_t input_bus_init(void);
+
+/**
+ * @brief Posts an event without blocking. The timestamp is filled in here.
+ * @return true if queued, false if the bus is full or not initialized.
+ */
+bool input_bus_post(input_event_t *event);
+
+/**
+ * @brief Convenience wrapper around input_bus_post().
+ */
+bool input_bus_post_simple(input_event_type_t type, input_source_t source,
+                           input_control_t control, int value);
+
+/**
+ * @brief Waits for the next event. Before input_bus_init() it waits out the
+ * timeout and fails.
+ * @return true if an event was received before the timeout.
+ */
+bool input_bus_receive(input_event_t *event, TickType_t wait);
+
+/**
+ * @brief Returns a new request id (never 0) for input_event_t.request_id.
+ */
+uint32_t input_bus_new_request_id(void);
+
+/**
+ * @brief Registers the completion callback (one subscriber).
+ */
+void input_bus_set_complete_cb(input_complete_cb_t cb);
+
+/**
+ * @brief Reports that the dispatcher finished handling an event. Does
+ * nothing unless the event has a request id.
+ */
+void input_bus_complete(const input_event_t *event, esp_err_t result);
+
+/**
+ * @brief Whether a source is someone at the radio or on the web UI, whose
+ * events restore a dimmed or blanked display. The player, recording
+ * schedules and multi-room act on their own and leave it as it is.
+ */
+bool input_source_is_user(input_source_t source);
+
+/**
+ * @brief Returns a short name for an event type (for logging).
+ */
+const char *input_event_type_to_string(input_event_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INPUT_BUS_H
@@ -13,29 +13,42 @@
 #include "audio_event_iface.h"
 #include "audio_pipeline_manager.h"
 #include "board.h"
+#include "decoder_bench.h"
+#include "decoder_registry.h"
 // #include "driver/gpio.h"
 #include "encoders.h"
 #include "esp_event.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_netif_sntp.h"
 #include "esp_peripherals.h"
 #include "esp_sleep.h"
 #include "esp_wifi.h"
 // #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "hls_stream.h"
 #include "ir_remote.h"
+#include "local_media.h"
 #include "lvgl_ssd1306_setup.h"
+#include "multiroom.h"
 #include "nvs_flash.h"
+#include "recorder.h"
 #include "screens.h"
 // #include "sdkconfig.h"
 #include "app_config.h"
 #include "internet_radio_adf.h"
+#include "input_bus.h"
 #include "station_data.h"
+#include "station_health.h"
+#include "stream_relay.h"
+#include "timeshift.h"
+#include "visualizer.h"
 #include "web_server.h"
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_ble.h"
+#include <inttypes.h>
 #include <string.h>
 
 static const char *TAG = "INTERNET_RADIO";
@@ -51,8 +64,18 @@ static const char *TAG = "INTERNET_RADIO";
 
 #define BITRATE_UPDATE_INTERVAL_MS 1000
 
+// Boot waits this long for Wi-Fi before playing local files, if there are any
+#define BOOT_WIFI_WAIT_MS 20000
+
+#if CONFIG_DECODER_BENCH
+// The clip the boot-time decode benchmark plays (main/CMakeLists.txt)
+extern const uint8_t
+    decoder_bench_clip[] asm("_binary_decoder_bench_opus_start");
+extern const uint8_t
+    decoder_bench_clip_end[] asm("_binary_decoder_bench_opus_end");
+#endif
+
 // oled screen with lvgl
-extern int station_count; // from station_data.c
 static lv_display_t *display;
 
 // global variables for easier access in callbacks
@@ -166,20 +189,42 @@ static void load_wifi_state_from_nvs(void) {
   ESP_LOGI(TAG, "WiFi state loaded from NVS (Ready for Fast Connect)");
 }
 
-void change_station(int new_station_index) {
+esp_err_t change_station(int new_station_index) {
   esp_err_t ret;
+  if (multiroom_is_follower()) {
+    ESP_LOGW(TAG, "Following the multi-room leader; stations are not played");
+    return ESP_ERR_INVALID_STATE;
+  }
+  // Held until the pipeline has its URI, so an upload can't free it meanwhile
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
 
-  if (new_station_index < 0 || new_station_index >= station_count) {
+  if (new_station_index < 0 || new_station_index >= snapshot->count) {
     ESP_LOGE(TAG, "Invalid station index: %d", new_station_index);
-    return;
+    station_snapshot_release(snapshot);
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // A station the prober found dead is swapped for a working mirror (same
+  // call sign and origin), if the list has one
+  if (station_health_is_dead(snapshot->stations[new_station_index].id)) {
+    int mirror = station_health_best_mirror(snapshot, new_station_index);
+    if (mirror != new_station_index) {
+      ESP_LOGW(TAG, "Station %d is not responding, playing mirror %d",
+               new_station_index, mirror);
+      new_station_index = mirror;
+    }
   }
 
-  // Only change if the new station is different from the current one
-  if (new_station_index == current_station) {
+  // Only change if the new station is different from the current one (or
+  // files are playing instead)
+  if (new_station_index == current_station && !local_media_is_active()) {
     ESP_LOGI(TAG, "Station %d is already selected. No change needed.",
              new_station_index);
-    return;
+    station_snapshot_release(snapshot);
+    return ESP_OK;
   }
+  const station_t *station = &snapshot->stations[new_station_index];
+  local_media_leave();
 
   // Mute at start of station change to avoid pops/noise
   if (board_handle && board_handle->audio_hal) {
@@ -194,29 +239,29 @@ void change_station(int new_station_index) {
   current_station = new_station_index;
   g_is_pipeline_running = false;
   ESP_LOGI(TAG, "Switching to station %d: %s, %s", current_station,
-           radio_stations[current_station].call_sign,
-           radio_stations[current_station].origin);
+           station->call_sign, station->origin);
   sync_station_encoder_index(); // Sync encoder's internal state
   save_current_station_to_nvs(current_station);
-  update_station_name(radio_stations[current_station].call_sign);
-  update_station_origin(radio_stations[current_station].origin);
+  update_station_name(station->call_sign);
+  update_station_origin(station->origin);
 
-  ret = create_audio_pipeline(&audio_pipeline_components,
-                              radio_stations[current_station].codec,
-                              radio_stations[current_station].uri);
+  ret = create_audio_pipeline(&audio_pipeline_components, station->codec,
+                              station->uri);
   if (ret != ESP_OK) {
     ESP_LOGE(
         TAG,
         "Failed to create new audio pipeline for station %s, %s. Error: %d",
-        radio_stations[current_station].call_sign,
-        radio_stations[current_station].origin, ret);
+        station->call_sign, station->origin, ret);
+    station_snapshot_release(snapshot);
     // Restore mute state even on failure
     if (board_handle && board_handle->audio_hal) {
       audio_hal_set_mute(board_handle->audio_hal, get_mute_state());
     }
-    return;
+    return ret;
   }
 
+  station_snapshot_release(snapshot);
+
   ESP_LOGI(TAG, "Starting new audio pipeline");
   reset_throughput_history();
   ret = audio_pipeline_run(audio_pipeline_components.pipeline);
@@ -234,9 +279,57 @@ void change_station(int new_station_index) {
   if (ret != ESP_OK) {
     ESP_LOGE(TAG, "Failed to run new audio pipeline. Error: %d", ret);
     destroy_audio_pipeline(&audio_pipeline_components);
-  } else {
+    return ret;
+  }
+  g_is_pipeline_running = true;
+  return ESP_OK;
+}
+
+/* Replaces the pipeline with one for a source other than a station */
+static esp_err_t replace_pipeline(codec_type_t codec, const char *uri) {
+  if (board_handle && board_handle->audio_hal) {
+    audio_hal_set_mute(board_handle->audio_hal, true);
+  }
+  destroy_audio_pipeline(&audio_pipeline_components);
+  g_is_pipeline_running = false;
+
+  esp_err_t ret = create_audio_pipeline(&audio_pipeline_components, codec, uri);
+  if (ret == ESP_OK) {
+    reset_throughput_history();
+    ret = audio_pipeline_run(audio_pipeline_components.pipeline);
+    if (evt) {
+      audio_pipeline_set_listener(audio_pipeline_components.pipeline, evt);
+    }
+    if (ret != ESP_OK) {
+      destroy_audio_pipeline(&audio_pipeline_components);
+    }
+  }
+  if (board_handle && board_handle->audio_hal) {
+    audio_hal_set_mute(board_handle->audio_hal, get_mute_state());
+  }
+  if (ret == ESP_OK) {
     g_is_pipeline_running = true;
   }
+  return ret;
+}
+
+esp_err_t follow_leader(codec_type_t codec) {
+  local_media_leave();
+  update_station_origin("Multi-room");
+  esp_err_t ret = replace_pipeline(codec, MULTIROOM_SOURCE_URI);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to follow the leader's %s stream: %s",
+             codec_type_to_string(codec), esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+esp_err_t play_file(codec_type_t codec, const char *uri) {
+  esp_err_t ret = replace_pipeline(codec, uri);
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to play %s: %s", uri, esp_err_to_name(ret));
+  }
+  return ret;
 }
 
 /* Event handler for catching system events */
@@ -398,6 +491,16 @@ static void get_device_service_name(char *service_name, size_t max) {
 
 #include "esp_timer.h" // Added for watchdog timer
 
+/* Whether the decoder has audio to decode: not while paused */
+static bool audio_flowing(void) {
+  timeshift_stats_t ts;
+  local_media_stats_t lm;
+  timeshift_get_stats(&ts);
+  local_media_get_stats(&lm);
+  return g_is_pipeline_running && !(ts.active && ts.paused) &&
+         !(lm.active && lm.paused);
+}
+
 /**
  * @brief Task to measure and log the data throughput in kbps.
  */
@@ -437,6 +540,8 @@ static void data_throughput_task(void *pvParameters) {
     g_bitrate_kbps = weighted_sum / total_weight;
     update_bitrate_label(g_bitrate_kbps);
 
+    decoder_registry_sample(audio_flowing());
+
     if (g_enable_sys_monitor) {
       // monitoring ram usage.  remove this for production
       size_t total_ram = heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
@@ -492,8 +597,125 @@ static void data_throughput_task(void *pvParameters) {
       prev_total = current_total_time;
     }
 
-    // Watchdog check
-    if (g_is_pipeline_running) {
+    if (g_enable_sys_monitor) {
+      // Display SPI traffic; with dirty page updates a bitrate label change
+      // costs two or three pages (128 bytes each) per refresh
+      static lvgl_ssd1306_flush_stats_t prev_flush;
+      lvgl_ssd1306_flush_stats_t flush;
+      lvgl_ssd1306_get_flush_stats(&flush);
+      ESP_LOGI(TAG,
+               "Display: %" PRIu32 " frames, %" PRIu32 " pages, %" PRIu32
+               " SPI bytes/s, %" PRIu32 " LVGL wakeups/min",
+               flush.flushes - prev_flush.flushes,
+               flush.pages_sent - prev_flush.pages_sent,
+               (flush.spi_bytes - prev_flush.spi_bytes) * 1000 /
+                   BITRATE_UPDATE_INTERVAL_MS,
+               (flush.task_wakeups - prev_flush.task_wakeups) * 60000 /
+                   BITRATE_UPDATE_INTERVAL_MS);
+      prev_flush = flush;
+
+      if (g_runtime_config.visualizer_mode != VISUALIZER_OFF) {
+        visualizer_stats_t vis;
+        visualizer_get_stats(&vis);
+        ESP_LOGI(TAG,
+                 "Visualizer: %" PRIu32 " frames, %" PRIu32 " skipped, %" PRIu32
+                 " overruns, %" PRIu32 " us/frame, stride %" PRIu32,
+                 vis.frames, vis.skipped, vis.overruns, vis.avg_cost_us,
+                 vis.frame_stride);
+      }
+
+      stream_relay_stats_t relay;
+      stream_relay_get_stats(&relay);
+      if (relay.max_clients > 0) {
+        ESP_LOGI(TAG,
+                 "Relay: %d/%d listeners, %" PRIu64 " bytes in, %" PRIu64
+                 " bytes out, %" PRIu32 " dropped slow",
+                 relay.clients, relay.max_clients, relay.bytes_in,
+                 relay.bytes_out, relay.dropped_slow);
+      }
+
+      multiroom_stats_t mr;
+      multiroom_get_stats(&mr);
+      if (mr.mode == MULTIROOM_LEADER) {
+        ESP_LOGI(TAG,
+                 "Multi-room leader: %d followers, %" PRIu32
+                 " packets, error %" PRId32 " us, %" PRId32 " ppm",
+                 mr.followers, mr.packets_sent, mr.error_us, mr.ppm);
+      } else if (mr.mode == MULTIROOM_FOLLOWER) {
+        ESP_LOGI(TAG,
+                 "Multi-room follower: offset %" PRId64 " us (rtt %" PRId32
+                 " us), error %" PRId32 " us, %" PRId32 " ppm, fill %" PRId32
+                 " ms, %" PRIu32 " lost, %" PRIu32 " late",
+                 mr.clock_offset_us, mr.clock_delay_us, mr.error_us, mr.ppm,
+                 mr.fill_ms, mr.packets_lost, mr.packets_late);
+      }
+
+      timeshift_stats_t ts;
+      timeshift_get_stats(&ts);
+      if (ts.active) {
+        ESP_LOGI(TAG,
+                 "Time-shift: %" PRIu32 " s held, %" PRIu32
+                 " s behind%s, %" PRIu32 " bytes, %u.%u%% CPU, %" PRIu32
+                 " overruns",
+                 ts.buffered_s, ts.behind_s, ts.paused ? " (paused)" : "",
+                 ts.memory, ts.cpu_permille / 10, ts.cpu_permille % 10,
+                 ts.overruns);
+      }
+
+      local_media_stats_t lm;
+      local_media_get_stats(&lm);
+      if (lm.active) {
+        ESP_LOGI(TAG,
+                 "Local: track %d/%u%s, start %" PRIu32 " ms, seek %" PRIu32
+                 " ms, %" PRIu32 " kb/s from storage, worst read %" PRIu32
+                 " ms, %" PRIu32 " bytes ahead at least, %" PRIu32 " starved",
+                 lm.track + 1, lm.tracks, lm.paused ? " (paused)" : "",
+                 lm.start_ms, lm.seek_ms, lm.read_kbps, lm.read_stall_max_ms,
+                 lm.fill_min, lm.starved);
+      }
+
+      hls_stream_stats_t hls;
+      hls_stream_get_stats(&hls);
+      if (hls.active) {
+        ESP_LOGI(TAG,
+                 "HLS: variant %d/%u at %" PRIu32 " kb/s, %" PRIu32
+                 " kb/s measured, %" PRIu32 " ms buffered, segment %" PRIu32
+                 " ms (avg %" PRIu32 ", max %" PRIu32 "), %" PRIu32
+                 " rebuffers, %" PRIu32 " requests on %" PRIu32
+                 " connections, %" PRIu32 " skipped",
+                 hls.variant + 1, hls.variants, hls.variant_kbps,
+                 hls.measured_kbps, hls.buffer_ms, hls.segment_ms,
+                 hls.segment_avg_ms, hls.segment_max_ms, hls.rebuffers,
+                 hls.requests, hls.connections, hls.skipped);
+      }
+
+      decoder_stats_t dec;
+      decoder_registry_get_stats(&dec);
+      if (dec.active) {
+        ESP_LOGI(TAG,
+                 "Decoder: %s, %u.%u%% CPU, %u.%ux real time, %" PRIu32
+                 " bytes of stack never used",
+                 codec_type_to_string(dec.codec), dec.cpu_permille / 10,
+                 dec.cpu_permille % 10, dec.speed_x10 / 10,
+                 dec.speed_x10 % 10, dec.stack_free);
+      }
+
+      recorder_stats_t rec;
+      recorder_get_stats(&rec);
+      if (rec.recording) {
+        ESP_LOGI(TAG,
+                 "Recorder: %s, %" PRIu64 " bytes written, %" PRIu64
+                 " dropped, %" PRIu32 " kb/s to the card, worst stall %" PRIu32
+                 " ms, %" PRIu32 " bytes buffered at most",
+                 rec.file[0] ? rec.file : "waiting", rec.bytes_written,
+                 rec.bytes_dropped, rec.write_kbps, rec.stall_max_ms,
+                 rec.buffered_max);
+      }
+    }
+
+    // Watchdog check; local playback is silent while paused, and has no
+    // network to lose
+    if (g_is_pipeline_running && !local_media_is_active()) {
       if (current_bitrate == 0) {
         g_consecutive_zero_count++;
       } else {
@@ -502,9 +724,17 @@ static void data_throughput_task(void *pvParameters) {
 
       if (g_consecutive_zero_count >= 30) {
 
-        ESP_LOGE(TAG, "Watchdog triggered: 0 kbps for 30 consecutive seconds. "
-                      "Restarting...");
-        esp_restart();
+        if (local_media_available() && !multiroom_is_follower()) {
+          ESP_LOGE(TAG, "Watchdog triggered: 0 kbps for 30 consecutive "
+                        "seconds. Playing local files");
+          input_bus_post_simple(INPUT_EVENT_LOCAL, INPUT_SOURCE_PLAYER,
+                                INPUT_CONTROL_NONE, 1);
+          g_consecutive_zero_count = 0;
+        } else {
+          ESP_LOGE(TAG, "Watchdog triggered: 0 kbps for 30 consecutive "
+                        "seconds. Restarting...");
+          esp_restart();
+        }
       }
     } else {
       g_consecutive_zero_count = 0;
@@ -525,9 +755,22 @@ void reset_throughput_history(void) {
 
 void wait_for_wifi_connection(void) {
   ESP_LOGI(TAG, "Waiting for Wi-Fi connection...");
-  xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true,
-                      portMAX_DELAY);
-  ESP_LOGI(TAG, "Wi-Fi Connected.");
+  EventBits_t bits =
+      xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true,
+                          pdMS_TO_TICKS(BOOT_WIFI_WAIT_MS));
+  // Without a network the files on the card are played, if there are any; a
+  // follower has nothing to play but the leader's stream
+  if (!(bits & WIFI_CONNECTED_BIT) &&
+      g_runtime_config.multiroom_mode != MULTIROOM_FOLLOWER) {
+    ESP_LOGW(TAG, "No Wi-Fi after %d s, trying local files",
+             BOOT_WIFI_WAIT_MS / 1000);
+    local_media_enter();
+  }
+  if (!local_media_is_active()) {
+    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true,
+                        portMAX_DELAY);
+    ESP_LOGI(TAG, "Wi-Fi Connected.");
+  }
 }
 
 void set_wifi_sleep_mode(bool sleeping) {
@@ -618,6 +861,8 @@ void app_main(void) {
   load_wifi_state_from_nvs();
 
   init_station_data();
+  // Startup works from one list; released once the first stream is set up
+  const station_snapshot_t *stations = station_snapshot_acquire();
 
   nvs_handle_t nvs_handle;
   err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
@@ -631,7 +876,7 @@ void app_main(void) {
     case ESP_OK:
       ESP_LOGI(TAG, "Successfully read current_station = %d",
                (int)station_from_nvs);
-      if (station_from_nvs >= 0 && station_from_nvs < station_count) {
+      if (station_from_nvs >= 0 && station_from_nvs < stations->count) {
         current_station = station_from_nvs;
       } else {
         ESP_LOGW(TAG, "Invalid station index %d found in NVS, defaulting to 0",
@@ -704,13 +949,35 @@ void app_main(void) {
 #else
   tcpip_adapter_init();
 #endif
-  // Create the UI message queue before any UI tasks are started
-  g_ui_queue = xQueueCreate(10, sizeof(ui_update_message_t));
-
+  // Before any of its producers start: the encoders and buttons, the web API,
+  // multi-room, recording schedules and the player itself
+  ESP_ERROR_CHECK(input_bus_init());
   display = lvgl_ssd1306_setup();
   screens_init(display);
-  update_station_name(radio_stations[current_station].call_sign);
-  update_station_origin(radio_stations[current_station].origin);
+  update_station_name(stations->stations[current_station].call_sign);
+  update_station_origin(stations->stations[current_station].origin);
+  if (visualizer_init() == ESP_OK) {
+    visualizer_set_mode(g_runtime_config.visualizer_mode);
+  }
+  if (stream_relay_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set up the stream relay");
+  }
+  timeshift_init();
+  if (recorder_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set up the recorder");
+  }
+  // Mounts the card and finds the files in the background, while Wi-Fi
+  // connects
+  if (local_media_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to set up local playback");
+  }
+#if CONFIG_DECODER_BENCH
+  // Before Wi-Fi and the pipeline, with the decoder's core to itself
+  decoder_bench_result_t bench;
+  decoder_bench_opus(decoder_bench_clip,
+                     decoder_bench_clip_end - decoder_bench_clip,
+                     CONFIG_DECODER_BENCH_RUNS, &bench);
+#endif
 
   // start oled display test task,  remove after debugging
   // xTaskCreate(task_test_ssd1306, "u8g2_task", 4096, NULL, 5, NULL);
@@ -809,22 +1076,46 @@ void app_main(void) {
                       portMAX_DELAY);
   ESP_LOGI(TAG, "Wi-Fi Connected.");
 
-  // Start audio pipeline AFTER WiFi is confirmed connected
-  ESP_LOGI(TAG, "Starting audio pipeline...");
-  err = create_audio_pipeline(&audio_pipeline_components,
-                              radio_stations[current_station].codec,
-                              radio_stations[current_station].uri);
-  if (err == ESP_OK) {
-    reset_throughput_history();
-    audio_pipeline_run(audio_pipeline_components.pipeline);
-    if (evt) {
-      audio_pipeline_set_listener(audio_pipeline_components.pipeline, evt);
+  // Wall clock, for recording schedules and file names
+  esp_sntp_config_t sntp_cfg = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+  if (esp_netif_sntp_init(&sntp_cfg) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start SNTP");
+  }
+
+  if (multiroom_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start multi-room sync");
+  }
+
+  // Start audio pipeline AFTER WiFi is confirmed connected. A follower's
+  // is created once the leader's stream is heard.
+  if (multiroom_is_follower()) {
+    update_station_name("Follower");
+    update_station_origin("Waiting for leader");
+  } else if (local_media_is_active()) {
+    ESP_LOGI(TAG, "Playing local files until a station is tuned");
+  } else {
+    ESP_LOGI(TAG, "Starting audio pipeline...");
+    err = create_audio_pipeline(&audio_pipeline_components,
+                                stations->stations[current_station].codec,
+                                stations->stations[current_station].uri);
+    if (err == ESP_OK) {
+      reset_throughput_history();
+      audio_pipeline_run(audio_pipeline_components.pipeline);
+      if (evt) {
+        audio_pipeline_set_listener(audio_pipeline_components.pipeline, evt);
+      }
+      g_is_pipeline_running = true;
     }
-    g_is_pipeline_running = true;
   }
+  station_snapshot_release(stations);
+  stations = NULL;
 
   start_web_server();
 
+  if (station_health_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start the station health prober");
+  }
+
   xTaskCreate(data_throughput_task, "data_throughput_task", 3 * 1024, NULL, 5,
               NULL);
 
@@ -886,6 +1177,20 @@ void app_main(void) {
       continue;
     }
 
+    // A local track played to its end: the next one. A pipeline stopped
+    // for any other reason doesn't finish with the whole file read.
+    if (local_media_is_active() &&
+        audio_pipeline_components.i2s_stream_writer &&
+        msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT &&
+        msg.source == (void *)audio_pipeline_components.i2s_stream_writer &&
+        msg.cmd == AEL_MSG_CMD_REPORT_STATUS &&
+        (int)msg.data == AEL_STATUS_STATE_FINISHED &&
+        local_media_source_done()) {
+      input_bus_post_simple(INPUT_EVENT_TRACK_STEP, INPUT_SOURCE_PLAYER,
+                            INPUT_CONTROL_NONE, 1);
+      continue;
+    }
+
     // Reset open error count on successful start or other events
     // (Note: in a real app you might check for AEL_STATUS_STATE_RUNNING)
   }
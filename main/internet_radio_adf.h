@@ -1,6 +1,8 @@
 #ifndef INTERNET_RADIO_ADF_H
 #define INTERNET_RADIO_ADF_H
 
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -11,8 +13,22 @@ extern "C" {
 /**
  * @brief Changes the radio station, handling pipeline destruction and creation.
  * @param new_station_index The index of the new station to play.
+ * @return ESP_OK once the new station is playing (or was already selected),
+ * ESP_ERR_INVALID_ARG for an index outside the list, or the pipeline error.
  */
-void change_station(int new_station_index);
+esp_err_t change_station(int new_station_index);
+
+/**
+ * @brief Rebuilds the pipeline for a new stream of the multi-room leader
+ * (followers only; see multiroom.h).
+ */
+esp_err_t follow_leader(codec_type_t codec);
+
+/**
+ * @brief Rebuilds the pipeline for a local file (uri: LOCAL_MEDIA_URI_PREFIX
+ * and the path; see local_media.h).
+ */
+esp_err_t play_file(codec_type_t codec, const char *uri);
 
 /**
  * @brief Resets the watchdog counter to avoid spurious restarts after sleep.
@@ -0,0 +1,412 @@
+#include "json_stream.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+  ST_VALUE,         // expecting a value
+  ST_VALUE_OR_END,  // after '[': a value or ']'
+  ST_KEY,           // after ',' in an object
+  ST_KEY_OR_END,    // after '{': a key or '}'
+  ST_COLON,         // after a key
+  ST_AFTER_VALUE,   // ',' or the end of the container
+  ST_STRING,        // inside a string or key
+  ST_ESCAPE,        // after '\' in a string
+  ST_UNICODE,       // reading the hex digits of \uXXXX
+  ST_NUMBER,        // inside a number
+  ST_LITERAL,       // inside true/false/null
+  ST_DONE,          // top-level value complete
+} parse_state_t;
+
+enum { CONTAINER_OBJECT, CONTAINER_ARRAY };
+
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *ctx) {
+  memset(js, 0, sizeof(*js));
+  js->cb = cb;
+  js->ctx = ctx;
+  js->state = ST_VALUE;
+}
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static esp_err_t emit(json_stream_t *js, json_token_type_t type) {
+  json_token_t token = {.type = type, .depth = js->depth};
+  return js->cb(&token, js->ctx);
+}
+
+static bool in_string(const json_stream_t *js) {
+  return js->state == ST_STRING || js->state == ST_ESCAPE ||
+         js->state == ST_UNICODE;
+}
+
+static esp_err_t token_append(json_stream_t *js, char c) {
+  if (js->token_len >= JSON_STREAM_TOKEN_MAX) {
+    if (js->truncate_strings && in_string(js)) {
+      js->truncated = true;
+      return ESP_OK;
+    }
+    return ESP_ERR_INVALID_SIZE;
+  }
+  js->token[js->token_len++] = c;
+  return ESP_OK;
+}
+
+static esp_err_t token_append_utf8(json_stream_t *js, uint32_t cp) {
+  char buf[4];
+  int n;
+  if (cp < 0x80) {
+    buf[0] = cp;
+    n = 1;
+  } else if (cp < 0x800) {
+    buf[0] = 0xC0 | (cp >> 6);
+    buf[1] = 0x80 | (cp & 0x3F);
+    n = 2;
+  } else if (cp < 0x10000) {
+    buf[0] = 0xE0 | (cp >> 12);
+    buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+    buf[2] = 0x80 | (cp & 0x3F);
+    n = 3;
+  } else {
+    buf[0] = 0xF0 | (cp >> 18);
+    buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+    buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+    buf[3] = 0x80 | (cp & 0x3F);
+    n = 4;
+  }
+  if (js->truncate_strings && js->token_len + n > JSON_STREAM_TOKEN_MAX) {
+    js->truncated = true; // never keep part of a character
+    return ESP_OK;
+  }
+  for (int i = 0; i < n; i++) {
+    esp_err_t ret = token_append(js, buf[i]);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+  }
+  return ESP_OK;
+}
+
+// A high surrogate not followed by a low one becomes U+FFFD
+static esp_err_t flush_surrogate(json_stream_t *js) {
+  if (js->pending_high == 0) {
+    return ESP_OK;
+  }
+  js->pending_high = 0;
+  return token_append_utf8(js, 0xFFFD);
+}
+
+static esp_err_t push(json_stream_t *js, uint8_t container) {
+  if (js->depth >= JSON_STREAM_MAX_DEPTH) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t ret = emit(js, container == CONTAINER_OBJECT
+                               ? JSON_TOKEN_OBJECT_START
+                               : JSON_TOKEN_ARRAY_START);
+  js->stack[js->depth++] = container;
+  js->state = container == CONTAINER_OBJECT ? ST_KEY_OR_END : ST_VALUE_OR_END;
+  return ret;
+}
+
+static esp_err_t pop(json_stream_t *js, uint8_t container) {
+  if (js->depth == 0 || js->stack[js->depth - 1] != container) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  js->depth--;
+  js->state = js->depth == 0 ? ST_DONE : ST_AFTER_VALUE;
+  return emit(js, container == CONTAINER_OBJECT ? JSON_TOKEN_OBJECT_END
+                                                : JSON_TOKEN_ARRAY_END);
+}
+
+static void value_done(json_stream_t *js) {
+  js->state = js->depth == 0 ? ST_DONE : ST_AFTER_VALUE;
+}
+
+// Drops a multi-byte character left incomplete by truncation
+static void trim_partial_utf8(json_stream_t *js) {
+  size_t start = js->token_len;
+  while (start > 0 && ((unsigned char)js->token[start - 1] & 0xC0) == 0x80) {
+    start--;
+  }
+  if (start == 0) {
+    return;
+  }
+  unsigned char lead = js->token[start - 1];
+  size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+  if (js->token_len - (start - 1) < need) {
+    js->token_len = start - 1;
+  }
+}
+
+static esp_err_t end_string(json_stream_t *js) {
+  esp_err_t ret = flush_surrogate(js);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  if (js->truncated) {
+    trim_partial_utf8(js);
+  }
+  js->token[js->token_len] = '\0';
+  json_token_t token = {.type = js->is_key ? JSON_TOKEN_KEY : JSON_TOKEN_STRING,
+                        .depth = js->depth,
+                        .str = js->token,
+                        .len = js->token_len,
+                        .truncated = js->truncated};
+  if (js->is_key) {
+    js->state = ST_COLON;
+  } else {
+    value_done(js);
+  }
+  return js->cb(&token, js->ctx);
+}
+
+static esp_err_t end_number(json_stream_t *js) {
+  js->token[js->token_len] = '\0';
+  char *end = NULL;
+  double value = strtod(js->token, &end);
+  // strtod accepts a superset of JSON numbers; at least reject leftovers
+  if (js->token_len == 0 || end != js->token + js->token_len) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  json_token_t token = {
+      .type = JSON_TOKEN_NUMBER, .depth = js->depth, .number = value};
+  value_done(js);
+  return js->cb(&token, js->ctx);
+}
+
+static esp_err_t end_literal(json_stream_t *js) {
+  js->token[js->token_len] = '\0';
+  json_token_t token = {.depth = js->depth};
+  if (strcmp(js->token, "true") == 0) {
+    token.type = JSON_TOKEN_BOOL;
+    token.boolean = true;
+  } else if (strcmp(js->token, "false") == 0) {
+    token.type = JSON_TOKEN_BOOL;
+  } else if (strcmp(js->token, "null") == 0) {
+    token.type = JSON_TOKEN_NULL;
+  } else {
+    return ESP_ERR_INVALID_ARG;
+  }
+  value_done(js);
+  return js->cb(&token, js->ctx);
+}
+
+static esp_err_t start_value(json_stream_t *js, char c) {
+  js->token_len = 0;
+  if (c == '{') {
+    return push(js, CONTAINER_OBJECT);
+  }
+  if (c == '[') {
+    return push(js, CONTAINER_ARRAY);
+  }
+  if (c == '"') {
+    js->is_key = false;
+    js->truncated = false;
+    js->state = ST_STRING;
+    return ESP_OK;
+  }
+  if (c == '-' || (c >= '0' && c <= '9')) {
+    js->state = ST_NUMBER;
+    return token_append(js, c);
+  }
+  if (c == 't' || c == 'f' || c == 'n') {
+    js->state = ST_LITERAL;
+    return token_append(js, c);
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static esp_err_t end_unicode(json_stream_t *js) {
+  uint32_t cp = js->code_point;
+  js->state = ST_STRING;
+  if (cp >= 0xD800 && cp < 0xDC00) {
+    esp_err_t ret = flush_surrogate(js);
+    js->pending_high = cp;
+    return ret;
+  }
+  if (cp >= 0xDC00 && cp < 0xE000) {
+    if (js->pending_high == 0) {
+      return token_append_utf8(js, 0xFFFD);
+    }
+    cp = 0x10000 + ((js->pending_high - 0xD800) << 10) + (cp - 0xDC00);
+    js->pending_high = 0;
+    return token_append_utf8(js, cp);
+  }
+  esp_err_t ret = flush_surrogate(js);
+  return ret != ESP_OK ? ret : token_append_utf8(js, cp);
+}
+
+// Consumes one character. Scalars that end on a delimiter (numbers, literals)
+// return ESP_ERR_NOT_FINISHED to have the delimiter processed again.
+static esp_err_t step(json_stream_t *js, char c) {
+  switch (js->state) {
+  case ST_VALUE:
+  case ST_VALUE_OR_END:
+    if (is_space(c)) {
+      return ESP_OK;
+    }
+    if (c == ']' && js->state == ST_VALUE_OR_END) {
+      return pop(js, CONTAINER_ARRAY);
+    }
+    return start_value(js, c);
+
+  case ST_KEY:
+  case ST_KEY_OR_END:
+    if (is_space(c)) {
+      return ESP_OK;
+    }
+    if (c == '}' && js->state == ST_KEY_OR_END) {
+      return pop(js, CONTAINER_OBJECT);
+    }
+    if (c != '"') {
+      return ESP_ERR_INVALID_ARG;
+    }
+    js->token_len = 0;
+    js->is_key = true;
+    js->truncated = false;
+    js->state = ST_STRING;
+    return ESP_OK;
+
+  case ST_COLON:
+    if (is_space(c)) {
+      return ESP_OK;
+    }
+    if (c != ':') {
+      return ESP_ERR_INVALID_ARG;
+    }
+    js->state = ST_VALUE;
+    return ESP_OK;
+
+  case ST_AFTER_VALUE:
+    if (is_space(c)) {
+      return ESP_OK;
+    }
+    if (c == ',') {
+      js->state = js->stack[js->depth - 1] == CONTAINER_OBJECT ? ST_KEY
+                                                                : ST_VALUE;
+      return ESP_OK;
+    }
+    if (c == '}') {
+      return pop(js, CONTAINER_OBJECT);
+    }
+    if (c == ']') {
+      return pop(js, CONTAINER_ARRAY);
+    }
+    return ESP_ERR_INVALID_ARG;
+
+  case ST_STRING:
+    if (c == '\\') {
+      js->state = ST_ESCAPE;
+      return ESP_OK;
+    }
+    if (c == '"') {
+      return end_string(js);
+    }
+    if ((unsigned char)c < 0x20) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    {
+      esp_err_t ret = flush_surrogate(js);
+      return ret != ESP_OK ? ret : token_append(js, c);
+    }
+
+  case ST_ESCAPE: {
+    if (c == 'u') {
+      js->state = ST_UNICODE;
+      js->hex_digits = 0;
+      js->code_point = 0;
+      return ESP_OK;
+    }
+    static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+    const char *hit = NULL;
+    for (const char *e = escapes; *e; e += 2) {
+      if (*e == c) {
+        hit = e + 1;
+        break;
+      }
+    }
+    if (hit == NULL) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    js->state = ST_STRING;
+    esp_err_t ret = flush_surrogate(js);
+    return ret != ESP_OK ? ret : token_append(js, *hit);
+  }
+
+  case ST_UNICODE: {
+    int v = hex_value(c);
+    if (v < 0) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    js->code_point = (js->code_point << 4) | v;
+    if (++js->hex_digits < 4) {
+      return ESP_OK;
+    }
+    return end_unicode(js);
+  }
+
+  case ST_NUMBER:
+    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' ||
+        c == '+' || c == '-') {
+      return token_append(js, c);
+    }
+    {
+      esp_err_t ret = end_number(js);
+      return ret != ESP_OK ? ret : ESP_ERR_NOT_FINISHED;
+    }
+
+  case ST_LITERAL:
+    if (c >= 'a' && c <= 'z') {
+      return token_append(js, c);
+    }
+    {
+      esp_err_t ret = end_literal(js);
+      return ret != ESP_OK ? ret : ESP_ERR_NOT_FINISHED;
+    }
+
+  case ST_DONE:
+    return is_space(c) ? ESP_OK : ESP_ERR_INVALID_ARG;
+  }
+  return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t json_stream_feed(json_stream_t *js, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    esp_err_t ret = step(js, data[i]);
+    if (ret == ESP_ERR_NOT_FINISHED) {
+      ret = step(js, data[i]);
+    }
+    if (ret != ESP_OK) {
+      return ret;
+    }
+    js->offset++;
+  }
+  return ESP_OK;
+}
+
+esp_err_t json_stream_finish(json_stream_t *js) {
+  esp_err_t ret = ESP_OK;
+  // A bare top-level number or literal ends with the input
+  if (js->state == ST_NUMBER && js->depth == 0) {
+    ret = end_number(js);
+  } else if (js->state == ST_LITERAL && js->depth == 0) {
+    ret = end_literal(js);
+  }
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  return js->state == ST_DONE ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
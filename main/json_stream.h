@@ -0,0 +1,107 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Deepest nesting of objects and arrays accepted
+#define JSON_STREAM_MAX_DEPTH 8
+// Longest string, key or number (decoded, excluding terminator)
+#define JSON_STREAM_TOKEN_MAX 511
+
+/**
+ * @brief Token types reported by the tokenizer.
+ */
+typedef enum {
+  JSON_TOKEN_OBJECT_START,
+  JSON_TOKEN_OBJECT_END,
+  JSON_TOKEN_ARRAY_START,
+  JSON_TOKEN_ARRAY_END,
+  JSON_TOKEN_KEY,
+  JSON_TOKEN_STRING,
+  JSON_TOKEN_NUMBER,
+  JSON_TOKEN_BOOL,
+  JSON_TOKEN_NULL,
+} json_token_type_t;
+
+/**
+ * @brief A token. str is valid only during the callback.
+ *
+ * depth is the nesting level the token belongs to: a top-level array's
+ * start/end are at depth 0, its elements at depth 1, and the keys and values
+ * of an object in that array at depth 2.
+ */
+typedef struct {
+  json_token_type_t type;
+  int depth;
+  const char *str; // KEY and STRING: decoded UTF-8, NUL terminated
+  size_t len;
+  double number;  // NUMBER
+  bool boolean;   // BOOL
+  bool truncated; // KEY and STRING: cut at JSON_STREAM_TOKEN_MAX bytes
+} json_token_t;
+
+/**
+ * @brief Token callback. Returning anything but ESP_OK aborts parsing with
+ * that error.
+ */
+typedef esp_err_t (*json_stream_cb_t)(const json_token_t *token, void *ctx);
+
+/**
+ * @brief Incremental JSON tokenizer.
+ *
+ * Input is pushed in chunks of any size (e.g. straight from httpd_req_recv)
+ * and tokens are reported as soon as they are complete; no document tree is
+ * built and memory use is fixed (this struct). Strings are unescaped,
+ * including \\u escapes and surrogate pairs.
+ *
+ * Set truncate_strings after init to accept documents with strings of any
+ * length (e.g. third-party exports with long descriptions): longer strings
+ * are cut at a character boundary and flagged instead of failing.
+ */
+typedef struct {
+  json_stream_cb_t cb;
+  void *ctx;
+  uint8_t state;
+  uint8_t depth;
+  uint8_t stack[JSON_STREAM_MAX_DEPTH]; // container types
+  bool is_key;
+  bool truncate_strings;
+  bool truncated; // current string lost characters
+  uint8_t hex_digits;
+  uint32_t code_point;
+  uint32_t pending_high; // high surrogate waiting for its pair
+  size_t token_len;
+  size_t offset; // bytes consumed, for error reporting
+  char token[JSON_STREAM_TOKEN_MAX + 1];
+} json_stream_t;
+
+/**
+ * @brief Prepares a tokenizer for a new document.
+ */
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *ctx);
+
+/**
+ * @brief Consumes a chunk of input.
+ * @return ESP_OK, ESP_ERR_INVALID_ARG on a syntax error, ESP_ERR_INVALID_SIZE
+ * if a token or the nesting is too large, or the callback's error.
+ */
+esp_err_t json_stream_feed(json_stream_t *js, const char *data, size_t len);
+
+/**
+ * @brief Ends the input.
+ * @return ESP_OK if exactly one complete value was read.
+ */
+esp_err_t json_stream_finish(json_stream_t *js);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JSON_STREAM_H
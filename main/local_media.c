@@ -0,0 +1,825 @@
+#include "local_media.h"
+#include "audio_pipeline_manager.h"
+#include "decoder_registry.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "internet_radio_adf.h"
+#include "multiroom.h"
+#include "screens.h"
+#include "sd_card.h"
+#include "stream_head.h"
+#include "ui_state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *TAG = "LOCAL_MEDIA";
+
+// Mounted by station_data.c
+#define LM_SPIFFS_ROOT "/spiffs"
+// Read from the card at a time, into internal RAM
+#define LM_READ_CHUNK (16 * 1024)
+// The ring is topped up once it has drained to this
+#define LM_REFILL_LEVEL (LOCAL_MEDIA_RING_SIZE / 2)
+// Longest the decoder is kept waiting, so the pipeline can be stopped
+#define LM_READ_TIMEOUT_MS 100
+// Played this long, the measured byte rate is trusted for seeking
+#define LM_RATE_MIN_PLAY_US (3 * 1000000LL)
+// Byte rates assumed before that: 128 kb/s, and CD quality FLAC
+#define LM_DEFAULT_RATE (128000 / 8)
+#define LM_FLAC_DEFAULT_RATE 100000
+// A seek looks this many chunks ahead for a frame
+#define LM_SYNC_SEARCH_CHUNKS 4
+// FLAC metadata blocks walked at most, past the first chunk
+#define LM_FLAC_MAX_BLOCKS 64
+#define LM_READ_AHEAD_STACK 3072
+// As the HTTP reader it stands in for
+#define LM_READ_AHEAD_PRIORITY 4
+#define LM_SCAN_STACK 4096
+#define LM_SCAN_PRIORITY 2
+
+// Folders, the track list and the player state; held by readers of names
+static SemaphoreHandle_t lib_lock = NULL;
+static SemaphoreHandle_t scan_lock = NULL; // one scan at a time
+static media_folder_t *folders = NULL;
+static media_folder_t *scan_buf = NULL; // swapped with folders
+static int folder_count = 0;
+static media_tracks_t tracks;
+static int tracks_folder = -1; // folder tracks was loaded for
+static int cur_folder = -1;
+static int cur_track = 0;
+static char resume_path[MEDIA_PATH_MAX]; // folder played last
+static atomic_bool active = false;
+static atomic_bool paused = false;
+static atomic_bool scanned = false;
+
+// The file: file_lock is held while it is read, opened, moved in or closed
+static SemaphoreHandle_t file_lock = NULL;
+static TaskHandle_t read_ahead_handle = NULL;
+static uint8_t *chunk = NULL; // internal RAM
+static int fd = -1;
+static media_format_t format;
+static uint64_t file_size = 0;
+static uint32_t audio_start = 0; // bytes before the first frame
+static uint32_t flac_rate = 0;   // from STREAMINFO, bytes per second
+
+// The ring, under ra_lock; data_sem is given as data arrives
+static SemaphoreHandle_t ra_lock = NULL;
+static SemaphoreHandle_t data_sem = NULL;
+static uint8_t *ring = NULL; // PSRAM
+static size_t ring_tail = 0;
+static size_t ring_fill = 0;
+static uint64_t ring_file_pos = 0; // file offset just past the ring's data
+static bool file_eof = false;
+static bool primed = false;   // filled up since the last open or seek
+static bool starving = false; // decoder waiting on an empty ring
+static uint64_t fed_bytes = 0;    // given to the decoder, for the byte rate
+static int64_t first_data_us = 0; // of the track
+static int64_t paused_at_us = 0;
+static int64_t paused_total_us = 0;
+static int64_t start_request_us = 0; // pending startup measurement
+static int64_t seek_request_us = 0;  // pending seek measurement
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static local_media_stats_t stats;
+static uint64_t read_us = 0; // time spent in read(), for read_kbps
+
+static void *lm_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+static codec_type_t codec_of(media_format_t fmt) {
+  switch (fmt) {
+  case MEDIA_FORMAT_AAC:
+    return CODEC_TYPE_AAC;
+  case MEDIA_FORMAT_OGG:
+    return CODEC_TYPE_OGG;
+  case MEDIA_FORMAT_FLAC:
+    return CODEC_TYPE_FLAC;
+  case MEDIA_FORMAT_OPUS:
+    return CODEC_TYPE_OPUS;
+  default:
+    return CODEC_TYPE_MP3;
+  }
+}
+
+static stream_sync_t sync_of(media_format_t fmt) {
+  return decoder_registry_sync(codec_of(fmt));
+}
+
+/* ---------- read ahead ---------- */
+
+/* Appends to the ring; ra_lock held, and room checked */
+static void ring_put(const uint8_t *data, size_t len) {
+  size_t head = (ring_tail + ring_fill) % LOCAL_MEDIA_RING_SIZE;
+  size_t n = MIN(len, LOCAL_MEDIA_RING_SIZE - head);
+  memcpy(ring + head, data, n);
+  memcpy(ring, data + n, len - n);
+  ring_fill += len;
+  ring_file_pos += len;
+}
+
+/* Empties the ring for data from file offset pos on; ra_lock held */
+static void ring_reset(uint64_t pos) {
+  ring_tail = 0;
+  ring_fill = 0;
+  ring_file_pos = pos;
+  file_eof = false;
+  primed = false;
+  starving = false;
+}
+
+/* read() with the figures kept; file_lock held */
+static ssize_t timed_read(uint8_t *buf, size_t len) {
+  int64_t start = esp_timer_get_time();
+  ssize_t n = read(fd, buf, len);
+  int64_t took = esp_timer_get_time() - start;
+  if (n > 0) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.bytes_read += n;
+    stats.read_stall_max_ms =
+        MAX(stats.read_stall_max_ms, (uint32_t)(took / 1000));
+    read_us += took;
+    portEXIT_CRITICAL(&stats_lock);
+  } else if (n < 0) {
+    ESP_LOGE(TAG, "Reading failed: %s", strerror(errno));
+  }
+  return n;
+}
+
+static void read_ahead_task(void *pvParameters) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Burst: the ring is filled all the way up
+    for (;;) {
+      xSemaphoreTake(file_lock, portMAX_DELAY);
+      xSemaphoreTake(ra_lock, portMAX_DELAY);
+      bool room = LOCAL_MEDIA_RING_SIZE - ring_fill >= LM_READ_CHUNK;
+      bool more = fd >= 0 && !file_eof && room;
+      if (fd >= 0 && !room) {
+        primed = true;
+      }
+      xSemaphoreGive(ra_lock);
+      if (!more) {
+        xSemaphoreGive(file_lock);
+        break;
+      }
+      ssize_t n = timed_read(chunk, LM_READ_CHUNK);
+      xSemaphoreTake(ra_lock, portMAX_DELAY);
+      if (n > 0) {
+        ring_put(chunk, n);
+      } else {
+        file_eof = true; // errors end the track too
+      }
+      xSemaphoreGive(ra_lock);
+      xSemaphoreGive(file_lock);
+      xSemaphoreGive(data_sem);
+    }
+  }
+}
+
+/* Bytes before the first audio frame: an ID3v2 tag, FLAC metadata or Ogg
+ * header pages. buf holds the first len bytes; file_lock held, the file
+ * position is left anywhere. */
+static uint32_t find_audio_start(const uint8_t *buf, size_t len) {
+  if (sync_of(format) == STREAM_SYNC_OGG) {
+    int n = stream_head_ogg_len(buf, len);
+    return n > 0 ? n : 0;
+  }
+  if (format == MEDIA_FORMAT_FLAC) {
+    int n = stream_head_flac_len(buf, len);
+    if (n != 0) {
+      return MAX(n, 0);
+    }
+    // Metadata longer than the chunk (cover art): walk the block headers
+    uint32_t off = 4;
+    uint8_t hdr[4];
+    for (int i = 0; i < LM_FLAC_MAX_BLOCKS; i++) {
+      if (lseek(fd, off, SEEK_SET) < 0 || read(fd, hdr, 4) != 4) {
+        return 0;
+      }
+      off += 4 + ((uint32_t)hdr[1] << 16 | hdr[2] << 8 | hdr[3]);
+      if (hdr[0] & 0x80) {
+        return off;
+      }
+    }
+    return 0;
+  }
+  // MP3 and ADTS files may start with a tag; the size is synchsafe
+  if (len >= 10 && memcmp(buf, "ID3", 3) == 0) {
+    uint32_t size = (buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+                    (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f);
+    return 10 + size + (buf[5] & 0x10 ? 10 : 0);
+  }
+  return 0;
+}
+
+/* Stream bytes per second, as well as known */
+static uint32_t byte_rate(void) {
+  if (flac_rate) {
+    return flac_rate;
+  }
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  int64_t now = paused_at_us ? paused_at_us : esp_timer_get_time();
+  int64_t played_us = first_data_us ? now - first_data_us - paused_total_us
+                                    : 0;
+  uint64_t fed = fed_bytes;
+  xSemaphoreGive(ra_lock);
+  if (played_us >= LM_RATE_MIN_PLAY_US) {
+    return fed * 1000000 / played_us;
+  }
+  return format == MEDIA_FORMAT_FLAC ? LM_FLAC_DEFAULT_RATE : LM_DEFAULT_RATE;
+}
+
+bool local_media_is_source_uri(const char *uri) {
+  return uri && strncmp(uri, LOCAL_MEDIA_URI_PREFIX,
+                        strlen(LOCAL_MEDIA_URI_PREFIX)) == 0;
+}
+
+/* The ring and the read buffer, on first use */
+static esp_err_t alloc_buffers(void) {
+  if (ring) {
+    return ESP_OK;
+  }
+  ring = lm_alloc(LOCAL_MEDIA_RING_SIZE);
+  chunk = heap_caps_malloc(LM_READ_CHUNK, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (ring == NULL || chunk == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate the read-ahead buffers");
+    free(ring);
+    free(chunk);
+    ring = NULL;
+    chunk = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  portENTER_CRITICAL(&stats_lock);
+  stats.memory += LOCAL_MEDIA_RING_SIZE + LM_READ_CHUNK;
+  portEXIT_CRITICAL(&stats_lock);
+  return ESP_OK;
+}
+
+esp_err_t local_media_source_prepare(const char *uri) {
+  if (file_lock == NULL || !local_media_is_source_uri(uri)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const char *path = uri + strlen(LOCAL_MEDIA_URI_PREFIX);
+  esp_err_t err = alloc_buffers();
+  if (err != ESP_OK) {
+    return err;
+  }
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    xSemaphoreGive(file_lock);
+    return ESP_ERR_NOT_FOUND;
+  }
+  file_size = st.st_size;
+  format = media_format_from_path(path);
+
+  // The first chunk now, so the decoder can start without waiting
+  ssize_t n = timed_read(chunk, LM_READ_CHUNK);
+  n = MAX(n, 0);
+  audio_start = find_audio_start(chunk, n);
+  flac_rate = 0;
+  uint32_t sample_rate;
+  uint64_t samples;
+  if (format == MEDIA_FORMAT_FLAC &&
+      stream_head_flac_streaminfo(chunk, n, &sample_rate, &samples) &&
+      samples >= sample_rate && file_size > audio_start) {
+    flac_rate = (file_size - audio_start) * sample_rate / samples;
+  }
+  lseek(fd, n, SEEK_SET);
+
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  ring_reset(0);
+  ring_put(chunk, n);
+  file_eof = n < LM_READ_CHUNK;
+  fed_bytes = 0;
+  first_data_us = 0;
+  paused_at_us = atomic_load(&paused) ? esp_timer_get_time() : 0;
+  paused_total_us = 0;
+  seek_request_us = 0;
+  xSemaphoreGive(ra_lock);
+  xSemaphoreGive(file_lock);
+  xSemaphoreTake(data_sem, 0); // stale
+  xTaskNotifyGive(read_ahead_handle);
+  ESP_LOGI(TAG, "Playing %s (%" PRIu64 " bytes, audio from %" PRIu32 ")",
+           path, file_size, audio_start);
+  return ESP_OK;
+}
+
+void local_media_source_close(void) {
+  if (file_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  ring_reset(0);
+  xSemaphoreGive(ra_lock);
+  xSemaphoreGive(file_lock);
+}
+
+bool local_media_source_done(void) {
+  if (ra_lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  bool done = file_eof && ring_fill == 0;
+  xSemaphoreGive(ra_lock);
+  return done;
+}
+
+/* First data of a track or after a seek: the time it took; ra_lock held */
+static void note_first_data(int64_t now) {
+  if (first_data_us == 0) {
+    first_data_us = now;
+  }
+  if (start_request_us) {
+    uint32_t ms = (now - start_request_us) / 1000;
+    start_request_us = 0;
+    portENTER_CRITICAL(&stats_lock);
+    stats.start_ms = ms;
+    stats.start_max_ms = MAX(stats.start_max_ms, ms);
+    portEXIT_CRITICAL(&stats_lock);
+  }
+  if (seek_request_us) {
+    uint32_t ms = (now - seek_request_us) / 1000;
+    seek_request_us = 0;
+    portENTER_CRITICAL(&stats_lock);
+    stats.seek_ms = ms;
+    stats.seek_max_ms = MAX(stats.seek_max_ms, ms);
+    portEXIT_CRITICAL(&stats_lock);
+  }
+}
+
+int local_media_source_read(audio_element_handle_t el, char *buf, int len,
+                            TickType_t wait, void *ctx) {
+  TickType_t until =
+      xTaskGetTickCount() + MIN(wait, pdMS_TO_TICKS(LM_READ_TIMEOUT_MS));
+  for (;;) {
+    if (!atomic_load(&paused)) {
+      xSemaphoreTake(ra_lock, portMAX_DELAY);
+      if (ring_fill > 0) {
+        size_t n = MIN((size_t)len, ring_fill);
+        size_t first = MIN(n, LOCAL_MEDIA_RING_SIZE - ring_tail);
+        memcpy(buf, ring + ring_tail, first);
+        memcpy(buf + first, ring, n - first);
+        ring_tail = (ring_tail + n) % LOCAL_MEDIA_RING_SIZE;
+        ring_fill -= n;
+        fed_bytes += n;
+        starving = false;
+        note_first_data(esp_timer_get_time());
+        size_t fill = ring_fill;
+        bool refill = !file_eof && fill < LM_REFILL_LEVEL;
+        if (primed && !file_eof) {
+          portENTER_CRITICAL(&stats_lock);
+          stats.fill_min = MIN(stats.fill_min, (uint32_t)fill);
+          portEXIT_CRITICAL(&stats_lock);
+        }
+        xSemaphoreGive(ra_lock);
+        if (refill) {
+          xTaskNotifyGive(read_ahead_handle);
+        }
+        g_bytes_read += n; // bitrate display
+        g_stream_buffer_fill = fill * 100 / LOCAL_MEDIA_RING_SIZE;
+        return n;
+      }
+      bool done = file_eof;
+      // Until the ring has filled once, a wait is part of starting up
+      if (!done && !starving && primed) {
+        starving = true;
+        portENTER_CRITICAL(&stats_lock);
+        stats.starved++;
+        portEXIT_CRITICAL(&stats_lock);
+      }
+      xSemaphoreGive(ra_lock);
+      if (done) {
+        return AEL_IO_DONE;
+      }
+    }
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(until - now) <= 0 ||
+        xSemaphoreTake(data_sem, until - now) != pdTRUE) {
+      return AEL_IO_TIMEOUT;
+    }
+  }
+}
+
+/* ---------- library ---------- */
+
+/* Finds the folders again; the one being played keeps its place */
+static void rescan(void) {
+  xSemaphoreTake(scan_lock, portMAX_DELAY);
+  const char *roots[2];
+  int root_count = 0;
+  if (sd_card_is_mounted()) {
+    roots[root_count++] = SD_CARD_MOUNT_POINT;
+  }
+  roots[root_count++] = LM_SPIFFS_ROOT;
+  int64_t start = esp_timer_get_time();
+  int count = media_library_scan(roots, root_count, scan_buf,
+                                 MEDIA_MAX_FOLDERS);
+  uint32_t ms = (esp_timer_get_time() - start) / 1000;
+
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  const char *playing =
+      cur_folder >= 0 ? folders[cur_folder].path : resume_path;
+  int found = -1;
+  for (int i = 0; i < count && found < 0; i++) {
+    if (strcmp(scan_buf[i].path, playing) == 0) {
+      found = i;
+    }
+  }
+  if (cur_folder >= 0) {
+    cur_folder = found;
+    tracks_folder = found;
+    if (found < 0) {
+      media_tracks_free(&tracks);
+    }
+  }
+  media_folder_t *old = folders;
+  folders = scan_buf;
+  scan_buf = old;
+  folder_count = count;
+  xSemaphoreGive(lib_lock);
+  xSemaphoreGive(scan_lock);
+
+  atomic_store(&scanned, true);
+  portENTER_CRITICAL(&stats_lock);
+  stats.scan_ms = ms;
+  stats.mounted = sd_card_is_mounted();
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "%d folders found in %" PRIu32 " ms", count, ms);
+}
+
+static void scan_task(void *pvParameters) {
+  sd_card_mount();
+  rescan();
+  vTaskDelete(NULL);
+}
+
+/* Loads the track list of folder if it isn't; lib_lock held */
+static int load_tracks(int folder) {
+  if (tracks_folder == folder) {
+    return tracks.count;
+  }
+  tracks_folder = -1;
+  int count = media_tracks_load(&folders[folder], &tracks);
+  if (count <= 0) {
+    return count;
+  }
+  tracks_folder = folder;
+  portENTER_CRITICAL(&stats_lock);
+  stats.memory = (ring ? LOCAL_MEDIA_RING_SIZE + LM_READ_CHUNK : 0) +
+                 2 * MEDIA_MAX_FOLDERS * sizeof(media_folder_t) +
+                 MEDIA_MAX_TRACKS * sizeof(uint32_t) + tracks.names_cap;
+  portEXIT_CRITICAL(&stats_lock);
+  return count;
+}
+
+/* ---------- player ---------- */
+
+esp_err_t local_media_play(int folder, int track) {
+  if (lib_lock == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (multiroom_is_follower()) {
+    ESP_LOGW(TAG, "Following the multi-room leader; files are not played");
+    return ESP_ERR_INVALID_STATE;
+  }
+  char uri[sizeof(LOCAL_MEDIA_URI_PREFIX) + MEDIA_PATH_MAX];
+  char name[UI_STATE_STR_MAX];
+  char folder_name[UI_STATE_STR_MAX];
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  if (folder < 0 || folder >= folder_count) {
+    xSemaphoreGive(lib_lock);
+    return ESP_ERR_INVALID_ARG;
+  }
+  int count = load_tracks(folder);
+  if (count <= 0 || track < 0 || track >= count) {
+    xSemaphoreGive(lib_lock);
+    return count < 0 ? ESP_FAIL : ESP_ERR_INVALID_ARG;
+  }
+  const char *path = media_track_path(&tracks, track);
+  cur_folder = folder;
+  cur_track = track;
+  strlcpy(resume_path, folders[folder].path, sizeof(resume_path));
+  snprintf(uri, sizeof(uri), LOCAL_MEDIA_URI_PREFIX "%s", path);
+  media_display_name(path, name, sizeof(name));
+  media_display_name(folders[folder].path, folder_name, sizeof(folder_name));
+  codec_type_t codec = codec_of(media_format_from_path(path));
+  xSemaphoreGive(lib_lock);
+
+  atomic_store(&active, true);
+  atomic_store(&paused, false);
+  update_time_shift(false, 0);
+  update_station_name(name);
+  update_station_origin(folder_name);
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  start_request_us = esp_timer_get_time();
+  xSemaphoreGive(ra_lock);
+  ESP_LOGI(TAG, "Track %d of %d in %s", track + 1, count, folder_name);
+  esp_err_t err = play_file(codec, uri);
+  if (err != ESP_OK) {
+    xSemaphoreTake(ra_lock, portMAX_DELAY);
+    start_request_us = 0;
+    xSemaphoreGive(ra_lock);
+  }
+  return err;
+}
+
+esp_err_t local_media_enter(void) {
+  if (lib_lock == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (multiroom_is_follower()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  // A card may have been put in since boot
+  sd_card_mount();
+  rescan();
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  int folder = 0;
+  int track = 0;
+  for (int i = 0; i < folder_count; i++) {
+    if (strcmp(folders[i].path, resume_path) == 0) {
+      folder = i;
+      track = cur_track;
+    }
+  }
+  int count = folder_count;
+  xSemaphoreGive(lib_lock);
+  if (count == 0) {
+    ESP_LOGW(TAG, "No audio files found");
+    return ESP_ERR_NOT_FOUND;
+  }
+  esp_err_t err = local_media_play(folder, track);
+  if (err == ESP_ERR_INVALID_ARG && track != 0) {
+    err = local_media_play(folder, 0); // the folder has changed
+  }
+  return err;
+}
+
+void local_media_leave(void) {
+  if (atomic_exchange(&active, false)) {
+    ESP_LOGI(TAG, "Leaving local playback");
+    atomic_store(&paused, false);
+    update_time_shift(false, 0);
+  }
+}
+
+esp_err_t local_media_step(int delta) {
+  if (!atomic_load(&active)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  int folder = cur_folder;
+  int count = folder >= 0 && tracks_folder == folder ? tracks.count : 0;
+  int track = cur_track;
+  xSemaphoreGive(lib_lock);
+  if (count == 0) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return local_media_play(folder, ((track + delta) % count + count) % count);
+}
+
+esp_err_t local_media_pause(int state) {
+  if (!atomic_load(&active)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  bool pause = state < 0 ? !atomic_load(&paused) : state != 0;
+  if (atomic_exchange(&paused, pause) == pause) {
+    return ESP_OK;
+  }
+  // Paused time doesn't count towards the measured byte rate
+  int64_t now = esp_timer_get_time();
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  if (pause) {
+    paused_at_us = now;
+  } else if (paused_at_us) {
+    paused_total_us += now - paused_at_us;
+    paused_at_us = 0;
+  }
+  xSemaphoreGive(ra_lock);
+  if (!pause) {
+    xSemaphoreGive(data_sem); // a waiting reader looks again
+  }
+  update_time_shift(pause, 0);
+  ESP_LOGI(TAG, "%s", pause ? "Paused" : "Resumed");
+  return ESP_OK;
+}
+
+esp_err_t local_media_seek(int seconds) {
+  if (!atomic_load(&active)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  int64_t request_us = esp_timer_get_time();
+  uint32_t rate = byte_rate();
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  if (fd < 0) {
+    xSemaphoreGive(file_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  int64_t pos = ring_file_pos - ring_fill; // the decoder is here
+  xSemaphoreGive(ra_lock);
+  int64_t target = pos + (int64_t)seconds * rate;
+  target = MAX(target, (int64_t)audio_start);
+  target = MIN(target, (int64_t)file_size); // past the end: the next track
+
+  // Reading resumes at the next frame
+  stream_sync_t sync = sync_of(format);
+  int64_t chunk_pos = target;
+  ssize_t n = 0;
+  size_t off = 0;
+  bool found = false;
+  if (lseek(fd, target, SEEK_SET) >= 0) {
+    for (int i = 0; i < LM_SYNC_SEARCH_CHUNKS && !found; i++) {
+      n = timed_read(chunk, LM_READ_CHUNK);
+      if (n <= 0) {
+        n = 0;
+        break;
+      }
+      off = stream_sync_find(sync, chunk, n);
+      found = off < (size_t)n;
+      if (!found) {
+        // A frame start could straddle the chunks
+        chunk_pos += n - MIN((size_t)n, STREAM_SYNC_LEN - 1);
+        lseek(fd, chunk_pos, SEEK_SET);
+      }
+    }
+  }
+  xSemaphoreTake(ra_lock, portMAX_DELAY);
+  ring_reset(found ? chunk_pos + (int64_t)off : chunk_pos);
+  if (found) {
+    ring_put(chunk + off, n - off);
+  }
+  file_eof = found ? n < LM_READ_CHUNK : n == 0;
+  seek_request_us = request_us;
+  xSemaphoreGive(ra_lock);
+  xSemaphoreGive(file_lock);
+  xSemaphoreGive(data_sem);
+  xTaskNotifyGive(read_ahead_handle);
+
+  portENTER_CRITICAL(&stats_lock);
+  stats.seeks++;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "Seek %+d s: byte %" PRId64 " to %" PRId64 " (%" PRIu32
+           " B/s)", seconds, pos, found ? chunk_pos + (int64_t)off : chunk_pos,
+           rate);
+  return ESP_OK;
+}
+
+/* ---------- state ---------- */
+
+bool local_media_available(void) {
+  return atomic_load(&scanned) && local_media_folder_count() > 0;
+}
+
+bool local_media_is_active(void) { return atomic_load(&active); }
+
+int local_media_folder_count(void) {
+  if (lib_lock == NULL) {
+    return 0;
+  }
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  int count = folder_count;
+  xSemaphoreGive(lib_lock);
+  return count;
+}
+
+bool local_media_folder_name(int index, char *buf, size_t len) {
+  if (lib_lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  bool ok = index >= 0 && index < folder_count;
+  if (ok) {
+    media_display_name(folders[index].path, buf, len);
+  }
+  xSemaphoreGive(lib_lock);
+  return ok;
+}
+
+bool local_media_track_name(int index, char *buf, size_t len) {
+  if (lib_lock == NULL) {
+    return false;
+  }
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  const char *path = tracks_folder >= 0 && tracks_folder == cur_folder
+                         ? media_track_path(&tracks, index)
+                         : NULL;
+  if (path) {
+    media_display_name(path, buf, len);
+  }
+  xSemaphoreGive(lib_lock);
+  return path != NULL;
+}
+
+int local_media_copy_tracks(int folder, media_tracks_t *list) {
+  memset(list, 0, sizeof(*list));
+  if (lib_lock == NULL) {
+    return -1;
+  }
+  xSemaphoreTake(lib_lock, portMAX_DELAY);
+  if (folder < 0 || folder >= folder_count) {
+    xSemaphoreGive(lib_lock);
+    return -1;
+  }
+  int count;
+  if (folder != tracks_folder) {
+    count = media_tracks_load(&folders[folder], list);
+  } else {
+    count = tracks.count;
+    list->offsets = malloc(MAX(count, 1) * sizeof(uint32_t));
+    list->names = malloc(MAX(tracks.names_len, 1));
+    if (list->offsets && list->names) {
+      memcpy(list->offsets, tracks.offsets, count * sizeof(uint32_t));
+      memcpy(list->names, tracks.names, tracks.names_len);
+      list->count = count;
+      list->names_len = list->names_cap = tracks.names_len;
+    } else {
+      media_tracks_free(list);
+      count = -1;
+    }
+  }
+  xSemaphoreGive(lib_lock);
+  return count;
+}
+
+void local_media_get_stats(local_media_stats_t *out) {
+  if (lib_lock) {
+    xSemaphoreTake(lib_lock, portMAX_DELAY);
+  }
+  int folder = cur_folder;
+  int track = cur_track;
+  int count = folder >= 0 && tracks_folder == folder ? tracks.count : 0;
+  int folders_found = folder_count;
+  if (lib_lock) {
+    xSemaphoreGive(lib_lock);
+  }
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  uint64_t us = read_us;
+  portEXIT_CRITICAL(&stats_lock);
+  out->mounted = sd_card_is_mounted();
+  out->scanned = atomic_load(&scanned);
+  out->active = atomic_load(&active);
+  out->paused = atomic_load(&paused);
+  out->folders = folders_found;
+  out->folder = out->active ? folder : -1;
+  out->track = track;
+  out->tracks = count;
+  out->read_kbps = us ? out->bytes_read * 8000 / us : 0;
+}
+
+esp_err_t local_media_init(void) {
+  lib_lock = xSemaphoreCreateMutex();
+  scan_lock = xSemaphoreCreateMutex();
+  file_lock = xSemaphoreCreateMutex();
+  ra_lock = xSemaphoreCreateMutex();
+  data_sem = xSemaphoreCreateBinary();
+  folders = lm_alloc(MEDIA_MAX_FOLDERS * sizeof(media_folder_t));
+  scan_buf = lm_alloc(MEDIA_MAX_FOLDERS * sizeof(media_folder_t));
+  if (lib_lock == NULL || scan_lock == NULL || file_lock == NULL ||
+      ra_lock == NULL || data_sem == NULL || folders == NULL ||
+      scan_buf == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate local playback");
+    lib_lock = NULL; // everything stays off
+    return ESP_ERR_NO_MEM;
+  }
+  stats.memory = 2 * MEDIA_MAX_FOLDERS * sizeof(media_folder_t);
+  stats.fill_min = LOCAL_MEDIA_RING_SIZE;
+  if (xTaskCreate(read_ahead_task, "local_read_ahead", LM_READ_AHEAD_STACK,
+                  NULL, LM_READ_AHEAD_PRIORITY, &read_ahead_handle) !=
+          pdPASS ||
+      xTaskCreate(scan_task, "local_scan", LM_SCAN_STACK, NULL,
+                  LM_SCAN_PRIORITY, NULL) != pdPASS) {
+    lib_lock = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
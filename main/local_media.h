@@ -0,0 +1,172 @@
+#ifndef LOCAL_MEDIA_H
+#define LOCAL_MEDIA_H
+
+#include "audio_element.h"
+#include "esp_err.h"
+#include "media_library.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Local playback: audio files on the SD card and SPIFFS
+ *
+ * Without a network, or when asked to, the radio plays the files on its
+ * storage (media_library.h) folder by folder, playlist by playlist. The
+ * decoder reads the file through a callback in place of the HTTP reader, as
+ * a multi-room follower reads the leader's stream; the rest of the pipeline
+ * is the one stations use.
+ *
+ * A read-ahead task keeps up to LOCAL_MEDIA_RING_SIZE of the file in PSRAM
+ * ahead of the decoder. It reads the card in large chunks into internal RAM
+ * (the SD host can't DMA into PSRAM, and would fall back to one sector per
+ * command) and only once the ring has drained to half, so the card is read
+ * in bursts and a slow access (FAT lookups, the card's own housekeeping) is
+ * covered by seconds of audio, even for FLAC.
+ *
+ * Pausing stops feeding the decoder. Seeking jumps by an estimated number
+ * of bytes: the stream's byte rate from the FLAC STREAMINFO where there is
+ * one, as measured while playing otherwise. Reading resumes at the next
+ * frame (stream_head.h), so the decoder sees no more than a gap.
+ *
+ * Entered on request (input bus, web API), and by itself when Wi-Fi doesn't
+ * connect at boot or the stream watchdog gives up, if there is anything to
+ * play. Tuning a station leaves it.
+ */
+
+// create_audio_pipeline source: the prefix, then the file's path
+#define LOCAL_MEDIA_URI_PREFIX "file://"
+// PSRAM read ahead of the decoder: 30 s at 128 kb/s, 5 s of CD FLAC
+#define LOCAL_MEDIA_RING_SIZE (512 * 1024)
+// Step of the skip gestures
+#define LOCAL_MEDIA_SKIP_S 10
+
+/**
+ * @brief Local playback figures, counters since boot.
+ */
+typedef struct {
+  bool mounted;  // SD card
+  bool scanned;  // folders found, at least once
+  bool active;   // playing files instead of stations
+  bool paused;
+  uint16_t folders;
+  int16_t folder; // being played, -1 if none
+  int16_t track;
+  uint16_t tracks; // in the folder being played
+  uint32_t memory; // bytes allocated
+  uint32_t scan_ms;       // last scan of the storage
+  uint32_t start_ms;      // last track: request to first data decoded
+  uint32_t start_max_ms;
+  uint32_t seek_ms;       // last seek: request to first data decoded
+  uint32_t seek_max_ms;
+  uint32_t seeks;
+  uint32_t read_kbps;     // sustained, from the card while reading
+  uint32_t read_stall_max_ms; // longest single read
+  uint32_t starved;       // times the decoder found the ring empty
+  uint32_t fill_min;      // least read ahead while playing, bytes
+  uint64_t bytes_read;    // from storage
+} local_media_stats_t;
+
+/**
+ * @brief Mounts the SD card and scans the storage for folders in the
+ * background. Call before the first pipeline is created.
+ */
+esp_err_t local_media_init(void);
+
+/**
+ * @brief Whether there are files to play.
+ */
+bool local_media_available(void);
+
+/**
+ * @brief Whether files are being played instead of stations.
+ */
+bool local_media_is_active(void);
+
+/**
+ * @brief Whether uri starts with LOCAL_MEDIA_URI_PREFIX.
+ */
+bool local_media_is_source_uri(const char *uri);
+
+/**
+ * @brief Decoder read callback for a file. Opens the file of uri (read
+ * ahead starts at once); call when creating the pipeline with a file URI.
+ * local_media_source_close() is called once the pipeline is deinitialized.
+ */
+esp_err_t local_media_source_prepare(const char *uri);
+int local_media_source_read(audio_element_handle_t el, char *buf, int len,
+                            TickType_t wait, void *ctx);
+void local_media_source_close(void);
+
+/**
+ * @brief Whether the decoder has been given the whole file: a pipeline
+ * that finishes now has played the track to its end.
+ */
+bool local_media_source_done(void);
+
+/**
+ * @brief Scans the storage again and plays where local playback was left,
+ * or the first folder.
+ * @return ESP_ERR_NOT_FOUND if there are no files, ESP_ERR_INVALID_STATE on
+ * a multi-room follower.
+ */
+esp_err_t local_media_enter(void);
+
+/**
+ * @brief Forgets that files are being played; the caller tunes a station.
+ */
+void local_media_leave(void);
+
+/**
+ * @brief Plays a track of a folder (indices as listed), entering local
+ * playback if needed.
+ */
+esp_err_t local_media_play(int folder, int track);
+
+/**
+ * @brief Moves by delta tracks in the folder, wrapping around.
+ */
+esp_err_t local_media_step(int delta);
+
+/**
+ * @brief Pauses (1) or resumes (0), or toggles (-1).
+ */
+esp_err_t local_media_pause(int state);
+
+/**
+ * @brief Moves playback by seconds (negative: back), within the track.
+ */
+esp_err_t local_media_seek(int seconds);
+
+/**
+ * @brief Number of folders, and their names as shown.
+ */
+int local_media_folder_count(void);
+bool local_media_folder_name(int index, char *buf, size_t len);
+
+/**
+ * @brief Name of a track of the folder being played.
+ */
+bool local_media_track_name(int index, char *buf, size_t len);
+
+/**
+ * @brief Copies the track list of a folder, to be gone through without
+ * holding up playback. Free it with media_tracks_free().
+ * @return the number of tracks, or -1 if the folder can't be read.
+ */
+int local_media_copy_tracks(int folder, media_tracks_t *list);
+
+/**
+ * @brief Copies the local playback figures.
+ */
+void local_media_get_stats(local_media_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOCAL_MEDIA_H
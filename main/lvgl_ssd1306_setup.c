@@ -9,10 +9,16 @@
 #include "lvgl.h"
 #include <sys/lock.h>
 #include <sys/param.h>
-#include <unistd.h>
 
+#include "app_config.h"
 #include "esp_lcd_panel_vendor.h"
+#include "freertos/semphr.h"
+#include "lvgl_ssd1306_setup.h"
 #include "screens.h"
+#include "ssd1306_frame.h"
+#include "ui_state.h"
+#include <stdatomic.h>
+#include <string.h>
 
 static lv_display_t *g_display = NULL;
 
@@ -35,27 +41,78 @@ static const char *TAG = "init_lvgl_ssd1306";
 #define LCD_CMD_BITS 8
 #define LCD_PARAM_BITS 8
 
-#define LVGL_TICK_PERIOD_MS 5
 #define LVGL_TASK_STACK_SIZE (8 * 1024)
 #define LVGL_TASK_PRIORITY 2
 #define LVGL_PALETTE_SIZE 8
-#define LVGL_TASK_MAX_DELAY_MS 100
 #define LVGL_TASK_MIN_DELAY_MS 1000 / CONFIG_FREERTOS_HZ
 
-// To use LV_COLOR_FORMAT_I1, we need an extra buffer to hold the converted data
-static uint8_t oled_buffer[LCD_H_RES * LCD_V_RES / 8];
+// SSD1306 contrast control
+#define SSD1306_CMD_SET_CONTRAST 0x81
+#define SSD1306_CONTRAST_NORMAL 0x7F
+#define SSD1306_CONTRAST_DIM 0x01
+
+_Static_assert(LCD_H_RES == SSD1306_FRAME_WIDTH &&
+                   LCD_V_RES == SSD1306_FRAME_HEIGHT,
+               "ssd1306_frame.h has the panel's geometry");
+// Upper bound on waiting for the SPI driver to release a frame buffer
+#define FLUSH_BUFFER_WAIT_MS 100
+// Redraw after a failed transfer this much later
+#define FLUSH_RETRY_MS 100
+
+// To use LV_COLOR_FORMAT_I1, we need extra buffers to hold the converted data
+// in the SSD1306 page layout. Two frames alternate so that LVGL can render the
+// next frame while the previous one is still being sent by SPI DMA. The frame
+// that was sent last is also the reference for the dirty page comparison.
+static uint8_t oled_frames[2][SSD1306_FRAME_BYTES];
+static int oled_front = 0;          // index of the frame last sent to the panel
+static bool oled_force_full = true; // panel RAM content unknown (boot/wakeup)
+static bool oled_redraw;            // a transfer failed; render the screen again
+// Color transfers queued per frame buffer, compared against completed
+// transfers (the SPI driver completes them in order).
+static uint32_t oled_frame_seq[2];
+static uint32_t oled_trans_queued;
+static volatile uint32_t oled_trans_done;
+static SemaphoreHandle_t oled_trans_sem;
+static lvgl_ssd1306_flush_stats_t flush_stats;
+
+typedef enum {
+  PANEL_POWER_ON,
+  PANEL_POWER_DIMMED,
+  PANEL_POWER_BLANKED,
+} panel_power_t;
+
+static esp_lcd_panel_io_handle_t panel_io = NULL;
+static TaskHandle_t lvgl_task_handle = NULL;
+static lv_timer_t *refr_timer = NULL;
+static panel_power_t panel_power = PANEL_POWER_ON;
+// Set from the encoder, dispatcher and web server tasks, read by the LVGL
+// task; a plain 64-bit store takes two on this core and could be read torn
+static _Atomic int64_t last_activity_us = 0;
 // LVGL library is not thread-safe, this example will call LVGL APIs from
 // different tasks, so use a mutex to protect it
 static _lock_t lvgl_api_lock;
 
 // extern void radio_home_screen_create(lv_disp_t* disp);
 
-static bool notify_lvgl_flush_ready(esp_lcd_panel_io_handle_t io_panel,
+static bool notify_color_trans_done(esp_lcd_panel_io_handle_t io_panel,
                                     esp_lcd_panel_io_event_data_t *edata,
                                     void *user_ctx) {
-  lv_display_t *disp = (lv_display_t *)user_ctx;
-  lv_display_flush_ready(disp);
-  return false;
+  BaseType_t high_task_wakeup = pdFALSE;
+  oled_trans_done++;
+  xSemaphoreGiveFromISR(oled_trans_sem, &high_task_wakeup);
+  return high_task_wakeup == pdTRUE;
+}
+
+// Waits until no queued SPI transfer still reads from the given frame buffer.
+static void wait_frame_released(int frame) {
+  while ((int32_t)(oled_trans_done - oled_frame_seq[frame]) < 0) {
+    if (xSemaphoreTake(oled_trans_sem, pdMS_TO_TICKS(FLUSH_BUFFER_WAIT_MS)) !=
+        pdTRUE) {
+      ESP_LOGW(TAG, "Timed out waiting for display transfer");
+      oled_trans_done = oled_frame_seq[frame];
+      oled_force_full = true;
+    }
+  }
 }
 
 static void lvgl_flush_cb(lv_display_t *disp, const lv_area_t *area,
@@ -68,40 +125,136 @@ static void lvgl_flush_cb(lv_display_t *disp, const lv_area_t *area,
   // https://docs.lvgl.io/9.2/porting/display.html#monochrome-displays
   px_map += LVGL_PALETTE_SIZE;
 
-  uint16_t hor_res = lv_display_get_physical_horizontal_resolution(disp);
-  int x1 = area->x1;
-  int x2 = area->x2;
-  int y1 = area->y1;
-  int y2 = area->y2;
-
-  for (int y = y1; y <= y2; y++) {
-    for (int x = x1; x <= x2; x++) {
-      /* The order of bits is MSB first
-                  MSB           LSB
-         bits      7 6 5 4 3 2 1 0
-         pixels    0 1 2 3 4 5 6 7
-                  Left         Right
-      */
-      bool chroma_color =
-          (px_map[(hor_res >> 3) * y + (x >> 3)] & 1 << (7 - x % 8));
-
-      /* Write to the buffer as required for the display.
-       * It writes only 1-bit for monochrome displays mapped vertically.*/
-      uint8_t *buf = oled_buffer + hor_res * (y >> 3) + (x);
-      if (chroma_color) {
-        (*buf) &= ~(1 << (y % 8));
-      } else {
-        (*buf) |= (1 << (y % 8));
-      }
+  // The display uses LV_DISPLAY_RENDER_MODE_FULL, so px_map always holds the
+  // whole frame and 'area' is the full screen.
+  (void)area;
+  int back = oled_front ^ 1;
+  wait_frame_released(back);
+
+  uint8_t *frame = oled_frames[back];
+  ssd1306_frame_convert(px_map, frame);
+
+  // LVGL's draw buffer has been consumed; let it render the next frame while
+  // the dirty pages go out over SPI.
+  lv_display_flush_ready(disp);
+  flush_stats.flushes++;
+
+  // Send runs of consecutive changed pages, one transfer per run
+  ssd1306_run_t runs[SSD1306_FRAME_PAGES];
+  int run_count = ssd1306_frame_dirty_runs(
+      frame, oled_force_full ? NULL : oled_frames[oled_front], runs);
+  bool queued = false;
+  bool failed = false;
+  for (int i = 0; i < run_count; i++) {
+    int first = runs[i].first;
+    int end = runs[i].end;
+    oled_trans_queued++;
+    esp_err_t err = esp_lcd_panel_draw_bitmap(
+        panel_handle, 0, first * 8, LCD_H_RES, end * 8,
+        frame + SSD1306_PAGE_BYTES * first);
+    if (err != ESP_OK) {
+      // No completion will be reported for this transfer
+      oled_trans_queued--;
+      ESP_LOGW(TAG, "Display transfer failed (%s)", esp_err_to_name(err));
+      failed = true;
+      continue;
     }
+    flush_stats.pages_sent += end - first;
+    flush_stats.spi_bytes += SSD1306_PAGE_BYTES * (end - first);
+    queued = true;
   }
-  // pass the draw buffer to the driver
-  esp_lcd_panel_draw_bitmap(panel_handle, x1, y1, x2 + 1, y2 + 1, oled_buffer);
+  // Pages that didn't go out would match the next frame and never be resent,
+  // so the panel's content is unknown until a whole frame gets through
+  oled_force_full = failed;
+  oled_redraw = failed;
+
+  if (queued) {
+    oled_frame_seq[back] = oled_trans_queued;
+    oled_front = back;
+  }
+}
+
+void lvgl_ssd1306_get_flush_stats(lvgl_ssd1306_flush_stats_t *stats) {
+  *stats = flush_stats;
+}
+
+static uint32_t lvgl_tick_get(void) {
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void wake_lvgl_task(void) {
+  if (lvgl_task_handle) {
+    xTaskNotifyGive(lvgl_task_handle);
+  }
+}
+
+// The refresh timer only runs while something is invalidated. A still screen
+// (including finished animations) leaves no LVGL timer armed, so the task
+// sleeps until the UI state changes or a power deadline is reached.
+static void display_event_cb(lv_event_t *e) {
+  switch (lv_event_get_code(e)) {
+  case LV_EVENT_INVALIDATE_AREA:
+    lv_timer_resume(refr_timer);
+    break;
+  case LV_EVENT_REFR_READY:
+    lv_timer_pause(refr_timer);
+    break;
+  default:
+    break;
+  }
+}
+
+static void set_contrast(uint8_t contrast) {
+  esp_lcd_panel_io_tx_param(panel_io, SSD1306_CMD_SET_CONTRAST, &contrast, 1);
 }
 
-static void increase_lvgl_tick(void *arg) {
-  /* Tell LVGL how many milliseconds has elapsed */
-  lv_tick_inc(LVGL_TICK_PERIOD_MS);
+// Applies the dim/blank state for the current idle time. Returns the time of
+// the next transition, or -1 if none is pending. Called with the LVGL lock
+// held.
+static int64_t update_panel_power(int64_t now_us) {
+  esp_lcd_panel_handle_t panel_handle = lv_display_get_user_data(g_display);
+  int64_t idle_start = atomic_load(&last_activity_us);
+  int64_t dim_at = g_runtime_config.display_dim_delay_ms
+                       ? idle_start +
+                             (int64_t)g_runtime_config.display_dim_delay_ms * 1000
+                       : -1;
+  int64_t blank_at =
+      g_runtime_config.display_blank_delay_ms
+          ? idle_start + (int64_t)g_runtime_config.display_blank_delay_ms * 1000
+          : -1;
+
+  panel_power_t target = PANEL_POWER_ON;
+  if (blank_at >= 0 && now_us >= blank_at) {
+    target = PANEL_POWER_BLANKED;
+  } else if (dim_at >= 0 && now_us >= dim_at) {
+    target = PANEL_POWER_DIMMED;
+  }
+
+  if (target != panel_power) {
+    ESP_LOGI(TAG, "Display %s",
+             target == PANEL_POWER_ON
+                 ? "on"
+                 : (target == PANEL_POWER_DIMMED ? "dimmed" : "blanked"));
+    if (target == PANEL_POWER_BLANKED) {
+      esp_lcd_panel_disp_on_off(panel_handle, false);
+    } else {
+      set_contrast(target == PANEL_POWER_DIMMED ? SSD1306_CONTRAST_DIM
+                                                : SSD1306_CONTRAST_NORMAL);
+      if (panel_power == PANEL_POWER_BLANKED) {
+        esp_lcd_panel_disp_on_off(panel_handle, true);
+      }
+    }
+    panel_power = target;
+  }
+
+  if (target == PANEL_POWER_ON && dim_at >= 0 &&
+      (blank_at < 0 || dim_at < blank_at)) {
+    return dim_at;
+  }
+  if (target != PANEL_POWER_BLANKED && blank_at >= 0) {
+    return blank_at;
+  }
+  return -1;
 }
 
 static void lvgl_port_task(void *arg) {
@@ -109,14 +262,45 @@ static void lvgl_port_task(void *arg) {
   uint32_t time_till_next_ms = 0;
   while (1) {
     _lock_acquire(&lvgl_api_lock);
+    if (oled_redraw) {
+      oled_redraw = false;
+      lv_obj_invalidate(lv_screen_active());
+    }
     process_ui_updates();
+    int64_t power_deadline = update_panel_power(esp_timer_get_time());
     time_till_next_ms = lv_timer_handler();
+    bool redraw = oled_redraw;
     _lock_release(&lvgl_api_lock);
-    // in case of triggering a task watch dog time out
-    time_till_next_ms = MAX(time_till_next_ms, LVGL_TASK_MIN_DELAY_MS);
-    // in case of lvgl display not ready yet
-    time_till_next_ms = MIN(time_till_next_ms, LVGL_TASK_MAX_DELAY_MS);
-    usleep(1000 * time_till_next_ms);
+    flush_stats.task_wakeups++;
+
+    TickType_t wait = portMAX_DELAY;
+    if (time_till_next_ms != LV_NO_TIMER_READY) {
+      // in case of triggering a task watch dog time out
+      time_till_next_ms = MAX(time_till_next_ms, LVGL_TASK_MIN_DELAY_MS);
+      wait = pdMS_TO_TICKS(time_till_next_ms);
+    }
+    if (power_deadline >= 0) {
+      int64_t power_ms = (power_deadline - esp_timer_get_time()) / 1000 + 1;
+      TickType_t power_wait =
+          pdMS_TO_TICKS(MAX(power_ms, LVGL_TASK_MIN_DELAY_MS));
+      wait = MIN(wait, power_wait);
+    }
+    if (redraw) {
+      wait = MIN(wait, pdMS_TO_TICKS(FLUSH_RETRY_MS));
+    }
+    // Woken early by UI state changes and user activity
+    ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+
+bool lvgl_ssd1306_is_panel_on(void) {
+  return panel_power != PANEL_POWER_BLANKED;
+}
+
+void lvgl_ssd1306_notify_activity(void) {
+  atomic_store(&last_activity_us, esp_timer_get_time());
+  if (panel_power != PANEL_POWER_ON) {
+    wake_lvgl_task();
   }
 }
 
@@ -128,10 +312,13 @@ lv_display_t *lvgl_ssd1306_setup(void) {
       .miso_io_num = -1,
       .quadwp_io_num = -1,
       .quadhd_io_num = -1,
-      .max_transfer_sz = LCD_H_RES * LCD_V_RES / 8,
+      .max_transfer_sz = SSD1306_FRAME_BYTES,
   };
   ESP_ERROR_CHECK(spi_bus_initialize(LCD_HOST, &buscfg, SPI_DMA_CH_AUTO));
 
+  oled_trans_sem = xSemaphoreCreateBinary();
+  assert(oled_trans_sem);
+
   ESP_LOGI(TAG, "Install panel IO");
   esp_lcd_panel_io_handle_t io_handle = NULL;
   esp_lcd_panel_io_spi_config_t io_config = {
@@ -142,8 +329,8 @@ lv_display_t *lvgl_ssd1306_setup(void) {
       .lcd_param_bits = LCD_PARAM_BITS,
       .spi_mode = 0,
       .trans_queue_depth = 10,
-      .on_color_trans_done = notify_lvgl_flush_ready,
-      .user_ctx = NULL, // Will be set later
+      .on_color_trans_done = notify_color_trans_done,
+      .user_ctx = NULL,
       .flags =
           {
               .dc_low_on_param = 1,
@@ -152,6 +339,7 @@ lv_display_t *lvgl_ssd1306_setup(void) {
   // Attach the LCD to the SPI bus
   ESP_ERROR_CHECK(esp_lcd_new_panel_io_spi((esp_lcd_spi_bus_handle_t)LCD_HOST,
                                            &io_config, &io_handle));
+  panel_io = io_handle;
 
   ESP_LOGI(TAG, "Install SSD1306 panel driver");
   esp_lcd_panel_handle_t panel_handle = NULL;
@@ -183,7 +371,6 @@ lv_display_t *lvgl_ssd1306_setup(void) {
   lv_display_t *display = lv_display_create(LCD_H_RES, LCD_V_RES);
   // associate the i2c panel handle to the display
   lv_display_set_user_data(display, panel_handle);
-  io_config.user_ctx = display; // Set user context for the callback
   // create draw buffer
   void *buf = NULL;
   ESP_LOGI(TAG, "Allocate separate LVGL draw buffers");
@@ -203,27 +390,30 @@ lv_display_t *lvgl_ssd1306_setup(void) {
   // display
   lv_display_set_flush_cb(display, lvgl_flush_cb);
 
-  ESP_LOGI(
-      TAG,
-      "Register io panel event callback for LVGL flush ready notification");
+  ESP_LOGI(TAG, "Register io panel event callback for transfer completion");
   const esp_lcd_panel_io_callbacks_t cbs = {
-      .on_color_trans_done = notify_lvgl_flush_ready,
+      .on_color_trans_done = notify_color_trans_done,
   };
   /* Register done callback */
-  esp_lcd_panel_io_register_event_callbacks(io_handle, &cbs, display);
+  esp_lcd_panel_io_register_event_callbacks(io_handle, &cbs, NULL);
 
-  ESP_LOGI(TAG, "Use esp_timer as LVGL tick timer");
-  const esp_timer_create_args_t lvgl_tick_timer_args = {
-      .callback = &increase_lvgl_tick, .name = "lvgl_tick"};
-  esp_timer_handle_t lvgl_tick_timer = NULL;
-  ESP_ERROR_CHECK(esp_timer_create(&lvgl_tick_timer_args, &lvgl_tick_timer));
-  ESP_ERROR_CHECK(
-      esp_timer_start_periodic(lvgl_tick_timer, LVGL_TICK_PERIOD_MS * 1000));
+  // Refresh on demand instead of every LV_DEF_REFR_PERIOD
+  refr_timer = lv_display_get_refr_timer(display);
+  lv_display_add_event_cb(display, display_event_cb, LV_EVENT_INVALIDATE_AREA,
+                          NULL);
+  lv_display_add_event_cb(display, display_event_cb, LV_EVENT_REFR_READY,
+                          NULL);
+
+  // LVGL reads the time when it needs it instead of a periodic tick interrupt
+  lv_tick_set_cb(lvgl_tick_get);
+
+  g_display = display;
+  atomic_store(&last_activity_us, esp_timer_get_time());
 
   ESP_LOGI(TAG, "Create LVGL task");
   xTaskCreate(lvgl_port_task, "LVGL", LVGL_TASK_STACK_SIZE, NULL,
-              LVGL_TASK_PRIORITY, NULL);
-  g_display = display;
+              LVGL_TASK_PRIORITY, &lvgl_task_handle);
+  ui_state_add_change_cb(wake_lvgl_task);
   return display;
 }
 
@@ -239,7 +429,13 @@ void lvgl_ssd1306_wakeup(void) {
     esp_lcd_panel_init(panel_handle);
     esp_lcd_panel_mirror(panel_handle, 1, 1);
     esp_lcd_panel_disp_on_off(panel_handle, true);
+    // The panel RAM was lost; resend every page on the next refresh
+    oled_force_full = true;
+    lv_obj_invalidate(lv_screen_active());
+    panel_power = PANEL_POWER_ON;
+    atomic_store(&last_activity_us, esp_timer_get_time());
     _lock_release(&lvgl_api_lock);
+    wake_lvgl_task();
   }
 }
 
@@ -2,6 +2,8 @@
 #define LVGL_SSD1306_SETUP_H
 
 #include "lvgl.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +25,32 @@ void lvgl_ssd1306_wakeup(void);
  */
 void lvgl_ssd1306_sleep(void);
 
+/**
+ * @brief Reports user activity. Restores a dimmed or blanked panel and
+ * restarts the inactivity timeouts.
+ */
+void lvgl_ssd1306_notify_activity(void);
+
+/**
+ * @brief Returns false while the panel is blanked for inactivity.
+ */
+bool lvgl_ssd1306_is_panel_on(void);
+
+/**
+ * @brief Cumulative display flush counters.
+ */
+typedef struct {
+  uint32_t flushes;    // frames rendered by LVGL
+  uint32_t pages_sent; // 128 byte SSD1306 pages sent over SPI
+  uint32_t spi_bytes;  // pixel data bytes sent over SPI (wraps)
+  uint32_t task_wakeups; // LVGL task loop iterations
+} lvgl_ssd1306_flush_stats_t;
+
+/**
+ * @brief Returns a snapshot of the display flush counters.
+ */
+void lvgl_ssd1306_get_flush_stats(lvgl_ssd1306_flush_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
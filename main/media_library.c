@@ -0,0 +1,377 @@
+#include "media_library.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+// Track list growth; the paths of a typical album fit the first
+#define NAMES_MIN_CAP 4096
+
+typedef int (*track_cb_t)(void *ctx, const char *path);
+
+static const char *extension(const char *path) {
+  const char *dot = strrchr(path, '.');
+  const char *slash = strrchr(path, '/');
+  return dot && (slash == NULL || dot > slash) ? dot + 1 : "";
+}
+
+media_format_t media_format_from_path(const char *path) {
+  const char *ext = extension(path);
+  if (strcasecmp(ext, "mp3") == 0) {
+    return MEDIA_FORMAT_MP3;
+  } else if (strcasecmp(ext, "aac") == 0) {
+    return MEDIA_FORMAT_AAC;
+  } else if (strcasecmp(ext, "ogg") == 0 || strcasecmp(ext, "oga") == 0) {
+    return MEDIA_FORMAT_OGG;
+  } else if (strcasecmp(ext, "flac") == 0) {
+    return MEDIA_FORMAT_FLAC;
+  } else if (strcasecmp(ext, "opus") == 0) {
+    return MEDIA_FORMAT_OPUS;
+  }
+  return MEDIA_FORMAT_NONE;
+}
+
+static bool is_playlist(const char *path) {
+  const char *ext = extension(path);
+  return strcasecmp(ext, "m3u") == 0 || strcasecmp(ext, "m3u8") == 0;
+}
+
+static bool skip_entry(const char *name) {
+  return name[0] == '.' || strcasecmp(name, "System Volume Information") == 0;
+}
+
+/* d_type where the filesystem fills it in, stat() otherwise */
+static bool entry_is_dir(const char *path, const struct dirent *entry) {
+#ifdef DT_DIR
+  if (entry->d_type == DT_DIR) {
+    return true;
+  }
+  if (entry->d_type != DT_UNKNOWN) {
+    return false;
+  }
+#endif
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Case-insensitive, with runs of digits compared by value, so "2 Song"
+ * comes before "10 Song" */
+static int natural_cmp(const char *a, const char *b) {
+  while (*a && *b) {
+    if (isdigit((unsigned char)*a) && isdigit((unsigned char)*b)) {
+      while (*a == '0') {
+        a++;
+      }
+      while (*b == '0') {
+        b++;
+      }
+      size_t na = 0, nb = 0;
+      while (isdigit((unsigned char)a[na])) {
+        na++;
+      }
+      while (isdigit((unsigned char)b[nb])) {
+        nb++;
+      }
+      if (na != nb) {
+        return na < nb ? -1 : 1;
+      }
+      int c = strncmp(a, b, na);
+      if (c != 0) {
+        return c;
+      }
+      a += na;
+      b += nb;
+      continue;
+    }
+    int ca = tolower((unsigned char)*a);
+    int cb = tolower((unsigned char)*b);
+    if (ca != cb) {
+      return ca - cb;
+    }
+    a++;
+    b++;
+  }
+  return (unsigned char)*a - (unsigned char)*b;
+}
+
+/* Collapses "." and ".." components in an absolute path; FAT takes
+ * neither */
+static void normalize_path(char *path) {
+  char *out = path;
+  const char *in = path;
+  while (*in) {
+    if (*in == '/') {
+      in++;
+      continue;
+    }
+    const char *end = strchr(in, '/');
+    size_t n = end ? (size_t)(end - in) : strlen(in);
+    if (n == 1 && in[0] == '.') {
+      // dropped
+    } else if (n == 2 && in[0] == '.' && in[1] == '.') {
+      while (out > path && *--out != '/') {
+      }
+    } else {
+      *out++ = '/';
+      memmove(out, in, n);
+      out += n;
+    }
+    in += n;
+  }
+  if (out == path) {
+    *out++ = '/';
+  }
+  *out = '\0';
+}
+
+/* Calls cb with the path of each playable entry of an M3U playlist, until
+ * it returns nonzero. Returns -1 if the playlist can't be opened, otherwise
+ * what cb last returned. */
+static int read_playlist(const char *playlist, track_cb_t cb, void *ctx) {
+  FILE *f = fopen(playlist, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  char dir[MEDIA_PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", playlist);
+  char *slash = strrchr(dir, '/');
+  if (slash) {
+    *slash = '\0';
+  }
+
+  char line[MEDIA_PATH_MAX];
+  char path[MEDIA_PATH_MAX];
+  bool first = true;
+  int ret = 0;
+  while (ret == 0 && fgets(line, sizeof(line), f)) {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n') {
+      // Too long for a path we could open: skip the rest of the line
+      int c;
+      while ((c = fgetc(f)) != EOF && c != '\n') {
+      }
+      continue;
+    }
+    char *s = line;
+    if (first && memcmp(s, "\xEF\xBB\xBF", 3) == 0) {
+      s += 3; // UTF-8 byte order mark
+    }
+    first = false;
+    while (isspace((unsigned char)*s)) {
+      s++;
+    }
+    len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+      s[--len] = '\0';
+    }
+    if (*s == '\0' || *s == '#') {
+      continue;
+    }
+    if (strncmp(s, "file://", 7) == 0) {
+      s += 7;
+    } else if (strstr(s, "://") || (isalpha((unsigned char)s[0]) &&
+                                     s[1] == ':')) {
+      continue; // a stream, or a Windows drive
+    }
+    for (char *p = s; *p; p++) {
+      if (*p == '\\') {
+        *p = '/';
+      }
+    }
+    int n = s[0] == '/' ? snprintf(path, sizeof(path), "%s", s)
+                        : snprintf(path, sizeof(path), "%s/%s", dir, s);
+    if (n < 0 || (size_t)n >= sizeof(path)) {
+      continue;
+    }
+    normalize_path(path);
+    if (media_format_from_path(path) != MEDIA_FORMAT_NONE) {
+      ret = cb(ctx, path);
+    }
+  }
+  fclose(f);
+  return ret;
+}
+
+static int count_track(void *ctx, const char *path) {
+  (void)path;
+  int *count = ctx;
+  return ++*count >= MEDIA_MAX_TRACKS;
+}
+
+/* ---------- scan ---------- */
+
+typedef struct {
+  media_folder_t *folders;
+  int max;
+  int count;
+} scan_t;
+
+static void add_folder(scan_t *scan, const char *path, bool playlist,
+                       int tracks) {
+  if (scan->count < scan->max && tracks > 0) {
+    media_folder_t *folder = &scan->folders[scan->count++];
+    snprintf(folder->path, sizeof(folder->path), "%s", path);
+    folder->playlist = playlist;
+    folder->tracks = tracks < MEDIA_MAX_TRACKS ? tracks : MEDIA_MAX_TRACKS;
+  }
+}
+
+/* path has room for MEDIA_PATH_MAX; restored before returning */
+static void scan_dir(scan_t *scan, char *path, size_t path_len, int depth) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return;
+  }
+  int files = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL && scan->count < scan->max) {
+    size_t name_len = strlen(entry->d_name);
+    if (skip_entry(entry->d_name) ||
+        path_len + 1 + name_len >= MEDIA_PATH_MAX) {
+      continue;
+    }
+    path[path_len] = '/';
+    memcpy(path + path_len + 1, entry->d_name, name_len + 1);
+    if (entry_is_dir(path, entry)) {
+      if (depth + 1 < MEDIA_SCAN_DEPTH) {
+        scan_dir(scan, path, path_len + 1 + name_len, depth + 1);
+      }
+    } else if (media_format_from_path(entry->d_name) != MEDIA_FORMAT_NONE) {
+      files++;
+    } else if (is_playlist(entry->d_name)) {
+      int tracks = 0;
+      read_playlist(path, count_track, &tracks);
+      add_folder(scan, path, true, tracks);
+    }
+    path[path_len] = '\0';
+  }
+  closedir(dir);
+  add_folder(scan, path, false, files);
+}
+
+int media_library_scan(const char *const *roots, int root_count,
+                       media_folder_t *folders, int max) {
+  scan_t scan = {.folders = folders, .max = max, .count = 0};
+  char path[MEDIA_PATH_MAX];
+  for (int i = 0; i < root_count; i++) {
+    size_t len = strlen(roots[i]);
+    if (len < sizeof(path)) {
+      memcpy(path, roots[i], len + 1);
+      scan_dir(&scan, path, len, 0);
+    }
+  }
+  // Insertion sort: a few dozen folders, found mostly in order already
+  for (int i = 1; i < scan.count; i++) {
+    media_folder_t folder = folders[i];
+    int j = i;
+    for (; j > 0 && natural_cmp(folders[j - 1].path, folder.path) > 0; j--) {
+      folders[j] = folders[j - 1];
+    }
+    folders[j] = folder;
+  }
+  return scan.count;
+}
+
+/* ---------- track lists ---------- */
+
+/* 0 to go on, 1 once the list is full, -1 if out of memory */
+static int add_track(void *ctx, const char *path) {
+  media_tracks_t *tracks = ctx;
+  if (tracks->count >= MEDIA_MAX_TRACKS) {
+    return 1;
+  }
+  if (tracks->offsets == NULL) {
+    tracks->offsets = malloc(MEDIA_MAX_TRACKS * sizeof(uint32_t));
+    if (tracks->offsets == NULL) {
+      return -1;
+    }
+  }
+  size_t len = strlen(path) + 1;
+  if (tracks->names_len + len > tracks->names_cap) {
+    size_t cap = tracks->names_cap ? tracks->names_cap * 2 : NAMES_MIN_CAP;
+    while (cap < tracks->names_len + len) {
+      cap *= 2;
+    }
+    char *names = realloc(tracks->names, cap);
+    if (names == NULL) {
+      return -1;
+    }
+    tracks->names = names;
+    tracks->names_cap = cap;
+  }
+  memcpy(tracks->names + tracks->names_len, path, len);
+  tracks->offsets[tracks->count++] = tracks->names_len;
+  tracks->names_len += len;
+  return 0;
+}
+
+int media_tracks_load(const media_folder_t *folder, media_tracks_t *tracks) {
+  tracks->count = 0;
+  tracks->names_len = 0;
+  int ret = 0;
+  if (folder->playlist) {
+    ret = read_playlist(folder->path, add_track, tracks);
+    return ret < 0 ? -1 : tracks->count;
+  }
+
+  DIR *dir = opendir(folder->path);
+  if (dir == NULL) {
+    return -1;
+  }
+  char path[MEDIA_PATH_MAX];
+  struct dirent *entry;
+  while (ret == 0 && (entry = readdir(dir)) != NULL) {
+    if (skip_entry(entry->d_name) ||
+        media_format_from_path(entry->d_name) == MEDIA_FORMAT_NONE) {
+      continue;
+    }
+    int n = snprintf(path, sizeof(path), "%s/%s", folder->path,
+                     entry->d_name);
+    if (n > 0 && (size_t)n < sizeof(path) && !entry_is_dir(path, entry)) {
+      ret = add_track(tracks, path);
+    }
+  }
+  closedir(dir);
+  if (ret < 0) {
+    return -1;
+  }
+  // Insertion sort of the offsets; directories list in creation order
+  for (int i = 1; i < tracks->count; i++) {
+    uint32_t offset = tracks->offsets[i];
+    int j = i;
+    for (; j > 0 && natural_cmp(tracks->names + tracks->offsets[j - 1],
+                                tracks->names + offset) > 0;
+         j--) {
+      tracks->offsets[j] = tracks->offsets[j - 1];
+    }
+    tracks->offsets[j] = offset;
+  }
+  return tracks->count;
+}
+
+const char *media_track_path(const media_tracks_t *tracks, int index) {
+  if (index < 0 || index >= tracks->count) {
+    return NULL;
+  }
+  return tracks->names + tracks->offsets[index];
+}
+
+void media_tracks_free(media_tracks_t *tracks) {
+  free(tracks->offsets);
+  free(tracks->names);
+  memset(tracks, 0, sizeof(*tracks));
+}
+
+void media_display_name(const char *path, char *buf, size_t len) {
+  const char *slash = strrchr(path, '/');
+  const char *name = slash ? slash + 1 : path;
+  size_t n = strlen(name);
+  if (media_format_from_path(name) != MEDIA_FORMAT_NONE ||
+      is_playlist(name)) {
+    n -= strlen(extension(name)) + 1;
+  }
+  snprintf(buf, len, "%.*s", (int)n, name);
+}
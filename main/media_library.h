@@ -0,0 +1,98 @@
+#ifndef MEDIA_LIBRARY_H
+#define MEDIA_LIBRARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audio files on the storage mounts, as folders and playlists
+ *
+ * A folder is a directory holding playable files (by extension: .mp3,
+ * .aac, .ogg/.oga, .opus, .flac) or an M3U playlist. Its tracks are the files in
+ * name order, or the playlist's entries in the playlist's order. Folders
+ * are found by walking the mounts MEDIA_SCAN_DEPTH levels deep and sorted
+ * by path; the track list is only loaded for the folder being played, so
+ * a card with thousands of files costs no more memory than its folders.
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+#define MEDIA_PATH_MAX 160
+#define MEDIA_MAX_FOLDERS 64
+#define MEDIA_MAX_TRACKS 512
+#define MEDIA_SCAN_DEPTH 4
+
+typedef enum {
+  MEDIA_FORMAT_NONE,
+  MEDIA_FORMAT_MP3,
+  MEDIA_FORMAT_AAC, // ADTS
+  MEDIA_FORMAT_OGG, // Vorbis
+  MEDIA_FORMAT_FLAC,
+  MEDIA_FORMAT_OPUS, // Ogg Opus
+} media_format_t;
+
+typedef struct {
+  char path[MEDIA_PATH_MAX]; // the directory, or the playlist file
+  bool playlist;
+  uint16_t tracks; // when scanned
+} media_folder_t;
+
+/**
+ * @brief A folder's tracks: full paths, in playing order.
+ */
+typedef struct {
+  int count;
+  uint32_t *offsets; // into names
+  char *names;       // NUL terminated paths
+  size_t names_len;
+  size_t names_cap;
+} media_tracks_t;
+
+/**
+ * @brief Format of a file, from its extension.
+ */
+media_format_t media_format_from_path(const char *path);
+
+/**
+ * @brief Finds the folders under the roots (directories such as "/sdcard").
+ * Hidden entries and "System Volume Information" are skipped.
+ * @return the number of folders written to folders, at most max.
+ */
+int media_library_scan(const char *const *roots, int root_count,
+                       media_folder_t *folders, int max);
+
+/**
+ * @brief Loads a folder's tracks, at most MEDIA_MAX_TRACKS. Playlist
+ * entries are taken relative to the playlist's directory; URLs and files
+ * that aren't playable are left out.
+ * @return the number of tracks, or -1 if the folder can't be read or
+ * memory runs out. tracks is emptied first either way.
+ */
+int media_tracks_load(const media_folder_t *folder, media_tracks_t *tracks);
+
+/**
+ * @brief Path of track index, or NULL if there is no such track.
+ */
+const char *media_track_path(const media_tracks_t *tracks, int index);
+
+/**
+ * @brief Frees a track list; it can be loaded again.
+ */
+void media_tracks_free(media_tracks_t *tracks);
+
+/**
+ * @brief Writes the last component of path, without the extension of a
+ * file, to buf: the name to show for a track or folder.
+ */
+void media_display_name(const char *path, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MEDIA_LIBRARY_H
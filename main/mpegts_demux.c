@@ -0,0 +1,276 @@
+#include "mpegts_demux.h"
+#include <string.h>
+
+#define TS_SYNC 0x47
+#define PAT_PID 0x0000
+#define ID3_HEADER_LEN 10
+
+enum {
+  ST_DETECT, // first bytes of the segment
+  ST_ID3,    // skipping a tag
+  ST_TS,
+  ST_PACKED,
+};
+
+void mpegts_demux_init(mpegts_demux_t *d, mpegts_out_t out, void *ctx) {
+  memset(d, 0, sizeof(*d));
+  d->out = out;
+  d->ctx = ctx;
+  d->pmt_pid = -1;
+  d->audio_pid = -1;
+  d->last_cc = -1;
+}
+
+void mpegts_demux_segment(mpegts_demux_t *d, bool discontinuity) {
+  d->state = ST_DETECT;
+  d->pkt_len = 0;
+  d->id3_len = 0;
+  d->pes_skip = 0;
+  d->last_cc = -1;
+  if (discontinuity) {
+    d->pmt_pid = -1;
+    d->audio_pid = -1;
+    d->audio = MPEGTS_AUDIO_NONE;
+  }
+}
+
+static int emit(mpegts_demux_t *d, const uint8_t *data, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+  d->bytes_out += len;
+  return d->out(d->ctx, data, len);
+}
+
+/* ---------- PSI ---------- */
+
+/* Start of the section in a packet's payload, and its length up to the
+ * CRC; NULL if it doesn't fit the packet */
+static const uint8_t *section(const uint8_t *p, size_t len, size_t *body) {
+  if (len < 1 || (size_t)p[0] + 1 + 8 > len) {
+    return NULL;
+  }
+  len -= p[0] + 1;
+  p += p[0] + 1; // pointer field
+  size_t section_len = ((p[1] & 0x0F) << 8) | p[2];
+  if (section_len < 9 || 3 + section_len > len) {
+    return NULL;
+  }
+  *body = 3 + section_len - 4;
+  return p;
+}
+
+static void parse_pat(mpegts_demux_t *d, const uint8_t *p, size_t len) {
+  size_t end;
+  const uint8_t *s = section(p, len, &end);
+  if (s == NULL || s[0] != 0x00) {
+    return;
+  }
+  for (size_t i = 8; i + 4 <= end; i += 4) {
+    int program = (s[i] << 8) | s[i + 1];
+    if (program != 0) { // 0 is the network PID
+      d->pmt_pid = ((s[i + 2] & 0x1F) << 8) | s[i + 3];
+      return;
+    }
+  }
+}
+
+static void parse_pmt(mpegts_demux_t *d, const uint8_t *p, size_t len) {
+  size_t end;
+  const uint8_t *s = section(p, len, &end);
+  if (s == NULL || s[0] != 0x02 || end < 12) {
+    return;
+  }
+  size_t i = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+  bool other = false;
+  for (; i + 5 <= end; i += 5 + (((s[i + 3] & 0x0F) << 8) | s[i + 4])) {
+    int type = s[i];
+    int pid = ((s[i + 1] & 0x1F) << 8) | s[i + 2];
+    mpegts_audio_t audio = type == 0x0F                 ? MPEGTS_AUDIO_ADTS
+                           : type == 0x03 || type == 0x04 ? MPEGTS_AUDIO_MPEG
+                                                          : MPEGTS_AUDIO_NONE;
+    if (audio != MPEGTS_AUDIO_NONE) {
+      if (pid != d->audio_pid) {
+        d->last_cc = -1;
+      }
+      d->audio_pid = pid;
+      d->audio = audio;
+      return;
+    }
+    // LATM, AC-3, E-AC-3
+    other |= type == 0x11 || type == 0x81 || type == 0x87;
+  }
+  if (other && d->audio == MPEGTS_AUDIO_NONE) {
+    d->audio = MPEGTS_AUDIO_OTHER;
+  }
+}
+
+/* ---------- packets ---------- */
+
+static int parse_packet(mpegts_demux_t *d, const uint8_t *pkt) {
+  d->packets++;
+  bool start = pkt[1] & 0x40;
+  int pid = ((pkt[1] & 0x1F) << 8) | pkt[2];
+  int afc = (pkt[3] >> 4) & 0x03;
+  int cc = pkt[3] & 0x0F;
+  if (!(afc & 0x01)) {
+    return 0; // adaptation field only
+  }
+  size_t off = 4;
+  if (afc & 0x02) {
+    off += 1 + pkt[4];
+  }
+  if (off >= MPEGTS_PACKET_SIZE) {
+    return 0;
+  }
+  const uint8_t *p = pkt + off;
+  size_t len = MPEGTS_PACKET_SIZE - off;
+
+  if (pid == PAT_PID) {
+    if (start) {
+      parse_pat(d, p, len);
+    }
+    return 0;
+  }
+  if (pid == d->pmt_pid) {
+    if (start) {
+      parse_pmt(d, p, len);
+    }
+    return 0;
+  }
+  if (pid != d->audio_pid) {
+    return 0;
+  }
+
+  if (d->last_cc >= 0) {
+    if (cc == d->last_cc) {
+      return 0; // sent twice
+    }
+    if (cc != ((d->last_cc + 1) & 0x0F)) {
+      d->cc_errors++;
+    }
+  }
+  d->last_cc = cc;
+
+  if (start) {
+    // PES header: start code, stream id, length, flags, header length
+    if (len < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1) {
+      d->pes_skip = 0;
+      return 0;
+    }
+    d->pes_skip = 9 + p[8];
+  }
+  if (d->pes_skip >= len) {
+    d->pes_skip -= len;
+    return 0;
+  }
+  p += d->pes_skip;
+  len -= d->pes_skip;
+  d->pes_skip = 0;
+  return emit(d, p, len);
+}
+
+static int feed_ts(mpegts_demux_t *d, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    if (d->pkt_len == 0 && data[0] != TS_SYNC) {
+      // Lost sync: on to the next sync byte
+      const uint8_t *next = memchr(data, TS_SYNC, len);
+      size_t skip = next ? (size_t)(next - data) : len;
+      d->resyncs++;
+      data += skip;
+      len -= skip;
+      continue;
+    }
+    size_t n = MPEGTS_PACKET_SIZE - d->pkt_len;
+    if (d->pkt_len == 0 && len >= MPEGTS_PACKET_SIZE) {
+      int ret = parse_packet(d, data); // whole packet in place
+      data += MPEGTS_PACKET_SIZE;
+      len -= MPEGTS_PACKET_SIZE;
+      if (ret != 0) {
+        return ret;
+      }
+      continue;
+    }
+    if (n > len) {
+      n = len;
+    }
+    memcpy(d->pkt + d->pkt_len, data, n);
+    d->pkt_len += n;
+    data += n;
+    len -= n;
+    if (d->pkt_len == MPEGTS_PACKET_SIZE) {
+      d->pkt_len = 0;
+      int ret = parse_packet(d, d->pkt);
+      if (ret != 0) {
+        return ret;
+      }
+    }
+  }
+  return 0;
+}
+
+/* ---------- segments ---------- */
+
+int mpegts_demux_feed(mpegts_demux_t *d, const uint8_t *data, size_t len) {
+  while (len > 0) {
+    switch (d->state) {
+    case ST_DETECT: {
+      if (data[0] == TS_SYNC && d->id3_len == 0) {
+        d->state = ST_TS;
+        d->packed = false;
+        break;
+      }
+      // "ID3" opens packed audio; anything else is taken as a bare stream
+      size_t n = ID3_HEADER_LEN - d->id3_len;
+      n = n < len ? n : len;
+      memcpy(d->id3 + d->id3_len, data, n);
+      d->id3_len += n;
+      data += n;
+      len -= n;
+      if (d->id3_len < 3 && memcmp(d->id3, "ID3", d->id3_len) == 0) {
+        break;
+      }
+      if (memcmp(d->id3, "ID3", 3) != 0) {
+        d->state = ST_PACKED;
+        d->packed = true;
+        size_t held = d->id3_len;
+        d->id3_len = 0;
+        int ret = emit(d, d->id3, held);
+        if (ret != 0) {
+          return ret;
+        }
+        break;
+      }
+      if (d->id3_len < ID3_HEADER_LEN) {
+        break;
+      }
+      // Size: 28 bits, 7 per byte; a footer adds another header's length
+      const uint8_t *h = d->id3;
+      d->id3_skip = ((uint32_t)(h[6] & 0x7F) << 21) | ((h[7] & 0x7F) << 14) |
+                    ((h[8] & 0x7F) << 7) | (h[9] & 0x7F);
+      if (h[5] & 0x10) {
+        d->id3_skip += ID3_HEADER_LEN;
+      }
+      d->id3_len = 0;
+      d->packed = true;
+      d->state = ST_ID3;
+      break;
+    }
+    case ST_ID3: {
+      size_t n = d->id3_skip < len ? d->id3_skip : len;
+      d->id3_skip -= n;
+      data += n;
+      len -= n;
+      if (d->id3_skip == 0) {
+        d->state = ST_DETECT; // another tag, or the audio
+      }
+      break;
+    }
+    case ST_TS:
+      return feed_ts(d, data, len);
+    default:
+      return emit(d, data, len);
+    }
+  }
+  return 0;
+}
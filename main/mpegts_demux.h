@@ -0,0 +1,89 @@
+#ifndef MPEGTS_DEMUX_H
+#define MPEGTS_DEMUX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audio out of HLS segments: MPEG transport stream or packed audio
+ *
+ * HLS audio comes in MPEG-TS segments or, as "packed audio", as the bare
+ * ADTS or MP3 stream after an ID3 tag that carries its timestamp. The
+ * decoders want the elementary stream either way: this takes a segment in
+ * pieces of any size and passes on the payload of the first audio stream
+ * the program map names (AAC in ADTS, or MPEG audio), or the packed stream
+ * without its ID3 tags. Both formats are framed, so PES packets are passed
+ * on as they come, without being put back together.
+ *
+ * PAT and PMT sections are expected to fit their packet, as they do in
+ * audio streams. Lost packets (continuity counter gaps) are counted; the
+ * decoder resynchronizes on the next frame.
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+#define MPEGTS_PACKET_SIZE 188
+
+typedef enum {
+  MPEGTS_AUDIO_NONE,  // not found yet
+  MPEGTS_AUDIO_ADTS,  // stream type 0x0F
+  MPEGTS_AUDIO_MPEG,  // stream types 0x03, 0x04
+  MPEGTS_AUDIO_OTHER, // only audio that can't be played (LATM, AC-3...)
+} mpegts_audio_t;
+
+/**
+ * @brief Receives elementary stream data; nonzero stops the segment.
+ */
+typedef int (*mpegts_out_t)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct {
+  mpegts_out_t out;
+  void *ctx;
+  mpegts_audio_t audio;
+  bool packed; // the segment is packed audio, not TS
+
+  uint32_t packets;   // TS packets, since init
+  uint32_t cc_errors; // lost or out of order
+  uint32_t resyncs;   // bytes skipped to find a packet start again
+  uint64_t bytes_out;
+
+  // Parser state
+  int state;
+  uint8_t pkt[MPEGTS_PACKET_SIZE];
+  size_t pkt_len;
+  uint8_t id3[10];
+  size_t id3_len;
+  uint32_t id3_skip;
+  int pmt_pid;   // -1 until the PAT is seen
+  int audio_pid; // -1 until the PMT is seen
+  int last_cc;
+  size_t pes_skip; // PES header bytes still to drop
+} mpegts_demux_t;
+
+/**
+ * @brief Sets up a demuxer passing the audio to out.
+ */
+void mpegts_demux_init(mpegts_demux_t *d, mpegts_out_t out, void *ctx);
+
+/**
+ * @brief Starts a segment; its format is found from its first bytes. At a
+ * discontinuity the streams are looked up again.
+ */
+void mpegts_demux_segment(mpegts_demux_t *d, bool discontinuity);
+
+/**
+ * @brief Demuxes the next piece of the segment.
+ * @return what out returned if it stopped the segment, otherwise 0.
+ */
+int mpegts_demux_feed(mpegts_demux_t *d, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MPEGTS_DEMUX_H
@@ -0,0 +1,980 @@
+#include "multiroom.h"
+#include "app_config.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "input_bus.h"
+#include "multiroom_proto.h"
+#include "ringbuf.h"
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *TAG = "MULTIROOM";
+
+// Tap between the HTTP reader and the leader task
+#define MR_TAP_SIZE (16 * 1024)
+// Frames are cut from this; a frame is at most 1.7 KB
+#define MR_PARSE_SIZE (8 * 1024)
+// Short, so a detached tap is let go of soon
+#define MR_READ_TIMEOUT_MS 50
+#define MR_TASK_STACK 4096
+// Above the HTTP reader (4), so the tap is drained before it overflows
+#define MR_LEADER_PRIORITY 5
+// Clock timestamps are taken in these tasks; keep them prompt
+#define MR_NET_PRIORITY 10
+#define MR_CLOCK_INTERVAL_MS 250
+#define MR_CLOCK_FAST_INTERVAL_MS 50 // until the clock is locked
+// Jitter buffer on a follower: 3 s at 320 kb/s, 10 s at 128 kb/s
+#define MR_SLOTS 128
+// The first packet fed to a new decoder must be due this far ahead
+#define MR_JOIN_MARGIN_US 150000
+// After this long without a packet that decodes on its own, take any
+#define MR_JOIN_WAIT_US 3000000
+// A missing packet is given up once this many later ones are in...
+#define MR_REORDER_PACKETS 4
+// ...or once it would be due this soon
+#define MR_LOSS_DEADLINE_US 200000
+// Ask again for the pipeline of a new session if it has not appeared
+#define MR_REFOLLOW_US 3000000
+#define MR_FOLLOWER_TIMEOUT_US 5000000
+#define MR_MAX_GAPS 16
+// Playout element buffer; an update of the servo per buffer (~23 ms)
+#define MR_PLAYOUT_BUF 4096
+// How long the playout element waits for the leader's first frame
+#define MR_PLAYOUT_WAIT_MS 500
+
+typedef struct {
+  bool used;
+  mr_packet_t hdr;
+  uint8_t payload[MR_MAX_PAYLOAD];
+} mr_slot_t;
+
+typedef struct {
+  int64_t at_us;   // media time reached when the jump happens
+  int64_t jump_us; // media time skipped (lost packets)
+} mr_gap_t;
+
+static multiroom_mode_t mode = MULTIROOM_OFF;
+
+// Shared between the network tasks, the decoder and the playout element
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool timeline_ready = false;
+static uint32_t timeline_session = 0;
+static int64_t timeline_t0 = 0;
+static int64_t timeline_base = 0; // media time of the decoder's first sample
+static mr_gap_t gaps[MR_MAX_GAPS];
+static int gap_head = 0;
+static int gap_count = 0;
+static mr_clock_t leader_clock; // follower
+static multiroom_follower_t followers[MULTIROOM_MAX_FOLLOWERS];
+static int64_t follower_seen[MULTIROOM_MAX_FOLLOWERS];
+static multiroom_stats_t stats;
+
+static volatile int out_rate = 0;
+static volatile int out_bits = 16;
+static volatile int out_channels = 2;
+
+/* Leader time now; false on a follower whose clock is not locked */
+static bool leader_now(int64_t *now) {
+  int64_t local = esp_timer_get_time();
+  if (mode == MULTIROOM_LEADER) {
+    *now = local;
+    return true;
+  }
+  portENTER_CRITICAL(&state_lock);
+  bool locked = leader_clock.locked;
+  *now = local + leader_clock.offset_us;
+  portEXIT_CRITICAL(&state_lock);
+  return locked;
+}
+
+static void timeline_start(uint32_t session, int64_t t0, int64_t base) {
+  portENTER_CRITICAL(&state_lock);
+  timeline_session = session;
+  timeline_t0 = t0;
+  timeline_base = base;
+  gap_count = 0;
+  timeline_ready = true;
+  stats.session = session;
+  portEXIT_CRITICAL(&state_lock);
+}
+
+static void timeline_stop(void) {
+  portENTER_CRITICAL(&state_lock);
+  timeline_ready = false;
+  stats.synced = false;
+  portEXIT_CRITICAL(&state_lock);
+}
+
+static void timeline_gap(int64_t at, int64_t jump) {
+  portENTER_CRITICAL(&state_lock);
+  if (gap_count < MR_MAX_GAPS) {
+    gaps[(gap_head + gap_count) % MR_MAX_GAPS] = (mr_gap_t){at, jump};
+    gap_count++;
+  }
+  portEXIT_CRITICAL(&state_lock);
+}
+
+static void *mr_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+/* ---------- playout element ---------- */
+
+typedef struct {
+  mr_servo_t servo;
+  mr_resampler_t rsp;
+  bool started;         // on the timeline below
+  uint32_t session;
+  int64_t t0;
+  int rate;             // of the position below
+  int64_t pos_media_us; // media time at pos_frames == 0
+  uint64_t pos_frames;  // frames taken from the decoder since
+  uint64_t drop_frames; // still to be skipped
+  int16_t *out;
+  uint8_t carry[4]; // partial frame from the last read
+  int carry_len;
+} playout_t;
+
+static playout_t playout; // one pipeline at a time
+
+/* Media time of the next input frame, after any gap it has reached */
+static int64_t playout_media(playout_t *p) {
+  int64_t media = p->pos_media_us + (int64_t)(p->pos_frames * 1000000ULL /
+                                               (uint64_t)p->rate);
+  portENTER_CRITICAL(&state_lock);
+  while (gap_count > 0 && media >= gaps[gap_head].at_us) {
+    media += gaps[gap_head].jump_us;
+    gap_head = (gap_head + 1) % MR_MAX_GAPS;
+    gap_count--;
+    p->pos_media_us = media;
+    p->pos_frames = 0;
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return media;
+}
+
+/* Picks up the timeline, waiting a little for the leader's first frame */
+static bool playout_schedule(playout_t *p) {
+  for (int waited = 0;; waited += 10) {
+    portENTER_CRITICAL(&state_lock);
+    bool ready = timeline_ready;
+    uint32_t session = timeline_session;
+    int64_t t0 = timeline_t0;
+    int64_t base = timeline_base;
+    portEXIT_CRITICAL(&state_lock);
+    if (ready) {
+      if (!p->started || p->session != session) {
+        p->started = true;
+        p->session = session;
+        p->t0 = t0;
+        p->pos_media_us = base;
+        p->pos_frames = 0;
+        p->drop_frames = 0;
+        mr_servo_reset(&p->servo);
+      }
+      return true;
+    }
+    if (p->started || waited >= MR_PLAYOUT_WAIT_MS) {
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+static esp_err_t playout_open(audio_element_handle_t self) {
+  playout_t *p = &playout;
+  free(p->out);
+  memset(p, 0, sizeof(*p));
+  p->out = malloc(MR_PLAYOUT_BUF + 64);
+  return p->out ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static esp_err_t playout_close(audio_element_handle_t self) {
+  free(playout.out);
+  playout.out = NULL;
+  return ESP_OK;
+}
+
+static int playout_silence(audio_element_handle_t self, playout_t *p,
+                           uint64_t frames, int frame_bytes) {
+  memset(p->out, 0, MR_PLAYOUT_BUF);
+  uint64_t bytes = frames * frame_bytes;
+  while (bytes > 0) {
+    int n = audio_element_output(self, (char *)p->out,
+                                 MIN(bytes, MR_PLAYOUT_BUF));
+    if (n <= 0) {
+      return n;
+    }
+    bytes -= n;
+  }
+  return 1;
+}
+
+static int playout_process(audio_element_handle_t self, char *in_buffer,
+                           int in_len) {
+  playout_t *p = &playout;
+  memcpy(in_buffer, p->carry, p->carry_len);
+  int n = audio_element_input(self, in_buffer + p->carry_len,
+                              in_len - p->carry_len);
+  if (n <= 0) {
+    return n;
+  }
+  n += p->carry_len;
+  p->carry_len = 0;
+
+  int rate = out_rate;
+  int channels = out_channels;
+  if (out_bits != 16 || rate <= 0 || channels < 1 ||
+      channels > MR_RESAMPLE_MAX_CHANNELS || !playout_schedule(p)) {
+    return audio_element_output(self, in_buffer, n);
+  }
+  int frame_bytes = 2 * channels;
+  size_t frames = n / frame_bytes;
+  p->carry_len = n % frame_bytes;
+  memcpy(p->carry, in_buffer + frames * frame_bytes, p->carry_len);
+  if (frames == 0) {
+    return n;
+  }
+  if (p->rsp.channels != channels) {
+    mr_resampler_reset(&p->rsp, channels);
+  }
+  if (p->rate != rate) {
+    if (p->rate > 0) {
+      p->pos_media_us = playout_media(p);
+      p->pos_frames = 0;
+    }
+    p->rate = rate;
+  }
+
+  // Which sample is being heard now, against which should be
+  int64_t now;
+  if (leader_now(&now)) {
+    ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+    int64_t queued = rb ? rb_bytes_filled(rb) / frame_bytes : 0;
+    int64_t heard = playout_media(p) - queued * 1000000 / rate;
+    int64_t step = mr_servo_update(&p->servo, (now - p->t0) - heard);
+    portENTER_CRITICAL(&state_lock);
+    stats.synced = true;
+    stats.error_us = p->servo.error_us;
+    stats.ppm = p->servo.ppm;
+    stats.steps = p->servo.steps;
+    portEXIT_CRITICAL(&state_lock);
+    if (step < 0) {
+      int ret = playout_silence(self, p, -step * rate / 1000000, frame_bytes);
+      if (ret <= 0) {
+        return ret;
+      }
+    } else if (step > 0) {
+      p->drop_frames += step * rate / 1000000;
+    }
+  }
+
+  const int16_t *in = (const int16_t *)in_buffer;
+  size_t skip = MIN(p->drop_frames, frames);
+  p->drop_frames -= skip;
+  p->pos_frames += skip;
+  in += skip * channels;
+  frames -= skip;
+  if (frames == 0) {
+    return n;
+  }
+  size_t out_frames = mr_resample(&p->rsp, in, frames, p->out, p->servo.ppm);
+  p->pos_frames += frames;
+  return audio_element_output(self, (char *)p->out, out_frames * frame_bytes);
+}
+
+audio_element_handle_t multiroom_playout_init(void) {
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  cfg.open = playout_open;
+  cfg.close = playout_close;
+  cfg.process = playout_process;
+  cfg.tag = "sync";
+  cfg.buffer_len = MR_PLAYOUT_BUF;
+  cfg.task_stack = MULTIROOM_PLAYOUT_STACK;
+  cfg.task_core = 1;
+  return audio_element_init(&cfg);
+}
+
+void multiroom_playout_set_format(int sample_rate, int bits, int channels) {
+  out_rate = sample_rate;
+  out_bits = bits;
+  out_channels = channels;
+}
+
+/* ---------- leader ---------- */
+
+static ringbuf_handle_t tap_rb = NULL;
+static SemaphoreHandle_t tap_lock = NULL;
+static TaskHandle_t leader_task_handle = NULL;
+static codec_type_t tap_codec;
+static atomic_bool tap_attached = false;
+static atomic_uint tap_generation = 0; // one more for every stream tapped
+static int data_sock = -1;
+static int clock_sock = -1;
+static struct sockaddr_in group_addr;
+
+// Leader task only
+static uint8_t *parse_buf = NULL;
+static size_t parse_len = 0;
+static uint8_t *packets[2]; // the one being filled and the previous one
+static size_t packet_len[2];
+static int packet_cur = 0;
+static mr_packet_t packet;
+static bool framing_locked = false;
+static bool session_started = false;
+static int64_t media_us = 0;
+
+static void leader_send(const uint8_t *buf, size_t len) {
+  if (sendto(data_sock, buf, len, 0, (struct sockaddr *)&group_addr,
+             sizeof(group_addr)) < 0) {
+    ESP_LOGD(TAG, "Multicast send failed");
+  }
+}
+
+/* Sends the packet being filled, then repeats the previous one */
+static void leader_flush(void) {
+  if (packet.payload_len == 0) {
+    return;
+  }
+  uint8_t *buf = packets[packet_cur];
+  mr_packet_encode(&packet, buf);
+  packet_len[packet_cur] = MR_HEADER_LEN + packet.payload_len;
+  leader_send(buf, packet_len[packet_cur]);
+  int prev = packet_cur ^ 1;
+  if (packet_len[prev] > 0) {
+    leader_send(packets[prev], packet_len[prev]);
+  }
+  portENTER_CRITICAL(&state_lock);
+  stats.packets_sent++;
+  stats.bytes_sent += packet_len[packet_cur];
+  portEXIT_CRITICAL(&state_lock);
+
+  packet_cur = prev;
+  packet.seq++;
+  packet.payload_len = 0;
+  packet.duration_us = 0;
+}
+
+static void leader_add_frame(const uint8_t *frame, const mr_frame_t *f) {
+  if (!session_started) {
+    // The leader's own playout waits for this too
+    session_started = true;
+    packet.t0_us = esp_timer_get_time() + MULTIROOM_LATENCY_MS * 1000LL;
+    timeline_start(packet.session, packet.t0_us, 0);
+  }
+  if (f->len > MR_MAX_PAYLOAD) {
+    // Only at 320 kb/s and 32 kHz; followers fill it with silence
+    leader_flush();
+    media_us += f->duration_us;
+    return;
+  }
+  // A packet starts at a frame that decodes on its own whenever possible,
+  // so followers can join there
+  if (packet.payload_len + f->len > MR_MAX_PAYLOAD ||
+      (f->independent && packet.payload_len > 0 &&
+       tap_codec == CODEC_TYPE_MP3)) {
+    leader_flush();
+  }
+  if (packet.payload_len == 0) {
+    packet.media_us = media_us;
+    packet.flags = f->independent ? MR_FLAG_SYNC_POINT : 0;
+  }
+  memcpy(packets[packet_cur] + MR_HEADER_LEN + packet.payload_len, frame,
+         f->len);
+  packet.payload_len += f->len;
+  packet.duration_us += f->duration_us;
+  media_us += f->duration_us;
+}
+
+/* Cuts whole frames from parse_buf */
+static void leader_parse(void) {
+  mr_framing_t framing =
+      tap_codec == CODEC_TYPE_AAC ? MR_FRAMING_ADTS : MR_FRAMING_MPEG;
+  size_t pos = 0;
+  while (pos < parse_len) {
+    mr_frame_t f;
+    int r = mr_frame_parse(framing, parse_buf + pos, parse_len - pos, &f);
+    if (r == 0) {
+      break;
+    }
+    if (r < 0) {
+      framing_locked = false;
+      pos++;
+      continue;
+    }
+    if (!framing_locked) {
+      // Out of sync, a header must be followed by another one
+      mr_frame_t next;
+      if (pos + f.len + 8 > parse_len) {
+        if (parse_len - pos >= MR_PARSE_SIZE / 2) {
+          pos++; // can't be a frame this long
+          continue;
+        }
+        break;
+      }
+      if (mr_frame_parse(framing, parse_buf + pos + f.len,
+                         parse_len - pos - f.len, &next) != 1) {
+        pos++;
+        continue;
+      }
+      framing_locked = true;
+    }
+    if (pos + f.len > parse_len) {
+      break;
+    }
+    leader_add_frame(parse_buf + pos, &f);
+    pos += f.len;
+  }
+  memmove(parse_buf, parse_buf + pos, parse_len - pos);
+  parse_len -= pos;
+}
+
+static void leader_task(void *pvParameters) {
+  unsigned generation = 0;
+  for (;;) {
+    if (!atomic_load(&tap_attached)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    unsigned tapped = atomic_load(&tap_generation);
+    if (tapped != generation) {
+      // A new pipeline was tapped; everything in the tap is its stream
+      generation = tapped;
+      leader_flush();
+      packet.session++;
+      packet.seq = 0;
+      packet.codec = tap_codec;
+      packet_len[0] = packet_len[1] = 0;
+      parse_len = 0;
+      framing_locked = false;
+      session_started = false;
+      media_us = 0;
+    }
+    int n = rb_read(tap_rb, (char *)parse_buf + parse_len,
+                    MR_PARSE_SIZE - parse_len,
+                    pdMS_TO_TICKS(MR_READ_TIMEOUT_MS));
+    if (atomic_load(&tap_generation) != generation) {
+      continue; // tapped mid-read: the end of the old stream and the new
+    }
+    if (n > 0) {
+      parse_len += n;
+      leader_parse();
+    }
+    leader_flush();
+  }
+}
+
+/* Answers clock requests and keeps the followers' reports */
+static void clock_server_task(void *pvParameters) {
+  uint8_t buf[MR_CLOCK_LEN];
+  for (;;) {
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int n = recvfrom(clock_sock, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                     &from_len);
+    int64_t t2 = esp_timer_get_time();
+    mr_clock_msg_t msg;
+    if (n <= 0 || !mr_clock_decode(&msg, buf, n)) {
+      continue;
+    }
+    portENTER_CRITICAL(&state_lock);
+    int slot = -1;
+    for (int i = 0; i < MULTIROOM_MAX_FOLLOWERS; i++) {
+      if (followers[i].addr == from.sin_addr.s_addr) {
+        slot = i;
+        break;
+      }
+      if (slot < 0 || follower_seen[i] < follower_seen[slot]) {
+        slot = i; // free or least recently seen
+      }
+    }
+    followers[slot].addr = from.sin_addr.s_addr;
+    followers[slot].error_us = msg.error_us;
+    followers[slot].fill_ms = msg.fill_ms;
+    follower_seen[slot] = t2;
+    portEXIT_CRITICAL(&state_lock);
+
+    msg.t2_us = t2;
+    msg.t3_us = esp_timer_get_time();
+    mr_clock_encode(&msg, buf);
+    sendto(clock_sock, buf, MR_CLOCK_LEN, 0, (struct sockaddr *)&from,
+           from_len);
+  }
+}
+
+static int udp_socket(uint16_t port) {
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(port),
+                             .sin_addr.s_addr = htonl(INADDR_ANY)};
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static esp_err_t leader_start(void) {
+  tap_lock = xSemaphoreCreateMutex();
+  tap_rb = rb_create(MR_TAP_SIZE, 1);
+  parse_buf = mr_alloc(MR_PARSE_SIZE);
+  packets[0] = mr_alloc(MR_PACKET_MAX);
+  packets[1] = mr_alloc(MR_PACKET_MAX);
+  data_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  clock_sock = udp_socket(MR_CLOCK_PORT);
+  if (tap_lock == NULL || tap_rb == NULL || parse_buf == NULL ||
+      packets[0] == NULL || packets[1] == NULL || data_sock < 0 ||
+      clock_sock < 0) {
+    ESP_LOGE(TAG, "Failed to set up the leader");
+    return ESP_FAIL;
+  }
+  uint8_t ttl = 1; // this LAN only
+  setsockopt(data_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  group_addr = (struct sockaddr_in){.sin_family = AF_INET,
+                                    .sin_port = htons(MR_DATA_PORT)};
+  inet_aton(MR_GROUP_ADDR, &group_addr.sin_addr);
+  // Followers tell a restarted leader by its new sessions
+  packet.session = esp_random();
+
+  if (xTaskCreate(leader_task, "mr_leader", MR_TASK_STACK, NULL,
+                  MR_LEADER_PRIORITY, &leader_task_handle) != pdPASS ||
+      xTaskCreate(clock_server_task, "mr_clock", MR_TASK_STACK, NULL,
+                  MR_NET_PRIORITY, NULL) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to start the leader tasks");
+    return ESP_ERR_NO_MEM;
+  }
+  portENTER_CRITICAL(&state_lock);
+  stats.memory = MR_TAP_SIZE + MR_PARSE_SIZE + 2 * MR_PACKET_MAX;
+  portEXIT_CRITICAL(&state_lock);
+  ESP_LOGI(TAG, "Leading multi-room group %s:%d", MR_GROUP_ADDR,
+           MR_DATA_PORT);
+  return ESP_OK;
+}
+
+void multiroom_attach(codec_type_t codec) {
+  if (mode != MULTIROOM_LEADER || tap_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(tap_lock, portMAX_DELAY);
+  tap_codec = codec;
+  atomic_store(&tap_attached, false);
+  if (multiroom_paces(codec)) {
+    rb_reset(tap_rb);
+    if (audio_pipeline_tap_insert(PIPELINE_TAP_MULTIROOM, tap_rb) == ESP_OK) {
+      atomic_fetch_add(&tap_generation, 1);
+      atomic_store(&tap_attached, true);
+      xTaskNotifyGive(leader_task_handle);
+    } else {
+      ESP_LOGE(TAG, "Failed to tap the stream");
+    }
+  } else {
+    ESP_LOGW(TAG, "%s streams are not shared with followers",
+             codec_type_to_string(codec));
+  }
+  xSemaphoreGive(tap_lock);
+}
+
+void multiroom_detach(void) {
+  if (mode != MULTIROOM_LEADER || tap_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(tap_lock, portMAX_DELAY);
+  atomic_store(&tap_attached, false);
+  xSemaphoreGive(tap_lock);
+  timeline_stop();
+}
+
+/* ---------- follower ---------- */
+
+static mr_slot_t *slots = NULL;
+static SemaphoreHandle_t jb_lock = NULL;   // slots and the reader position
+static SemaphoreHandle_t jb_signal = NULL; // a packet arrived
+static uint32_t rx_session = 0;            // newest session heard
+static codec_type_t rx_codec;
+static int64_t rx_end = 0;          // media time the newest packet ends at
+static uint32_t pipeline_session = 0; // session the decoder is set up for
+static int64_t follow_posted_us = 0;
+
+// Reader position, jb_lock held
+static bool rd_joined = false;
+static uint32_t rd_next_seq = 0;
+static int64_t rd_fed_end = 0; // media time fed to the decoder so far
+static int64_t rd_wait_start = 0;
+static int64_t rd_t0 = 0;
+// Packet being fed, decoder task only
+static uint8_t *rd_buf = NULL;
+static size_t rd_len = 0;
+static size_t rd_off = 0;
+
+static void follow_session(uint32_t session, codec_type_t codec) {
+  follow_posted_us = esp_timer_get_time();
+  ESP_LOGI(TAG, "Following session %08" PRIx32 " (%s)", session,
+           codec_type_to_string(codec));
+  input_bus_post_simple(INPUT_EVENT_FOLLOW, INPUT_SOURCE_MULTIROOM,
+                        INPUT_CONTROL_NONE, codec);
+}
+
+/* Stores a packet from the leader; follower task */
+static void follower_receive(const mr_packet_t *hdr, const uint8_t *payload) {
+  bool new_session = false;
+  xSemaphoreTake(jb_lock, portMAX_DELAY);
+  if (hdr->session != rx_session) {
+    new_session = true;
+    rx_session = hdr->session;
+    rx_codec = (codec_type_t)hdr->codec;
+    rx_end = 0;
+    for (int i = 0; i < MR_SLOTS; i++) {
+      slots[i].used = false;
+    }
+  }
+  bool late = rd_joined && pipeline_session == rx_session &&
+              (int32_t)(hdr->seq - rd_next_seq) < 0;
+  mr_slot_t *slot = &slots[hdr->seq % MR_SLOTS];
+  bool stored = false;
+  if (!late && !(slot->used && slot->hdr.seq == hdr->seq)) {
+    slot->hdr = *hdr;
+    memcpy(slot->payload, payload, hdr->payload_len);
+    slot->used = true;
+    stored = true;
+    rx_end = MAX(rx_end, hdr->media_us + hdr->duration_us);
+  }
+  xSemaphoreGive(jb_lock);
+
+  portENTER_CRITICAL(&state_lock);
+  stats.packets_received += stored;
+  stats.packets_late += late;
+  portEXIT_CRITICAL(&state_lock);
+  if (stored) {
+    xSemaphoreGive(jb_signal);
+  }
+  if (new_session) {
+    timeline_stop();
+    follow_session(rx_session, rx_codec);
+  }
+}
+
+static void follower_task(void *pvParameters) {
+  int rx_sock = udp_socket(MR_DATA_PORT);
+  int sync_sock = udp_socket(0);
+  uint8_t *buf = malloc(MR_PACKET_MAX);
+  if (rx_sock < 0 || sync_sock < 0 || buf == NULL) {
+    ESP_LOGE(TAG, "Failed to open the follower sockets");
+    vTaskDelete(NULL);
+    return;
+  }
+  struct ip_mreq mreq = {.imr_interface.s_addr = htonl(INADDR_ANY)};
+  inet_aton(MR_GROUP_ADDR, &mreq.imr_multiaddr);
+  if (setsockopt(rx_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                 sizeof(mreq)) < 0) {
+    ESP_LOGE(TAG, "Failed to join %s", MR_GROUP_ADDR);
+  }
+
+  struct sockaddr_in leader = {.sin_family = AF_INET,
+                               .sin_port = htons(MR_CLOCK_PORT)};
+  uint32_t clock_seq = 0;
+  int64_t next_clock_us = 0;
+  for (;;) {
+    int64_t now = esp_timer_get_time();
+    if (leader.sin_addr.s_addr != 0 && now >= next_clock_us) {
+      mr_clock_msg_t msg = {.seq = ++clock_seq};
+      portENTER_CRITICAL(&state_lock);
+      bool locked = leader_clock.locked;
+      int64_t offset = leader_clock.offset_us;
+      msg.error_us = stats.error_us;
+      msg.fill_ms = MAX(0, MIN(UINT16_MAX, stats.fill_ms));
+      portEXIT_CRITICAL(&state_lock);
+      msg.t1_us = esp_timer_get_time();
+      mr_clock_encode(&msg, buf);
+      sendto(sync_sock, buf, MR_CLOCK_LEN, 0, (struct sockaddr *)&leader,
+             sizeof(leader));
+      next_clock_us = now + 1000LL * (locked ? MR_CLOCK_INTERVAL_MS
+                                             : MR_CLOCK_FAST_INTERVAL_MS);
+      // The buffered audio, for telemetry
+      xSemaphoreTake(jb_lock, portMAX_DELAY);
+      int64_t end = rx_end;
+      xSemaphoreGive(jb_lock);
+      portENTER_CRITICAL(&state_lock);
+      stats.fill_ms = timeline_ready
+                          ? (end - (now + offset - timeline_t0)) / 1000
+                          : 0;
+      portEXIT_CRITICAL(&state_lock);
+    }
+
+    int64_t wait_us = leader.sin_addr.s_addr != 0
+                          ? MAX(0, next_clock_us - esp_timer_get_time())
+                          : 1000000;
+    struct timeval tv = {.tv_sec = wait_us / 1000000,
+                         .tv_usec = wait_us % 1000000};
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(rx_sock, &fds);
+    FD_SET(sync_sock, &fds);
+    if (select(MAX(rx_sock, sync_sock) + 1, &fds, NULL, NULL, &tv) <= 0) {
+      continue;
+    }
+
+    if (FD_ISSET(sync_sock, &fds)) {
+      int n = recv(sync_sock, buf, MR_PACKET_MAX, 0);
+      int64_t t4 = esp_timer_get_time();
+      mr_clock_msg_t msg;
+      if (n > 0 && mr_clock_decode(&msg, buf, n) && msg.seq == clock_seq) {
+        portENTER_CRITICAL(&state_lock);
+        mr_clock_add(&leader_clock, msg.t1_us, msg.t2_us, msg.t3_us, t4);
+        stats.clock_offset_us = leader_clock.offset_us;
+        stats.clock_delay_us = leader_clock.delay_us;
+        stats.clock_steps = leader_clock.steps;
+        portEXIT_CRITICAL(&state_lock);
+      }
+    }
+
+    if (FD_ISSET(rx_sock, &fds)) {
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      int n = recvfrom(rx_sock, buf, MR_PACKET_MAX, 0,
+                       (struct sockaddr *)&from, &from_len);
+      mr_packet_t hdr;
+      if (n > 0 && mr_packet_decode(&hdr, buf, n)) {
+        if (from.sin_addr.s_addr != leader.sin_addr.s_addr) {
+          char addr[16];
+          ESP_LOGI(TAG, "Leader at %s",
+                   inet_ntoa_r(from.sin_addr, addr, sizeof(addr)));
+          leader.sin_addr = from.sin_addr;
+          next_clock_us = 0;
+          portENTER_CRITICAL(&state_lock);
+          mr_clock_reset(&leader_clock);
+          portEXIT_CRITICAL(&state_lock);
+        }
+        follower_receive(&hdr, buf + MR_HEADER_LEN);
+      }
+    }
+
+    // The dispatcher may have been busy or not up yet
+    xSemaphoreTake(jb_lock, portMAX_DELAY);
+    bool stale = rx_session != 0 && pipeline_session != rx_session;
+    xSemaphoreGive(jb_lock);
+    if (stale && esp_timer_get_time() - follow_posted_us > MR_REFOLLOW_US) {
+      follow_session(rx_session, rx_codec);
+    }
+  }
+}
+
+/* Picks the packet to start a new decoder with; jb_lock held */
+static mr_slot_t *reader_join(int64_t now) {
+  mr_slot_t *first = NULL;
+  mr_slot_t *sync = NULL;
+  for (int i = 0; i < MR_SLOTS; i++) {
+    mr_slot_t *s = &slots[i];
+    if (!s->used ||
+        s->hdr.t0_us + s->hdr.media_us - now < MR_JOIN_MARGIN_US) {
+      continue;
+    }
+    if (first == NULL || (int32_t)(s->hdr.seq - first->hdr.seq) < 0) {
+      first = s;
+    }
+    if ((s->hdr.flags & MR_FLAG_SYNC_POINT) &&
+        (sync == NULL || (int32_t)(s->hdr.seq - sync->hdr.seq) < 0)) {
+      sync = s;
+    }
+  }
+  if (rd_wait_start == 0) {
+    rd_wait_start = now;
+  }
+  if (sync) {
+    return sync;
+  }
+  return now - rd_wait_start >= MR_JOIN_WAIT_US ? first : NULL;
+}
+
+/* Takes the next packet for the decoder into rd_buf; jb_lock held */
+static bool reader_take(void) {
+  int64_t now;
+  if (rx_session == 0 || rx_session != pipeline_session ||
+      !leader_now(&now)) {
+    return false;
+  }
+  if (!rd_joined) {
+    mr_slot_t *start = reader_join(now);
+    if (start == NULL) {
+      return false;
+    }
+    rd_joined = true;
+    rd_next_seq = start->hdr.seq;
+    rd_fed_end = start->hdr.media_us;
+    rd_t0 = start->hdr.t0_us;
+    timeline_start(rx_session, start->hdr.t0_us, start->hdr.media_us);
+    ESP_LOGI(TAG, "Joined at packet %" PRIu32 "%s", rd_next_seq,
+             (start->hdr.flags & MR_FLAG_SYNC_POINT) ? "" : " (not a sync point)");
+  }
+
+  mr_slot_t *s = &slots[rd_next_seq % MR_SLOTS];
+  if (!s->used || s->hdr.seq != rd_next_seq) {
+    // Missing; skip it if later packets are in and it is not coming
+    mr_slot_t *later = NULL;
+    uint32_t ahead;
+    for (ahead = 1; ahead < MR_SLOTS; ahead++) {
+      mr_slot_t *t = &slots[(rd_next_seq + ahead) % MR_SLOTS];
+      if (t->used && t->hdr.seq == rd_next_seq + ahead) {
+        later = t;
+        break;
+      }
+    }
+    if (later == NULL ||
+        (ahead < MR_REORDER_PACKETS &&
+         rd_t0 + rd_fed_end - now > MR_LOSS_DEADLINE_US)) {
+      return false;
+    }
+    portENTER_CRITICAL(&state_lock);
+    stats.packets_lost += ahead;
+    portEXIT_CRITICAL(&state_lock);
+    rd_next_seq = later->hdr.seq;
+    s = later;
+  }
+  if (s->hdr.media_us > rd_fed_end) {
+    // Lost packets or an oversized frame; the playout fills it in
+    timeline_gap(rd_fed_end, s->hdr.media_us - rd_fed_end);
+  }
+  memcpy(rd_buf, s->payload, s->hdr.payload_len);
+  rd_len = s->hdr.payload_len;
+  rd_off = 0;
+  rd_fed_end = s->hdr.media_us + s->hdr.duration_us;
+  s->used = false;
+  rd_next_seq++;
+  return true;
+}
+
+void multiroom_source_prepare(void) {
+  if (jb_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(jb_lock, portMAX_DELAY);
+  pipeline_session = rx_session;
+  rd_joined = false;
+  rd_wait_start = 0;
+  rd_len = rd_off = 0;
+  xSemaphoreGive(jb_lock);
+  timeline_stop();
+}
+
+int multiroom_source_read(audio_element_handle_t el, char *buf, int len,
+                          TickType_t wait, void *ctx) {
+  if (rd_off >= rd_len) {
+    // Short waits, so the pipeline can be stopped meanwhile
+    TickType_t until = xTaskGetTickCount() + MIN(wait, pdMS_TO_TICKS(100));
+    for (;;) {
+      xSemaphoreTake(jb_lock, portMAX_DELAY);
+      bool got = reader_take();
+      xSemaphoreGive(jb_lock);
+      if (got) {
+        break;
+      }
+      TickType_t now = xTaskGetTickCount();
+      if ((int32_t)(until - now) <= 0 ||
+          xSemaphoreTake(jb_signal, until - now) != pdTRUE) {
+        return AEL_IO_TIMEOUT;
+      }
+    }
+  }
+  int n = MIN((size_t)len, rd_len - rd_off);
+  memcpy(buf, rd_buf + rd_off, n);
+  rd_off += n;
+  g_bytes_read += n; // bitrate display and stall watchdog
+  return n;
+}
+
+static esp_err_t follower_start(void) {
+  slots = mr_alloc(MR_SLOTS * sizeof(mr_slot_t));
+  rd_buf = mr_alloc(MR_MAX_PAYLOAD);
+  jb_lock = xSemaphoreCreateMutex();
+  jb_signal = xSemaphoreCreateBinary();
+  if (slots == NULL || rd_buf == NULL || jb_lock == NULL ||
+      jb_signal == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate the follower");
+    return ESP_ERR_NO_MEM;
+  }
+  memset(slots, 0, MR_SLOTS * sizeof(mr_slot_t));
+  if (xTaskCreate(follower_task, "mr_follower", MR_TASK_STACK, NULL,
+                  MR_NET_PRIORITY, NULL) != pdPASS) {
+    return ESP_ERR_NO_MEM;
+  }
+  portENTER_CRITICAL(&state_lock);
+  stats.memory = MR_SLOTS * sizeof(mr_slot_t) + MR_MAX_PAYLOAD;
+  portEXIT_CRITICAL(&state_lock);
+  ESP_LOGI(TAG, "Following multi-room group %s:%d", MR_GROUP_ADDR,
+           MR_DATA_PORT);
+  return ESP_OK;
+}
+
+/* ---------- common ---------- */
+
+esp_err_t multiroom_init(void) {
+  mode = g_runtime_config.multiroom_mode;
+  stats.mode = mode;
+  mr_clock_reset(&leader_clock);
+  switch (mode) {
+  case MULTIROOM_LEADER:
+    return leader_start();
+  case MULTIROOM_FOLLOWER:
+    return follower_start();
+  default:
+    return ESP_OK;
+  }
+}
+
+bool multiroom_is_follower(void) { return mode == MULTIROOM_FOLLOWER; }
+
+bool multiroom_is_source_uri(const char *uri) {
+  return uri && strcmp(uri, MULTIROOM_SOURCE_URI) == 0;
+}
+
+bool multiroom_paces(codec_type_t codec) {
+  return mode == MULTIROOM_FOLLOWER ||
+         (mode == MULTIROOM_LEADER &&
+          (codec == CODEC_TYPE_MP3 || codec == CODEC_TYPE_AAC));
+}
+
+void multiroom_get_stats(multiroom_stats_t *out) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&state_lock);
+  *out = stats;
+  out->followers = 0;
+  for (int i = 0; i < MULTIROOM_MAX_FOLLOWERS; i++) {
+    out->followers += followers[i].addr != 0 &&
+                      now - follower_seen[i] < MR_FOLLOWER_TIMEOUT_US;
+  }
+  portEXIT_CRITICAL(&state_lock);
+}
+
+int multiroom_get_followers(multiroom_follower_t *out, int max) {
+  int64_t now = esp_timer_get_time();
+  int n = 0;
+  portENTER_CRITICAL(&state_lock);
+  for (int i = 0; i < MULTIROOM_MAX_FOLLOWERS && n < max; i++) {
+    if (followers[i].addr != 0 &&
+        now - follower_seen[i] < MR_FOLLOWER_TIMEOUT_US) {
+      out[n] = followers[i];
+      out[n].age_ms = (now - follower_seen[i]) / 1000;
+      n++;
+    }
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return n;
+}
@@ -0,0 +1,157 @@
+#ifndef MULTIROOM_H
+#define MULTIROOM_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multi-room sync: several radios on a LAN playing one stream in step
+ *
+ * The leader plays a station as usual. Its HTTP reader is tapped (a second
+ * multi-output slot, next to the LAN relay's), the compressed stream is cut
+ * into whole MP3 or ADTS frames, and the frames are multicast to
+ * MR_GROUP_ADDR with their media time and the leader time t0 at which media
+ * time 0 is to be heard: t0 is MULTIROOM_LATENCY_MS after the first frame
+ * arrived. Every packet is sent twice, the repeat one packet later, since
+ * Wi-Fi multicast is not acknowledged.
+ *
+ * Followers ignore their own station. They learn the leader's address from
+ * its packets and measure its clock with a four-timestamp exchange (as in
+ * PTP) every 250 ms, keeping the offset from the exchanges with the
+ * shortest round trip. Frames are buffered in PSRAM and fed to the decoder
+ * (an ADF read callback in place of the HTTP reader) from a packet that can
+ * be decoded on its own and is due far enough ahead.
+ *
+ * On both sides a playout element ("sync") sits between the decoder and
+ * i2s_stream_writer. It knows the media time of the samples it passes on,
+ * and from the fill of the I2S ringbuf, which one is being heard now; the
+ * I2S driver's own buffering is the same on every unit and cancels out. A
+ * servo (multiroom_proto.h) removes small errors by resampling within
+ * +-500 ppm and large ones (a late start, lost packets, a stall) by
+ * dropping samples or inserting silence.
+ *
+ * Ogg and FLAC stations are played by the leader alone. Off unless
+ * g_runtime_config.multiroom_mode says otherwise; the mode is read at boot.
+ */
+
+// Delay from the leader receiving a frame to everyone playing it
+#define MULTIROOM_LATENCY_MS 500
+// Followers the leader keeps telemetry for
+#define MULTIROOM_MAX_FOLLOWERS 8
+// create_audio_pipeline source for a follower
+#define MULTIROOM_SOURCE_URI "multiroom:"
+
+/**
+ * @brief Sync figures since boot.
+ */
+typedef struct {
+  uint8_t mode;        // multiroom_mode_t
+  bool synced;         // on schedule: playing, clock locked (follower)
+  uint32_t session;    // stream being played, 0 before the first
+  int32_t error_us;    // playout error, filtered (positive: late)
+  int32_t ppm;         // resampling being applied
+  uint32_t steps;      // drops and silence inserted to catch up
+  // leader
+  uint32_t packets_sent;
+  uint64_t bytes_sent;
+  uint8_t followers; // heard from in the last 5 s
+  // follower
+  int64_t clock_offset_us; // leader clock - own clock
+  int32_t clock_delay_us;  // round trip of the exchange in use
+  uint32_t clock_steps;    // offset jumps after lock
+  int32_t fill_ms;         // received audio not yet heard
+  uint32_t packets_received;
+  uint32_t packets_lost;
+  uint32_t packets_late; // arrived after their turn
+  uint32_t memory;       // bytes allocated
+} multiroom_stats_t;
+
+/**
+ * @brief A follower as last reported to the leader.
+ */
+typedef struct {
+  uint32_t addr; // IPv4, network order
+  int32_t error_us;
+  uint16_t fill_ms;
+  uint32_t age_ms; // since its last clock exchange
+} multiroom_follower_t;
+
+/**
+ * @brief Starts the mode configured. Call once the network is up, before
+ * the first pipeline is created.
+ */
+esp_err_t multiroom_init(void);
+
+/**
+ * @brief Whether this unit plays the leader's stream instead of stations.
+ */
+bool multiroom_is_follower(void);
+
+/**
+ * @brief Whether uri is MULTIROOM_SOURCE_URI.
+ */
+bool multiroom_is_source_uri(const char *uri);
+
+/**
+ * @brief Whether a pipeline for codec needs the playout element: always on
+ * a follower, for MP3 and AAC on the leader.
+ */
+bool multiroom_paces(codec_type_t codec);
+
+// Task stack of the playout element
+#define MULTIROOM_PLAYOUT_STACK (3 * 1024)
+
+/**
+ * @brief Creates the playout element, to be linked between the decoder and
+ * i2s_stream_writer.
+ */
+audio_element_handle_t multiroom_playout_init(void);
+
+/**
+ * @brief Output format reported by the decoder (16-bit PCM is paced; other
+ * widths pass through).
+ */
+void multiroom_playout_set_format(int sample_rate, int bits, int channels);
+
+/**
+ * @brief Decoder read callback on a follower. Prepares a new session's
+ * stream; call when creating the pipeline with MULTIROOM_SOURCE_URI.
+ */
+void multiroom_source_prepare(void);
+int multiroom_source_read(audio_element_handle_t el, char *buf, int len,
+                          TickType_t wait, void *ctx);
+
+/**
+ * @brief Taps a new pipeline's source (PIPELINE_TAP_MULTIROOM) on the
+ * leader.
+ */
+void multiroom_attach(codec_type_t codec);
+
+/**
+ * @brief Forgets the source. Call before the pipeline is deinitialized.
+ */
+void multiroom_detach(void);
+
+/**
+ * @brief Copies the sync figures.
+ */
+void multiroom_get_stats(multiroom_stats_t *stats);
+
+/**
+ * @brief Copies up to max followers (leader only).
+ * @return Number copied.
+ */
+int multiroom_get_followers(multiroom_follower_t *out, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MULTIROOM_H
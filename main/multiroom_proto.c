@@ -0,0 +1,285 @@
+#include "multiroom_proto.h"
+#include <string.h>
+
+/* ---------- wire format ---------- */
+
+static void put_u16(uint8_t *b, uint16_t v) {
+  b[0] = v;
+  b[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *b, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    b[i] = v >> (8 * i);
+  }
+}
+
+static void put_u64(uint8_t *b, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    b[i] = v >> (8 * i);
+  }
+}
+
+static uint16_t get_u16(const uint8_t *b) { return b[0] | b[1] << 8; }
+
+static uint32_t get_u32(const uint8_t *b) {
+  return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 |
+         (uint32_t)b[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t *b) {
+  return (uint64_t)get_u32(b) | (uint64_t)get_u32(b + 4) << 32;
+}
+
+void mr_packet_encode(const mr_packet_t *p, uint8_t *buf) {
+  put_u32(buf, MR_MAGIC_DATA);
+  put_u32(buf + 4, p->session);
+  put_u32(buf + 8, p->seq);
+  put_u64(buf + 12, (uint64_t)p->t0_us);
+  put_u64(buf + 20, (uint64_t)p->media_us);
+  put_u32(buf + 28, p->duration_us);
+  buf[32] = p->codec;
+  buf[33] = p->flags;
+  put_u16(buf + 34, p->payload_len);
+  put_u32(buf + 36, 0);
+}
+
+bool mr_packet_decode(mr_packet_t *p, const uint8_t *buf, size_t len) {
+  if (len < MR_HEADER_LEN || get_u32(buf) != MR_MAGIC_DATA) {
+    return false;
+  }
+  p->session = get_u32(buf + 4);
+  p->seq = get_u32(buf + 8);
+  p->t0_us = (int64_t)get_u64(buf + 12);
+  p->media_us = (int64_t)get_u64(buf + 20);
+  p->duration_us = get_u32(buf + 28);
+  p->codec = buf[32];
+  p->flags = buf[33];
+  p->payload_len = get_u16(buf + 34);
+  return p->payload_len <= MR_MAX_PAYLOAD &&
+         len >= MR_HEADER_LEN + (size_t)p->payload_len;
+}
+
+void mr_clock_encode(const mr_clock_msg_t *m, uint8_t *buf) {
+  put_u32(buf, MR_MAGIC_CLOCK);
+  put_u32(buf + 4, m->seq);
+  put_u64(buf + 8, (uint64_t)m->t1_us);
+  put_u64(buf + 16, (uint64_t)m->t2_us);
+  put_u64(buf + 24, (uint64_t)m->t3_us);
+  put_u32(buf + 32, (uint32_t)m->error_us);
+  put_u16(buf + 36, m->fill_ms);
+  put_u16(buf + 38, 0);
+}
+
+bool mr_clock_decode(mr_clock_msg_t *m, const uint8_t *buf, size_t len) {
+  if (len < MR_CLOCK_LEN || get_u32(buf) != MR_MAGIC_CLOCK) {
+    return false;
+  }
+  m->seq = get_u32(buf + 4);
+  m->t1_us = (int64_t)get_u64(buf + 8);
+  m->t2_us = (int64_t)get_u64(buf + 16);
+  m->t3_us = (int64_t)get_u64(buf + 24);
+  m->error_us = (int32_t)get_u32(buf + 32);
+  m->fill_ms = get_u16(buf + 36);
+  return true;
+}
+
+/* ---------- framing ---------- */
+
+// kb/s by [MPEG-1][layer - 1][index], index 0 (free format) not supported
+static const uint16_t mpeg_bitrates[2][3][15] = {
+    {// MPEG-2 and 2.5
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}},
+    {// MPEG-1
+     {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+};
+
+static const uint32_t mpeg_rates[3] = {44100, 48000, 32000};
+
+static const uint32_t adts_rates[13] = {96000, 88200, 64000, 48000, 44100,
+                                        32000, 24000, 22050, 16000, 12000,
+                                        11025, 8000,  7350};
+
+static int parse_mpeg(const uint8_t *b, size_t len, mr_frame_t *f) {
+  if (len < 4) {
+    return 0;
+  }
+  if (b[0] != 0xff || (b[1] & 0xe0) != 0xe0) {
+    return -1;
+  }
+  int version = (b[1] >> 3) & 3; // 0: 2.5, 2: 2, 3: 1
+  int layer = 4 - ((b[1] >> 1) & 3);
+  int bitrate_index = b[2] >> 4;
+  int rate_index = (b[2] >> 2) & 3;
+  if (version == 1 || layer == 4 || bitrate_index == 0 ||
+      bitrate_index == 15 || rate_index == 3) {
+    return -1;
+  }
+  bool mpeg1 = version == 3;
+  uint32_t rate = mpeg_rates[rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+  uint32_t bitrate = mpeg_bitrates[mpeg1][layer - 1][bitrate_index] * 1000U;
+  int padding = (b[2] >> 1) & 1;
+  uint32_t samples;
+  if (layer == 1) {
+    samples = 384;
+    f->len = (12 * bitrate / rate + padding) * 4;
+  } else {
+    samples = (layer == 3 && !mpeg1) ? 576 : 1152;
+    f->len = samples / 8 * bitrate / rate + padding;
+  }
+  f->duration_us = (uint32_t)((uint64_t)samples * 1000000 / rate);
+  f->independent = true;
+  if (layer == 3) {
+    // main_data_begin, right after the header (and CRC): how far back in
+    // earlier frames this frame's data starts
+    size_t side = (b[1] & 1) ? 4 : 6;
+    if (len < side + 2) {
+      return 0;
+    }
+    int main_data_begin = mpeg1 ? (b[side] << 1 | b[side + 1] >> 7)
+                                : b[side];
+    f->independent = main_data_begin == 0;
+  }
+  return 1;
+}
+
+static int parse_adts(const uint8_t *b, size_t len, mr_frame_t *f) {
+  if (len < 7) {
+    return 0;
+  }
+  if (b[0] != 0xff || (b[1] & 0xf6) != 0xf0) {
+    return -1;
+  }
+  int rate_index = (b[2] >> 2) & 0xf;
+  size_t frame_len = (size_t)(b[3] & 3) << 11 | b[4] << 3 | b[5] >> 5;
+  if (rate_index >= 13 || frame_len < 7) {
+    return -1;
+  }
+  int blocks = (b[6] & 3) + 1;
+  f->len = frame_len;
+  // Core rate; with SBR the decoder doubles both rate and samples
+  f->duration_us =
+      (uint32_t)((uint64_t)blocks * 1024 * 1000000 / adts_rates[rate_index]);
+  f->independent = true;
+  return 1;
+}
+
+int mr_frame_parse(mr_framing_t framing, const uint8_t *buf, size_t len,
+                   mr_frame_t *f) {
+  return framing == MR_FRAMING_ADTS ? parse_adts(buf, len, f)
+                                    : parse_mpeg(buf, len, f);
+}
+
+/* ---------- clock filter ---------- */
+
+void mr_clock_reset(mr_clock_t *c) { memset(c, 0, sizeof(*c)); }
+
+void mr_clock_add(mr_clock_t *c, int64_t t1, int64_t t2, int64_t t3,
+                  int64_t t4) {
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  if (delay < 0) {
+    return;
+  }
+  c->win_offset[c->next] = ((t2 - t1) + (t3 - t4)) / 2;
+  c->win_delay[c->next] = delay;
+  c->next = (c->next + 1) % MR_CLOCK_WINDOW;
+  if (c->count < MR_CLOCK_WINDOW) {
+    c->count++;
+  }
+
+  int best = 0;
+  for (int i = 1; i < c->count; i++) {
+    if (c->win_delay[i] < c->win_delay[best]) {
+      best = i;
+    }
+  }
+  int64_t offset = c->win_offset[best];
+  c->delay_us = c->win_delay[best];
+  if (!c->locked) {
+    c->offset_us = offset;
+    c->locked = c->count >= MR_CLOCK_LOCK_SAMPLES;
+    return;
+  }
+  int64_t diff = offset - c->offset_us;
+  if (diff > MR_CLOCK_STEP_US || diff < -MR_CLOCK_STEP_US) {
+    c->offset_us = offset;
+    c->steps++;
+  } else {
+    c->offset_us += diff / 4;
+  }
+}
+
+/* ---------- playout servo ---------- */
+
+void mr_servo_reset(mr_servo_t *s) { memset(s, 0, sizeof(*s)); }
+
+int64_t mr_servo_update(mr_servo_t *s, int64_t error_us) {
+  if (!s->primed || error_us > MR_SERVO_STEP_US ||
+      error_us < -MR_SERVO_STEP_US) {
+    // Jump onto the schedule; the filter starts over from there
+    s->primed = true;
+    s->error_us = 0;
+    s->steps++;
+    return error_us;
+  }
+  // The measurement carries the output buffer's sawtooth; average it out
+  s->error_us += (int32_t)((error_us - s->error_us) / 8);
+  // About 0.1 ppm per us: 1 ms is taken out in ~10 s. The integral learns
+  // the crystal difference so the proportional part can go back to zero;
+  // at ~40 updates a second the loop is close to critically damped.
+  s->integral_ppm += s->error_us * 0.0001f;
+  if (s->integral_ppm > MR_SERVO_MAX_PPM) {
+    s->integral_ppm = MR_SERVO_MAX_PPM;
+  } else if (s->integral_ppm < -MR_SERVO_MAX_PPM) {
+    s->integral_ppm = -MR_SERVO_MAX_PPM;
+  }
+  float ppm = s->error_us * 0.1f + s->integral_ppm;
+  if (ppm > MR_SERVO_MAX_PPM) {
+    ppm = MR_SERVO_MAX_PPM;
+  } else if (ppm < -MR_SERVO_MAX_PPM) {
+    ppm = -MR_SERVO_MAX_PPM;
+  }
+  s->ppm = (int32_t)ppm;
+  return 0;
+}
+
+/* ---------- resampler ---------- */
+
+void mr_resampler_reset(mr_resampler_t *r, int channels) {
+  memset(r, 0, sizeof(*r));
+  r->channels = channels < 1                          ? 1
+                : channels > MR_RESAMPLE_MAX_CHANNELS ? MR_RESAMPLE_MAX_CHANNELS
+                                                      : channels;
+  // Start on the first input frame, not on the (silent) previous block
+  r->phase = 1ULL << 32;
+}
+
+size_t mr_resample(mr_resampler_t *r, const int16_t *in, size_t in_frames,
+                   int16_t *out, int32_t ppm) {
+  if (in_frames == 0) {
+    return 0;
+  }
+  const int ch = r->channels;
+  // Frame k of the virtual input is r->last for k == 0, in[k - 1] after
+  const uint64_t step = (1ULL << 32) + (int64_t)ppm * (1LL << 32) / 1000000;
+  const uint64_t end = (uint64_t)in_frames << 32;
+  size_t n = 0;
+  while (r->phase < end) {
+    size_t k = r->phase >> 32;
+    int64_t frac = (r->phase & 0xffffffffU) >> 16; // Q16
+    const int16_t *a = k == 0 ? r->last : in + (k - 1) * ch;
+    const int16_t *b = in + k * ch;
+    for (int c = 0; c < ch; c++) {
+      out[n * ch + c] = (int16_t)(a[c] + (((b[c] - a[c]) * frac) >> 16));
+    }
+    n++;
+    r->phase += step;
+  }
+  r->phase -= end;
+  memcpy(r->last, in + (in_frames - 1) * ch, ch * sizeof(int16_t));
+  return n;
+}
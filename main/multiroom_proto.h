@@ -0,0 +1,196 @@
+#ifndef MULTIROOM_PROTO_H
+#define MULTIROOM_PROTO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Multi-room sync: wire format and the arithmetic behind it
+ *
+ * Everything here is plain C without ESP-IDF, so the protocol, the clock
+ * filter and the playout servo can be built and exercised on a host.
+ * multiroom.c puts them to work on the radio.
+ *
+ * Times are microseconds. "Leader time" is the leader's esp_timer clock;
+ * "media time" runs from 0 at the first frame of the leader's stream. The
+ * sample with media time m is to be heard at leader time t0 + m.
+ *
+ * All fields are little-endian on the wire.
+ */
+
+#define MR_DATA_PORT 5004
+#define MR_CLOCK_PORT 5005
+#define MR_GROUP_ADDR "239.255.77.77"
+
+#define MR_MAGIC_DATA 0x3153524dU  // "MRS1"
+#define MR_MAGIC_CLOCK 0x3143524dU // "MRC1"
+
+#define MR_HEADER_LEN 40
+#define MR_MAX_PAYLOAD 1400
+#define MR_PACKET_MAX (MR_HEADER_LEN + MR_MAX_PAYLOAD)
+#define MR_CLOCK_LEN 40
+
+// The first frame of the payload decodes on its own (no MP3 bit reservoir)
+#define MR_FLAG_SYNC_POINT 0x01
+
+/**
+ * @brief Header of a data packet: whole compressed frames of the leader's
+ * stream, sent to the multicast group.
+ */
+typedef struct {
+  uint32_t session;     // changes with every stream the leader starts
+  uint32_t seq;         // packet number within the session
+  int64_t t0_us;        // leader time at which media time 0 is heard
+  int64_t media_us;     // media time of the first frame
+  uint32_t duration_us; // media time the payload covers
+  uint8_t codec;        // codec_type_t of the stream
+  uint8_t flags;        // MR_FLAG_*
+  uint16_t payload_len;
+} mr_packet_t;
+
+/**
+ * @brief Clock exchange. A follower sends t1 (its clock) with its playout
+ * figures; the leader returns the message with t2 (received) and t3 (sent)
+ * in its own clock.
+ */
+typedef struct {
+  uint32_t seq;
+  int64_t t1_us;
+  int64_t t2_us;
+  int64_t t3_us;
+  int32_t error_us; // follower's playout error, for the leader's telemetry
+  uint16_t fill_ms; // follower's buffered audio
+} mr_clock_msg_t;
+
+/**
+ * @brief Writes the header of p to buf (MR_HEADER_LEN bytes).
+ */
+void mr_packet_encode(const mr_packet_t *p, uint8_t *buf);
+
+/**
+ * @brief Reads a packet header. Returns false if buf is not a data packet
+ * or is shorter than the payload it announces.
+ */
+bool mr_packet_decode(mr_packet_t *p, const uint8_t *buf, size_t len);
+
+void mr_clock_encode(const mr_clock_msg_t *m, uint8_t *buf);
+bool mr_clock_decode(mr_clock_msg_t *m, const uint8_t *buf, size_t len);
+
+/* ---------- framing ---------- */
+
+typedef enum {
+  MR_FRAMING_MPEG, // MPEG audio layer I-III (MP3)
+  MR_FRAMING_ADTS, // AAC in ADTS
+} mr_framing_t;
+
+typedef struct {
+  size_t len;           // bytes, header included
+  uint32_t duration_us; // media time the frame decodes to
+  bool independent;     // decodes without earlier frames
+} mr_frame_t;
+
+/**
+ * @brief Parses the frame header at the start of buf.
+ * @return 1 if a frame starts there (f filled in), 0 if more bytes are
+ *         needed to tell, -1 if this is not a frame header.
+ */
+int mr_frame_parse(mr_framing_t framing, const uint8_t *buf, size_t len,
+                   mr_frame_t *f);
+
+/* ---------- clock filter ---------- */
+
+#define MR_CLOCK_WINDOW 8
+// Exchanges needed before the offset is trusted
+#define MR_CLOCK_LOCK_SAMPLES 4
+// A filtered estimate this far from the current offset is stepped to
+#define MR_CLOCK_STEP_US 2000
+
+/**
+ * @brief Offset of the leader's clock from ours, from the exchanges with
+ * the shortest round trip (the least queueing, so the most symmetric) among
+ * the last MR_CLOCK_WINDOW.
+ */
+typedef struct {
+  int64_t win_offset[MR_CLOCK_WINDOW];
+  int64_t win_delay[MR_CLOCK_WINDOW];
+  int count;
+  int next;
+  bool locked;
+  int64_t offset_us; // leader time - local time
+  int64_t delay_us;  // round trip of the sample in use
+  uint32_t steps;    // times the offset jumped instead of slewing
+} mr_clock_t;
+
+void mr_clock_reset(mr_clock_t *c);
+
+/**
+ * @brief Adds an exchange: t1/t4 local send/receive, t2/t3 leader
+ * receive/send.
+ */
+void mr_clock_add(mr_clock_t *c, int64_t t1, int64_t t2, int64_t t3,
+                  int64_t t4);
+
+/* ---------- playout servo ---------- */
+
+// Beyond this, samples are dropped or silence inserted instead of slewing
+#define MR_SERVO_STEP_US 20000
+// Resampling range; crystals are within +-50 ppm, the rest is for pull-in
+#define MR_SERVO_MAX_PPM 500
+
+/**
+ * @brief Keeps a unit's output on schedule. The error is how far the
+ * sample being heard lags the schedule (positive: late). Small errors are
+ * removed by resampling, large ones at once.
+ */
+typedef struct {
+  bool primed;
+  int32_t error_us; // filtered
+  float integral_ppm;
+  int32_t ppm; // resampling to apply: positive plays faster
+  uint32_t steps;
+} mr_servo_t;
+
+void mr_servo_reset(mr_servo_t *s);
+
+/**
+ * @brief Feeds a measurement, taken about every 20-50 ms.
+ * @return Time to skip (positive: drop that much audio) or to fill with
+ *         silence (negative) right away; 0 when resampling is enough.
+ */
+int64_t mr_servo_update(mr_servo_t *s, int64_t error_us);
+
+/* ---------- resampler ---------- */
+
+#define MR_RESAMPLE_MAX_CHANNELS 2
+
+/**
+ * @brief Linear interpolation of 16-bit interleaved PCM by a ratio within
+ * a few hundred ppm of 1.
+ */
+typedef struct {
+  uint64_t phase; // Q32 position in the input, 0 = last frame of the
+                  // previous block
+  int16_t last[MR_RESAMPLE_MAX_CHANNELS];
+  int channels;
+} mr_resampler_t;
+
+void mr_resampler_reset(mr_resampler_t *r, int channels);
+
+/**
+ * @brief Resamples in_frames frames. ppm > 0 consumes the input faster
+ * (fewer frames out). out must hold in_frames + in_frames / 1000 + 2 frames.
+ * @return Frames written to out.
+ */
+size_t mr_resample(mr_resampler_t *r, const int16_t *in, size_t in_frames,
+                   int16_t *out, int32_t ppm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MULTIROOM_PROTO_H
@@ -0,0 +1,272 @@
+#include "pipeline_graph.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PARAM_CORE 0x01
+#define PARAM_STACK 0x02
+#define PARAM_RB 0x04
+
+typedef struct {
+  const char *name;
+  uint8_t params; // PARAM_* the stage takes
+  bool required;
+} stage_info_t;
+
+// shift and sync are elements of this firmware with a fixed task; the I2S
+// writer is the last stage, so no ring follows it
+static const stage_info_t stage_info[PIPELINE_STAGE_COUNT] = {
+    [PIPELINE_STAGE_SOURCE] = {"source", PARAM_CORE | PARAM_STACK | PARAM_RB,
+                               true},
+    [PIPELINE_STAGE_SHIFT] = {"shift", PARAM_RB, false},
+    [PIPELINE_STAGE_CODEC] = {"codec", PARAM_CORE | PARAM_STACK | PARAM_RB,
+                              true},
+    [PIPELINE_STAGE_SYNC] = {"sync", PARAM_RB, false},
+    [PIPELINE_STAGE_I2S] = {"i2s", PARAM_CORE | PARAM_STACK, true},
+};
+
+static const char *const param_names[] = {"core", "stack", "rb"};
+
+const char *pipeline_stage_name(pipeline_stage_type_t type) {
+  return (unsigned)type < PIPELINE_STAGE_COUNT ? stage_info[type].name : "?";
+}
+
+static bool fail(char *err, size_t err_len, const char *fmt, ...) {
+  if (err && err_len) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(err, err_len, fmt, ap);
+    va_end(ap);
+  }
+  return false;
+}
+
+static bool word_is(const char *s, size_t len, const char *word) {
+  return strlen(word) == len && strncmp(s, word, len) == 0;
+}
+
+/* A decimal number with an optional k (KB) suffix, the whole of s[0..len) */
+static bool parse_size(const char *s, size_t len, uint32_t *out) {
+  uint64_t v = 0;
+  size_t i = 0;
+  for (; i < len && isdigit((unsigned char)s[i]); i++) {
+    v = v * 10 + (s[i] - '0');
+    if (v > UINT32_MAX) {
+      return false;
+    }
+  }
+  if (i == 0) {
+    return false;
+  }
+  if (i < len && (s[i] == 'k' || s[i] == 'K')) {
+    v *= 1024;
+    i++;
+  }
+  if (i != len || v > UINT32_MAX) {
+    return false;
+  }
+  *out = (uint32_t)v;
+  return true;
+}
+
+/* One "name=value" of a stage */
+static bool parse_param(pipeline_stage_t *st, const char *s, size_t len,
+                        char *err, size_t err_len) {
+  const char *eq = memchr(s, '=', len);
+  size_t name_len = eq ? (size_t)(eq - s) : len;
+  int param = -1;
+  for (int i = 0; i < 3; i++) {
+    if (word_is(s, name_len, param_names[i])) {
+      param = i;
+    }
+  }
+  const char *stage = stage_info[st->type].name;
+  if (param < 0) {
+    return fail(err, err_len, "unknown parameter '%.*s' of %s",
+                (int)name_len, s, stage);
+  }
+  if (!(stage_info[st->type].params & (1 << param))) {
+    return fail(err, err_len, "%s takes no %s", stage, param_names[param]);
+  }
+  uint32_t v;
+  if (eq == NULL || !parse_size(eq + 1, len - name_len - 1, &v)) {
+    return fail(err, err_len, "%s of %s needs a number", param_names[param],
+                stage);
+  }
+  switch (param) {
+  case 0:
+    if (v >= PIPELINE_CORES) {
+      return fail(err, err_len, "core of %s is 0 or 1", stage);
+    }
+    st->core = (int8_t)v;
+    break;
+  case 1:
+    if (v < PIPELINE_STACK_MIN || v > PIPELINE_STACK_MAX) {
+      return fail(err, err_len, "stack of %s is %dk to %dk", stage,
+                  PIPELINE_STACK_MIN / 1024, PIPELINE_STACK_MAX / 1024);
+    }
+    st->stack = v;
+    break;
+  default:
+    if (v < PIPELINE_RB_MIN || v > PIPELINE_RB_MAX) {
+      return fail(err, err_len, "rb of %s is %dk to %dk", stage,
+                  PIPELINE_RB_MIN / 1024, PIPELINE_RB_MAX / 1024);
+    }
+    st->rb = v;
+    break;
+  }
+  return true;
+}
+
+/* One stage with its parameters, s[0..len) without surrounding spaces */
+static bool parse_stage(pipeline_graph_t *g, const char *s, size_t len,
+                        char *err, size_t err_len) {
+  const char *colon = memchr(s, ':', len);
+  size_t name_len = colon ? (size_t)(colon - s) : len;
+  int type = -1;
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    if (word_is(s, name_len, stage_info[i].name)) {
+      type = i;
+    }
+  }
+  if (type < 0) {
+    return fail(err, err_len, name_len ? "unknown stage '%.*s'" : "empty stage",
+                (int)name_len, s);
+  }
+  if (g->count > 0) {
+    pipeline_stage_type_t prev = g->stages[g->count - 1].type;
+    if ((int)prev == type) {
+      return fail(err, err_len, "%s is listed twice", stage_info[type].name);
+    }
+    if ((int)prev > type) {
+      return fail(err, err_len, "%s must come before %s",
+                  stage_info[type].name, stage_info[prev].name);
+    }
+  }
+  pipeline_stage_t *st = &g->stages[g->count++];
+  *st = (pipeline_stage_t){.type = type, .core = -1};
+
+  while (colon) {
+    const char *p = colon + 1;
+    const char *end = s + len;
+    colon = memchr(p, ':', end - p);
+    if (!parse_param(st, p, (colon ? colon : end) - p, err, err_len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool pipeline_graph_parse(const char *text, pipeline_graph_t *g, char *err,
+                          size_t err_len) {
+  g->count = 0;
+  if (text == NULL || text[strspn(text, " ")] == '\0') {
+    text = PIPELINE_GRAPH_DEFAULT;
+  }
+  if (strlen(text) >= PIPELINE_GRAPH_MAX_LEN) {
+    return fail(err, err_len, "graph too long");
+  }
+  const char *s = text;
+  for (;;) {
+    size_t len = strcspn(s, ",");
+    const char *next = s[len] ? s + len + 1 : NULL;
+    while (len && *s == ' ') {
+      s++;
+      len--;
+    }
+    while (len && s[len - 1] == ' ') {
+      len--;
+    }
+    // Order is checked as stages come, so there is room for all of them
+    if (!parse_stage(g, s, len, err, err_len)) {
+      return false;
+    }
+    if (next == NULL) {
+      break;
+    }
+    s = next;
+  }
+  for (int i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+    if (stage_info[i].required && pipeline_graph_find(g, i) == NULL) {
+      return fail(err, err_len, "%s is needed", stage_info[i].name);
+    }
+  }
+  return true;
+}
+
+pipeline_fit_t pipeline_budget_check(const pipeline_budget_t *need,
+                                     const pipeline_budget_t *free_mem,
+                                     bool has_psram) {
+  uint64_t internal = (uint64_t)need->internal + PIPELINE_INTERNAL_RESERVE;
+  if (!has_psram) {
+    internal += need->psram;
+  } else if ((uint64_t)need->psram + PIPELINE_PSRAM_RESERVE >
+             free_mem->psram) {
+    return PIPELINE_SHORT_OF_PSRAM;
+  }
+  if (internal > free_mem->internal ||
+      need->largest_internal > free_mem->largest_internal) {
+    return PIPELINE_SHORT_OF_INTERNAL;
+  }
+  return PIPELINE_FITS;
+}
+
+pipeline_choice_t pipeline_graph_choose(
+    const char *text, bool (*fits)(const pipeline_graph_t *g, void *arg),
+    void *arg, pipeline_graph_t *g, char *err, size_t err_len) {
+  pipeline_choice_t choice = PIPELINE_GRAPH_CONFIGURED;
+  if (!pipeline_graph_parse(text, g, err, err_len)) {
+    choice = PIPELINE_GRAPH_REJECTED;
+  } else if (!fits(g, arg)) {
+    choice = PIPELINE_GRAPH_TOO_BIG;
+  }
+  if (choice != PIPELINE_GRAPH_CONFIGURED) {
+    pipeline_graph_parse(PIPELINE_GRAPH_DEFAULT, g, NULL, 0);
+  }
+  return choice;
+}
+
+static size_t put_size(char *buf, size_t len, size_t pos, const char *name,
+                       uint32_t v) {
+  char *at = pos < len ? buf + pos : NULL;
+  size_t room = pos < len ? len - pos : 0;
+  if (v % 1024 == 0) {
+    return pos + snprintf(at, room, ":%s=%luk", name, (unsigned long)v / 1024);
+  }
+  return pos + snprintf(at, room, ":%s=%lu", name, (unsigned long)v);
+}
+
+size_t pipeline_graph_format(const pipeline_graph_t *g, char *buf,
+                             size_t len) {
+  size_t pos = 0;
+  if (len) {
+    buf[0] = '\0';
+  }
+  for (int i = 0; i < g->count; i++) {
+    const pipeline_stage_t *st = &g->stages[i];
+    pos += snprintf(pos < len ? buf + pos : NULL, pos < len ? len - pos : 0,
+                    "%s%s", i ? "," : "", pipeline_stage_name(st->type));
+    if (st->core >= 0) {
+      pos += snprintf(pos < len ? buf + pos : NULL,
+                      pos < len ? len - pos : 0, ":core=%d", st->core);
+    }
+    if (st->stack) {
+      pos = put_size(buf, len, pos, "stack", st->stack);
+    }
+    if (st->rb) {
+      pos = put_size(buf, len, pos, "rb", st->rb);
+    }
+  }
+  return pos;
+}
+
+const pipeline_stage_t *pipeline_graph_find(const pipeline_graph_t *g,
+                                            pipeline_stage_type_t type) {
+  for (int i = 0; i < g->count; i++) {
+    if (g->stages[i].type == type) {
+      return &g->stages[i];
+    }
+  }
+  return NULL;
+}
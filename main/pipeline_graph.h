@@ -0,0 +1,147 @@
+#ifndef PIPELINE_GRAPH_H
+#define PIPELINE_GRAPH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Pipeline graph: which stages a station's pipeline is built from
+ *
+ * A graph is a line of text naming the stages from the station to the DAC,
+ * each with optional parameters:
+ *
+ *   source,shift,codec:core=1:stack=6k:rb=16k,sync,i2s
+ *
+ *   core   CPU the stage's task runs on, 0 or 1
+ *   stack  task stack, bytes ("k" for KB)
+ *   rb     ring buffer after the stage, bytes ("k" for KB)
+ *
+ * Stages go in data-flow order, each at most once. source, codec and i2s
+ * are needed to play; shift (time-shift) and sync (multi-room pacing) may
+ * be left out, and are then never created. A stage only takes the
+ * parameters that apply to it, so a graph is checked in full before a
+ * pipeline is built from it. audio_pipeline_manager.c builds, links and
+ * tears down whatever the graph lists, and falls back to the default graph
+ * when the configured one is rejected or its stages would not leave the
+ * reserves below free (pipeline_graph_choose()).
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+// The pipeline as it always was; an empty graph stands for it
+#define PIPELINE_GRAPH_DEFAULT "source,shift,codec,sync,i2s"
+#define PIPELINE_GRAPH_MAX_LEN 96 // with the terminator
+#define PIPELINE_GRAPH_ERROR_LEN 64
+
+#define PIPELINE_STACK_MIN 2048
+#define PIPELINE_STACK_MAX (32 * 1024)
+#define PIPELINE_RB_MIN 1024
+#define PIPELINE_RB_MAX (512 * 1024)
+#define PIPELINE_CORES 2
+
+// Left free for Wi-Fi, TLS handshakes and the web server
+#define PIPELINE_INTERNAL_RESERVE (32 * 1024)
+#define PIPELINE_PSRAM_RESERVE (64 * 1024)
+
+/**
+ * @brief Stage types, in data-flow order.
+ */
+typedef enum {
+  PIPELINE_STAGE_SOURCE, // HTTP or HLS stream; compressed taps
+  PIPELINE_STAGE_SHIFT,  // time-shift buffer
+  PIPELINE_STAGE_CODEC,  // decoder of the station's codec
+  PIPELINE_STAGE_SYNC,   // multi-room playout
+  PIPELINE_STAGE_I2S,    // I2S writer; PCM tap
+  PIPELINE_STAGE_COUNT
+} pipeline_stage_type_t;
+
+/**
+ * @brief A stage and its parameters; 0 (core -1) leaves the stage's own
+ * default.
+ */
+typedef struct {
+  pipeline_stage_type_t type;
+  int8_t core;
+  uint32_t stack; // bytes
+  uint32_t rb;    // bytes
+} pipeline_stage_t;
+
+typedef struct {
+  uint8_t count;
+  pipeline_stage_t stages[PIPELINE_STAGE_COUNT]; // in data-flow order
+} pipeline_graph_t;
+
+/**
+ * @brief Memory of a pipeline once it runs, or free in the heap.
+ */
+typedef struct {
+  uint32_t internal;
+  uint32_t psram;
+  uint32_t largest_internal; // biggest task stack, or free block
+} pipeline_budget_t;
+
+typedef enum {
+  PIPELINE_FITS,
+  PIPELINE_SHORT_OF_INTERNAL,
+  PIPELINE_SHORT_OF_PSRAM,
+} pipeline_fit_t;
+
+typedef enum {
+  PIPELINE_GRAPH_CONFIGURED, // the text's graph (or the default for none)
+  PIPELINE_GRAPH_REJECTED,   // the default: the text doesn't parse
+  PIPELINE_GRAPH_TOO_BIG,    // the default: the text's graph doesn't fit
+} pipeline_choice_t;
+
+/**
+ * @brief Parses and checks a graph. Empty text (or NULL) gives the default.
+ * @param err Set to what is wrong if the graph is rejected; may be NULL.
+ * @return false if the graph is rejected; g is then undefined.
+ */
+bool pipeline_graph_parse(const char *text, pipeline_graph_t *g, char *err,
+                          size_t err_len);
+
+/**
+ * @brief Whether a pipeline needing need leaves the reserves free. Without
+ * PSRAM its rings go to internal RAM too.
+ */
+pipeline_fit_t pipeline_budget_check(const pipeline_budget_t *need,
+                                     const pipeline_budget_t *free_mem,
+                                     bool has_psram);
+
+/**
+ * @brief The graph to build: text's if it parses and fits() takes it, or
+ * else the default, which is not checked again.
+ * @param err Set to what is wrong if the text is rejected; may be NULL.
+ */
+pipeline_choice_t pipeline_graph_choose(
+    const char *text, bool (*fits)(const pipeline_graph_t *g, void *arg),
+    void *arg, pipeline_graph_t *g, char *err, size_t err_len);
+
+/**
+ * @brief Writes a graph as text, parameters only where they are set.
+ * @return Length of the whole text; it is cut short if len is too small.
+ */
+size_t pipeline_graph_format(const pipeline_graph_t *g, char *buf,
+                             size_t len);
+
+/**
+ * @brief The stage of a type, NULL if the graph leaves it out.
+ */
+const pipeline_stage_t *pipeline_graph_find(const pipeline_graph_t *g,
+                                            pipeline_stage_type_t type);
+
+/**
+ * @brief Name of a stage type, as written in graphs.
+ */
+const char *pipeline_stage_name(pipeline_stage_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIPELINE_GRAPH_H
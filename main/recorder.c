@@ -0,0 +1,833 @@
+#include "recorder.h"
+#include "app_config.h"
+#include "decoder_registry.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "input_bus.h"
+#include "nvs_flash.h"
+#include "ringbuf.h"
+#include "sd_card.h"
+#include "station_data.h"
+#include "stream_head.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *TAG = "RECORDER";
+
+extern int current_station;
+
+// Each of the two buffers: 8 s at 128 kb/s, about 1 s of FLAC. A multiple
+// of the card's 64 KB allocation unit, so writes stay cluster aligned.
+#define REC_BUFFER_SIZE (128 * 1024)
+// Written to the card at a time, from internal RAM: the SD host can't DMA
+// from PSRAM and would fall back to one sector per command
+#define REC_WRITE_CHUNK (16 * 1024)
+// Tap between the HTTP reader and the collector task
+#define REC_TAP_SIZE (16 * 1024)
+#define REC_READ_CHUNK 4096
+// Short, so a detached tap is let go of soon
+#define REC_READ_TIMEOUT_MS 50
+// Room for Ogg header pages or FLAC metadata
+#define REC_HEAD_MAX (16 * 1024)
+// File size and FAT are brought up to date on the card this often, so a
+// power cut costs no more than this of the recording
+#define REC_SYNC_INTERVAL_US (30 * 1000000LL)
+// Schedules and the hour are looked at this often
+#define REC_CLOCK_CHECK_MS 1000
+// Earlier than this, the clock has not been set
+#define REC_CLOCK_VALID 1700000000
+// A scheduled recording waits this long at most for its station to start
+#define REC_TUNE_TIMEOUT_US (30 * 1000000LL)
+// A file is not started with less room than this left on the card
+#define REC_MIN_FREE (4 * 1024 * 1024)
+#define REC_QUEUE_LEN 8
+#define REC_COLLECT_STACK 3072
+// Above the HTTP reader (4), so the tap is drained before it overflows
+#define REC_COLLECT_PRIORITY 5
+#define REC_WRITER_STACK 4096
+// Below everything that plays; the card can wait
+#define REC_WRITER_PRIORITY 2
+#define REC_NVS_KEY "rec_sched"
+
+typedef enum {
+  HEAD_NONE,    // codec needs no header (MP3, AAC)
+  HEAD_PENDING, // still arriving
+  HEAD_DONE,    // head_buf[0..head_len) holds it
+  HEAD_FAILED,  // not found; files cut mid-stream go without
+} head_state_t;
+
+typedef enum {
+  REC_OPEN,  // a new file, named after local_time
+  REC_WRITE, // buffer buf, len bytes
+  REC_CLOSE,
+} rec_op_t;
+
+typedef struct {
+  rec_op_t op;
+  uint8_t buf;
+  uint32_t len;
+  time_t local_time;
+  const char *ext;
+} rec_msg_t;
+
+/* Saved in NVS as it is */
+typedef struct {
+  int16_t utc_offset_min;
+  uint8_t count;
+  recorder_schedule_t entries[RECORDER_MAX_SCHEDULES];
+} schedule_set_t;
+
+static SemaphoreHandle_t rec_lock = NULL; // enabling and the tap
+static TaskHandle_t collect_task_handle = NULL;
+static TaskHandle_t writer_task_handle = NULL;
+static QueueHandle_t writer_queue = NULL;
+static ringbuf_handle_t tap_rb = NULL;
+static bool tap_pipeline = false; // a pipeline with a source plays
+static codec_type_t tap_codec;
+static atomic_bool tap_attached = false;
+static atomic_uint tap_generation = 0; // one more for every stream tapped
+static atomic_bool write_failed = false;
+
+static uint8_t *buffers[2];
+static atomic_bool buffer_busy[2]; // handed to the writer
+static uint8_t *head_buf = NULL;
+static uint8_t *read_buf = NULL;
+static uint8_t *write_chunk = NULL; // writer only
+
+// Requests, and the schedules
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool want_recording = false;
+static bool scheduled = false;
+static time_t schedule_end = 0;  // local time the scheduled slot ends
+static time_t last_slot = 0;     // local start of the last slot acted on
+static schedule_set_t schedules;
+
+// Collector task only
+static codec_type_t stream_codec;
+static stream_sync_t stream_sync;
+static uint64_t stream_bytes = 0; // of the current stream, seen so far
+static head_state_t head_state = HEAD_NONE;
+static size_t head_filled = 0;
+static size_t head_len = 0;
+static bool recording = false;
+static int64_t tune_deadline_us = 0; // waiting for the scheduled station
+static bool file_open = false;
+static bool syncing = false;       // skipping to the next frame
+static bool split_pending = false; // new file at the next frame
+static time_t file_hour = 0;       // local hour the file belongs to
+static uint8_t cur = 0;            // buffer being filled
+static size_t fill = 0;
+
+// Writer task only
+static int fd = -1;
+static int64_t last_sync_us = 0;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static recorder_stats_t stats;
+static uint64_t write_us = 0; // time spent in write(), for write_kbps
+
+static const char *file_ext(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->ext : "bin";
+}
+
+/* Local time, or 0 if the clock has not been set */
+static time_t local_now(void) {
+  time_t now = time(NULL);
+  if (now < REC_CLOCK_VALID) {
+    return 0;
+  }
+  portENTER_CRITICAL(&state_lock);
+  int offset_min = schedules.utc_offset_min;
+  portEXIT_CRITICAL(&state_lock);
+  return now + offset_min * 60;
+}
+
+/* ---------- writer task ---------- */
+
+static void set_file_name(const char *path) {
+  portENTER_CRITICAL(&stats_lock);
+  strlcpy(stats.file, path, sizeof(stats.file));
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+/* Card figures for the stats; cheap once FAT knows its free count */
+static void update_card_space(void) {
+  uint64_t total = 0, free_bytes = 0;
+  if (esp_vfs_fat_info(SD_CARD_MOUNT_POINT, &total, &free_bytes) != ESP_OK) {
+    return;
+  }
+  portENTER_CRITICAL(&stats_lock);
+  stats.card_size = total;
+  stats.card_free = free_bytes;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+static void writer_fail(const char *what) {
+  ESP_LOGE(TAG, "%s failed: %s", what, strerror(errno));
+  portENTER_CRITICAL(&stats_lock);
+  stats.errors++;
+  portEXIT_CRITICAL(&stats_lock);
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  set_file_name("");
+  atomic_store(&write_failed, true);
+  xTaskNotifyGive(collect_task_handle);
+}
+
+static void writer_open(time_t local_time, const char *ext) {
+  update_card_space();
+  portENTER_CRITICAL(&stats_lock);
+  bool full = stats.card_size > 0 && stats.card_free < REC_MIN_FREE;
+  portEXIT_CRITICAL(&stats_lock);
+  if (full) {
+    errno = ENOSPC;
+    writer_fail("Starting a file");
+    return;
+  }
+  struct tm tm;
+  gmtime_r(&local_time, &tm);
+  char path[sizeof(stats.file)];
+  snprintf(path, sizeof(path), RECORDER_DIR "/%04d%02d%02d", tm.tm_year + 1900,
+           tm.tm_mon + 1, tm.tm_mday);
+  mkdir(RECORDER_DIR, 0775);
+  mkdir(path, 0775);
+  size_t dir_len = strlen(path);
+  // Two files started within a second: the second is named a second later
+  for (int i = 0; i < 60 && fd < 0; i++) {
+    time_t t = local_time + i;
+    gmtime_r(&t, &tm);
+    snprintf(path + dir_len, sizeof(path) - dir_len, "/%02d%02d%02d.%s",
+             tm.tm_hour, tm.tm_min, tm.tm_sec, ext);
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0664);
+    if (fd < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (fd < 0) {
+    writer_fail("Creating a file");
+    return;
+  }
+  last_sync_us = esp_timer_get_time();
+  set_file_name(path);
+  portENTER_CRITICAL(&stats_lock);
+  stats.files++;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "Recording to %s", path);
+}
+
+static void writer_write(const uint8_t *buf, size_t len) {
+  if (fd < 0) {
+    return; // the file could not be opened; its data goes nowhere
+  }
+  for (size_t done = 0; done < len;) {
+    size_t n = MIN(len - done, REC_WRITE_CHUNK);
+    memcpy(write_chunk, buf + done, n);
+    int64_t start = esp_timer_get_time();
+    ssize_t written = write(fd, write_chunk, n);
+    int64_t took = esp_timer_get_time() - start;
+    if (written != (ssize_t)n) {
+      if (written >= 0) {
+        errno = ENOSPC;
+      }
+      writer_fail("Writing");
+      return;
+    }
+    done += n;
+    portENTER_CRITICAL(&stats_lock);
+    stats.bytes_written += n;
+    stats.stall_max_ms = MAX(stats.stall_max_ms, (uint32_t)(took / 1000));
+    write_us += took;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+  int64_t now = esp_timer_get_time();
+  if (now - last_sync_us >= REC_SYNC_INTERVAL_US) {
+    last_sync_us = now;
+    if (fsync(fd) != 0) {
+      writer_fail("Syncing");
+    }
+  }
+}
+
+static void writer_close(void) {
+  if (fd < 0) {
+    return;
+  }
+  if (close(fd) != 0) {
+    fd = -1;
+    writer_fail("Closing");
+    return;
+  }
+  fd = -1;
+  set_file_name("");
+  update_card_space();
+}
+
+static void writer_task(void *pvParameters) {
+  rec_msg_t msg;
+  for (;;) {
+    xQueueReceive(writer_queue, &msg, portMAX_DELAY);
+    switch (msg.op) {
+    case REC_OPEN:
+      writer_close();
+      writer_open(msg.local_time, msg.ext);
+      break;
+    case REC_WRITE:
+      writer_write(buffers[msg.buf], msg.len);
+      atomic_store(&buffer_busy[msg.buf], false);
+      break;
+    case REC_CLOSE:
+      writer_close();
+      break;
+    }
+  }
+}
+
+/* ---------- collector task ---------- */
+
+static void send_to_writer(const rec_msg_t *msg) {
+  // The queue holds more than the two buffers can ever have outstanding
+  if (xQueueSend(writer_queue, msg, 0) != pdTRUE) {
+    ESP_LOGE(TAG, "Writer queue full");
+    if (msg->op == REC_WRITE) {
+      atomic_store(&buffer_busy[msg->buf], false);
+    }
+  }
+}
+
+/* Hands the buffer being filled to the writer and moves to the other one */
+static void submit(void) {
+  if (fill == 0) {
+    return;
+  }
+  uint32_t waiting = fill;
+  if (atomic_load(&buffer_busy[cur ^ 1])) {
+    waiting += REC_BUFFER_SIZE;
+  }
+  atomic_store(&buffer_busy[cur], true);
+  rec_msg_t msg = {.op = REC_WRITE, .buf = cur, .len = fill};
+  send_to_writer(&msg);
+  cur ^= 1;
+  fill = 0;
+  portENTER_CRITICAL(&stats_lock);
+  stats.buffered_max = MAX(stats.buffered_max, waiting);
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+/* Adds to the file; drops what doesn't fit while the writer is behind */
+static void append(const uint8_t *data, size_t len) {
+  while (len > 0) {
+    if (atomic_load(&buffer_busy[cur])) {
+      portENTER_CRITICAL(&stats_lock);
+      stats.bytes_dropped += len;
+      portEXIT_CRITICAL(&stats_lock);
+      // Picks up again at a frame
+      syncing = true;
+      return;
+    }
+    size_t n = MIN(len, REC_BUFFER_SIZE - fill);
+    memcpy(buffers[cur] + fill, data, n);
+    fill += n;
+    data += n;
+    len -= n;
+    if (fill == REC_BUFFER_SIZE) {
+      submit();
+    }
+  }
+}
+
+static void finish_file(void) {
+  if (!file_open) {
+    return;
+  }
+  submit();
+  rec_msg_t msg = {.op = REC_CLOSE};
+  send_to_writer(&msg);
+  file_open = false;
+  split_pending = false;
+}
+
+/* Starts a file with the chunk about to be collected. Returns false if
+ * that has to wait for the stream header. */
+static bool start_file(void) {
+  time_t local_time = local_now();
+  if (local_time == 0) {
+    return false; // files are named after the time
+  }
+  // Mid-stream, Ogg and FLAC files start with the header
+  if (head_state == HEAD_PENDING && stream_bytes > 0) {
+    return false;
+  }
+  rec_msg_t msg = {
+      .op = REC_OPEN, .local_time = local_time, .ext = file_ext(stream_codec)};
+  send_to_writer(&msg);
+  file_open = true;
+  file_hour = local_time / 3600;
+  split_pending = false;
+  if (stream_bytes == 0 &&
+      (head_state == HEAD_PENDING || head_state == HEAD_DONE)) {
+    // The stream starts here, header and all
+    syncing = false;
+    return true;
+  }
+  if (head_state == HEAD_DONE) {
+    append(head_buf, head_len);
+  }
+  syncing = true;
+  return true;
+}
+
+/* Collects the header of the current stream as it arrives */
+static void capture_head(const uint8_t *data, size_t len) {
+  if (head_state != HEAD_PENDING) {
+    return;
+  }
+  size_t n = MIN(len, REC_HEAD_MAX - head_filled);
+  memcpy(head_buf + head_filled, data, n);
+  head_filled += n;
+  int found = stream_sync == STREAM_SYNC_OGG
+                  ? stream_head_ogg_len(head_buf, head_filled)
+                  : stream_head_flac_len(head_buf, head_filled);
+  if (found > 0) {
+    head_len = found;
+    head_state = HEAD_DONE;
+  } else if (found < 0 || head_filled == REC_HEAD_MAX) {
+    head_state = HEAD_FAILED;
+    ESP_LOGW(TAG, "No %s stream header found",
+             codec_type_to_string(stream_codec));
+  }
+}
+
+static void collect(const uint8_t *data, size_t len) {
+  capture_head(data, len);
+  if (recording && !file_open && !start_file()) {
+    stream_bytes += len;
+    return;
+  }
+  stream_bytes += len;
+  if (!file_open) {
+    return;
+  }
+  if (split_pending) {
+    // The rest of the frame still belongs to the old file
+    size_t at = stream_sync_find(stream_sync, data, len);
+    if (at == len) {
+      append(data, len);
+      return;
+    }
+    append(data, at);
+    finish_file();
+    if (!start_file()) {
+      return;
+    }
+    syncing = false;
+    data += at;
+    len -= at;
+  }
+  if (syncing) {
+    size_t at = stream_sync_find(stream_sync, data, len);
+    if (at == len) {
+      return;
+    }
+    syncing = false;
+    data += at;
+    len -= at;
+  }
+  append(data, len);
+}
+
+static void new_stream(void) {
+  finish_file();
+  tune_deadline_us = 0;
+  stream_codec = tap_codec;
+  stream_sync = decoder_registry_sync(stream_codec);
+  stream_bytes = 0;
+  head_filled = head_len = 0;
+  head_state = decoder_registry_has_head(stream_codec) ? HEAD_PENDING
+                                                      : HEAD_NONE;
+}
+
+static void stop_recording(void) {
+  portENTER_CRITICAL(&state_lock);
+  want_recording = false;
+  scheduled = false;
+  portEXIT_CRITICAL(&state_lock);
+}
+
+/* Starts the slot that covers now, if one does and it was not acted on */
+static void check_schedules(time_t local) {
+  portENTER_CRITICAL(&state_lock);
+  schedule_set_t set = schedules;
+  bool in_slot = scheduled;
+  time_t end = schedule_end;
+  time_t done = last_slot;
+  portEXIT_CRITICAL(&state_lock);
+
+  if (in_slot) {
+    if (local >= end) {
+      ESP_LOGI(TAG, "Scheduled recording ended");
+      stop_recording();
+    }
+    return;
+  }
+  time_t today = local / 86400 * 86400;
+  for (int i = 0; i < set.count; i++) {
+    const recorder_schedule_t *s = &set.entries[i];
+    // A slot can run past midnight: yesterday's may still be on
+    for (int back = 1; back >= 0; back--) {
+      time_t day = today - back * 86400;
+      int weekday = (day / 86400 + 4) % 7; // 1970-01-01 was a Thursday
+      time_t start = day + s->start_min * 60;
+      time_t stop = start + s->minutes * 60;
+      if (!(s->days & (1 << weekday)) || local < start || local >= stop ||
+          start == done) {
+        continue;
+      }
+      ESP_LOGI(TAG, "Scheduled recording %d started, %u minutes", i,
+               s->minutes);
+      if (s->station_id >= 0) {
+        const station_snapshot_t *snapshot = station_snapshot_acquire();
+        int index = station_snapshot_find_id(snapshot, s->station_id);
+        station_snapshot_release(snapshot);
+        if (index >= 0 && index != current_station) {
+          // Recorded from the start of the new stream
+          tune_deadline_us = esp_timer_get_time() + REC_TUNE_TIMEOUT_US;
+          input_bus_post_simple(INPUT_EVENT_STATION_SELECT,
+                                INPUT_SOURCE_SCHEDULE, INPUT_CONTROL_STATION,
+                                index);
+        } else if (index < 0) {
+          ESP_LOGW(TAG, "Scheduled station %" PRId32 " is not in the list",
+                   s->station_id);
+        }
+      }
+      portENTER_CRITICAL(&state_lock);
+      want_recording = true;
+      scheduled = true;
+      schedule_end = stop;
+      last_slot = start;
+      portEXIT_CRITICAL(&state_lock);
+      return;
+    }
+  }
+}
+
+static void check_clock(void) {
+  time_t local = local_now();
+  if (local == 0) {
+    return;
+  }
+  if (g_runtime_config.recorder_enabled) {
+    check_schedules(local);
+  }
+  if (file_open && !split_pending && local / 3600 != file_hour) {
+    split_pending = true;
+  }
+}
+
+/* Picks up start and stop requests, and failures of the writer */
+static void apply_requests(void) {
+  if (atomic_exchange(&write_failed, false)) {
+    ESP_LOGE(TAG, "Recording stopped");
+    stop_recording();
+  }
+  portENTER_CRITICAL(&state_lock);
+  bool want = want_recording;
+  portEXIT_CRITICAL(&state_lock);
+  if (tune_deadline_us && esp_timer_get_time() >= tune_deadline_us) {
+    ESP_LOGW(TAG, "Scheduled station did not start, recording what plays");
+    tune_deadline_us = 0;
+  }
+  recording = want && atomic_load(&tap_attached) && tune_deadline_us == 0;
+  if (!recording) {
+    finish_file();
+  }
+}
+
+static void collect_task(void *pvParameters) {
+  int64_t next_check_us = 0;
+  unsigned generation = 0;
+  for (;;) {
+    int64_t now = esp_timer_get_time();
+    if (now >= next_check_us) {
+      next_check_us = now + REC_CLOCK_CHECK_MS * 1000LL;
+      check_clock();
+    }
+    unsigned tapped = atomic_load(&tap_generation);
+    if (tapped != generation) {
+      // A new pipeline was tapped; everything in the tap is its stream. Taken
+      // before the requests, so a scheduled station is recorded from its start
+      generation = tapped;
+      new_stream();
+    }
+    apply_requests();
+    if (!atomic_load(&tap_attached)) {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(REC_CLOCK_CHECK_MS));
+      continue;
+    }
+    int n = rb_read(tap_rb, (char *)read_buf, REC_READ_CHUNK,
+                    pdMS_TO_TICKS(REC_READ_TIMEOUT_MS));
+    if (atomic_load(&tap_generation) != generation) {
+      continue; // tapped mid-read: the end of the old stream and the new
+    }
+    if (n > 0) {
+      collect(read_buf, n);
+    }
+  }
+}
+
+/* ---------- control ---------- */
+
+static void *rec_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+/* Mounts the card and allocates everything on first use; rec_lock held */
+static esp_err_t recorder_enable(void) {
+  if (collect_task_handle) {
+    return ESP_OK;
+  }
+  esp_err_t err = sd_card_mount();
+  if (err != ESP_OK) {
+    return err;
+  }
+  buffers[0] = rec_alloc(REC_BUFFER_SIZE);
+  buffers[1] = rec_alloc(REC_BUFFER_SIZE);
+  head_buf = rec_alloc(REC_HEAD_MAX);
+  read_buf = malloc(REC_READ_CHUNK);
+  write_chunk = heap_caps_malloc(REC_WRITE_CHUNK,
+                                 MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  tap_rb = rb_create(REC_TAP_SIZE, 1);
+  writer_queue = xQueueCreate(REC_QUEUE_LEN, sizeof(rec_msg_t));
+  if (buffers[0] == NULL || buffers[1] == NULL || head_buf == NULL ||
+      read_buf == NULL || write_chunk == NULL || tap_rb == NULL ||
+      writer_queue == NULL ||
+      xTaskCreate(writer_task, "rec_writer", REC_WRITER_STACK, NULL,
+                  REC_WRITER_PRIORITY, &writer_task_handle) != pdPASS) {
+    goto fail;
+  }
+  if (xTaskCreate(collect_task, "rec_collect", REC_COLLECT_STACK, NULL,
+                  REC_COLLECT_PRIORITY, &collect_task_handle) != pdPASS) {
+    vTaskDelete(writer_task_handle);
+    goto fail;
+  }
+  uint32_t memory =
+      2 * REC_BUFFER_SIZE + REC_HEAD_MAX + REC_READ_CHUNK + REC_WRITE_CHUNK +
+      REC_TAP_SIZE;
+  portENTER_CRITICAL(&stats_lock);
+  stats.memory = memory;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "Recorder enabled, %" PRIu32 " KB", memory / 1024);
+  return ESP_OK;
+
+fail:
+  ESP_LOGE(TAG, "Failed to allocate the recorder");
+  free(buffers[0]);
+  free(buffers[1]);
+  free(head_buf);
+  free(read_buf);
+  free(write_chunk);
+  if (tap_rb) {
+    rb_destroy(tap_rb);
+  }
+  if (writer_queue) {
+    vQueueDelete(writer_queue);
+  }
+  buffers[0] = buffers[1] = head_buf = read_buf = write_chunk = NULL;
+  tap_rb = NULL;
+  writer_queue = NULL;
+  writer_task_handle = NULL;
+  return ESP_ERR_NO_MEM;
+}
+
+/* Connects the tap to the current source; rec_lock held */
+static void tap_connect(void) {
+  if (atomic_load(&tap_attached) || !tap_pipeline ||
+      collect_task_handle == NULL) {
+    return;
+  }
+  rb_reset(tap_rb);
+  if (audio_pipeline_tap_insert(PIPELINE_TAP_RECORDER, tap_rb) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to tap the stream");
+    return;
+  }
+  atomic_fetch_add(&tap_generation, 1);
+  atomic_store(&tap_attached, true);
+  xTaskNotifyGive(collect_task_handle);
+}
+
+void recorder_attach(codec_type_t codec) {
+  if (rec_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(rec_lock, portMAX_DELAY);
+  tap_pipeline = true;
+  tap_codec = codec;
+  atomic_store(&tap_attached, false);
+  if (g_runtime_config.recorder_enabled) {
+    tap_connect();
+  }
+  xSemaphoreGive(rec_lock);
+}
+
+void recorder_detach(void) {
+  if (rec_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(rec_lock, portMAX_DELAY);
+  tap_pipeline = false;
+  atomic_store(&tap_attached, false);
+  if (collect_task_handle) {
+    xTaskNotifyGive(collect_task_handle);
+  }
+  xSemaphoreGive(rec_lock);
+}
+
+void recorder_apply_config(void) {
+  if (rec_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(rec_lock, portMAX_DELAY);
+  if (g_runtime_config.recorder_enabled) {
+    if (recorder_enable() == ESP_OK) {
+      tap_connect();
+    }
+  } else {
+    stop_recording();
+    // The stream plays on without copying to the recorder
+    if (atomic_exchange(&tap_attached, false)) {
+      audio_pipeline_tap_remove(PIPELINE_TAP_RECORDER);
+    }
+    if (collect_task_handle) {
+      xTaskNotifyGive(collect_task_handle);
+    }
+  }
+  xSemaphoreGive(rec_lock);
+}
+
+esp_err_t recorder_record(int state) {
+  if (!g_runtime_config.recorder_enabled || collect_task_handle == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  portENTER_CRITICAL(&state_lock);
+  bool on = state < 0 ? !want_recording : state != 0;
+  want_recording = on;
+  // Taken over by hand: a running slot is not stopped at its end
+  scheduled = false;
+  portEXIT_CRITICAL(&state_lock);
+  ESP_LOGI(TAG, "Recording %s", on ? "requested" : "stopped");
+  xTaskNotifyGive(collect_task_handle);
+  return ESP_OK;
+}
+
+bool recorder_is_recording(void) {
+  portENTER_CRITICAL(&state_lock);
+  bool on = want_recording;
+  portEXIT_CRITICAL(&state_lock);
+  return on;
+}
+
+/* ---------- schedules ---------- */
+
+static void load_schedules(void) {
+  nvs_handle_t nvs_handle;
+  if (nvs_open("storage", NVS_READONLY, &nvs_handle) != ESP_OK) {
+    return;
+  }
+  schedule_set_t set;
+  size_t size = sizeof(set);
+  if (nvs_get_blob(nvs_handle, REC_NVS_KEY, &set, &size) == ESP_OK &&
+      size == sizeof(set) && set.count <= RECORDER_MAX_SCHEDULES) {
+    schedules = set;
+  }
+  nvs_close(nvs_handle);
+}
+
+int recorder_get_schedules(recorder_schedule_t *out, int max,
+                           int *utc_offset_min) {
+  portENTER_CRITICAL(&state_lock);
+  int n = MIN(max, schedules.count);
+  memcpy(out, schedules.entries, n * sizeof(*out));
+  *utc_offset_min = schedules.utc_offset_min;
+  portEXIT_CRITICAL(&state_lock);
+  return n;
+}
+
+esp_err_t recorder_set_schedules(const recorder_schedule_t *entries, int count,
+                                 int utc_offset_min) {
+  if (count < 0 || count > RECORDER_MAX_SCHEDULES ||
+      utc_offset_min < -14 * 60 || utc_offset_min > 14 * 60) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  schedule_set_t set = {.utc_offset_min = utc_offset_min, .count = count};
+  for (int i = 0; i < count; i++) {
+    if (entries[i].days > 0x7F || entries[i].start_min >= 24 * 60 ||
+        entries[i].minutes == 0 || entries[i].minutes > 24 * 60) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    set.entries[i] = entries[i];
+  }
+
+  nvs_handle_t nvs_handle;
+  esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvs_handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = nvs_set_blob(nvs_handle, REC_NVS_KEY, &set, sizeof(set));
+  if (err == ESP_OK) {
+    err = nvs_commit(nvs_handle);
+  }
+  nvs_close(nvs_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Saving the schedules failed: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  portENTER_CRITICAL(&state_lock);
+  schedules = set;
+  portEXIT_CRITICAL(&state_lock);
+  ESP_LOGI(TAG, "%d schedules saved, UTC%+d min", count, utc_offset_min);
+  return ESP_OK;
+}
+
+esp_err_t recorder_init(void) {
+  rec_lock = xSemaphoreCreateMutex();
+  if (rec_lock == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  load_schedules();
+  recorder_apply_config();
+  return ESP_OK;
+}
+
+void recorder_get_stats(recorder_stats_t *out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  uint64_t busy_us = write_us;
+  portEXIT_CRITICAL(&stats_lock);
+  out->write_kbps =
+      busy_us ? (uint32_t)(out->bytes_written * 1000 / busy_us * 8) : 0;
+  out->mounted = sd_card_is_mounted();
+  portENTER_CRITICAL(&state_lock);
+  out->recording = want_recording;
+  out->scheduled = scheduled;
+  portEXIT_CRITICAL(&state_lock);
+  out->clock_set = time(NULL) >= REC_CLOCK_VALID;
+}
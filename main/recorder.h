@@ -0,0 +1,134 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include "sd_card.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Recording to the SD card
+ *
+ * The station is saved as it arrives, compressed frames and all: nothing is
+ * decoded or encoded again. The HTTP reader's output is teed (a third
+ * multi-output ringbuf, next to the LAN relay's and multi-room's) into one
+ * of two large buffers in PSRAM; a writer task saves the other one to the
+ * card meanwhile. Files are only ever written whole buffers at a time, in
+ * pieces the SD host can send in one multi-block transfer, so the card sees
+ * few, large, cluster aligned writes. When the card stalls (FAT updates,
+ * the card's own housekeeping) the tap keeps being drained into the free
+ * buffer; only if both are full is audio dropped from the recording, and
+ * counted. Playback is never held up.
+ *
+ * Files go to RECORDER_DIR/<yyyymmdd>/<hhmmss>.<ext>, named after their
+ * local start time. A new file is started at every full hour, at a frame
+ * (Ogg: page) boundary, and on every station change. Ogg and FLAC files
+ * cut from the middle of a stream get the stream header first.
+ *
+ * Recordings are started and stopped on request (input bus, web API), or
+ * by schedules: weekly time slots, optionally tuning a station first.
+ * Local time is UTC plus the offset saved with the schedules, the clock is
+ * set by SNTP.
+ *
+ * Off unless g_runtime_config.recorder_enabled is set. The buffers are
+ * allocated, and the card (sd_card.h) mounted if it isn't yet, when it is
+ * first enabled.
+ */
+
+#define RECORDER_DIR SD_CARD_MOUNT_POINT "/rec"
+#define RECORDER_MAX_SCHEDULES 8
+
+/**
+ * @brief A weekly recording slot.
+ */
+typedef struct {
+  uint8_t days;       // bit 0 Sunday ... bit 6 Saturday; 0 = slot unused
+  uint16_t start_min; // local time, minutes after midnight
+  uint16_t minutes;   // length
+  int32_t station_id; // tuned at the start; -1 records what is playing
+} recorder_schedule_t;
+
+/**
+ * @brief Recorder figures, counters since boot.
+ */
+typedef struct {
+  bool mounted;
+  bool recording;         // requested, by hand or by a schedule
+  bool scheduled;         // by a schedule
+  bool clock_set;         // schedules and file names need the time
+  char file[40];          // being written, "" if none
+  uint32_t memory;        // bytes allocated
+  uint64_t card_size;     // as of the last file started or finished
+  uint64_t card_free;
+  uint32_t files;         // started
+  uint64_t bytes_written; // saved to the card
+  uint64_t bytes_dropped; // lost while both buffers were full
+  uint32_t write_kbps;    // sustained, while writing
+  uint32_t stall_max_ms;  // longest single write to the card
+  uint32_t buffered_max;  // most bytes waiting for the card at once
+  uint32_t errors;        // failed opens and writes
+} recorder_stats_t;
+
+/**
+ * @brief Sets up the recorder, and mounts the card if enabled. Call before
+ * the first pipeline is created.
+ */
+esp_err_t recorder_init(void);
+
+/**
+ * @brief Applies g_runtime_config.recorder_enabled: mounts the card and
+ * taps the current stream when enabled, stops recording when disabled.
+ */
+void recorder_apply_config(void);
+
+/**
+ * @brief Taps a new pipeline's source (PIPELINE_TAP_RECORDER) while the
+ * recorder is on. A recording in progress continues into a new file.
+ */
+void recorder_attach(codec_type_t codec);
+
+/**
+ * @brief Forgets the source. Call before the pipeline is deinitialized.
+ */
+void recorder_detach(void);
+
+/**
+ * @brief Starts (1) or stops (0) recording, or toggles (-1).
+ * @return ESP_ERR_INVALID_STATE if the recorder is off or has no card.
+ */
+esp_err_t recorder_record(int state);
+
+/**
+ * @brief Copies the schedules and the UTC offset they are in.
+ * @return the number of schedules.
+ */
+int recorder_get_schedules(recorder_schedule_t *out, int max,
+                           int *utc_offset_min);
+
+/**
+ * @brief Replaces the schedules and saves them to NVS.
+ */
+esp_err_t recorder_set_schedules(const recorder_schedule_t *schedules,
+                                 int count, int utc_offset_min);
+
+/**
+ * @brief Whether a recording is in progress (power save waits for it).
+ */
+bool recorder_is_recording(void);
+
+/**
+ * @brief Copies the recorder figures.
+ */
+void recorder_get_stats(recorder_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORDER_H
@@ -9,13 +9,16 @@
 #include "freertos/FreeRTOS.h"
 #include "lvgl.h"
 #include "station_data.h"
+#include "station_health.h"
+#include "station_list_window.h"
+#include "ui_state.h"
+#include "visualizer.h"
 #include <stdlib.h>
 #include <string.h>
 
 extern int g_bitrate_kbps;
 extern int current_station;
 
-QueueHandle_t g_ui_queue;
 static const char *TAG = "SCREENS";
 
 static lv_obj_t *bitrate_label = NULL;
@@ -23,7 +26,26 @@ static lv_obj_t *callsign_label = NULL;
 static lv_obj_t *origin_label = NULL;
 static lv_obj_t *volume_slider = NULL;
 static lv_obj_t *mute_m_label = NULL;
-static lv_obj_t *station_roller = NULL;
+
+// Station list. Only the visible rows, plus one spare above and below for
+// the scroll animation, exist as labels; their text is taken from the
+// station table whenever the selection moves. Unlike an LVGL roller, whose
+// options string is laid out in full, cost and memory do not depend on the
+// number of stations. Stations the health prober found dead get a cross.
+#define STATION_LIST_ROW_HEIGHT 18
+#define STATION_LIST_ANIM_MS 120
+static lv_obj_t *station_list_track = NULL; // holds the rows, slides
+static lv_obj_t *station_list_rows[STATION_LIST_ROWS];
+static int station_list_selected = -1;
+
+// Visualizer, shown in place of the bitrate label
+#define VIS_HEIGHT 14
+#define VIS_BAR_WIDTH 5
+static lv_obj_t *spectrum_box = NULL;
+static lv_obj_t *spectrum_bars[VISUALIZER_BANDS];
+static lv_coord_t spectrum_heights[VISUALIZER_BANDS];
+static lv_obj_t *vu_box = NULL;
+static lv_obj_t *vu_bars[2];
 
 static lv_obj_t *home_screen_obj = NULL;
 static lv_obj_t *station_selection_screen_obj = NULL;
@@ -31,153 +53,327 @@ static lv_obj_t *station_selection_screen_obj = NULL;
 static lv_obj_t *message_screen_obj = NULL;
 static lv_obj_t *message_label = NULL;
 
+static lv_obj_t *search_screen_obj = NULL;
+static lv_obj_t *search_query_label = NULL;
+static lv_obj_t *search_results_label = NULL;
+
+// Versions of the UI state fields last applied to the widgets
+static uint32_t applied_int[UI_INT_FIELD_COUNT];
+static uint32_t applied_str[UI_STR_FIELD_COUNT];
+
 void update_bitrate_label(int bitrate) {
-  ui_update_message_t msg = {.type = UPDATE_BITRATE, .data.value = bitrate};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_BITRATE, bitrate);
+}
+
+void update_time_shift(bool paused, int behind_s) {
+  ui_state_set_int(UI_FIELD_PAUSED, paused);
+  ui_state_set_int(UI_FIELD_TIME_SHIFT, behind_s);
 }
 
 void update_station_name(const char *name) {
-  ui_update_message_t msg = {.type = UPDATE_STATION_NAME,
-                             .data.str_value = name};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_str(UI_FIELD_STATION_NAME, name);
 }
 
 void update_station_origin(const char *origin) {
-  ui_update_message_t msg = {.type = UPDATE_STATION_ORIGIN,
-                             .data.str_value = origin};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_str(UI_FIELD_STATION_ORIGIN, origin);
 }
 
 void update_volume_slider(int volume) {
-  ui_update_message_t msg = {.type = UPDATE_VOLUME, .data.value = volume};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_VOLUME, volume);
 }
 
 void update_station_roller(int new_station_index) {
-  ui_update_message_t msg = {.type = UPDATE_STATION_ROLLER,
-                             .data.value = new_station_index};
-  xQueueSend(g_ui_queue, &msg, 0);
-}
-void update_mute_state(bool muted) {
-  ui_update_message_t msg = {.type = UPDATE_MUTE_STATE, .data.value = muted};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_ROLLER, new_station_index);
 }
 
+void update_mute_state(bool muted) { ui_state_set_int(UI_FIELD_MUTE, muted); }
+
 void switch_to_provisioning_screen(void) {
-  ui_update_message_t msg = {.type = SWITCH_TO_PROVISIONING};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_PROVISIONING);
 }
 
 void switch_to_ip_screen(void) {
-  ui_update_message_t msg = {.type = SWITCH_TO_IP_SCREEN};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_IP);
 }
 
-void update_ip_label(const char *ip) {
-  ui_update_message_t msg = {.type = UPDATE_IP_LABEL, .data.str_value = ip};
-  xQueueSend(g_ui_queue, &msg, 0);
-}
+void update_ip_label(const char *ip) { ui_state_set_str(UI_FIELD_IP, ip); }
 
 void switch_to_reboot_screen(void) {
-  ui_update_message_t msg = {.type = SWITCH_TO_REBOOT_SCREEN};
-  xQueueSend(g_ui_queue, &msg, 0);
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_REBOOT);
+}
+
+void switch_to_home_screen(void) {
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_HOME);
+}
+
+void switch_to_station_selection_screen(void) {
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_STATION_SELECTION);
+}
+
+void switch_to_search_screen(void) {
+  ui_state_set_int(UI_FIELD_SCREEN, UI_SCREEN_SEARCH);
+}
+
+void update_search_query(const char *query) {
+  ui_state_set_str(UI_FIELD_SEARCH_QUERY, query);
+}
+
+void update_search_results(const char *results) {
+  ui_state_set_str(UI_FIELD_SEARCH_RESULTS, results);
+}
+
+// Returns true and the new value if an integer field changed since it was
+// last applied.
+static bool int_changed(ui_int_field_t field, int32_t *value) {
+  if (ui_state_int_version(field) == applied_int[field]) {
+    return false;
+  }
+  applied_int[field] = ui_state_get_int(field, value);
+  return true;
+}
+
+static bool str_changed(ui_str_field_t field, char *buf, size_t len) {
+  if (ui_state_str_version(field) == applied_str[field]) {
+    return false;
+  }
+  applied_str[field] = ui_state_get_str(field, buf, len);
+  return true;
+}
+
+static void place_mute_label(int volume) {
+  lv_coord_t h = lv_obj_get_height(volume_slider);
+  lv_coord_t label_h = lv_obj_get_height(mute_m_label);
+  lv_coord_t y = (h * (100 - volume / 2)) / 100 - (label_h / 2);
+  if (y < 0)
+    y = 0;
+  if (y > h - label_h)
+    y = h - label_h;
+  lv_obj_set_y(mute_m_label, y);
+}
+
+// Fills the rows around the selected station. Rows that would repeat a
+// station in a short list are hidden.
+static void fill_station_list(const station_snapshot_t *snapshot,
+                              int selected) {
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    lv_obj_t *row = station_list_rows[r];
+    int index = station_list_row_station(snapshot->count, selected, r);
+    if (index < 0) {
+      lv_label_set_text(row,
+                        r == STATION_LIST_CENTER_ROW ? "No stations" : "");
+      continue;
+    }
+    const station_t *st = &snapshot->stations[index];
+    if (station_health_is_dead(st->id)) {
+      lv_label_set_text_fmt(row, LV_SYMBOL_CLOSE " %s", st->call_sign);
+    } else {
+      lv_label_set_text(row, st->call_sign);
+    }
+  }
+  station_list_selected = selected;
+}
+
+static void station_list_anim_cb(void *var, int32_t y) {
+  lv_obj_set_y(var, y);
+}
+
+// Moves the selection; single steps slide the rows by one row height
+static void show_station_list(int selected, bool animate) {
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  int delta =
+      station_list_step(snapshot->count, station_list_selected, selected);
+  fill_station_list(snapshot, selected);
+  station_snapshot_release(snapshot);
+
+  lv_coord_t rest = -STATION_LIST_ROW_HEIGHT;
+  lv_anim_delete(station_list_track, station_list_anim_cb);
+  if (animate && (delta == 1 || delta == -1)) {
+    lv_anim_t a;
+    lv_anim_init(&a);
+    lv_anim_set_var(&a, station_list_track);
+    lv_anim_set_exec_cb(&a, station_list_anim_cb);
+    lv_anim_set_values(&a, rest + delta * STATION_LIST_ROW_HEIGHT, rest);
+    lv_anim_set_duration(&a, STATION_LIST_ANIM_MS);
+    lv_anim_set_path_cb(&a, lv_anim_path_ease_out);
+    lv_anim_start(&a);
+  } else {
+    lv_obj_set_y(station_list_track, rest);
+  }
+}
+
+static void apply_screen(ui_screen_t screen) {
+  switch (screen) {
+  case UI_SCREEN_HOME:
+    if (home_screen_obj)
+      lv_screen_load(home_screen_obj);
+    break;
+  case UI_SCREEN_STATION_SELECTION:
+    if (station_selection_screen_obj) {
+      // The list may have been replaced since the screen was last shown
+      int32_t selected;
+      ui_state_get_int(UI_FIELD_ROLLER, &selected);
+      show_station_list(selected, false);
+      lv_screen_load(station_selection_screen_obj);
+    }
+    break;
+  case UI_SCREEN_PROVISIONING:
+    if (message_screen_obj) {
+      lv_label_set_text(message_label, "Setup WIFI with\nESP BLE Prov\napp");
+      lv_screen_load(message_screen_obj);
+    }
+    break;
+  case UI_SCREEN_REBOOT:
+    if (message_screen_obj) {
+      lv_label_set_text(message_label, "Rebooting");
+      lv_screen_load(message_screen_obj);
+    }
+    break;
+  case UI_SCREEN_IP:
+    if (message_screen_obj) {
+      // The label text is owned by the IP field; force it to be reapplied
+      applied_str[UI_FIELD_IP] = ui_state_str_version(UI_FIELD_IP) - 1;
+      lv_screen_load(message_screen_obj);
+    }
+    break;
+  case UI_SCREEN_SEARCH:
+    if (search_screen_obj)
+      lv_screen_load(search_screen_obj);
+    break;
+  default:
+    ESP_LOGW(TAG, "Unknown screen: %d", screen);
+    break;
+  }
+}
+
+/* The bitrate, or while time-shifted how far behind live playback is */
+static void apply_bitrate_label(void) {
+  int32_t bitrate, paused, behind;
+  ui_state_get_int(UI_FIELD_BITRATE, &bitrate);
+  ui_state_get_int(UI_FIELD_PAUSED, &paused);
+  ui_state_get_int(UI_FIELD_TIME_SHIFT, &behind);
+  if (paused) {
+    lv_label_set_text(bitrate_label, "Paused");
+  } else if (behind > 0) {
+    lv_label_set_text_fmt(bitrate_label, "-%d:%02d", (int)(behind / 60),
+                          (int)(behind % 60));
+  } else {
+    lv_label_set_text_fmt(bitrate_label, "%d kb/s", (int)bitrate);
+  }
+}
+
+static void apply_visualizer_mode(visualizer_mode_t mode) {
+  if (mode == VISUALIZER_SPECTRUM) {
+    lv_obj_remove_flag(spectrum_box, LV_OBJ_FLAG_HIDDEN);
+  } else {
+    lv_obj_add_flag(spectrum_box, LV_OBJ_FLAG_HIDDEN);
+  }
+  if (mode == VISUALIZER_VU) {
+    lv_obj_remove_flag(vu_box, LV_OBJ_FLAG_HIDDEN);
+  } else {
+    lv_obj_add_flag(vu_box, LV_OBJ_FLAG_HIDDEN);
+  }
+  if (mode == VISUALIZER_OFF) {
+    lv_obj_remove_flag(bitrate_label, LV_OBJ_FLAG_HIDDEN);
+  } else {
+    lv_obj_add_flag(bitrate_label, LV_OBJ_FLAG_HIDDEN);
+  }
+}
+
+static void apply_visualizer_frame(visualizer_mode_t mode) {
+  visualizer_frame_t frame;
+  visualizer_get_frame(&frame);
+  if (mode == VISUALIZER_SPECTRUM) {
+    for (int b = 0; b < VISUALIZER_BANDS; b++) {
+      // Bars at least one pixel high so the baseline stays visible
+      lv_coord_t h =
+          1 + frame.bands[b] * (VIS_HEIGHT - 1) / VISUALIZER_LEVEL_MAX;
+      // Unchanged bars are not invalidated
+      if (spectrum_heights[b] != h) {
+        spectrum_heights[b] = h;
+        lv_obj_set_height(spectrum_bars[b], h);
+      }
+    }
+  } else if (mode == VISUALIZER_VU) {
+    for (int ch = 0; ch < 2; ch++) {
+      lv_bar_set_value(vu_bars[ch], frame.vu[ch], LV_ANIM_OFF);
+    }
+  }
 }
 
 void process_ui_updates(void) {
-  // Defensive check to ensure the queue has been created.
-  if (g_ui_queue == NULL) {
+  // Defensive check to ensure the widgets have been created.
+  if (home_screen_obj == NULL) {
     return;
   }
 
-  ui_update_message_t msg;
-  while (xQueueReceive(g_ui_queue, &msg, 0) == pdTRUE) {
-    switch (msg.type) {
-    case UPDATE_BITRATE:
-      if (bitrate_label)
-        lv_label_set_text_fmt(bitrate_label, "%d kb/s", msg.data.value);
-      break;
-    case UPDATE_STATION_NAME:
-      if (callsign_label)
-        lv_label_set_text(callsign_label, msg.data.str_value);
-      break;
-    case UPDATE_STATION_ORIGIN:
-      if (origin_label)
-        lv_label_set_text(origin_label, msg.data.str_value);
-      break;
-    case UPDATE_VOLUME:
-      if (volume_slider) {
-        lv_slider_set_value(volume_slider, msg.data.value, LV_ANIM_ON);
-        // Update Mute M position if it exists and is not hidden
-        if (mute_m_label) {
-          lv_coord_t h = lv_obj_get_height(volume_slider);
-          lv_coord_t label_h = lv_obj_get_height(mute_m_label);
-          lv_coord_t y = (h * (100 - msg.data.value / 2)) / 100 - (label_h / 2);
-          if (y < 0) y = 0;
-          if (y > h - label_h) y = h - label_h;
-          lv_obj_set_y(mute_m_label, y);
-        }
-      }
-      break;
-    case UPDATE_STATION_ROLLER:
-      if (station_roller)
-        lv_roller_set_selected(station_roller, msg.data.value, LV_ANIM_ON);
-      break;
-    case SWITCH_TO_HOME:
-      if (home_screen_obj)
-        lv_screen_load(home_screen_obj);
-      break;
-    case SWITCH_TO_STATION_SELECTION:
-      if (station_selection_screen_obj)
-        lv_screen_load(station_selection_screen_obj);
-      break;
-    case SWITCH_TO_PROVISIONING:
-      if (message_screen_obj) {
-        lv_label_set_text(message_label, "Setup WIFI with\nESP BLE Prov\napp");
-        lv_screen_load(message_screen_obj);
-      }
-      break;
-    // ... inside process_ui_updates default/switch ...
-    case SWITCH_TO_REBOOT_SCREEN:
-      if (message_screen_obj) {
-        lv_label_set_text(message_label, "Rebooting");
-        lv_screen_load(message_screen_obj);
-      }
-      break;
-    case SWITCH_TO_IP_SCREEN:
-      if (message_screen_obj) {
-        // IP text is usually updated via UPDATE_IP_LABEL, but we can set a
-        // placeholder if needed or just keep the previous text if we want to be
-        // safe, but typically we want to clear or set placeholder
-        // lv_label_set_text(message_label, "IP Address:\n...");
-        lv_screen_load(message_screen_obj);
-      }
-      break;
-    case UPDATE_IP_LABEL:
-      if (message_label)
-        lv_label_set_text(message_label, msg.data.str_value);
-      break;
-    case UPDATE_MUTE_STATE:
-      if (mute_m_label) {
-        if (msg.data.value) {
-          lv_obj_remove_flag(mute_m_label, LV_OBJ_FLAG_HIDDEN);
-          // Ensure position is correct when showing
-          lv_coord_t h = lv_obj_get_height(volume_slider);
-          int vol = lv_slider_get_value(volume_slider);
-          lv_coord_t label_h = lv_obj_get_height(mute_m_label);
-          lv_coord_t y = (h * (100 - vol / 2)) / 100 - (label_h / 2);
-          if (y < 0) y = 0;
-          if (y > h - label_h) y = h - label_h;
-          lv_obj_set_y(mute_m_label, y);
-        } else {
-          lv_obj_add_flag(mute_m_label, LV_OBJ_FLAG_HIDDEN);
-        }
-      }
-      break;
-    default:
-      ESP_LOGW(TAG, "Unknown UI update type: %d", msg.type);
-      break;
+  int32_t value;
+  char text[UI_STATE_STR_MAX];
+  int32_t screen;
+  ui_state_get_int(UI_FIELD_SCREEN, &screen);
+
+  if (int_changed(UI_FIELD_SCREEN, &screen)) {
+    apply_screen((ui_screen_t)screen);
+  }
+  // Bitwise or: each field must be marked applied
+  if ((int_changed(UI_FIELD_BITRATE, &value) |
+       int_changed(UI_FIELD_PAUSED, &value) |
+       int_changed(UI_FIELD_TIME_SHIFT, &value)) &&
+      bitrate_label) {
+    apply_bitrate_label();
+  }
+  if (str_changed(UI_FIELD_STATION_NAME, text, sizeof(text)) &&
+      callsign_label) {
+    lv_label_set_text(callsign_label, text);
+  }
+  if (str_changed(UI_FIELD_STATION_ORIGIN, text, sizeof(text)) &&
+      origin_label) {
+    lv_label_set_text(origin_label, text);
+  }
+  // Volume before mute: the mute indicator is placed on the slider
+  if (int_changed(UI_FIELD_VOLUME, &value) && volume_slider) {
+    lv_slider_set_value(volume_slider, value, LV_ANIM_ON);
+    // Update Mute M position if it exists and is not hidden
+    if (mute_m_label) {
+      place_mute_label(value);
+    }
+  }
+  if (int_changed(UI_FIELD_MUTE, &value) && mute_m_label) {
+    if (value) {
+      lv_obj_remove_flag(mute_m_label, LV_OBJ_FLAG_HIDDEN);
+      // Ensure position is correct when showing
+      place_mute_label(lv_slider_get_value(volume_slider));
+    } else {
+      lv_obj_add_flag(mute_m_label, LV_OBJ_FLAG_HIDDEN);
     }
   }
+  if (int_changed(UI_FIELD_ROLLER, &value) && station_list_track) {
+    show_station_list(value, screen == UI_SCREEN_STATION_SELECTION);
+  }
+  int32_t vis_mode;
+  ui_state_get_int(UI_FIELD_VISUALIZER_MODE, &vis_mode);
+  if (int_changed(UI_FIELD_VISUALIZER_MODE, &vis_mode)) {
+    apply_visualizer_mode((visualizer_mode_t)vis_mode);
+  }
+  // Only draw frames the user can see; the analyzer skips while the previous
+  // frame has not been taken
+  if (int_changed(UI_FIELD_VISUALIZER_FRAME, &value) &&
+      screen == UI_SCREEN_HOME) {
+    apply_visualizer_frame((visualizer_mode_t)vis_mode);
+  }
+  if (str_changed(UI_FIELD_SEARCH_QUERY, text, sizeof(text)) &&
+      search_query_label) {
+    lv_label_set_text(search_query_label, text);
+  }
+  if (str_changed(UI_FIELD_SEARCH_RESULTS, text, sizeof(text)) &&
+      search_results_label) {
+    lv_label_set_text(search_results_label, text);
+  }
+  // The message label shows the IP only while the IP screen is up; the other
+  // message screens set their own text.
+  if (screen == UI_SCREEN_IP &&
+      str_changed(UI_FIELD_IP, text, sizeof(text)) && message_label) {
+    lv_label_set_text(message_label, text);
+  }
 }
 
 static void create_home_screen_widgets(lv_obj_t *parent) {
@@ -276,39 +472,78 @@ static void create_home_screen_widgets(lv_obj_t *parent) {
   lv_obj_set_style_text_font(bitrate_label, &lv_font_montserrat_14,
                              0); // Use default font for smaller text
   lv_obj_set_style_text_letter_space(bitrate_label, 1, 0);
+
+  // Spectrum bars, bottom aligned
+  spectrum_box = lv_obj_create(text_container);
+  lv_obj_remove_style_all(spectrum_box);
+  lv_obj_set_size(spectrum_box, lv_pct(100), VIS_HEIGHT);
+  lv_obj_set_flex_flow(spectrum_box, LV_FLEX_FLOW_ROW);
+  lv_obj_set_flex_align(spectrum_box, LV_FLEX_ALIGN_SPACE_EVENLY,
+                        LV_FLEX_ALIGN_END, LV_FLEX_ALIGN_END);
+  for (int b = 0; b < VISUALIZER_BANDS; b++) {
+    spectrum_bars[b] = lv_obj_create(spectrum_box);
+    lv_obj_remove_style_all(spectrum_bars[b]);
+    lv_obj_set_size(spectrum_bars[b], VIS_BAR_WIDTH, 1);
+    spectrum_heights[b] = 1;
+    lv_obj_set_style_bg_opa(spectrum_bars[b], LV_OPA_COVER, 0);
+    lv_obj_set_style_bg_color(spectrum_bars[b],
+                              lv_palette_main(LV_PALETTE_BLUE), 0);
+  }
+  lv_obj_add_flag(spectrum_box, LV_OBJ_FLAG_HIDDEN);
+
+  // Stereo VU meter: two horizontal bars
+  vu_box = lv_obj_create(text_container);
+  lv_obj_remove_style_all(vu_box);
+  lv_obj_set_size(vu_box, lv_pct(100), VIS_HEIGHT);
+  lv_obj_set_flex_flow(vu_box, LV_FLEX_FLOW_COLUMN);
+  lv_obj_set_flex_align(vu_box, LV_FLEX_ALIGN_SPACE_EVENLY,
+                        LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
+  for (int ch = 0; ch < 2; ch++) {
+    vu_bars[ch] = lv_bar_create(vu_box);
+    lv_obj_set_size(vu_bars[ch], lv_pct(100), 5);
+    lv_bar_set_range(vu_bars[ch], 0, VISUALIZER_LEVEL_MAX);
+    lv_obj_set_style_bg_opa(vu_bars[ch], LV_OPA_TRANSP, LV_PART_MAIN);
+    lv_obj_set_style_bg_color(vu_bars[ch], lv_palette_main(LV_PALETTE_BLUE),
+                              LV_PART_INDICATOR);
+  }
+  lv_obj_add_flag(vu_box, LV_OBJ_FLAG_HIDDEN);
 }
 
 static void create_station_selection_screen_widgets(lv_obj_t *parent) {
-
-  // Build the options string for the roller
-  char roller_options[1024] = {0}; // Make sure this is large enough
-  for (int i = 0; i < station_count; i++) {
-    strcat(roller_options, radio_stations[i].call_sign);
-    if (i < station_count - 1) {
-      strcat(roller_options, "\n");
+  // Clip window showing STATION_LIST_VISIBLE rows
+  lv_obj_t *window = lv_obj_create(parent);
+  lv_obj_remove_style_all(window);
+  lv_obj_set_size(window, lv_pct(80),
+                  STATION_LIST_VISIBLE * STATION_LIST_ROW_HEIGHT);
+  lv_obj_center(window);
+  lv_obj_remove_flag(window, LV_OBJ_FLAG_SCROLLABLE);
+
+  station_list_track = lv_obj_create(window);
+  lv_obj_remove_style_all(station_list_track);
+  lv_obj_set_size(station_list_track, lv_pct(100),
+                  STATION_LIST_ROWS * STATION_LIST_ROW_HEIGHT);
+  lv_obj_set_flex_flow(station_list_track, LV_FLEX_FLOW_COLUMN);
+  lv_obj_set_flex_align(station_list_track, LV_FLEX_ALIGN_START,
+                        LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
+  lv_obj_set_y(station_list_track, -STATION_LIST_ROW_HEIGHT);
+
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    lv_obj_t *row = lv_label_create(station_list_track);
+    lv_obj_set_size(row, lv_pct(100), STATION_LIST_ROW_HEIGHT);
+    lv_label_set_long_mode(row, LV_LABEL_LONG_CLIP);
+    lv_obj_set_style_text_align(row, LV_TEXT_ALIGN_CENTER, 0);
+    lv_obj_set_style_text_font(row, &lv_font_montserrat_14, 0);
+    lv_obj_set_style_text_letter_space(row, 1, 0);
+    if (r == STATION_LIST_CENTER_ROW) {
+      lv_obj_set_style_text_color(row, lv_palette_main(LV_PALETTE_BLUE), 0);
     }
+    station_list_rows[r] = row;
   }
 
-  /*Create a roller*/
-  station_roller = lv_roller_create(parent);
-  lv_roller_set_options(station_roller, roller_options,
-                        LV_ROLLER_MODE_INFINITE);
-
-  lv_roller_set_visible_row_count(station_roller, 3);
-  lv_obj_set_width(station_roller, lv_pct(80));
-  lv_obj_center(station_roller);
-
-  // Use a smaller font and remove the inverted selection style
-  lv_obj_set_style_text_font(station_roller, &lv_font_montserrat_14, 0);
-  lv_obj_set_style_bg_opa(station_roller, LV_OPA_TRANSP, LV_PART_SELECTED);
-  lv_obj_set_style_text_color(station_roller, lv_palette_main(LV_PALETTE_BLUE),
-                              LV_PART_SELECTED);
-  lv_obj_set_style_text_line_space(station_roller, 2,
-                                   0); // Reduce space between items
-  lv_obj_set_style_text_letter_space(station_roller, 1, 0);
-
   // Set initial station
-  lv_roller_set_selected(station_roller, current_station, LV_ANIM_ON);
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  fill_station_list(snapshot, current_station);
+  station_snapshot_release(snapshot);
 
   // build gnomon
   static lv_point_precise_t line_points[] = {{0, 32}, {32, 32}};
@@ -330,9 +565,6 @@ static void create_station_selection_screen_widgets(lv_obj_t *parent) {
   lv_obj_add_style(line2, &style_line, 0);
   lv_obj_align(line1, LV_ALIGN_LEFT_MID, 0, -15);
   lv_obj_align(line2, LV_ALIGN_RIGHT_MID, 0, -15);
-
-  // // Event handler for when the roller value changes
-  // lv_obj_add_event_cb(station_roller, event_handler, LV_EVENT_ALL, NULL);
 }
 
 static void create_message_screen_widgets(lv_obj_t *parent) {
@@ -345,26 +577,40 @@ static void create_message_screen_widgets(lv_obj_t *parent) {
   lv_obj_center(message_label);
 }
 
+static void create_search_screen_widgets(lv_obj_t *parent) {
+  // Query on top, underlined, best matches below
+  search_query_label = lv_label_create(parent);
+  lv_label_set_text(search_query_label, "");
+  lv_obj_set_width(search_query_label, lv_pct(100));
+  lv_label_set_long_mode(search_query_label, LV_LABEL_LONG_CLIP);
+  lv_obj_set_style_text_font(search_query_label, &lv_font_montserrat_14, 0);
+  lv_obj_set_style_text_letter_space(search_query_label, 1, 0);
+  lv_obj_set_style_border_side(search_query_label, LV_BORDER_SIDE_BOTTOM, 0);
+  lv_obj_set_style_border_width(search_query_label, 1, 0);
+  lv_obj_set_style_border_color(search_query_label,
+                                lv_palette_main(LV_PALETTE_BLUE), 0);
+  lv_obj_align(search_query_label, LV_ALIGN_TOP_LEFT, 0, 0);
+
+  search_results_label = lv_label_create(parent);
+  lv_label_set_text(search_results_label, "");
+  lv_obj_set_width(search_results_label, lv_pct(100));
+  lv_label_set_long_mode(search_results_label, LV_LABEL_LONG_CLIP);
+  lv_obj_set_style_text_font(search_results_label, &lv_font_montserrat_12, 0);
+  lv_obj_set_style_text_line_space(search_results_label, 1, 0);
+  lv_obj_align(search_results_label, LV_ALIGN_TOP_LEFT, 0, 18);
+}
+
 void screens_init(lv_display_t *disp) {
-  g_ui_queue = xQueueCreate(10, sizeof(ui_update_message_t));
   home_screen_obj = lv_obj_create(NULL);
   station_selection_screen_obj = lv_obj_create(NULL);
   message_screen_obj = lv_obj_create(NULL);
+  search_screen_obj = lv_obj_create(NULL);
 
   create_home_screen_widgets(home_screen_obj);
   create_station_selection_screen_widgets(station_selection_screen_obj);
   create_message_screen_widgets(message_screen_obj);
+  create_search_screen_widgets(search_screen_obj);
 
   // Start on the home screen
   lv_screen_load(home_screen_obj);
 }
-
-void switch_to_home_screen(void) {
-  ui_update_message_t msg = {.type = SWITCH_TO_HOME};
-  xQueueSend(g_ui_queue, &msg, 0);
-}
-
-void switch_to_station_selection_screen(void) {
-  ui_update_message_t msg = {.type = SWITCH_TO_STATION_SELECTION};
-  xQueueSend(g_ui_queue, &msg, 0);
-}
\ No newline at end of file
@@ -1,38 +1,25 @@
 #ifndef SCREENS_H
 #define SCREENS_H
 
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
 #include "lvgl.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * @brief Screens selectable through the UI state.
+ */
 typedef enum {
-  UPDATE_BITRATE,
-  UPDATE_STATION_NAME,
-  UPDATE_STATION_ORIGIN,
-  UPDATE_VOLUME,
-  UPDATE_STATION_ROLLER,
-  SWITCH_TO_HOME,
-  SWITCH_TO_STATION_SELECTION,
-  SWITCH_TO_PROVISIONING,
-  SWITCH_TO_IP_SCREEN,
-  SWITCH_TO_REBOOT_SCREEN,
-  UPDATE_IP_LABEL,
-  UPDATE_MUTE_STATE
-} ui_update_type_t;
-
-typedef struct {
-  ui_update_type_t type;
-  union {
-    int value;
-    const char *str_value;
-  } data;
-} ui_update_message_t;
-
-extern QueueHandle_t g_ui_queue;
+  UI_SCREEN_HOME,
+  UI_SCREEN_STATION_SELECTION,
+  UI_SCREEN_PROVISIONING,
+  UI_SCREEN_IP,
+  UI_SCREEN_REBOOT,
+  UI_SCREEN_SEARCH,
+} ui_screen_t;
+
 /**
  * @brief Initializes all UI screens.
  * @param disp Pointer to the LVGL display.
@@ -40,7 +27,8 @@ extern QueueHandle_t g_ui_queue;
 void screens_init(lv_display_t *disp);
 
 /**
- * @brief Processes all pending UI update messages from the queue.
+ * @brief Applies the UI state fields that changed since the last call.
+ * Must be called from the LVGL task.
  */
 void process_ui_updates(void);
 
@@ -69,6 +57,23 @@ void switch_to_ip_screen(void);
  */
 void switch_to_reboot_screen(void);
 
+/**
+ * @brief Switches the active view to the type-ahead search screen.
+ */
+void switch_to_search_screen(void);
+
+/**
+ * @brief Updates the query line of the search screen.
+ * @param query The query as it should be displayed.
+ */
+void update_search_query(const char *query);
+
+/**
+ * @brief Updates the result lines of the search screen.
+ * @param results Newline separated matches.
+ */
+void update_search_results(const char *results);
+
 /**
  * @brief Updates the station name label on the screen.
  * @param name The new station name to display.
@@ -87,6 +92,14 @@ void update_station_origin(const char *origin);
  */
 void update_bitrate_label(int bitrate);
 
+/**
+ * @brief Shows the time-shift state in place of the bitrate while playback
+ * is paused or behind the live stream.
+ * @param paused Whether playback is paused.
+ * @param behind_s How far playback is behind the live stream, in seconds.
+ */
+void update_time_shift(bool paused, int behind_s);
+
 /**
  * @brief Updates the volume slider on the screen.
  * @param volume The new volume value (0-100).
@@ -104,6 +117,11 @@ void update_station_roller(int new_station_index);
  * @param ip The IP address string.
  */
 void update_ip_label(const char *ip);
+
+/**
+ * @brief Shows or hides the mute indicator.
+ * @param muted The new mute state.
+ */
 void update_mute_state(bool muted);
 
 #ifdef __cplusplus
@@ -0,0 +1,40 @@
+#include "sd_card.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdcard.h"
+
+static const char *TAG = "SD_CARD";
+
+static portMUX_TYPE create_lock = portMUX_INITIALIZER_UNLOCKED;
+static StaticSemaphore_t mount_lock_buf;
+static SemaphoreHandle_t mount_lock = NULL;
+static volatile bool mounted = false;
+
+esp_err_t sd_card_mount(void) {
+  if (mounted) {
+    return ESP_OK;
+  }
+  // Mounting takes a while; callers in other tasks wait for the first
+  portENTER_CRITICAL(&create_lock);
+  if (mount_lock == NULL) {
+    mount_lock = xSemaphoreCreateMutexStatic(&mount_lock_buf);
+  }
+  portEXIT_CRITICAL(&create_lock);
+
+  xSemaphoreTake(mount_lock, portMAX_DELAY);
+  esp_err_t err = ESP_OK;
+  if (!mounted) {
+    err = sdcard_mount(SD_CARD_MOUNT_POINT, SD_MODE_1_LINE);
+    if (err == ESP_OK) {
+      mounted = true;
+      ESP_LOGI(TAG, "SD card mounted at %s", SD_CARD_MOUNT_POINT);
+    } else {
+      ESP_LOGW(TAG, "No SD card: %s", esp_err_to_name(err));
+    }
+  }
+  xSemaphoreGive(mount_lock);
+  return err;
+}
+
+bool sd_card_is_mounted(void) { return mounted; }
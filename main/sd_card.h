@@ -0,0 +1,38 @@
+#ifndef SD_CARD_H
+#define SD_CARD_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The SD card, shared by the recorder and local playback
+ *
+ * SDMMC in 1-line mode (pins in gpio_assignments.h), FAT, mounted at
+ * SD_CARD_MOUNT_POINT by whichever user needs it first and never unmounted.
+ */
+
+// The host tests use a scratch directory
+#ifndef SD_CARD_MOUNT_POINT
+#define SD_CARD_MOUNT_POINT "/sdcard"
+#endif
+
+/**
+ * @brief Mounts the card unless it is mounted already. A card that was
+ * missing is looked for again on the next call.
+ */
+esp_err_t sd_card_mount(void);
+
+/**
+ * @brief Whether the card is mounted.
+ */
+bool sd_card_is_mounted(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SD_CARD_H
@@ -0,0 +1,66 @@
+#include "ssd1306_frame.h"
+#include <stddef.h>
+#include <string.h>
+
+/* Transposes an 8x8 bit block. rows[y] holds 8 horizontal pixels, MSB first
+   (LVGL I1). cols[x] receives 8 vertical pixels, LSB = top row (SSD1306 page
+   byte). Three delta swaps on a 64 bit word instead of 64 single bit moves. */
+static inline void transpose8x8(const uint8_t *rows, size_t stride,
+                                uint8_t *cols) {
+  // Row 7 goes in the most significant byte so that bit y of each result byte
+  // comes from row y.
+  uint64_t x = 0;
+  for (int y = 7; y >= 0; y--) {
+    x = (x << 8) | rows[stride * y];
+  }
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x ^= t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x ^= t ^ (t << 28);
+  // Column 0 (leftmost pixel) ends up in the most significant byte. LVGL's
+  // "set" bit is the dark pixel, so invert for the panel.
+  for (int i = 7; i >= 0; i--) {
+    cols[i] = (uint8_t)~x;
+    x >>= 8;
+  }
+}
+
+void ssd1306_frame_convert(const uint8_t *px_map, uint8_t *frame) {
+  const size_t stride = SSD1306_FRAME_WIDTH / 8;
+  for (int page = 0; page < SSD1306_FRAME_PAGES; page++) {
+    const uint8_t *rows = px_map + stride * 8 * page;
+    uint8_t *cols = frame + SSD1306_PAGE_BYTES * page;
+    for (size_t bx = 0; bx < stride; bx++) {
+      transpose8x8(rows + bx, stride, cols + 8 * bx);
+    }
+  }
+}
+
+static bool page_dirty(const uint8_t *frame, const uint8_t *sent, int page) {
+  return sent == NULL || memcmp(frame + SSD1306_PAGE_BYTES * page,
+                                sent + SSD1306_PAGE_BYTES * page,
+                                SSD1306_PAGE_BYTES) != 0;
+}
+
+int ssd1306_frame_dirty_runs(const uint8_t *frame, const uint8_t *sent,
+                             ssd1306_run_t *runs) {
+  int count = 0;
+  int page = 0;
+  while (page < SSD1306_FRAME_PAGES) {
+    if (!page_dirty(frame, sent, page)) {
+      page++;
+      continue;
+    }
+    int first = page;
+    while (page < SSD1306_FRAME_PAGES && page_dirty(frame, sent, page)) {
+      page++;
+    }
+    runs[count].first = (uint8_t)first;
+    runs[count].end = (uint8_t)page;
+    count++;
+  }
+  return count;
+}
@@ -0,0 +1,57 @@
+#ifndef SSD1306_FRAME_H
+#define SSD1306_FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SSD1306 frames: LVGL's 1 bit frame in the panel's page layout, and which
+ * pages of it changed
+ *
+ * The panel is written in pages: 8 pixel rows, one byte per column with
+ * the top row in the least significant bit. LVGL renders rows of pixels,
+ * 8 per byte with the leftmost in the most significant bit. The flush
+ * callback in lvgl_ssd1306_setup.c converts each frame and sends only the
+ * runs of pages that differ from the frame the panel already shows.
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+#define SSD1306_FRAME_WIDTH 128
+#define SSD1306_FRAME_HEIGHT 64
+#define SSD1306_FRAME_PAGES (SSD1306_FRAME_HEIGHT / 8)
+#define SSD1306_PAGE_BYTES SSD1306_FRAME_WIDTH
+#define SSD1306_FRAME_BYTES (SSD1306_PAGE_BYTES * SSD1306_FRAME_PAGES)
+
+/**
+ * @brief Consecutive changed pages, [first, end).
+ */
+typedef struct {
+  uint8_t first;
+  uint8_t end;
+} ssd1306_run_t;
+
+/**
+ * @brief Converts an LVGL I1 frame (palette skipped) to page layout. LVGL's
+ * set bit is a dark pixel, so pixels are inverted for the panel.
+ */
+void ssd1306_frame_convert(const uint8_t *px_map, uint8_t *frame);
+
+/**
+ * @brief Finds the runs of pages of frame that differ from sent, every page
+ * in one run if sent is NULL (panel content unknown).
+ * @param runs Room for SSD1306_FRAME_PAGES runs.
+ * @return Number of runs, 0 if nothing changed.
+ */
+int ssd1306_frame_dirty_runs(const uint8_t *frame, const uint8_t *sent,
+                             ssd1306_run_t *runs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SSD1306_FRAME_H
@@ -1,7 +1,17 @@
 #include "station_data.h"
-#include "cJSON.h"
+#include "decoder_registry.h"
 #include "esp_log.h"
 #include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "json_stream.h"
+#include "station_image.h"
+#include "station_index.h"
+#include "station_store.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +19,171 @@
 
 static const char *TAG = "STATION_DATA";
 #define STORAGE_BASE_PATH "/spiffs"
-#define STATION_FILE "/spiffs/stations.json"
+// Older firmware kept the list as JSON; imported once, then left alone
+#define LEGACY_STATION_FILE "/spiffs/stations.json"
+
+// A published station list and the storage it owns. pub comes first so a
+// station_snapshot_t pointer converts back to its node.
+typedef struct snapshot_node {
+  station_snapshot_t pub;
+  atomic_int refs;             // references held by readers
+  station_t *stations;         // pointers into image's arena
+  station_image_t image;       // backing store of every string
+  uint32_t *by_id;             // station indices sorted by id
+  station_index_t *index;      // search index
+  struct snapshot_node *retired_next;
+} snapshot_node_t;
+
+// Stands in for the list before the first one is installed; never retired
+static snapshot_node_t empty_snapshot;
+static _Atomic(snapshot_node_t *) current_snapshot = &empty_snapshot;
+// Readers between loading current_snapshot and counting their reference.
+// While this is non-zero a retired snapshot with no references may still be
+// about to get one, so nothing is freed.
+static atomic_int acquiring = 0;
+// Set by a reclaim that found a reader in that window; the last reader out
+// of it reclaims again
+static atomic_bool reclaim_pending = false;
+// Replaced snapshots, freed once unreferenced and past the grace period
+static snapshot_node_t *retired_list = NULL;
+static portMUX_TYPE retired_lock = portMUX_INITIALIZER_UNLOCKED;
+// A reclaim is running, and another was asked for meanwhile; under
+// retired_lock
+static bool reclaiming = false;
+static bool reclaim_again = false;
+// Serializes writers: installing a list and saving it
+static SemaphoreHandle_t writer_lock = NULL;
+
+// The list as last loaded or saved, for writing only the differences. Holds
+// a reference; the same snapshot as current while nothing is unsaved.
+static const station_snapshot_t *saved_snapshot = NULL;
+
+static void snapshot_free(snapshot_node_t *node) {
+  station_index_free(node->index);
+  free(node->by_id);
+  free(node->stations);
+  station_image_free(&node->image);
+  free(node);
+}
+
+// Frees the retired snapshots nobody references. One reclaim runs at a
+// time; a reclaim asked for meanwhile, say by a release whose snapshot was
+// detached here, makes it go round again. If a reader is inside the acquire
+// window nothing is freed, and the reclaim is left to that reader.
+static void snapshot_reclaim(void) {
+  taskENTER_CRITICAL(&retired_lock);
+  if (reclaiming) {
+    reclaim_again = true;
+    taskEXIT_CRITICAL(&retired_lock);
+    return;
+  }
+  reclaiming = true;
+  bool done = false;
+  while (!done) {
+    reclaim_again = false;
+    snapshot_node_t *list = retired_list;
+    retired_list = NULL;
+    taskEXIT_CRITICAL(&retired_lock);
+
+    // Checked after detaching: every reader that loaded one of these
+    // snapshots as current has either counted its reference by now or is
+    // still in the window
+    bool quiet = list == NULL || atomic_load(&acquiring) == 0;
+    snapshot_node_t *keep = NULL;
+    while (list != NULL) {
+      snapshot_node_t *next = list->retired_next;
+      if (quiet && atomic_load(&list->refs) == 0) {
+        snapshot_free(list);
+      } else {
+        list->retired_next = keep;
+        keep = list;
+      }
+      list = next;
+    }
+    // Set before looking again, so a reader still in the window sees it on
+    // the way out; if none is, this goes round again
+    done = quiet;
+    if (!quiet) {
+      atomic_store(&reclaim_pending, true);
+      done = atomic_load(&acquiring) != 0;
+    }
+
+    taskENTER_CRITICAL(&retired_lock);
+    if (keep != NULL) {
+      snapshot_node_t *tail = keep;
+      while (tail->retired_next != NULL) {
+        tail = tail->retired_next;
+      }
+      tail->retired_next = retired_list;
+      retired_list = keep;
+    }
+    done = done && !reclaim_again;
+  }
+  reclaiming = false;
+  taskEXIT_CRITICAL(&retired_lock);
+}
+
+const station_snapshot_t *station_snapshot_acquire(void) {
+  atomic_fetch_add(&acquiring, 1);
+  snapshot_node_t *node = atomic_load(&current_snapshot);
+  atomic_fetch_add(&node->refs, 1);
+  if (atomic_fetch_sub(&acquiring, 1) == 1 &&
+      atomic_load(&reclaim_pending) &&
+      atomic_exchange(&reclaim_pending, false)) {
+    snapshot_reclaim();
+  }
+  return &node->pub;
+}
+
+void station_snapshot_release(const station_snapshot_t *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+  snapshot_node_t *node = (snapshot_node_t *)snapshot;
+  // node may be freed by anyone once the count drops; not touched after
+  if (atomic_fetch_sub(&node->refs, 1) == 1) {
+    snapshot_reclaim();
+  }
+}
 
-station_t *radio_stations = NULL;
-int station_count = 0;
+int station_snapshot_find_id(const station_snapshot_t *snapshot, uint32_t id) {
+  const snapshot_node_t *node = (const snapshot_node_t *)snapshot;
+  int lo = 0, hi = snapshot->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    uint32_t mid_id = node->stations[node->by_id[mid]].id;
+    if (mid_id < id) {
+      lo = mid + 1;
+    } else if (mid_id > id) {
+      hi = mid;
+    } else {
+      return node->by_id[mid];
+    }
+  }
+  return -1;
+}
+
+static void writer_enter(void) {
+  if (writer_lock == NULL) {
+    writer_lock = xSemaphoreCreateMutex();
+  }
+  xSemaphoreTake(writer_lock, portMAX_DELAY);
+}
+
+static void writer_exit(void) { xSemaphoreGive(writer_lock); }
+
+// Makes node the current list and retires the old one. Called with the
+// writer lock held.
+static void snapshot_publish(snapshot_node_t *node) {
+  snapshot_node_t *old = atomic_exchange(&current_snapshot, node);
+  if (old != &empty_snapshot) {
+    taskENTER_CRITICAL(&retired_lock);
+    old->retired_next = retired_list;
+    retired_list = old;
+    taskEXIT_CRITICAL(&retired_lock);
+  }
+  snapshot_reclaim();
+}
 
 // Temporary structure for defaults to avoid const warnings with the main struct
 typedef struct {
@@ -69,8 +240,82 @@ static const default_station_t default_stations[] = {
 static const int default_station_count =
     sizeof(default_stations) / sizeof(default_stations[0]);
 
-static void load_stations_from_file(void);
-static void create_default_station_file(void);
+static esp_err_t load_legacy_json(void);
+static esp_err_t install_defaults(void);
+
+// List being sorted by compare_by_id; install_image holds the writer lock
+static const station_t *sort_stations;
+
+static int compare_by_id(const void *a, const void *b) {
+  const station_t *stations = sort_stations;
+  uint32_t ia = stations[*(const uint32_t *)a].id;
+  uint32_t ib = stations[*(const uint32_t *)b].id;
+  return ia < ib ? -1 : ia > ib;
+}
+
+// Makes an image the live station list. The station_t array is one block of
+// pointers into the image arena, so there is no per-station allocation. The
+// id table and search index are built here, before publishing, so readers
+// never see a list without them.
+static esp_err_t install_image(station_image_t *image) {
+  uint32_t count = image->header->count;
+  snapshot_node_t *node = calloc(1, sizeof(snapshot_node_t));
+  if (node == NULL) {
+    station_image_free(image);
+    return ESP_ERR_NO_MEM;
+  }
+  node->image = *image;
+  if (count > 0) {
+    node->stations = malloc(sizeof(station_t) * count);
+    node->by_id = malloc(sizeof(uint32_t) * count);
+    if (node->stations == NULL || node->by_id == NULL) {
+      ESP_LOGE(TAG, "Failed to allocate station table");
+      snapshot_free(node);
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  // Held from here so concurrent installs publish in the order they built
+  writer_enter();
+  for (uint32_t i = 0; i < count; i++) {
+    const station_record_t *rec = &image->records[i];
+    // The arena is read-only in practice; station_t keeps char * for API
+    // compatibility
+    node->stations[i].id = rec->id;
+    node->stations[i].call_sign =
+        (char *)station_image_str(image, rec->call_sign_off);
+    node->stations[i].origin =
+        (char *)station_image_str(image, rec->origin_off);
+    node->stations[i].uri = (char *)station_image_str(image, rec->uri_off);
+    node->stations[i].codec = (codec_type_t)rec->codec;
+    node->by_id[i] = i;
+  }
+  sort_stations = node->stations;
+  qsort(node->by_id, count, sizeof(uint32_t), compare_by_id);
+  // A failure is logged; searches find nothing until the next install
+  node->index = station_index_build(node->stations, count);
+
+  node->pub.stations = node->stations;
+  node->pub.count = count;
+  node->pub.version = image->header->crc32;
+  node->pub.index = node->index;
+  snapshot_publish(node);
+  writer_exit();
+  return ESP_OK;
+}
+
+esp_err_t station_data_install(station_image_t *image) {
+  return install_image(image);
+}
+
+static esp_err_t install_entries(const station_entry_t *entries, int count) {
+  station_image_t image;
+  esp_err_t ret = station_image_build(entries, count, &image);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  return install_image(&image);
+}
 
 void init_station_data(void) {
   ESP_LOGI(TAG, "Initializing SPIFFS");
@@ -90,6 +335,7 @@ void init_station_data(void) {
     } else {
       ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
     }
+    install_defaults();
     return;
   }
 
@@ -99,180 +345,338 @@ void init_station_data(void) {
     ESP_LOGE(TAG, "Failed to get SPIFFS partition information (%s)",
              esp_err_to_name(ret));
   } else {
-    ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
+    ESP_LOGI(TAG, "Partition size: total: %u, used: %u", (unsigned)total,
+             (unsigned)used);
+  }
+
+  int64_t start = esp_timer_get_time();
+  station_image_t image;
+  ret = station_store_load(&image);
+  if (ret == ESP_OK) {
+    ret = install_image(&image);
+  }
+  if (ret == ESP_OK) {
+    saved_snapshot = station_snapshot_acquire();
+    ESP_LOGI(TAG, "Loaded %d stations (%u bytes) in %lld us",
+             saved_snapshot->count, (unsigned)image.size,
+             (long long)(esp_timer_get_time() - start));
+    return;
   }
 
-  // Check if file exists
   struct stat st;
-  if (stat(STATION_FILE, &st) == 0) {
-    ESP_LOGI(TAG, "Station file found, loading...");
-    load_stations_from_file();
+  if (stat(LEGACY_STATION_FILE, &st) == 0 && load_legacy_json() == ESP_OK) {
+    ESP_LOGI(TAG, "Imported stations from %s", LEGACY_STATION_FILE);
   } else {
     ESP_LOGI(TAG, "Station file not found, creating defaults...");
-    create_default_station_file();
-    load_stations_from_file(); // Load back what we just wrote
+    install_defaults();
   }
+  save_station_data();
 }
 
 void free_station_data(void) {
-  if (radio_stations != NULL) {
-    for (int i = 0; i < station_count; i++) {
-      free(radio_stations[i].call_sign);
-      free(radio_stations[i].origin);
-      free(radio_stations[i].uri);
-    }
-    free(radio_stations);
-    radio_stations = NULL;
-  }
-  station_count = 0;
+  writer_enter();
+  snapshot_publish(&empty_snapshot);
+  station_snapshot_release(saved_snapshot);
+  saved_snapshot = NULL;
+  writer_exit();
 }
 
-static void create_default_station_file(void) {
-  // Populate global array temporarily from defaults to use save function?
-  // Or just construct JSON directly. Let's construct JSON directly to be safe
-  // and clean.
-
-  cJSON *root = cJSON_CreateArray();
+static esp_err_t install_defaults(void) {
+  station_entry_t entries[sizeof(default_stations) /
+                          sizeof(default_stations[0])];
   for (int i = 0; i < default_station_count; i++) {
-    cJSON *item = cJSON_CreateObject();
-    cJSON_AddStringToObject(item, "call_sign", default_stations[i].call_sign);
-    cJSON_AddStringToObject(item, "origin", default_stations[i].origin);
-    cJSON_AddStringToObject(item, "uri", default_stations[i].uri);
-    cJSON_AddNumberToObject(item, "codec", default_stations[i].codec);
-    cJSON_AddItemToArray(root, item);
+    entries[i] = (station_entry_t){.id = 0,
+                                   .call_sign = default_stations[i].call_sign,
+                                   .origin = default_stations[i].origin,
+                                   .uri = default_stations[i].uri,
+                                   .codec = default_stations[i].codec};
   }
-
-  char *json_str = cJSON_Print(root);
-  FILE *f = fopen(STATION_FILE, "w");
-  if (f == NULL) {
-    ESP_LOGE(TAG, "Failed to open file for writing defaults");
-    cJSON_Delete(root);
-    free(json_str);
-    return;
-  }
-  fprintf(f, "%s", json_str);
-  fclose(f);
-
-  ESP_LOGI(TAG, "Created default stations file");
-
-  free(json_str);
-  cJSON_Delete(root);
+  return install_entries(entries, default_station_count);
 }
 
 int save_station_data(void) {
-  char *json_str = get_stations_json();
-  if (json_str == NULL) {
-    return -1;
-  }
-
-  FILE *f = fopen(STATION_FILE, "w");
-  if (f == NULL) {
-    ESP_LOGE(TAG, "Failed to open file for writing");
-    free(json_str);
-    return -1;
+  writer_enter();
+  const station_snapshot_t *current = station_snapshot_acquire();
+  const snapshot_node_t *node = (const snapshot_node_t *)current;
+  const snapshot_node_t *saved = (const snapshot_node_t *)saved_snapshot;
+  int ret = -1;
+  if (node->image.block != NULL &&
+      station_store_save(saved ? &saved->image : NULL, &node->image) ==
+          ESP_OK) {
+    // Keep the reference just taken as the new baseline
+    station_snapshot_release(saved_snapshot);
+    saved_snapshot = current;
+    current = NULL;
+    ret = 0;
   }
-  fprintf(f, "%s", json_str);
-  fclose(f);
-
-  ESP_LOGI(TAG, "Saved stations to file");
-  free(json_str);
-  return 0;
+  station_snapshot_release(current);
+  writer_exit();
+  return ret;
 }
 
-char *get_stations_json(void) {
-  cJSON *root = cJSON_CreateArray();
-  for (int i = 0; i < station_count; i++) {
-    cJSON *item = cJSON_CreateObject();
-    cJSON_AddStringToObject(item, "call_sign", radio_stations[i].call_sign);
-    cJSON_AddStringToObject(item, "origin", radio_stations[i].origin);
-    cJSON_AddStringToObject(item, "uri", radio_stations[i].uri);
-    cJSON_AddNumberToObject(item, "codec", radio_stations[i].codec);
-    cJSON_AddItemToArray(root, item);
-  }
-  char *out = cJSON_Print(root);
-  cJSON_Delete(root);
-  return out;
+uint32_t station_data_version(void) {
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  uint32_t version = snapshot->version;
+  station_snapshot_release(snapshot);
+  return version;
 }
 
-static void load_stations_from_file(void) {
-  FILE *f = fopen(STATION_FILE, "r");
+static esp_err_t load_legacy_json(void) {
+  FILE *f = fopen(LEGACY_STATION_FILE, "r");
   if (f == NULL) {
     ESP_LOGE(TAG, "Failed to open station data file");
-    return;
+    return ESP_FAIL;
   }
 
-  fseek(f, 0, SEEK_END);
-  long length = ftell(f);
-  fseek(f, 0, SEEK_SET);
-
-  char *data = (char *)malloc(length + 1);
-  if (!data) {
-    ESP_LOGE(TAG, "Failed to allocate memory for reading file");
+  station_json_import_t *import = station_json_import_begin();
+  if (import == NULL) {
     fclose(f);
-    return;
+    return ESP_ERR_NO_MEM;
+  }
+  char buf[256];
+  size_t n;
+  esp_err_t ret = ESP_OK;
+  while (ret == ESP_OK && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    ret = station_json_import_feed(import, buf, n);
   }
-
-  fread(data, 1, length, f);
-  data[length] = '\0';
   fclose(f);
+  if (ret == ESP_OK) {
+    ret = station_json_import_finish(import);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to import %s: %s", LEGACY_STATION_FILE,
+             station_json_import_error(import));
+  }
+  station_json_import_free(import);
+  return ret;
+}
+
+/* ---------- streaming JSON import ---------- */
+
+typedef enum {
+  FIELD_NONE,
+  FIELD_ID,
+  FIELD_CALL_SIGN,
+  FIELD_ORIGIN,
+  FIELD_URI,
+  FIELD_CODEC,
+} station_field_t;
+
+struct station_json_import {
+  json_stream_t js;
+  station_image_builder_t builder;
+  station_field_t field; // field of the current key
+  uint8_t seen;          // bit per station_field_t
+  uint32_t id;
+  codec_type_t codec;
+  char call_sign[STATION_CALL_SIGN_MAX + 1];
+  char origin[STATION_ORIGIN_MAX + 1];
+  char uri[STATION_URI_MAX + 1];
+  char error[80];
+};
 
-  int ret = update_stations_from_json(data);
-  free(data);
+static esp_err_t import_fail(station_json_import_t *import, const char *what) {
+  snprintf(import->error, sizeof(import->error), "station %d: %s",
+           import->builder.count + 1, what);
+  return ESP_ERR_INVALID_ARG;
+}
 
-  if (ret == 0) {
-    ESP_LOGI(TAG, "Loaded %d stations from file", station_count);
+static esp_err_t import_string(station_json_import_t *import,
+                               const json_token_t *token) {
+  char *dst;
+  size_t max;
+  switch (import->field) {
+  case FIELD_CALL_SIGN:
+    dst = import->call_sign;
+    max = STATION_CALL_SIGN_MAX;
+    break;
+  case FIELD_ORIGIN:
+    dst = import->origin;
+    max = STATION_ORIGIN_MAX;
+    break;
+  case FIELD_URI:
+    dst = import->uri;
+    max = STATION_URI_MAX;
+    break;
+  case FIELD_NONE:
+    return ESP_OK;
+  default:
+    return import_fail(import, "id and codec must be numbers");
+  }
+  if (token->len > max) {
+    return import_fail(import, "string too long");
   }
+  memcpy(dst, token->str, token->len + 1);
+  import->seen |= 1 << import->field;
+  return ESP_OK;
 }
 
-int update_stations_from_json(const char *json_str) {
-  cJSON *json = cJSON_Parse(json_str);
-  if (json == NULL) {
-    ESP_LOGE(TAG, "Failed to parse JSON");
-    return -1;
+static esp_err_t import_number(station_json_import_t *import,
+                               const json_token_t *token) {
+  double value = token->number;
+  if (import->field == FIELD_NONE) {
+    return ESP_OK;
+  }
+  if (import->field != FIELD_ID && import->field != FIELD_CODEC) {
+    return import_fail(import, "call_sign, origin and uri must be strings");
+  }
+  if (value < 0 || value > UINT32_MAX || value != (uint32_t)value) {
+    return import_fail(import, "id and codec must be non-negative integers");
   }
+  if (import->field == FIELD_ID) {
+    import->id = (uint32_t)value;
+  } else {
+    if (decoder_registry_find((codec_type_t)value) == NULL) {
+      return import_fail(import, "unknown codec");
+    }
+    import->codec = (codec_type_t)value;
+  }
+  import->seen |= 1 << import->field;
+  return ESP_OK;
+}
 
-  if (!cJSON_IsArray(json)) {
-    ESP_LOGE(TAG, "JSON is not an array");
-    cJSON_Delete(json);
-    return -1;
+static esp_err_t import_station_end(station_json_import_t *import) {
+  const uint8_t required = (1 << FIELD_CALL_SIGN) | (1 << FIELD_ORIGIN) |
+                           (1 << FIELD_URI) | (1 << FIELD_CODEC);
+  if ((import->seen & required) != required) {
+    return import_fail(import, "call_sign, origin, uri and codec are required");
+  }
+  if (import->call_sign[0] == '\0') {
+    return import_fail(import, "empty call_sign");
+  }
+  if (strncmp(import->uri, "http://", 7) != 0 &&
+      strncmp(import->uri, "https://", 8) != 0) {
+    return import_fail(import, "uri must be http:// or https://");
   }
+  if (import->builder.count >= STATION_MAX_COUNT) {
+    return import_fail(import, "too many stations");
+  }
+  station_entry_t entry = {.id = (import->seen & (1 << FIELD_ID)) ? import->id
+                                                                   : 0,
+                           .call_sign = import->call_sign,
+                           .origin = import->origin,
+                           .uri = import->uri,
+                           .codec = import->codec};
+  if (station_image_builder_add(&import->builder, &entry) != ESP_OK) {
+    snprintf(import->error, sizeof(import->error), "out of memory");
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
 
-  int new_count = cJSON_GetArraySize(json);
+// Depth 0 is the list, depth 1 the station objects, depth 2 their members;
+// anything nested deeper belongs to unknown members and is skipped.
+static esp_err_t import_token(const json_token_t *token, void *ctx) {
+  station_json_import_t *import = ctx;
+  switch (token->depth) {
+  case 0:
+    if (token->type == JSON_TOKEN_ARRAY_START ||
+        token->type == JSON_TOKEN_ARRAY_END) {
+      return ESP_OK;
+    }
+    snprintf(import->error, sizeof(import->error),
+             "expected an array of stations");
+    return ESP_ERR_INVALID_ARG;
+  case 1:
+    if (token->type == JSON_TOKEN_OBJECT_START) {
+      import->seen = 0;
+      import->field = FIELD_NONE;
+      return ESP_OK;
+    }
+    if (token->type == JSON_TOKEN_OBJECT_END) {
+      return import_station_end(import);
+    }
+    return import_fail(import, "not an object");
+  case 2:
+    switch (token->type) {
+    case JSON_TOKEN_KEY:
+      import->field = strcmp(token->str, "id") == 0          ? FIELD_ID
+                      : strcmp(token->str, "call_sign") == 0 ? FIELD_CALL_SIGN
+                      : strcmp(token->str, "origin") == 0    ? FIELD_ORIGIN
+                      : strcmp(token->str, "uri") == 0       ? FIELD_URI
+                      : strcmp(token->str, "codec") == 0     ? FIELD_CODEC
+                                                             : FIELD_NONE;
+      return ESP_OK;
+    case JSON_TOKEN_STRING:
+      return import_string(import, token);
+    case JSON_TOKEN_NUMBER:
+      return import_number(import, token);
+    default:
+      return import->field == FIELD_NONE
+                 ? ESP_OK
+                 : import_fail(import, "invalid value type");
+    }
+  default:
+    return ESP_OK;
+  }
+}
 
-  // Allocate new array first
-  station_t *new_stations = (station_t *)malloc(sizeof(station_t) * new_count);
-  if (!new_stations) {
-    ESP_LOGE(TAG, "Failed to allocate memory for new stations");
-    cJSON_Delete(json);
-    return -1;
+station_json_import_t *station_json_import_begin(void) {
+  station_json_import_t *import = calloc(1, sizeof(station_json_import_t));
+  if (import == NULL) {
+    return NULL;
   }
+  json_stream_init(&import->js, import_token, import);
+  station_image_builder_init(&import->builder);
+  return import;
+}
 
-  memset(new_stations, 0, sizeof(station_t) * new_count);
+esp_err_t station_json_import_feed(station_json_import_t *import,
+                                   const char *data, size_t len) {
+  esp_err_t ret = json_stream_feed(&import->js, data, len);
+  if (ret != ESP_OK && import->error[0] == '\0') {
+    snprintf(import->error, sizeof(import->error), "%s at byte %u",
+             ret == ESP_ERR_INVALID_SIZE ? "value or nesting too large"
+                                         : "invalid JSON",
+             (unsigned)import->js.offset);
+  }
+  return ret;
+}
 
-  int idx = 0;
-  cJSON *item = NULL;
-  cJSON_ArrayForEach(item, json) {
-    cJSON *call_sign = cJSON_GetObjectItem(item, "call_sign");
-    cJSON *origin = cJSON_GetObjectItem(item, "origin");
-    cJSON *uri = cJSON_GetObjectItem(item, "uri");
-    cJSON *codec = cJSON_GetObjectItem(item, "codec");
+esp_err_t station_json_import_finish(station_json_import_t *import) {
+  esp_err_t ret = json_stream_finish(&import->js);
+  if (ret != ESP_OK) {
+    snprintf(import->error, sizeof(import->error), "incomplete JSON");
+    return ret;
+  }
+  int count = import->builder.count;
+  station_image_t image;
+  ret = station_image_builder_finish(&import->builder, &image);
+  if (ret == ESP_OK) {
+    ret = install_image(&image);
+  }
+  if (ret != ESP_OK) {
+    snprintf(import->error, sizeof(import->error), "out of memory");
+    return ret;
+  }
+  ESP_LOGI(TAG, "Imported %d stations", count);
+  return ESP_OK;
+}
 
-    if (cJSON_IsString(call_sign) && cJSON_IsString(origin) &&
-        cJSON_IsString(uri) && cJSON_IsNumber(codec)) {
+const char *station_json_import_error(const station_json_import_t *import) {
+  return import->error;
+}
 
-      new_stations[idx].call_sign = strdup(call_sign->valuestring);
-      new_stations[idx].origin = strdup(origin->valuestring);
-      new_stations[idx].uri = strdup(uri->valuestring);
-      new_stations[idx].codec = (codec_type_t)codec->valueint;
-      idx++;
-    }
+void station_json_import_free(station_json_import_t *import) {
+  if (import != NULL) {
+    station_image_builder_discard(&import->builder);
+    free(import);
   }
+}
 
-  // Now replace the global data
-  free_station_data();
-  radio_stations = new_stations;
-  station_count = idx; // Use actual read count, in case of partial failures
-
-  cJSON_Delete(json);
-  return 0;
-}
\ No newline at end of file
+int update_stations_from_json(const char *json_str) {
+  station_json_import_t *import = station_json_import_begin();
+  if (import == NULL) {
+    return -1;
+  }
+  esp_err_t ret = station_json_import_feed(import, json_str, strlen(json_str));
+  if (ret == ESP_OK) {
+    ret = station_json_import_finish(import);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Station import failed: %s",
+             station_json_import_error(import));
+  }
+  station_json_import_free(import);
+  return ret == ESP_OK ? 0 : -1;
+}
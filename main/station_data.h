@@ -2,36 +2,78 @@
 #define STATION_DATA_H
 
 #include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include "station_image.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Limits enforced when importing stations
+#define STATION_MAX_COUNT 10000
+#define STATION_CALL_SIGN_MAX 32
+#define STATION_ORIGIN_MAX 64
+#define STATION_URI_MAX 255 // fits audio_pipeline_components_t.current_uri
+
 /**
  * @brief Structure to define a radio station's properties.
- * Note: Members are now non-const to allow dynamic allocation.
+ * Note: The strings point into the loaded station image and must not be
+ * modified or freed.
  */
 typedef struct {
+  uint32_t id;        // Stable station id, survives reordering
   char *call_sign;    // Station's call sign or name
   char *origin;       // Station's origin (city or school)
   char *uri;          // Stream URI
   codec_type_t codec; // Codec type for the stream
 } station_t;
 
+struct station_index;
+
+/**
+ * @brief An immutable version of the station list.
+ *
+ * The list is never modified in place. A change builds a new snapshot and
+ * publishes it with a single atomic pointer swap. Readers take a reference
+ * with station_snapshot_acquire(), use it for as long as they need (e.g.
+ * while streaming it to a web client) and drop it with
+ * station_snapshot_release(). Acquire, release and lookups by index or id
+ * never block or wait for a writer. A replaced snapshot is freed once its
+ * last reference is gone and no reader is still between loading the pointer
+ * and taking its reference (the grace period), by whichever release or
+ * acquire ends the later of the two.
+ */
+typedef struct {
+  const station_t *stations;
+  int count;
+  uint32_t version;                   // image CRC, changes with any edit
+  const struct station_index *index;  // search index, NULL if unavailable
+} station_snapshot_t;
+
 /**
- * @brief Pointer to the array of station data.
+ * @brief Takes a reference to the current station list. Never NULL; an empty
+ * list has count 0.
  */
-extern station_t *radio_stations;
+const station_snapshot_t *station_snapshot_acquire(void);
 
 /**
- * @brief Current number of available stations.
+ * @brief Drops a reference taken with station_snapshot_acquire().
  */
-extern int station_count;
+void station_snapshot_release(const station_snapshot_t *snapshot);
+
+/**
+ * @brief Finds a station by its stable id.
+ * @return Its index in the snapshot, or -1.
+ */
+int station_snapshot_find_id(const station_snapshot_t *snapshot, uint32_t id);
 
 /**
  * @brief Initialize station data subsystem.
- * Mounts filesystem, loads stations.json. If missing, creates defaults.
+ * Mounts filesystem and loads the binary station image (stations.bin).
+ * If missing, imports a legacy stations.json or creates defaults.
  */
 void init_station_data(void);
 
@@ -42,24 +84,70 @@ void init_station_data(void);
 int save_station_data(void);
 
 /**
- * @brief Free all allocated station memory.
+ * @brief Replaces the station list with an empty one. Snapshots still held
+ * by readers stay valid until released.
  */
 void free_station_data(void);
 
 /**
- * @brief Get the stations list as a JSON string.
- * Caller must free the returned string.
- * @return JSON string or NULL on error.
+ * @brief Identifies the current station list: the CRC of its image, which
+ * changes whenever any station, the order or an id changes. Suitable as an
+ * HTTP ETag; readers holding a snapshot use its version field instead.
+ */
+uint32_t station_data_version(void);
+
+/**
+ * @brief Makes an image the live station list. Takes ownership of the image,
+ * also on failure. Does not save it.
  */
-char *get_stations_json(void);
+esp_err_t station_data_install(station_image_t *image);
 
 /**
- * @brief Update stations from a JSON string.
+ * @brief Update stations from a JSON string. Entries may carry an "id";
+ * missing or duplicate ids are assigned.
  * @param json_str JSON string containing array of stations.
  * @return 0 on success, < 0 on failure.
  */
 int update_stations_from_json(const char *json_str);
 
+/**
+ * @brief Streaming JSON import of a station list.
+ *
+ * The JSON is tokenized as it arrives and each station is validated and
+ * appended to a new station image as soon as its object closes, so memory
+ * use is the compact image plus a fixed parser state, independent of how
+ * the payload is formatted or chunked.
+ */
+typedef struct station_json_import station_json_import_t;
+
+/**
+ * @brief Starts an import.
+ * @return NULL if out of memory.
+ */
+station_json_import_t *station_json_import_begin(void);
+
+/**
+ * @brief Consumes the next chunk of JSON.
+ */
+esp_err_t station_json_import_feed(station_json_import_t *import,
+                                   const char *data, size_t len);
+
+/**
+ * @brief Validates the end of input and replaces the station list. Does not
+ * save it.
+ */
+esp_err_t station_json_import_finish(station_json_import_t *import);
+
+/**
+ * @brief Describes why feed or finish failed.
+ */
+const char *station_json_import_error(const station_json_import_t *import);
+
+/**
+ * @brief Frees an import, finished or not.
+ */
+void station_json_import_free(station_json_import_t *import);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1032 @@
+#include "station_health.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/netdb.h"
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+static const char *TAG = "STATION_HEALTH";
+
+// Next to the station list (a scratch directory in the host tests)
+#ifndef STATION_STORE_DIR
+#define STATION_STORE_DIR "/spiffs"
+#endif
+#define HEALTH_FILE STATION_STORE_DIR "/health.bin"
+#define HEALTH_TMP_FILE STATION_STORE_DIR "/health.tmp"
+#define HEALTH_MAGIC 0x48544C48 // "HLTH"
+
+// Prober task: below every other task, so it only gets otherwise idle CPU
+#define PROBE_TASK_PRIORITY 1
+#define PROBE_TASK_STACK 8192 // TLS handshake
+
+// Budget per probe: one connection, PROBE_SAMPLE_BYTES of audio, all
+// redirects included within PROBE_TIMEOUT_MS
+#define PROBE_CONNECT_TIMEOUT_MS 4000 // also the longest a read blocks
+#define PROBE_TIMEOUT_MS 8000
+#define PROBE_MAX_HOPS 4 // the stream URL plus three redirects or playlists
+#define PROBE_URL_MAX 384
+#define PROBE_HEAD_MAX 1024
+#define PROBE_SAMPLE_BYTES 8192
+#define PROBE_MIN_AUDIO_BYTES 1024
+
+// Budget over time: probes at least PROBE_INTERVAL_MS apart and on average
+// no more than PROBE_BUDGET_BYTES_PER_S (8 kb/s next to a 128 kb/s stream)
+#define PROBE_INTERVAL_MS 15000
+#define PROBE_BUDGET_BYTES_PER_S 1024
+// Playback must have been in the same state (station, running) this long
+#define PROBE_SETTLE_MS 60000
+// Headroom for a TLS handshake, which mostly needs internal RAM
+#define PROBE_MIN_FREE_INTERNAL (48 * 1024)
+// A round starts at most this often; failing stations are retried up to
+// STATION_HEALTH_DEAD_FAILS passes within a round
+#define ROUND_MIN_MS (6 * 3600 * 1000LL)
+#define SAVE_EVERY 32
+
+extern volatile bool g_is_pipeline_running;
+extern int current_station;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t record_size;
+  uint16_t round;
+  uint32_t count;
+  uint32_t crc; // crc32 of the records
+} health_file_header_t;
+
+typedef struct {
+  station_health_error_t error;
+  bool aborted; // playback changed, result discarded
+  uint16_t dns_ms;
+  uint16_t connect_ms;
+  uint16_t first_byte_ms;
+  uint16_t bitrate_kbps;
+  bool icy_bitrate;
+  int codec;
+  uint32_t bytes;
+} probe_result_t;
+
+typedef struct {
+  char url[PROBE_URL_MAX];
+  char next_url[PROBE_URL_MAX];
+  char host[128];
+  char content_type[64];
+  char head[PROBE_HEAD_MAX + 1];
+  uint8_t *sample; // PROBE_SAMPLE_BYTES
+} probe_buffers_t;
+
+// Results sorted by id, one per station of the snapshot they were built for.
+// Only the prober task writes; readers copy entries under the lock.
+static station_health_t *table = NULL;
+static int table_count = 0;
+static uint32_t table_version = 0;
+static bool table_synced = false; // table matches table_version
+static portMUX_TYPE table_lock = portMUX_INITIALIZER_UNLOCKED;
+static station_health_stats_t stats = {.round = 1, .waiting = "starting"};
+
+// Playback state as last seen, and when it last changed
+static bool seen_running = false;
+static int seen_station = -1;
+static int64_t seen_change_us = 0;
+
+static void *health_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+static int64_t now_ms(void) { return esp_timer_get_time() / 1000; }
+
+static uint16_t clamp_ms(int64_t ms) {
+  return ms < 0 ? 0 : ms > UINT16_MAX ? UINT16_MAX : (uint16_t)ms;
+}
+
+/* ---------- result table ---------- */
+
+static station_health_t *find_locked(uint32_t id) {
+  int lo = 0, hi = table_count - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (table[mid].id == id) {
+      return &table[mid];
+    }
+    if (table[mid].id < id) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return NULL;
+}
+
+static int compare_health_id(const void *a, const void *b) {
+  uint32_t x = ((const station_health_t *)a)->id;
+  uint32_t y = ((const station_health_t *)b)->id;
+  return x < y ? -1 : x > y;
+}
+
+/* Rebuilds the table for a new version of the station list, keeping the
+ * results of stations that are still in it. Called by the prober only. */
+static bool sync_table(const station_snapshot_t *snapshot) {
+  if (table_synced && snapshot->version == table_version) {
+    return true;
+  }
+  station_health_t *fresh = NULL;
+  if (snapshot->count > 0) {
+    fresh = health_alloc(snapshot->count * sizeof(*fresh));
+    if (fresh == NULL) {
+      ESP_LOGE(TAG, "No memory for %d results", snapshot->count);
+      return false;
+    }
+  }
+  for (int i = 0; i < snapshot->count; i++) {
+    fresh[i] = (station_health_t){.id = snapshot->stations[i].id,
+                                  .codec = STATION_HEALTH_CODEC_UNKNOWN};
+  }
+  if (fresh) {
+    qsort(fresh, snapshot->count, sizeof(*fresh), compare_health_id);
+  }
+  uint32_t dead = 0;
+  for (int i = 0; i < snapshot->count; i++) {
+    // The old table is only replaced below, by this task
+    station_health_t *old = find_locked(fresh[i].id);
+    if (old) {
+      fresh[i] = *old;
+    }
+    dead += fresh[i].status == STATION_HEALTH_DEAD;
+  }
+
+  station_health_t *old_table = table;
+  taskENTER_CRITICAL(&table_lock);
+  table = fresh;
+  table_count = snapshot->count;
+  stats.dead = dead;
+  taskEXIT_CRITICAL(&table_lock);
+  table_version = snapshot->version;
+  table_synced = true;
+  free(old_table);
+  return true;
+}
+
+static void load_results(void) {
+  const char *path = HEALTH_FILE;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    // A save was interrupted between removing the old file and the rename
+    path = HEALTH_TMP_FILE;
+    f = fopen(path, "rb");
+  }
+  if (f == NULL) {
+    return;
+  }
+  health_file_header_t header;
+  station_health_t *loaded = NULL;
+  if (fread(&header, sizeof(header), 1, f) != 1 ||
+      header.magic != HEALTH_MAGIC ||
+      header.record_size != sizeof(station_health_t) ||
+      header.count > STATION_MAX_COUNT) {
+    goto invalid;
+  }
+  if (header.count > 0) {
+    loaded = health_alloc(header.count * sizeof(*loaded));
+    if (loaded == NULL ||
+        fread(loaded, sizeof(*loaded), header.count, f) != header.count ||
+        esp_rom_crc32_le(0, (const uint8_t *)loaded,
+                         header.count * sizeof(*loaded)) != header.crc) {
+      goto invalid;
+    }
+  }
+  fclose(f);
+  // Matched against the station list on the first sync
+  table = loaded;
+  table_count = header.count;
+  stats.round = header.round ? header.round : 1;
+  ESP_LOGI(TAG, "Loaded %" PRIu32 " results (round %u)", header.count,
+           header.round);
+  return;
+
+invalid:
+  ESP_LOGW(TAG, "Ignoring invalid %s", path);
+  free(loaded);
+  fclose(f);
+}
+
+static void save_results(void) {
+  // Only probed stations are worth keeping
+  health_file_header_t header = {.magic = HEALTH_MAGIC,
+                                 .record_size = sizeof(station_health_t),
+                                 .round = stats.round};
+  for (int i = 0; i < table_count; i++) {
+    if (table[i].status != STATION_HEALTH_UNKNOWN) {
+      header.crc = esp_rom_crc32_le(header.crc, (const uint8_t *)&table[i],
+                                    sizeof(table[i]));
+      header.count++;
+    }
+  }
+
+  FILE *f = fopen(HEALTH_TMP_FILE, "wb");
+  if (f == NULL) {
+    ESP_LOGE(TAG, "Failed to open %s", HEALTH_TMP_FILE);
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (int i = 0; i < table_count && ok; i++) {
+    if (table[i].status != STATION_HEALTH_UNKNOWN) {
+      ok = fwrite(&table[i], sizeof(table[i]), 1, f) == 1;
+    }
+  }
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to write %s", HEALTH_TMP_FILE);
+    remove(HEALTH_TMP_FILE);
+    return;
+  }
+  // SPIFFS cannot rename over an existing file; load_results() falls back
+  // to the temporary file if we stop in between
+  remove(HEALTH_FILE);
+  if (rename(HEALTH_TMP_FILE, HEALTH_FILE) != 0) {
+    ESP_LOGE(TAG, "Failed to rename %s", HEALTH_TMP_FILE);
+  }
+}
+
+/* ---------- stream analysis ---------- */
+
+typedef struct {
+  int codec; // CODEC_TYPE_MP3 or CODEC_TYPE_AAC
+  int len;   // frame bytes
+  int samples;
+  int rate;
+} frame_info_t;
+
+static bool parse_mpeg_frame(const uint8_t *h, frame_info_t *f) {
+  static const uint16_t kbps[2][3][15] = {
+      {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+       {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+       {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+      {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+       {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+       {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}}};
+  static const uint16_t rates[3] = {44100, 48000, 32000};
+  int version = (h[1] >> 3) & 3; // 0: 2.5, 1: reserved, 2: 2, 3: 1
+  int layer = 3 - ((h[1] >> 1) & 3); // 0: I, 1: II, 2: III
+  int bitrate_index = h[2] >> 4;
+  int rate_index = (h[2] >> 2) & 3;
+  int padding = (h[2] >> 1) & 1;
+  if (version == 1 || layer == 3 || bitrate_index == 0 ||
+      bitrate_index == 15 || rate_index == 3) {
+    return false;
+  }
+  int bitrate = kbps[version != 3][layer][bitrate_index] * 1000;
+  f->codec = CODEC_TYPE_MP3;
+  f->rate = rates[rate_index] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+  if (layer == 0) {
+    f->samples = 384;
+    f->len = (12 * bitrate / f->rate + padding) * 4;
+  } else {
+    f->samples = layer == 2 && version != 3 ? 576 : 1152;
+    f->len = f->samples / 8 * bitrate / f->rate + padding;
+  }
+  return true;
+}
+
+static bool parse_adts_frame(const uint8_t *h, frame_info_t *f) {
+  static const uint32_t rates[13] = {96000, 88200, 64000, 48000, 44100,
+                                     32000, 24000, 22050, 16000, 12000,
+                                     11025, 8000,  7350};
+  int rate_index = (h[2] >> 2) & 0xF;
+  if (rate_index >= 13) {
+    return false;
+  }
+  f->codec = CODEC_TYPE_AAC;
+  f->rate = rates[rate_index];
+  f->len = ((h[3] & 3) << 11) | (h[4] << 3) | (h[5] >> 5);
+  f->samples = 1024 * ((h[6] & 3) + 1);
+  return f->len >= 7;
+}
+
+/* An MPEG audio or ADTS frame header at h (at least 7 bytes) */
+static bool parse_frame(const uint8_t *h, frame_info_t *f) {
+  if (h[0] != 0xFF || (h[1] & 0xE0) != 0xE0) {
+    return false;
+  }
+  // Layer bits 00 are reserved in MPEG audio and mandatory in ADTS
+  return (h[1] & 0x06) ? parse_mpeg_frame(h, f)
+                       : (h[1] & 0xF0) == 0xF0 && parse_adts_frame(h, f);
+}
+
+/* Finds two consecutive frames of the same kind (a lone sync word is easily
+ * a false positive), then averages the bitrate over every following frame
+ * in the sample, which also covers VBR streams. */
+static bool analyze_frames(const uint8_t *data, size_t len, int *codec,
+                           int *kbps) {
+  for (size_t pos = 0; pos + 7 <= len; pos++) {
+    frame_info_t first, f;
+    if (!parse_frame(data + pos, &first) || pos + first.len + 7 > len ||
+        !parse_frame(data + pos + first.len, &f) || f.codec != first.codec ||
+        f.rate != first.rate) {
+      continue;
+    }
+    uint64_t bytes = 0, samples = 0;
+    size_t p = pos;
+    while (p + 7 <= len && parse_frame(data + p, &f) &&
+           f.codec == first.codec && f.rate == first.rate &&
+           p + f.len <= len) {
+      bytes += f.len;
+      samples += f.samples;
+      p += f.len;
+    }
+    *codec = first.codec;
+    *kbps = (int)((bytes * 8 * first.rate + samples * 500) / (samples * 1000));
+    return true;
+  }
+  return false;
+}
+
+static const uint8_t *find_bytes(const uint8_t *data, size_t len,
+                                 const char *needle, size_t n) {
+  for (size_t i = 0; i + n <= len; i++) {
+    if (memcmp(data + i, needle, n) == 0) {
+      return data + i;
+    }
+  }
+  return NULL;
+}
+
+/* Recognizes the stream from its first bytes: Ogg (Vorbis or Opus) and
+ * FLAC by their magic, MP3 and AAC by their frames. The bitrate is the Vorbis nominal bitrate or
+ * the average over the frames, 0 if neither is known. */
+static bool analyze_audio(const uint8_t *data, size_t len, int *codec,
+                          int *kbps) {
+  *kbps = 0;
+  // Skip an ID3v2 tag (sync-safe size)
+  if (len >= 10 && memcmp(data, "ID3", 3) == 0) {
+    size_t tag = 10 + ((data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 |
+                       (data[8] & 0x7F) << 7 | (data[9] & 0x7F));
+    tag += (data[5] & 0x10) ? 10 : 0; // footer
+    if (tag >= len) {
+      return false;
+    }
+    data += tag;
+    len -= tag;
+  }
+  const uint8_t *ogg = find_bytes(data, MIN(len, 512), "OggS", 4);
+  if (ogg) {
+    // Opus has no nominal bitrate in its header
+    if (find_bytes(ogg, len - (ogg - data), "OpusHead", 8)) {
+      *codec = CODEC_TYPE_OPUS;
+      return true;
+    }
+    *codec = CODEC_TYPE_OGG;
+    const uint8_t *vorbis =
+        find_bytes(ogg, len - (ogg - data), "\x01vorbis", 7);
+    if (vorbis && vorbis + 24 <= data + len) {
+      int32_t nominal = vorbis[20] | vorbis[21] << 8 | vorbis[22] << 16 |
+                        (uint32_t)vorbis[23] << 24;
+      *kbps = nominal > 0 ? (nominal + 500) / 1000 : 0;
+    }
+    return true;
+  }
+  if (find_bytes(data, MIN(len, 512), "fLaC", 4)) {
+    *codec = CODEC_TYPE_FLAC;
+    return true;
+  }
+  return analyze_frames(data, len, codec, kbps);
+}
+
+// Results keep the detected codec in 3 bits
+_Static_assert(CODEC_TYPE_COUNT <= STATION_HEALTH_CODEC_UNKNOWN,
+               "codec_type_t outgrew station_health_t.codec");
+
+static int codec_from_content_type(const char *type) {
+  static const struct {
+    const char *type;
+    int codec;
+  } types[] = {
+      {"audio/mpeg", CODEC_TYPE_MP3},   {"audio/mp3", CODEC_TYPE_MP3},
+      {"audio/aac", CODEC_TYPE_AAC},    {"audio/aacp", CODEC_TYPE_AAC},
+      {"audio/x-aac", CODEC_TYPE_AAC},  {"audio/ogg", CODEC_TYPE_OGG},
+      {"application/ogg", CODEC_TYPE_OGG}, {"audio/flac", CODEC_TYPE_FLAC},
+      {"audio/x-flac", CODEC_TYPE_FLAC}, {"audio/opus", CODEC_TYPE_OPUS},
+  };
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    size_t n = strlen(types[i].type);
+    if (strncasecmp(type, types[i].type, n) == 0 &&
+        (type[n] == '\0' || type[n] == ';' || type[n] == ' ')) {
+      return types[i].codec;
+    }
+  }
+  return STATION_HEALTH_CODEC_UNKNOWN;
+}
+
+static bool contains_ignore_case(const char *haystack, const char *needle) {
+  size_t n = strlen(needle);
+  for (; *haystack; haystack++) {
+    if (strncasecmp(haystack, needle, n) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_playlist(const char *type, const uint8_t *body, size_t len) {
+  if (contains_ignore_case(type, "mpegurl") ||
+      contains_ignore_case(type, "scpls") ||
+      contains_ignore_case(type, "pls+xml")) {
+    return true;
+  }
+  return (len >= 7 && memcmp(body, "#EXTM3U", 7) == 0) ||
+         (len >= 10 && strncasecmp((const char *)body, "[playlist]", 10) == 0) ||
+         (len >= 4 && strncasecmp((const char *)body, "http", 4) == 0);
+}
+
+/* The first http(s) URL at the start of a line or after '=' (PLS) */
+static bool playlist_first_url(const uint8_t *body, size_t len, char *out,
+                               size_t out_len) {
+  for (size_t i = 0; i < len; i++) {
+    if ((i == 0 || body[i - 1] == '\n' || body[i - 1] == '=') &&
+        len - i >= 7 && strncasecmp((const char *)body + i, "http", 4) == 0) {
+      size_t n = 0;
+      while (i + n < len && !isspace(body[i + n]) && n + 1 < out_len) {
+        n++;
+      }
+      if (i + n < len && !isspace(body[i + n])) {
+        return false; // too long or cut off
+      }
+      memcpy(out, body + i, n);
+      out[n] = '\0';
+      return strncasecmp(out, "http://", 7) == 0 ||
+             strncasecmp(out, "https://", 8) == 0;
+    }
+  }
+  return false;
+}
+
+/* ---------- HTTP ---------- */
+
+typedef struct {
+  bool https;
+  int port;
+  const char *path; // into the URL, "" for the root
+} url_parts_t;
+
+static bool parse_url(const char *url, char *host, size_t host_len,
+                      url_parts_t *out) {
+  const char *p;
+  if (strncasecmp(url, "http://", 7) == 0) {
+    out->https = false;
+    p = url + 7;
+  } else if (strncasecmp(url, "https://", 8) == 0) {
+    out->https = true;
+    p = url + 8;
+  } else {
+    return false;
+  }
+  size_t n = strcspn(p, ":/?#");
+  if (n == 0 || n >= host_len) {
+    return false;
+  }
+  memcpy(host, p, n);
+  host[n] = '\0';
+  p += n;
+  out->port = out->https ? 443 : 80;
+  if (*p == ':') {
+    char *end;
+    long port = strtol(p + 1, &end, 10);
+    if (port <= 0 || port > 65535) {
+      return false;
+    }
+    out->port = port;
+    p = end;
+  }
+  out->path = p;
+  return true;
+}
+
+/* Status line and the few headers the probe needs. Shoutcast v1 answers
+ * "ICY 200 OK". */
+static int parse_head(char *head, char *content_type, size_t type_len,
+                      int *icy_br, char *location, size_t location_len) {
+  int status = 0;
+  if (sscanf(head, "HTTP/%*d.%*d %d", &status) != 1 &&
+      sscanf(head, "ICY %d", &status) != 1) {
+    return 0;
+  }
+  content_type[0] = '\0';
+  location[0] = '\0';
+  *icy_br = 0;
+  for (char *line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+    line += 2;
+    char *colon = strchr(line, ':');
+    char *end = strstr(line, "\r\n");
+    if (colon == NULL || end == NULL || colon > end) {
+      continue;
+    }
+    char *value = colon + 1;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+    size_t n = end - value;
+    size_t name_len = colon - line;
+    if (name_len == 12 && strncasecmp(line, "content-type", 12) == 0) {
+      snprintf(content_type, type_len, "%.*s", (int)n, value);
+    } else if (name_len == 8 && strncasecmp(line, "location", 8) == 0) {
+      if (n >= location_len) {
+        return -1;
+      }
+      memcpy(location, value, n);
+      location[n] = '\0';
+    } else if (name_len == 6 && strncasecmp(line, "icy-br", 6) == 0) {
+      // Sometimes a list ("128,128"); the first is the stream's
+      *icy_br = atoi(value);
+    }
+  }
+  return status;
+}
+
+/* Playback changed since the probe started: give up, it may be competing */
+static bool playback_changed(bool running, int station) {
+  return g_is_pipeline_running != running || current_station != station;
+}
+
+static int probe_read(esp_tls_t *tls, void *buf, size_t len) {
+  int n;
+  do {
+    n = esp_tls_conn_read(tls, buf, len);
+  } while (n == ESP_TLS_ERR_SSL_WANT_READ);
+  return n;
+}
+
+/* One hop: resolve, connect, request, read the head and a sample of the
+ * body. Sets next_url if the hop points elsewhere. */
+static void probe_hop(probe_buffers_t *b, int64_t deadline_ms,
+                      probe_result_t *r) {
+  bool running = g_is_pipeline_running;
+  int station = current_station;
+  url_parts_t url;
+  if (!parse_url(b->url, b->host, sizeof(b->host), &url)) {
+    r->error = STATION_HEALTH_ERR_URL;
+    return;
+  }
+
+  // The lookup is repeated by esp_tls, but answered from the DNS cache then
+  int64_t t = now_ms();
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+  struct addrinfo *addr = NULL;
+  int err = getaddrinfo(b->host, NULL, &hints, &addr);
+  r->dns_ms = clamp_ms(now_ms() - t);
+  if (addr) {
+    freeaddrinfo(addr);
+  }
+  if (err != 0) {
+    r->error = STATION_HEALTH_ERR_DNS;
+    return;
+  }
+
+  esp_tls_cfg_t cfg = {
+      .timeout_ms = PROBE_CONNECT_TIMEOUT_MS,
+      .is_plain_tcp = !url.https,
+  };
+  esp_tls_t *tls = esp_tls_init();
+  if (tls == NULL) {
+    r->error = STATION_HEALTH_ERR_CONNECT;
+    return;
+  }
+  t = now_ms();
+  if (esp_tls_conn_new_sync(b->host, strlen(b->host), url.port, &cfg, tls) !=
+      1) {
+    r->error = STATION_HEALTH_ERR_CONNECT;
+    goto cleanup;
+  }
+  r->connect_ms = clamp_ms(now_ms() - t);
+
+  char port[8] = "";
+  if (url.port != (url.https ? 443 : 80)) {
+    snprintf(port, sizeof(port), ":%d", url.port);
+  }
+  int len = snprintf(b->head, sizeof(b->head),
+                     "GET %s%s HTTP/1.0\r\nHost: %s%s\r\n"
+                     "User-Agent: ESP32-Radio\r\nAccept: */*\r\n"
+                     "Icy-MetaData: 0\r\nConnection: close\r\n\r\n",
+                     url.path[0] == '/' ? "" : "/", url.path, b->host, port);
+  if (len >= (int)sizeof(b->head)) {
+    r->error = STATION_HEALTH_ERR_URL;
+    goto cleanup;
+  }
+  for (int sent = 0; sent < len;) {
+    int n = esp_tls_conn_write(tls, b->head + sent, len - sent);
+    if (n < 0) {
+      r->error = STATION_HEALTH_ERR_CONNECT;
+      goto cleanup;
+    }
+    sent += n;
+  }
+
+  // Response head
+  t = now_ms();
+  size_t head_len = 0;
+  char *body = NULL;
+  while (body == NULL) {
+    if (head_len == PROBE_HEAD_MAX || now_ms() > deadline_ms ||
+        playback_changed(running, station)) {
+      r->error = STATION_HEALTH_ERR_TIMEOUT;
+      r->aborted = playback_changed(running, station);
+      goto cleanup;
+    }
+    int n = probe_read(tls, b->head + head_len, PROBE_HEAD_MAX - head_len);
+    if (n <= 0) {
+      r->error = head_len ? STATION_HEALTH_ERR_HTTP : STATION_HEALTH_ERR_TIMEOUT;
+      goto cleanup;
+    }
+    if (head_len == 0) {
+      r->first_byte_ms = clamp_ms(now_ms() - t);
+    }
+    head_len += n;
+    r->bytes += n;
+    b->head[head_len] = '\0';
+    body = strstr(b->head, "\r\n\r\n");
+  }
+  body += 4;
+  int icy_br;
+  int status = parse_head(b->head, b->content_type, sizeof(b->content_type),
+                          &icy_br, b->next_url, sizeof(b->next_url));
+  if (status >= 300 && status < 400 && b->next_url[0]) {
+    if (b->next_url[0] == '/') {
+      // Relative redirect
+      char path[PROBE_URL_MAX];
+      strlcpy(path, b->next_url, sizeof(path));
+      if (snprintf(b->next_url, sizeof(b->next_url), "%s://%s:%d%s",
+                   url.https ? "https" : "http", b->host, url.port,
+                   path) >= (int)sizeof(b->next_url)) {
+        b->next_url[0] = '\0';
+        r->error = STATION_HEALTH_ERR_URL;
+      }
+    }
+    goto cleanup;
+  }
+  b->next_url[0] = '\0';
+  if (status < 200 || status >= 300) {
+    r->error = STATION_HEALTH_ERR_HTTP;
+    goto cleanup;
+  }
+
+  // Body sample; whatever followed the head comes first
+  size_t sample_len = head_len - (body - b->head);
+  memcpy(b->sample, body, sample_len);
+  while (sample_len < PROBE_SAMPLE_BYTES && now_ms() < deadline_ms) {
+    if (playback_changed(running, station)) {
+      r->aborted = true;
+      goto cleanup;
+    }
+    int n = probe_read(tls, b->sample + sample_len,
+                       PROBE_SAMPLE_BYTES - sample_len);
+    if (n <= 0) {
+      break;
+    }
+    sample_len += n;
+    r->bytes += n;
+  }
+
+  if (is_playlist(b->content_type, b->sample, sample_len)) {
+    if (!playlist_first_url(b->sample, sample_len, b->next_url,
+                            sizeof(b->next_url))) {
+      r->error = STATION_HEALTH_ERR_NO_AUDIO;
+    }
+    goto cleanup;
+  }
+
+  int kbps = 0;
+  r->codec = STATION_HEALTH_CODEC_UNKNOWN;
+  if (!analyze_audio(b->sample, sample_len, &r->codec, &kbps)) {
+    r->codec = codec_from_content_type(b->content_type);
+  }
+  r->bitrate_kbps = kbps ? kbps : icy_br;
+  r->icy_bitrate = kbps == 0 && icy_br > 0;
+  if (r->codec == STATION_HEALTH_CODEC_UNKNOWN ||
+      sample_len < PROBE_MIN_AUDIO_BYTES) {
+    r->error = STATION_HEALTH_ERR_NO_AUDIO;
+  }
+
+cleanup:
+  esp_tls_conn_destroy(tls);
+}
+
+static void probe_station(probe_buffers_t *b, const char *uri,
+                          probe_result_t *r) {
+  *r = (probe_result_t){.codec = STATION_HEALTH_CODEC_UNKNOWN};
+  int64_t deadline_ms = now_ms() + PROBE_TIMEOUT_MS;
+  strlcpy(b->url, uri, sizeof(b->url));
+  for (int hop = 0; hop < PROBE_MAX_HOPS; hop++) {
+    // Timings are those of the last hop, the one that serves the stream
+    b->next_url[0] = '\0';
+    r->error = STATION_HEALTH_ERR_NONE;
+    probe_hop(b, deadline_ms, r);
+    if (r->error != STATION_HEALTH_ERR_NONE || r->aborted ||
+        b->next_url[0] == '\0') {
+      return;
+    }
+    ESP_LOGD(TAG, "%s -> %s", b->url, b->next_url);
+    strlcpy(b->url, b->next_url, sizeof(b->url));
+  }
+  r->error = STATION_HEALTH_ERR_REDIRECTS;
+}
+
+/* ---------- scheduling ---------- */
+
+static void track_playback(void) {
+  if (g_is_pipeline_running != seen_running ||
+      current_station != seen_station) {
+    seen_running = g_is_pipeline_running;
+    seen_station = current_station;
+    seen_change_us = esp_timer_get_time();
+  }
+}
+
+/* Why a probe can't run now, NULL if it can */
+static const char *probe_gate(void) {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+    return "wifi";
+  }
+  if ((esp_timer_get_time() - seen_change_us) / 1000 < PROBE_SETTLE_MS) {
+    return "playback settling";
+  }
+  if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) < PROBE_MIN_FREE_INTERNAL) {
+    return "memory";
+  }
+  return NULL;
+}
+
+static void set_waiting(const char *reason) {
+  taskENTER_CRITICAL(&table_lock);
+  stats.waiting = reason;
+  taskEXIT_CRITICAL(&table_lock);
+}
+
+/* Next station from cursor not yet done this round, -1 at the end of a pass.
+ * The playing station is skipped: playback shows how it is doing. */
+static int next_due(const station_snapshot_t *snapshot, int *cursor) {
+  while (*cursor < snapshot->count) {
+    int i = (*cursor)++;
+    station_health_t *h = find_locked(snapshot->stations[i].id);
+    if (i != current_station && h && h->round != stats.round) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void record_result(uint32_t id, const probe_result_t *r) {
+  station_health_t *h = find_locked(id);
+  if (h == NULL) {
+    return; // removed meanwhile
+  }
+  station_health_t next = *h;
+  if (r->error == STATION_HEALTH_ERR_NONE) {
+    next.round = stats.round;
+    next.status = STATION_HEALTH_OK;
+    next.fails = 0;
+    next.error = STATION_HEALTH_ERR_NONE;
+    next.dns_ms = r->dns_ms;
+    next.connect_ms = r->connect_ms;
+    next.first_byte_ms = r->first_byte_ms;
+    next.bitrate_kbps = r->bitrate_kbps;
+    next.icy_bitrate = r->icy_bitrate;
+    next.codec = r->codec;
+  } else {
+    // The last good timings, codec and bitrate are kept. The station stays
+    // due this round until it has failed often enough to be dead.
+    next.fails = MIN(next.fails + 1, 7);
+    next.error = r->error;
+    next.status = next.fails >= STATION_HEALTH_DEAD_FAILS
+                      ? STATION_HEALTH_DEAD
+                      : STATION_HEALTH_FAILING;
+    if (next.status == STATION_HEALTH_DEAD) {
+      next.round = stats.round;
+    }
+  }
+  taskENTER_CRITICAL(&table_lock);
+  stats.dead += (next.status == STATION_HEALTH_DEAD) -
+                (h->status == STATION_HEALTH_DEAD);
+  stats.probed += next.round == stats.round;
+  stats.probes++;
+  stats.failures += r->error != STATION_HEALTH_ERR_NONE;
+  *h = next;
+  taskEXIT_CRITICAL(&table_lock);
+}
+
+static void health_task(void *arg) {
+  probe_buffers_t *b = arg;
+  int64_t round_start_ms = now_ms();
+  int64_t next_probe_ms = 0;
+  int cursor = 0;
+  int pass = 1;
+  int pass_failures = 0;
+  int unsaved = 0;
+
+  while (1) {
+    vTaskDelay(pdMS_TO_TICKS(1000));
+    track_playback();
+    if (now_ms() < next_probe_ms) {
+      continue;
+    }
+    const char *gate = probe_gate();
+    if (gate) {
+      set_waiting(gate);
+      continue;
+    }
+
+    const station_snapshot_t *snapshot = station_snapshot_acquire();
+    if (!sync_table(snapshot)) {
+      station_snapshot_release(snapshot);
+      set_waiting("memory");
+      next_probe_ms = now_ms() + PROBE_INTERVAL_MS;
+      continue;
+    }
+    int index = next_due(snapshot, &cursor);
+    if (index < 0) {
+      station_snapshot_release(snapshot);
+      if (pass < STATION_HEALTH_DEAD_FAILS && pass_failures > 0) {
+        // Retry the failing stations before the round ends
+        pass++;
+        pass_failures = 0;
+        cursor = 0;
+        continue;
+      }
+      if (unsaved) {
+        save_results();
+        unsaved = 0;
+      }
+      if (now_ms() - round_start_ms < ROUND_MIN_MS) {
+        set_waiting("round done");
+        next_probe_ms = round_start_ms + ROUND_MIN_MS;
+        continue;
+      }
+      ESP_LOGI(TAG, "Round %" PRIu32 " done: %" PRIu32 " stations, %" PRIu32
+                    " dead", stats.round, stats.probed, stats.dead);
+      taskENTER_CRITICAL(&table_lock);
+      stats.round = stats.round == UINT16_MAX ? 1 : stats.round + 1;
+      stats.probed = 0;
+      taskEXIT_CRITICAL(&table_lock);
+      round_start_ms = now_ms();
+      cursor = 0;
+      pass = 1;
+      pass_failures = 0;
+      continue;
+    }
+    // The probe takes seconds; don't hold the list meanwhile
+    const station_t *st = &snapshot->stations[index];
+    uint32_t id = st->id;
+    char uri[STATION_URI_MAX + 1];
+    strlcpy(uri, st->uri, sizeof(uri));
+    station_snapshot_release(snapshot);
+
+    set_waiting(NULL);
+    uint64_t live_bytes = g_bytes_read;
+    bool live = g_is_pipeline_running;
+    probe_result_t r;
+    probe_station(b, uri, &r);
+    taskENTER_CRITICAL(&table_lock);
+    stats.bytes += r.bytes;
+    taskEXIT_CRITICAL(&table_lock);
+
+    // Not the station's fault if we lost the network or the live stream
+    // stalled at the same time
+    wifi_ap_record_t ap;
+    bool blame_network = r.error != STATION_HEALTH_ERR_NONE &&
+                         (esp_wifi_sta_get_ap_info(&ap) != ESP_OK ||
+                          (live && g_bytes_read == live_bytes));
+    if (r.aborted || blame_network) {
+      ESP_LOGD(TAG, "Discarding probe of %s", uri);
+      taskENTER_CRITICAL(&table_lock);
+      stats.discarded++;
+      taskEXIT_CRITICAL(&table_lock);
+    } else {
+      if (r.error != STATION_HEALTH_ERR_NONE) {
+        ESP_LOGI(TAG, "%s failed: %s", uri,
+                 station_health_error_name(r.error));
+        pass_failures++;
+      } else {
+        ESP_LOGD(TAG, "%s ok: %u/%u/%u ms, %u kb/s", uri, r.dns_ms,
+                 r.connect_ms, r.first_byte_ms, r.bitrate_kbps);
+      }
+      record_result(id, &r);
+      if (++unsaved >= SAVE_EVERY) {
+        save_results();
+        unsaved = 0;
+      }
+    }
+    next_probe_ms =
+        now_ms() + MAX(PROBE_INTERVAL_MS,
+                       (int64_t)r.bytes * 1000 / PROBE_BUDGET_BYTES_PER_S);
+    set_waiting("pacing");
+  }
+}
+
+/* ---------- public API ---------- */
+
+esp_err_t station_health_init(void) {
+  probe_buffers_t *b = health_alloc(sizeof(*b));
+  uint8_t *sample = health_alloc(PROBE_SAMPLE_BYTES);
+  if (b == NULL || sample == NULL) {
+    free(b);
+    free(sample);
+    return ESP_ERR_NO_MEM;
+  }
+  b->sample = sample;
+  load_results();
+  seen_change_us = esp_timer_get_time();
+  if (xTaskCreate(health_task, "station_health", PROBE_TASK_STACK, b,
+                  PROBE_TASK_PRIORITY, NULL) != pdPASS) {
+    free(sample);
+    free(b);
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+bool station_health_get(uint32_t id, station_health_t *out) {
+  taskENTER_CRITICAL(&table_lock);
+  station_health_t *h = find_locked(id);
+  if (h) {
+    *out = *h;
+  }
+  taskEXIT_CRITICAL(&table_lock);
+  return h != NULL;
+}
+
+bool station_health_is_dead(uint32_t id) {
+  station_health_t h;
+  return station_health_get(id, &h) && h.status == STATION_HEALTH_DEAD;
+}
+
+uint32_t station_health_score(const station_health_t *health) {
+  static const uint8_t status_rank[] = {
+      [STATION_HEALTH_UNKNOWN] = 2,
+      [STATION_HEALTH_OK] = 3,
+      [STATION_HEALTH_FAILING] = 1,
+      [STATION_HEALTH_DEAD] = 0,
+  };
+  uint32_t score = (uint32_t)status_rank[health->status] << 24;
+  if (health->status == STATION_HEALTH_OK) {
+    int startup =
+        health->dns_ms + health->connect_ms + health->first_byte_ms;
+    score |= (uint32_t)(15 - MIN(startup / 500, 15)) << 16;
+    score |= health->bitrate_kbps;
+  }
+  return score;
+}
+
+static uint32_t score_of(uint32_t id) {
+  station_health_t h = {.status = STATION_HEALTH_UNKNOWN};
+  station_health_get(id, &h);
+  return station_health_score(&h);
+}
+
+int station_health_best_mirror(const station_snapshot_t *snapshot,
+                               int index) {
+  if (index < 0 || index >= snapshot->count) {
+    return index;
+  }
+  const station_t *st = &snapshot->stations[index];
+  int best = index;
+  uint32_t best_score = score_of(st->id);
+  for (int i = 0; i < snapshot->count; i++) {
+    const station_t *other = &snapshot->stations[i];
+    if (i == index || strcasecmp(other->call_sign, st->call_sign) != 0 ||
+        strcasecmp(other->origin, st->origin) != 0) {
+      continue;
+    }
+    uint32_t score = score_of(other->id);
+    if (score > best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+void station_health_get_stats(station_health_stats_t *out) {
+  taskENTER_CRITICAL(&table_lock);
+  *out = stats;
+  taskEXIT_CRITICAL(&table_lock);
+}
+
+const char *station_health_status_name(station_health_status_t status) {
+  static const char *names[] = {"unknown", "ok", "failing", "dead"};
+  return status < sizeof(names) / sizeof(names[0]) ? names[status] : "unknown";
+}
+
+const char *station_health_error_name(station_health_error_t error) {
+  static const char *names[] = {"none",    "url",  "dns",       "connect",
+                                "timeout", "http", "redirects", "no audio"};
+  return error < sizeof(names) / sizeof(names[0]) ? names[error] : "unknown";
+}
@@ -0,0 +1,137 @@
+#ifndef STATION_HEALTH_H
+#define STATION_HEALTH_H
+
+#include "esp_err.h"
+#include "station_data.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Background station health prober
+ *
+ * A low priority task walks the station list in rounds and probes one
+ * station at a time: it resolves the host, connects (TLS included), sends
+ * the stream request, times the first response byte and reads a few KB of
+ * audio. The codec is taken from the stream's magic bytes (or failing that
+ * its Content-Type) and the bitrate from its frame headers (or icy-br).
+ * Redirects and playlist links are followed a few hops.
+ *
+ * Probing never competes with playback: it only runs while Wi-Fi is up and
+ * playback has been stable for a while, one connection at a time, with a
+ * cap on bytes per probe and an average bandwidth budget. A probe is
+ * abandoned as soon as playback changes state, and a failure is not held
+ * against the station if the live stream stalled meanwhile (the network is
+ * to blame then). A station is marked dead after several failed probes in a
+ * row; one good probe revives it.
+ *
+ * Results are kept per station id in a compact table in PSRAM and saved to
+ * /spiffs/health.bin, so a round resumes after a reboot.
+ */
+
+typedef enum {
+  STATION_HEALTH_UNKNOWN, // not probed yet
+  STATION_HEALTH_OK,
+  STATION_HEALTH_FAILING, // last probe failed
+  STATION_HEALTH_DEAD,    // STATION_HEALTH_DEAD_FAILS probes in a row failed
+} station_health_status_t;
+
+typedef enum {
+  STATION_HEALTH_ERR_NONE,
+  STATION_HEALTH_ERR_URL,       // not an http(s) URL
+  STATION_HEALTH_ERR_DNS,       // host did not resolve
+  STATION_HEALTH_ERR_CONNECT,   // TCP or TLS connect failed
+  STATION_HEALTH_ERR_TIMEOUT,   // no (complete) response in time
+  STATION_HEALTH_ERR_HTTP,      // status other than 2xx
+  STATION_HEALTH_ERR_REDIRECTS, // too many redirects or playlist hops
+  STATION_HEALTH_ERR_NO_AUDIO,  // response is not a recognizable stream
+} station_health_error_t;
+
+// Consecutive failed probes before a station is marked dead
+#define STATION_HEALTH_DEAD_FAILS 3
+// codec when the stream was not recognized
+#define STATION_HEALTH_CODEC_UNKNOWN 7
+
+/**
+ * @brief Result of the last probe of a station (16 bytes).
+ */
+typedef struct {
+  uint32_t id;            // station id
+  uint16_t round;         // round the station was last done in, 0 if never
+                          // (a failing station is retried within a round)
+  uint16_t dns_ms;        // host lookup
+  uint16_t connect_ms;    // TCP connect plus TLS handshake
+  uint16_t first_byte_ms; // request sent to first response byte
+  uint16_t bitrate_kbps;  // 0 if unknown
+  uint8_t codec : 3;      // detected codec_type_t or ..._CODEC_UNKNOWN
+  uint8_t status : 2;     // station_health_status_t
+  uint8_t fails : 3;      // consecutive failed probes, saturating
+  uint8_t error : 4;      // station_health_error_t of the last failure
+  uint8_t icy_bitrate : 1; // bitrate taken from icy-br, not the frames
+  uint8_t reserved : 3;
+} station_health_t;
+
+/**
+ * @brief Prober counters.
+ */
+typedef struct {
+  uint32_t round;     // current round
+  uint32_t probed;    // stations probed this round
+  uint32_t probes;    // probes since boot
+  uint32_t failures;  // failed probes since boot
+  uint32_t discarded; // probes abandoned or not held against the station
+  uint32_t bytes;     // bytes received since boot
+  uint32_t dead;      // stations currently marked dead
+  const char *waiting; // why the prober is idle, NULL while probing
+} station_health_stats_t;
+
+/**
+ * @brief Loads saved results and starts the prober task. Call after
+ * init_station_data().
+ */
+esp_err_t station_health_init(void);
+
+/**
+ * @brief Copies the last result for a station.
+ * @return false if the station is unknown to the prober.
+ */
+bool station_health_get(uint32_t id, station_health_t *out);
+
+/**
+ * @brief Whether the station is marked dead.
+ */
+bool station_health_is_dead(uint32_t id);
+
+/**
+ * @brief Ranks a result for choosing between mirrors: status first (ok >
+ * unknown > failing > dead), then startup time in 500 ms steps, then
+ * bitrate. Higher is better.
+ */
+uint32_t station_health_score(const station_health_t *health);
+
+/**
+ * @brief Among the stations sharing the call sign and origin of the one at
+ * index (its mirrors), returns the best scored one, preferring index itself
+ * on a tie.
+ */
+int station_health_best_mirror(const station_snapshot_t *snapshot, int index);
+
+/**
+ * @brief Returns the prober counters.
+ */
+void station_health_get_stats(station_health_stats_t *stats);
+
+/**
+ * @brief Names for the status and error codes, as used by the web API.
+ */
+const char *station_health_status_name(station_health_status_t status);
+const char *station_health_error_name(station_health_error_t error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_HEALTH_H
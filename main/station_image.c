@@ -0,0 +1,296 @@
+#include "station_image.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "STATION_IMAGE";
+
+static void bind_image(void *block, size_t size, station_image_t *out) {
+  out->block = block;
+  out->size = size;
+  out->header = (const station_image_header_t *)block;
+  out->records =
+      (const station_record_t *)((uint8_t *)block +
+                                 sizeof(station_image_header_t));
+  out->arena = (const char *)(out->records + out->header->count);
+}
+
+static uint32_t image_crc(const void *block, size_t size) {
+  return esp_rom_crc32_le(0, (const uint8_t *)block +
+                                 sizeof(station_image_header_t),
+                          size - sizeof(station_image_header_t));
+}
+
+typedef struct {
+  uint32_t id;
+  int index;
+} id_slot_t;
+
+static int compare_id_slot(const void *a, const void *b) {
+  const id_slot_t *x = a, *y = b;
+  if (x->id != y->id) {
+    return x->id < y->id ? -1 : 1;
+  }
+  return x->index - y->index;
+}
+
+// Replaces ids that are 0 or repeat an earlier record's id with fresh ones.
+// Sorting keeps this O(n log n) for large imports.
+static esp_err_t assign_ids(station_record_t *records, int count) {
+  if (count == 0) {
+    return ESP_OK;
+  }
+  id_slot_t *slots = malloc((size_t)count * sizeof(id_slot_t));
+  if (slots == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  uint32_t next_id = 1;
+  for (int i = 0; i < count; i++) {
+    slots[i].id = records[i].id;
+    slots[i].index = i;
+    if (records[i].id >= next_id) {
+      next_id = records[i].id + 1;
+    }
+  }
+  qsort(slots, count, sizeof(id_slot_t), compare_id_slot);
+  for (int i = 0; i < count; i++) {
+    if (slots[i].id == 0 || (i > 0 && slots[i].id == slots[i - 1].id)) {
+      records[slots[i].index].id = next_id++;
+    }
+  }
+  free(slots);
+  return ESP_OK;
+}
+
+static void finish_header(uint8_t *block, size_t size, int count,
+                          size_t arena_size) {
+  station_image_header_t *header = (station_image_header_t *)block;
+  header->magic = STATION_IMAGE_MAGIC;
+  header->version = STATION_IMAGE_VERSION;
+  header->record_size = sizeof(station_record_t);
+  header->count = count;
+  header->arena_size = arena_size;
+  header->crc32 = image_crc(block, size);
+}
+
+static size_t entry_strings_size(const station_entry_t *entry) {
+  return strlen(entry->call_sign ? entry->call_sign : "") + 1 +
+         strlen(entry->origin ? entry->origin : "") + 1 +
+         strlen(entry->uri ? entry->uri : "") + 1;
+}
+
+static uint32_t append_str(char *arena, size_t *offset, const char *str) {
+  uint32_t start = *offset;
+  size_t n = strlen(str ? str : "") + 1;
+  memcpy(arena + start, str ? str : "", n);
+  *offset += n;
+  return start;
+}
+
+// Fills a record and copies its strings; the arena must have room
+static void put_entry(station_record_t *rec, char *arena, size_t *offset,
+                      const station_entry_t *entry) {
+  memset(rec, 0, sizeof(*rec));
+  rec->id = entry->id;
+  rec->codec = (uint8_t)entry->codec;
+  rec->call_sign_off = append_str(arena, offset, entry->call_sign);
+  rec->origin_off = append_str(arena, offset, entry->origin);
+  rec->uri_off = append_str(arena, offset, entry->uri);
+}
+
+esp_err_t station_image_build(const station_entry_t *entries, int count,
+                              station_image_t *out) {
+  if (count < 0 || (count > 0 && entries == NULL) || out == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Pass 1: size the arena
+  size_t arena_size = 0;
+  for (int i = 0; i < count; i++) {
+    arena_size += entry_strings_size(&entries[i]);
+  }
+  size_t size = sizeof(station_image_header_t) +
+                (size_t)count * sizeof(station_record_t) + arena_size;
+  uint8_t *block = malloc(size);
+  if (block == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate %u byte station image", (unsigned)size);
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Pass 2: fill records and arena
+  station_record_t *records =
+      (station_record_t *)(block + sizeof(station_image_header_t));
+  char *arena = (char *)(records + count);
+  size_t offset = 0;
+  for (int i = 0; i < count; i++) {
+    put_entry(&records[i], arena, &offset, &entries[i]);
+  }
+  if (assign_ids(records, count) != ESP_OK) {
+    free(block);
+    return ESP_ERR_NO_MEM;
+  }
+
+  finish_header(block, size, count, arena_size);
+  bind_image(block, size, out);
+  return ESP_OK;
+}
+
+void station_image_builder_init(station_image_builder_t *builder) {
+  memset(builder, 0, sizeof(*builder));
+}
+
+esp_err_t station_image_builder_add(station_image_builder_t *builder,
+                                    const station_entry_t *entry) {
+  if (builder->count == builder->capacity) {
+    int capacity = builder->capacity ? builder->capacity * 2 : 16;
+    station_record_t *records =
+        realloc(builder->records, sizeof(station_record_t) * capacity);
+    if (records == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+    builder->records = records;
+    builder->capacity = capacity;
+  }
+  size_t needed = builder->arena_size + entry_strings_size(entry);
+  if (needed > builder->arena_capacity) {
+    size_t capacity = builder->arena_capacity ? builder->arena_capacity : 1024;
+    while (capacity < needed) {
+      capacity *= 2;
+    }
+    char *arena = realloc(builder->arena, capacity);
+    if (arena == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+    builder->arena = arena;
+    builder->arena_capacity = capacity;
+  }
+  put_entry(&builder->records[builder->count++], builder->arena,
+            &builder->arena_size, entry);
+  return ESP_OK;
+}
+
+esp_err_t station_image_builder_finish(station_image_builder_t *builder,
+                                       station_image_t *out) {
+  esp_err_t ret = assign_ids(builder->records, builder->count);
+  if (ret != ESP_OK) {
+    station_image_builder_discard(builder);
+    return ret;
+  }
+  // Grow the arena buffer into the image and slide the strings behind the
+  // records, so only the record table is ever held twice
+  size_t table = sizeof(station_image_header_t) +
+                 (size_t)builder->count * sizeof(station_record_t);
+  size_t size = table + builder->arena_size;
+  uint8_t *block = realloc(builder->arena, size);
+  if (block == NULL) {
+    station_image_builder_discard(builder);
+    return ESP_ERR_NO_MEM;
+  }
+  memmove(block + table, block, builder->arena_size);
+  memcpy(block + sizeof(station_image_header_t), builder->records,
+         (size_t)builder->count * sizeof(station_record_t));
+  int count = builder->count;
+  size_t arena_size = builder->arena_size;
+  builder->arena = NULL;
+  station_image_builder_discard(builder);
+
+  finish_header(block, size, count, arena_size);
+  bind_image(block, size, out);
+  return ESP_OK;
+}
+
+void station_image_builder_discard(station_image_builder_t *builder) {
+  free(builder->records);
+  free(builder->arena);
+  memset(builder, 0, sizeof(*builder));
+}
+
+esp_err_t station_image_adopt(void *block, size_t size, station_image_t *out) {
+  const station_image_header_t *header = block;
+  const char *reason = NULL;
+
+  if (size < sizeof(station_image_header_t)) {
+    reason = "truncated header";
+  } else if (header->magic != STATION_IMAGE_MAGIC) {
+    reason = "bad magic";
+  } else if (header->version != STATION_IMAGE_VERSION ||
+             header->record_size != sizeof(station_record_t)) {
+    reason = "unsupported version";
+  } else if (size != sizeof(station_image_header_t) +
+                         (size_t)header->count * sizeof(station_record_t) +
+                         header->arena_size) {
+    reason = "size mismatch";
+  } else if (header->crc32 != image_crc(block, size)) {
+    reason = "CRC mismatch";
+  }
+
+  if (reason == NULL) {
+    const station_record_t *records =
+        (const station_record_t *)((const uint8_t *)block +
+                                   sizeof(station_image_header_t));
+    const char *arena = (const char *)(records + header->count);
+    // The arena must end with a terminator so every offset yields a C string
+    if (header->arena_size > 0 && arena[header->arena_size - 1] != '\0') {
+      reason = "unterminated arena";
+    }
+    for (uint32_t i = 0; reason == NULL && i < header->count; i++) {
+      if (records[i].call_sign_off >= header->arena_size ||
+          records[i].origin_off >= header->arena_size ||
+          records[i].uri_off >= header->arena_size) {
+        reason = "string offset out of range";
+      }
+    }
+  }
+
+  if (reason != NULL) {
+    ESP_LOGE(TAG, "Invalid station image: %s", reason);
+    free(block);
+    return ESP_ERR_INVALID_CRC;
+  }
+  bind_image(block, size, out);
+  return ESP_OK;
+}
+
+esp_err_t station_image_read_file(const char *path, station_image_t *out) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  esp_err_t ret = ESP_FAIL;
+  uint8_t *block = NULL;
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (length <= 0) {
+    goto cleanup;
+  }
+
+  block = malloc(length);
+  if (block == NULL) {
+    ESP_LOGE(TAG, "Failed to allocate %ld bytes for %s", length, path);
+    ret = ESP_ERR_NO_MEM;
+    goto cleanup;
+  }
+  if (fread(block, 1, length, f) != (size_t)length) {
+    ESP_LOGE(TAG, "Short read on %s", path);
+    free(block);
+    goto cleanup;
+  }
+  ret = station_image_adopt(block, length, out);
+
+cleanup:
+  fclose(f);
+  return ret;
+}
+
+void station_image_free(station_image_t *image) {
+  if (image == NULL) {
+    return;
+  }
+  free(image->block);
+  memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,139 @@
+#ifndef STATION_IMAGE_H
+#define STATION_IMAGE_H
+
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary station image
+ *
+ *   station_image_header_t
+ *   station_record_t[count]
+ *   string arena (NUL terminated strings, arena_size bytes)
+ *
+ * All offsets are relative to the start of the arena and all fields are
+ * little endian, so the image is position independent: it can be used in
+ * place from a single read buffer (or a memory mapped flash region).
+ * The CRC covers everything after the header.
+ */
+
+#define STATION_IMAGE_MAGIC 0x314E5453 // "STN1"
+#define STATION_IMAGE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size; // sizeof(station_record_t) of the writer
+  uint32_t count;
+  uint32_t arena_size;
+  uint32_t crc32;
+} station_image_header_t;
+
+typedef struct {
+  uint32_t id; // stable station id
+  uint32_t call_sign_off;
+  uint32_t origin_off;
+  uint32_t uri_off;
+  uint8_t codec; // codec_type_t
+  uint8_t flags;
+  uint16_t reserved;
+} station_record_t;
+
+/**
+ * @brief A validated image held in one heap block.
+ */
+typedef struct {
+  void *block; // owns header, records and arena
+  size_t size;
+  const station_image_header_t *header;
+  const station_record_t *records;
+  const char *arena;
+} station_image_t;
+
+/**
+ * @brief Input for building an image. Strings are copied into the arena.
+ * An id of 0 asks the builder to assign one.
+ */
+typedef struct {
+  uint32_t id;
+  const char *call_sign;
+  const char *origin;
+  const char *uri;
+  codec_type_t codec;
+} station_entry_t;
+
+/**
+ * @brief Builds an image from entries (two passes, one allocation).
+ * Duplicate or missing ids are replaced with fresh ones.
+ */
+esp_err_t station_image_build(const station_entry_t *entries, int count,
+                              station_image_t *out);
+
+/**
+ * @brief Incremental image builder, for lists whose size is not known up
+ * front (e.g. streamed imports).
+ */
+typedef struct {
+  station_record_t *records;
+  int count;
+  int capacity;
+  char *arena;
+  size_t arena_size;
+  size_t arena_capacity;
+} station_image_builder_t;
+
+void station_image_builder_init(station_image_builder_t *builder);
+
+/**
+ * @brief Appends a station; its strings are copied.
+ */
+esp_err_t station_image_builder_add(station_image_builder_t *builder,
+                                    const station_entry_t *entry);
+
+/**
+ * @brief Produces the image and releases the builder (also on failure).
+ * Ids are assigned as in station_image_build().
+ */
+esp_err_t station_image_builder_finish(station_image_builder_t *builder,
+                                       station_image_t *out);
+
+/**
+ * @brief Releases a builder without producing an image.
+ */
+void station_image_builder_discard(station_image_builder_t *builder);
+
+/**
+ * @brief Validates an image in a heap block and takes ownership of it.
+ * The block is freed on failure.
+ */
+esp_err_t station_image_adopt(void *block, size_t size, station_image_t *out);
+
+/**
+ * @brief Reads and validates an image file with a single read.
+ */
+esp_err_t station_image_read_file(const char *path, station_image_t *out);
+
+/**
+ * @brief Returns a string from the image arena.
+ */
+static inline const char *station_image_str(const station_image_t *image,
+                                            uint32_t offset) {
+  return image->arena + offset;
+}
+
+/**
+ * @brief Frees an image.
+ */
+void station_image_free(station_image_t *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_IMAGE_H
@@ -0,0 +1,1131 @@
+#include "station_import.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "hls_stream.h"
+#include "json_stream.h"
+#include "station_data.h"
+#include "station_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+static const char *TAG = "STATION_IMPORT";
+
+// Bytes looked at to detect the format
+#define SNIFF_LEN 64
+// Longest playlist line kept; the rest of a longer line is dropped
+#define LINE_MAX_LEN 1023
+// Longest title kept before it is cut to a call sign
+#define TITLE_MAX 127
+#define TAGS_MAX 255
+#define PROGRESS_EVERY 1000
+#define URL_SET_MIN_CAPACITY 1024
+
+typedef enum {
+  RB_NONE,
+  RB_NAME,
+  RB_URL,
+  RB_URL_RESOLVED,
+  RB_CODEC,
+  RB_COUNTRY,
+  RB_COUNTRYCODE,
+  RB_STATE,
+  RB_TAGS,
+  RB_HLS,
+  RB_LASTCHECKOK,
+} rb_field_t;
+
+typedef enum {
+  XML_TEXT,
+  XML_TAG_NAME, // after '<'
+  XML_TAG_REST, // attributes, up to '>'
+  XML_SKIP,     // comment, declaration or processing instruction
+} xml_state_t;
+
+typedef enum {
+  XSPF_NONE,
+  XSPF_LOCATION,
+  XSPF_TITLE,
+} xspf_field_t;
+
+struct station_import {
+  station_import_options_t options;
+  char country[48];
+  char tag[32];
+  station_import_format_t format;
+  const station_snapshot_t *base; // the list being added to
+  station_image_builder_t builder;
+  int limit; // most stations to add
+  station_import_stats_t stats;
+  char error[80];
+
+  // Hashes of the normalized URLs in the list so far (open addressing,
+  // 0 marks a free slot)
+  uint64_t *urls;
+  size_t url_count;
+  size_t url_capacity;
+
+  char sniff[SNIFF_LEN];
+  size_t sniff_len;
+  bool started; // format settled, sniffed bytes passed on
+
+  // M3U and PLS
+  char line[LINE_MAX_LEN + 1];
+  size_t line_len;
+  int pls_entry; // number of the PLS entry being collected, 0 if none
+
+  // XSPF
+  xml_state_t xml_state;
+  char xml_tag[16];
+  size_t xml_tag_len;
+  uint8_t xml_skip_len; // characters seen after "<!", up to 2
+  bool xml_comment;     // skipping a comment, which ends only at "-->"
+  char xml_last[2];
+  xspf_field_t xspf_field;
+  size_t xspf_len;
+  bool in_track;
+  bool has_location;
+
+  // radio-browser JSON
+  json_stream_t js;
+  rb_field_t field;
+  bool hls;
+  bool broken;
+
+  // The entry being collected
+  char title[TITLE_MAX + 1];
+  char uri[STATION_URI_MAX + 2]; // one spare byte detects overlong URLs
+  char codec[16];
+  char entry_country[48];
+  char entry_countrycode[8];
+  char entry_state[48];
+  char tags[TAGS_MAX + 1];
+  bool has_resolved_url;
+};
+
+static void *import_alloc(size_t size) {
+  void *ptr = heap_caps_calloc(1, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return ptr != NULL ? ptr : calloc(1, size);
+}
+
+static esp_err_t import_fail(station_import_t *import, const char *what) {
+  if (import->error[0] == '\0') {
+    snprintf(import->error, sizeof(import->error), "%s", what);
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t import_no_mem(station_import_t *import) {
+  snprintf(import->error, sizeof(import->error), "out of memory");
+  return ESP_ERR_NO_MEM;
+}
+
+// Copies text with surrounding white space removed and control characters
+// turned into spaces, cut at a character boundary to fit size
+static void copy_text(char *dst, size_t size, const char *src, size_t len) {
+  while (len > 0 && (unsigned char)*src <= ' ') {
+    src++;
+    len--;
+  }
+  while (len > 0 && (unsigned char)src[len - 1] <= ' ') {
+    len--;
+  }
+  if (len > size - 1) {
+    len = size - 1;
+    while (len > 0 && ((unsigned char)src[len] & 0xC0) == 0x80) {
+      len--;
+    }
+    while (len > 0 && src[len - 1] == ' ') {
+      len--;
+    }
+  }
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = (unsigned char)src[i] < ' ' ? ' ' : src[i];
+  }
+  dst[len] = '\0';
+}
+
+/* ---------- URL handling ---------- */
+
+static uint64_t fnv1a(uint64_t hash, const char *s, size_t len, bool fold) {
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = s[i];
+    if (fold && c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    }
+    hash = (hash ^ c) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Identifies a stream regardless of the URL's spelling: the scheme, a
+// default port, the host's case, a fragment and trailing '/', ';' or '?'
+// (as in Shoutcast's "/;") are ignored
+static uint64_t url_key(const char *uri) {
+  const char *p = strstr(uri, "://");
+  p = p != NULL ? p + 3 : uri;
+  size_t host_len = strcspn(p, "/?#");
+  size_t name_len = host_len;
+  if (name_len > 3 && strncmp(p + name_len - 3, ":80", 3) == 0) {
+    name_len -= 3;
+  } else if (name_len > 4 && strncmp(p + name_len - 4, ":443", 4) == 0) {
+    name_len -= 4;
+  }
+  uint64_t hash = fnv1a(0xcbf29ce484222325ULL, p, name_len, true);
+
+  const char *rest = p + host_len;
+  size_t rest_len = strcspn(rest, "#");
+  while (rest_len > 0 && (rest[rest_len - 1] == '/' ||
+                          rest[rest_len - 1] == ';' ||
+                          rest[rest_len - 1] == '?')) {
+    rest_len--;
+  }
+  hash = fnv1a(hash ^ '/', rest, rest_len, false);
+  return hash != 0 ? hash : 1;
+}
+
+static bool url_set_contains(const station_import_t *import, uint64_t key) {
+  if (import->url_capacity == 0) {
+    return false;
+  }
+  size_t mask = import->url_capacity - 1;
+  for (size_t i = key & mask; import->urls[i] != 0; i = (i + 1) & mask) {
+    if (import->urls[i] == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void url_set_put(uint64_t *urls, size_t capacity, uint64_t key) {
+  size_t mask = capacity - 1;
+  size_t i = key & mask;
+  while (urls[i] != 0 && urls[i] != key) {
+    i = (i + 1) & mask;
+  }
+  urls[i] = key;
+}
+
+static esp_err_t url_set_add(station_import_t *import, uint64_t key) {
+  // Kept at most half full
+  if ((import->url_count + 1) * 2 > import->url_capacity) {
+    size_t capacity = MAX(import->url_capacity * 2, URL_SET_MIN_CAPACITY);
+    uint64_t *urls = import_alloc(capacity * sizeof(uint64_t));
+    if (urls == NULL) {
+      return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < import->url_capacity; i++) {
+      if (import->urls[i] != 0) {
+        url_set_put(urls, capacity, import->urls[i]);
+      }
+    }
+    free(import->urls);
+    import->urls = urls;
+    import->url_capacity = capacity;
+  }
+  url_set_put(import->urls, import->url_capacity, key);
+  import->url_count++;
+  return ESP_OK;
+}
+
+static bool url_is_valid(const char *uri) {
+  if (strncmp(uri, "http://", 7) != 0 && strncmp(uri, "https://", 8) != 0) {
+    return false;
+  }
+  size_t len = strlen(uri);
+  if (len > STATION_URI_MAX) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if ((unsigned char)uri[i] <= ' ') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Picks the codec from the entry's metadata, or from the URL when there is
+// none; HLS playlists are taken for AAC, which nearly all audio HLS is.
+// Returns false for streams that can't be played: other codecs and links to
+// further playlists.
+static bool resolve_codec(const char *name, const char *uri,
+                          codec_type_t *codec) {
+  if (name != NULL && name[0] != '\0' && strcasecmp(name, "UNKNOWN") != 0) {
+    if (strncasecmp(name, "MP3", 3) == 0) {
+      *codec = CODEC_TYPE_MP3;
+    } else if (strncasecmp(name, "AAC", 3) == 0) { // AAC, AAC+, AACP
+      *codec = CODEC_TYPE_AAC;
+    } else if (strncasecmp(name, "OGG", 3) == 0 ||
+               strcasecmp(name, "VORBIS") == 0) {
+      *codec = CODEC_TYPE_OGG;
+    } else if (strcasecmp(name, "FLAC") == 0) {
+      *codec = CODEC_TYPE_FLAC;
+    } else if (strcasecmp(name, "OPUS") == 0) {
+      *codec = CODEC_TYPE_OPUS;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // The extension of the last path segment, if any
+  const char *path = strstr(uri, "://");
+  path = path != NULL ? path + 3 : uri;
+  size_t path_len = strcspn(path, "?#");
+  const char *ext = NULL;
+  for (size_t i = path_len; i > 0 && path[i - 1] != '/'; i--) {
+    if (path[i - 1] == '.') {
+      ext = path + i;
+      break;
+    }
+  }
+  size_t ext_len = ext != NULL ? (size_t)(path + path_len - ext) : 0;
+  static const struct {
+    const char *ext;
+    int codec; // -1: not a stream
+  } exts[] = {
+      {"mp3", CODEC_TYPE_MP3},   {"aac", CODEC_TYPE_AAC},
+      {"aacp", CODEC_TYPE_AAC},  {"adts", CODEC_TYPE_AAC},
+      {"m4a", CODEC_TYPE_AAC},   {"ogg", CODEC_TYPE_OGG},
+      {"oga", CODEC_TYPE_OGG},   {"opus", CODEC_TYPE_OPUS},
+      {"flac", CODEC_TYPE_FLAC}, {"m3u8", CODEC_TYPE_AAC},
+      {"m3u", -1},               {"pls", -1},
+      {"asx", -1},               {"xspf", -1},
+  };
+  for (size_t i = 0; ext != NULL && i < sizeof(exts) / sizeof(exts[0]); i++) {
+    if (strlen(exts[i].ext) == ext_len &&
+        strncasecmp(ext, exts[i].ext, ext_len) == 0) {
+      if (exts[i].codec < 0) {
+        return false;
+      }
+      *codec = (codec_type_t)exts[i].codec;
+      return true;
+    }
+  }
+  // Mount points often name the format, e.g. "/aac_64" or "/stream/ogg";
+  // anything else is most likely an MP3 Icecast or Shoutcast stream
+  char lower[STATION_URI_MAX + 1];
+  size_t n = MIN(path_len, sizeof(lower) - 1);
+  for (size_t i = 0; i < n; i++) {
+    lower[i] = (path[i] >= 'A' && path[i] <= 'Z') ? path[i] + ('a' - 'A')
+                                                  : path[i];
+  }
+  lower[n] = '\0';
+  if (strstr(lower, "aac") != NULL) {
+    *codec = CODEC_TYPE_AAC;
+  } else if (strstr(lower, "opus") != NULL) {
+    *codec = CODEC_TYPE_OPUS;
+  } else if (strstr(lower, "ogg") != NULL || strstr(lower, "vorbis") != NULL) {
+    *codec = CODEC_TYPE_OGG;
+  } else if (strstr(lower, "flac") != NULL) {
+    *codec = CODEC_TYPE_FLAC;
+  } else {
+    *codec = CODEC_TYPE_MP3;
+  }
+  return true;
+}
+
+/* ---------- adding stations ---------- */
+
+static void log_progress(const station_import_t *import) {
+  const station_import_stats_t *s = &import->stats;
+  if (import->options.total_bytes > 0) {
+    ESP_LOGI(TAG, "%u%%: %u entries, %u added, %u duplicates",
+             (unsigned)((uint64_t)s->bytes * 100 / import->options.total_bytes),
+             (unsigned)s->entries, (unsigned)s->added,
+             (unsigned)s->duplicates);
+  } else {
+    ESP_LOGI(TAG, "%u bytes: %u entries, %u added, %u duplicates",
+             (unsigned)s->bytes, (unsigned)s->entries, (unsigned)s->added,
+             (unsigned)s->duplicates);
+  }
+}
+
+// Counts an entry read; every one is then counted once more by outcome
+static void count_entry(station_import_t *import) {
+  if (++import->stats.entries % PROGRESS_EVERY == 0) {
+    log_progress(import);
+  }
+}
+
+// Adds the collected entry (title, uri, codec) with the given origin
+static esp_err_t add_entry(station_import_t *import, const char *origin) {
+  char uri[STATION_URI_MAX + 2];
+  copy_text(uri, sizeof(uri), import->uri, strlen(import->uri));
+  if (!url_is_valid(uri)) {
+    import->stats.invalid++;
+    return ESP_OK;
+  }
+  codec_type_t codec;
+  if (!resolve_codec(import->codec, uri, &codec)) {
+    import->stats.unsupported++;
+    return ESP_OK;
+  }
+  uint64_t key = url_key(uri);
+  if (url_set_contains(import, key)) {
+    import->stats.duplicates++;
+    return ESP_OK;
+  }
+  if ((int)import->stats.added >= import->limit) {
+    import->stats.dropped++;
+    return ESP_OK;
+  }
+
+  char call_sign[STATION_CALL_SIGN_MAX + 1];
+  copy_text(call_sign, sizeof(call_sign), import->title,
+            strlen(import->title));
+  if (call_sign[0] == '\0') {
+    // Untitled playlist entries are named after their host
+    const char *host = strstr(uri, "://") + 3;
+    if (strncasecmp(host, "www.", 4) == 0) {
+      host += 4;
+    }
+    copy_text(call_sign, sizeof(call_sign), host, strcspn(host, ":/?#"));
+  }
+  char origin_text[STATION_ORIGIN_MAX + 1];
+  copy_text(origin_text, sizeof(origin_text), origin, strlen(origin));
+
+  station_entry_t entry = {.id = 0,
+                           .call_sign = call_sign,
+                           .origin = origin_text,
+                           .uri = uri,
+                           .codec = codec};
+  if (station_image_builder_add(&import->builder, &entry) != ESP_OK ||
+      url_set_add(import, key) != ESP_OK) {
+    return import_no_mem(import);
+  }
+  import->stats.added++;
+  return ESP_OK;
+}
+
+static void clear_entry(station_import_t *import) {
+  import->title[0] = '\0';
+  import->uri[0] = '\0';
+  import->codec[0] = '\0';
+  import->entry_country[0] = '\0';
+  import->entry_countrycode[0] = '\0';
+  import->entry_state[0] = '\0';
+  import->tags[0] = '\0';
+  import->has_resolved_url = false;
+}
+
+/* ---------- M3U and PLS ---------- */
+
+// Title of "#EXTINF:<length> [attributes],<title>"; attribute values may
+// contain commas
+static const char *extinf_title(const char *line) {
+  bool quoted = false;
+  for (const char *p = line; *p; p++) {
+    if (*p == '"') {
+      quoted = !quoted;
+    } else if (*p == ',' && !quoted) {
+      return p + 1;
+    }
+  }
+  return "";
+}
+
+static esp_err_t m3u_line(station_import_t *import, char *line) {
+  if (line[0] == '\0') {
+    return ESP_OK;
+  }
+  if (line[0] == '#') {
+    if (strncasecmp(line, "#EXTINF:", 8) == 0) {
+      const char *title = extinf_title(line + 8);
+      copy_text(import->title, sizeof(import->title), title, strlen(title));
+    } else if (strncasecmp(line, "#EXT-X-", 7) == 0) {
+      // Segments or variants of one HLS stream, not a list of stations
+      return import_fail(import, "HLS playlist, not a station list");
+    }
+    return ESP_OK;
+  }
+  count_entry(import);
+  strlcpy(import->uri, line, sizeof(import->uri));
+  esp_err_t ret = add_entry(import, "");
+  clear_entry(import);
+  return ret;
+}
+
+static esp_err_t pls_entry_end(station_import_t *import) {
+  esp_err_t ret = ESP_OK;
+  if (import->pls_entry != 0 && import->uri[0] != '\0') {
+    count_entry(import);
+    ret = add_entry(import, "");
+  }
+  clear_entry(import);
+  import->pls_entry = 0;
+  return ret;
+}
+
+// "FileN=", "TitleN=" and "LengthN=" lines, grouped by N
+static esp_err_t pls_line(station_import_t *import, char *line) {
+  char *eq = strchr(line, '=');
+  if (line[0] == '[' || eq == NULL) {
+    return ESP_OK;
+  }
+  static const char *const keys[] = {"File", "Title"};
+  for (int k = 0; k < 2; k++) {
+    size_t key_len = strlen(keys[k]);
+    if (strncasecmp(line, keys[k], key_len) != 0) {
+      continue;
+    }
+    char *end;
+    long n = strtol(line + key_len, &end, 10);
+    if (end == line + key_len || end != eq || n <= 0) {
+      return ESP_OK;
+    }
+    if (n != import->pls_entry) {
+      esp_err_t ret = pls_entry_end(import);
+      if (ret != ESP_OK) {
+        return ret;
+      }
+      import->pls_entry = n;
+    }
+    const char *value = eq + 1;
+    if (k == 0) {
+      strlcpy(import->uri, value, sizeof(import->uri));
+    } else {
+      copy_text(import->title, sizeof(import->title), value, strlen(value));
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t line_end(station_import_t *import) {
+  size_t len = import->line_len;
+  while (len > 0 && (unsigned char)import->line[len - 1] <= ' ') {
+    len--;
+  }
+  import->line[len] = '\0';
+  char *line = import->line;
+  while (*line == ' ' || *line == '\t') {
+    line++;
+  }
+  import->line_len = 0;
+  return import->format == STATION_IMPORT_PLS ? pls_line(import, line)
+                                              : m3u_line(import, line);
+}
+
+static esp_err_t feed_lines(station_import_t *import, const char *data,
+                            size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (data[i] == '\n') {
+      esp_err_t ret = line_end(import);
+      if (ret != ESP_OK) {
+        return ret;
+      }
+    } else if (import->line_len < LINE_MAX_LEN) {
+      import->line[import->line_len++] = data[i];
+    }
+  }
+  return ESP_OK;
+}
+
+/* ---------- XSPF ---------- */
+
+// Decodes the XML entities that occur in URLs and titles, in place
+static void decode_entities(char *s) {
+  static const struct {
+    const char *name;
+    char c;
+  } entities[] = {{"amp;", '&'},  {"lt;", '<'},   {"gt;", '>'},
+                  {"quot;", '"'}, {"apos;", '\''}};
+  char *out = s;
+  while (*s) {
+    if (*s != '&') {
+      *out++ = *s++;
+      continue;
+    }
+    bool done = false;
+    for (size_t i = 0; i < sizeof(entities) / sizeof(entities[0]); i++) {
+      size_t n = strlen(entities[i].name);
+      if (strncmp(s + 1, entities[i].name, n) == 0) {
+        *out++ = entities[i].c;
+        s += n + 1;
+        done = true;
+        break;
+      }
+    }
+    if (!done && s[1] == '#') {
+      char *end;
+      long cp = s[2] == 'x' ? strtol(s + 3, &end, 16) : strtol(s + 2, &end, 10);
+      if (*end == ';' && cp > 0 && cp < 0x80) {
+        *out++ = (char)cp;
+        s = end + 1;
+        done = true;
+      }
+    }
+    if (!done) {
+      *out++ = *s++;
+    }
+  }
+  *out = '\0';
+}
+
+static esp_err_t xspf_tag(station_import_t *import) {
+  import->xml_tag[import->xml_tag_len] = '\0';
+  const char *name = import->xml_tag;
+  bool closing = name[0] == '/';
+  if (closing) {
+    name++;
+  }
+  const char *colon = strchr(name, ':'); // namespace prefix
+  if (colon != NULL) {
+    name = colon + 1;
+  }
+
+  import->xspf_field = XSPF_NONE;
+  if (strcmp(name, "track") == 0) {
+    if (!closing) {
+      clear_entry(import);
+      import->in_track = true;
+      import->has_location = false;
+      return ESP_OK;
+    }
+    if (!import->in_track) {
+      return ESP_OK;
+    }
+    import->in_track = false;
+    count_entry(import);
+    decode_entities(import->uri);
+    decode_entities(import->title);
+    esp_err_t ret = add_entry(import, "");
+    clear_entry(import);
+    return ret;
+  }
+  if (closing || !import->in_track) {
+    return ESP_OK;
+  }
+  // A track may list alternative locations; the first one is used
+  if (strcmp(name, "location") == 0 && !import->has_location) {
+    import->has_location = true;
+    import->xspf_field = XSPF_LOCATION;
+    import->xspf_len = 0;
+  } else if (strcmp(name, "title") == 0) {
+    import->xspf_field = XSPF_TITLE;
+    import->xspf_len = 0;
+  }
+  return ESP_OK;
+}
+
+static void xspf_text(station_import_t *import, char c) {
+  char *dst;
+  size_t size;
+  if (import->xspf_field == XSPF_LOCATION) {
+    dst = import->uri;
+    size = sizeof(import->uri);
+  } else if (import->xspf_field == XSPF_TITLE) {
+    dst = import->title;
+    size = sizeof(import->title);
+  } else {
+    return;
+  }
+  if (import->xspf_len < size - 1) {
+    dst[import->xspf_len++] = c;
+    dst[import->xspf_len] = '\0';
+  }
+}
+
+// A minimal XML scanner: tag names and the text directly inside <location>
+// and <title> of each <track>; attributes, comments and everything else are
+// skipped
+static esp_err_t feed_xml(station_import_t *import, const char *data,
+                          size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    switch (import->xml_state) {
+    case XML_TEXT:
+      if (c == '<') {
+        import->xml_state = XML_TAG_NAME;
+        import->xml_tag_len = 0;
+      } else {
+        xspf_text(import, c);
+      }
+      break;
+    case XML_TAG_NAME:
+      if (import->xml_tag_len == 0 && (c == '!' || c == '?')) {
+        import->xml_state = XML_SKIP;
+        import->xml_skip_len = c == '!' ? 0 : 2;
+        import->xml_comment = false;
+        import->xml_last[0] = import->xml_last[1] = '\0';
+      } else if (c == '>' || c == ' ' || c == '\t' || c == '\r' ||
+                 c == '\n' || (c == '/' && import->xml_tag_len > 0)) {
+        esp_err_t ret = xspf_tag(import);
+        if (ret != ESP_OK) {
+          return ret;
+        }
+        import->xml_state = c == '>' ? XML_TEXT : XML_TAG_REST;
+      } else if (import->xml_tag_len < sizeof(import->xml_tag) - 1) {
+        import->xml_tag[import->xml_tag_len++] = c;
+      }
+      break;
+    case XML_TAG_REST:
+      if (c == '>') {
+        import->xml_state = XML_TEXT;
+      }
+      break;
+    case XML_SKIP:
+      if (c == '>' &&
+          (!import->xml_comment ||
+           (import->xml_last[0] == '-' && import->xml_last[1] == '-'))) {
+        import->xml_state = XML_TEXT;
+        break;
+      }
+      if (import->xml_skip_len < 2) {
+        // "<!--" starts a comment
+        import->xml_skip_len = c == '-' ? import->xml_skip_len + 1 : 2;
+        if (import->xml_skip_len == 2 && c == '-') {
+          import->xml_comment = true;
+          c = '\0'; // the opening dashes don't close it
+        }
+      }
+      import->xml_last[0] = import->xml_last[1];
+      import->xml_last[1] = c;
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+/* ---------- radio-browser JSON ---------- */
+
+static bool contains_ignore_case(const char *haystack, const char *needle) {
+  size_t n = strlen(needle);
+  for (; *haystack; haystack++) {
+    if (strncasecmp(haystack, needle, n) == 0) {
+      return true;
+    }
+  }
+  return n == 0;
+}
+
+static esp_err_t rb_station_end(station_import_t *import) {
+  count_entry(import);
+  const char *country = import->country;
+  if ((import->broken && !import->options.include_broken) ||
+      (country[0] != '\0' &&
+       strcasecmp(import->entry_countrycode, country) != 0 &&
+       strcasecmp(import->entry_country, country) != 0) ||
+      (import->tag[0] != '\0' &&
+       !contains_ignore_case(import->tags, import->tag))) {
+    import->stats.filtered++;
+    return ESP_OK;
+  }
+  if (import->hls && !hls_stream_is_source_uri(import->uri)) {
+    // Only .m3u8 URLs are played as HLS
+    import->stats.unsupported++;
+    return ESP_OK;
+  }
+
+  // "State, CC" where the state is known, the country otherwise
+  char origin[STATION_ORIGIN_MAX + 1];
+  if (import->entry_state[0] != '\0' && import->entry_countrycode[0] != '\0') {
+    snprintf(origin, sizeof(origin), "%.48s, %.7s", import->entry_state,
+             import->entry_countrycode);
+  } else {
+    strlcpy(origin, import->entry_country, sizeof(origin));
+  }
+  return add_entry(import, origin);
+}
+
+// Depth 0 is the array, depth 1 the station objects, depth 2 their members
+static esp_err_t rb_token(const json_token_t *token, void *ctx) {
+  station_import_t *import = ctx;
+  switch (token->depth) {
+  case 0:
+    if (token->type == JSON_TOKEN_ARRAY_START ||
+        token->type == JSON_TOKEN_ARRAY_END) {
+      return ESP_OK;
+    }
+    return import_fail(import, "expected an array of stations");
+  case 1:
+    if (token->type == JSON_TOKEN_OBJECT_START) {
+      clear_entry(import);
+      import->field = RB_NONE;
+      import->hls = false;
+      import->broken = false;
+      return ESP_OK;
+    }
+    if (token->type == JSON_TOKEN_OBJECT_END) {
+      return rb_station_end(import);
+    }
+    return import_fail(import, "expected an array of stations");
+  case 2:
+    break;
+  default:
+    return ESP_OK;
+  }
+
+  if (token->type == JSON_TOKEN_KEY) {
+    static const struct {
+      const char *key;
+      rb_field_t field;
+    } keys[] = {
+        {"name", RB_NAME},
+        {"url", RB_URL},
+        {"url_resolved", RB_URL_RESOLVED},
+        {"codec", RB_CODEC},
+        {"country", RB_COUNTRY},
+        {"countrycode", RB_COUNTRYCODE},
+        {"state", RB_STATE},
+        {"tags", RB_TAGS},
+        {"hls", RB_HLS},
+        {"lastcheckok", RB_LASTCHECKOK},
+    };
+    import->field = RB_NONE;
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+      if (strcmp(token->str, keys[i].key) == 0) {
+        import->field = keys[i].field;
+        break;
+      }
+    }
+    return ESP_OK;
+  }
+
+  rb_field_t field = import->field;
+  import->field = RB_NONE;
+  if (token->type == JSON_TOKEN_NUMBER || token->type == JSON_TOKEN_BOOL) {
+    bool set = token->type == JSON_TOKEN_BOOL ? token->boolean
+                                              : token->number != 0;
+    if (field == RB_HLS) {
+      import->hls = set;
+    } else if (field == RB_LASTCHECKOK) {
+      import->broken = !set;
+    }
+    return ESP_OK;
+  }
+  if (token->type != JSON_TOKEN_STRING) {
+    return ESP_OK;
+  }
+  const char *s = token->str;
+  switch (field) {
+  case RB_NAME:
+    copy_text(import->title, sizeof(import->title), s, token->len);
+    break;
+  case RB_URL:
+    // url_resolved, when present, is the stream behind a playlist link
+    if (!import->has_resolved_url) {
+      strlcpy(import->uri, token->truncated ? "" : s, sizeof(import->uri));
+    }
+    break;
+  case RB_URL_RESOLVED:
+    if (s[0] != '\0') {
+      strlcpy(import->uri, token->truncated ? "" : s, sizeof(import->uri));
+      import->has_resolved_url = true;
+    }
+    break;
+  case RB_CODEC:
+    strlcpy(import->codec, s, sizeof(import->codec));
+    break;
+  case RB_COUNTRY:
+    copy_text(import->entry_country, sizeof(import->entry_country), s,
+              token->len);
+    break;
+  case RB_COUNTRYCODE:
+    copy_text(import->entry_countrycode, sizeof(import->entry_countrycode), s,
+              token->len);
+    break;
+  case RB_STATE:
+    copy_text(import->entry_state, sizeof(import->entry_state), s, token->len);
+    break;
+  case RB_TAGS:
+    strlcpy(import->tags, s, sizeof(import->tags));
+    break;
+  default:
+    break;
+  }
+  return ESP_OK;
+}
+
+/* ---------- formats ---------- */
+
+static station_import_format_t detect_format(const char *s, size_t len) {
+  size_t i = 0;
+  while (i < len && (unsigned char)s[i] <= ' ') {
+    i++;
+  }
+  if (i == len) {
+    return STATION_IMPORT_M3U;
+  }
+  if (len - i >= 10 && strncasecmp(s + i, "[playlist]", 10) == 0) {
+    return STATION_IMPORT_PLS;
+  }
+  if (len - i >= 5 && (strncasecmp(s + i, "File1", 5) == 0 ||
+                       strncasecmp(s + i, "NumberOfEntries", 5) == 0)) {
+    return STATION_IMPORT_PLS;
+  }
+  if (s[i] == '[' || s[i] == '{') {
+    return STATION_IMPORT_RADIO_BROWSER;
+  }
+  if (s[i] == '<') {
+    return STATION_IMPORT_XSPF;
+  }
+  return STATION_IMPORT_M3U;
+}
+
+static esp_err_t feed_format(station_import_t *import, const char *data,
+                             size_t len) {
+  switch (import->format) {
+  case STATION_IMPORT_RADIO_BROWSER: {
+    esp_err_t ret = json_stream_feed(&import->js, data, len);
+    if (ret == ESP_ERR_INVALID_SIZE || ret == ESP_ERR_INVALID_ARG) {
+      char what[48];
+      snprintf(what, sizeof(what), "invalid JSON at byte %u",
+               (unsigned)import->js.offset);
+      return import_fail(import, what);
+    }
+    return ret;
+  }
+  case STATION_IMPORT_XSPF:
+    return feed_xml(import, data, len);
+  default:
+    return feed_lines(import, data, len);
+  }
+}
+
+// Settles the format and replays the bytes held back to detect it
+static esp_err_t start_format(station_import_t *import) {
+  const char *s = import->sniff;
+  size_t len = import->sniff_len;
+  if (len >= 3 && memcmp(s, "\xEF\xBB\xBF", 3) == 0) { // UTF-8 BOM
+    s += 3;
+    len -= 3;
+  }
+  if (import->format == STATION_IMPORT_AUTO) {
+    import->format = detect_format(s, len);
+  }
+  static const char *const names[] = {"auto", "radio-browser", "M3U", "PLS",
+                                      "XSPF"};
+  ESP_LOGI(TAG, "Importing %s", names[import->format]);
+  import->started = true;
+  import->sniff_len = 0;
+  return feed_format(import, s, len);
+}
+
+/* ---------- public API ---------- */
+
+station_import_t *station_import_begin(const station_import_options_t *options) {
+  station_import_t *import = import_alloc(sizeof(station_import_t));
+  if (import == NULL) {
+    return NULL;
+  }
+  import->options = *options;
+  strlcpy(import->country, options->country ? options->country : "",
+          sizeof(import->country));
+  strlcpy(import->tag, options->tag ? options->tag : "", sizeof(import->tag));
+  import->options.country = import->country;
+  import->options.tag = import->tag;
+  import->format = options->format;
+  json_stream_init(&import->js, rb_token, import);
+  import->js.truncate_strings = true;
+  station_image_builder_init(&import->builder);
+
+  import->base = station_snapshot_acquire();
+  int kept = options->replace ? 0 : import->base->count;
+  import->limit = STATION_MAX_COUNT - kept;
+  if (options->limit > 0 && options->limit < import->limit) {
+    import->limit = options->limit;
+  }
+  // Existing stations keep their ids and take part in the dedupe
+  for (int i = 0; i < kept; i++) {
+    const station_t *st = &import->base->stations[i];
+    station_entry_t entry = {.id = st->id,
+                             .call_sign = st->call_sign,
+                             .origin = st->origin,
+                             .uri = st->uri,
+                             .codec = st->codec};
+    if (station_image_builder_add(&import->builder, &entry) != ESP_OK ||
+        url_set_add(import, url_key(st->uri)) != ESP_OK) {
+      station_import_free(import);
+      return NULL;
+    }
+  }
+  return import;
+}
+
+esp_err_t station_import_feed(station_import_t *import, const char *data,
+                              size_t len) {
+  if (import->error[0] != '\0') {
+    return ESP_ERR_INVALID_STATE;
+  }
+  import->stats.bytes += len;
+  if (!import->started) {
+    // Hold back the start of the input until there is enough to go by
+    size_t n = MIN(len, SNIFF_LEN - import->sniff_len);
+    memcpy(import->sniff + import->sniff_len, data, n);
+    import->sniff_len += n;
+    data += n;
+    len -= n;
+    if (import->sniff_len < SNIFF_LEN) {
+      return ESP_OK;
+    }
+    esp_err_t ret = start_format(import);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+  }
+  return feed_format(import, data, len);
+}
+
+// Puts the list back as it was before a failed save
+static void restore_base(station_import_t *import) {
+  station_image_builder_t builder;
+  station_image_builder_init(&builder);
+  for (int i = 0; i < import->base->count; i++) {
+    const station_t *st = &import->base->stations[i];
+    station_entry_t entry = {.id = st->id,
+                             .call_sign = st->call_sign,
+                             .origin = st->origin,
+                             .uri = st->uri,
+                             .codec = st->codec};
+    if (station_image_builder_add(&builder, &entry) != ESP_OK) {
+      station_image_builder_discard(&builder);
+      return;
+    }
+  }
+  station_image_t image;
+  if (station_image_builder_finish(&builder, &image) == ESP_OK) {
+    station_data_install(&image);
+  }
+}
+
+esp_err_t station_import_finish(station_import_t *import) {
+  if (import->error[0] != '\0') {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t ret = ESP_OK;
+  if (!import->started) {
+    ret = start_format(import);
+  }
+  if (ret == ESP_OK) {
+    switch (import->format) {
+    case STATION_IMPORT_RADIO_BROWSER:
+      if (json_stream_finish(&import->js) != ESP_OK) {
+        ret = import_fail(import, "incomplete JSON");
+      }
+      break;
+    case STATION_IMPORT_M3U:
+      ret = line_end(import);
+      break;
+    case STATION_IMPORT_PLS:
+      ret = line_end(import);
+      if (ret == ESP_OK) {
+        ret = pls_entry_end(import);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  log_progress(import);
+
+  if (station_data_version() != import->base->version) {
+    snprintf(import->error, sizeof(import->error),
+             "station list changed during the import");
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (import->stats.added == 0) {
+    if (import->options.replace) {
+      return import_fail(import, "no playable stations found");
+    }
+    import->stats.stations = import->base->count;
+    return ESP_OK; // nothing new; the list stays as it is
+  }
+
+  station_image_t image;
+  ret = station_image_builder_finish(&import->builder, &image);
+  if (ret == ESP_OK) {
+    ret = station_data_install(&image);
+  }
+  if (ret != ESP_OK) {
+    return import_no_mem(import);
+  }
+  if (save_station_data() != 0) {
+    restore_base(import);
+    snprintf(import->error, sizeof(import->error),
+             "not enough storage for the new list");
+    return ESP_FAIL;
+  }
+
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  import->stats.stations = snapshot->count;
+  station_snapshot_release(snapshot);
+  const station_import_stats_t *s = &import->stats;
+  ESP_LOGI(TAG,
+           "Imported %u of %u entries (%u duplicates, %u filtered, %u "
+           "unsupported, %u invalid, %u over the limit); %u stations",
+           (unsigned)s->added, (unsigned)s->entries, (unsigned)s->duplicates,
+           (unsigned)s->filtered, (unsigned)s->unsupported,
+           (unsigned)s->invalid, (unsigned)s->dropped, (unsigned)s->stations);
+  return ESP_OK;
+}
+
+void station_import_get_stats(const station_import_t *import,
+                              station_import_stats_t *stats) {
+  *stats = import->stats;
+}
+
+const char *station_import_error(const station_import_t *import) {
+  return import->error;
+}
+
+void station_import_free(station_import_t *import) {
+  if (import == NULL) {
+    return;
+  }
+  station_image_builder_discard(&import->builder);
+  station_snapshot_release(import->base);
+  free(import->urls);
+  free(import);
+}
+
+esp_err_t station_import_feed_file(station_import_t *import,
+                                   const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    snprintf(import->error, sizeof(import->error), "can't open %s", path);
+    return ESP_ERR_NOT_FOUND;
+  }
+  struct stat st;
+  if (import->options.total_bytes == 0 && stat(path, &st) == 0) {
+    import->options.total_bytes = st.st_size;
+  }
+  char buf[512];
+  size_t n;
+  esp_err_t ret = ESP_OK;
+  while (ret == ESP_OK && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    ret = station_import_feed(import, buf, n);
+  }
+  fclose(f);
+  return ret;
+}
+
+station_import_format_t station_import_format_from_name(const char *name) {
+  if (name == NULL) {
+    return STATION_IMPORT_AUTO;
+  }
+  if (strcasecmp(name, "radio-browser") == 0) {
+    return STATION_IMPORT_RADIO_BROWSER;
+  }
+  const char *dot = strrchr(name, '.');
+  const char *ext = dot != NULL ? dot + 1 : name;
+  if (strcasecmp(ext, "json") == 0) {
+    return STATION_IMPORT_RADIO_BROWSER;
+  }
+  if (strcasecmp(ext, "m3u") == 0 || strcasecmp(ext, "m3u8") == 0) {
+    return STATION_IMPORT_M3U;
+  }
+  if (strcasecmp(ext, "pls") == 0) {
+    return STATION_IMPORT_PLS;
+  }
+  if (strcasecmp(ext, "xspf") == 0) {
+    return STATION_IMPORT_XSPF;
+  }
+  return STATION_IMPORT_AUTO;
+}
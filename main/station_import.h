@@ -0,0 +1,122 @@
+#ifndef STATION_IMPORT_H
+#define STATION_IMPORT_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bulk station import from directory dumps and playlists
+ *
+ * Accepts a radio-browser.info JSON export or an M3U, PLS or XSPF playlist,
+ * streamed in chunks of any size. Each entry is mapped to a station as soon
+ * as it is complete: the codec comes from the entry's metadata or, failing
+ * that, the URL; entries whose normalized URL is already in the list (or
+ * earlier in the same file) are skipped. Memory use is the new station image
+ * plus a table of URL hashes, independent of the size of the input, so a
+ * dump of tens of thousands of entries can be filtered down on the device.
+ *
+ * finish() merges the new stations into the list (or replaces it) and saves
+ * it once, so the whole import is a single journaled write.
+ */
+
+typedef enum {
+  STATION_IMPORT_AUTO, // detected from the first bytes
+  STATION_IMPORT_RADIO_BROWSER,
+  STATION_IMPORT_M3U,
+  STATION_IMPORT_PLS,
+  STATION_IMPORT_XSPF,
+} station_import_format_t;
+
+typedef struct {
+  station_import_format_t format;
+  bool replace; // replace the list instead of adding to it
+  int limit;    // most stations to add, 0 for as many as fit
+  // radio-browser only: country code or name, and a tag, to keep (NULL or
+  // empty keeps all). Stations marked as failing their last check are
+  // skipped unless include_broken is set.
+  const char *country;
+  const char *tag;
+  bool include_broken;
+  size_t total_bytes; // input size if known, for progress logging
+} station_import_options_t;
+
+/**
+ * @brief Import counters. Every entry read ends up in exactly one of the
+ * counters after entries.
+ */
+typedef struct {
+  uint32_t bytes;       // input consumed
+  uint32_t entries;     // entries read
+  uint32_t added;       // new stations
+  uint32_t duplicates;  // URL already in the list
+  uint32_t filtered;    // excluded by country, tag or a failed check
+  uint32_t unsupported; // codec, HLS without .m3u8 or nested playlist
+  uint32_t invalid;     // missing or malformed URL
+  uint32_t dropped;     // over the limit
+  uint32_t stations;    // list size after finish
+} station_import_stats_t;
+
+typedef struct station_import station_import_t;
+
+/**
+ * @brief Starts an import. The options' strings are copied.
+ * @return NULL if out of memory.
+ */
+station_import_t *station_import_begin(const station_import_options_t *options);
+
+/**
+ * @brief Consumes the next chunk of input.
+ * @return ESP_ERR_INVALID_ARG if the input is malformed (see
+ * station_import_error()), ESP_ERR_NO_MEM if out of memory.
+ */
+esp_err_t station_import_feed(station_import_t *import, const char *data,
+                              size_t len);
+
+/**
+ * @brief Ends the input, installs the merged list and saves it.
+ * @return ESP_ERR_INVALID_STATE if the list was changed by someone else
+ * during the import, ESP_FAIL if it could not be saved.
+ */
+esp_err_t station_import_finish(station_import_t *import);
+
+/**
+ * @brief Returns the counters so far.
+ */
+void station_import_get_stats(const station_import_t *import,
+                              station_import_stats_t *stats);
+
+/**
+ * @brief Describes why feed or finish failed.
+ */
+const char *station_import_error(const station_import_t *import);
+
+/**
+ * @brief Frees an import, finished or not.
+ */
+void station_import_free(station_import_t *import);
+
+/**
+ * @brief Feeds a whole file from a mounted filesystem (SPIFFS or SD card).
+ * Sets the options' total_bytes from the file size if it was not given.
+ * @return ESP_ERR_NOT_FOUND if the file can't be opened, otherwise as
+ * station_import_feed().
+ */
+esp_err_t station_import_feed_file(station_import_t *import, const char *path);
+
+/**
+ * @brief Maps a format name or file extension ("radio-browser", "json",
+ * "m3u", "m3u8", "pls", "xspf") to a format; anything else is AUTO.
+ */
+station_import_format_t station_import_format_from_name(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_IMPORT_H
@@ -0,0 +1,547 @@
+#include "station_index.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "STATION_INDEX";
+
+// Separates call sign and origin in the normalized text; never produced by
+// normalize(), so neither trigrams nor substring matches span both fields
+#define FIELD_SEP '\x1f'
+#define QUERY_MAX 64
+
+// Ranking, best first
+#define SCORE_EXACT 1000
+#define SCORE_CALL_SIGN_PREFIX 800
+#define SCORE_ORIGIN_PREFIX 600
+#define SCORE_WORD_PREFIX 400
+#define SCORE_SUBSTRING 200
+
+struct station_index {
+  int count;
+  char *text;         // "call sign" FIELD_SEP "origin" NUL, per station
+  uint32_t *text_off; // [count + 1], start of each station's text
+  uint32_t *keys;     // sorted distinct trigrams
+  uint32_t *starts;   // [trigrams + 1], posting list bounds
+  uint32_t *postings; // station indices, ascending within each list
+  uint32_t trigrams;
+  uint32_t *words; // text offsets of word starts, sorted by suffix
+  uint32_t word_count;
+  // Results for every one character query, computed at build time since the
+  // first keystroke matches the most words
+  station_match_t *initials;
+  uint32_t initial_start[257]; // by first byte
+  int32_t first_station[256];  // first station by call sign initial, or -1
+  uint32_t bytes;
+  uint32_t build_us;
+};
+
+typedef struct {
+  uint32_t key;
+  uint32_t station;
+} trigram_ref_t;
+
+static void *index_alloc(size_t size) {
+  if (size == 0) {
+    size = 1;
+  }
+  void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return ptr != NULL ? ptr : malloc(size);
+}
+
+static char fold(unsigned char c) {
+  if (c >= 'A' && c <= 'Z') {
+    return (char)(c + ('a' - 'A'));
+  }
+  if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80) {
+    return (char)c;
+  }
+  return ' ';
+}
+
+// Case folds src into dst and collapses punctuation and runs of whitespace
+// into single spaces. Returns the length written.
+static size_t normalize(char *dst, const char *src, size_t max) {
+  size_t len = 0;
+  for (; *src != '\0' && len < max; src++) {
+    char c = fold((unsigned char)*src);
+    if (c == ' ' && (len == 0 || dst[len - 1] == ' ')) {
+      continue;
+    }
+    dst[len++] = c;
+  }
+  while (len > 0 && dst[len - 1] == ' ') {
+    len--;
+  }
+  return len;
+}
+
+static inline uint32_t trigram_key(const char *s) {
+  return ((uint32_t)(unsigned char)s[0] << 16) |
+         ((uint32_t)(unsigned char)s[1] << 8) | (unsigned char)s[2];
+}
+
+static inline bool is_word_start(const char *text, uint32_t off) {
+  char c = text[off];
+  if (c == ' ' || c == FIELD_SEP || c == '\0') {
+    return false;
+  }
+  return off == 0 || text[off - 1] == ' ' || text[off - 1] == FIELD_SEP ||
+         text[off - 1] == '\0';
+}
+
+static int compare_refs(const void *a, const void *b) {
+  const trigram_ref_t *x = a, *y = b;
+  if (x->key != y->key) {
+    return x->key < y->key ? -1 : 1;
+  }
+  return (x->station > y->station) - (x->station < y->station);
+}
+
+// Text of the index being built, for compare_words (qsort has no context
+// argument). Indexes are only built by the station list writer, one at a time.
+static const char *sort_text;
+
+// Compares the word suffixes up to the end of their field
+static int compare_words(const void *a, const void *b) {
+  const unsigned char *x = (const unsigned char *)sort_text + *(const uint32_t *)a;
+  const unsigned char *y = (const unsigned char *)sort_text + *(const uint32_t *)b;
+  while (*x == *y && *x != '\0' && *x != FIELD_SEP) {
+    x++;
+    y++;
+  }
+  unsigned cx = (*x == FIELD_SEP) ? 0 : *x;
+  unsigned cy = (*y == FIELD_SEP) ? 0 : *y;
+  if (cx != cy) {
+    return cx < cy ? -1 : 1;
+  }
+  return (*(const uint32_t *)a > *(const uint32_t *)b) -
+         (*(const uint32_t *)a < *(const uint32_t *)b);
+}
+
+void station_index_free(station_index_t *index) {
+  if (index == NULL) {
+    return;
+  }
+  free(index->text);
+  free(index->text_off);
+  free(index->keys);
+  free(index->starts);
+  free(index->postings);
+  free(index->words);
+  free(index->initials);
+  free(index);
+}
+
+static int search_index(const station_index_t *index, const char *q,
+                        size_t qlen, station_match_t *out, int max);
+
+static station_index_t *index_build(const station_t *stations, int count) {
+  station_index_t *index = calloc(1, sizeof(station_index_t));
+  if (index == NULL) {
+    return NULL;
+  }
+  index->count = count;
+
+  size_t text_size = 1;
+  for (int i = 0; i < count; i++) {
+    text_size += strlen(stations[i].call_sign) + strlen(stations[i].origin) + 2;
+  }
+  index->text = index_alloc(text_size);
+  index->text_off = index_alloc(sizeof(uint32_t) * (count + 1));
+  if (index->text == NULL || index->text_off == NULL) {
+    goto fail;
+  }
+
+  // Pass 1: normalized text, and an upper bound for trigram references and
+  // word starts
+  size_t pos = 0, ref_bound = 0, word_bound = 0;
+  for (int i = 0; i < count; i++) {
+    index->text_off[i] = pos;
+    size_t n = normalize(index->text + pos, stations[i].call_sign,
+                         STATION_CALL_SIGN_MAX);
+    ref_bound += n > 2 ? n - 2 : 0;
+    pos += n;
+    index->text[pos++] = FIELD_SEP;
+    n = normalize(index->text + pos, stations[i].origin, STATION_ORIGIN_MAX);
+    ref_bound += n > 2 ? n - 2 : 0;
+    pos += n;
+    index->text[pos++] = '\0';
+  }
+  index->text_off[count] = pos;
+  for (size_t off = 0; off < pos; off++) {
+    word_bound += is_word_start(index->text, off);
+  }
+
+  // Pass 2: (trigram, station) references, sorted and deduplicated, then
+  // compacted in place into the posting lists
+  trigram_ref_t *refs = index_alloc(sizeof(trigram_ref_t) * ref_bound);
+  index->words = index_alloc(sizeof(uint32_t) * word_bound);
+  if (refs == NULL || index->words == NULL) {
+    free(refs);
+    goto fail;
+  }
+  size_t ref_count = 0;
+  for (int i = 0; i < count; i++) {
+    const char *t = index->text + index->text_off[i];
+    const char *end = index->text + index->text_off[i + 1] - 1;
+    for (; t + 2 < end; t++) {
+      if (t[0] == FIELD_SEP || t[1] == FIELD_SEP || t[2] == FIELD_SEP) {
+        continue;
+      }
+      refs[ref_count].key = trigram_key(t);
+      refs[ref_count].station = i;
+      ref_count++;
+    }
+  }
+  qsort(refs, ref_count, sizeof(trigram_ref_t), compare_refs);
+
+  size_t distinct = 0;
+  for (size_t i = 0; i < ref_count; i++) {
+    distinct += (i == 0 || refs[i].key != refs[i - 1].key);
+  }
+  index->keys = index_alloc(sizeof(uint32_t) * distinct);
+  index->starts = index_alloc(sizeof(uint32_t) * (distinct + 1));
+  if (index->keys == NULL || index->starts == NULL) {
+    free(refs);
+    goto fail;
+  }
+  // Writing postings[n] never overtakes reading refs[i] (n <= i and a
+  // posting is half the size of a reference), but it may overwrite
+  // refs[i - 1], so the previous reference is kept aside
+  uint32_t *postings = (uint32_t *)refs;
+  size_t n = 0, k = 0;
+  uint32_t prev_key = 0, prev_station = UINT32_MAX;
+  for (size_t i = 0; i < ref_count; i++) {
+    uint32_t key = refs[i].key, station = refs[i].station;
+    if (key == prev_key && station == prev_station) {
+      continue;
+    }
+    prev_key = key;
+    prev_station = station;
+    if (k == 0 || index->keys[k - 1] != key) {
+      index->keys[k] = key;
+      index->starts[k] = n;
+      k++;
+    }
+    postings[n++] = station;
+  }
+  index->starts[k] = n;
+  index->trigrams = k;
+  index->postings = postings;
+  if (n > 0) {
+    uint32_t *shrunk = realloc(postings, sizeof(uint32_t) * n);
+    if (shrunk != NULL) {
+      index->postings = shrunk;
+    }
+  }
+
+  // Pass 3: word prefix table
+  for (size_t off = 0; off < pos; off++) {
+    if (is_word_start(index->text, off)) {
+      index->words[index->word_count++] = off;
+    }
+  }
+  sort_text = index->text;
+  qsort(index->words, index->word_count, sizeof(uint32_t), compare_words);
+  sort_text = NULL;
+
+  // Pass 4: one character results
+  size_t initial_count = 0;
+  for (uint32_t i = 0; i < index->word_count;) {
+    unsigned char c = index->text[index->words[i]];
+    initial_count += STATION_INDEX_MAX_RESULTS;
+    while (i < index->word_count &&
+           (unsigned char)index->text[index->words[i]] == c) {
+      i++;
+    }
+  }
+  // Computed by the regular search, so published only once complete
+  station_match_t *initials =
+      index_alloc(sizeof(station_match_t) * initial_count);
+  if (initials == NULL) {
+    goto fail;
+  }
+  uint32_t filled = 0;
+  for (int c = 0; c < 256; c++) {
+    index->initial_start[c] = filled;
+    char q = (char)c;
+    if (c != 0) {
+      filled += search_index(index, &q, 1, initials + filled,
+                             STATION_INDEX_MAX_RESULTS);
+    }
+  }
+  index->initial_start[256] = filled;
+  index->initials = initials;
+
+  for (int c = 0; c < 256; c++) {
+    index->first_station[c] = -1;
+  }
+  for (int i = count - 1; i >= 0; i--) {
+    unsigned char c = index->text[index->text_off[i]];
+    if (c != (unsigned char)FIELD_SEP) {
+      index->first_station[c] = i;
+    }
+  }
+
+  index->bytes = sizeof(station_index_t) + text_size +
+                 sizeof(uint32_t) * (count + 1) +
+                 sizeof(uint32_t) * (2 * k + 1) + sizeof(uint32_t) * n +
+                 sizeof(uint32_t) * index->word_count +
+                 sizeof(station_match_t) * initial_count;
+  return index;
+
+fail:
+  station_index_free(index);
+  return NULL;
+}
+
+station_index_t *station_index_build(const station_t *stations, int count) {
+  int64_t start = esp_timer_get_time();
+  station_index_t *index = index_build(stations, count);
+  if (index == NULL) {
+    ESP_LOGE(TAG, "Out of memory building the index for %d stations", count);
+    return NULL;
+  }
+  index->build_us = (uint32_t)(esp_timer_get_time() - start);
+  ESP_LOGI(TAG, "Indexed %d stations: %u trigrams, %u words, %u bytes in %u us",
+           count, (unsigned)index->trigrams, (unsigned)index->word_count,
+           (unsigned)index->bytes, (unsigned)index->build_us);
+  return index;
+}
+
+static const uint32_t *find_postings(const station_index_t *index,
+                                     uint32_t key, uint32_t *len) {
+  uint32_t lo = 0, hi = index->trigrams;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (index->keys[mid] < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == index->trigrams || index->keys[lo] != key) {
+    *len = 0;
+    return NULL;
+  }
+  *len = index->starts[lo + 1] - index->starts[lo];
+  return index->postings + index->starts[lo];
+}
+
+// Compares a word suffix with the query; 0 when the word starts with it
+static int compare_word_prefix(const char *text, uint32_t off, const char *q,
+                               size_t qlen) {
+  const unsigned char *w = (const unsigned char *)text + off;
+  for (size_t i = 0; i < qlen; i++) {
+    unsigned c = (w[i] == FIELD_SEP) ? 0 : w[i];
+    if (c != (unsigned char)q[i]) {
+      return c < (unsigned char)q[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static int station_of(const station_index_t *index, uint32_t off) {
+  int lo = 0, hi = index->count;
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+    if (index->text_off[mid] <= off) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Searches text for q within one field (no match across FIELD_SEP)
+static const char *find_in_text(const char *text, const char *q, size_t qlen) {
+  for (const char *t = text; *t != '\0'; t++) {
+    if (*t == q[0] && strncmp(t, q, qlen) == 0 &&
+        memchr(t, FIELD_SEP, qlen) == NULL) {
+      return t;
+    }
+  }
+  return NULL;
+}
+
+static int score_station(const station_index_t *index, int station,
+                         const char *q, size_t qlen) {
+  const char *text = index->text + index->text_off[station];
+  const char *origin = strchr(text, FIELD_SEP) + 1;
+  size_t call_len = origin - 1 - text;
+  const char *hit = find_in_text(text, q, qlen);
+  if (hit == NULL) {
+    return 0;
+  }
+
+  int score = SCORE_SUBSTRING;
+  if (call_len == qlen && hit == text) {
+    score = SCORE_EXACT;
+  } else if (hit == text) {
+    score = SCORE_CALL_SIGN_PREFIX;
+  } else if (strncmp(origin, q, qlen) == 0) {
+    score = SCORE_ORIGIN_PREFIX;
+  } else {
+    for (const char *t = hit; t != NULL; t = find_in_text(t + 1, q, qlen)) {
+      if (is_word_start(text, t - text)) {
+        score = SCORE_WORD_PREFIX;
+        break;
+      }
+    }
+  }
+  // Shorter call signs first within a rank
+  return score * 64 - (int)(call_len < 63 ? call_len : 63);
+}
+
+static inline bool ranks_before(int score, int station,
+                                const station_match_t *m) {
+  return score > m->score || (score == m->score && station < m->index);
+}
+
+// Keeps out[] sorted best first; ties go to the lower station index
+static int offer(station_match_t *out, int found, int max, int station,
+                 int score) {
+  if (found == max && !ranks_before(score, station, &out[max - 1])) {
+    return found;
+  }
+  int i = found < max ? found++ : max - 1;
+  while (i > 0 && ranks_before(score, station, &out[i - 1])) {
+    out[i] = out[i - 1];
+    i--;
+  }
+  out[i].index = station;
+  out[i].score = score;
+  return found;
+}
+
+static int search_index(const station_index_t *index, const char *q,
+                        size_t qlen, station_match_t *out, int max) {
+  int found = 0;
+  if (qlen >= 3) {
+    // Candidates from the rarest trigram, verified by substring match
+    const uint32_t *best = NULL;
+    uint32_t best_len = UINT32_MAX;
+    for (size_t i = 0; i + 2 < qlen; i++) {
+      uint32_t len;
+      const uint32_t *list = find_postings(index, trigram_key(q + i), &len);
+      if (list == NULL) {
+        return 0;
+      }
+      if (len < best_len) {
+        best = list;
+        best_len = len;
+      }
+    }
+    for (uint32_t i = 0; i < best_len; i++) {
+      int score = score_station(index, best[i], q, qlen);
+      if (score > 0) {
+        found = offer(out, found, max, best[i], score);
+      }
+    }
+    return found;
+  }
+
+  if (qlen == 1 && index->initials != NULL) {
+    unsigned char c = (unsigned char)q[0];
+    uint32_t count = index->initial_start[c + 1] - index->initial_start[c];
+    found = count < (uint32_t)max ? (int)count : max;
+    memcpy(out, index->initials + index->initial_start[c],
+           sizeof(station_match_t) * found);
+    return found;
+  }
+
+  // Short query: the range of words starting with it
+  uint32_t lo = 0, hi = index->word_count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (compare_word_prefix(index->text, index->words[mid], q, qlen) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  // The word's position gives its rank directly. A station appears once per
+  // matching word and keeps its best rank.
+  for (uint32_t i = lo; i < index->word_count &&
+                        compare_word_prefix(index->text, index->words[i], q,
+                                            qlen) == 0;
+       i++) {
+    uint32_t off = index->words[i];
+    int station = station_of(index, off);
+    const char *text = index->text + index->text_off[station];
+    size_t call_len = strchr(text, FIELD_SEP) - text;
+    int score = SCORE_WORD_PREFIX;
+    if (off == index->text_off[station]) {
+      score = call_len == qlen ? SCORE_EXACT : SCORE_CALL_SIGN_PREFIX;
+    } else if (index->text[off - 1] == FIELD_SEP) {
+      score = SCORE_ORIGIN_PREFIX;
+    }
+    score = score * 64 - (int)(call_len < 63 ? call_len : 63);
+
+    int j = 0;
+    while (j < found && out[j].index != station) {
+      j++;
+    }
+    if (j < found) {
+      if (out[j].score >= score) {
+        continue;
+      }
+      memmove(&out[j], &out[j + 1], sizeof(station_match_t) * (found - j - 1));
+      found--;
+    }
+    found = offer(out, found, max, station, score);
+  }
+  return found;
+}
+
+int station_index_search(const station_index_t *index, const char *query,
+                         station_match_t *out, int max) {
+  if (index == NULL || query == NULL || out == NULL || max <= 0) {
+    return 0;
+  }
+  if (max > STATION_INDEX_MAX_RESULTS) {
+    max = STATION_INDEX_MAX_RESULTS;
+  }
+  char q[QUERY_MAX + 1];
+  size_t qlen = normalize(q, query, QUERY_MAX);
+  q[qlen] = '\0';
+  if (qlen == 0) {
+    return 0;
+  }
+  return search_index(index, q, qlen, out, max);
+}
+
+int station_index_jump_initial(const station_index_t *index, int from,
+                               int direction) {
+  if (index == NULL || from < 0 || from >= index->count) {
+    return from;
+  }
+  int c = (unsigned char)index->text[index->text_off[from]];
+  int step = direction < 0 ? -1 : 1;
+  for (int n = 1; n < 256; n++) {
+    int next = (c + step * n) & 0xFF;
+    if (index->first_station[next] >= 0) {
+      return index->first_station[next];
+    }
+  }
+  return from;
+}
+
+void station_index_get_stats(const station_index_t *index,
+                             station_index_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (index == NULL) {
+    return;
+  }
+  stats->stations = index->count;
+  stats->trigrams = index->trigrams;
+  stats->postings = index->starts[index->trigrams];
+  stats->words = index->word_count;
+  stats->bytes = index->bytes;
+  stats->build_us = index->build_us;
+}
@@ -0,0 +1,89 @@
+#ifndef STATION_INDEX_H
+#define STATION_INDEX_H
+
+#include "esp_err.h"
+#include "station_data.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most results a single query returns
+#define STATION_INDEX_MAX_RESULTS 32
+
+/**
+ * @brief One search hit.
+ */
+typedef struct {
+  int index; // position in the indexed station list
+  int score; // higher is better
+} station_match_t;
+
+typedef struct station_index station_index_t;
+
+/**
+ * @brief Index size and cost counters.
+ */
+typedef struct {
+  uint32_t stations;
+  uint32_t trigrams;  // distinct trigrams
+  uint32_t postings;  // station references in all trigram lists
+  uint32_t words;     // entries in the word prefix table
+  uint32_t bytes;     // memory held by the index
+  uint32_t build_us;  // time taken to build
+} station_index_stats_t;
+
+/*
+ * Search index over the call sign and origin of every station
+ *
+ * Text is normalized (ASCII case folded, punctuation treated as a word
+ * break). Queries of three or more characters are answered from trigram
+ * posting lists: the shortest list among the query's trigrams gives the
+ * candidates, which are then verified as substrings. Shorter queries use a
+ * sorted table of word starts, found by binary search. Matches are ranked
+ * exact call sign > call sign prefix > origin prefix > word prefix >
+ * substring, shorter call signs first. Index memory prefers PSRAM.
+ *
+ * An index is immutable once built and belongs to the station snapshot it
+ * was built for, so searches need no locking.
+ */
+
+/**
+ * @brief Builds the index for a station list.
+ * @return NULL if out of memory.
+ */
+station_index_t *station_index_build(const station_t *stations, int count);
+
+/**
+ * @brief Frees an index. NULL is ignored.
+ */
+void station_index_free(station_index_t *index);
+
+/**
+ * @brief Finds the best matches for query. A NULL index finds nothing.
+ * @return Number of results written to out (at most max).
+ */
+int station_index_search(const station_index_t *index, const char *query,
+                         station_match_t *out, int max);
+
+/**
+ * @brief Alphabetical jump: the first station (in list order) whose call sign
+ * starts with the next letter or digit after the one station from starts
+ * with, or the previous one if direction < 0. Wraps around.
+ * @return A station index, or from if there is nothing to jump to.
+ */
+int station_index_jump_initial(const station_index_t *index, int from,
+                               int direction);
+
+/**
+ * @brief Returns the index counters (all zero for NULL).
+ */
+void station_index_get_stats(const station_index_t *index,
+                             station_index_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_INDEX_H
@@ -0,0 +1,21 @@
+#include "station_list_window.h"
+
+int station_list_row_station(int count, int selected, int row) {
+  int offset = row - STATION_LIST_CENTER_ROW;
+  // A short list shows each station once, more of them below the selection
+  if (count == 0 || offset < -(count - 1) / 2 || offset > count / 2) {
+    return -1;
+  }
+  return ((selected + offset) % count + count) % count;
+}
+
+int station_list_step(int count, int from, int to) {
+  int delta = to - from;
+  if (count > 0) {
+    delta = ((delta % count) + count) % count;
+    if (delta > count / 2) {
+      delta -= count;
+    }
+  }
+  return delta;
+}
@@ -0,0 +1,39 @@
+#ifndef STATION_LIST_WINDOW_H
+#define STATION_LIST_WINDOW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Station selection list: which station each row shows
+ *
+ * The list on the station selection screen is a fixed set of label rows
+ * around the selection, refilled whenever it moves (screens.c). The list
+ * wraps, and rows that would repeat a station in a short list are hidden.
+ *
+ * Plain C without ESP-IDF or LVGL, like ssd1306_frame.h.
+ */
+
+#define STATION_LIST_VISIBLE 3
+// A spare row above and below for the scroll animation
+#define STATION_LIST_ROWS (STATION_LIST_VISIBLE + 2)
+#define STATION_LIST_CENTER_ROW (STATION_LIST_ROWS / 2)
+
+/**
+ * @brief The station shown in a row, the selection in the center row.
+ * @return Station index, or -1 for a hidden row.
+ */
+int station_list_row_station(int count, int selected, int row);
+
+/**
+ * @brief The shortest move from one selection to another around the
+ * wrapping list, negative upwards; to - from if the list is empty.
+ */
+int station_list_step(int count, int from, int to);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_LIST_WINDOW_H
@@ -0,0 +1,609 @@
+#include "station_store.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *TAG = "STATION_STORE";
+
+// The SPIFFS mount; the host tests use a scratch directory
+#ifndef STATION_STORE_DIR
+#define STATION_STORE_DIR "/spiffs"
+#endif
+#define BASE_FILE STATION_STORE_DIR "/stations.bin"
+#define COMPACT_FILE STATION_STORE_DIR "/stations.new"
+#define JOURNAL_FILE STATION_STORE_DIR "/stations.jnl"
+
+#define JOURNAL_MAGIC 0x4E4A5453 // "STJN"
+// The journal is compacted once it would outgrow half the base image; small
+// lists may still collect a few KB of edits between compactions
+#define JOURNAL_MIN_LIMIT 4096
+
+typedef enum {
+  REC_PUT = 1,    // put_payload_t + call_sign, origin, uri (NUL terminated)
+  REC_DELETE = 2, // uint32_t id
+  REC_ORDER = 3,  // uint32_t ids[]
+} journal_rec_type_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t base_crc; // crc32 of the stations.bin this journal applies to
+} journal_header_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t reserved[3];
+  uint32_t len; // payload bytes
+  uint32_t crc; // crc32 of the payload, seeded with the type
+} journal_rec_t;
+
+typedef struct {
+  uint32_t id;
+  uint8_t codec;
+  uint8_t reserved[3];
+} put_payload_t;
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+} byte_buf_t;
+
+typedef struct {
+  station_entry_t *items;
+  int count;
+  int capacity;
+} entry_list_t;
+
+typedef struct {
+  uint32_t id;
+  int index;
+} id_index_t;
+
+static uint32_t base_crc;
+static uint32_t base_size;
+static uint32_t journal_size; // 0 when there is no journal
+static station_store_stats_t stats;
+
+/* ---------- helpers ---------- */
+
+static esp_err_t write_file(const char *path, const char *mode,
+                            const void *head, size_t head_len,
+                            const void *data, size_t len) {
+  FILE *f = fopen(path, mode);
+  if (f == NULL) {
+    ESP_LOGE(TAG, "Failed to open %s", path);
+    return ESP_FAIL;
+  }
+  bool ok = (head_len == 0 || fwrite(head, 1, head_len, f) == head_len) &&
+            fwrite(data, 1, len, f) == len && fflush(f) == 0 &&
+            fsync(fileno(f)) == 0;
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    ESP_LOGE(TAG, "Failed to write %s", path);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t read_file(const char *path, uint8_t **data, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  esp_err_t ret = ESP_FAIL;
+  fseek(f, 0, SEEK_END);
+  long length = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  *data = NULL;
+  if (length > 0 && (*data = malloc(length)) != NULL) {
+    if (fread(*data, 1, length, f) == (size_t)length) {
+      *len = length;
+      ret = ESP_OK;
+    } else {
+      free(*data);
+      *data = NULL;
+    }
+  }
+  fclose(f);
+  return ret;
+}
+
+static bool buf_append(byte_buf_t *buf, const void *data, size_t len) {
+  if (buf->len + len > buf->capacity) {
+    size_t capacity = buf->capacity ? buf->capacity * 2 : 256;
+    while (capacity < buf->len + len) {
+      capacity *= 2;
+    }
+    uint8_t *data_new = realloc(buf->data, capacity);
+    if (data_new == NULL) {
+      return false;
+    }
+    buf->data = data_new;
+    buf->capacity = capacity;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return true;
+}
+
+// Appends a record whose payload is given in up to four parts
+static bool buf_append_record(byte_buf_t *buf, journal_rec_type_t type,
+                              const void *const parts[], const size_t sizes[],
+                              int n_parts) {
+  journal_rec_t rec = {.type = type, .len = 0, .crc = type};
+  for (int i = 0; i < n_parts; i++) {
+    rec.len += sizes[i];
+    rec.crc = esp_rom_crc32_le(rec.crc, parts[i], sizes[i]);
+  }
+  if (!buf_append(buf, &rec, sizeof(rec))) {
+    return false;
+  }
+  for (int i = 0; i < n_parts; i++) {
+    if (!buf_append(buf, parts[i], sizes[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compare_id_index(const void *a, const void *b) {
+  const id_index_t *x = a, *y = b;
+  return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static id_index_t *build_id_index(const station_image_t *image) {
+  uint32_t count = image->header->count;
+  id_index_t *index = malloc(sizeof(id_index_t) * (count ? count : 1));
+  if (index == NULL) {
+    return NULL;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    index[i].id = image->records[i].id;
+    index[i].index = i;
+  }
+  qsort(index, count, sizeof(id_index_t), compare_id_index);
+  return index;
+}
+
+static int find_id(const id_index_t *index, int count, uint32_t id) {
+  id_index_t key = {.id = id};
+  const id_index_t *hit =
+      bsearch(&key, index, count, sizeof(id_index_t), compare_id_index);
+  return hit ? hit->index : -1;
+}
+
+/* ---------- delta ---------- */
+
+static bool same_station(const station_image_t *a, const station_record_t *ra,
+                         const station_image_t *b,
+                         const station_record_t *rb) {
+  return ra->codec == rb->codec &&
+         strcmp(station_image_str(a, ra->call_sign_off),
+                station_image_str(b, rb->call_sign_off)) == 0 &&
+         strcmp(station_image_str(a, ra->origin_off),
+                station_image_str(b, rb->origin_off)) == 0 &&
+         strcmp(station_image_str(a, ra->uri_off),
+                station_image_str(b, rb->uri_off)) == 0;
+}
+
+static bool append_put(byte_buf_t *buf, const station_image_t *image,
+                       const station_record_t *rec) {
+  put_payload_t put = {.id = rec->id, .codec = rec->codec};
+  const char *call_sign = station_image_str(image, rec->call_sign_off);
+  const char *origin = station_image_str(image, rec->origin_off);
+  const char *uri = station_image_str(image, rec->uri_off);
+  const void *parts[] = {&put, call_sign, origin, uri};
+  const size_t sizes[] = {sizeof(put), strlen(call_sign) + 1,
+                          strlen(origin) + 1, strlen(uri) + 1};
+  return buf_append_record(buf, REC_PUT, parts, sizes, 4);
+}
+
+// Encodes the changes from saved to current as journal records
+static esp_err_t build_delta(const station_image_t *saved,
+                             const station_image_t *current, byte_buf_t *buf) {
+  int saved_count = saved->header->count;
+  int current_count = current->header->count;
+  id_index_t *saved_index = build_id_index(saved);
+  id_index_t *current_index = build_id_index(current);
+  esp_err_t ret = ESP_ERR_NO_MEM;
+  if (saved_index == NULL || current_index == NULL) {
+    goto cleanup;
+  }
+
+  int added = 0;
+  for (int i = 0; i < current_count; i++) {
+    const station_record_t *rec = &current->records[i];
+    int j = find_id(saved_index, saved_count, rec->id);
+    if (j < 0) {
+      added++;
+    }
+    if ((j < 0 || !same_station(saved, &saved->records[j], current, rec)) &&
+        !append_put(buf, current, rec)) {
+      goto cleanup;
+    }
+  }
+
+  // Replay appends new stations at the end and deletions keep the order of
+  // the rest; anything else needs an explicit order record
+  bool reordered = false;
+  int k = 0;
+  for (int i = 0; i < saved_count; i++) {
+    uint32_t id = saved->records[i].id;
+    if (find_id(current_index, current_count, id) < 0) {
+      const void *parts[] = {&id};
+      const size_t sizes[] = {sizeof(id)};
+      if (!buf_append_record(buf, REC_DELETE, parts, sizes, 1)) {
+        goto cleanup;
+      }
+    } else if (k >= current_count - added || current->records[k++].id != id) {
+      reordered = true;
+    }
+  }
+  for (; !reordered && k < current_count; k++) {
+    reordered = find_id(saved_index, saved_count, current->records[k].id) >= 0;
+  }
+  if (reordered) {
+    uint32_t *ids = malloc(sizeof(uint32_t) * (current_count ? current_count : 1));
+    if (ids == NULL) {
+      goto cleanup;
+    }
+    for (int i = 0; i < current_count; i++) {
+      ids[i] = current->records[i].id;
+    }
+    const void *parts[] = {ids};
+    const size_t sizes[] = {sizeof(uint32_t) * current_count};
+    bool ok = buf_append_record(buf, REC_ORDER, parts, sizes, 1);
+    free(ids);
+    if (!ok) {
+      goto cleanup;
+    }
+  }
+  ret = ESP_OK;
+
+cleanup:
+  free(saved_index);
+  free(current_index);
+  return ret;
+}
+
+/* ---------- replay ---------- */
+
+static int list_find(const entry_list_t *list, uint32_t id) {
+  for (int i = 0; i < list->count; i++) {
+    if (list->items[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool apply_put(entry_list_t *list, const uint8_t *payload,
+                      uint32_t len) {
+  if (len < sizeof(put_payload_t)) {
+    return false;
+  }
+  put_payload_t put;
+  memcpy(&put, payload, sizeof(put));
+  const char *strings[3];
+  const char *p = (const char *)payload + sizeof(put);
+  const char *end = (const char *)payload + len;
+  for (int i = 0; i < 3; i++) {
+    const char *nul = memchr(p, '\0', end - p);
+    if (nul == NULL) {
+      return false;
+    }
+    strings[i] = p;
+    p = nul + 1;
+  }
+
+  int i = list_find(list, put.id);
+  if (i < 0) {
+    if (list->count == list->capacity) {
+      int capacity = list->capacity ? list->capacity * 2 : 16;
+      station_entry_t *items =
+          realloc(list->items, sizeof(station_entry_t) * capacity);
+      if (items == NULL) {
+        return false;
+      }
+      list->items = items;
+      list->capacity = capacity;
+    }
+    i = list->count++;
+  }
+  list->items[i] = (station_entry_t){.id = put.id,
+                                     .call_sign = strings[0],
+                                     .origin = strings[1],
+                                     .uri = strings[2],
+                                     .codec = (codec_type_t)put.codec};
+  return true;
+}
+
+static bool apply_delete(entry_list_t *list, const uint8_t *payload,
+                         uint32_t len) {
+  uint32_t id;
+  if (len != sizeof(id)) {
+    return false;
+  }
+  memcpy(&id, payload, sizeof(id));
+  int i = list_find(list, id);
+  if (i >= 0) {
+    memmove(&list->items[i], &list->items[i + 1],
+            sizeof(station_entry_t) * (list->count - i - 1));
+    list->count--;
+  }
+  return true;
+}
+
+static bool apply_order(entry_list_t *list, const uint8_t *payload,
+                        uint32_t len) {
+  if (len % sizeof(uint32_t) != 0) {
+    return false;
+  }
+  int n = len / sizeof(uint32_t);
+  int count = list->count;
+  id_index_t *index = malloc(sizeof(id_index_t) * (count ? count : 1));
+  station_entry_t *items = malloc(sizeof(station_entry_t) * (count ? count : 1));
+  bool *used = calloc(count ? count : 1, sizeof(bool));
+  bool ok = index && items && used;
+  if (ok) {
+    for (int i = 0; i < count; i++) {
+      index[i].id = list->items[i].id;
+      index[i].index = i;
+    }
+    qsort(index, count, sizeof(id_index_t), compare_id_index);
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+      uint32_t id;
+      memcpy(&id, payload + i * sizeof(id), sizeof(id));
+      int j = find_id(index, count, id);
+      if (j >= 0 && !used[j]) {
+        used[j] = true;
+        items[k++] = list->items[j];
+      }
+    }
+    // Stations the order record does not mention keep their relative order
+    for (int j = 0; j < count; j++) {
+      if (!used[j]) {
+        items[k++] = list->items[j];
+      }
+    }
+    memcpy(list->items, items, sizeof(station_entry_t) * count);
+  }
+  free(index);
+  free(items);
+  free(used);
+  return ok;
+}
+
+// Applies the journal to base. Returns the number of bytes of valid records
+// (including the header) in *valid_len; anything past that is a torn tail.
+static esp_err_t replay_journal(const station_image_t *base,
+                                const uint8_t *journal, size_t len,
+                                station_image_t *out, size_t *valid_len,
+                                int *applied) {
+  entry_list_t list = {0};
+  int count = base->header->count;
+  list.capacity = count > 16 ? count : 16;
+  list.items = malloc(sizeof(station_entry_t) * list.capacity);
+  if (list.items == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < count; i++) {
+    const station_record_t *rec = &base->records[i];
+    list.items[i] =
+        (station_entry_t){.id = rec->id,
+                          .call_sign = station_image_str(base, rec->call_sign_off),
+                          .origin = station_image_str(base, rec->origin_off),
+                          .uri = station_image_str(base, rec->uri_off),
+                          .codec = (codec_type_t)rec->codec};
+  }
+  list.count = count;
+
+  size_t pos = sizeof(journal_header_t);
+  *applied = 0;
+  while (pos + sizeof(journal_rec_t) <= len) {
+    journal_rec_t rec;
+    memcpy(&rec, journal + pos, sizeof(rec));
+    const uint8_t *payload = journal + pos + sizeof(rec);
+    if (rec.len > len - pos - sizeof(rec) ||
+        esp_rom_crc32_le(rec.type, payload, rec.len) != rec.crc) {
+      break;
+    }
+    bool ok = false;
+    switch (rec.type) {
+    case REC_PUT:
+      ok = apply_put(&list, payload, rec.len);
+      break;
+    case REC_DELETE:
+      ok = apply_delete(&list, payload, rec.len);
+      break;
+    case REC_ORDER:
+      ok = apply_order(&list, payload, rec.len);
+      break;
+    }
+    if (!ok) {
+      break;
+    }
+    pos += sizeof(rec) + rec.len;
+    (*applied)++;
+  }
+  *valid_len = pos;
+
+  // The entries point into base and journal; the new image copies them
+  esp_err_t ret = station_image_build(list.items, list.count, out);
+  free(list.items);
+  return ret;
+}
+
+/* ---------- load / save ---------- */
+
+static void recover_compaction(void) {
+  struct stat st;
+  if (stat(COMPACT_FILE, &st) != 0) {
+    return;
+  }
+  station_image_t image;
+  if (station_image_read_file(COMPACT_FILE, &image) == ESP_OK) {
+    // The new image was complete: finish replacing the base
+    station_image_free(&image);
+    remove(BASE_FILE);
+    if (rename(COMPACT_FILE, BASE_FILE) == 0) {
+      ESP_LOGW(TAG, "Completed interrupted compaction");
+      return;
+    }
+  }
+  ESP_LOGW(TAG, "Discarding incomplete compaction");
+  remove(COMPACT_FILE);
+}
+
+static esp_err_t compact(const station_image_t *image) {
+  esp_err_t ret =
+      write_file(COMPACT_FILE, "wb", NULL, 0, image->block, image->size);
+  if (ret != ESP_OK) {
+    remove(COMPACT_FILE);
+    return ret;
+  }
+  // SPIFFS cannot rename over an existing file. A crash between these steps
+  // leaves a complete stations.new, which recover_compaction() promotes.
+  remove(BASE_FILE);
+  if (rename(COMPACT_FILE, BASE_FILE) != 0) {
+    ESP_LOGE(TAG, "Failed to rename %s", COMPACT_FILE);
+    return ESP_FAIL;
+  }
+  // A stale journal would be ignored (base CRC changed), but drop it anyway
+  remove(JOURNAL_FILE);
+  base_crc = image->header->crc32;
+  base_size = image->size;
+  journal_size = 0;
+  stats.compactions++;
+  return ESP_OK;
+}
+
+esp_err_t station_store_load(station_image_t *out) {
+  recover_compaction();
+
+  station_image_t base;
+  esp_err_t ret = station_image_read_file(BASE_FILE, &base);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  base_crc = base.header->crc32;
+  base_size = base.size;
+  journal_size = 0;
+
+  uint8_t *journal = NULL;
+  size_t len = 0;
+  if (read_file(JOURNAL_FILE, &journal, &len) != ESP_OK) {
+    *out = base;
+    return ESP_OK;
+  }
+  journal_header_t header;
+  if (len < sizeof(header)) {
+    header.magic = 0;
+  } else {
+    memcpy(&header, journal, sizeof(header));
+  }
+  if (header.magic != JOURNAL_MAGIC || header.base_crc != base_crc) {
+    ESP_LOGW(TAG, "Ignoring journal for another base image");
+    remove(JOURNAL_FILE);
+    free(journal);
+    *out = base;
+    return ESP_OK;
+  }
+
+  size_t valid_len = 0;
+  int applied = 0;
+  ret = replay_journal(&base, journal, len, out, &valid_len, &applied);
+  free(journal);
+  station_image_free(&base);
+  if (ret != ESP_OK) {
+    // Without memory for the replay the journal is kept for the next boot
+    ESP_LOGE(TAG, "Failed to replay journal (%s)", esp_err_to_name(ret));
+    return ret;
+  }
+  journal_size = len;
+  ESP_LOGI(TAG, "Replayed %d journal records (%u bytes)", applied,
+           (unsigned)valid_len);
+  if (valid_len != len) {
+    // Appending after a torn record would hide the new records on replay
+    ESP_LOGW(TAG, "Journal has a torn tail (%u of %u bytes valid), compacting",
+             (unsigned)valid_len, (unsigned)len);
+    if (compact(out) != ESP_OK) {
+      base_size = 0; // force a full write on the next save
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t station_store_save(const station_image_t *saved,
+                             const station_image_t *current) {
+  int64_t start = esp_timer_get_time();
+  byte_buf_t delta = {0};
+  bool full = saved == NULL || base_size == 0;
+  esp_err_t ret;
+
+  if (!full) {
+    ret = build_delta(saved, current, &delta);
+    if (ret != ESP_OK) {
+      full = true;
+    } else if (delta.len == 0) {
+      free(delta.data);
+      ESP_LOGI(TAG, "No station changes to save");
+      return ESP_OK;
+    } else {
+      uint32_t limit = base_size / 2;
+      full = journal_size + delta.len >
+             (limit > JOURNAL_MIN_LIMIT ? limit : JOURNAL_MIN_LIMIT);
+    }
+  }
+
+  uint32_t written;
+  uint32_t changed;
+  if (full) {
+    ret = compact(current);
+    written = current->size;
+    changed = delta.len ? delta.len : current->size;
+  } else {
+    journal_header_t header = {.magic = JOURNAL_MAGIC, .base_crc = base_crc};
+    bool fresh = journal_size == 0;
+    ret = write_file(JOURNAL_FILE, fresh ? "wb" : "ab", &header,
+                     fresh ? sizeof(header) : 0, delta.data, delta.len);
+    written = (fresh ? sizeof(header) : 0) + delta.len;
+    changed = delta.len;
+    if (ret == ESP_OK) {
+      journal_size += written;
+    } else {
+      // The tail may be torn; the next save rewrites everything
+      base_size = 0;
+    }
+  }
+  free(delta.data);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+
+  stats.saves++;
+  stats.journal_bytes = journal_size;
+  stats.bytes_written += written;
+  stats.delta_bytes += changed;
+  stats.last_bytes_written = written;
+  stats.last_delta_bytes = changed;
+  stats.last_save_us = (uint32_t)(esp_timer_get_time() - start);
+  ESP_LOGI(TAG,
+           "Saved %u stations (%s): %u bytes written for %u bytes changed "
+           "(WA %u.%02u), %u us",
+           (unsigned)current->header->count, full ? "compacted" : "journal",
+           (unsigned)written, (unsigned)changed,
+           (unsigned)(written / changed),
+           (unsigned)(written % changed * 100 / changed),
+           (unsigned)stats.last_save_us);
+  return ESP_OK;
+}
+
+void station_store_get_stats(station_store_stats_t *out) { *out = stats; }
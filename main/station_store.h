@@ -0,0 +1,66 @@
+#ifndef STATION_STORE_H
+#define STATION_STORE_H
+
+#include "esp_err.h"
+#include "station_image.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Crash-safe station persistence
+ *
+ *   stations.bin  base image, only ever replaced whole
+ *   stations.new  compaction in progress
+ *   stations.jnl  append-only delta journal on top of stations.bin
+ *
+ * A save appends the differences (put/delete/order records, each with its
+ * own CRC) to the journal. When the journal grows past half the base size
+ * the full list is compacted into stations.new, which then replaces
+ * stations.bin, and the journal is dropped. The journal header names the CRC
+ * of the base it applies to, so a journal left over from before a compaction
+ * is ignored. At boot a complete stations.new is promoted, and journal
+ * replay stops at the first torn or corrupt record.
+ */
+
+/**
+ * @brief Persistence counters. Write amplification is bytes_written /
+ * delta_bytes.
+ */
+typedef struct {
+  uint32_t saves;
+  uint32_t compactions;
+  uint32_t journal_bytes;      // current journal size
+  uint32_t bytes_written;      // total bytes written to flash
+  uint32_t delta_bytes;        // total size of the changes saved
+  uint32_t last_bytes_written; // last save
+  uint32_t last_delta_bytes;   // last save
+  uint32_t last_save_us;       // last save
+} station_store_stats_t;
+
+/**
+ * @brief Loads the station list: recovers an interrupted compaction, reads
+ * the base image and replays the journal.
+ * @return ESP_ERR_NOT_FOUND if no station image exists.
+ */
+esp_err_t station_store_load(station_image_t *out);
+
+/**
+ * @brief Persists current. saved is the list as last loaded or saved (NULL
+ * forces a full write); only the differences are written when possible.
+ */
+esp_err_t station_store_save(const station_image_t *saved,
+                             const station_image_t *current);
+
+/**
+ * @brief Returns the persistence counters.
+ */
+void station_store_get_stats(station_store_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STATION_STORE_H
@@ -0,0 +1,96 @@
+#include "stream_head.h"
+#include <string.h>
+
+/* Header pages are every page up to the first one that completes an audio
+ * packet (granule position other than 0, or -1 for "no packet ends here") */
+int stream_head_ogg_len(const uint8_t *buf, size_t len) {
+  size_t pos = 0;
+  while (pos + 27 <= len) {
+    const uint8_t *page = buf + pos;
+    if (memcmp(page, "OggS", 4) != 0) {
+      return -1;
+    }
+    uint64_t granule = 0;
+    for (int i = 7; i >= 0; i--) {
+      granule = granule << 8 | page[6 + i];
+    }
+    if (pos > 0 && granule != 0 && granule != UINT64_MAX) {
+      return pos;
+    }
+    size_t segments = page[26];
+    if (pos + 27 + segments > len) {
+      return 0;
+    }
+    size_t body = 0;
+    for (size_t i = 0; i < segments; i++) {
+      body += page[27 + i];
+    }
+    pos += 27 + segments + body;
+  }
+  return 0;
+}
+
+int stream_head_flac_len(const uint8_t *buf, size_t len) {
+  if (len < 4) {
+    return 0;
+  }
+  if (memcmp(buf, "fLaC", 4) != 0) {
+    return -1;
+  }
+  size_t pos = 4;
+  while (pos + 4 <= len) {
+    bool last = buf[pos] & 0x80;
+    pos += 4 + ((size_t)buf[pos + 1] << 16 | buf[pos + 2] << 8 | buf[pos + 3]);
+    if (last) {
+      return pos <= len ? (int)pos : 0;
+    }
+  }
+  return 0;
+}
+
+bool stream_head_flac_streaminfo(const uint8_t *buf, size_t len,
+                                 uint32_t *sample_rate, uint64_t *samples) {
+  // "fLaC", a block header of type 0, then 10 bytes of frame and block
+  // sizes before the 20 bit rate and, after channels and sample size, the
+  // 36 bit total
+  if (len < 42 || memcmp(buf, "fLaC", 4) != 0 || (buf[4] & 0x7F) != 0) {
+    return false;
+  }
+  const uint8_t *info = buf + 8;
+  *sample_rate = (uint32_t)info[10] << 12 | info[11] << 4 | info[12] >> 4;
+  *samples = (uint64_t)(info[13] & 0x0F) << 32 | (uint32_t)info[14] << 24 |
+             info[15] << 16 | info[16] << 8 | info[17];
+  return *sample_rate > 0 && *samples > 0;
+}
+
+bool stream_sync_at(stream_sync_t sync, const uint8_t *p) {
+  switch (sync) {
+  case STREAM_SYNC_MPEG:
+    // 11 sync bits, a layer, and neither the "bad" bitrate nor the reserved
+    // sample rate
+    return p[0] == 0xFF && (p[1] & 0xE0) == 0xE0 && (p[1] & 0x06) != 0 &&
+           (p[2] & 0xF0) != 0xF0 && (p[2] & 0x0C) != 0x0C;
+  case STREAM_SYNC_ADTS:
+    // 12 sync bits, layer 0, and a sample rate index in use
+    return p[0] == 0xFF && (p[1] & 0xF6) == 0xF0 && (p[2] & 0x3C) < 0x30;
+  case STREAM_SYNC_OGG:
+    return memcmp(p, "OggS", 4) == 0;
+  case STREAM_SYNC_FLAC:
+    // Fixed or variable block size, and none of the reserved block size,
+    // sample rate, channel or sample size codes
+    return p[0] == 0xFF && (p[1] & 0xFE) == 0xF8 && (p[2] & 0xF0) != 0 &&
+           (p[2] & 0x0F) != 0x0F && (p[3] >> 4) < 11 &&
+           (p[3] & 0x0E) != 0x06 && (p[3] & 0x01) == 0;
+  }
+  return false;
+}
+
+size_t stream_sync_find(stream_sync_t sync, const uint8_t *buf, size_t len) {
+  for (size_t i = 0; i + STREAM_SYNC_LEN <= len; i++) {
+    if (buf[i] == (sync == STREAM_SYNC_OGG ? 'O' : 0xFF) &&
+        stream_sync_at(sync, buf + i)) {
+      return i;
+    }
+  }
+  return len;
+}
@@ -0,0 +1,74 @@
+#ifndef STREAM_HEAD_H
+#define STREAM_HEAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stream headers and frame sync of the compressed formats
+ *
+ * Whoever picks up a station in the middle of its stream (a relay listener,
+ * a recording) needs two things: the stream header, for the formats that
+ * have one, and a place to start where a decoder can lock on. Ogg and FLAC
+ * streams can't be decoded without the header pages or metadata blocks sent
+ * at their start; MP3 and ADTS have none, a decoder only needs a frame.
+ * A seek in a local file is the same as picking up a stream: the decoder
+ * has the header already, only the frame is needed.
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h.
+ */
+
+typedef enum {
+  STREAM_SYNC_MPEG, // MP3 frame header
+  STREAM_SYNC_ADTS, // AAC ADTS frame header
+  STREAM_SYNC_OGG,  // "OggS" page
+  STREAM_SYNC_FLAC, // FLAC frame sync code
+} stream_sync_t;
+
+// Bytes stream_sync_at() looks at
+#define STREAM_SYNC_LEN 4
+
+/**
+ * @brief Length of the Ogg header pages at the start of buf: every page up
+ * to the first one that completes an audio packet.
+ * @return 0 if more data is needed, -1 if this is not Ogg.
+ */
+int stream_head_ogg_len(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Length of "fLaC" and the metadata blocks at the start of buf.
+ * @return 0 if more data is needed, -1 if this is not FLAC.
+ */
+int stream_head_flac_len(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Sample rate and length in samples from the STREAMINFO block that
+ * starts a FLAC stream (the first 42 bytes).
+ * @return false if buf doesn't start with one, or the length is unknown.
+ */
+bool stream_head_flac_streaminfo(const uint8_t *buf, size_t len,
+                                 uint32_t *sample_rate, uint64_t *samples);
+
+/**
+ * @brief Whether p (STREAM_SYNC_LEN bytes) looks like the start of a frame
+ * or page. Frame headers can occur in the payload by chance too; for MP3
+ * and ADTS that costs a decoder no more than a resync.
+ */
+bool stream_sync_at(stream_sync_t sync, const uint8_t *p);
+
+/**
+ * @brief Offset of the first frame or page start in buf, or len if there
+ * is none that stream_sync_at() could check in full.
+ */
+size_t stream_sync_find(stream_sync_t sync, const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STREAM_HEAD_H
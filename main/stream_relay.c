@@ -0,0 +1,564 @@
+#include "stream_relay.h"
+#include "app_config.h"
+#include "decoder_registry.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "ringbuf.h"
+#include "stream_head.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+static const char *TAG = "STREAM_RELAY";
+
+// Shared ring, a power of two: 8 s at 128 kb/s, about 1 s of FLAC
+#define RELAY_BUFFER_SIZE (128 * 1024)
+#define RELAY_MASK (RELAY_BUFFER_SIZE - 1)
+// Tap between the HTTP reader and the relay task
+#define RELAY_TAP_SIZE (16 * 1024)
+// Largest copy from the tap into the ring
+#define RELAY_READ_CHUNK 4096
+// Short, so the tail of the previous stream is not taken for the new one
+#define RELAY_READ_TIMEOUT_MS 50
+// A listener further behind than this is disconnected. The margin covers the
+// chunk being copied into the ring ahead of the published position.
+#define RELAY_MAX_LAG (RELAY_BUFFER_SIZE - 2 * RELAY_READ_CHUNK)
+// Recent audio sent to a new listener, so its player starts at once
+#define RELAY_BURST (16 * 1024)
+// Room for Ogg header pages (Vorbis setup, Opus tags) or FLAC metadata
+#define RELAY_HEAD_MAX (16 * 1024)
+// Largest single socket write
+#define RELAY_SEND_MAX 4096
+#define RELAY_TASK_STACK 3072
+// Above the HTTP reader (4), so the tap is drained before it overflows
+#define RELAY_TASK_PRIORITY 5
+
+static const char RELAY_RESPONSE_HEADER[] = "HTTP/1.1 200 OK\r\n"
+                                            "Content-Type: %s\r\n"
+                                            "Cache-Control: no-cache\r\n"
+                                            "Connection: close\r\n"
+                                            "\r\n";
+
+typedef enum {
+  HEAD_NONE,    // codec needs no header (MP3, AAC)
+  HEAD_PENDING, // still arriving
+  HEAD_DONE,    // head_buf[0..head_len) holds it
+  HEAD_FAILED,  // not found; late listeners get the stream as it is
+} head_state_t;
+
+/* One listener; lives in the server task only */
+typedef struct {
+  int fd; // -1 while the slot is free
+  bool closing;
+  bool syncing;     // skipping to the next Ogg page or FLAC frame
+  uint64_t cursor;  // next stream position to send
+  size_t head_len;  // stream header to send first (0 if none)
+  size_t head_sent; // bytes of it already sent
+} relay_client_t;
+
+static SemaphoreHandle_t relay_lock = NULL; // allocation and the tap
+static httpd_handle_t relay_server = NULL;
+static TaskHandle_t relay_task_handle = NULL;
+static uint8_t *ring = NULL;
+static uint8_t *head_buf = NULL;
+static ringbuf_handle_t tap_rb = NULL;
+static bool tap_pipeline = false; // a pipeline with a source plays
+static codec_type_t tap_codec;
+static atomic_bool tap_attached = false;
+static atomic_bool restart_pending = false;
+static atomic_bool head_wanted = false; // header capture needs the server
+static atomic_bool deliver_pending = false;
+static _Atomic int client_count = 0;
+
+// Written by the relay task, read by the server task
+static portMUX_TYPE pos_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t write_pos = 0;    // bytes ever written to the ring
+static uint64_t stream_start = 0; // position at which the stream began
+static codec_type_t stream_codec;
+static uint32_t stream_gen = 0; // 0 until a stream was tapped
+
+// Server task only
+static relay_client_t clients[STREAM_RELAY_MAX_CLIENTS];
+static uint32_t seen_gen = 0;
+static codec_type_t seen_codec;
+static head_state_t head_state = HEAD_NONE;
+static size_t head_filled = 0;
+static size_t head_len = 0;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static stream_relay_stats_t stats;
+
+typedef struct {
+  uint64_t write_pos;
+  uint64_t stream_start;
+  codec_type_t codec;
+  uint32_t gen;
+} stream_pos_t;
+
+static void read_pos(stream_pos_t *p) {
+  portENTER_CRITICAL(&pos_lock);
+  p->write_pos = write_pos;
+  p->stream_start = stream_start;
+  p->codec = stream_codec;
+  p->gen = stream_gen;
+  portEXIT_CRITICAL(&pos_lock);
+}
+
+static uint64_t read_write_pos(void) {
+  portENTER_CRITICAL(&pos_lock);
+  uint64_t pos = write_pos;
+  portEXIT_CRITICAL(&pos_lock);
+  return pos;
+}
+
+/* Whether the ring still holds the byte at pos */
+static bool ring_holds(uint64_t pos) {
+  return read_write_pos() - pos <= RELAY_MAX_LAG;
+}
+
+static void count(uint32_t *counter) {
+  portENTER_CRITICAL(&stats_lock);
+  (*counter)++;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+static int max_clients(void) {
+  return MIN(g_runtime_config.relay_max_clients, STREAM_RELAY_MAX_CLIENTS);
+}
+
+static const char *content_type(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->mime : "application/octet-stream";
+}
+
+/* ---------- stream headers (server task) ---------- */
+
+/* Whether a page or frame starts at pos (the bytes are in the ring) */
+static bool sync_at(codec_type_t codec, uint64_t pos) {
+  uint8_t p[STREAM_SYNC_LEN];
+  for (int i = 0; i < STREAM_SYNC_LEN; i++) {
+    p[i] = ring[(pos + i) & RELAY_MASK];
+  }
+  return stream_sync_at(decoder_registry_sync(codec), p);
+}
+
+/* Collects the header of the current stream from the ring as it arrives */
+static void capture_head(const stream_pos_t *p) {
+  if (head_state != HEAD_PENDING) {
+    return;
+  }
+  uint64_t from = p->stream_start + head_filled;
+  size_t n = MIN(p->write_pos - from, RELAY_HEAD_MAX - head_filled);
+  if (!ring_holds(from)) {
+    head_state = HEAD_FAILED;
+    atomic_store(&head_wanted, false);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    head_buf[head_filled + i] = ring[(from + i) & RELAY_MASK];
+  }
+  if (!ring_holds(from)) {
+    head_state = HEAD_FAILED;
+    atomic_store(&head_wanted, false);
+    return;
+  }
+  head_filled += n;
+
+  int len = decoder_registry_sync(p->codec) == STREAM_SYNC_OGG
+                ? stream_head_ogg_len(head_buf, head_filled)
+                : stream_head_flac_len(head_buf, head_filled);
+  if (len > 0) {
+    head_len = len;
+    head_state = HEAD_DONE;
+    ESP_LOGI(TAG, "Stream header: %u bytes", (unsigned)head_len);
+  } else if (len < 0 || head_filled == RELAY_HEAD_MAX) {
+    head_state = HEAD_FAILED;
+    ESP_LOGW(TAG, "No %s stream header found",
+             codec_type_to_string(p->codec));
+  }
+  if (head_state != HEAD_PENDING) {
+    atomic_store(&head_wanted, false);
+  }
+}
+
+/* ---------- listeners (server task) ---------- */
+
+static void client_close(relay_client_t *c, const char *why) {
+  ESP_LOGI(TAG, "Closing listener %d: %s", c->fd, why);
+  c->closing = true;
+  httpd_sess_trigger_close(relay_server, c->fd);
+}
+
+/* Picks up a new stream: resets the header and disconnects the listeners
+ * that can't follow into it */
+static void stream_changed(const stream_pos_t *p) {
+  bool same = seen_gen != 0 && p->codec == seen_codec;
+  seen_gen = p->gen;
+  seen_codec = p->codec;
+  head_filled = head_len = 0;
+  head_state =
+      decoder_registry_has_head(p->codec) ? HEAD_PENDING : HEAD_NONE;
+
+  for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS; i++) {
+    relay_client_t *c = &clients[i];
+    if (c->fd < 0 || c->closing) {
+      continue;
+    }
+    // MP3 and AAC decoders resync, chained Ogg is valid; a second FLAC
+    // stream in one file is not
+    if (!same || decoder_registry_sync(p->codec) == STREAM_SYNC_FLAC) {
+      client_close(c, "codec changed");
+    } else if (c->head_sent < c->head_len) {
+      client_close(c, "stream changed during its header");
+    }
+  }
+}
+
+static void refresh(stream_pos_t *p) {
+  read_pos(p);
+  if (p->gen != seen_gen) {
+    stream_changed(p);
+  }
+  capture_head(p);
+}
+
+/* Sends buf without blocking. Returns the bytes sent, 0 if the socket is
+ * full, -1 if the connection failed. */
+static int client_send(relay_client_t *c, const void *buf, size_t len) {
+  int n = httpd_socket_send(relay_server, c->fd, buf, len, MSG_DONTWAIT);
+  if (n == HTTPD_SOCK_ERR_TIMEOUT) {
+    return 0;
+  }
+  if (n < 0) {
+    return -1;
+  }
+  portENTER_CRITICAL(&stats_lock);
+  stats.bytes_out += n;
+  portEXIT_CRITICAL(&stats_lock);
+  return n;
+}
+
+/* Sends what the socket takes. Returns false if the listener was closed. */
+static bool client_push(relay_client_t *c, const stream_pos_t *p) {
+  while (c->head_sent < c->head_len) {
+    int n = client_send(c, head_buf + c->head_sent, c->head_len - c->head_sent);
+    if (n <= 0) {
+      return n == 0;
+    }
+    c->head_sent += n;
+  }
+
+  if (p->write_pos - c->cursor > RELAY_MAX_LAG) {
+    count(&stats.dropped_slow);
+    client_close(c, "too slow");
+    return false;
+  }
+  if (c->syncing) {
+    // Stops short of bytes a match could still need
+    for (; c->cursor + STREAM_SYNC_LEN <= p->write_pos; c->cursor++) {
+      if (sync_at(p->codec, c->cursor)) {
+        c->syncing = false;
+        break;
+      }
+    }
+    if (c->syncing) {
+      return true;
+    }
+  }
+
+  while (c->cursor < p->write_pos) {
+    size_t offset = c->cursor & RELAY_MASK;
+    size_t len = MIN(p->write_pos - c->cursor, RELAY_BUFFER_SIZE - offset);
+    int n = client_send(c, ring + offset, MIN(len, RELAY_SEND_MAX));
+    if (n < 0) {
+      client_close(c, "send failed");
+      return false;
+    }
+    // Sent straight from the ring: if the relay task wrapped around onto
+    // those bytes meanwhile, the listener got garbage
+    if (!ring_holds(c->cursor)) {
+      count(&stats.dropped_slow);
+      client_close(c, "overrun during send");
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    c->cursor += n;
+  }
+  return true;
+}
+
+/* Work item: feeds every listener what arrived */
+static void relay_deliver(void *arg) {
+  atomic_store(&deliver_pending, false);
+  if (relay_server == NULL || ring == NULL) {
+    return;
+  }
+  stream_pos_t p;
+  refresh(&p);
+  int allowed = max_clients();
+  for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS; i++) {
+    relay_client_t *c = &clients[i];
+    if (c->fd < 0 || c->closing) {
+      continue;
+    }
+    if (allowed == 0) {
+      client_close(c, "relay disabled");
+      continue;
+    }
+    client_push(c, &p);
+  }
+}
+
+static void schedule_deliver(void) {
+  if (relay_server && !atomic_exchange(&deliver_pending, true) &&
+      httpd_queue_work(relay_server, relay_deliver, NULL) != ESP_OK) {
+    atomic_store(&deliver_pending, false);
+  }
+}
+
+/* Session context destructor: the connection is gone */
+static void client_gone(void *ctx) {
+  relay_client_t *c = ctx;
+  ESP_LOGI(TAG, "Listener %d left", c->fd);
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+  atomic_fetch_sub(&client_count, 1);
+}
+
+static esp_err_t refuse(httpd_req_t *req, const char *status,
+                        const char *error) {
+  count(&stats.rejected);
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, "application/json");
+  char body[64];
+  snprintf(body, sizeof(body), "{\"error\":\"%s\"}", error);
+  return httpd_resp_sendstr(req, body);
+}
+
+esp_err_t stream_relay_handler(httpd_req_t *req) {
+  if (max_clients() == 0 || ring == NULL) {
+    return refuse(req, "404 Not Found", "relay disabled");
+  }
+  stream_pos_t p;
+  refresh(&p);
+  if (p.gen == 0) {
+    return refuse(req, "503 Service Unavailable", "nothing playing");
+  }
+  relay_client_t *c = NULL;
+  if (atomic_load(&client_count) < max_clients()) {
+    for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS && c == NULL; i++) {
+      if (clients[i].fd < 0) {
+        c = &clients[i];
+      }
+    }
+  }
+  if (c == NULL) {
+    httpd_resp_set_hdr(req, "Retry-After", "10");
+    return refuse(req, "503 Service Unavailable", "too many listeners");
+  }
+
+  // Written straight to the socket from here on, head included
+  char header[sizeof(RELAY_RESPONSE_HEADER) + 32];
+  int len = snprintf(header, sizeof(header), RELAY_RESPONSE_HEADER,
+                     content_type(p.codec));
+  if (httpd_send(req, header, len) < 0) {
+    return ESP_FAIL;
+  }
+
+  uint64_t oldest = p.write_pos > RELAY_MAX_LAG ? p.write_pos - RELAY_MAX_LAG
+                                                : 0;
+  uint64_t burst = p.write_pos > RELAY_BURST ? p.write_pos - RELAY_BURST : 0;
+  c->fd = httpd_req_to_sockfd(req);
+  c->closing = false;
+  c->head_sent = 0;
+  if (head_state == HEAD_PENDING && p.stream_start >= oldest) {
+    // The header is still arriving: just start at the beginning
+    c->cursor = p.stream_start;
+    c->head_len = 0;
+    c->syncing = false;
+  } else if (head_state == HEAD_DONE) {
+    c->cursor = MAX(MAX(burst, oldest), p.stream_start + head_len);
+    c->head_len = head_len;
+    c->syncing = true;
+  } else {
+    c->cursor = MAX(MAX(burst, oldest), p.stream_start);
+    c->head_len = 0;
+    c->syncing = false;
+  }
+  req->sess_ctx = c;
+  req->free_ctx = client_gone;
+  atomic_fetch_add(&client_count, 1);
+  count(&stats.listeners);
+  ESP_LOGI(TAG, "Listener %d joined (%s)", c->fd, content_type(p.codec));
+  client_push(c, &p);
+  return ESP_OK;
+}
+
+/* ---------- tap (relay task) ---------- */
+
+static void relay_task(void *pvParameters) {
+  for (;;) {
+    if (!atomic_load(&tap_attached)) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    // Read straight into the ring, past the published position
+    size_t offset = write_pos & RELAY_MASK;
+    int n = rb_read(tap_rb, (char *)ring + offset,
+                    MIN(RELAY_READ_CHUNK, RELAY_BUFFER_SIZE - offset),
+                    pdMS_TO_TICKS(RELAY_READ_TIMEOUT_MS));
+    if (atomic_exchange(&restart_pending, false)) {
+      // A new pipeline was tapped; n is the end of the previous stream
+      // (the new one needs longer than the read timeout to connect)
+      portENTER_CRITICAL(&pos_lock);
+      stream_start = write_pos;
+      stream_codec = tap_codec;
+      stream_gen++;
+      portEXIT_CRITICAL(&pos_lock);
+      atomic_store(&head_wanted, decoder_registry_has_head(tap_codec));
+      schedule_deliver();
+      continue;
+    }
+    if (n <= 0) {
+      continue;
+    }
+    portENTER_CRITICAL(&pos_lock);
+    write_pos += n;
+    portEXIT_CRITICAL(&pos_lock);
+    portENTER_CRITICAL(&stats_lock);
+    stats.bytes_in += n;
+    portEXIT_CRITICAL(&stats_lock);
+    if (atomic_load(&client_count) > 0 || atomic_load(&head_wanted)) {
+      schedule_deliver();
+    }
+  }
+}
+
+static void *relay_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+/* Allocates everything on first use; relay_lock held */
+static esp_err_t relay_enable(void) {
+  if (relay_task_handle) {
+    return ESP_OK;
+  }
+  ring = relay_alloc(RELAY_BUFFER_SIZE);
+  head_buf = relay_alloc(RELAY_HEAD_MAX);
+  tap_rb = rb_create(RELAY_TAP_SIZE, 1);
+  if (ring == NULL || head_buf == NULL || tap_rb == NULL ||
+      xTaskCreate(relay_task, "stream_relay", RELAY_TASK_STACK, NULL,
+                  RELAY_TASK_PRIORITY, &relay_task_handle) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to allocate the relay");
+    free(ring);
+    free(head_buf);
+    if (tap_rb) {
+      rb_destroy(tap_rb);
+    }
+    ring = head_buf = NULL;
+    tap_rb = NULL;
+    relay_task_handle = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  uint32_t memory = RELAY_BUFFER_SIZE + RELAY_HEAD_MAX + RELAY_TAP_SIZE;
+  portENTER_CRITICAL(&stats_lock);
+  stats.memory = memory;
+  portEXIT_CRITICAL(&stats_lock);
+  ESP_LOGI(TAG, "Relay enabled, %" PRIu32 " KB", memory / 1024);
+  return ESP_OK;
+}
+
+/* Connects the tap to the current source; relay_lock held */
+static void tap_connect(void) {
+  if (atomic_load(&tap_attached) || !tap_pipeline ||
+      relay_task_handle == NULL) {
+    return;
+  }
+  rb_reset(tap_rb);
+  if (audio_pipeline_tap_insert(PIPELINE_TAP_RELAY, tap_rb) != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to tap the stream");
+    return;
+  }
+  atomic_store(&restart_pending, true);
+  atomic_store(&tap_attached, true);
+  xTaskNotifyGive(relay_task_handle);
+}
+
+void stream_relay_attach(codec_type_t codec) {
+  if (relay_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(relay_lock, portMAX_DELAY);
+  tap_pipeline = true;
+  tap_codec = codec;
+  atomic_store(&tap_attached, false);
+  if (max_clients() > 0) {
+    tap_connect();
+  }
+  xSemaphoreGive(relay_lock);
+}
+
+void stream_relay_detach(void) {
+  if (relay_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(relay_lock, portMAX_DELAY);
+  tap_pipeline = false;
+  atomic_store(&tap_attached, false);
+  xSemaphoreGive(relay_lock);
+}
+
+void stream_relay_apply_config(void) {
+  if (relay_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(relay_lock, portMAX_DELAY);
+  if (max_clients() > 0 && relay_enable() == ESP_OK) {
+    tap_connect();
+  } else if (atomic_exchange(&tap_attached, false)) {
+    // The stream plays on without copying to the relay
+    audio_pipeline_tap_remove(PIPELINE_TAP_RELAY);
+  }
+  xSemaphoreGive(relay_lock);
+  // Lets the listeners go if it was switched off
+  schedule_deliver();
+}
+
+esp_err_t stream_relay_init(void) {
+  relay_lock = xSemaphoreCreateMutex();
+  if (relay_lock == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+  stream_relay_apply_config();
+  return ESP_OK;
+}
+
+esp_err_t stream_relay_start(httpd_handle_t server) {
+  relay_server = server;
+  return ESP_OK;
+}
+
+void stream_relay_stop(void) { relay_server = NULL; }
+
+void stream_relay_get_stats(stream_relay_stats_t *out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+  out->clients = atomic_load(&client_count);
+  out->max_clients = max_clients();
+}
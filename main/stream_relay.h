@@ -0,0 +1,101 @@
+#ifndef STREAM_RELAY_H
+#define STREAM_RELAY_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * LAN relay of the stream being played (GET /stream)
+ *
+ * Other players on the network can listen along without opening their own
+ * connection to the station. The compressed bytes the HTTP reader passes to
+ * the decoder are teed (a multi-output ringbuf on http_stream_reader, like
+ * the visualizer's PCM tap) into one ring in PSRAM. Every listener has its
+ * own read position in that ring and is written from it directly; nothing is
+ * copied per listener. The upstream is fetched once by the player, however
+ * many listeners there are.
+ *
+ * The relay never holds up playback: a listener that falls more than the
+ * ring behind is disconnected. New listeners get a short burst of recent
+ * audio so they start at once; for Ogg and FLAC the stream headers are kept
+ * and sent first, then the stream from the next page or frame.
+ *
+ * Off unless g_runtime_config.relay_max_clients is nonzero. The ring is
+ * allocated when the relay is first enabled and kept from then on.
+ */
+
+// Upper bound for g_runtime_config.relay_max_clients
+#define STREAM_RELAY_MAX_CLIENTS 4
+
+/**
+ * @brief Relay counters, since boot.
+ */
+typedef struct {
+  uint8_t clients;       // listeners connected now
+  uint8_t max_clients;   // as configured (0 = relay off)
+  uint32_t memory;       // bytes allocated for the relay
+  uint64_t bytes_in;     // teed from the HTTP reader
+  uint64_t bytes_out;    // sent to listeners, all together
+  uint32_t listeners;    // connections accepted
+  uint32_t dropped_slow; // listeners disconnected for falling behind
+  uint32_t rejected;     // connections refused (full or off)
+} stream_relay_stats_t;
+
+/**
+ * @brief Sets up the relay, and allocates it if enabled. Call before the
+ * first pipeline is created.
+ */
+esp_err_t stream_relay_init(void);
+
+/**
+ * @brief Starts serving listeners on the web server. Call once it is
+ * running, before registering stream_relay_handler.
+ */
+esp_err_t stream_relay_start(httpd_handle_t server);
+
+/**
+ * @brief Stops serving. Listeners are closed with the server.
+ */
+void stream_relay_stop(void);
+
+/**
+ * @brief Applies g_runtime_config.relay_max_clients: allocates the relay and
+ * taps the current stream when enabled, disconnects everyone when disabled.
+ */
+void stream_relay_apply_config(void);
+
+/**
+ * @brief Taps a new pipeline's source (PIPELINE_TAP_RELAY) while the relay
+ * is on. Listeners stay connected across stations as long as the codec
+ * allows it.
+ */
+void stream_relay_attach(codec_type_t codec);
+
+/**
+ * @brief Forgets the source. Call before the pipeline is deinitialized.
+ */
+void stream_relay_detach(void);
+
+/**
+ * @brief Handler for GET /stream. 404 while the relay is off, 503 when
+ * full or nothing has played yet.
+ */
+esp_err_t stream_relay_handler(httpd_req_t *req);
+
+/**
+ * @brief Copies the relay counters.
+ */
+void stream_relay_get_stats(stream_relay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STREAM_RELAY_H
@@ -0,0 +1,399 @@
+#include "timeshift.h"
+#include "app_config.h"
+#include "decoder_registry.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ringbuf.h"
+#include "screens.h"
+#include "timeshift_index.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+static const char *TAG = "TIMESHIFT";
+
+// Element buffer; also the most handed to the decoder at once
+#define TS_BUF (4 * 1024)
+// Short, so a paused or rewound decoder is fed while the station is quiet
+#define TS_INPUT_TIMEOUT_MS 20
+// Once the station has ended, how often to look for a resume
+#define TS_IDLE_MS 20
+// Seek points per configured minute: two minutes' worth, for bitrates down
+// to 80 kb/s; at lower ones the oldest audio has no points and is skipped
+#define TS_POINTS_PER_MINUTE (2 * 60 * 1000000 / TS_POINT_INTERVAL_US)
+#define TS_CPU_WINDOW_US 1000000
+
+typedef struct {
+  ts_index_t index;
+  uint64_t write_pos;  // stream bytes appended
+  uint64_t read_pos;   // stream bytes handed to the decoder
+  ts_point_t unit_end; // where the decoder may be stopped next
+  int64_t read_media;  // media time at the start of the current unit
+  bool paused;
+  bool input_done;
+  bool overrun; // read_pos is being pushed on by the writer
+  int64_t cpu_window_start;
+  int64_t cpu_busy_us;
+} shift_t;
+
+// Allocated while time-shift is on; pipelines are created and destroyed
+// one after the other, so at most one element uses them
+static uint8_t *ring = NULL;
+static size_t ring_size = 0;
+static ts_point_t *points = NULL;
+static size_t points_capacity = 0;
+static uint8_t ring_minutes = 0;
+static ts_format_t shift_format = TS_FORMAT_MPEG;
+static shift_t shift;
+
+// Requests from the controls, applied between units
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool want_paused = false;
+static int64_t want_seek_us = 0;
+static bool want_live = false;
+static timeshift_stats_t stats;
+
+static void *ts_alloc(size_t size) {
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);
+}
+
+static void ring_free(void) {
+  free(ring);
+  free(points);
+  ring = NULL;
+  points = NULL;
+  ring_size = points_capacity = 0;
+  ring_minutes = 0;
+}
+
+static bool ring_alloc(uint8_t minutes) {
+  if (minutes == ring_minutes) {
+    return ring != NULL;
+  }
+  ring_free();
+  size_t size = (size_t)minutes * TIMESHIFT_BYTES_PER_MINUTE;
+  size_t capacity = (size_t)minutes * TS_POINTS_PER_MINUTE;
+  ring = ts_alloc(size);
+  points = ts_alloc(capacity * sizeof(ts_point_t));
+  if (ring == NULL || points == NULL) {
+    ESP_LOGE(TAG, "No memory for %u minutes (%u bytes)", minutes,
+             (unsigned)size);
+    ring_free();
+    return false;
+  }
+  ring_size = size;
+  points_capacity = capacity;
+  ring_minutes = minutes;
+  ESP_LOGI(TAG, "%u minutes: %u bytes, %u seek points", minutes,
+           (unsigned)size, (unsigned)capacity);
+  return true;
+}
+
+static ts_format_t codec_format(codec_type_t codec) {
+  switch (decoder_registry_sync(codec)) {
+  case STREAM_SYNC_ADTS:
+    return TS_FORMAT_ADTS;
+  case STREAM_SYNC_OGG:
+    return TS_FORMAT_OGG;
+  case STREAM_SYNC_FLAC:
+    return TS_FORMAT_FLAC;
+  case STREAM_SYNC_MPEG:
+  default:
+    return TS_FORMAT_MPEG;
+  }
+}
+
+/* ---------- element ---------- */
+
+/* Stores bytes from the station. Paused for longer than the ring holds,
+ * playback is moved on to the oldest seek point left. */
+static void ring_append(shift_t *s, const uint8_t *data, size_t len) {
+  if (s->write_pos + len > ring_size) {
+    uint64_t oldest = s->write_pos + len - ring_size;
+    ts_index_forget(&s->index, oldest);
+    if (s->read_pos < oldest) {
+      s->unit_end = ts_index_oldest(&s->index);
+      s->read_pos = s->unit_end.pos;
+      s->read_media = s->unit_end.media_us;
+      if (!s->overrun) {
+        portENTER_CRITICAL(&state_lock);
+        stats.overruns++;
+        portEXIT_CRITICAL(&state_lock);
+      }
+      s->overrun = true;
+    }
+  }
+  size_t offset = s->write_pos % ring_size;
+  size_t first = MIN(len, ring_size - offset);
+  memcpy(ring + offset, data, first);
+  memcpy(ring, data + first, len - first);
+  s->write_pos += len;
+  ts_index_scan(&s->index, s->write_pos);
+}
+
+/* At a unit end: applies what the controls asked for and picks the next
+ * unit, up to the next seek point */
+static void start_unit(shift_t *s) {
+  s->read_media = s->unit_end.media_us;
+  portENTER_CRITICAL(&state_lock);
+  bool paused = want_paused;
+  int64_t seek_us = want_seek_us;
+  bool live = want_live;
+  want_seek_us = 0;
+  want_live = false;
+  portEXIT_CRITICAL(&state_lock);
+
+  int64_t target = s->read_media + seek_us;
+  if (live || (seek_us > 0 && target >= s->index.media_us)) {
+    s->read_pos = s->index.boundary;
+    s->read_media = s->index.media_us;
+  } else if (seek_us != 0) {
+    ts_point_t point;
+    if (ts_index_find(&s->index, target, &point)) {
+      s->read_pos = point.pos;
+      s->read_media = point.media_us;
+    }
+  }
+  if (seek_us != 0 || live) {
+    ESP_LOGI(TAG, "Playing %" PRId64 " ms behind",
+             (s->index.media_us - s->read_media) / 1000);
+  }
+  s->paused = paused;
+  if (paused) {
+    s->unit_end = (ts_point_t){.pos = s->read_pos, .media_us = s->read_media};
+  } else {
+    s->unit_end = ts_index_next(&s->index, s->read_pos);
+  }
+}
+
+/* Hands the decoder what it can take of the current unit without blocking.
+ * @return bytes handed over, 0 if none, or an AEL_IO error */
+static int feed(audio_element_handle_t self, shift_t *s) {
+  if (s->read_pos == s->unit_end.pos) {
+    start_unit(s);
+  }
+  uint64_t end = s->unit_end.pos;
+  // The station has ended: the tail after the last whole frame goes too
+  if (s->input_done && !s->paused && end == s->index.boundary) {
+    end = s->write_pos;
+  }
+  if (end <= s->read_pos) {
+    return 0;
+  }
+  ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+  size_t offset = s->read_pos % ring_size;
+  size_t len = MIN(end - s->read_pos, ring_size - offset);
+  len = MIN(len, TS_BUF);
+  if (rb) {
+    len = MIN(len, (size_t)rb_bytes_available(rb));
+  }
+  if (len == 0) {
+    return 0;
+  }
+  int n = audio_element_output(self, (char *)ring + offset, len);
+  if (n > 0) {
+    s->read_pos += n;
+    s->overrun = false;
+  }
+  return n;
+}
+
+static void update_stats(audio_element_handle_t self, shift_t *s) {
+  int64_t behind = s->index.media_us - s->read_media;
+  int64_t buffered = s->index.media_us - ts_index_oldest(&s->index).media_us;
+  uint32_t behind_s = behind > 0 ? behind / 1000000 : 0;
+  portENTER_CRITICAL(&state_lock);
+  stats.paused = s->paused;
+  stats.behind_s = behind_s;
+  stats.buffered_s = buffered > 0 ? buffered / 1000000 : 0;
+  stats.points = s->index.count;
+  portEXIT_CRITICAL(&state_lock);
+
+  // The decoder's input now comes from here
+  ringbuf_handle_t rb = audio_element_get_output_ringbuf(self);
+  int size = rb ? rb_get_size(rb) : 0;
+  if (size > 0) {
+    g_stream_buffer_fill = rb_bytes_filled(rb) * 100 / size;
+  }
+  update_time_shift(s->paused, behind_s);
+}
+
+static esp_err_t shift_open(audio_element_handle_t self) {
+  shift_t *s = &shift;
+  memset(s, 0, sizeof(*s));
+  ts_index_init(&s->index, shift_format, ring, ring_size, points,
+                points_capacity, 0);
+  s->cpu_window_start = esp_timer_get_time();
+  audio_element_set_input_timeout(self, pdMS_TO_TICKS(TS_INPUT_TIMEOUT_MS));
+  // A new station starts live
+  portENTER_CRITICAL(&state_lock);
+  want_paused = false;
+  want_seek_us = 0;
+  want_live = false;
+  stats.active = true;
+  stats.paused = false;
+  stats.behind_s = 0;
+  stats.buffered_s = 0;
+  stats.points = 0;
+  portEXIT_CRITICAL(&state_lock);
+  return ESP_OK;
+}
+
+static esp_err_t shift_close(audio_element_handle_t self) {
+  portENTER_CRITICAL(&state_lock);
+  stats.active = false;
+  stats.paused = false;
+  stats.behind_s = 0;
+  portEXIT_CRITICAL(&state_lock);
+  update_time_shift(false, 0);
+  return ESP_OK;
+}
+
+static int shift_process(audio_element_handle_t self, char *in_buffer,
+                         int in_len) {
+  shift_t *s = &shift;
+  int64_t busy = 0;
+  int progress = 0;
+  if (!s->input_done) {
+    // Take what is there rather than wait for a full buffer
+    ringbuf_handle_t in_rb = audio_element_get_input_ringbuf(self);
+    int want = in_len;
+    if (in_rb && rb_bytes_filled(in_rb) > 0) {
+      want = MIN(want, rb_bytes_filled(in_rb));
+    }
+    int n = audio_element_input(self, in_buffer, want);
+    if (n > 0) {
+      int64_t t = esp_timer_get_time();
+      ring_append(s, (const uint8_t *)in_buffer, n);
+      busy += esp_timer_get_time() - t;
+      portENTER_CRITICAL(&state_lock);
+      stats.bytes_in += n;
+      portEXIT_CRITICAL(&state_lock);
+      progress = n;
+    } else if (n == AEL_IO_DONE || n == AEL_IO_OK) {
+      s->input_done = true;
+    } else if (n != AEL_IO_TIMEOUT) {
+      return n;
+    }
+  }
+
+  int64_t t = esp_timer_get_time();
+  int n;
+  while ((n = feed(self, s)) > 0) {
+    progress += n;
+  }
+  int64_t now = esp_timer_get_time();
+  busy += now - t;
+  if (n < 0) {
+    return n;
+  }
+
+  s->cpu_busy_us += busy;
+  if (now - s->cpu_window_start >= TS_CPU_WINDOW_US) {
+    uint16_t permille =
+        s->cpu_busy_us * 1000 / (now - s->cpu_window_start);
+    s->cpu_busy_us = 0;
+    s->cpu_window_start = now;
+    portENTER_CRITICAL(&state_lock);
+    stats.cpu_permille = permille;
+    portEXIT_CRITICAL(&state_lock);
+  }
+  update_stats(self, s);
+
+  if (s->input_done) {
+    if (!s->paused && s->read_pos == s->write_pos) {
+      return AEL_IO_DONE;
+    }
+    if (progress == 0) {
+      vTaskDelay(pdMS_TO_TICKS(TS_IDLE_MS));
+    }
+  }
+  return progress > 0 ? progress : AEL_IO_TIMEOUT;
+}
+
+/* ---------- interface ---------- */
+
+esp_err_t timeshift_init(void) {
+  if (g_runtime_config.timeshift_minutes > TIMESHIFT_MAX_MINUTES) {
+    g_runtime_config.timeshift_minutes = TIMESHIFT_MAX_MINUTES;
+  }
+  ESP_LOGI(TAG, "Time-shift %s (%u minutes)",
+           g_runtime_config.timeshift_minutes ? "on" : "off",
+           g_runtime_config.timeshift_minutes);
+  return ESP_OK;
+}
+
+audio_element_handle_t timeshift_element_init(codec_type_t codec) {
+  uint8_t minutes =
+      MIN(g_runtime_config.timeshift_minutes, TIMESHIFT_MAX_MINUTES);
+  if (minutes == 0) {
+    ring_free();
+  } else if (!ring_alloc(minutes)) {
+    ESP_LOGW(TAG, "Playing without time-shift");
+  }
+  portENTER_CRITICAL(&state_lock);
+  stats.minutes = ring_minutes;
+  stats.memory = ring_size + points_capacity * sizeof(ts_point_t);
+  portEXIT_CRITICAL(&state_lock);
+  if (ring == NULL) {
+    return NULL;
+  }
+  shift_format = codec_format(codec);
+
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  cfg.open = shift_open;
+  cfg.close = shift_close;
+  cfg.process = shift_process;
+  cfg.tag = "shift";
+  cfg.buffer_len = TS_BUF;
+  cfg.task_stack = TIMESHIFT_ELEMENT_STACK;
+  cfg.task_core = 1;
+  return audio_element_init(&cfg);
+}
+
+esp_err_t timeshift_pause(int state) {
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&state_lock);
+  if (stats.active) {
+    want_paused = state < 0 ? !want_paused : state != 0;
+    ret = ESP_OK;
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return ret;
+}
+
+esp_err_t timeshift_seek(int seconds) {
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&state_lock);
+  if (stats.active) {
+    want_seek_us += (int64_t)seconds * 1000000;
+    stats.seeks++;
+    ret = ESP_OK;
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return ret;
+}
+
+esp_err_t timeshift_live(void) {
+  esp_err_t ret = ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&state_lock);
+  if (stats.active) {
+    want_live = true;
+    want_seek_us = 0;
+    want_paused = false;
+    ret = ESP_OK;
+  }
+  portEXIT_CRITICAL(&state_lock);
+  return ret;
+}
+
+void timeshift_get_stats(timeshift_stats_t *out) {
+  portENTER_CRITICAL(&state_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&state_lock);
+}
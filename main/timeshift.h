@@ -0,0 +1,100 @@
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Time-shift: pause and rewind live radio
+ *
+ * An element ("shift") between the HTTP reader and the decoder keeps the
+ * last minutes of the compressed stream in a ring in PSRAM. The reader
+ * always writes into the ring, so the station keeps downloading while
+ * playback is paused; the decoder is fed from its own position in the ring,
+ * which can be anywhere in it.
+ *
+ * The stream is indexed frame by frame as it arrives (timeshift_index.h).
+ * The decoder is only ever given whole frames, and pausing and seeking take
+ * effect between them, at a seek point, so a jump looks to the decoder like
+ * nothing more than a gap in the stream.
+ *
+ * Off unless g_runtime_config.timeshift_minutes is set; the ring is sized
+ * when the next pipeline is created. Not used while multi-room playback
+ * paces the pipeline, since that has to follow the leader's schedule.
+ */
+
+// Upper bound for g_runtime_config.timeshift_minutes
+#define TIMESHIFT_MAX_MINUTES 4
+// Ring bytes per configured minute: a minute at 160 kb/s, more at lower
+// bitrates
+#define TIMESHIFT_BYTES_PER_MINUTE (160 * 1000 / 8 * 60)
+// Step of the skip back gesture
+#define TIMESHIFT_SKIP_S 30
+// Task stack of the time-shift element
+#define TIMESHIFT_ELEMENT_STACK (3 * 1024)
+
+/**
+ * @brief Time-shift figures.
+ */
+typedef struct {
+  uint8_t minutes;        // ring size, as allocated
+  bool active;            // a pipeline is using it
+  bool paused;
+  uint32_t memory;        // bytes allocated
+  uint32_t buffered_s;    // how far back playback can go
+  uint32_t behind_s;      // how far playback is behind the live stream
+  uint32_t points;        // seek points indexed
+  uint32_t seeks;         // since boot
+  uint32_t overruns;      // paused for longer than the ring holds
+  uint16_t cpu_permille;  // of one core, over the last second
+  uint64_t bytes_in;      // since boot
+} timeshift_stats_t;
+
+/**
+ * @brief Sets up the module. Call once, before the first pipeline.
+ */
+esp_err_t timeshift_init(void);
+
+/**
+ * @brief Creates the time-shift element for a new pipeline, sizing the
+ * ring to g_runtime_config.timeshift_minutes first.
+ * @return NULL if time-shift is off or the ring can't be allocated; the
+ * HTTP reader then feeds the decoder directly.
+ */
+audio_element_handle_t timeshift_element_init(codec_type_t codec);
+
+/**
+ * @brief Pauses (1) or resumes (0) playback, or toggles (-1). The stream
+ * keeps arriving meanwhile.
+ * @return ESP_ERR_INVALID_STATE if no pipeline is buffering.
+ */
+esp_err_t timeshift_pause(int state);
+
+/**
+ * @brief Moves playback by seconds (negative: back). Stops at the oldest
+ * audio held and at the live stream.
+ */
+esp_err_t timeshift_seek(int seconds);
+
+/**
+ * @brief Goes back to the live stream, resuming if paused.
+ */
+esp_err_t timeshift_live(void);
+
+/**
+ * @brief Copies the time-shift figures.
+ */
+void timeshift_get_stats(timeshift_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMESHIFT_H
@@ -0,0 +1,431 @@
+#include "timeshift_index.h"
+#include "multiroom_proto.h"
+#include <string.h>
+
+// Bytes mr_frame_parse() needs to judge an MPEG or ADTS header
+#define FRAME_PEEK 8
+#define OGG_PAGE_HEADER 27
+// Sync code, coded number, block size and rate fields, CRC-8
+#define FLAC_MAX_HEADER 16
+
+static size_t min_size(uint64_t a, size_t b) { return a < b ? (size_t)a : b; }
+
+/* Copies len bytes at pos out of the ring */
+static void peek(const ts_index_t *x, uint64_t pos, uint8_t *buf, size_t len) {
+  size_t offset = pos % x->ring_size;
+  size_t first = min_size(len, x->ring_size - offset);
+  memcpy(buf, x->ring + offset, first);
+  memcpy(buf + first, x->ring, len - first);
+}
+
+static uint32_t get_le32(const uint8_t *b) {
+  return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 |
+         (uint32_t)b[3] << 24;
+}
+
+static uint64_t get_le64(const uint8_t *b) {
+  return (uint64_t)get_le32(b) | (uint64_t)get_le32(b + 4) << 32;
+}
+
+/* Keeps the frame at pos as a seek point if the last one is far enough
+ * back. Frames that decode on their own are preferred; others are taken
+ * once twice the interval has passed without one. */
+static void add_point(ts_index_t *x, uint64_t pos, int64_t media_us,
+                      bool preferred) {
+  int64_t since = media_us - x->last_point_us;
+  if (x->count > 0 &&
+      since < (preferred ? 1 : 2) * (int64_t)TS_POINT_INTERVAL_US) {
+    return;
+  }
+  if (x->count == x->capacity) {
+    x->head = (x->head + 1) % x->capacity;
+    x->count--;
+  }
+  x->points[(x->head + x->count) % x->capacity] =
+      (ts_point_t){.pos = pos, .media_us = media_us};
+  x->count++;
+  x->last_point_us = media_us;
+}
+
+/* Not a frame at scan_pos: moves on, and after long enough lets the bytes
+ * skipped through */
+static void lose_sync(ts_index_t *x, uint64_t skip) {
+  x->locked = false;
+  x->scan_pos += skip;
+  if (x->scan_pos - x->boundary > TS_SYNC_GIVE_UP) {
+    x->boundary = x->scan_pos;
+  }
+}
+
+/* ---------- MPEG audio, ADTS ---------- */
+
+static void scan_frames(ts_index_t *x, uint64_t write_pos) {
+  mr_framing_t framing =
+      x->format == TS_FORMAT_ADTS ? MR_FRAMING_ADTS : MR_FRAMING_MPEG;
+  uint8_t header[FRAME_PEEK];
+  mr_frame_t f, next;
+  while (x->scan_pos < write_pos) {
+    size_t avail = min_size(write_pos - x->scan_pos, FRAME_PEEK);
+    peek(x, x->scan_pos, header, avail);
+    int ret = mr_frame_parse(framing, header, avail, &f);
+    if (ret == 0) {
+      return;
+    }
+    if (ret < 0 || f.len < FRAME_PEEK) {
+      lose_sync(x, 1);
+      continue;
+    }
+    if (!x->locked) {
+      // Sync words turn up in audio data; a frame header is only taken if
+      // another one follows where it says
+      uint64_t next_pos = x->scan_pos + f.len;
+      if (next_pos + FRAME_PEEK > write_pos) {
+        return;
+      }
+      peek(x, next_pos, header, FRAME_PEEK);
+      if (mr_frame_parse(framing, header, FRAME_PEEK, &next) != 1) {
+        lose_sync(x, 1);
+        continue;
+      }
+      x->locked = true;
+    }
+    if (x->scan_pos + f.len > write_pos) {
+      return;
+    }
+    add_point(x, x->scan_pos, x->media_us, f.independent);
+    x->scan_pos += f.len;
+    x->boundary = x->scan_pos;
+    x->media_us += f.duration_us;
+  }
+}
+
+/* ---------- Ogg ---------- */
+
+static void scan_ogg(ts_index_t *x, uint64_t write_pos) {
+  uint8_t page[OGG_PAGE_HEADER + 255];
+  while (x->scan_pos + OGG_PAGE_HEADER <= write_pos) {
+    peek(x, x->scan_pos, page, OGG_PAGE_HEADER);
+    if (memcmp(page, "OggS", 4) != 0 || page[4] != 0) {
+      lose_sync(x, 1);
+      continue;
+    }
+    size_t segments = page[26];
+    uint64_t body_pos = x->scan_pos + OGG_PAGE_HEADER + segments;
+    if (body_pos > write_pos) {
+      return;
+    }
+    peek(x, x->scan_pos + OGG_PAGE_HEADER, page + OGG_PAGE_HEADER, segments);
+    size_t body = 0;
+    for (size_t i = 0; i < segments; i++) {
+      body += page[OGG_PAGE_HEADER + i];
+    }
+    if (body_pos + body > write_pos) {
+      return;
+    }
+    uint8_t flags = page[5];
+    uint64_t granule = get_le64(page + 6);
+
+    if (flags & 0x02) {
+      // First page of a (chained) stream: the identification header
+      uint8_t id[16];
+      size_t n = min_size(body, sizeof(id));
+      peek(x, body_pos, id, n);
+      if (n >= 16 && memcmp(id, "\x01vorbis", 7) == 0) {
+        x->ogg_rate = get_le32(id + 12);
+      } else if (n >= 8 && memcmp(id, "OpusHead", 8) == 0) {
+        x->ogg_rate = 48000; // granule positions are always at 48 kHz
+      }
+      x->ogg_audio = false;
+      x->ogg_granule = 0;
+      x->ogg_base_us = x->media_us;
+    } else if (granule != 0 || x->ogg_audio) {
+      // Header pages have granule position 0. Audio pages that do not
+      // continue a packet from the previous page are where a decoder that
+      // has the headers can pick up.
+      x->ogg_audio = true;
+      if (!(flags & 0x01)) {
+        add_point(x, x->scan_pos, x->media_us, true);
+      }
+    }
+    if (granule != UINT64_MAX) {
+      // The granule position counts samples up to the last packet that
+      // ends on this page
+      if (granule > x->ogg_granule && x->ogg_rate > 0) {
+        x->ogg_granule = granule;
+        x->media_us =
+            x->ogg_base_us + (int64_t)(granule * 1000000 / x->ogg_rate);
+      }
+    }
+    x->locked = true;
+    x->scan_pos = body_pos + body;
+    x->boundary = x->scan_pos;
+  }
+}
+
+/* ---------- FLAC ---------- */
+
+static uint8_t crc8(const uint8_t *buf, size_t len) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (uint8_t)(crc << 1 ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+typedef struct {
+  uint32_t samples;
+  uint32_t rate;
+  uint64_t number; // frame number, or sample number if variable
+  bool variable;
+  size_t len;
+} flac_header_t;
+
+/* Parses a frame header; false unless it is valid and its CRC matches */
+static bool flac_frame_header(const uint8_t *h, uint32_t stream_rate,
+                              flac_header_t *fh) {
+  static const uint32_t rates[12] = {0,     88200, 176400, 192000,
+                                     8000,  16000, 22050,  24000,
+                                     32000, 44100, 48000,  96000};
+  if (h[0] != 0xff || (h[1] & 0xfe) != 0xf8) {
+    return false;
+  }
+  int block_code = h[2] >> 4;
+  int rate_code = h[2] & 0x0f;
+  int channels = h[3] >> 4;
+  int sample_size = (h[3] >> 1) & 7;
+  if (block_code == 0 || rate_code == 15 || channels > 10 ||
+      sample_size == 3 || (h[3] & 1)) {
+    return false;
+  }
+  fh->variable = h[1] & 1;
+
+  // Frame or sample number, UTF-8 style
+  size_t p = 4;
+  uint8_t b = h[p++];
+  int extra;
+  uint64_t number;
+  if (b < 0x80) {
+    number = b;
+    extra = 0;
+  } else if (b >= 0xc0 && b < 0xfe) {
+    extra = b >= 0xfc ? 5 : b >= 0xf8 ? 4 : b >= 0xf0 ? 3 : b >= 0xe0 ? 2 : 1;
+    number = b & (0x3f >> extra);
+  } else if (b == 0xfe) {
+    number = 0;
+    extra = 6;
+  } else {
+    return false;
+  }
+  for (int i = 0; i < extra; i++) {
+    b = h[p++];
+    if ((b & 0xc0) != 0x80) {
+      return false;
+    }
+    number = number << 6 | (b & 0x3f);
+  }
+  fh->number = number;
+
+  if (block_code == 1) {
+    fh->samples = 192;
+  } else if (block_code <= 5) {
+    fh->samples = 576U << (block_code - 2);
+  } else if (block_code == 6) {
+    fh->samples = h[p++] + 1U;
+  } else if (block_code == 7) {
+    fh->samples = (h[p] << 8 | h[p + 1]) + 1U;
+    p += 2;
+  } else {
+    fh->samples = 256U << (block_code - 8);
+  }
+
+  if (rate_code == 0) {
+    fh->rate = stream_rate;
+  } else if (rate_code < 12) {
+    fh->rate = rates[rate_code];
+  } else if (rate_code == 12) {
+    fh->rate = h[p++] * 1000U;
+  } else {
+    fh->rate = (h[p] << 8 | h[p + 1]) * (rate_code == 14 ? 10U : 1U);
+    p += 2;
+  }
+  if (fh->rate == 0 || crc8(h, p) != h[p]) {
+    return false;
+  }
+  fh->len = p + 1;
+  return true;
+}
+
+/* Skips "fLaC" and the metadata blocks, taking the sample rate from
+ * STREAMINFO. False until all of them are in. */
+static bool flac_head(ts_index_t *x, uint64_t write_pos) {
+  uint8_t b[13];
+  if (write_pos - x->scan_pos < 4) {
+    return false;
+  }
+  peek(x, x->scan_pos, b, 4);
+  if (memcmp(b, "fLaC", 4) != 0) {
+    // Joined mid-stream; look for frames right away
+    x->flac_head_done = true;
+    return true;
+  }
+  uint64_t pos = x->scan_pos + 4;
+  for (;;) {
+    if (pos + 4 > write_pos) {
+      return false;
+    }
+    peek(x, pos, b, 4);
+    bool last = b[0] & 0x80;
+    int type = b[0] & 0x7f;
+    uint32_t len = (uint32_t)b[1] << 16 | b[2] << 8 | b[3];
+    if (type == 0 && len >= sizeof(b)) {
+      if (pos + 4 + sizeof(b) > write_pos) {
+        return false;
+      }
+      peek(x, pos + 4, b, sizeof(b));
+      x->flac_rate = (uint32_t)b[10] << 12 | b[11] << 4 | b[12] >> 4;
+    }
+    pos += 4 + len;
+    if (last) {
+      break;
+    }
+  }
+  if (pos > write_pos) {
+    return false;
+  }
+  x->scan_pos = x->boundary = pos;
+  x->flac_head_done = true;
+  return true;
+}
+
+/* Skips bytes inside a frame. If the next header does not turn up, the frame
+ * is given up on and the next valid header is taken, whatever its number. */
+static void flac_skip(ts_index_t *x, uint64_t skip) {
+  lose_sync(x, skip);
+  if (x->boundary == x->scan_pos) {
+    x->flac_in_frame = false;
+  }
+}
+
+/* A FLAC frame has no length field, so its end is only known once the next
+ * header is found: the boundary is the start of the last frame found. */
+static void scan_flac(ts_index_t *x, uint64_t write_pos) {
+  if (!x->flac_head_done && !flac_head(x, write_pos)) {
+    return;
+  }
+  uint8_t h[FLAC_MAX_HEADER];
+  while (x->scan_pos < write_pos) {
+    size_t offset = x->scan_pos % x->ring_size;
+    size_t n = min_size(write_pos - x->scan_pos, x->ring_size - offset);
+    const uint8_t *sync = memchr(x->ring + offset, 0xff, n);
+    if (sync == NULL) {
+      flac_skip(x, n);
+      continue;
+    }
+    if (sync != x->ring + offset) {
+      flac_skip(x, sync - (x->ring + offset));
+      continue;
+    }
+    if (x->scan_pos + FLAC_MAX_HEADER > write_pos) {
+      return;
+    }
+    peek(x, x->scan_pos, h, sizeof(h));
+    flac_header_t fh;
+    // Once in step, a header must also carry the next frame's number
+    if (!flac_frame_header(h, x->flac_rate, &fh) ||
+        (x->flac_in_frame && fh.number != x->flac_next_number)) {
+      flac_skip(x, 1);
+      continue;
+    }
+    if (x->flac_in_frame) {
+      x->media_us += (int64_t)x->flac_frame_samples * 1000000 / fh.rate;
+    }
+    x->boundary = x->scan_pos;
+    add_point(x, x->scan_pos, x->media_us, true);
+    x->flac_in_frame = true;
+    x->flac_frame_samples = fh.samples;
+    x->flac_next_number = fh.number + (fh.variable ? fh.samples : 1);
+    x->locked = true;
+    x->scan_pos += fh.len;
+  }
+}
+
+/* ---------- index ---------- */
+
+void ts_index_init(ts_index_t *x, ts_format_t format, const uint8_t *ring,
+                   size_t ring_size, ts_point_t *points, size_t capacity,
+                   uint64_t start) {
+  memset(x, 0, sizeof(*x));
+  x->format = format;
+  x->ring = ring;
+  x->ring_size = ring_size;
+  x->points = points;
+  x->capacity = capacity;
+  x->scan_pos = x->boundary = start;
+  // Until STREAMINFO says otherwise, for frames that leave it to it
+  x->flac_rate = 44100;
+}
+
+void ts_index_scan(ts_index_t *x, uint64_t write_pos) {
+  switch (x->format) {
+  case TS_FORMAT_MPEG:
+  case TS_FORMAT_ADTS:
+    scan_frames(x, write_pos);
+    break;
+  case TS_FORMAT_OGG:
+    scan_ogg(x, write_pos);
+    break;
+  case TS_FORMAT_FLAC:
+    scan_flac(x, write_pos);
+    break;
+  }
+}
+
+void ts_index_forget(ts_index_t *x, uint64_t oldest) {
+  while (x->count > 0 && x->points[x->head].pos < oldest) {
+    x->head = (x->head + 1) % x->capacity;
+    x->count--;
+  }
+}
+
+static const ts_point_t *point_at(const ts_index_t *x, size_t i) {
+  return &x->points[(x->head + i) % x->capacity];
+}
+
+bool ts_index_find(const ts_index_t *x, int64_t media_us, ts_point_t *out) {
+  if (x->count == 0) {
+    return false;
+  }
+  size_t i = x->count;
+  while (i > 1 && point_at(x, i - 1)->media_us > media_us) {
+    i--;
+  }
+  *out = *point_at(x, i - 1);
+  return true;
+}
+
+ts_point_t ts_index_next(const ts_index_t *x, uint64_t pos) {
+  // First point after pos
+  size_t lo = 0, hi = x->count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (point_at(x, mid)->pos <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < x->count && point_at(x, lo)->pos <= x->boundary) {
+    return *point_at(x, lo);
+  }
+  return (ts_point_t){.pos = x->boundary, .media_us = x->media_us};
+}
+
+ts_point_t ts_index_oldest(const ts_index_t *x) {
+  if (x->count == 0) {
+    return (ts_point_t){.pos = x->boundary, .media_us = x->media_us};
+  }
+  return *point_at(x, 0);
+}
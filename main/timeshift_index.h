@@ -0,0 +1,119 @@
+#ifndef TIMESHIFT_INDEX_H
+#define TIMESHIFT_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Time-shift: frame index of the compressed stream in the ring
+ *
+ * Plain C without ESP-IDF, like multiroom_proto.h, so it can be exercised on
+ * a host. timeshift.c owns the ring and feeds the index every byte appended.
+ *
+ * The index walks the stream frame by frame (Ogg: page by page) and knows,
+ * for every position up to its boundary, the media time it decodes to. A
+ * boundary is the end of the last complete frame: bytes up to it can be fed
+ * to the decoder without ever cutting a frame, which is what lets playback
+ * jump around without confusing the decoder. Every TS_POINT_INTERVAL_US or
+ * so, a frame start is kept as a seek point.
+ *
+ * Positions are absolute byte counts since the ring was started; the byte at
+ * position p is ring[p % ring_size].
+ */
+
+typedef enum {
+  TS_FORMAT_MPEG, // MP3 (MPEG audio layer I-III)
+  TS_FORMAT_ADTS, // AAC in ADTS
+  TS_FORMAT_OGG,  // Vorbis or Opus
+  TS_FORMAT_FLAC,
+} ts_format_t;
+
+// Seek points are kept about this far apart
+#define TS_POINT_INTERVAL_US 250000
+// Without a frame found in this many bytes the index gives up on them and
+// lets them through as they are
+#define TS_SYNC_GIVE_UP (64 * 1024)
+
+/**
+ * @brief A seek point: a frame that starts at pos and media time media_us.
+ */
+typedef struct {
+  uint64_t pos;
+  int64_t media_us;
+} ts_point_t;
+
+typedef struct {
+  ts_format_t format;
+  const uint8_t *ring;
+  size_t ring_size;
+  ts_point_t *points; // caller's array of capacity entries, oldest at head
+  size_t capacity;
+  size_t head;
+  size_t count;
+
+  uint64_t scan_pos; // next byte to look at
+  uint64_t boundary; // end of the last complete frame
+  int64_t media_us;  // media time at boundary
+  bool locked;       // scan_pos is at a frame start
+  int64_t last_point_us;
+
+  // Ogg
+  uint32_t ogg_rate;
+  uint64_t ogg_granule; // of the last page that had one
+  int64_t ogg_base_us;  // media time at the start of the logical stream
+  bool ogg_audio;       // past the header pages
+  // FLAC
+  bool flac_head_done;
+  uint32_t flac_rate; // from STREAMINFO
+  bool flac_in_frame;
+  uint32_t flac_frame_samples;
+  uint64_t flac_next_number; // expected frame or sample number
+  bool flac_variable;
+} ts_index_t;
+
+/**
+ * @brief Starts indexing a stream that begins at position start.
+ */
+void ts_index_init(ts_index_t *x, ts_format_t format, const uint8_t *ring,
+                   size_t ring_size, ts_point_t *points, size_t capacity,
+                   uint64_t start);
+
+/**
+ * @brief Indexes the bytes appended up to write_pos.
+ */
+void ts_index_scan(ts_index_t *x, uint64_t write_pos);
+
+/**
+ * @brief Drops the points before oldest (about to be overwritten).
+ */
+void ts_index_forget(ts_index_t *x, uint64_t oldest);
+
+/**
+ * @brief Latest point at or before media_us; the oldest point if media_us
+ * is earlier than all of them.
+ * @return false if there are no points.
+ */
+bool ts_index_find(const ts_index_t *x, int64_t media_us, ts_point_t *out);
+
+/**
+ * @brief First point after pos, if it is before the boundary; otherwise the
+ * boundary. Feeding the decoder from a point up to this, then from here on,
+ * always stops at a frame end.
+ */
+ts_point_t ts_index_next(const ts_index_t *x, uint64_t pos);
+
+/**
+ * @brief The oldest point, or the boundary if there is none.
+ */
+ts_point_t ts_index_oldest(const ts_index_t *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMESHIFT_INDEX_H
@@ -0,0 +1,128 @@
+#include "ui_state.h"
+#include "freertos/FreeRTOS.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+typedef struct {
+  _Atomic int32_t value;
+  _Atomic uint32_t version;
+} int_slot_t;
+
+typedef struct {
+  _Atomic uint32_t seq; // odd while a write is in progress
+  char value[UI_STATE_STR_MAX];
+} str_slot_t;
+
+static int_slot_t int_slots[UI_INT_FIELD_COUNT];
+static str_slot_t str_slots[UI_STR_FIELD_COUNT];
+static portMUX_TYPE str_write_lock = portMUX_INITIALIZER_UNLOCKED;
+static _Atomic(ui_state_change_cb_t) change_cbs[UI_STATE_MAX_CHANGE_CBS];
+
+static void notify_change(void) {
+  for (int i = 0; i < UI_STATE_MAX_CHANGE_CBS; i++) {
+    ui_state_change_cb_t cb =
+        atomic_load_explicit(&change_cbs[i], memory_order_acquire);
+    if (cb == NULL) {
+      break;
+    }
+    cb();
+  }
+}
+
+bool ui_state_add_change_cb(ui_state_change_cb_t cb) {
+  for (int i = 0; i < UI_STATE_MAX_CHANGE_CBS; i++) {
+    ui_state_change_cb_t expected = NULL;
+    if (atomic_compare_exchange_strong(&change_cbs[i], &expected, cb)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ui_state_set_int(ui_int_field_t field, int32_t value) {
+  if (field >= UI_INT_FIELD_COUNT) {
+    return;
+  }
+  int_slot_t *slot = &int_slots[field];
+  if (atomic_exchange_explicit(&slot->value, value, memory_order_acq_rel) !=
+      value) {
+    atomic_fetch_add_explicit(&slot->version, 1, memory_order_release);
+    notify_change();
+  }
+}
+
+uint32_t ui_state_get_int(ui_int_field_t field, int32_t *value) {
+  if (field >= UI_INT_FIELD_COUNT) {
+    return 0;
+  }
+  int_slot_t *slot = &int_slots[field];
+  // Version first: a racing write then shows up again on the next read
+  uint32_t version =
+      atomic_load_explicit(&slot->version, memory_order_acquire);
+  *value = atomic_load_explicit(&slot->value, memory_order_acquire);
+  return version;
+}
+
+void ui_state_set_str(ui_str_field_t field, const char *value) {
+  if (field >= UI_STR_FIELD_COUNT) {
+    return;
+  }
+  str_slot_t *slot = &str_slots[field];
+  if (value == NULL) {
+    value = "";
+  }
+  size_t len = strnlen(value, UI_STATE_STR_MAX - 1);
+  bool changed = false;
+
+  portENTER_CRITICAL(&str_write_lock);
+  if (strncmp(slot->value, value, len) != 0 || slot->value[len] != '\0') {
+    uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(slot->value, value, len);
+    slot->value[len] = '\0';
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+    changed = true;
+  }
+  portEXIT_CRITICAL(&str_write_lock);
+  if (changed) {
+    notify_change();
+  }
+}
+
+uint32_t ui_state_get_str(ui_str_field_t field, char *buf, size_t len) {
+  if (field >= UI_STR_FIELD_COUNT || len == 0) {
+    return 0;
+  }
+  str_slot_t *slot = &str_slots[field];
+  size_t n = len < UI_STATE_STR_MAX ? len : UI_STATE_STR_MAX;
+  uint32_t before, after;
+  do {
+    before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(buf, slot->value, n);
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  } while ((before & 1) || before != after);
+  buf[n - 1] = '\0';
+  return before / 2;
+}
+
+uint32_t ui_state_int_version(ui_int_field_t field) {
+  if (field >= UI_INT_FIELD_COUNT) {
+    return 0;
+  }
+  return atomic_load_explicit(&int_slots[field].version,
+                              memory_order_acquire);
+}
+
+uint32_t ui_state_str_version(ui_str_field_t field) {
+  if (field >= UI_STR_FIELD_COUNT) {
+    return 0;
+  }
+  return atomic_load_explicit(&str_slots[field].seq, memory_order_acquire) /
+         2;
+}
@@ -0,0 +1,103 @@
+#ifndef UI_STATE_H
+#define UI_STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest string (including terminator) held by a string field
+#define UI_STATE_STR_MAX 64
+
+/**
+ * @brief Integer fields of the UI state.
+ */
+typedef enum {
+  UI_FIELD_BITRATE, // kb/s
+  UI_FIELD_VOLUME,  // 0-100
+  UI_FIELD_MUTE,    // 0/1
+  UI_FIELD_ROLLER,  // station index selected in the roller
+  UI_FIELD_SCREEN,  // ui_screen_t
+  UI_FIELD_VISUALIZER_MODE,  // visualizer_mode_t
+  UI_FIELD_VISUALIZER_FRAME, // frame counter; data via visualizer_get_frame()
+  UI_FIELD_PAUSED,           // 0/1, time-shift
+  UI_FIELD_TIME_SHIFT,       // seconds behind the live stream
+  UI_INT_FIELD_COUNT
+} ui_int_field_t;
+
+/**
+ * @brief String fields of the UI state. Values are copied into the state, so
+ * callers may pass temporary buffers.
+ */
+typedef enum {
+  UI_FIELD_STATION_NAME,
+  UI_FIELD_STATION_ORIGIN,
+  UI_FIELD_IP,
+  UI_FIELD_SEARCH_QUERY,   // type-ahead query being entered
+  UI_FIELD_SEARCH_RESULTS, // best matches, one per line
+  UI_STR_FIELD_COUNT
+} ui_str_field_t;
+
+/**
+ * @brief Latest-value UI state.
+ *
+ * Each field is a single slot holding its most recent value and a version
+ * counter that changes whenever the value does. Producers never block and
+ * never lose the latest value; the LVGL task compares versions with the ones
+ * it last applied and redraws only what changed. Integer slots are plain
+ * atomics. String slots are seqlocks: writers are serialized by a short
+ * spinlock and readers retry if they raced with a write.
+ */
+
+/**
+ * @brief Stores an integer field. The version only changes if the value does.
+ */
+void ui_state_set_int(ui_int_field_t field, int32_t value);
+
+/**
+ * @brief Reads an integer field.
+ * @return The version of the value read.
+ */
+uint32_t ui_state_get_int(ui_int_field_t field, int32_t *value);
+
+/**
+ * @brief Copies a string into a field, truncating to UI_STATE_STR_MAX - 1
+ * characters. NULL is stored as an empty string.
+ */
+void ui_state_set_str(ui_str_field_t field, const char *value);
+
+/**
+ * @brief Copies a string field into buf.
+ * @return The version of the value read.
+ */
+uint32_t ui_state_get_str(ui_str_field_t field, char *buf, size_t len);
+
+/**
+ * @brief Called after a field changed, from the writer's context. Used to wake
+ * the LVGL task; must not block.
+ */
+typedef void (*ui_state_change_cb_t)(void);
+
+// Change callbacks that can be registered (LVGL task, web event stream)
+#define UI_STATE_MAX_CHANGE_CBS 2
+
+/**
+ * @brief Registers a change callback. Callbacks are never removed.
+ * @return false if all UI_STATE_MAX_CHANGE_CBS slots are taken.
+ */
+bool ui_state_add_change_cb(ui_state_change_cb_t cb);
+
+/**
+ * @brief Current version of a field, for cheap change detection.
+ */
+uint32_t ui_state_int_version(ui_int_field_t field);
+uint32_t ui_state_str_version(ui_str_field_t field);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UI_STATE_H
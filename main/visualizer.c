@@ -0,0 +1,329 @@
+#include "visualizer.h"
+#include "audio_pipeline_manager.h"
+#include "dsps_bit_rev.h"
+#include "dsps_fft2r.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lvgl_ssd1306_setup.h"
+#include "ringbuf.h"
+#include "ui_state.h"
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+static const char *TAG = "VISUALIZER";
+
+#define VIS_FFT_SIZE 256
+#define VIS_TAP_BUFFER_SIZE (16 * 1024)
+#define VIS_READ_CHUNK 1024
+#define VIS_READ_TIMEOUT_MS 100
+// Matches LVGL's display refresh period, so frames are not produced faster
+// than the panel can show them.
+#define VIS_FRAME_PERIOD_MS 33
+// Share of core 0 the analysis may use before frames are skipped
+#define VIS_CPU_BUDGET_PERCENT 10
+#define VIS_MAX_FRAME_STRIDE 8
+// Decimate towards this rate; there is little to see above ~10 kHz
+#define VIS_TARGET_RATE_HZ 22050
+#define VIS_FLOOR_DB (-60.0f)
+#define VIS_VU_FLOOR_DB (-48.0f)
+#define VIS_DECAY_PER_FRAME 6
+#define VIS_TASK_STACK_SIZE 4096
+#define VIS_TASK_PRIORITY 1
+#define VIS_TASK_CORE 0
+
+static ringbuf_handle_t tap_rb = NULL;
+static TaskHandle_t vis_task_handle = NULL;
+static volatile visualizer_mode_t vis_mode = VISUALIZER_OFF;
+
+static volatile int stream_rate = 44100;
+static volatile int stream_bits = 16;
+static volatile int stream_channels = 2;
+
+// Latest published frame, shared with the LVGL task
+static portMUX_TYPE frame_lock = portMUX_INITIALIZER_UNLOCKED;
+static visualizer_frame_t shared_frame;
+static bool frame_consumed = true;
+static visualizer_stats_t stats = {.frame_stride = 1};
+
+// Analyzer state (analyzer task only)
+static int16_t history[VIS_FFT_SIZE]; // decimated mono samples, circular
+static int history_pos;
+static int16_t hann_q15[VIS_FFT_SIZE];
+static int16_t fft_buf[VIS_FFT_SIZE * 2] __attribute__((aligned(16)));
+static uint8_t band_edges[VISUALIZER_BANDS + 1]; // FFT bin ranges
+static visualizer_frame_t frame;
+static int32_t decim_acc;
+static int decim_count;
+static int64_t vu_sum_sq[2];
+static int vu_count;
+
+static void init_tables(void) {
+  for (int i = 0; i < VIS_FFT_SIZE; i++) {
+    float w = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (VIS_FFT_SIZE - 1));
+    hann_q15[i] = (int16_t)(w * 32767.0f);
+  }
+  // Logarithmic bands over bins 1..N/2, each at least one bin wide
+  const int bins = VIS_FFT_SIZE / 2;
+  band_edges[0] = 1;
+  for (int b = 1; b <= VISUALIZER_BANDS; b++) {
+    int edge = (int)powf((float)bins, (float)b / VISUALIZER_BANDS);
+    if (edge <= band_edges[b - 1]) {
+      edge = band_edges[b - 1] + 1;
+    }
+    band_edges[b] = edge > bins ? bins : edge;
+  }
+}
+
+static uint8_t db_to_level(float db, float floor_db) {
+  if (db <= floor_db) {
+    return 0;
+  }
+  if (db >= 0.0f) {
+    return VISUALIZER_LEVEL_MAX;
+  }
+  return (uint8_t)(VISUALIZER_LEVEL_MAX * (1.0f - db / floor_db));
+}
+
+static void analyze_spectrum(void) {
+  // Windowed, oldest sample first; imaginary part zero
+  for (int i = 0; i < VIS_FFT_SIZE; i++) {
+    int16_t s = history[(history_pos + i) % VIS_FFT_SIZE];
+    fft_buf[2 * i] = (int16_t)(((int32_t)s * hann_q15[i]) >> 15);
+    fft_buf[2 * i + 1] = 0;
+  }
+  // Fixed point radix-2; dispatches to the S3 (aes3) SIMD version when the
+  // optimized esp-dsp build is enabled. Each stage scales by 1/2.
+  dsps_fft2r_sc16(fft_buf, VIS_FFT_SIZE);
+  dsps_bit_rev_sc16_ansi(fft_buf, VIS_FFT_SIZE);
+
+  // A full scale sine ends up at 32767 * 0.5 (Hann) / 2 (two sided) in its
+  // bin after the 1/N scaling
+  const float ref_power = 8192.0f * 8192.0f;
+  for (int b = 0; b < VISUALIZER_BANDS; b++) {
+    int32_t peak = 0;
+    for (int k = band_edges[b]; k < band_edges[b + 1]; k++) {
+      int32_t re = fft_buf[2 * k];
+      int32_t im = fft_buf[2 * k + 1];
+      int32_t power = re * re + im * im;
+      if (power > peak) {
+        peak = power;
+      }
+    }
+    float db = peak ? 10.0f * log10f((float)peak / ref_power) : VIS_FLOOR_DB;
+    uint8_t level = db_to_level(db, VIS_FLOOR_DB);
+    // Bars fall gradually so the display does not flicker
+    int decayed = (int)frame.bands[b] - VIS_DECAY_PER_FRAME;
+    frame.bands[b] = level > decayed ? level : (decayed > 0 ? decayed : 0);
+  }
+}
+
+static void analyze_vu(void) {
+  for (int ch = 0; ch < 2; ch++) {
+    uint8_t level = 0;
+    if (vu_count > 0 && vu_sum_sq[ch] > 0) {
+      float rms = sqrtf((float)vu_sum_sq[ch] / vu_count);
+      level = db_to_level(20.0f * log10f(rms / 32768.0f), VIS_VU_FLOOR_DB);
+    }
+    int decayed = (int)frame.vu[ch] - VIS_DECAY_PER_FRAME;
+    frame.vu[ch] = level > decayed ? level : (decayed > 0 ? decayed : 0);
+    vu_sum_sq[ch] = 0;
+  }
+  vu_count = 0;
+}
+
+// Mixes to mono, decimates and keeps the VU sums
+static void consume_pcm(const int16_t *samples, int count) {
+  int channels = stream_channels > 1 ? 2 : 1;
+  int factor = stream_rate / VIS_TARGET_RATE_HZ;
+  if (factor < 1) {
+    factor = 1;
+  }
+  for (int i = 0; i + channels <= count; i += channels) {
+    int32_t left = samples[i];
+    int32_t right = channels == 2 ? samples[i + 1] : left;
+    vu_sum_sq[0] += left * left;
+    vu_sum_sq[1] += right * right;
+    vu_count++;
+
+    // Box filter over the decimation factor doubles as the anti-alias filter
+    decim_acc += (left + right) / 2;
+    if (++decim_count >= factor) {
+      history[history_pos] = (int16_t)(decim_acc / factor);
+      history_pos = (history_pos + 1) % VIS_FFT_SIZE;
+      decim_acc = 0;
+      decim_count = 0;
+    }
+  }
+}
+
+static void publish_frame(void) {
+  portENTER_CRITICAL(&frame_lock);
+  shared_frame = frame;
+  frame_consumed = false;
+  stats.frames++;
+  portEXIT_CRITICAL(&frame_lock);
+  ui_state_set_int(UI_FIELD_VISUALIZER_FRAME, (int32_t)stats.frames);
+}
+
+// Adapts the frame stride so the analysis stays within its CPU share
+static void update_frame_stride(uint32_t cost_us) {
+  stats.avg_cost_us += ((int32_t)cost_us - (int32_t)stats.avg_cost_us) / 8;
+  uint32_t budget_us =
+      VIS_FRAME_PERIOD_MS * 1000 * VIS_CPU_BUDGET_PERCENT / 100;
+  uint32_t per_slot_us = stats.avg_cost_us / stats.frame_stride;
+  if (per_slot_us > budget_us && stats.frame_stride < VIS_MAX_FRAME_STRIDE) {
+    stats.frame_stride++;
+    ESP_LOGW(TAG, "Analysis takes %" PRIu32 " us, showing every %" PRIu32
+                  " frames",
+             stats.avg_cost_us, stats.frame_stride);
+  } else if (stats.frame_stride > 1 &&
+             stats.avg_cost_us / (stats.frame_stride - 1) < budget_us / 2) {
+    stats.frame_stride--;
+  }
+}
+
+static void visualizer_task(void *pvParameters) {
+  static int16_t chunk[VIS_READ_CHUNK / sizeof(int16_t)];
+  int64_t next_frame_us = 0;
+  ESP_LOGI(TAG, "Visualizer task started.");
+
+  for (;;) {
+    if (vis_mode == VISUALIZER_OFF) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      rb_reset(tap_rb);
+      continue;
+    }
+
+    // Keep the tap well below full so writes are never split mid-sample
+    if (rb_bytes_filled(tap_rb) > VIS_TAP_BUFFER_SIZE / 2) {
+      rb_reset(tap_rb);
+      stats.overruns++;
+    }
+
+    int n = rb_read(tap_rb, (char *)chunk, sizeof(chunk),
+                    pdMS_TO_TICKS(VIS_READ_TIMEOUT_MS));
+    if (n > 0 && stream_bits == 16) {
+      consume_pcm(chunk, n / (int)sizeof(int16_t));
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (now < next_frame_us) {
+      continue;
+    }
+    next_frame_us = now + (int64_t)VIS_FRAME_PERIOD_MS * 1000 *
+                              stats.frame_stride;
+
+    bool display_ready;
+    portENTER_CRITICAL(&frame_lock);
+    display_ready = frame_consumed;
+    portEXIT_CRITICAL(&frame_lock);
+    if (!display_ready || !lvgl_ssd1306_is_panel_on()) {
+      stats.skipped++;
+      continue;
+    }
+
+    if (n <= 0) {
+      // No audio (muted, buffering): let the bars fall, then go quiet
+      memset(history, 0, sizeof(history));
+      bool any = false;
+      for (int b = 0; b < VISUALIZER_BANDS; b++) {
+        any |= frame.bands[b] != 0;
+      }
+      any |= frame.vu[0] != 0 || frame.vu[1] != 0;
+      if (!any) {
+        continue;
+      }
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (vis_mode == VISUALIZER_SPECTRUM) {
+      analyze_spectrum();
+    } else {
+      analyze_vu();
+    }
+    update_frame_stride((uint32_t)(esp_timer_get_time() - start));
+    publish_frame();
+  }
+}
+
+esp_err_t visualizer_init(void) {
+  esp_err_t err = dsps_fft2r_init_sc16(NULL, VIS_FFT_SIZE);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to initialize FFT (%s)", esp_err_to_name(err));
+    return err;
+  }
+  init_tables();
+
+  tap_rb = rb_create(VIS_TAP_BUFFER_SIZE, 1);
+  if (tap_rb == NULL) {
+    ESP_LOGE(TAG, "Failed to create PCM tap buffer");
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (xTaskCreatePinnedToCore(visualizer_task, "visualizer",
+                              VIS_TASK_STACK_SIZE, NULL, VIS_TASK_PRIORITY,
+                              &vis_task_handle, VIS_TASK_CORE) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create visualizer task");
+    rb_destroy(tap_rb);
+    tap_rb = NULL;
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+/* Taps the I2S writer only while there is something to show, so no PCM is
+ * copied with the visualizer off */
+static void tap_update(void) {
+  if (tap_rb == NULL) {
+    return;
+  }
+  if (vis_mode == VISUALIZER_OFF) {
+    audio_pipeline_tap_remove(PIPELINE_TAP_VISUALIZER);
+  } else {
+    // Fails harmlessly while no pipeline exists
+    audio_pipeline_tap_insert(PIPELINE_TAP_VISUALIZER, tap_rb);
+  }
+}
+
+void visualizer_set_mode(visualizer_mode_t mode) {
+  vis_mode = mode;
+  tap_update();
+  memset(&frame, 0, sizeof(frame));
+  ui_state_set_int(UI_FIELD_VISUALIZER_MODE, mode);
+  if (vis_task_handle) {
+    xTaskNotifyGive(vis_task_handle);
+  }
+}
+
+void visualizer_attach(void) {
+  if (tap_rb == NULL) {
+    return;
+  }
+  rb_reset(tap_rb);
+  tap_update();
+}
+
+void visualizer_set_format(int sample_rate, int bits, int channels) {
+  stream_rate = sample_rate;
+  stream_bits = bits;
+  stream_channels = channels;
+  if (bits != 16) {
+    ESP_LOGW(TAG, "%d bit PCM is not visualized", bits);
+  }
+}
+
+void visualizer_get_frame(visualizer_frame_t *out) {
+  portENTER_CRITICAL(&frame_lock);
+  *out = shared_frame;
+  frame_consumed = true;
+  portEXIT_CRITICAL(&frame_lock);
+}
+
+void visualizer_get_stats(visualizer_stats_t *out) {
+  portENTER_CRITICAL(&frame_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&frame_lock);
+}
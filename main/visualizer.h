@@ -0,0 +1,75 @@
+#ifndef VISUALIZER_H
+#define VISUALIZER_H
+
+#include "app_config.h"
+#include "audio_element.h"
+#include "esp_err.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VISUALIZER_BANDS 16
+// Band and VU levels are reported in the range 0..VISUALIZER_LEVEL_MAX
+#define VISUALIZER_LEVEL_MAX 100
+
+/**
+ * @brief One visualizer frame.
+ */
+typedef struct {
+  uint8_t bands[VISUALIZER_BANDS]; // spectrum, low to high frequency
+  uint8_t vu[2];                   // left, right
+} visualizer_frame_t;
+
+/**
+ * @brief Analyzer cost counters.
+ */
+typedef struct {
+  uint32_t frames;       // frames published
+  uint32_t skipped;      // frame slots skipped (load or display not ready)
+  uint32_t overruns;     // PCM tap buffer overflows
+  uint32_t avg_cost_us;  // moving average of analysis time per frame
+  uint32_t frame_stride; // current frame-skip factor (1 = every frame)
+} visualizer_stats_t;
+
+/**
+ * @brief Creates the PCM tap buffer and the analyzer task (core 0, below the
+ * audio and UI tasks). The task is idle while the mode is VISUALIZER_OFF.
+ */
+esp_err_t visualizer_init(void);
+
+/**
+ * @brief Selects the visualization. Also updates the home screen layout.
+ */
+void visualizer_set_mode(visualizer_mode_t mode);
+
+/**
+ * @brief Connects the PCM tap (PIPELINE_TAP_VISUALIZER) to a new pipeline
+ * while a visualization is selected. Decoded PCM is copied to the tap
+ * without blocking; if the analyzer falls behind, data is dropped, never
+ * the audio.
+ */
+void visualizer_attach(void);
+
+/**
+ * @brief Reports the decoded stream format (from the decoder's music info).
+ */
+void visualizer_set_format(int sample_rate, int bits, int channels);
+
+/**
+ * @brief Copies the latest frame. Called by the LVGL task; marks the frame as
+ * consumed so the analyzer knows the display kept up.
+ */
+void visualizer_get_frame(visualizer_frame_t *frame);
+
+/**
+ * @brief Returns the analyzer cost counters.
+ */
+void visualizer_get_stats(visualizer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VISUALIZER_H
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Packs the web UI into a C source file for the firmware.
+
+Usage: pack_assets.py OUTPUT.c ASSET...
+
+Text assets (HTML, CSS, JS, SVG, JSON) are minified and gzip-compressed;
+other files (fonts, images) are embedded as they are. Every asset gets a
+strong ETag from its content. References from a page or stylesheet to
+another asset ("/style.css", url(/inter.woff2)) are rewritten to carry that
+hash ("/style.css?v=<etag>"), so those can be cached for good while the
+page itself is revalidated.
+
+index.html is served at "/" and other pages without their extension
+("/stations"); everything else under its own name.
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+TYPES = {
+    '.html': 'text/html; charset=utf-8',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+    '.svg': 'image/svg+xml',
+    '.json': 'application/json',
+    '.woff2': 'font/woff2',
+    '.woff': 'font/woff',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+}
+TEXT = {'.html', '.css', '.js', '.svg', '.json'}
+
+
+def minify_css(css):
+    css = re.sub(r'/\*.*?\*/', '', css, flags=re.S)
+    css = re.sub(r'\s+', ' ', css)
+    css = re.sub(r'\s*([{};:,])\s*', r'\1', css)
+    return css.replace(';}', '}').strip()
+
+
+def minify_js(js):
+    # Conservative: line structure is kept, so automatic semicolon
+    # insertion still sees the same program
+    lines = (line.strip() for line in js.splitlines())
+    return '\n'.join(l for l in lines if l and not l.startswith('//'))
+
+
+def minify_html(html):
+    out = []
+    pos = 0
+    for m in re.finditer(r'(<(script|style)\b[^>]*>)(.*?)(</\2>)', html,
+                         flags=re.S | re.I):
+        out.append(minify_markup(html[pos:m.start()]))
+        body = m.group(3)
+        body = minify_js(body) if m.group(2).lower() == 'script' \
+            else minify_css(body)
+        out.append(m.group(1) + body + m.group(4))
+        pos = m.end()
+    out.append(minify_markup(html[pos:]))
+    return ''.join(out)
+
+
+def minify_markup(markup):
+    # Whitespace around line breaks is only layout in the source; spaces
+    # within a line (between inline elements) are kept
+    markup = re.sub(r'\s*\n\s*', '\n', markup)
+    markup = re.sub(r'>\n(<|$)', r'>\1', markup)
+    markup = re.sub(r'^\n<', '<', markup)
+    return markup.replace('\n', ' ')
+
+
+def link_assets(text, etags):
+    for name, etag in etags.items():
+        versioned = '/%s?v=%s' % (name, etag)
+        text = re.sub(r"""(['"])/%s\1""" % re.escape(name),
+                      r'\g<1>%s\g<1>' % versioned, text)
+        text = re.sub(r'url\(/%s\)' % re.escape(name),
+                      'url(%s)' % versioned, text)
+    return text
+
+
+def url_path(name):
+    base, ext = os.path.splitext(name)
+    if ext == '.html':
+        return '/' if base == 'index' else '/' + base
+    return '/' + name
+
+
+def main():
+    output, files = sys.argv[1], sorted(sys.argv[2:])
+    assets = []
+    for path in files:
+        name = os.path.basename(path)
+        ext = os.path.splitext(name)[1].lower()
+        if ext not in TYPES:
+            sys.exit('pack_assets.py: unknown asset type: ' + path)
+        with open(path, 'rb') as f:
+            data = f.read()
+        assets.append({'name': name, 'ext': ext, 'data': data})
+
+    # Subresources first, so pages and stylesheets can link to them by hash
+    assets.sort(key=lambda a: (a['ext'] == '.html', a['ext'] in TEXT))
+    etags = {}
+    for a in assets:
+        data = a['data']
+        if a['ext'] in TEXT:
+            text = data.decode('utf-8')
+            if a['ext'] == '.html':
+                text = link_assets(minify_html(text), etags)
+            elif a['ext'] == '.css':
+                text = link_assets(minify_css(text), etags)
+            elif a['ext'] == '.js':
+                text = minify_js(text)
+            # mtime=0 keeps the output, and so the ETag, reproducible
+            data = gzip.compress(text.encode('utf-8'), 9, mtime=0)
+        a['served'] = data
+        a['etag'] = hashlib.sha256(data).hexdigest()[:16]
+        etags[a['name']] = a['etag']
+
+    lines = ['// Generated by main/web/pack_assets.py, do not edit',
+             '#include "web_assets.h"', '']
+    for i, a in enumerate(assets):
+        lines.append('// %s: %d bytes, %d served' %
+                     (a['name'], len(a['data']), len(a['served'])))
+        lines.append('static const uint8_t asset_%d[] = {' % i)
+        data = a['served']
+        for j in range(0, len(data), 16):
+            lines.append('    ' + ', '.join('0x%02x' % b
+                                            for b in data[j:j + 16]) + ',')
+        lines.append('};')
+        lines.append('')
+    lines.append('const web_asset_t web_assets[] = {')
+    for i, a in enumerate(assets):
+        lines.append('    {"%s", "%s", "\\"%s\\"", asset_%d, sizeof(asset_%d), '
+                     '%s, %s},' % (url_path(a['name']), TYPES[a['ext']],
+                                   a['etag'], i, i,
+                                   'true' if a['ext'] in TEXT else 'false',
+                                   'false' if a['ext'] == '.html' else 'true'))
+    lines.append('};')
+    lines.append('')
+    lines.append('const size_t web_asset_count = %d;' % len(assets))
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,36 @@
+#ifndef WEB_ASSETS_H
+#define WEB_ASSETS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The web UI, embedded at build time
+ *
+ * The files in web/ are minified and gzip-compressed by web/pack_assets.py
+ * when the firmware is built, and end up in flash as the table below.
+ */
+
+typedef struct {
+  const char *path;    // URL path, e.g. "/" or "/style.css"
+  const char *type;    // Content-Type
+  const char *etag;    // strong ETag (quoted), a hash of data
+  const uint8_t *data; // body as sent
+  size_t size;
+  bool gzip;      // data is gzip-compressed
+  bool immutable; // only linked by hash, so it may be cached for good
+} web_asset_t;
+
+extern const web_asset_t web_assets[];
+extern const size_t web_asset_count;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WEB_ASSETS_H
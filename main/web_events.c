@@ -0,0 +1,599 @@
+#include "web_events.h"
+#include "audio_pipeline_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "local_media.h"
+#include "recorder.h"
+#include "station_data.h"
+#include "ui_state.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static const char *TAG = "WEB_EVENTS";
+
+#define EVENTS_TASK_STACK 3072
+#define EVENTS_TASK_PRIORITY 2
+// Bitrate and buffer fill are sampled (and idle clients pinged) this often
+#define EVENTS_POLL_MS 1000
+// Changes closer together than this (an encoder turn) go out as one update
+#define EVENTS_MIN_INTERVAL_MS 50
+// An idle stream gets a comment this often, so dead peers are noticed
+#define EVENTS_KEEPALIVE_MS 15000
+// Largest serialized message
+#define EVENTS_MSG_MAX 512
+// Messages a client can have queued; past that it misses state changes
+#define EVENTS_CLIENT_QUEUE 4
+// Command results waiting for the event task
+#define EVENTS_COMMAND_QUEUE 8
+
+extern volatile int g_bitrate_kbps;
+extern volatile bool g_is_pipeline_running;
+extern int current_station;
+
+static const char SSE_RESPONSE_HEADER[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "retry: 3000\n\n";
+
+typedef struct {
+  int station_index;
+  uint32_t station_id;
+  char call_sign[UI_STATE_STR_MAX];
+  char origin[UI_STATE_STR_MAX];
+  int volume;
+  bool muted;
+  bool playing;
+  int bitrate_kbps;
+  int buffer_fill;
+  bool paused; // time-shift
+  int behind_s;
+  bool recording;
+  int local_folder; // -1 unless local files are playing
+  int local_track;
+} player_state_t;
+
+typedef enum {
+  EVENT_MSG_DIFF,     // changed fields of state version seq
+  EVENT_MSG_SNAPSHOT, // all fields as of version seq
+  EVENT_MSG_COMMAND,  // a command finished
+  EVENT_MSG_COMMENT,  // keepalive
+} event_msg_kind_t;
+
+/* A serialized message, shared by every client that still has to send it.
+ * Created by the event task, then only touched from the server task. */
+typedef struct {
+  int refs;
+  event_msg_kind_t kind;
+  uint32_t seq;
+  size_t len;
+  char data[];
+} event_msg_t;
+
+/* One subscriber; lives in the server task only */
+typedef struct {
+  int fd; // -1 while the slot is free
+  bool closing;
+  bool synced;  // has been given a snapshot
+  uint32_t seq; // state version of the last state message queued
+  event_msg_t *queue[EVENTS_CLIENT_QUEUE]; // queue[0] is being sent
+  int queued;
+  size_t offset;            // bytes of queue[0] already sent
+  int64_t stalled_since_us; // 0 while the socket takes data
+} events_client_t;
+
+static httpd_handle_t events_server = NULL;
+static TaskHandle_t events_task_handle = NULL;
+static events_client_t clients[WEB_EVENTS_MAX_CLIENTS];
+static _Atomic int client_count = 0;
+static atomic_bool snapshot_wanted = false;
+static QueueHandle_t command_queue = NULL;
+static uint32_t latest_seq = 0; // server task's view
+
+/* ---------- serialization (event task) ---------- */
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+  bool overflow;
+} msg_writer_t;
+
+static void msg_printf(msg_writer_t *w, const char *fmt, ...) {
+  if (w->overflow) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(w->buf + w->len, w->cap - w->len, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= w->cap - w->len) {
+    w->overflow = true;
+    return;
+  }
+  w->len += n;
+}
+
+static void msg_put_json_string(msg_writer_t *w, const char *s) {
+  msg_printf(w, "\"");
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      msg_printf(w, "\\%c", c);
+    } else if (c < 0x20) {
+      msg_printf(w, "\\u%04x", c);
+    } else {
+      msg_printf(w, "%c", c);
+    }
+  }
+  msg_printf(w, "\"");
+}
+
+/* Writes the fields of now that differ from last (all of them if last is
+ * NULL) as the members of a JSON object. Returns the number written. */
+static int put_state_fields(msg_writer_t *w, const player_state_t *now,
+                            const player_state_t *last) {
+  int fields = 0;
+#define SEPARATOR() msg_printf(w, fields++ ? "," : "")
+  if (!last || now->station_index != last->station_index ||
+      now->station_id != last->station_id ||
+      strcmp(now->call_sign, last->call_sign) != 0 ||
+      strcmp(now->origin, last->origin) != 0) {
+    SEPARATOR();
+    msg_printf(w, "\"station\":{\"index\":%d,\"id\":%" PRIu32 ",\"call_sign\":",
+               now->station_index, now->station_id);
+    msg_put_json_string(w, now->call_sign);
+    msg_printf(w, ",\"origin\":");
+    msg_put_json_string(w, now->origin);
+    msg_printf(w, "}");
+  }
+  if (!last || now->volume != last->volume) {
+    SEPARATOR();
+    msg_printf(w, "\"volume\":%d", now->volume);
+  }
+  if (!last || now->muted != last->muted) {
+    SEPARATOR();
+    msg_printf(w, "\"muted\":%s", now->muted ? "true" : "false");
+  }
+  if (!last || now->playing != last->playing) {
+    SEPARATOR();
+    msg_printf(w, "\"playing\":%s", now->playing ? "true" : "false");
+  }
+  if (!last || now->bitrate_kbps != last->bitrate_kbps) {
+    SEPARATOR();
+    msg_printf(w, "\"bitrate\":%d", now->bitrate_kbps);
+  }
+  if (!last || now->buffer_fill != last->buffer_fill) {
+    SEPARATOR();
+    msg_printf(w, "\"buffer\":%d", now->buffer_fill);
+  }
+  if (!last || now->paused != last->paused) {
+    SEPARATOR();
+    msg_printf(w, "\"paused\":%s", now->paused ? "true" : "false");
+  }
+  if (!last || now->behind_s != last->behind_s) {
+    SEPARATOR();
+    msg_printf(w, "\"behind\":%d", now->behind_s);
+  }
+  if (!last || now->recording != last->recording) {
+    SEPARATOR();
+    msg_printf(w, "\"recording\":%s", now->recording ? "true" : "false");
+  }
+  if (!last || now->local_folder != last->local_folder ||
+      now->local_track != last->local_track) {
+    SEPARATOR();
+    if (now->local_folder < 0) {
+      msg_printf(w, "\"local\":false");
+    } else {
+      msg_printf(w, "\"local\":{\"folder\":%d,\"track\":%d}",
+                 now->local_folder, now->local_track);
+    }
+  }
+#undef SEPARATOR
+  return fields;
+}
+
+static bool state_equal(const player_state_t *a, const player_state_t *b) {
+  return a->station_index == b->station_index &&
+         a->station_id == b->station_id &&
+         strcmp(a->call_sign, b->call_sign) == 0 &&
+         strcmp(a->origin, b->origin) == 0 && a->volume == b->volume &&
+         a->muted == b->muted && a->playing == b->playing &&
+         a->bitrate_kbps == b->bitrate_kbps &&
+         a->buffer_fill == b->buffer_fill && a->paused == b->paused &&
+         a->behind_s == b->behind_s && a->recording == b->recording &&
+         a->local_folder == b->local_folder &&
+         a->local_track == b->local_track;
+}
+
+static event_msg_t *msg_create(event_msg_kind_t kind, uint32_t seq,
+                               const char *data, size_t len) {
+  event_msg_t *msg = malloc(sizeof(*msg) + len);
+  if (msg == NULL) {
+    return NULL;
+  }
+  msg->refs = 1;
+  msg->kind = kind;
+  msg->seq = seq;
+  msg->len = len;
+  memcpy(msg->data, data, len);
+  return msg;
+}
+
+/* Serializes a state message; last NULL makes a snapshot */
+static event_msg_t *state_msg_create(uint32_t seq, const player_state_t *now,
+                                     const player_state_t *last) {
+  char buf[EVENTS_MSG_MAX];
+  msg_writer_t w = {.buf = buf, .cap = sizeof(buf)};
+  msg_printf(&w, "id: %" PRIu32 "\nevent: state\ndata: {", seq);
+  if (put_state_fields(&w, now, last) == 0) {
+    return NULL;
+  }
+  msg_printf(&w, "}\n\n");
+  if (w.overflow) {
+    ESP_LOGE(TAG, "State message exceeds %d bytes", EVENTS_MSG_MAX);
+    return NULL;
+  }
+  return msg_create(last ? EVENT_MSG_DIFF : EVENT_MSG_SNAPSHOT, seq, buf,
+                    w.len);
+}
+
+static event_msg_t *command_msg_create(const web_events_command_t *done) {
+  char buf[EVENTS_MSG_MAX];
+  msg_writer_t w = {.buf = buf, .cap = sizeof(buf)};
+  msg_printf(&w, "event: command\ndata: {\"request\":%" PRIu32 ",\"command\":",
+             done->request_id);
+  msg_put_json_string(&w, done->command);
+  if (done->result == ESP_OK) {
+    msg_printf(&w, ",\"status\":\"ok\"");
+  } else {
+    msg_printf(&w, ",\"status\":\"error\",\"error\":");
+    msg_put_json_string(&w, esp_err_to_name(done->result));
+  }
+  msg_printf(&w, ",\"latency_us\":%" PRIu32 "}\n\n", done->latency_us);
+  if (w.overflow) {
+    return NULL;
+  }
+  return msg_create(EVENT_MSG_COMMAND, 0, buf, w.len);
+}
+
+/* ---------- delivery (server task) ---------- */
+
+static void msg_release(event_msg_t *msg) {
+  if (msg && --msg->refs == 0) {
+    free(msg);
+  }
+}
+
+static void request_snapshot(void) {
+  if (!atomic_exchange(&snapshot_wanted, true) && events_task_handle) {
+    xTaskNotifyGive(events_task_handle);
+  }
+}
+
+/* Sends as much of the queue as the socket takes without blocking. Returns
+ * false if the connection failed. */
+static bool client_push(events_client_t *c) {
+  while (c->queued > 0) {
+    event_msg_t *msg = c->queue[0];
+    int n = httpd_socket_send(events_server, c->fd, msg->data + c->offset,
+                              msg->len - c->offset, MSG_DONTWAIT);
+    if (n == HTTPD_SOCK_ERR_TIMEOUT || n == 0) {
+      if (c->stalled_since_us == 0) {
+        c->stalled_since_us = esp_timer_get_time();
+      }
+      return true;
+    }
+    if (n < 0) {
+      return false;
+    }
+    c->stalled_since_us = 0;
+    c->offset += n;
+    if (c->offset == msg->len) {
+      msg_release(msg);
+      c->queued--;
+      memmove(&c->queue[0], &c->queue[1], c->queued * sizeof(c->queue[0]));
+      c->offset = 0;
+    }
+  }
+  return true;
+}
+
+static void client_close(events_client_t *c, const char *why) {
+  ESP_LOGI(TAG, "Closing event stream %d: %s", c->fd, why);
+  c->closing = true;
+  httpd_sess_trigger_close(events_server, c->fd);
+}
+
+/* Whether msg goes to this client, if it has room for it */
+static bool client_wants(const events_client_t *c, const event_msg_t *msg) {
+  switch (msg->kind) {
+  case EVENT_MSG_DIFF:
+    // Only on top of the version it has, otherwise it needs a snapshot
+    return c->synced && c->seq + 1 == msg->seq;
+  case EVENT_MSG_SNAPSHOT:
+    return !c->synced || c->seq != msg->seq;
+  case EVENT_MSG_COMMAND:
+    return true;
+  default:
+    return c->queued == 0;
+  }
+}
+
+/* Work item: retries pending sends and hands msg (may be NULL) to every
+ * client ready for it */
+static void events_deliver(void *arg) {
+  event_msg_t *msg = arg;
+  int64_t now = esp_timer_get_time();
+  bool behind = false;
+
+  if (msg && (msg->kind == EVENT_MSG_DIFF || msg->kind == EVENT_MSG_SNAPSHOT) &&
+      msg->seq > latest_seq) {
+    latest_seq = msg->seq;
+  }
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    events_client_t *c = &clients[i];
+    if (c->fd < 0 || c->closing) {
+      continue;
+    }
+    if (!client_push(c)) {
+      client_close(c, "send failed");
+      continue;
+    }
+    if (c->stalled_since_us &&
+        now - c->stalled_since_us > WEB_EVENTS_STALL_MS * 1000LL) {
+      client_close(c, "not reading");
+      continue;
+    }
+    if (msg && c->queued < EVENTS_CLIENT_QUEUE && client_wants(c, msg)) {
+      msg->refs++;
+      c->queue[c->queued++] = msg;
+      if (msg->kind == EVENT_MSG_DIFF || msg->kind == EVENT_MSG_SNAPSHOT) {
+        c->synced = true;
+        c->seq = msg->seq;
+      }
+      if (!client_push(c)) {
+        client_close(c, "send failed");
+        continue;
+      }
+    }
+    // Missed versions while full (or the message was lost): once drained,
+    // catch up with a snapshot
+    if (c->queued == 0 && (!c->synced || c->seq != latest_seq)) {
+      behind = true;
+    }
+  }
+  msg_release(msg);
+  if (behind) {
+    request_snapshot();
+  }
+}
+
+/* Session context destructor: the connection is gone */
+static void client_gone(void *ctx) {
+  events_client_t *c = ctx;
+  ESP_LOGI(TAG, "Event stream %d closed", c->fd);
+  for (int i = 0; i < c->queued; i++) {
+    msg_release(c->queue[i]);
+  }
+  memset(c, 0, sizeof(*c));
+  c->fd = -1;
+  atomic_fetch_sub(&client_count, 1);
+}
+
+esp_err_t web_events_handler(httpd_req_t *req) {
+  events_client_t *c = NULL;
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS && c == NULL; i++) {
+    if (clients[i].fd < 0) {
+      c = &clients[i];
+    }
+  }
+  if (c == NULL || events_task_handle == NULL) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_hdr(req, "Retry-After", "10");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, "{\"error\":\"too many subscribers\"}");
+  }
+
+  // The stream is written straight to the socket from here on, so the
+  // response head is too (no chunked encoding)
+  if (httpd_send(req, SSE_RESPONSE_HEADER, sizeof(SSE_RESPONSE_HEADER) - 1) <
+      0) {
+    return ESP_FAIL;
+  }
+  c->fd = httpd_req_to_sockfd(req);
+  c->closing = false;
+  c->synced = false;
+  c->queued = 0;
+  c->offset = 0;
+  c->stalled_since_us = 0;
+  req->sess_ctx = c;
+  req->free_ctx = client_gone;
+  atomic_fetch_add(&client_count, 1);
+  ESP_LOGI(TAG, "Event stream %d opened", c->fd);
+  request_snapshot();
+  return ESP_OK;
+}
+
+/* ---------- event task ---------- */
+
+static void read_player_state(player_state_t *s, bool sample) {
+  int32_t value;
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  s->station_index = current_station;
+  if (s->station_index >= 0 && s->station_index < snapshot->count) {
+    const station_t *st = &snapshot->stations[s->station_index];
+    s->station_id = st->id;
+    snprintf(s->call_sign, sizeof(s->call_sign), "%s", st->call_sign);
+    snprintf(s->origin, sizeof(s->origin), "%s", st->origin);
+  } else {
+    s->station_id = 0;
+    s->call_sign[0] = s->origin[0] = '\0';
+  }
+  station_snapshot_release(snapshot);
+
+  ui_state_get_int(UI_FIELD_VOLUME, &value);
+  s->volume = value;
+  ui_state_get_int(UI_FIELD_MUTE, &value);
+  s->muted = value != 0;
+  ui_state_get_int(UI_FIELD_PAUSED, &value);
+  s->paused = value != 0;
+  ui_state_get_int(UI_FIELD_TIME_SHIFT, &value);
+  s->behind_s = value;
+  s->playing = g_is_pipeline_running;
+  s->recording = recorder_is_recording();
+  local_media_stats_t lm;
+  local_media_get_stats(&lm);
+  s->local_folder = lm.folder;
+  s->local_track = lm.folder >= 0 ? lm.track : -1;
+  if (sample) {
+    s->bitrate_kbps = g_bitrate_kbps;
+    s->buffer_fill = g_stream_buffer_fill;
+  }
+}
+
+static bool publish(event_msg_t *msg) {
+  httpd_handle_t server = events_server;
+  if (server == NULL ||
+      httpd_queue_work(server, events_deliver, msg) != ESP_OK) {
+    free(msg);
+    return false;
+  }
+  return true;
+}
+
+/* Change callback from ui_state; any task */
+static void on_state_change(void) {
+  if (atomic_load(&client_count) > 0 && events_task_handle) {
+    xTaskNotifyGive(events_task_handle);
+  }
+}
+
+static void events_task(void *arg) {
+  static player_state_t last, now;
+  uint32_t seq = 0;
+  int64_t last_diff_us = 0;
+  int64_t last_sent_us = 0;
+  int64_t next_poll_us = 0;
+
+  while (1) {
+    bool subscribed = atomic_load(&client_count) > 0;
+    ulTaskNotifyTake(pdTRUE, subscribed ? pdMS_TO_TICKS(EVENTS_POLL_MS)
+                                        : portMAX_DELAY);
+    web_events_command_t done[EVENTS_COMMAND_QUEUE];
+    int done_count = 0;
+    while (done_count < EVENTS_COMMAND_QUEUE &&
+           xQueueReceive(command_queue, &done[done_count], 0) == pdTRUE) {
+      done_count++;
+    }
+    if (events_server == NULL) {
+      continue;
+    }
+    int64_t t = esp_timer_get_time();
+    bool poll = t >= next_poll_us;
+    if (poll) {
+      next_poll_us = t + EVENTS_POLL_MS * 1000LL;
+    }
+
+    now = last;
+    read_player_state(&now, poll);
+    event_msg_t *diff = NULL;
+    if (!state_equal(&now, &last)) {
+      // Spread a burst of changes: wait out the interval, then take
+      // everything that changed meanwhile in one update
+      int64_t wait_us = last_diff_us + EVENTS_MIN_INTERVAL_MS * 1000LL - t;
+      if (wait_us > 0) {
+        vTaskDelay(pdMS_TO_TICKS((wait_us + 999) / 1000));
+        read_player_state(&now, poll);
+      }
+      diff = state_msg_create(++seq, &now, &last);
+      last_diff_us = esp_timer_get_time();
+      if (diff && publish(diff)) {
+        last_sent_us = last_diff_us;
+      } else {
+        // Nobody got this version: bring everyone up to date instead
+        atomic_store(&snapshot_wanted, true);
+      }
+    }
+    last = now;
+
+    if (atomic_exchange(&snapshot_wanted, false)) {
+      event_msg_t *snapshot = state_msg_create(seq, &now, NULL);
+      if (snapshot && publish(snapshot)) {
+        last_sent_us = esp_timer_get_time();
+      } else {
+        atomic_store(&snapshot_wanted, true); // retried on the next poll
+      }
+    }
+
+    // Results go out after the state, which already has their effect
+    for (int i = 0; i < done_count; i++) {
+      event_msg_t *msg = command_msg_create(&done[i]);
+      if (msg && publish(msg)) {
+        last_sent_us = esp_timer_get_time();
+      }
+    }
+
+    if (poll && diff == NULL && done_count == 0) {
+      if (t - last_sent_us >= EVENTS_KEEPALIVE_MS * 1000LL) {
+        static const char keepalive[] = ": keepalive\n\n";
+        event_msg_t *msg = msg_create(EVENT_MSG_COMMENT, 0, keepalive,
+                                      sizeof(keepalive) - 1);
+        if (msg && publish(msg)) {
+          last_sent_us = t;
+        }
+      } else if (subscribed) {
+        // Nothing new, but stalled clients still need their retries
+        httpd_queue_work(events_server, events_deliver, NULL);
+      }
+    }
+  }
+}
+
+void web_events_command_done(const web_events_command_t *done) {
+  if (command_queue == NULL || atomic_load(&client_count) == 0) {
+    return;
+  }
+  if (xQueueSend(command_queue, done, 0) == pdTRUE) {
+    xTaskNotifyGive(events_task_handle);
+  } else {
+    ESP_LOGW(TAG, "Result of request %" PRIu32 " dropped", done->request_id);
+  }
+}
+
+esp_err_t web_events_start(httpd_handle_t server) {
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+  events_server = server;
+  if (events_task_handle) {
+    return ESP_OK;
+  }
+  command_queue =
+      xQueueCreate(EVENTS_COMMAND_QUEUE, sizeof(web_events_command_t));
+  if (command_queue == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (xTaskCreate(events_task, "web_events", EVENTS_TASK_STACK, NULL,
+                  EVENTS_TASK_PRIORITY, &events_task_handle) != pdPASS) {
+    ESP_LOGE(TAG, "Failed to create the event task");
+    return ESP_ERR_NO_MEM;
+  }
+  if (!ui_state_add_change_cb(on_state_change)) {
+    ESP_LOGW(TAG, "No ui_state callback slot, changes are polled");
+  }
+  return ESP_OK;
+}
+
+void web_events_stop(void) { events_server = NULL; }
@@ -0,0 +1,83 @@
+#ifndef WEB_EVENTS_H
+#define WEB_EVENTS_H
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Live player state for web clients (GET /api/events)
+ *
+ * The endpoint is a Server-Sent Events stream. Every message is a "state"
+ * event whose data is a JSON object to be merged into the client's copy of
+ * the player state:
+ *
+ *   {"station":{"index":3,"id":17,"call_sign":"KEXP","origin":"Seattle"},
+ *    "volume":40,"muted":false,"playing":true,"bitrate":128,"buffer":87}
+ *
+ * A client first gets all fields, then only the ones that changed. The SSE
+ * id is the state version.
+ *
+ * When a command posted through /api/player has been carried out, a
+ * "command" event reports it, after the state change it caused:
+ *
+ *   {"request":12,"command":"station-select","status":"ok","latency_us":812345}
+ *
+ * status is "error" (with "error", the esp_err_t name) if it failed.
+ * latency_us runs from the request being queued to the action being done.
+ *
+ * A single task watches the player and serializes each change once; the
+ * message is then shared by all subscribers. Sockets are written without
+ * blocking from the web server task. A client that can't keep up holds at
+ * most a few messages: state changes it misses meanwhile are replaced by one
+ * full update when it has caught up, and a client that stops reading for
+ * WEB_EVENTS_STALL_MS is disconnected.
+ */
+
+// Concurrent subscribers; the web server keeps the other sockets for pages
+#define WEB_EVENTS_MAX_CLIENTS 3
+// A client whose socket takes nothing for this long is disconnected
+#define WEB_EVENTS_STALL_MS 10000
+
+/**
+ * @brief A finished command, for the "command" event.
+ */
+typedef struct {
+  uint32_t request_id;
+  const char *command; // static string, e.g. "station-select"
+  esp_err_t result;
+  uint32_t latency_us;
+} web_events_command_t;
+
+/**
+ * @brief Starts the event task. Call once the server is running, before
+ * registering web_events_handler.
+ */
+esp_err_t web_events_start(httpd_handle_t server);
+
+/**
+ * @brief Stops publishing. Subscribers are closed with the server.
+ */
+void web_events_stop(void);
+
+/**
+ * @brief Publishes a command result. Does not block; dropped if nobody is
+ * subscribed.
+ */
+void web_events_command_done(const web_events_command_t *done);
+
+/**
+ * @brief Handler for GET /api/events. Answers 503 when
+ * WEB_EVENTS_MAX_CLIENTS are already subscribed.
+ */
+esp_err_t web_events_handler(httpd_req_t *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WEB_EVENTS_H
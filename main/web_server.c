@@ -1,67 +1,668 @@
 #include "web_server.h"
 #include "app_config.h"
+#include "audio_pipeline_manager.h"
 #include "cJSON.h"
+#include "decoder_registry.h"
+#include "esp_heap_caps.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "hls_stream.h"
+#include "input_bus.h"
 #include "ir_remote.h"
+#include "json_stream.h"
+#include "local_media.h"
+#include "lvgl_ssd1306_setup.h"
+#include "multiroom.h"
 #include "pcm5122_driver.h"
+#include "pipeline_graph.h"
+#include "recorder.h"
 #include "station_data.h"
+#include "station_health.h"
+#include "station_import.h"
+#include "station_index.h"
+#include "stream_relay.h"
+#include "timeshift.h"
+#include "visualizer.h"
+#include "web_assets.h"
+#include "web_events.h"
 #include "board.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/param.h>
 
 extern audio_board_handle_t board_handle;
+extern volatile int g_bitrate_kbps;
+extern volatile bool g_is_pipeline_running;
 
 static const char *TAG = "WEB_SERVER";
+
+// Request bodies are parsed as they arrive, RECV_CHUNK_SIZE bytes at a time
+#define RECV_CHUNK_SIZE 512
+// Responses are streamed RESP_CHUNK_SIZE bytes at a time
+#define RESP_CHUNK_SIZE 512
+#define STATIONS_POST_MAX_LEN (2 * 1024 * 1024)
+#define CONFIG_POST_MAX_LEN 2048
+
 static httpd_handle_t server = NULL;
 
-/* Handler for GET /api/stations */
+/* Buffered writer for chunked responses. Output is collected in a small
+ * buffer (on the handler's stack) and sent whenever it fills up. */
+typedef struct {
+  httpd_req_t *req;
+  esp_err_t err;
+  size_t len;
+  char buf[RESP_CHUNK_SIZE];
+} chunk_writer_t;
+
+static void chunk_flush(chunk_writer_t *w) {
+  if (w->len > 0 && w->err == ESP_OK) {
+    w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+  }
+  w->len = 0;
+}
+
+static void chunk_putc(chunk_writer_t *w, char c) {
+  if (w->len == sizeof(w->buf)) {
+    chunk_flush(w);
+  }
+  w->buf[w->len++] = c;
+}
+
+static void chunk_puts(chunk_writer_t *w, const char *s) {
+  while (*s) {
+    chunk_putc(w, *s++);
+  }
+}
+
+static void chunk_put_json_string(chunk_writer_t *w, const char *s) {
+  static const char hex[] = "0123456789abcdef";
+  chunk_putc(w, '"');
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      chunk_putc(w, '\\');
+      chunk_putc(w, c);
+    } else if (c < 0x20) {
+      chunk_puts(w, "\\u00");
+      chunk_putc(w, hex[c >> 4]);
+      chunk_putc(w, hex[c & 0xF]);
+    } else {
+      chunk_putc(w, c);
+    }
+  }
+  chunk_putc(w, '"');
+}
+
+static void chunk_put_int(chunk_writer_t *w, long long value) {
+  char number[24];
+  snprintf(number, sizeof(number), "%lld", value);
+  chunk_puts(w, number);
+}
+
+/* Writes the members of a station object, without the braces */
+static void chunk_put_station_fields(chunk_writer_t *w, const station_t *st) {
+  chunk_puts(w, "\"id\":");
+  chunk_put_int(w, st->id);
+  chunk_puts(w, ",\"call_sign\":");
+  chunk_put_json_string(w, st->call_sign);
+  chunk_puts(w, ",\"origin\":");
+  chunk_put_json_string(w, st->origin);
+  chunk_puts(w, ",\"uri\":");
+  chunk_put_json_string(w, st->uri);
+  chunk_puts(w, ",\"codec\":");
+  chunk_put_int(w, st->codec);
+}
+
+/* Decodes %XX and '+' in place */
+static void url_decode(char *s) {
+  char *out = s;
+  for (; *s; s++) {
+    if (*s == '+') {
+      *out++ = ' ';
+    } else if (*s == '%' && isxdigit((unsigned char)s[1]) &&
+               isxdigit((unsigned char)s[2])) {
+      char hex[3] = {s[1], s[2], '\0'};
+      *out++ = (char)strtol(hex, NULL, 16);
+      s += 2;
+    } else {
+      *out++ = *s;
+    }
+  }
+  *out = '\0';
+}
+
+// A query string is part of the URI, so it is never longer than this
+#define QUERY_MAX_LEN CONFIG_HTTPD_MAX_URI_LEN
+
+/* Copies the query string into query (QUERY_MAX_LEN + 1 bytes); returns
+ * ESP_ERR_NOT_FOUND if there is none. A query cut short would lose its
+ * parameters without a trace, so it is answered with 414 and
+ * ESP_ERR_HTTPD_RESULT_TRUNC returned; the caller has nothing left to
+ * send. */
+static esp_err_t get_query(httpd_req_t *req, char *query, size_t size) {
+  esp_err_t ret = httpd_req_get_url_query_str(req, query, size);
+  if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    httpd_resp_send_err(req, HTTPD_414_URI_TOO_LONG, "Query too long");
+    return ret;
+  }
+  if (ret != ESP_OK) {
+    query[0] = '\0';
+    return ESP_ERR_NOT_FOUND;
+  }
+  return ESP_OK;
+}
+
+/* Reads a text parameter and decodes it into value. Returns
+ * ESP_ERR_HTTPD_RESULT_TRUNC if the decoded text doesn't fit, rather than
+ * dropping it. */
+static esp_err_t get_query_text(const char *query, const char *key,
+                                char *value, size_t size) {
+  char raw[QUERY_MAX_LEN + 1];
+  esp_err_t ret = httpd_query_key_value(query, key, raw, sizeof(raw));
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  url_decode(raw);
+  size_t len = strlen(raw);
+  if (len >= size) {
+    return ESP_ERR_HTTPD_RESULT_TRUNC;
+  }
+  memcpy(value, raw, len + 1);
+  return ESP_OK;
+}
+
+static bool contains_ignore_case(const char *haystack, const char *needle) {
+  size_t n = strlen(needle);
+  for (; *haystack; haystack++) {
+    if (strncasecmp(haystack, needle, n) == 0) {
+      return true;
+    }
+  }
+  return n == 0;
+}
+
+/* Handler for GET /api/stations
+ *
+ * Query parameters: offset, limit (default: all), q (case-insensitive match
+ * on call sign or origin) and pretty=1 (one station per line). The total
+ * number of matches is returned in X-Total-Count. The ETag is the station
+ * list version, so unchanged lists are answered with 304. The whole
+ * response comes from one snapshot of the list, so it is consistent with its
+ * ETag even if the list is replaced while it is being sent. */
 static esp_err_t api_stations_get_handler(httpd_req_t *req) {
-  char *json_str = get_stations_json();
-  if (json_str == NULL) {
-    httpd_resp_send_500(req);
-    return ESP_FAIL;
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  esp_err_t ret;
+  char etag[12];
+  snprintf(etag, sizeof(etag), "\"%08" PRIx32 "\"", snapshot->version);
+  char if_none_match[16];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK &&
+      strcmp(if_none_match, etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    ret = httpd_resp_send(req, NULL, 0);
+    goto cleanup;
+  }
+
+  int offset = 0;
+  int limit = snapshot->count;
+  bool pretty = false;
+  char q[STATION_CALL_SIGN_MAX + STATION_ORIGIN_MAX] = "";
+  char query[QUERY_MAX_LEN + 1];
+  ret = get_query(req, query, sizeof(query));
+  if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    ret = ESP_OK;
+    goto cleanup;
+  }
+  if (ret == ESP_OK) {
+    char value[16];
+    if (httpd_query_key_value(query, "offset", value, sizeof(value)) ==
+        ESP_OK) {
+      offset = MAX(atoi(value), 0);
+    }
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) ==
+        ESP_OK) {
+      limit = MAX(atoi(value), 0);
+    }
+    if (httpd_query_key_value(query, "pretty", value, sizeof(value)) ==
+        ESP_OK) {
+      pretty = atoi(value) != 0;
+    }
+    if (get_query_text(query, "q", q, sizeof(q)) ==
+        ESP_ERR_HTTPD_RESULT_TRUNC) {
+      // A search nothing can match; don't answer it with the whole list
+      ret = httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "q too long");
+      goto cleanup;
+    }
   }
 
+  // Count the matches first so the total can go in a header
+  int total = snapshot->count;
+  if (q[0] != '\0') {
+    total = 0;
+    for (int i = 0; i < snapshot->count; i++) {
+      total += contains_ignore_case(snapshot->stations[i].call_sign, q) ||
+               contains_ignore_case(snapshot->stations[i].origin, q);
+    }
+  }
+  char total_str[12];
+  snprintf(total_str, sizeof(total_str), "%d", total);
+
   httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
-  free(json_str);
-  return ESP_OK;
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "X-Total-Count", total_str);
+
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  int match = 0;
+  int sent = 0;
+  chunk_putc(&w, '[');
+  for (int i = 0; i < snapshot->count && sent < limit && w.err == ESP_OK;
+       i++) {
+    const station_t *st = &snapshot->stations[i];
+    if (q[0] != '\0' && !contains_ignore_case(st->call_sign, q) &&
+        !contains_ignore_case(st->origin, q)) {
+      continue;
+    }
+    if (match++ < offset) {
+      continue;
+    }
+    chunk_puts(&w, sent++ ? (pretty ? ",\n" : ",") : (pretty ? "\n" : ""));
+    chunk_putc(&w, '{');
+    chunk_put_station_fields(&w, st);
+    chunk_putc(&w, '}');
+  }
+  chunk_puts(&w, pretty && sent ? "\n]" : "]");
+  chunk_flush(&w);
+  ret = w.err == ESP_OK ? httpd_resp_send_chunk(req, NULL, 0) : w.err;
+
+cleanup:
+  station_snapshot_release(snapshot);
+  return ret;
 }
 
-/* Handler for POST /api/stations */
-static esp_err_t api_stations_post_handler(httpd_req_t *req) {
-  int total_len = req->content_len;
-  int cur_len = 0;
-  char *content = malloc(total_len + 1);
+/* Handler for GET /api/stations/search
+ *
+ * Ranked type-ahead search over call signs and origins using the station
+ * index. Query parameters: q and limit (default 10, at most
+ * STATION_INDEX_MAX_RESULTS). Each result is a station plus its "index" in
+ * the list and its "score". */
+static esp_err_t api_stations_search_handler(httpd_req_t *req) {
+  char q[STATION_CALL_SIGN_MAX + STATION_ORIGIN_MAX] = "";
+  int limit = 10;
+  char query[QUERY_MAX_LEN + 1];
+  esp_err_t ret = get_query(req, query, sizeof(query));
+  if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    return ESP_OK;
+  }
+  if (ret == ESP_OK) {
+    char value[8];
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) ==
+        ESP_OK) {
+      limit = MIN(MAX(atoi(value), 1), STATION_INDEX_MAX_RESULTS);
+    }
+    if (get_query_text(query, "q", q, sizeof(q)) ==
+        ESP_ERR_HTTPD_RESULT_TRUNC) {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "q too long");
+    }
+  }
 
-  if (!content) {
-    httpd_resp_send_500(req);
-    return ESP_FAIL;
+  // Indices in the results refer to this snapshot
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  station_match_t matches[STATION_INDEX_MAX_RESULTS];
+  int found = station_index_search(snapshot->index, q, matches, limit);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  chunk_putc(&w, '[');
+  for (int i = 0; i < found && w.err == ESP_OK; i++) {
+    chunk_puts(&w, i ? ",{" : "{");
+    chunk_put_station_fields(&w, &snapshot->stations[matches[i].index]);
+    chunk_puts(&w, ",\"index\":");
+    chunk_put_int(&w, matches[i].index);
+    chunk_puts(&w, ",\"score\":");
+    chunk_put_int(&w, matches[i].score);
+    chunk_putc(&w, '}');
+  }
+  station_snapshot_release(snapshot);
+  chunk_putc(&w, ']');
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Handler for GET /api/stations/health
+ *
+ * The health prober's counters and the last result of every probed station,
+ * in list order. Times are in ms and bitrates in kb/s; "codec" uses the
+ * station list's numbering (null if the stream was not recognized) and
+ * "error" is why the last probe failed. Timings, codec and bitrate are those
+ * of the last good probe. */
+static esp_err_t api_stations_health_handler(httpd_req_t *req) {
+  station_health_stats_t stats;
+  station_health_get_stats(&stats);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  chunk_puts(&w, "{\"round\":");
+  chunk_put_int(&w, stats.round);
+  chunk_puts(&w, ",\"probed\":");
+  chunk_put_int(&w, stats.probed);
+  chunk_puts(&w, ",\"probes\":");
+  chunk_put_int(&w, stats.probes);
+  chunk_puts(&w, ",\"failures\":");
+  chunk_put_int(&w, stats.failures);
+  chunk_puts(&w, ",\"discarded\":");
+  chunk_put_int(&w, stats.discarded);
+  chunk_puts(&w, ",\"bytes\":");
+  chunk_put_int(&w, stats.bytes);
+  chunk_puts(&w, ",\"dead\":");
+  chunk_put_int(&w, stats.dead);
+  chunk_puts(&w, ",\"waiting\":");
+  if (stats.waiting) {
+    chunk_put_json_string(&w, stats.waiting);
+  } else {
+    chunk_puts(&w, "null");
+  }
+  chunk_puts(&w, ",\"stations\":[");
+
+  const station_snapshot_t *snapshot = station_snapshot_acquire();
+  int sent = 0;
+  for (int i = 0; i < snapshot->count && w.err == ESP_OK; i++) {
+    station_health_t h;
+    if (!station_health_get(snapshot->stations[i].id, &h) ||
+        h.status == STATION_HEALTH_UNKNOWN) {
+      continue;
+    }
+    chunk_puts(&w, sent++ ? ",{\"id\":" : "{\"id\":");
+    chunk_put_int(&w, h.id);
+    chunk_puts(&w, ",\"status\":");
+    chunk_put_json_string(&w, station_health_status_name(h.status));
+    chunk_puts(&w, ",\"error\":");
+    chunk_put_json_string(&w, station_health_error_name(h.error));
+    chunk_puts(&w, ",\"fails\":");
+    chunk_put_int(&w, h.fails);
+    chunk_puts(&w, ",\"round\":");
+    chunk_put_int(&w, h.round);
+    chunk_puts(&w, ",\"dns_ms\":");
+    chunk_put_int(&w, h.dns_ms);
+    chunk_puts(&w, ",\"connect_ms\":");
+    chunk_put_int(&w, h.connect_ms);
+    chunk_puts(&w, ",\"first_byte_ms\":");
+    chunk_put_int(&w, h.first_byte_ms);
+    chunk_puts(&w, ",\"bitrate\":");
+    chunk_put_int(&w, h.bitrate_kbps);
+    chunk_puts(&w, ",\"bitrate_source\":");
+    chunk_puts(&w, h.bitrate_kbps == 0 ? "null"
+                   : h.icy_bitrate     ? "\"icy-br\""
+                                       : "\"stream\"");
+    chunk_puts(&w, ",\"codec\":");
+    if (h.codec == STATION_HEALTH_CODEC_UNKNOWN) {
+      chunk_puts(&w, "null");
+    } else {
+      chunk_put_int(&w, h.codec);
+    }
+    chunk_puts(&w, ",\"score\":");
+    chunk_put_int(&w, station_health_score(&h));
+    chunk_putc(&w, '}');
   }
+  station_snapshot_release(snapshot);
+  chunk_puts(&w, "]}");
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+typedef esp_err_t (*body_sink_t)(void *ctx, const char *data, size_t len);
 
-  int received = 0;
-  while (cur_len < total_len) {
-    received = httpd_req_recv(req, content + cur_len, total_len - cur_len);
+/* Passes the request body to sink in small chunks, so no handler ever holds
+ * the whole body. Stops at the first sink error. */
+static esp_err_t recv_body_streamed(httpd_req_t *req, body_sink_t sink,
+                                    void *ctx, esp_err_t *sink_ret) {
+  char buf[RECV_CHUNK_SIZE];
+  size_t remaining = req->content_len;
+  *sink_ret = ESP_OK;
+  while (remaining > 0) {
+    int received = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)));
     if (received <= 0) {
       if (received == HTTPD_SOCK_ERR_TIMEOUT) {
         continue;
       }
-      free(content);
       return ESP_FAIL;
     }
-    cur_len += received;
+    remaining -= received;
+    *sink_ret = sink(ctx, buf, received);
+    if (*sink_ret != ESP_OK) {
+      break;
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t station_import_sink(void *ctx, const char *data, size_t len) {
+  return station_json_import_feed(ctx, data, len);
+}
+
+/* Handler for GET /api/codecs
+ *
+ * The codecs of the decoder registry, for the station editor: "id" is the
+ * value of a station's "codec". */
+static esp_err_t api_codecs_get_handler(httpd_req_t *req) {
+  httpd_resp_set_type(req, "application/json");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  chunk_putc(&w, '[');
+  for (size_t i = 0; i < decoder_registry_count(); i++) {
+    const decoder_desc_t *d = decoder_registry_at(i);
+    chunk_puts(&w, i ? ",{\"id\":" : "{\"id\":");
+    chunk_put_int(&w, d->codec);
+    chunk_puts(&w, ",\"name\":");
+    chunk_put_json_string(&w, d->name);
+    chunk_puts(&w, ",\"mime\":");
+    chunk_put_json_string(&w, d->mime);
+    chunk_puts(&w, ",\"ext\":");
+    chunk_put_json_string(&w, d->ext);
+    chunk_putc(&w, '}');
+  }
+  chunk_putc(&w, ']');
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Handler for POST /api/stations */
+static esp_err_t api_stations_post_handler(httpd_req_t *req) {
+  if (req->content_len > STATIONS_POST_MAX_LEN) {
+    httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE,
+                        "Station list too large");
+    return ESP_FAIL;
+  }
+
+  station_json_import_t *import = station_json_import_begin();
+  if (import == NULL) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
   }
-  content[total_len] = '\0';
 
-  if (update_stations_from_json(content) == 0) {
-    save_station_data();
+  esp_err_t ret;
+  if (recv_body_streamed(req, station_import_sink, import, &ret) != ESP_OK) {
+    station_json_import_free(import);
+    return ESP_FAIL;
+  }
+  if (ret == ESP_OK) {
+    ret = station_json_import_finish(import);
+  }
+
+  if (ret == ESP_OK && save_station_data() != 0) {
+    // The list is already live; it is saved again with the next change
+    ESP_LOGE(TAG, "Failed to save the posted station list");
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                        "Station list applied but not saved");
+  } else if (ret == ESP_OK) {
     httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+  } else if (ret == ESP_ERR_NO_MEM) {
+    httpd_resp_send_500(req);
   } else {
+    ESP_LOGW(TAG, "Rejected station list: %s",
+             station_json_import_error(import));
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        station_json_import_error(import));
+  }
+
+  station_json_import_free(import);
+  return ESP_OK;
+}
+
+static esp_err_t playlist_import_sink(void *ctx, const char *data,
+                                      size_t len) {
+  return station_import_feed(ctx, data, len);
+}
+
+// Files may only be imported from the storage mounts
+static bool import_path_allowed(const char *path) {
+  return (strncmp(path, "/sdcard/", 8) == 0 ||
+          strncmp(path, "/spiffs/", 8) == 0) &&
+         strstr(path, "..") == NULL;
+}
+
+/* Handler for POST /api/stations/import
+ *
+ * Adds the stations of a radio-browser JSON export or an M3U, PLS or XSPF
+ * playlist: the request body, or with path= a file on the SD card or SPIFFS.
+ * Query parameters: format (default: detected), mode=replace, limit, and
+ * for radio-browser exports country, tag and broken=1. The input is streamed,
+ * so its size is not limited. The response has the import counters, and an
+ * error message if it failed. */
+static esp_err_t api_stations_import_handler(httpd_req_t *req) {
+  station_import_options_t options = {.format = STATION_IMPORT_AUTO,
+                                      .total_bytes = req->content_len};
+  char country[48] = "";
+  char tag[32] = "";
+  char path[96] = "";
+  char query[QUERY_MAX_LEN + 1];
+  esp_err_t ret = get_query(req, query, sizeof(query));
+  if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    return ESP_OK;
+  }
+  if (ret == ESP_OK) {
+    char value[16];
+    if (httpd_query_key_value(query, "format", value, sizeof(value)) ==
+        ESP_OK) {
+      options.format = station_import_format_from_name(value);
+    }
+    if (httpd_query_key_value(query, "mode", value, sizeof(value)) ==
+        ESP_OK) {
+      options.replace = strcmp(value, "replace") == 0;
+    }
+    if (httpd_query_key_value(query, "limit", value, sizeof(value)) ==
+        ESP_OK) {
+      options.limit = MAX(atoi(value), 0);
+    }
+    if (httpd_query_key_value(query, "broken", value, sizeof(value)) ==
+        ESP_OK) {
+      options.include_broken = atoi(value) != 0;
+    }
+    // A filter or path cut short would import the wrong stations
+    if (get_query_text(query, "country", country, sizeof(country)) ==
+            ESP_ERR_HTTPD_RESULT_TRUNC ||
+        get_query_text(query, "tag", tag, sizeof(tag)) ==
+            ESP_ERR_HTTPD_RESULT_TRUNC ||
+        get_query_text(query, "path", path, sizeof(path)) ==
+            ESP_ERR_HTTPD_RESULT_TRUNC) {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                          "country, tag or path too long");
+      return ESP_OK;
+    }
+  }
+  options.country = country;
+  options.tag = tag;
+
+  if (path[0] != '\0') {
+    if (!import_path_allowed(path)) {
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                          "path must be on /sdcard or /spiffs");
+      return ESP_OK;
+    }
+    options.total_bytes = 0;
+    if (options.format == STATION_IMPORT_AUTO) {
+      options.format = station_import_format_from_name(path);
+    }
+  } else if (req->content_len == 0) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "no playlist");
+    return ESP_OK;
+  }
+
+  station_import_t *import = station_import_begin(&options);
+  if (import == NULL) {
     httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  if (path[0] != '\0') {
+    ret = station_import_feed_file(import, path);
+  } else if (recv_body_streamed(req, playlist_import_sink, import, &ret) !=
+             ESP_OK) {
+    station_import_free(import);
+    return ESP_FAIL;
+  }
+  if (ret == ESP_OK) {
+    ret = station_import_finish(import);
   }
 
-  free(content);
+  station_import_stats_t stats;
+  station_import_get_stats(import, &stats);
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddStringToObject(root, "status", ret == ESP_OK ? "ok" : "error");
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Station import failed: %s", station_import_error(import));
+    cJSON_AddStringToObject(root, "error", station_import_error(import));
+  }
+  cJSON_AddNumberToObject(root, "entries", stats.entries);
+  cJSON_AddNumberToObject(root, "added", stats.added);
+  cJSON_AddNumberToObject(root, "duplicates", stats.duplicates);
+  cJSON_AddNumberToObject(root, "filtered", stats.filtered);
+  cJSON_AddNumberToObject(root, "unsupported", stats.unsupported);
+  cJSON_AddNumberToObject(root, "invalid", stats.invalid);
+  cJSON_AddNumberToObject(root, "dropped", stats.dropped);
+  cJSON_AddNumberToObject(root, "stations", stats.stations);
+  station_import_free(import);
+
+  switch (ret) {
+  case ESP_OK:
+    break;
+  case ESP_ERR_NOT_FOUND:
+    httpd_resp_set_status(req, "404 Not Found");
+    break;
+  case ESP_ERR_INVALID_ARG:
+    httpd_resp_set_status(req, "400 Bad Request");
+    break;
+  case ESP_ERR_INVALID_STATE:
+    httpd_resp_set_status(req, "409 Conflict");
+    break;
+  case ESP_FAIL:
+    httpd_resp_set_status(req, "507 Insufficient Storage");
+    break;
+  default:
+    httpd_resp_set_status(req, "500 Internal Server Error");
+    break;
+  }
+  char *json_str = cJSON_PrintUnformatted(root);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  cJSON_Delete(root);
+  free(json_str);
   return ESP_OK;
 }
 
@@ -79,6 +680,22 @@ static esp_err_t api_config_get_handler(httpd_req_t *req) {
   cJSON_AddNumberToObject(root, "deep_sleep_delay_ms",
                           g_runtime_config.deep_sleep_delay_ms);
   cJSON_AddBoolToObject(root, "ir_is_enabled", g_runtime_config.ir_is_enabled);
+  cJSON_AddNumberToObject(root, "display_dim_delay_ms",
+                          g_runtime_config.display_dim_delay_ms);
+  cJSON_AddNumberToObject(root, "display_blank_delay_ms",
+                          g_runtime_config.display_blank_delay_ms);
+  cJSON_AddNumberToObject(root, "visualizer_mode",
+                          g_runtime_config.visualizer_mode);
+  cJSON_AddNumberToObject(root, "relay_max_clients",
+                          g_runtime_config.relay_max_clients);
+  cJSON_AddNumberToObject(root, "multiroom_mode",
+                          g_runtime_config.multiroom_mode);
+  cJSON_AddNumberToObject(root, "timeshift_minutes",
+                          g_runtime_config.timeshift_minutes);
+  cJSON_AddBoolToObject(root, "recorder_enabled",
+                        g_runtime_config.recorder_enabled);
+  cJSON_AddStringToObject(root, "pipeline_graph",
+                          g_runtime_config.pipeline_graph);
 
   char *json_str = cJSON_PrintUnformatted(root);
   httpd_resp_set_type(req, "application/json");
@@ -89,49 +706,132 @@ static esp_err_t api_config_get_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+typedef struct {
+  json_stream_t js;
+  app_runtime_config_t config; // copy, committed only if the body is valid
+  char key[32];
+  char error[PIPELINE_GRAPH_ERROR_LEN]; // why the graph was rejected
+} config_parse_t;
+
+static esp_err_t config_token(const json_token_t *token, void *ctx) {
+  config_parse_t *parse = ctx;
+  app_runtime_config_t *config = &parse->config;
+  if (token->depth == 0) {
+    return token->type == JSON_TOKEN_OBJECT_START ||
+                   token->type == JSON_TOKEN_OBJECT_END
+               ? ESP_OK
+               : ESP_ERR_INVALID_ARG;
+  }
+  if (token->depth > 1) {
+    return ESP_OK;
+  }
+  if (token->type == JSON_TOKEN_KEY) {
+    strlcpy(parse->key, token->str, sizeof(parse->key));
+    return ESP_OK;
+  }
+
+  const char *key = parse->key;
+  if (token->type == JSON_TOKEN_BOOL) {
+    if (strcmp(key, "ir_is_enabled") == 0)
+      config->ir_is_enabled = token->boolean;
+    else if (strcmp(key, "recorder_enabled") == 0)
+      config->recorder_enabled = token->boolean;
+    return ESP_OK;
+  }
+  if (token->type == JSON_TOKEN_STRING) {
+    if (strcmp(key, "pipeline_graph") == 0) {
+      pipeline_graph_t graph;
+      if (strlcpy(config->pipeline_graph, token->str,
+                  sizeof(config->pipeline_graph)) >=
+              sizeof(config->pipeline_graph) ||
+          !pipeline_graph_parse(token->str, &graph, parse->error,
+                                sizeof(parse->error))) {
+        return ESP_ERR_INVALID_ARG;
+      }
+    }
+    return ESP_OK;
+  }
+  if (token->type != JSON_TOKEN_NUMBER) {
+    return ESP_OK;
+  }
+  if (token->number < 0 || token->number > UINT32_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint32_t value = (uint32_t)token->number;
+  if (strcmp(key, "analog_attenuation") == 0)
+    config->analog_attenuation = (pcm5122_analog_atten_t)value;
+  else if (strcmp(key, "digital_attenuation") == 0)
+    config->digital_attenuation = (pcm5122_digital_atten_t)value;
+  else if (strcmp(key, "power_save_mode") == 0)
+    config->power_save_mode = (power_save_mode_t)value;
+  else if (strcmp(key, "light_sleep_delay_ms") == 0)
+    config->light_sleep_delay_ms = value;
+  else if (strcmp(key, "deep_sleep_delay_ms") == 0)
+    config->deep_sleep_delay_ms = value;
+  else if (strcmp(key, "display_dim_delay_ms") == 0)
+    config->display_dim_delay_ms = value;
+  else if (strcmp(key, "display_blank_delay_ms") == 0)
+    config->display_blank_delay_ms = value;
+  else if (strcmp(key, "visualizer_mode") == 0)
+    config->visualizer_mode = (visualizer_mode_t)value;
+  else if (strcmp(key, "relay_max_clients") == 0) {
+    if (value > STREAM_RELAY_MAX_CLIENTS)
+      return ESP_ERR_INVALID_ARG;
+    config->relay_max_clients = (uint8_t)value;
+  } else if (strcmp(key, "multiroom_mode") == 0) {
+    if (value > MULTIROOM_FOLLOWER)
+      return ESP_ERR_INVALID_ARG;
+    config->multiroom_mode = (multiroom_mode_t)value;
+  } else if (strcmp(key, "timeshift_minutes") == 0) {
+    if (value > TIMESHIFT_MAX_MINUTES)
+      return ESP_ERR_INVALID_ARG;
+    config->timeshift_minutes = (uint8_t)value;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t config_sink(void *ctx, const char *data, size_t len) {
+  return json_stream_feed(&((config_parse_t *)ctx)->js, data, len);
+}
+
 /* Handler for POST /api/config */
 static esp_err_t api_config_post_handler(httpd_req_t *req) {
-  int total_len = req->content_len;
-  char *content = malloc(total_len + 1);
-  if (!content) {
+  if (req->content_len > CONFIG_POST_MAX_LEN) {
+    httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE, "Config too large");
+    return ESP_FAIL;
+  }
+
+  config_parse_t *parse = malloc(sizeof(config_parse_t));
+  if (!parse) {
     httpd_resp_send_500(req);
     return ESP_FAIL;
   }
+  parse->config = g_runtime_config;
+  parse->key[0] = '\0';
+  parse->error[0] = '\0';
+  json_stream_init(&parse->js, config_token, parse);
 
-  int cur_len = 0;
-  int received = 0;
-  while (cur_len < total_len) {
-    received = httpd_req_recv(req, content + cur_len, total_len - cur_len);
-    if (received <= 0) {
-      if (received == HTTPD_SOCK_ERR_TIMEOUT)
-        continue;
-      free(content);
-      return ESP_FAIL;
-    }
-    cur_len += received;
+  esp_err_t ret;
+  if (recv_body_streamed(req, config_sink, parse, &ret) != ESP_OK) {
+    free(parse);
+    return ESP_FAIL;
+  }
+  if (ret == ESP_OK) {
+    ret = json_stream_finish(&parse->js);
   }
-  content[total_len] = '\0';
 
-  cJSON *root = cJSON_Parse(content);
-  if (root) {
-    cJSON *item;
+  if (ret == ESP_OK) {
     bool ir_was_enabled = g_runtime_config.ir_is_enabled;
-
-    if ((item = cJSON_GetObjectItem(root, "analog_attenuation")))
-      g_runtime_config.analog_attenuation = (pcm5122_analog_atten_t)item->valueint;
-    if ((item = cJSON_GetObjectItem(root, "digital_attenuation")))
-      g_runtime_config.digital_attenuation = (pcm5122_digital_atten_t)item->valueint;
-    if ((item = cJSON_GetObjectItem(root, "power_save_mode")))
-      g_runtime_config.power_save_mode = (power_save_mode_t)item->valueint;
-    if ((item = cJSON_GetObjectItem(root, "light_sleep_delay_ms")))
-      g_runtime_config.light_sleep_delay_ms = item->valueint;
-    if ((item = cJSON_GetObjectItem(root, "deep_sleep_delay_ms")))
-      g_runtime_config.deep_sleep_delay_ms = item->valueint;
-    if ((item = cJSON_GetObjectItem(root, "ir_is_enabled")))
-      g_runtime_config.ir_is_enabled = cJSON_IsTrue(item);
+    g_runtime_config = parse->config;
 
     save_app_config();
 
+    // Restart the display timeouts with the new delays
+    lvgl_ssd1306_notify_activity();
+    visualizer_set_mode(g_runtime_config.visualizer_mode);
+    stream_relay_apply_config();
+    recorder_apply_config();
+
     // Immediate application
     pcm5122_apply_analog_attenuation();
     int current_vol = 0;
@@ -151,216 +851,865 @@ static esp_err_t api_config_post_handler(httpd_req_t *req) {
     }
 
     httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
-    cJSON_Delete(root);
   } else {
-    httpd_resp_send_500(req);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                        parse->error[0] ? parse->error : "Invalid config JSON");
   }
 
-  free(content);
+  free(parse);
   return ESP_OK;
 }
 
-/* Handler for GET / (Root) - Landing Page */
-static esp_err_t root_get_handler(httpd_req_t *req) {
-  const char *html_response =
-      "<!DOCTYPE html><html><head><meta name='viewport' "
-      "content='width=device-width, initial-scale=1.0'>"
-      "<style>body{font-family:'Inter',sans-serif;margin:0;padding:0;"
-      "display:flex;flex-direction:column;align-items:center;"
-      "justify-content:center;min-height:100vh;"
-      "background:linear-gradient(135deg, #141e30, #243b55);color:white;}"
-      "h1{margin-bottom:30px;text-shadow: 0 4px 6px rgba(0,0,0,0.3);}"
-      ".btn{display:inline-block;padding:18px "
-      "35px;margin:15px;background:rgba(255,255,255,0.1);color:white;"
-      "text-decoration:none;border-radius:12px;font-size:1.2em;font-weight:600;"
-      "backdrop-filter:blur(10px);border:1px solid rgba(255,255,255,0.2);"
-      "box-shadow:0 8px 32px 0 rgba(31,38,135,0.37);transition:all 0.3s ease;}"
-      ".btn:hover{background:rgba(255,255,255,0.2);transform:translateY(-5px);}"
-      "</style>"
-      "<link href='https://fonts.googleapis.com/css2?family=Inter:wght@400;600&display=swap' rel='stylesheet'>"
-      "<title>Radio Manager</title></head>"
-      "<body><h1>Radio Manager</h1>"
-      "<a href='/stations' class='btn'>Edit Stations</a>"
-      "<a href='/config' class='btn'>Configuration</a>"
-      "</body></html>";
-
-  httpd_resp_send(req, html_response, HTTPD_RESP_USE_STRLEN);
-  return ESP_OK;
+/* Latency of remote commands per event type, from being queued to done */
+typedef struct {
+  uint32_t count;
+  uint32_t failed;
+  uint64_t total_us;
+  uint32_t max_us;
+} command_stats_t;
+
+static command_stats_t command_stats[INPUT_EVENT_FOLDER_SELECT + 1];
+static portMUX_TYPE command_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Input bus completion callback, in the dispatcher task */
+static void player_command_complete(const input_event_t *event,
+                                    esp_err_t result, int64_t done_us) {
+  uint32_t latency_us = (uint32_t)(done_us - event->timestamp_us);
+  if (event->type < sizeof(command_stats) / sizeof(command_stats[0])) {
+    command_stats_t *st = &command_stats[event->type];
+    portENTER_CRITICAL(&command_stats_lock);
+    st->count++;
+    st->failed += result != ESP_OK;
+    st->total_us += latency_us;
+    st->max_us = MAX(st->max_us, latency_us);
+    portEXIT_CRITICAL(&command_stats_lock);
+  }
+  ESP_LOGI(TAG, "Request %" PRIu32 " (%s): %s after %" PRIu32 " us",
+           event->request_id, input_event_type_to_string(event->type),
+           esp_err_to_name(result), latency_us);
+  web_events_command_t done = {
+      .request_id = event->request_id,
+      .command = input_event_type_to_string(event->type),
+      .result = result,
+      .latency_us = latency_us,
+  };
+  web_events_command_done(&done);
 }
 
-/* Handler for GET /stations - Station Editor */
-static esp_err_t stations_page_handler(httpd_req_t *req) {
-  const char *html_response =
-      "<!DOCTYPE html><html><head><meta name='viewport' "
-      "content='width=device-width, initial-scale=1.0'>"
-      "<title>Edit Stations</title>"
-      "<style>"
-      "body{font-family:'Inter',sans-serif;background:linear-gradient(135deg, #0f2027, #203a43, #2c5364);"
-      "color:white;padding:20px;min-height:100vh;margin:0;}"
-      ".glass{background:rgba(255,255,255,0.05);backdrop-filter:blur(10px);"
-      "border-radius:16px;border:1px solid rgba(255,255,255,0.1);padding:20px;"
-      "box-shadow:0 8px 32px 0 rgba(0,0,0,0.37);}"
-      ".grid-container{display:grid;grid-template-columns:2em 5em 12em 1fr 6em "
-      "3em;gap:10px;align-items:center;min-width:700px;}"
-      "@media(max-width: 800px) { "
-      ".grid-container{display:flex;flex-direction:column;min-width:auto;} "
-      ".header-row{display:none;} "
-      ".station-row{display:flex;flex-wrap:wrap;gap:10px;margin-bottom:15px;padding:15px;background:rgba(255,255,255,0.05);border-radius:10px;} }"
-      ".header-row{display:contents;font-weight:bold;color:#ccc;}"
-      ".header-row span{padding:10px 0;border-bottom:1px solid rgba(255,255,255,0.1);}"
-      ".station-row{display:contents;}"
-      "input,select{background:rgba(0,0,0,0.2);color:white;border:1px solid rgba(255,255,255,0.2);"
-      "border-radius:8px;padding:8px;font-size:0.9em;width:100%;box-sizing:border-box;outline:none;}"
-      "input:focus{border-color:#3498db;}"
-      "option{background:#2c3e50;color:white;}"
-      ".btn{padding:10px 20px;background:#2ecc71;color:white;border:none;border-radius:8px;"
-      "cursor:pointer;font-weight:600;transition:all 0.2s;}"
-      ".btn:hover{background:#27ae60;}"
-      ".btn-del{background:#e74c3c;padding:5px 12px;}"
-      ".btn-del:hover{background:#c0392b;}"
-      ".homelink{display:inline-block;margin-bottom:20px;color:#3498db;text-decoration:none;font-weight:600;}"
-      ".handle{cursor:grab;font-size:1.4em;color:#aaa;user-select:none;text-align:center;}"
-      "</style>"
-      "<link href='https://fonts.googleapis.com/css2?family=Inter:wght@400;600&display=swap' rel='stylesheet'>"
-      "</head><body>"
-      "<a href='/' class='homelink'>&larr; Back to Home</a>"
-      "<div class='glass'>"
-      "<h3>Edit Stations</h3>"
-      "<div style='overflow-x:auto;'>"
-      "<div class='grid-container'>"
-      "  <div class='header-row'><span></span><span>Call</span><span>Origin</span><span>URI</span><span>Type</span><span></span></div>"
-      "  <div id='container' style='display:contents;'></div>"
-      "</div>"
-      "</div>"
-      "<div style='margin-top:25px;'>"
-      "<button class='btn' onclick='addStation()'>+ Add Station</button> "
-      "<button class='btn' onclick='saveStations()' style='background:#3498db'>Save Changes</button>"
-      "</div>"
-      "</div>"
-      "<script>"
-      "let stations=[]; let dragSrcIx = null;"
-      "async function fetchStations(){const r=await fetch('/api/stations');stations=await r.json();render();}"
-      "function render(){"
-      "  const c=document.getElementById('container');c.innerHTML='';"
-      "  stations.forEach((s,i)=>{"
-      "    const div=document.createElement('div');div.className='station-row';"
-      "    div.innerHTML=`<div class='handle' draggable='true' ondragstart='dragStart(event,${i})' ondragover='dragOver(event)' ondrop='drop(event,${i})'>&#9776;</div>"
-      "      <div><input value='${s.call_sign}' onchange='stations[${i}].call_sign=this.value' maxlength='4'></div>"
-      "      <div><input value='${s.origin}' onchange='stations[${i}].origin=this.value' maxlength='20'></div>"
-      "      <div><input value='${s.uri}' onchange='stations[${i}].uri=this.value'></div>"
-      "      <div><select onchange='stations[${i}].codec=parseInt(this.value)'>"
-      "        <option value='0' ${s.codec==0?'selected':''}>MP3</option><option value='1' ${s.codec==1?'selected':''}>AAC</option>"
-      "        <option value='2' ${s.codec==2?'selected':''}>OGG</option><option value='3' ${s.codec==3?'selected':''}>FLAC</option>"
-      "      </select></div>"
-      "      <div style='text-align:center'><button class='btn btn-del' onclick='removeStation(${i})'>&times;</button></div>`;"
-      "    c.appendChild(div);"
-      "  });"
-      "}"
-      "function dragStart(e,i){dragSrcIx=i;e.dataTransfer.setData('text/plain',i);}"
-      "function dragOver(e){e.preventDefault();return false;}"
-      "function drop(e,i){e.stopPropagation();if(dragSrcIx!==null && dragSrcIx!=i){"
-      "  const item=stations[dragSrcIx]; stations.splice(dragSrcIx,1); let target=i; if(dragSrcIx<i)target--; stations.splice(target,0,item); render();"
-      "} return false;}"
-      "function addStation(){stations.push({call_sign:'',origin:'',uri:'',codec:1});render();}"
-      "function removeStation(i){if(confirm('Delete station?')){stations.splice(i,1);render();}}"
-      "async function saveStations(){"
-      "  const r=await fetch('/api/stations',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(stations)});"
-      "  if(r.ok)alert('Success!');else alert('Error!');"
-      "}"
-      "fetchStations();</script></body></html>";
-
-  httpd_resp_send(req, html_response, HTTPD_RESP_USE_STRLEN);
+static bool parse_int(const char *s, int *out) {
+  char *end;
+  long value = strtol(s, &end, 10);
+  if (end == s || *end != '\0' || value < INT_MIN || value > INT_MAX) {
+    return false;
+  }
+  *out = (int)value;
+  return true;
+}
+
+/* Handler for POST /api/player/<command>
+ *
+ * Commands: tune?index=N or tune?id=N, next, prev, volume?set=N (0-100) or
+ * volume?step=N (signed), mute?state=on|off|toggle (default toggle), sleep,
+ * wake, and with time-shift pause, resume, seek?by=N (signed seconds,
+ * default -30) and live; record?state=on|off|toggle (default toggle) with
+ * the recorder; local?state=on|off|toggle (default toggle) for the files on
+ * the card, track?index=N and folder?index=N (as listed by /api/local).
+ * While files play, next, prev, pause, resume and seek act on them.
+ * Arguments are checked here and the command is queued for the
+ * input dispatcher, which runs it like an encoder action; nothing waits for
+ * it. The response (202) has the request id; the result follows as a
+ * "command" event on /api/events. */
+static esp_err_t api_player_post_handler(httpd_req_t *req) {
+  const char *command = req->uri + strlen("/api/player/");
+  size_t command_len = strcspn(command, "?");
+  char query[QUERY_MAX_LEN + 1];
+  char value[16];
+  if (get_query(req, query, sizeof(query)) == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    return ESP_OK;
+  }
+#define IS_COMMAND(name)                                                       \
+  (command_len == strlen(name) && strncmp(command, name, command_len) == 0)
+#define HAS_ARG(key)                                                           \
+  (httpd_query_key_value(query, key, value, sizeof(value)) == ESP_OK)
+
+  input_event_t event = {.source = INPUT_SOURCE_WEB,
+                         .control = INPUT_CONTROL_NONE};
+  if (IS_COMMAND("tune")) {
+    event.type = INPUT_EVENT_STATION_SELECT;
+    event.control = INPUT_CONTROL_STATION;
+    const station_snapshot_t *snapshot = station_snapshot_acquire();
+    int id;
+    if (HAS_ARG("index") && parse_int(value, &event.value) &&
+        event.value >= 0 && event.value < snapshot->count) {
+      // index given
+    } else if (HAS_ARG("id") && parse_int(value, &id) && id >= 0) {
+      event.value = station_snapshot_find_id(snapshot, (uint32_t)id);
+    } else {
+      event.value = -1;
+    }
+    station_snapshot_release(snapshot);
+    if (event.value < 0) {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                 "tune needs an index or id in the list");
+    }
+  } else if (IS_COMMAND("next") || IS_COMMAND("prev")) {
+    event.type = INPUT_EVENT_STATION_STEP;
+    event.control = INPUT_CONTROL_STATION;
+    event.value = IS_COMMAND("next") ? 1 : -1;
+  } else if (IS_COMMAND("volume")) {
+    event.control = INPUT_CONTROL_VOLUME;
+    if (HAS_ARG("set") && parse_int(value, &event.value) &&
+        event.value >= 0 && event.value <= 100) {
+      event.type = INPUT_EVENT_VOLUME_SET;
+    } else if (HAS_ARG("step") && parse_int(value, &event.value)) {
+      event.type = INPUT_EVENT_VOLUME_STEP;
+    } else {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                 "volume needs set=0..100 or step=N");
+    }
+  } else if (IS_COMMAND("mute") || IS_COMMAND("record") ||
+             IS_COMMAND("local")) {
+    event.type = IS_COMMAND("mute")     ? INPUT_EVENT_MUTE
+                 : IS_COMMAND("record") ? INPUT_EVENT_RECORD
+                                        : INPUT_EVENT_LOCAL;
+    event.control = IS_COMMAND("mute") ? INPUT_CONTROL_VOLUME
+                                       : INPUT_CONTROL_NONE;
+    event.value = -1;
+    if (HAS_ARG("state")) {
+      if (strcmp(value, "on") == 0) {
+        event.value = 1;
+      } else if (strcmp(value, "off") == 0) {
+        event.value = 0;
+      } else if (strcmp(value, "toggle") != 0) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                   "state must be on, off or toggle");
+      }
+    }
+  } else if (IS_COMMAND("sleep")) {
+    event.type = INPUT_EVENT_SLEEP;
+  } else if (IS_COMMAND("wake")) {
+    event.type = INPUT_EVENT_WAKE;
+  } else if (IS_COMMAND("pause") || IS_COMMAND("resume")) {
+    event.type = INPUT_EVENT_PAUSE;
+    event.value = IS_COMMAND("pause") ? 1 : 0;
+  } else if (IS_COMMAND("seek")) {
+    event.type = INPUT_EVENT_SEEK;
+    event.value = -TIMESHIFT_SKIP_S;
+    if (HAS_ARG("by") && !parse_int(value, &event.value)) {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                 "seek needs by=N (seconds, signed)");
+    }
+  } else if (IS_COMMAND("live")) {
+    event.type = INPUT_EVENT_LIVE;
+  } else if (IS_COMMAND("track") || IS_COMMAND("folder")) {
+    event.type = IS_COMMAND("track") ? INPUT_EVENT_TRACK_SELECT
+                                     : INPUT_EVENT_FOLDER_SELECT;
+    if (!HAS_ARG("index") || !parse_int(value, &event.value) ||
+        event.value < 0) {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                                 "track and folder need index=N");
+    }
+  } else {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown command");
+  }
+#undef IS_COMMAND
+#undef HAS_ARG
+
+  event.request_id = input_bus_new_request_id();
+  if (!input_bus_post(&event)) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, "{\"error\":\"command queue full\"}");
+  }
+  char response[64];
+  snprintf(response, sizeof(response),
+           "{\"request\":%" PRIu32 ",\"command\":\"%s\"}", event.request_id,
+           input_event_type_to_string(event.type));
+  httpd_resp_set_status(req, "202 Accepted");
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, response);
+}
+
+/* Handler for GET /api/player/stats
+ *
+ * Remote commands carried out since boot, per command: how many, how many
+ * failed, and the average and worst time from being queued to done (us). */
+static esp_err_t api_player_stats_handler(httpd_req_t *req) {
+  command_stats_t stats[sizeof(command_stats) / sizeof(command_stats[0])];
+  portENTER_CRITICAL(&command_stats_lock);
+  memcpy(stats, command_stats, sizeof(stats));
+  portEXIT_CRITICAL(&command_stats_lock);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  int sent = 0;
+  chunk_putc(&w, '{');
+  for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+    if (stats[i].count == 0) {
+      continue;
+    }
+    chunk_puts(&w, sent++ ? "," : "");
+    chunk_put_json_string(&w,
+                          input_event_type_to_string((input_event_type_t)i));
+    chunk_puts(&w, ":{\"count\":");
+    chunk_put_int(&w, stats[i].count);
+    chunk_puts(&w, ",\"failed\":");
+    chunk_put_int(&w, stats[i].failed);
+    chunk_puts(&w, ",\"avg_us\":");
+    chunk_put_int(&w, stats[i].total_us / stats[i].count);
+    chunk_puts(&w, ",\"max_us\":");
+    chunk_put_int(&w, stats[i].max_us);
+    chunk_putc(&w, '}');
+  }
+  chunk_putc(&w, '}');
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Handler for GET /api/record
+ *
+ * Recorder state, the card, and the weekly schedules with the UTC offset
+ * their times are in. */
+static esp_err_t api_record_get_handler(httpd_req_t *req) {
+  recorder_stats_t rec;
+  recorder_get_stats(&rec);
+  recorder_schedule_t schedules[RECORDER_MAX_SCHEDULES];
+  int utc_offset_min;
+  int n = recorder_get_schedules(schedules, RECORDER_MAX_SCHEDULES,
+                                 &utc_offset_min);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  chunk_puts(&w, "{\"enabled\":");
+  chunk_puts(&w, g_runtime_config.recorder_enabled ? "true" : "false");
+  chunk_puts(&w, ",\"mounted\":");
+  chunk_puts(&w, rec.mounted ? "true" : "false");
+  chunk_puts(&w, ",\"recording\":");
+  chunk_puts(&w, rec.recording ? "true" : "false");
+  chunk_puts(&w, ",\"scheduled\":");
+  chunk_puts(&w, rec.scheduled ? "true" : "false");
+  chunk_puts(&w, ",\"clock_set\":");
+  chunk_puts(&w, rec.clock_set ? "true" : "false");
+  chunk_puts(&w, ",\"file\":");
+  chunk_put_json_string(&w, rec.file);
+  chunk_puts(&w, ",\"card_size\":");
+  chunk_put_int(&w, rec.card_size);
+  chunk_puts(&w, ",\"card_free\":");
+  chunk_put_int(&w, rec.card_free);
+  chunk_puts(&w, ",\"utc_offset_min\":");
+  chunk_put_int(&w, utc_offset_min);
+  chunk_puts(&w, ",\"schedules\":[");
+  for (int i = 0; i < n; i++) {
+    chunk_puts(&w, i ? ",{\"days\":" : "{\"days\":");
+    chunk_put_int(&w, schedules[i].days);
+    chunk_puts(&w, ",\"start_min\":");
+    chunk_put_int(&w, schedules[i].start_min);
+    chunk_puts(&w, ",\"minutes\":");
+    chunk_put_int(&w, schedules[i].minutes);
+    chunk_puts(&w, ",\"station_id\":");
+    chunk_put_int(&w, schedules[i].station_id);
+    chunk_putc(&w, '}');
+  }
+  chunk_puts(&w, "]}");
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Handler for GET /api/local[?folder=N]
+ *
+ * Local playback: its state, the folders found, and the tracks of a folder
+ * (the one playing unless folder is given) by index. */
+static esp_err_t api_local_get_handler(httpd_req_t *req) {
+  local_media_stats_t lm;
+  local_media_get_stats(&lm);
+  int listed = lm.folder >= 0 ? lm.folder : 0;
+  char query[QUERY_MAX_LEN + 1];
+  char value[16];
+  esp_err_t ret = get_query(req, query, sizeof(query));
+  if (ret == ESP_ERR_HTTPD_RESULT_TRUNC) {
+    return ESP_OK;
+  }
+  if (ret == ESP_OK &&
+      httpd_query_key_value(query, "folder", value, sizeof(value)) ==
+          ESP_OK &&
+      !parse_int(value, &listed)) {
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                               "folder needs an index");
+  }
+  // A copy: the response is sent without holding the library
+  media_tracks_t tracks;
+  int count = local_media_copy_tracks(listed, &tracks);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  char name[MEDIA_PATH_MAX];
+  chunk_puts(&w, "{\"active\":");
+  chunk_puts(&w, lm.active ? "true" : "false");
+  chunk_puts(&w, ",\"paused\":");
+  chunk_puts(&w, lm.paused ? "true" : "false");
+  chunk_puts(&w, ",\"mounted\":");
+  chunk_puts(&w, lm.mounted ? "true" : "false");
+  chunk_puts(&w, ",\"folder\":");
+  chunk_put_int(&w, lm.folder);
+  chunk_puts(&w, ",\"track\":");
+  chunk_put_int(&w, lm.active ? lm.track : -1);
+  chunk_puts(&w, ",\"folders\":[");
+  for (int i = 0; local_media_folder_name(i, name, sizeof(name)); i++) {
+    chunk_puts(&w, i ? "," : "");
+    chunk_put_json_string(&w, name);
+  }
+  chunk_puts(&w, "],\"listed\":");
+  chunk_put_int(&w, count >= 0 ? listed : -1);
+  chunk_puts(&w, ",\"tracks\":[");
+  for (int i = 0; i < count; i++) {
+    media_display_name(media_track_path(&tracks, i), name, sizeof(name));
+    chunk_puts(&w, i ? "," : "");
+    chunk_put_json_string(&w, name);
+  }
+  chunk_puts(&w, "]}");
+  media_tracks_free(&tracks);
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+typedef struct {
+  json_stream_t js;
+  int utc_offset_min;
+  int count;
+  recorder_schedule_t entries[RECORDER_MAX_SCHEDULES];
+  bool in_schedules;
+  char key[32];
+} record_parse_t;
+
+static esp_err_t record_token(const json_token_t *token, void *ctx) {
+  record_parse_t *parse = ctx;
+  if (token->type == JSON_TOKEN_KEY) {
+    strlcpy(parse->key, token->str, sizeof(parse->key));
+    return ESP_OK;
+  }
+  // {"utc_offset_min":N,"schedules":[{"days":N,...},...]}
+  switch (token->depth) {
+  case 0:
+    return token->type == JSON_TOKEN_OBJECT_START ||
+                   token->type == JSON_TOKEN_OBJECT_END
+               ? ESP_OK
+               : ESP_ERR_INVALID_ARG;
+  case 1:
+    if (parse->in_schedules) {
+      // The array's end; the key is the last one of its objects by now
+      parse->in_schedules = false;
+      return token->type == JSON_TOKEN_ARRAY_END ? ESP_OK
+                                                 : ESP_ERR_INVALID_ARG;
+    }
+    if (strcmp(parse->key, "schedules") == 0) {
+      if (token->type != JSON_TOKEN_ARRAY_START) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      parse->in_schedules = true;
+    } else if (strcmp(parse->key, "utc_offset_min") == 0) {
+      if (token->type != JSON_TOKEN_NUMBER || token->number < INT16_MIN ||
+          token->number > INT16_MAX) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      parse->utc_offset_min = (int)token->number;
+    }
+    return ESP_OK;
+  case 2:
+    if (!parse->in_schedules || token->type != JSON_TOKEN_OBJECT_START) {
+      return token->type == JSON_TOKEN_OBJECT_END ? ESP_OK
+                                                  : ESP_ERR_INVALID_ARG;
+    }
+    if (parse->count == RECORDER_MAX_SCHEDULES) {
+      return ESP_ERR_INVALID_SIZE;
+    }
+    parse->entries[parse->count++] = (recorder_schedule_t){.station_id = -1};
+    return ESP_OK;
+  case 3:
+    break;
+  default:
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (token->type != JSON_TOKEN_NUMBER || parse->count == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // Ranges are checked by recorder_set_schedules(); here only what fits
+  recorder_schedule_t *s = &parse->entries[parse->count - 1];
+  double value = token->number;
+  if (strcmp(parse->key, "station_id") == 0) {
+    if (value < -1 || value > INT32_MAX) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    s->station_id = (int32_t)value;
+    return ESP_OK;
+  }
+  if (value < 0 || value > UINT16_MAX) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strcmp(parse->key, "days") == 0) {
+    if (value > UINT8_MAX) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    s->days = (uint8_t)value;
+  } else if (strcmp(parse->key, "start_min") == 0) {
+    s->start_min = (uint16_t)value;
+  } else if (strcmp(parse->key, "minutes") == 0) {
+    s->minutes = (uint16_t)value;
+  }
   return ESP_OK;
 }
 
-/* Handler for GET /config - Configuration Page */
-static esp_err_t config_page_handler(httpd_req_t *req) {
-  const char *html_response =
-      "<!DOCTYPE html><html><head><meta name='viewport' "
-      "content='width=device-width, initial-scale=1.0'>"
-      "<title>Configuration</title>"
-      "<style>"
-      "body{font-family:'Inter',sans-serif;background:linear-gradient(135deg, #2c3e50, #000000);color:white;margin:0;padding:20px;min-height:100vh;display:flex;flex-direction:column;align-items:center;}"
-      ".glass{max-width:500px;width:100%;background:rgba(255,255,255,0.03);backdrop-filter:blur(15px);border-radius:24px;border:1px solid rgba(255,255,255,0.1);padding:40px;box-shadow:0 20px 50px rgba(0,0,0,0.5);box-sizing:border-box;}"
-      "h2{margin-top:0;font-weight:600;letter-spacing:-0.5px;margin-bottom:30px;}"
-      ".field{margin-bottom:25px;}"
-      "label{display:block;margin-bottom:8px;font-size:0.85em;color:#aaa;text-transform:uppercase;letter-spacing:1px;font-weight:600;}"
-      ".tooltip{position:relative;display:inline-block;cursor:pointer;margin-left:5px;color:#3498db;text-transform:none;vertical-align:middle;}"
-      ".tooltip .tip{visibility:hidden;width:240px;background:#333;color:#fff;text-align:left;border-radius:8px;padding:12px;position:absolute;z-index:1;bottom:150%;left:50%;margin-left:-120px;opacity:0;transition:opacity 0.3s;font-size:0.85rem;font-weight:400;line-height:1.4;box-shadow:0 10px 30px rgba(0,0,0,0.5);border:1px solid rgba(255,255,255,0.1);pointer-events:none;}"
-      ".tooltip:hover .tip{visibility:visible;opacity:1;}"
-      "input,select{width:100%;background:rgba(255,255,255,0.05);border:1px solid rgba(255,255,255,0.2);color:white;padding:12px;border-radius:12px;font-size:1em;outline:none;transition:border-color 0.2s;box-sizing:border-box;}"
-      "input:focus,select:focus{border-color:#3498db;}"
-      "option{background:#2c3e50;color:white;}"
-      ".btn{width:100%;padding:15px;background:#3498db;color:white;border:none;border-radius:12px;font-size:1.1em;font-weight:600;cursor:pointer;margin-top:10px;transition:background 0.2s;}"
-      ".btn:hover{background:#2980b9;}"
-      ".homelink{align-self:flex-start;margin-bottom:20px;color:#3498db;text-decoration:none;font-weight:600;}"
-      ".info-section{margin-top:30px;padding-top:25px;border-top:1px solid rgba(255,255,255,0.1);font-size:0.9em;color:#ccc;line-height:1.6;}"
-      ".info-section h3{font-size:1em;color:#fff;margin-bottom:12px;text-transform:uppercase;letter-spacing:1px;}"
-      ".info-section ul{padding-left:18px;margin-bottom:15px;}"
-      ".info-section li{margin-bottom:8px;}"
-      "</style>"
-      "<link href='https://fonts.googleapis.com/css2?family=Inter:wght@400;600&display=swap' rel='stylesheet'>"
-      "</head><body>"
-      "<a href='/' class='homelink'>&larr; Back</a>"
-      "<div class='glass'>"
-      "<h2>Configuration</h2>"
-      "<div id='config-form'>"
-      "  <div class='field'><label>Analog Attenuation<span class='tooltip'>(i)<span class='tip'>Use -6dB here first to reduce output. This affects the hardware gain stage for cleaner sound at lower levels.</span></span></label><select id='anlgAttn'><option value='0'>0dB (2Vrms)</option><option value='1'>-6dB (1Vrms)</option></select></div>"
-      "  <div class='field'><label>Digital Attenuation<span class='tooltip'>(i)<span class='tip'>Use additional attenuation here if needed. This scales the digital signal before reaching the DAC.</span></span></label><select id='digiAttn'>"
-      "    <option value='0'>0 dB</option><option value='6'>-3 dB</option><option value='12'>-6 dB</option><option value='18'>-9 dB</option><option value='24'>-12 dB</option><option value='30'>-15 dB</option><option value='36'>-18 dB</option><option value='42'>-21 dB</option><option value='48'>-24 dB</option>"
-      "  </select></div>"
-      "  <div class='field'><label>Power Save Mode<span class='tooltip'>(i)<span class='tip'>Estimated power and annual cost:<br>- <b>None:</b> 190mA ~$1.25/yr<br>- <b>Light:</b> 18mA ~$0.12/yr<br>- <b>Deep:</b> ~8mA ~$0.05/yr</span></span></label><select id='pwrSave'><option value='0'>None</option><option value='1'>Light Sleep Only</option><option value='2'>Light &rarr; Deep Sleep</option></select></div>"
-      "  <div class='field'><label>Light Sleep Delay (seconds)<span class='tooltip'>(i)<span class='tip'>Default: 1200s (20 mins)</span></span></label><input type='number' id='lightDly'></div>"
-      "  <div class='field'><label>Deep Sleep Delay (seconds)<span class='tooltip'>(i)<span class='tip'>Default: 7200s (2 hours)</span></span></label><input type='number' id='deepDly'></div>"
-      "  <div class='field' style='display:flex;align-items:center;'><label style='margin:0;flex:1'>Enable IR Remote</label><input type='checkbox' id='irEn' style='width:auto'></div>"
-      "  <button class='btn' onclick='saveConfig()'>Save Settings</button>"
-      "</div>"
-      "<div class='info-section'>"
-      "  <h3>Power Saving Modes</h3>"
-      "  <ul>"
-      "    <li><b>None:</b> The device remains fully active at all times. Best for maximum responsiveness.</li>"
-      "    <li><b>Light Sleep Only:</b> Moves to low-power Light Sleep after the <i>Light Sleep Delay</i>. Maintains network and audio state for swift wakeups.</li>"
-      "    <li><b>Light &rarr; Deep Sleep:</b> Enters Light Sleep first, then transitions to Deep Sleep (powered down) after the <i>Deep Sleep Delay</i>. Best for long-term energy efficiency.</li>"
-      "  </ul>"
-      "</div>"
-      "</div>"
-      "<script>"
-      "async function loadConfig(){"
-      "  const r=await fetch('/api/config');const c=await r.json();"
-      "  document.getElementById('anlgAttn').value=c.analog_attenuation;"
-      "  document.getElementById('digiAttn').value=c.digital_attenuation;"
-      "  document.getElementById('pwrSave').value=c.power_save_mode;"
-      "  document.getElementById('lightDly').value=c.light_sleep_delay_ms/1000;"
-      "  document.getElementById('deepDly').value=c.deep_sleep_delay_ms/1000;"
-      "  document.getElementById('irEn').checked=c.ir_is_enabled;}"
-      "async function saveConfig(){"
-      "  const data={"
-      "    analog_attenuation: parseInt(document.getElementById('anlgAttn').value),"
-      "    digital_attenuation: parseInt(document.getElementById('digiAttn').value),"
-      "    power_save_mode: parseInt(document.getElementById('pwrSave').value),"
-      "    light_sleep_delay_ms: parseInt(document.getElementById('lightDly').value)*1000,"
-      "    deep_sleep_delay_ms: parseInt(document.getElementById('deepDly').value)*1000,"
-      "    ir_is_enabled: document.getElementById('irEn').checked"
-      "  };"
-      "  const r=await fetch('/api/config',{method:'POST',headers:{'Content-Type':'application/json'},body:JSON.stringify(data)});"
-      "  if(r.ok)alert('Settings saved and applied!');else alert('Error saving settings!');}"
-      "loadConfig();</script></body></html>";
-  httpd_resp_send(req, html_response, HTTPD_RESP_USE_STRLEN);
+static esp_err_t record_sink(void *ctx, const char *data, size_t len) {
+  return json_stream_feed(&((record_parse_t *)ctx)->js, data, len);
+}
+
+/* Handler for POST /api/record
+ *
+ * Replaces the schedules: {"utc_offset_min":N,"schedules":[{"days":N,
+ * "start_min":N,"minutes":N,"station_id":N},...]}. days has bit 0 for
+ * Sunday; station_id -1 (or left out) records whatever is playing. */
+static esp_err_t api_record_post_handler(httpd_req_t *req) {
+  if (req->content_len > CONFIG_POST_MAX_LEN) {
+    httpd_resp_send_err(req, HTTPD_413_CONTENT_TOO_LARGE,
+                        "Schedules too large");
+    return ESP_FAIL;
+  }
+
+  record_parse_t *parse = calloc(1, sizeof(record_parse_t));
+  if (!parse) {
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  json_stream_init(&parse->js, record_token, parse);
+
+  esp_err_t ret;
+  if (recv_body_streamed(req, record_sink, parse, &ret) != ESP_OK) {
+    free(parse);
+    return ESP_FAIL;
+  }
+  if (ret == ESP_OK) {
+    ret = json_stream_finish(&parse->js);
+  }
+  if (ret == ESP_OK) {
+    ret = recorder_set_schedules(parse->entries, parse->count,
+                                 parse->utc_offset_min);
+  }
+  free(parse);
+
+  if (ret == ESP_OK) {
+    httpd_resp_sendstr(req, "{\"status\":\"ok\"}");
+  } else if (ret == ESP_ERR_INVALID_ARG || ret == ESP_ERR_INVALID_SIZE) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid schedules");
+  } else {
+    httpd_resp_send_500(req);
+  }
   return ESP_OK;
 }
 
+static void put_multiroom_metrics(chunk_writer_t *w) {
+  static const char *const mode_names[] = {"off", "leader", "follower"};
+  multiroom_stats_t mr;
+  multiroom_get_stats(&mr);
+  chunk_puts(w, ",\"multiroom\":{\"mode\":\"");
+  chunk_puts(w, mr.mode <= MULTIROOM_FOLLOWER ? mode_names[mr.mode] : "?");
+  chunk_puts(w, "\"");
+  if (mr.mode == MULTIROOM_OFF) {
+    chunk_putc(w, '}');
+    return;
+  }
+  chunk_puts(w, ",\"synced\":");
+  chunk_puts(w, mr.synced ? "true" : "false");
+  chunk_puts(w, ",\"session\":");
+  chunk_put_int(w, mr.session);
+  chunk_puts(w, ",\"error_us\":");
+  chunk_put_int(w, mr.error_us);
+  chunk_puts(w, ",\"ppm\":");
+  chunk_put_int(w, mr.ppm);
+  chunk_puts(w, ",\"steps\":");
+  chunk_put_int(w, mr.steps);
+  chunk_puts(w, ",\"memory\":");
+  chunk_put_int(w, mr.memory);
+  if (mr.mode == MULTIROOM_LEADER) {
+    chunk_puts(w, ",\"packets_sent\":");
+    chunk_put_int(w, mr.packets_sent);
+    chunk_puts(w, ",\"bytes_sent\":");
+    chunk_put_int(w, mr.bytes_sent);
+    chunk_puts(w, ",\"followers\":[");
+    multiroom_follower_t followers[MULTIROOM_MAX_FOLLOWERS];
+    int n = multiroom_get_followers(followers, MULTIROOM_MAX_FOLLOWERS);
+    for (int i = 0; i < n; i++) {
+      char addr[16];
+      struct in_addr in = {.s_addr = followers[i].addr};
+      chunk_puts(w, i ? ",{\"addr\":\"" : "{\"addr\":\"");
+      chunk_puts(w, inet_ntoa_r(in, addr, sizeof(addr)));
+      chunk_puts(w, "\",\"error_us\":");
+      chunk_put_int(w, followers[i].error_us);
+      // Both errors are against the same schedule
+      chunk_puts(w, ",\"skew_us\":");
+      chunk_put_int(w, (long long)followers[i].error_us - mr.error_us);
+      chunk_puts(w, ",\"fill_ms\":");
+      chunk_put_int(w, followers[i].fill_ms);
+      chunk_puts(w, ",\"age_ms\":");
+      chunk_put_int(w, followers[i].age_ms);
+      chunk_putc(w, '}');
+    }
+    chunk_puts(w, "]}");
+    return;
+  }
+  chunk_puts(w, ",\"clock_offset_us\":");
+  chunk_put_int(w, mr.clock_offset_us);
+  chunk_puts(w, ",\"clock_rtt_us\":");
+  chunk_put_int(w, mr.clock_delay_us);
+  chunk_puts(w, ",\"clock_steps\":");
+  chunk_put_int(w, mr.clock_steps);
+  chunk_puts(w, ",\"fill_ms\":");
+  chunk_put_int(w, mr.fill_ms);
+  chunk_puts(w, ",\"packets_received\":");
+  chunk_put_int(w, mr.packets_received);
+  chunk_puts(w, ",\"packets_lost\":");
+  chunk_put_int(w, mr.packets_lost);
+  chunk_puts(w, ",\"packets_late\":");
+  chunk_put_int(w, mr.packets_late);
+  chunk_putc(w, '}');
+}
+
+static void put_timeshift_metrics(chunk_writer_t *w) {
+  timeshift_stats_t ts;
+  timeshift_get_stats(&ts);
+  chunk_puts(w, ",\"timeshift\":{\"minutes\":");
+  chunk_put_int(w, ts.minutes);
+  chunk_puts(w, ",\"memory\":");
+  chunk_put_int(w, ts.memory);
+  chunk_puts(w, ",\"active\":");
+  chunk_puts(w, ts.active ? "true" : "false");
+  chunk_puts(w, ",\"paused\":");
+  chunk_puts(w, ts.paused ? "true" : "false");
+  chunk_puts(w, ",\"buffered_s\":");
+  chunk_put_int(w, ts.buffered_s);
+  chunk_puts(w, ",\"behind_s\":");
+  chunk_put_int(w, ts.behind_s);
+  chunk_puts(w, ",\"points\":");
+  chunk_put_int(w, ts.points);
+  chunk_puts(w, ",\"seeks\":");
+  chunk_put_int(w, ts.seeks);
+  chunk_puts(w, ",\"overruns\":");
+  chunk_put_int(w, ts.overruns);
+  chunk_puts(w, ",\"cpu_permille\":");
+  chunk_put_int(w, ts.cpu_permille);
+  chunk_puts(w, ",\"bytes_in\":");
+  chunk_put_int(w, ts.bytes_in);
+  chunk_putc(w, '}');
+}
+
+static void put_recorder_metrics(chunk_writer_t *w) {
+  recorder_stats_t rec;
+  recorder_get_stats(&rec);
+  chunk_puts(w, ",\"recorder\":{\"mounted\":");
+  chunk_puts(w, rec.mounted ? "true" : "false");
+  chunk_puts(w, ",\"recording\":");
+  chunk_puts(w, rec.recording ? "true" : "false");
+  chunk_puts(w, ",\"memory\":");
+  chunk_put_int(w, rec.memory);
+  chunk_puts(w, ",\"files\":");
+  chunk_put_int(w, rec.files);
+  chunk_puts(w, ",\"bytes_written\":");
+  chunk_put_int(w, rec.bytes_written);
+  chunk_puts(w, ",\"bytes_dropped\":");
+  chunk_put_int(w, rec.bytes_dropped);
+  chunk_puts(w, ",\"write_kbps\":");
+  chunk_put_int(w, rec.write_kbps);
+  chunk_puts(w, ",\"stall_max_ms\":");
+  chunk_put_int(w, rec.stall_max_ms);
+  chunk_puts(w, ",\"buffered_max\":");
+  chunk_put_int(w, rec.buffered_max);
+  chunk_puts(w, ",\"errors\":");
+  chunk_put_int(w, rec.errors);
+  chunk_putc(w, '}');
+}
+
+static void put_local_metrics(chunk_writer_t *w) {
+  local_media_stats_t lm;
+  local_media_get_stats(&lm);
+  chunk_puts(w, ",\"local\":{\"mounted\":");
+  chunk_puts(w, lm.mounted ? "true" : "false");
+  chunk_puts(w, ",\"active\":");
+  chunk_puts(w, lm.active ? "true" : "false");
+  chunk_puts(w, ",\"folders\":");
+  chunk_put_int(w, lm.folders);
+  chunk_puts(w, ",\"memory\":");
+  chunk_put_int(w, lm.memory);
+  chunk_puts(w, ",\"scan_ms\":");
+  chunk_put_int(w, lm.scan_ms);
+  chunk_puts(w, ",\"start_ms\":");
+  chunk_put_int(w, lm.start_ms);
+  chunk_puts(w, ",\"start_max_ms\":");
+  chunk_put_int(w, lm.start_max_ms);
+  chunk_puts(w, ",\"seek_ms\":");
+  chunk_put_int(w, lm.seek_ms);
+  chunk_puts(w, ",\"seek_max_ms\":");
+  chunk_put_int(w, lm.seek_max_ms);
+  chunk_puts(w, ",\"seeks\":");
+  chunk_put_int(w, lm.seeks);
+  chunk_puts(w, ",\"read_kbps\":");
+  chunk_put_int(w, lm.read_kbps);
+  chunk_puts(w, ",\"read_stall_max_ms\":");
+  chunk_put_int(w, lm.read_stall_max_ms);
+  chunk_puts(w, ",\"starved\":");
+  chunk_put_int(w, lm.starved);
+  chunk_puts(w, ",\"fill_min\":");
+  chunk_put_int(w, lm.fill_min);
+  chunk_puts(w, ",\"bytes_read\":");
+  chunk_put_int(w, lm.bytes_read);
+  chunk_putc(w, '}');
+}
+
+static void put_hls_metrics(chunk_writer_t *w) {
+  hls_stream_stats_t hls;
+  hls_stream_get_stats(&hls);
+  chunk_puts(w, ",\"hls\":{\"active\":");
+  chunk_puts(w, hls.active ? "true" : "false");
+  chunk_puts(w, ",\"variant\":");
+  chunk_put_int(w, hls.variant);
+  chunk_puts(w, ",\"variants\":");
+  chunk_put_int(w, hls.variants);
+  chunk_puts(w, ",\"variant_kbps\":");
+  chunk_put_int(w, hls.variant_kbps);
+  chunk_puts(w, ",\"measured_kbps\":");
+  chunk_put_int(w, hls.measured_kbps);
+  chunk_puts(w, ",\"target_ms\":");
+  chunk_put_int(w, hls.target_ms);
+  chunk_puts(w, ",\"start_ms\":");
+  chunk_put_int(w, hls.start_ms);
+  chunk_puts(w, ",\"buffer_ms\":");
+  chunk_put_int(w, hls.buffer_ms);
+  chunk_puts(w, ",\"buffer_bytes\":");
+  chunk_put_int(w, hls.buffer_bytes);
+  chunk_puts(w, ",\"segment_ms\":");
+  chunk_put_int(w, hls.segment_ms);
+  chunk_puts(w, ",\"segment_avg_ms\":");
+  chunk_put_int(w, hls.segment_avg_ms);
+  chunk_puts(w, ",\"segment_max_ms\":");
+  chunk_put_int(w, hls.segment_max_ms);
+  chunk_puts(w, ",\"memory\":");
+  chunk_put_int(w, hls.memory);
+  chunk_puts(w, ",\"segments\":");
+  chunk_put_int(w, hls.segments);
+  chunk_puts(w, ",\"reloads\":");
+  chunk_put_int(w, hls.reloads);
+  chunk_puts(w, ",\"requests\":");
+  chunk_put_int(w, hls.requests);
+  chunk_puts(w, ",\"connections\":");
+  chunk_put_int(w, hls.connections);
+  chunk_puts(w, ",\"rebuffers\":");
+  chunk_put_int(w, hls.rebuffers);
+  chunk_puts(w, ",\"rebuffer_ms\":");
+  chunk_put_int(w, hls.rebuffer_ms);
+  chunk_puts(w, ",\"skipped\":");
+  chunk_put_int(w, hls.skipped);
+  chunk_puts(w, ",\"switches\":");
+  chunk_put_int(w, hls.switches);
+  chunk_puts(w, ",\"errors\":");
+  chunk_put_int(w, hls.errors);
+  chunk_puts(w, ",\"bytes\":");
+  chunk_put_int(w, hls.bytes);
+  chunk_putc(w, '}');
+}
+
+static void put_decoder_metrics(chunk_writer_t *w) {
+  decoder_stats_t dec;
+  decoder_registry_get_stats(&dec);
+  chunk_puts(w, ",\"decoder\":{\"active\":");
+  chunk_puts(w, dec.active ? "true" : "false");
+  chunk_puts(w, ",\"codec\":");
+  chunk_put_json_string(w, codec_type_to_string(dec.codec));
+  chunk_puts(w, ",\"cpu_permille\":");
+  chunk_put_int(w, dec.cpu_permille);
+  chunk_puts(w, ",\"speed_x10\":");
+  chunk_put_int(w, dec.speed_x10);
+  chunk_puts(w, ",\"stack_free\":");
+  chunk_put_int(w, dec.stack_free);
+  chunk_puts(w, ",\"codecs\":{");
+  for (size_t i = 0; i < decoder_registry_count(); i++) {
+    if (i) {
+      chunk_putc(w, ',');
+    }
+    chunk_put_json_string(w, decoder_registry_at(i)->name);
+    chunk_puts(w, ":{\"seconds\":");
+    chunk_put_int(w, dec.codecs[i].seconds);
+    chunk_puts(w, ",\"cpu_permille\":");
+    chunk_put_int(w, dec.codecs[i].cpu_permille);
+    chunk_puts(w, ",\"cpu_max_permille\":");
+    chunk_put_int(w, dec.codecs[i].cpu_max_permille);
+    chunk_putc(w, '}');
+  }
+  chunk_puts(w, "}}");
+}
+
+static void put_pipeline_metrics(chunk_writer_t *w) {
+  pipeline_build_stats_t pl;
+  audio_pipeline_get_stats(&pl);
+  chunk_puts(w, ",\"pipeline\":{\"active\":");
+  chunk_puts(w, pl.active ? "true" : "false");
+  chunk_puts(w, ",\"graph\":");
+  chunk_put_json_string(w, pl.graph);
+  chunk_puts(w, ",\"fallback\":");
+  chunk_puts(w, pl.fallback ? "true" : "false");
+  chunk_puts(w, ",\"fallbacks\":");
+  chunk_put_int(w, pl.fallbacks);
+  chunk_puts(w, ",\"stages\":");
+  chunk_put_int(w, pl.stages);
+  chunk_puts(w, ",\"taps\":");
+  chunk_put_int(w, pl.taps);
+  chunk_puts(w, ",\"internal_estimate\":");
+  chunk_put_int(w, pl.internal);
+  chunk_puts(w, ",\"psram_estimate\":");
+  chunk_put_int(w, pl.psram);
+  chunk_putc(w, '}');
+}
+
+/* Handler for GET /api/metrics
+ *
+ * Resource use and stream counters, for monitoring. */
+static esp_err_t api_metrics_get_handler(httpd_req_t *req) {
+  stream_relay_stats_t relay;
+  stream_relay_get_stats(&relay);
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  chunk_writer_t w = {.req = req, .err = ESP_OK, .len = 0};
+  chunk_puts(&w, "{\"uptime_s\":");
+  chunk_put_int(&w, esp_timer_get_time() / 1000000);
+  chunk_puts(&w, ",\"heap\":{\"internal_free\":");
+  chunk_put_int(&w, heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+  chunk_puts(&w, ",\"internal_min_free\":");
+  chunk_put_int(&w, heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+  chunk_puts(&w, ",\"psram_free\":");
+  chunk_put_int(&w, heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+  chunk_puts(&w, "},\"stream\":{\"playing\":");
+  chunk_puts(&w, g_is_pipeline_running ? "true" : "false");
+  chunk_puts(&w, ",\"bitrate_kbps\":");
+  chunk_put_int(&w, g_bitrate_kbps);
+  chunk_puts(&w, ",\"buffer\":");
+  chunk_put_int(&w, g_stream_buffer_fill);
+  chunk_puts(&w, "},\"relay\":{\"max_clients\":");
+  chunk_put_int(&w, relay.max_clients);
+  chunk_puts(&w, ",\"clients\":");
+  chunk_put_int(&w, relay.clients);
+  chunk_puts(&w, ",\"memory\":");
+  chunk_put_int(&w, relay.memory);
+  chunk_puts(&w, ",\"bytes_in\":");
+  chunk_put_int(&w, relay.bytes_in);
+  chunk_puts(&w, ",\"bytes_out\":");
+  chunk_put_int(&w, relay.bytes_out);
+  chunk_puts(&w, ",\"listeners\":");
+  chunk_put_int(&w, relay.listeners);
+  chunk_puts(&w, ",\"dropped_slow\":");
+  chunk_put_int(&w, relay.dropped_slow);
+  chunk_puts(&w, ",\"rejected\":");
+  chunk_put_int(&w, relay.rejected);
+  chunk_putc(&w, '}');
+  put_multiroom_metrics(&w);
+  put_timeshift_metrics(&w);
+  put_recorder_metrics(&w);
+  put_local_metrics(&w);
+  put_hls_metrics(&w);
+  put_decoder_metrics(&w);
+  put_pipeline_metrics(&w);
+  chunk_putc(&w, '}');
+  chunk_flush(&w);
+  if (w.err != ESP_OK) {
+    return w.err;
+  }
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const web_asset_t *find_web_asset(const char *uri) {
+  size_t len = strcspn(uri, "?");
+  for (size_t i = 0; i < web_asset_count; i++) {
+    if (strlen(web_assets[i].path) == len &&
+        strncmp(web_assets[i].path, uri, len) == 0) {
+      return &web_assets[i];
+    }
+  }
+  return NULL;
+}
+
+/* Handler for GET of everything else: the web UI (web/ in the source tree)
+ *
+ * Assets are minified and gzip-compressed at build time and sent from flash
+ * as they are, with a strong ETag. Pages are revalidated on every visit,
+ * which costs one small round-trip (304) once they are cached; the
+ * stylesheets and scripts they link carry their hash in the URL, so those
+ * are cached for a year and not requested again. */
+static esp_err_t web_asset_handler(httpd_req_t *req) {
+  const web_asset_t *asset = find_web_asset(req->uri);
+  if (asset == NULL) {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Not found");
+  }
+  httpd_resp_set_hdr(req, "ETag", asset->etag);
+  httpd_resp_set_hdr(req, "Cache-Control",
+                     asset->immutable ? "public, max-age=31536000, immutable"
+                                      : "no-cache");
+  char if_none_match[64];
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK &&
+      strstr(if_none_match, asset->etag) != NULL) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    return httpd_resp_send(req, NULL, 0);
+  }
+  httpd_resp_set_type(req, asset->type);
+  if (asset->gzip) {
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  }
+  return httpd_resp_send(req, (const char *)asset->data, asset->size);
+}
+
 static const httpd_uri_t api_stations_get = {.uri = "/api/stations",
                                              .method = HTTP_GET,
                                              .handler =
                                                  api_stations_get_handler,
                                              .user_ctx = NULL};
 
+static const httpd_uri_t api_stations_search_get = {
+    .uri = "/api/stations/search",
+    .method = HTTP_GET,
+    .handler = api_stations_search_handler,
+    .user_ctx = NULL};
+
+static const httpd_uri_t api_stations_health_get = {
+    .uri = "/api/stations/health",
+    .method = HTTP_GET,
+    .handler = api_stations_health_handler,
+    .user_ctx = NULL};
+
+static const httpd_uri_t api_codecs_get = {.uri = "/api/codecs",
+                                           .method = HTTP_GET,
+                                           .handler = api_codecs_get_handler,
+                                           .user_ctx = NULL};
+
 static const httpd_uri_t api_stations_post = {.uri = "/api/stations",
                                               .method = HTTP_POST,
                                               .handler =
                                                   api_stations_post_handler,
                                               .user_ctx = NULL};
 
+static const httpd_uri_t api_stations_import_post = {
+    .uri = "/api/stations/import",
+    .method = HTTP_POST,
+    .handler = api_stations_import_handler,
+    .user_ctx = NULL};
+
 static const httpd_uri_t api_config_get = {.uri = "/api/config",
                                            .method = HTTP_GET,
                                            .handler = api_config_get_handler,
@@ -371,35 +1720,86 @@ static const httpd_uri_t api_config_post = {.uri = "/api/config",
                                             .handler = api_config_post_handler,
                                             .user_ctx = NULL};
 
-static const httpd_uri_t root_get = {.uri = "/",
-                                     .method = HTTP_GET,
-                                     .handler = root_get_handler,
-                                     .user_ctx = NULL};
+static const httpd_uri_t api_player_stats_get = {
+    .uri = "/api/player/stats",
+    .method = HTTP_GET,
+    .handler = api_player_stats_handler,
+    .user_ctx = NULL};
 
-static const httpd_uri_t stations_page_get = {.uri = "/stations",
-                                              .method = HTTP_GET,
-                                              .handler = stations_page_handler,
-                                              .user_ctx = NULL};
+static const httpd_uri_t api_player_post = {.uri = "/api/player/*",
+                                            .method = HTTP_POST,
+                                            .handler = api_player_post_handler,
+                                            .user_ctx = NULL};
+
+static const httpd_uri_t api_record_get = {.uri = "/api/record",
+                                          .method = HTTP_GET,
+                                          .handler = api_record_get_handler,
+                                          .user_ctx = NULL};
 
-static const httpd_uri_t config_page_get = {.uri = "/config",
+static const httpd_uri_t api_record_post = {.uri = "/api/record",
+                                           .method = HTTP_POST,
+                                           .handler = api_record_post_handler,
+                                           .user_ctx = NULL};
+
+static const httpd_uri_t api_local_get = {.uri = "/api/local",
+                                          .method = HTTP_GET,
+                                          .handler = api_local_get_handler,
+                                          .user_ctx = NULL};
+
+static const httpd_uri_t api_metrics_get = {.uri = "/api/metrics",
                                             .method = HTTP_GET,
-                                            .handler = config_page_handler,
+                                            .handler = api_metrics_get_handler,
                                             .user_ctx = NULL};
 
+static const httpd_uri_t stream_get = {.uri = "/stream",
+                                       .method = HTTP_GET,
+                                       .handler = stream_relay_handler,
+                                       .user_ctx = NULL};
+
+static const httpd_uri_t api_events_get = {.uri = "/api/events",
+                                           .method = HTTP_GET,
+                                           .handler = web_events_handler,
+                                           .user_ctx = NULL};
+
+// Registered last: with wildcard matching, "/*" takes what the API leaves
+static const httpd_uri_t web_asset_get = {.uri = "/*",
+                                          .method = HTTP_GET,
+                                          .handler = web_asset_handler,
+                                          .user_ctx = NULL};
+
 void start_web_server(void) {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.stack_size = 12000; // Increase stack size for JSON parsing and strings
+  config.max_uri_handlers = 17;
+  // Pages, plus a socket for each relay listener
+  config.max_open_sockets = 7 + STREAM_RELAY_MAX_CLIENTS;
+  config.uri_match_fn = httpd_uri_match_wildcard;
 
   ESP_LOGI(TAG, "Starting web server on port: '%d'", config.server_port);
   if (httpd_start(&server, &config) == ESP_OK) {
+    if (web_events_start(server) != ESP_OK) {
+      ESP_LOGE(TAG, "Live events unavailable");
+    }
+    input_bus_set_complete_cb(player_command_complete);
+    stream_relay_start(server);
     ESP_LOGI(TAG, "Registering URI handlers");
     httpd_register_uri_handler(server, &api_stations_get);
+    httpd_register_uri_handler(server, &api_stations_search_get);
+    httpd_register_uri_handler(server, &api_stations_health_get);
+    httpd_register_uri_handler(server, &api_codecs_get);
     httpd_register_uri_handler(server, &api_stations_post);
+    httpd_register_uri_handler(server, &api_stations_import_post);
     httpd_register_uri_handler(server, &api_config_get);
     httpd_register_uri_handler(server, &api_config_post);
-    httpd_register_uri_handler(server, &root_get);
-    httpd_register_uri_handler(server, &stations_page_get);
-    httpd_register_uri_handler(server, &config_page_get);
+    httpd_register_uri_handler(server, &api_events_get);
+    httpd_register_uri_handler(server, &api_player_stats_get);
+    httpd_register_uri_handler(server, &api_player_post);
+    httpd_register_uri_handler(server, &api_record_get);
+    httpd_register_uri_handler(server, &api_record_post);
+    httpd_register_uri_handler(server, &api_local_get);
+    httpd_register_uri_handler(server, &api_metrics_get);
+    httpd_register_uri_handler(server, &stream_get);
+    httpd_register_uri_handler(server, &web_asset_get);
   } else {
     ESP_LOGE(TAG, "Error starting server!");
   }
@@ -407,6 +1807,8 @@ void start_web_server(void) {
 
 void stop_web_server(void) {
   if (server) {
+    web_events_stop();
+    stream_relay_stop();
     httpd_stop(server);
   }
 }
@@ -0,0 +1,43 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Helpers for the host benchmarks: a monotonic clock and the --quick flag
+ * CTest passes to check that a benchmark still runs, with small sizes.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static inline double bench_now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline bool bench_quick(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Deterministic pseudo-random numbers (xorshift32), so runs compare
+static inline uint32_t bench_rand(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Keeps the compiler from dropping a result
+static inline void bench_use(const void *p) {
+  __asm__ volatile("" ::"r"(p) : "memory");
+}
+
+#endif // BENCH_H
@@ -0,0 +1,59 @@
+/* Counting wrappers for -Wl,--wrap=malloc,calloc,realloc,free */
+#include "bench_heap.h"
+#include <malloc.h>
+#include <stdatomic.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static atomic_size_t in_use;
+static atomic_size_t peak;
+
+static void count_alloc(void *ptr) {
+  if (ptr != NULL) {
+    size_t now = atomic_fetch_add(&in_use, malloc_usable_size(ptr)) +
+                 malloc_usable_size(ptr);
+    size_t seen = atomic_load(&peak);
+    while (now > seen && !atomic_compare_exchange_weak(&peak, &seen, now)) {
+    }
+  }
+}
+
+static void count_free(void *ptr) {
+  if (ptr != NULL) {
+    atomic_fetch_sub(&in_use, malloc_usable_size(ptr));
+  }
+}
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  count_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  void *ptr = __real_calloc(n, size);
+  count_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  count_free(ptr);
+  void *moved = __real_realloc(ptr, size);
+  // A failed realloc leaves the block allocated
+  count_alloc(moved != NULL || size == 0 ? moved : ptr);
+  return moved;
+}
+
+void __wrap_free(void *ptr) {
+  count_free(ptr);
+  __real_free(ptr);
+}
+
+size_t bench_heap_in_use(void) { return atomic_load(&in_use); }
+
+size_t bench_heap_peak(void) { return atomic_load(&peak); }
+
+void bench_heap_reset_peak(void) { atomic_store(&peak, atomic_load(&in_use)); }
@@ -0,0 +1,21 @@
+#ifndef BENCH_HEAP_H
+#define BENCH_HEAP_H
+
+/*
+ * Heap accounting for the benchmarks that report memory. Targets set up
+ * with bench_heap() in CMakeLists.txt have malloc, calloc, realloc and
+ * free wrapped at link time, so every allocation of the modules under
+ * test is counted at its usable size.
+ */
+
+#include <stddef.h>
+
+// Bytes allocated now
+size_t bench_heap_in_use(void);
+
+// Most bytes allocated at once since the last bench_heap_reset_peak()
+size_t bench_heap_peak(void);
+
+void bench_heap_reset_peak(void);
+
+#endif // BENCH_HEAP_H
@@ -0,0 +1,174 @@
+/* Station list upload: the streaming import POST /api/stations uses
+ * against the cJSON path it replaced, from 10 to 10,000 stations.
+ *
+ * The streaming side is station_json_import_*() fed in 512-byte chunks,
+ * as recv_body_streamed() delivers them, through to the installed list.
+ * The cJSON side is the old update_stations_from_json(): the whole body in
+ * one allocation, cJSON_Parse() and a strdup() of every field. It is built
+ * only when the host has cJSON (HAVE_CJSON). Memory is the heap peak above
+ * what was allocated before the upload. */
+#include "bench.h"
+#include "bench_heap.h"
+#include "station_data.h"
+#include "station_gen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_CJSON
+#include <cJSON.h>
+#endif
+
+#define CHUNK 512 // RECV_CHUNK_LEN in web_server.c
+
+// The list as GET /api/stations writes it
+static char *station_json(int count, size_t *len) {
+  station_gen_t gen;
+  if (!station_gen(&gen, count, 33)) {
+    return NULL;
+  }
+  size_t cap = (size_t)count * 256 + 16;
+  char *json = malloc(cap);
+  size_t n = 0;
+  json[n++] = '[';
+  for (int i = 0; i < count; i++) {
+    const station_entry_t *e = &gen.entries[i];
+    n += snprintf(json + n, cap - n,
+                  "%s{\"id\":%u,\"call_sign\":\"%s\",\"origin\":\"%s\","
+                  "\"uri\":\"%s\",\"codec\":%d}",
+                  i ? "," : "", (unsigned)e->id, e->call_sign, e->origin,
+                  e->uri, (int)e->codec);
+  }
+  json[n++] = ']';
+  json[n] = '\0';
+  *len = n;
+  station_gen_free(&gen);
+  return json;
+}
+
+static bool import_streamed(const char *json, size_t len) {
+  station_json_import_t *import = station_json_import_begin();
+  if (import == NULL) {
+    return false;
+  }
+  esp_err_t ret = ESP_OK;
+  for (size_t i = 0; i < len && ret == ESP_OK; i += CHUNK) {
+    ret = station_json_import_feed(import, json + i,
+                                   len - i < CHUNK ? len - i : CHUNK);
+  }
+  if (ret == ESP_OK) {
+    ret = station_json_import_finish(import);
+  }
+  station_json_import_free(import);
+  return ret == ESP_OK;
+}
+
+#ifdef HAVE_CJSON
+typedef struct {
+  char *call_sign, *origin, *uri;
+  int codec;
+} old_station_t;
+
+static char *dup_str(const char *s) {
+  size_t n = strlen(s) + 1;
+  char *copy = malloc(n);
+  memcpy(copy, s, n);
+  return copy;
+}
+
+// The old update_stations_from_json(), which took a copy of the body
+static bool import_cjson(const char *json, size_t len) {
+  char *body = malloc(len + 1);
+  memcpy(body, json, len + 1);
+  cJSON *root = cJSON_Parse(body);
+  free(body);
+  if (root == NULL) {
+    return false;
+  }
+  int count = cJSON_GetArraySize(root);
+  old_station_t *stations = calloc(count ? count : 1, sizeof(old_station_t));
+  int n = 0;
+  cJSON *item;
+  cJSON_ArrayForEach(item, root) {
+    cJSON *call_sign = cJSON_GetObjectItem(item, "call_sign");
+    cJSON *origin = cJSON_GetObjectItem(item, "origin");
+    cJSON *uri = cJSON_GetObjectItem(item, "uri");
+    cJSON *codec = cJSON_GetObjectItem(item, "codec");
+    if (cJSON_IsString(call_sign) && cJSON_IsString(origin) &&
+        cJSON_IsString(uri) && cJSON_IsNumber(codec)) {
+      stations[n].call_sign = dup_str(call_sign->valuestring);
+      stations[n].origin = dup_str(origin->valuestring);
+      stations[n].uri = dup_str(uri->valuestring);
+      stations[n].codec = codec->valueint;
+      n++;
+    }
+  }
+  cJSON_Delete(root);
+  bench_use(stations);
+  for (int i = 0; i < n; i++) {
+    free(stations[i].call_sign);
+    free(stations[i].origin);
+    free(stations[i].uri);
+  }
+  free(stations);
+  return n == count;
+}
+#endif
+
+typedef bool (*import_fn_t)(const char *json, size_t len);
+
+// Best time of reps, and the heap peak of one run
+static bool measure(import_fn_t fn, const char *json, size_t len, int reps,
+                    double *time_s, size_t *peak) {
+  *time_s = 1e9;
+  for (int r = 0; r < reps; r++) {
+    size_t base = bench_heap_in_use();
+    bench_heap_reset_peak();
+    double t0 = bench_now_s();
+    if (!fn(json, len)) {
+      return false;
+    }
+    double t = bench_now_s() - t0;
+    *time_s = t < *time_s ? t : *time_s;
+    *peak = bench_heap_peak() - base;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  printf("station list upload, %d-byte chunks:\n", CHUNK);
+#ifdef HAVE_CJSON
+  printf("         N       body  stream (ms)  stream peak  cJSON (ms)  "
+         "cJSON peak\n");
+#else
+  printf("(cJSON not found on this host: streaming side only)\n");
+  printf("         N       body  stream (ms)  stream peak\n");
+#endif
+  static const int counts[] = {10, 100, 1000, 10000};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (quick && counts[i] > 100) {
+      break;
+    }
+    size_t len;
+    char *json = station_json(counts[i], &len);
+    int reps = quick ? 1 : counts[i] >= 10000 ? 5 : 20;
+    double t;
+    size_t peak;
+    if (json == NULL || !measure(import_streamed, json, len, reps, &t, &peak)) {
+      printf("%d stations: import failed\n", counts[i]);
+      return 1;
+    }
+    printf("  %8d  %7.1f KB  %11.3f  %8.1f KB", counts[i], len / 1024.0,
+           t * 1e3, peak / 1024.0);
+#ifdef HAVE_CJSON
+    if (!measure(import_cjson, json, len, reps, &t, &peak)) {
+      printf("\n%d stations: cJSON import failed\n", counts[i]);
+      return 1;
+    }
+    printf("  %10.3f  %7.1f KB", t * 1e3, peak / 1024.0);
+#endif
+    printf("\n");
+    free(json);
+  }
+  free_station_data();
+  return 0;
+}
@@ -0,0 +1,192 @@
+/* Local playback from a slow card: startup and seek latency, and whether
+ * the read-ahead covers the card's stalls. local_media.c plays CD-rate
+ * FLAC (media_gen.h) from SD_CARD_MOUNT_POINT; open(), read() and lseek()
+ * of the file are slowed down to a model of the radio's card, and a
+ * decoder thread reads 4 KB at a time at the stream's byte rate.
+ *
+ * The card model, SDMMC 1-line at 20 MHz: 2.5 bytes/us and 0.3 ms per
+ * command, a FAT lookup (0.5 ms) per 32 KB cluster crossed, 8 ms to open
+ * a file. 2% of reads stall 50-250 ms on the card's housekeeping and 0.1%
+ * 600 ms; --slow-card adds 5% stalling 200-600 ms, as worn cards do. */
+#define _GNU_SOURCE
+#include "bench.h"
+#include "local_media.h"
+#include "media_gen.h"
+#include "sd_card.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALBUM SD_CARD_MOUNT_POINT "/Album"
+#define RATE 44100
+#define BYTE_RATE 110000 // CD FLAC, about 880 kb/s
+#define CLUSTER (32 * 1024)
+
+int __real_open(const char *path, int flags, ...);
+ssize_t __real_read(int fd, void *buf, size_t len);
+off_t __real_lseek(int fd, off_t off, int whence);
+
+static atomic_int card_fd = -1; // local_media.c has one file open
+static off_t card_pos;
+static uint32_t seed = 4242;
+static bool slow_card;
+static int stalls;
+
+static void sleep_us(int64_t us) {
+  struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = us % 1000000 * 1000};
+  nanosleep(&ts, NULL);
+}
+
+int __wrap_open(const char *path, int flags, ...) {
+  va_list ap;
+  va_start(ap, flags);
+  int fd = __real_open(path, flags, va_arg(ap, int));
+  va_end(ap);
+  if (fd >= 0 &&
+      strncmp(path, SD_CARD_MOUNT_POINT "/", strlen(SD_CARD_MOUNT_POINT) + 1) ==
+          0) {
+    sleep_us(8000);
+    card_pos = 0;
+    atomic_store(&card_fd, fd);
+  }
+  return fd;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t len) {
+  if (fd != atomic_load(&card_fd)) {
+    return __real_read(fd, buf, len);
+  }
+  int64_t us = 300 + len * 2 / 5;
+  us += ((card_pos + len) / CLUSTER - card_pos / CLUSTER) * 500;
+  uint32_t r = bench_rand(&seed) % 1000;
+  if (slow_card && r % 20 == 0) {
+    us += 200000 + bench_rand(&seed) % 400000;
+    stalls++;
+  } else if (r < 20) {
+    us += 50000 + bench_rand(&seed) % 200000;
+    stalls++;
+  } else if (r == 999) {
+    us += 600000;
+    stalls++;
+  }
+  sleep_us(us);
+  ssize_t n = __real_read(fd, buf, len);
+  card_pos += MAX(n, 0);
+  return n;
+}
+
+off_t __wrap_lseek(int fd, off_t off, int whence) {
+  off_t to = __real_lseek(fd, off, whence);
+  if (fd == atomic_load(&card_fd) && to >= 0) {
+    // The FAT chain is followed from the start, a cluster at a time
+    sleep_us(300 + labs((long)(to - card_pos)) / CLUSTER * 20);
+    card_pos = to;
+  }
+  return to;
+}
+
+/* ---------- decoder ---------- */
+
+static long consume_rate; // bytes a second
+static atomic_bool finished;
+
+static void *decoder_task(void *arg) {
+  static char buf[4096];
+  double start = bench_now_s();
+  int64_t consumed = 0;
+  for (;;) {
+    int n = local_media_source_read(NULL, buf, sizeof(buf), 1000, NULL);
+    if (n == AEL_IO_DONE) {
+      atomic_store(&finished, true);
+      sleep_us(10000);
+      continue;
+    }
+    if (n < 0) {
+      // Nothing to play: the rate starts over once there is
+      start = bench_now_s();
+      consumed = 0;
+      continue;
+    }
+    atomic_store(&finished, false);
+    consumed += n;
+    double due = start + (double)consumed / consume_rate;
+    double now = bench_now_s();
+    if (due > now) {
+      sleep_us((int64_t)((due - now) * 1e6));
+    }
+  }
+  return NULL;
+}
+
+static void report(const char *what) {
+  local_media_stats_t st;
+  local_media_get_stats(&st);
+  printf("  %-8s %5" PRIu32 " %5" PRIu32 " %5" PRIu32 " %5" PRIu32
+         " %6" PRIu32 " %6" PRIu32 " %5" PRIu32 " %7" PRIu32 " %6" PRIu32
+         " %6d\n",
+         what, st.start_ms, st.start_max_ms, st.seek_ms, st.seek_max_ms,
+         st.read_kbps, st.read_stall_max_ms, st.starved, st.fill_min / 1024,
+         st.memory / 1024, stalls);
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  for (int i = 1; i < argc; i++) {
+    slow_card |= strcmp(argv[i], "--slow-card") == 0;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  uint32_t seconds = quick ? 30 : 120;
+  mkdir(SD_CARD_MOUNT_POINT, 0755);
+  mkdir(ALBUM, 0755);
+  media_gen_t gen = media_gen_flac(ALBUM "/01 Track.flac", RATE, seconds,
+                                   BYTE_RATE, 100000);
+  media_gen_flac(ALBUM "/02 Track.flac", RATE, seconds, BYTE_RATE, 100000);
+  consume_rate = (gen.size - gen.audio_start) / seconds;
+  if (local_media_init() != ESP_OK) {
+    return 1;
+  }
+  for (int i = 0; i < 300 && !local_media_available(); i++) {
+    sleep_us(10000);
+  }
+  pthread_t decoder;
+  pthread_create(&decoder, NULL, decoder_task, NULL);
+  if (local_media_enter() != ESP_OK) {
+    return 1;
+  }
+
+  printf("local playback of %ld kb/s FLAC from a%s card (ms, kb/s, KB):\n",
+         consume_rate * 8 / 1000, slow_card ? " slow" : "n SD");
+  printf("  %-8s %5s %5s %5s %5s %6s %6s %5s %7s %6s %6s\n", "", "start",
+         "max", "seek", "max", "read", "stall", "empty", "ahead", "memory",
+         "stalls");
+  sleep_us(quick ? 1000000 : (slow_card ? 40000000 : 20000000));
+  report("play");
+  int seeks = quick ? 1 : 5;
+  for (int i = 0; i < seeks; i++) {
+    if (local_media_seek(i % 2 ? -10 : 20) != ESP_OK) {
+      return 1;
+    }
+    sleep_us(1500000);
+  }
+  report("seeks");
+  // Past the end, then the next track
+  if (local_media_seek(10000) != ESP_OK) {
+    return 1;
+  }
+  for (int i = 0; i < 30 && !atomic_load(&finished); i++) {
+    sleep_us(100000);
+  }
+  if (!atomic_load(&finished) || local_media_step(1) != ESP_OK) {
+    return 1;
+  }
+  sleep_us(2000000);
+  report("next");
+  return 0;
+}
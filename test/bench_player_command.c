@@ -0,0 +1,106 @@
+/* Remote command latency on the input bus: a poster stamps and queues
+ * commands with a request id as the /api/player handler does, a dispatcher
+ * thread receives and completes them as input_dispatch_task() does, and
+ * the completion callback takes done - queued as player_command_complete()
+ * reports it. Commands go one at a time, each after the last completed, as
+ * a home-automation client sends them; optionally with encoder events
+ * posted alongside.
+ *
+ * The action itself is empty here, so this is the bus's share of the
+ * latency: queueing, the handoff between tasks and the callback. On the
+ * radio a tune adds connecting to the stream on top. */
+#include "bench.h"
+#include "input_bus.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ENCODER_EVENT_US 2000 // a fast turn: a detent every 2 ms
+
+static uint32_t *latencies;
+static _Atomic int completed;
+static atomic_bool stop_encoder;
+
+static void on_complete(const input_event_t *event, esp_err_t result,
+                        int64_t done_us) {
+  int i = atomic_load(&completed);
+  latencies[i] = (uint32_t)(done_us - event->timestamp_us);
+  atomic_fetch_add(&completed, 1);
+}
+
+static void *dispatch_task(void *arg) {
+  input_event_t event;
+  for (;;) {
+    if (!input_bus_receive(&event, portMAX_DELAY)) {
+      continue;
+    }
+    if (event.type == INPUT_EVENT_WAKE && event.source == INPUT_SOURCE_PLAYER) {
+      return NULL;
+    }
+    bench_use(&event);
+    input_bus_complete(&event, ESP_OK);
+  }
+}
+
+static void *encoder_task(void *arg) {
+  while (!atomic_load(&stop_encoder)) {
+    input_bus_post_simple(INPUT_EVENT_ENCODER_STEP, INPUT_SOURCE_ENCODER,
+                          INPUT_CONTROL_VOLUME, 1);
+    struct timespec ts = {.tv_nsec = ENCODER_EVENT_US * 1000};
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(const char *what, int n, bool encoder) {
+  atomic_store(&completed, 0);
+  atomic_store(&stop_encoder, false);
+  pthread_t dispatcher, turner;
+  pthread_create(&dispatcher, NULL, dispatch_task, NULL);
+  if (encoder) {
+    pthread_create(&turner, NULL, encoder_task, NULL);
+  }
+  for (int i = 0; i < n; i++) {
+    input_event_t event = {.type = INPUT_EVENT_VOLUME_SET,
+                           .source = INPUT_SOURCE_WEB,
+                           .control = INPUT_CONTROL_VOLUME,
+                           .value = i % 100,
+                           .request_id = input_bus_new_request_id()};
+    while (!input_bus_post(&event)) {
+      // Full: the handler answers 503 and the client retries
+    }
+    while (atomic_load(&completed) <= i) {
+    }
+  }
+  atomic_store(&stop_encoder, true);
+  if (encoder) {
+    pthread_join(turner, NULL);
+  }
+  while (!input_bus_post_simple(INPUT_EVENT_WAKE, INPUT_SOURCE_PLAYER,
+                                INPUT_CONTROL_NONE, 0)) {
+  }
+  pthread_join(dispatcher, NULL);
+
+  qsort(latencies, n, sizeof(uint32_t), compare_u32);
+  printf("  %-26s %6d %8u %8u %8u\n", what, n, latencies[n / 2],
+         latencies[n * 99 / 100], latencies[n - 1]);
+}
+
+int main(int argc, char **argv) {
+  int n = bench_quick(argc, argv) ? 200 : 20000;
+  latencies = calloc(n, sizeof(uint32_t));
+  input_bus_init();
+  input_bus_set_complete_cb(on_complete);
+  printf("remote command, queued to done (us):\n");
+  printf("  %-26s %6s %8s %8s %8s\n", "", "n", "median", "p99", "max");
+  run("idle", n, false);
+  run("while the encoder turns", n, true);
+  free(latencies);
+  return 0;
+}
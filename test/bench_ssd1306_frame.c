@@ -0,0 +1,107 @@
+/* Display flush cost: the 8x8 transpose against the old per-pixel
+ * conversion, and the SPI traffic of a bitrate label update.
+ *
+ * The bitrate label (Montserrat 14) is redrawn once a second
+ * (BITRATE_UPDATE_INTERVAL_MS). A new number changes the digits' rows,
+ * about 10 pixels high. Which pages that touches depends on where the
+ * label sits against the page grid, so every offset is measured. */
+#include "bench.h"
+#include "ssd1306_frame.h"
+#include "ssd1306_reference.h"
+#include <stdio.h>
+
+#define PX_BYTES (SSD1306_FRAME_WIDTH * SSD1306_FRAME_HEIGHT / 8)
+#define STRIDE (SSD1306_FRAME_WIDTH / 8)
+// esp_lcd's SSD1306 driver sets the column and page range before each
+// transfer: two commands with two parameters each
+#define TRANSFER_CMD_BYTES 6
+#define SPI_HZ 4000000 // LCD_PIXEL_CLOCK_HZ
+#define LABEL_UPDATES_PER_S 1
+#define DIGIT_ROWS 10
+#define DIGIT_X 40 // columns of "128" in "128 kb/s", after the slider
+#define DIGIT_W 32
+
+static uint8_t px[PX_BYTES];
+static uint8_t frames[2][SSD1306_FRAME_BYTES];
+
+static void bench_transpose(int n) {
+  uint32_t seed = 7;
+  for (int i = 0; i < PX_BYTES; i++) {
+    px[i] = (uint8_t)bench_rand(&seed);
+  }
+  ssd1306_frame_convert(px, frames[0]);
+  ssd1306_reference_convert(px, frames[1]);
+  if (memcmp(frames[0], frames[1], SSD1306_FRAME_BYTES) != 0) {
+    printf("8x8 transpose differs from the per-pixel conversion\n");
+  }
+
+  double t0 = bench_now_s();
+  for (int i = 0; i < n; i++) {
+    px[i % PX_BYTES] ^= 1;
+    ssd1306_reference_convert(px, frames[1]);
+    bench_use(frames[1]);
+  }
+  double per_pixel = (bench_now_s() - t0) / n;
+  t0 = bench_now_s();
+  for (int i = 0; i < n; i++) {
+    px[i % PX_BYTES] ^= 1;
+    ssd1306_frame_convert(px, frames[0]);
+    bench_use(frames[0]);
+  }
+  double transpose = (bench_now_s() - t0) / n;
+  printf("frame conversion, %d frames:\n", n);
+  printf("  per pixel  %8.2f us/frame\n", per_pixel * 1e6);
+  printf("  8x8 blocks %8.2f us/frame (%.1fx)\n\n", transpose * 1e6,
+         per_pixel / transpose);
+}
+
+// Random digit pixels in rows [top, top + DIGIT_ROWS)
+static void draw_digits(int top, uint32_t *seed) {
+  for (int y = top; y < top + DIGIT_ROWS; y++) {
+    for (int bx = DIGIT_X / 8; bx < (DIGIT_X + DIGIT_W) / 8; bx++) {
+      px[STRIDE * y + bx] = (uint8_t)bench_rand(seed);
+    }
+  }
+}
+
+static int transfer_bytes(int pages, int transfers) {
+  return pages * SSD1306_PAGE_BYTES + transfers * TRANSFER_CMD_BYTES;
+}
+
+static void bench_label_update(void) {
+  printf("bitrate label update, %d digit rows, %d/s, SPI at %d MHz:\n",
+         DIGIT_ROWS, LABEL_UPDATES_PER_S, SPI_HZ / 1000000);
+  printf("  first row  pages  transfers  SPI bytes/s  SPI ms/s\n");
+  uint32_t seed = 11;
+  ssd1306_run_t runs[SSD1306_FRAME_PAGES];
+  int worst = 0;
+  long total = 0;
+  // Rows 44 to 51 put the digits at every offset against the page grid
+  for (int top = 44; top < 52; top++) {
+    memset(px, 0, sizeof(px));
+    draw_digits(top, &seed);
+    ssd1306_frame_convert(px, frames[0]);
+    draw_digits(top, &seed);
+    ssd1306_frame_convert(px, frames[1]);
+    int n = ssd1306_frame_dirty_runs(frames[1], frames[0], runs);
+    int pages = 0;
+    for (int i = 0; i < n; i++) {
+      pages += runs[i].end - runs[i].first;
+    }
+    int bytes = transfer_bytes(pages, n) * LABEL_UPDATES_PER_S;
+    printf("  %9d  %5d  %9d  %11d  %8.2f\n", top, pages, n, bytes,
+           bytes * 8 * 1000.0 / SPI_HZ);
+    worst = bytes > worst ? bytes : worst;
+    total += bytes;
+  }
+  int full = transfer_bytes(SSD1306_FRAME_PAGES, 1) * LABEL_UPDATES_PER_S;
+  printf("  average %ld bytes/s, worst %d bytes/s; whole frame %d bytes/s "
+         "(%.2f ms/s)\n",
+         total / 8, worst, full, full * 8 * 1000.0 / SPI_HZ);
+}
+
+int main(int argc, char **argv) {
+  bench_transpose(bench_quick(argc, argv) ? 1000 : 200000);
+  bench_label_update();
+  return 0;
+}
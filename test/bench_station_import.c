@@ -0,0 +1,79 @@
+/* Station import of a 30,000-entry radio-browser export (RADIO_BROWSER_DUMP,
+ * written at build time by fixtures/import/gen_radio_browser.py): time and
+ * heap peak, filtered, fed a byte at a time, and replacing the whole list.
+ *
+ * The peak is what the import allocates above the list it starts from; the
+ * new snapshot and its search index are part of it. On the radio the
+ * import's own tables come from PSRAM. */
+#include "bench.h"
+#include "bench_heap.h"
+#include "station_data.h"
+#include "station_import.h"
+#include <stdio.h>
+#include <sys/stat.h>
+
+static bool run(const char *what, station_import_options_t options,
+                size_t chunk) {
+  size_t base = bench_heap_in_use();
+  bench_heap_reset_peak();
+  double t0 = bench_now_s();
+  station_import_t *import = station_import_begin(&options);
+  if (import == NULL) {
+    return false;
+  }
+  esp_err_t ret = ESP_OK;
+  if (chunk == 0) {
+    ret = station_import_feed_file(import, RADIO_BROWSER_DUMP);
+  } else {
+    FILE *f = fopen(RADIO_BROWSER_DUMP, "rb");
+    if (f == NULL) {
+      station_import_free(import);
+      return false;
+    }
+    char buf[4096];
+    size_t n;
+    while (ret == ESP_OK && (n = fread(buf, 1, chunk, f)) > 0) {
+      ret = station_import_feed(import, buf, n);
+    }
+    fclose(f);
+  }
+  if (ret == ESP_OK) {
+    ret = station_import_finish(import);
+  }
+  double t = bench_now_s() - t0;
+  station_import_stats_t s;
+  station_import_get_stats(import, &s);
+  if (ret != ESP_OK) {
+    printf("%s: %s\n", what, station_import_error(import));
+  }
+  station_import_free(import);
+  printf("  %-30s %6u %6u %6u %6u %6u %6u %6u %8.0f %8.1f\n", what,
+         (unsigned)s.entries, (unsigned)s.added, (unsigned)s.duplicates,
+         (unsigned)s.filtered, (unsigned)s.unsupported, (unsigned)s.dropped,
+         (unsigned)s.stations, t * 1e3,
+         (bench_heap_peak() - base) / 1024.0);
+  return ret == ESP_OK;
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  mkdir(STATION_STORE_DIR, 0755);
+  init_station_data();
+  printf("radio-browser import, %s:\n", RADIO_BROWSER_DUMP);
+  printf("  %-30s %6s %6s %6s %6s %6s %6s %6s %8s %8s\n", "", "read", "added",
+         "dup", "filter", "unsup", "limit", "list", "ms", "peak KB");
+  if (!run("country=de tag=jazz, file",
+           (station_import_options_t){.country = "de", .tag = "jazz"}, 0)) {
+    return 1;
+  }
+  if (quick) {
+    return 0;
+  }
+  if (!run("limit=500, 1-byte chunks",
+           (station_import_options_t){.limit = 500}, 1) ||
+      !run("replace, 512-byte chunks",
+           (station_import_options_t){.replace = true}, 512)) {
+    return 1;
+  }
+  return 0;
+}
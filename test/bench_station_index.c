@@ -0,0 +1,72 @@
+/* Station search: index build time and size, and query times against a
+ * linear scan with the same ranking, at 5,000 and 50,000 stations. The
+ * queries are what the type-ahead and the web search send: one and two
+ * characters while typing, then words. */
+#include "bench.h"
+#include "station_gen.h"
+#include "station_index.h"
+#include "station_index_reference.h"
+
+static const char *const queries[] = {"k",       "ch",   "jazz",
+                                      "seattle", "WBZ",  "salt lake",
+                                      "xyzq",    "rock radio"};
+
+static double time_search(const station_index_t *index,
+                          const station_t *stations, int count, const char *q,
+                          bool linear, int *found) {
+  station_match_t out[10];
+  int reps = 0;
+  double t0 = bench_now_s(), t;
+  do {
+    *found = linear ? reference_search(stations, count, q, out, 10)
+                    : station_index_search(index, q, out, 10);
+    bench_use(out);
+    reps++;
+  } while ((t = bench_now_s() - t0) < 0.05);
+  return t / reps;
+}
+
+static void bench_index(int count, bool quick) {
+  station_gen_t gen;
+  if (!station_gen_named(&gen, count, 35)) {
+    return;
+  }
+  station_t *stations = calloc(count, sizeof(station_t));
+  for (int i = 0; i < count; i++) {
+    stations[i] = (station_t){.call_sign = (char *)gen.entries[i].call_sign,
+                              .origin = (char *)gen.entries[i].origin};
+  }
+  double t0 = bench_now_s();
+  station_index_t *index = station_index_build(stations, count);
+  double build = bench_now_s() - t0;
+  station_index_stats_t stats;
+  station_index_get_stats(index, &stats);
+  printf("%d stations: build %.1f ms, %.2f MB (%u B/station), %u trigrams, "
+         "%u postings, %u words\n",
+         count, build * 1e3, stats.bytes / 1048576.0,
+         (unsigned)(stats.bytes / count), (unsigned)stats.trigrams,
+         (unsigned)stats.postings, (unsigned)stats.words);
+  printf("  query         hits  index (us)  linear (us)\n");
+  for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+    int found;
+    double indexed = time_search(index, stations, count, queries[i], false,
+                                 &found);
+    double linear = quick ? 0
+                          : time_search(index, stations, count, queries[i],
+                                        true, &found);
+    printf("  %-12s  %4d  %10.2f  %11.1f\n", queries[i], found, indexed * 1e6,
+           linear * 1e6);
+  }
+  station_index_free(index);
+  free(stations);
+  station_gen_free(&gen);
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  bench_index(quick ? 500 : 5000, quick);
+  if (!quick) {
+    bench_index(50000, quick);
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+/* Station selection list: the five refilled rows against the roller they
+ * replaced, from 16 to 10,000 stations.
+ *
+ * The roller side is what lv_roller_set_options() did with the old options
+ * string in infinite mode: the call signs joined with '\n', that string
+ * repeated LV_ROLLER_INF_PAGES times, and the label's own copy of it. The
+ * rows side is one selection step of fill_station_list(): a row lookup and
+ * a label text copy per row, as lv_label_set_text() reallocates it. Memory
+ * is heap held afterwards; for the roller also the peak while building.
+ *
+ * LVGL's layout and rendering are not part of either figure. The rows
+ * redraw the same window at any list size; the roller also measured its
+ * whole options text on every set. */
+#include "bench.h"
+#include "bench_heap.h"
+#include "station_gen.h"
+#include "station_list_window.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LV_ROLLER_INF_PAGES 7 // lv_roller.c
+
+static const int sizes[] = {16, 100, 1000, 10000};
+
+// The options string as create_station_selection_screen_widgets() built it
+static char *roller_options(const station_gen_t *gen) {
+  size_t len = 1;
+  for (int i = 0; i < gen->count; i++) {
+    len += strlen(gen->entries[i].call_sign) + 1;
+  }
+  char *options = malloc(len);
+  char *p = options;
+  for (int i = 0; i < gen->count; i++) {
+    size_t n = strlen(gen->entries[i].call_sign);
+    memcpy(p, gen->entries[i].call_sign, n);
+    p += n;
+    *p++ = '\n';
+  }
+  p[gen->count ? -1 : 0] = '\0';
+  return options;
+}
+
+// lv_roller_set_options(..., LV_ROLLER_MODE_INFINITE); returns the label text
+static char *roller_set_options(const char *options) {
+  size_t len = strlen(options) + 1;
+  char *pages = malloc(len * LV_ROLLER_INF_PAGES);
+  for (int i = 0; i < LV_ROLLER_INF_PAGES; i++) {
+    memcpy(pages + len * i, options, len);
+    pages[len * (i + 1) - 1] = '\n';
+  }
+  pages[len * LV_ROLLER_INF_PAGES - 1] = '\0';
+  char *text = malloc(len * LV_ROLLER_INF_PAGES);
+  memcpy(text, pages, len * LV_ROLLER_INF_PAGES);
+  free(pages);
+  return text;
+}
+
+static void label_set_text(char **text, const char *s) {
+  size_t len = strlen(s) + 1;
+  *text = realloc(*text, len);
+  memcpy(*text, s, len);
+}
+
+static void fill_rows(const station_gen_t *gen, int selected,
+                      char *rows[STATION_LIST_ROWS]) {
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    int index = station_list_row_station(gen->count, selected, r);
+    label_set_text(&rows[r], index < 0 ? "" : gen->entries[index].call_sign);
+  }
+}
+
+static void bench_size(int count, int reps) {
+  station_gen_t gen;
+  if (!station_gen(&gen, count, 36)) {
+    return;
+  }
+
+  size_t base = bench_heap_in_use();
+  bench_heap_reset_peak();
+  char *options = roller_options(&gen);
+  char *text = roller_set_options(options);
+  free(options);
+  size_t roller_peak = bench_heap_peak() - base;
+  size_t roller_held = bench_heap_in_use() - base;
+  free(text);
+  double t0 = bench_now_s();
+  for (int i = 0; i < reps; i++) {
+    options = roller_options(&gen);
+    text = roller_set_options(options);
+    free(options);
+    bench_use(text);
+    free(text);
+  }
+  double roller = (bench_now_s() - t0) / reps;
+
+  char *rows[STATION_LIST_ROWS] = {0};
+  base = bench_heap_in_use();
+  int steps = reps * 100;
+  t0 = bench_now_s();
+  for (int i = 0; i < steps; i++) {
+    fill_rows(&gen, i % count, rows);
+    bench_use(rows);
+  }
+  double step = (bench_now_s() - t0) / steps;
+  size_t rows_held = bench_heap_in_use() - base;
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    free(rows[r]);
+  }
+
+  printf("  %8d  %9.1f  %11zu  %11zu  %7.3f  %9zu\n", count, roller * 1e6,
+         roller_held, roller_peak, step * 1e6, rows_held);
+  station_gen_free(&gen);
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  printf("station list, roller options build against one row refill:\n");
+  printf("  stations  roller us  roller held  roller peak  rows us  "
+         "rows held\n");
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    bench_size(sizes[i], quick ? 2 : (sizes[i] >= 10000 ? 50 : 2000));
+  }
+  return 0;
+}
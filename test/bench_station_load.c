@@ -0,0 +1,83 @@
+/* Boot-time station load: station_store_load() of a saved list, as
+ * init_station_data() does it, from 16 to 5,000 stations, with and without
+ * a journal of edits to replay.
+ *
+ * The store reads STATION_STORE_DIR, a scratch directory here, so the file
+ * is in the page cache and the figures are the CPU side of the load: one
+ * read, the CRC check, and the replay. On the device the SPIFFS read of
+ * the image comes on top. */
+#include "bench.h"
+#include "station_gen.h"
+#include "station_store.h"
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define EDITS 50 // edited stations in the journal case
+
+static double time_load(int reps, uint32_t *count) {
+  double best = 1e9;
+  for (int r = 0; r < reps; r++) {
+    station_image_t image;
+    double t0 = bench_now_s();
+    esp_err_t ret = station_store_load(&image);
+    double t = bench_now_s() - t0;
+    if (ret != ESP_OK) {
+      printf("load failed: %s\n", esp_err_to_name(ret));
+      return 0;
+    }
+    *count = image.header->count;
+    station_image_free(&image);
+    best = t < best ? t : best;
+  }
+  return best;
+}
+
+static void bench_load(int count, int reps) {
+  station_gen_t gen;
+  station_image_t base, edited;
+  if (!station_gen(&gen, count, 31) ||
+      station_image_build(gen.entries, count, &base) != ESP_OK ||
+      station_store_save(NULL, &base) != ESP_OK) {
+    printf("%d stations: setup failed\n", count);
+    return;
+  }
+  uint32_t loaded = 0;
+  double plain = time_load(reps, &loaded);
+
+  // Renaming a few stations appends put records to the journal
+  int edits = count < EDITS ? count : EDITS;
+  for (int i = 0; i < edits; i++) {
+    gen.entries[i * (count / edits)].origin = "Edited";
+  }
+  double journal = 0;
+  uint32_t journaled = 0;
+  if (station_image_build(gen.entries, count, &edited) == ESP_OK) {
+    if (station_store_save(&base, &edited) == ESP_OK) {
+      journal = time_load(reps, &journaled);
+    }
+    station_image_free(&edited);
+  }
+  printf("  %8d  %9u  %8.3f  %15.3f\n", (int)loaded, (unsigned)base.size,
+         plain * 1e3, journal * 1e3);
+  if ((int)loaded != count || (int)journaled != count) {
+    printf("  loaded %u and %u of %d stations\n", (unsigned)loaded,
+           (unsigned)journaled, count);
+  }
+  station_image_free(&base);
+  station_gen_free(&gen);
+}
+
+int main(int argc, char **argv) {
+  bool quick = bench_quick(argc, argv);
+  mkdir(STATION_STORE_DIR, 0755);
+  printf("station_store_load(), best of %d:\n", quick ? 3 : 50);
+  printf("  stations  image (B)  load (ms)  + %d edits (ms)\n", EDITS);
+  static const int counts[] = {16, 500, 1000, 5000, 10000};
+  for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (quick && counts[i] > 1000) {
+      break;
+    }
+    bench_load(counts[i], quick ? 3 : 50);
+  }
+  return 0;
+}
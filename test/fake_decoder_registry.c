@@ -0,0 +1,44 @@
+/* The decoder registry's lookups without the ADF decoders: the same
+ * names, types and sync patterns as decoder_registry.c, no elements */
+#include "decoder_registry.h"
+
+static const decoder_desc_t decoders[] = {
+    [CODEC_TYPE_MP3] = {CODEC_TYPE_MP3, "MP3", "audio/mpeg", "mp3",
+                        STREAM_SYNC_MPEG},
+    [CODEC_TYPE_AAC] = {CODEC_TYPE_AAC, "AAC", "audio/aac", "aac",
+                        STREAM_SYNC_ADTS},
+    [CODEC_TYPE_OGG] = {CODEC_TYPE_OGG, "OGG", "audio/ogg", "ogg",
+                        STREAM_SYNC_OGG},
+    [CODEC_TYPE_FLAC] = {CODEC_TYPE_FLAC, "FLAC", "audio/flac", "flac",
+                         STREAM_SYNC_FLAC},
+    [CODEC_TYPE_OPUS] = {CODEC_TYPE_OPUS, "OPUS", "audio/ogg", "opus",
+                         STREAM_SYNC_OGG},
+};
+
+const decoder_desc_t *decoder_registry_find(codec_type_t codec) {
+  if ((unsigned)codec >= CODEC_TYPE_COUNT) {
+    return NULL;
+  }
+  return &decoders[codec];
+}
+
+size_t decoder_registry_count(void) { return CODEC_TYPE_COUNT; }
+
+const decoder_desc_t *decoder_registry_at(size_t i) {
+  return i < CODEC_TYPE_COUNT ? &decoders[i] : NULL;
+}
+
+const char *decoder_registry_name(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->name : "Unknown Codec";
+}
+
+stream_sync_t decoder_registry_sync(codec_type_t codec) {
+  const decoder_desc_t *d = decoder_registry_find(codec);
+  return d ? d->sync : STREAM_SYNC_MPEG;
+}
+
+bool decoder_registry_has_head(codec_type_t codec) {
+  stream_sync_t sync = decoder_registry_sync(codec);
+  return sync == STREAM_SYNC_OGG || sync == STREAM_SYNC_FLAC;
+}
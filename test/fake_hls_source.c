@@ -0,0 +1,12 @@
+/* hls_stream.c's playlist URL check, without the HLS source element */
+#include "hls_stream.h"
+#include <string.h>
+#include <strings.h>
+
+bool hls_stream_is_source_uri(const char *uri) {
+  if (uri == NULL) {
+    return false;
+  }
+  size_t len = strcspn(uri, "?#");
+  return len >= 5 && strncasecmp(uri + len - 5, ".m3u8", 5) == 0;
+}
@@ -0,0 +1,28 @@
+/* What local_media.c calls around it, without the ADF pipeline or the
+ * display: play_file() swaps the source as create_audio_pipeline() does
+ * for a file URI, and the card is the directory SD_CARD_MOUNT_POINT */
+#include "internet_radio_adf.h"
+#include "local_media.h"
+#include "multiroom.h"
+#include "screens.h"
+#include "sd_card.h"
+
+volatile uint64_t g_bytes_read;
+volatile int g_stream_buffer_fill;
+
+esp_err_t play_file(codec_type_t codec, const char *uri) {
+  local_media_source_close();
+  return local_media_source_prepare(uri);
+}
+
+bool multiroom_is_follower(void) { return false; }
+
+esp_err_t sd_card_mount(void) { return ESP_OK; }
+
+bool sd_card_is_mounted(void) { return true; }
+
+void update_station_name(const char *name) {}
+
+void update_station_origin(const char *origin) {}
+
+void update_time_shift(bool paused, int behind_s) {}
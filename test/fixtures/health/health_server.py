@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Station fixture server for test_station_health, on 127.0.0.1.
+
+    health_server.py    serve on a free port, printed first
+
+Each path is a station as the prober finds them in the wild. Streams are
+16 KB, twice what a probe reads, then the connection closes.
+
+    /mp3          MPEG-1 layer III at 128 kb/s, though icy-br says 96
+    /aac          ADTS AAC at 64 kb/s
+    /id3.mp3      a 2 KB ID3v2 tag with two 32 kb/s frames in its picture,
+                  then 192 kb/s MP3
+    /redirect     302 to /station.pls, a PLS listing /aac
+    /icy          "ICY 200 OK", icy-br 48 and Ogg Opus, which has no
+                  bitrate in its header
+    /html         a 200 web page
+    /loop         302 to itself
+    /silent       reads the request, then sends nothing for 10 s
+    anything else 404
+"""
+import http.server
+import socketserver
+import struct
+import sys
+import time
+
+STREAM_BYTES = 16384
+MP3_KBPS = [0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320]
+
+
+def mp3_frame(kbps, seq):
+    """MPEG-1 layer III, 44.1 kHz, no padding; the payload never syncs."""
+    size = 144 * kbps * 1000 // 44100
+    head = bytes([0xFF, 0xFB, MP3_KBPS.index(kbps) << 4, 0x64])
+    return head + bytes((seq + i) & 0x7F for i in range(size - 4))
+
+
+def adts_frame(kbps, seq):
+    size = int(kbps * 1000 / 8 / (44100 / 1024))
+    head = bytes([0xFF, 0xF1, 1 << 6 | 4 << 2,  # LC, 44.1 kHz
+                  2 << 6 | (size >> 11) & 3, (size >> 3) & 0xFF,
+                  (size & 7) << 5 | 0x1F, 0xFC])
+    return head + bytes((seq + i) & 0x7F for i in range(size - 7))
+
+
+def frames(make, kbps, length):
+    out = bytearray()
+    seq = 0
+    while len(out) < length:
+        out += make(kbps, seq)
+        seq += 1
+    return bytes(out[:length])
+
+
+def id3_tag(size):
+    """ID3v2.3 whose APIC frame holds what looks like two MP3 frames."""
+    picture = b"\x00image/jpeg\x00\x03\x00" + mp3_frame(32, 0) * 2
+    picture += bytes(size - 20 - len(picture))
+    frame = b"APIC" + struct.pack(">I", len(picture)) + b"\x00\x00" + picture
+    n = len(frame)
+    return b"ID3\x03\x00\x00" + bytes([n >> 21 & 0x7F, n >> 14 & 0x7F,
+                                       n >> 7 & 0x7F, n & 0x7F]) + frame
+
+
+def ogg_page(seq, body):
+    """An Ogg page; the CRC is not checked by the prober."""
+    segments = [255] * (len(body) // 255) + [len(body) % 255]
+    return (b"OggS\x00" + bytes([2 if seq == 0 else 0]) +
+            struct.pack("<qIII", 960 * seq, 1, seq, 0) +
+            bytes([len(segments)]) + bytes(segments) + body)
+
+
+def opus_stream(length):
+    out = bytearray(ogg_page(0, b"OpusHead\x01\x02\x38\x01\x80\xbb\x00\x00"
+                                b"\x00\x00\x00"))
+    out += ogg_page(1, b"OpusTags\x04\x00\x00\x00host\x00\x00\x00\x00")
+    seq = 2
+    while len(out) < length:
+        out += ogg_page(seq, bytes((seq + i) & 0x7F for i in range(400)))
+        seq += 1
+    return bytes(out[:length])
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    # HTTP/1.0: the connection closes after each response, as the prober asks
+
+    def log_message(self, *args):
+        pass
+
+    def send(self, status, body=b"", content_type=None, headers=()):
+        self.send_response(status)
+        if content_type:
+            self.send_header("Content-Type", content_type)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        path = self.path
+        if path == "/mp3":
+            return self.send(200, frames(mp3_frame, 128, STREAM_BYTES),
+                             "audio/mpeg", [("icy-br", "96")])
+        if path == "/aac":
+            return self.send(200, frames(adts_frame, 64, STREAM_BYTES),
+                             "audio/aac")
+        if path == "/id3.mp3":
+            tag = id3_tag(2048)
+            return self.send(200, tag + frames(mp3_frame, 192, STREAM_BYTES -
+                                               len(tag)), "audio/mpeg")
+        if path == "/redirect":
+            return self.send(302, headers=[("Location", "/station.pls")])
+        if path == "/station.pls":
+            port = self.server.server_address[1]
+            body = ("[playlist]\nNumberOfEntries=1\n"
+                    f"File1=http://127.0.0.1:{port}/aac\n")
+            return self.send(200, body.encode(), "audio/x-scpls")
+        if path == "/icy":
+            # Shoutcast v1: no HTTP status line
+            self.wfile.write(b"ICY 200 OK\r\nicy-name:Fixture\r\nicy-br:48\r\n"
+                             b"content-type:audio/ogg\r\n\r\n")
+            self.wfile.write(opus_stream(STREAM_BYTES))
+            return None
+        if path == "/html":
+            body = b"<html><body>" + b"<p>Moved on.</p>" * 200 + b"</body>"
+            return self.send(200, body, "text/html; charset=utf-8")
+        if path == "/loop":
+            return self.send(302, headers=[("Location", "/loop")])
+        if path == "/silent":
+            time.sleep(10)
+            return None
+        return self.send(404, b"<html>Not Found</html>", "text/html")
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    server = Server(("127.0.0.1", 0), Handler)
+    print(server.server_address[1], flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
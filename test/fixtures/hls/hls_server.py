@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""HLS fixture server for test_hls, on 127.0.0.1.
+
+    hls_server.py                         serve on a free port, printed first
+    hls_server.py segment ts|packed <sequence> <output>
+
+Every stream is ADTS AAC whose frames carry (variant, sequence, index) at
+the start of their payload, so a test can tell which segment and variant
+each frame came from and whether any went missing. Segments are 2 s.
+
+    /live/master.m3u8     live master: 64 and 192 kb/s audio, 500 kb/s video
+    /live/v<n>/index.m3u8 its live window of 6 segments, moving with the
+                          clock from sequence 30; v1's is sent chunked
+    /vod/index.m3u8       20 packed-audio segments (an ID3 tag, then ADTS),
+                          more than a playlist keeps at once, then ENDLIST
+    /short/index.m3u8     3 TS segments and ENDLIST
+    /gone/index.m3u8      4 TS segments and ENDLIST; the third one is 404
+    /redirect.m3u8        302 to /short/index.m3u8
+    anything else         404
+"""
+import http.server
+import socketserver
+import struct
+import sys
+import time
+
+SEGMENT_S = 2.0
+WINDOW = 6
+START = time.time() - 30 * SEGMENT_S  # the live window ends at 30 now
+FRAMES_PER_S = 44100 / 1024
+VARIANTS = [(64000, "mp4a.40.2"), (192000, "mp4a.40.2"),
+            (500000, "avc1.4d401f,mp4a.40.2")]
+
+
+def frame_count(seq):
+    """Frames of segment seq, so that segments add up to the clock."""
+    return (int((seq + 1) * SEGMENT_S * FRAMES_PER_S) -
+            int(seq * SEGMENT_S * FRAMES_PER_S))
+
+
+def adts_frames(variant, seq):
+    size = int(VARIANTS[variant][0] / 8 / FRAMES_PER_S)
+    frames = []
+    for i in range(frame_count(seq)):
+        head = bytes([0xFF, 0xF1, 1 << 6 | 4 << 2,  # LC, 44.1 kHz
+                      2 << 6 | (size >> 11) & 3, (size >> 3) & 0xFF,
+                      (size & 7) << 5 | 0x1F, 0xFC])
+        tag = struct.pack(">BIH", variant, seq, i)
+        fill = bytes((seq + i + k) & 0xFF
+                     for k in range(size - len(head) - len(tag)))
+        frames.append(head + tag + fill)
+    return frames
+
+
+def crc32_mpeg(data):
+    crc = 0xFFFFFFFF
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            crc = (crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1
+            crc &= 0xFFFFFFFF
+    return crc
+
+
+def psi_packet(pid, table_id, body):
+    section = bytes([table_id]) + struct.pack(">H", 0xB000 | len(body) + 4)
+    section += body
+    section += struct.pack(">I", crc32_mpeg(section))
+    packet = bytes([0x47, 0x40 | pid >> 8, pid & 0xFF, 0x10, 0]) + section
+    return packet + b"\xff" * (188 - len(packet))
+
+
+PMT_PID = 0x1000
+AUDIO_PID = 0x100
+
+
+def ts_segment(variant, seq):
+    # PAT: program 1; PMT: an ADTS stream
+    head = struct.pack(">HBBB", 1, 0xC1, 0, 0)
+    out = bytearray(psi_packet(0, 0x00,
+                               head + struct.pack(">HH", 1, 0xE000 | PMT_PID)))
+    stream = bytes([0x0F]) + struct.pack(">HH", 0xE000 | AUDIO_PID, 0xF000)
+    out += psi_packet(PMT_PID, 0x02, head + struct.pack(
+        ">HH", 0xE000 | AUDIO_PID, 0xF000) + stream)
+    frames = adts_frames(variant, seq)
+    cc = 0
+    for g in range(0, len(frames), 8):  # a PES packet per 8 frames
+        pts = int(seq * SEGMENT_S * 90000) + g * 1024 * 90000 // 44100
+        pes = b"\x00\x00\x01\xC0\x00\x00\x80\x80\x05" + bytes([
+            0x21 | (pts >> 29) & 0x0E, (pts >> 22) & 0xFF,
+            0x01 | (pts >> 14) & 0xFE, (pts >> 7) & 0xFF,
+            0x01 | (pts << 1) & 0xFE]) + b"".join(frames[g:g + 8])
+        start = 0x40
+        while pes:
+            if len(pes) >= 184:
+                packet = bytes([0x47, start | AUDIO_PID >> 8, AUDIO_PID & 0xFF,
+                                0x10 | cc]) + pes[:184]
+            else:
+                # Adaptation field stuffing fills the last packet
+                stuff = 184 - len(pes)
+                field = bytes([stuff - 1]) + (b"\x00" + b"\xff" * (stuff - 2)
+                                              if stuff > 1 else b"")
+                packet = bytes([0x47, start | AUDIO_PID >> 8, AUDIO_PID & 0xFF,
+                                0x30 | cc]) + field + pes
+            out += packet
+            pes = pes[184:]
+            cc = (cc + 1) & 15
+            start = 0
+    return bytes(out)
+
+
+def packed_segment(seq):
+    owner = b"com.apple.streaming.transportStreamTimestamp\x00"
+    frame = b"PRIV" + struct.pack(">I", len(owner) + 8) + b"\x00\x00" + owner
+    frame += struct.pack(">Q", int(seq * SEGMENT_S * 90000))
+    n = len(frame)
+    tag = b"ID3\x04\x00\x00" + bytes([n >> 21 & 0x7F, n >> 14 & 0x7F,
+                                       n >> 7 & 0x7F, n & 0x7F]) + frame
+    return tag + b"".join(adts_frames(0, seq))
+
+
+def media_playlist(first, count, uri, ended):
+    lines = ["#EXTM3U", "#EXT-X-VERSION:3",
+             f"#EXT-X-TARGETDURATION:{int(SEGMENT_S)}",
+             f"#EXT-X-MEDIA-SEQUENCE:{first}"]
+    if ended:
+        lines.append("#EXT-X-PLAYLIST-TYPE:VOD")
+    for seq in range(first, first + count):
+        lines += [f"#EXTINF:{SEGMENT_S:.3f},", uri.format(seq)]
+    if ended:
+        lines.append("#EXT-X-ENDLIST")
+    return ("\n".join(lines) + "\n").encode()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # kept alive, as CDNs do
+
+    def log_message(self, *args):
+        pass
+
+    def send(self, status, body=b"", content_type=None, chunked=False,
+             location=None):
+        self.send_response(status)
+        if content_type:
+            self.send_header("Content-Type", content_type)
+        if location:
+            self.send_header("Location", location)
+        if chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+        else:
+            self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if not chunked:
+            self.wfile.write(body)
+            return
+        for i in range(0, len(body), 100):
+            part = body[i:i + 100]
+            self.wfile.write(b"%x\r\n" % len(part) + part + b"\r\n")
+        self.wfile.write(b"0\r\n\r\n")
+
+    def do_GET(self):
+        path = self.path
+        playlist = "application/vnd.apple.mpegurl"
+        if path == "/live/master.m3u8":
+            lines = ["#EXTM3U", "#EXT-X-VERSION:3"]
+            for i, (bandwidth, codecs) in enumerate(VARIANTS):
+                lines += [f'#EXT-X-STREAM-INF:BANDWIDTH={bandwidth},'
+                          f'CODECS="{codecs}"', f"v{i}/index.m3u8"]
+            return self.send(200, ("\n".join(lines) + "\n").encode(), playlist)
+        if path.startswith("/live/v") and path.endswith("/index.m3u8"):
+            variant = int(path[7])
+            last = int((time.time() - START) / SEGMENT_S)
+            body = media_playlist(last - WINDOW + 1, WINDOW, "seg{}.ts", False)
+            return self.send(200, body, playlist, chunked=variant == 1)
+        if path.startswith("/live/v") and "/seg" in path:
+            variant = int(path[7])
+            seq = int(path.split("/seg")[1].split(".")[0])
+            return self.send(200, ts_segment(variant, seq), "video/mp2t")
+        if path == "/vod/index.m3u8":
+            return self.send(200, media_playlist(0, 20, "s{}.aac", True),
+                             playlist)
+        if path.startswith("/vod/s"):
+            return self.send(200, packed_segment(int(path[6:].split(".")[0])),
+                             "audio/aac")
+        if path in ("/short/index.m3u8", "/gone/index.m3u8"):
+            count = 3 if path.startswith("/short") else 4
+            return self.send(200, media_playlist(0, count, "s{}.ts", True),
+                             playlist)
+        if path.startswith("/short/s") or path.startswith("/gone/s"):
+            seq = int(path.split("/s")[-1].split(".")[0])
+            if path.startswith("/gone") and seq == 2:
+                return self.send(404)
+            return self.send(200, ts_segment(0, seq), "video/mp2t")
+        if path == "/redirect.m3u8":
+            return self.send(302, location="/short/index.m3u8")
+        return self.send(404)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    if len(sys.argv) == 5 and sys.argv[1] == "segment":
+        seq = int(sys.argv[3])
+        data = ts_segment(0, seq) if sys.argv[2] == "ts" else \
+            packed_segment(seq)
+        with open(sys.argv[4], "wb") as f:
+            f.write(data)
+        return
+    server = Server(("127.0.0.1", 0), Handler)
+    print(server.server_address[1], flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
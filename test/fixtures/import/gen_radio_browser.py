@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Writes a synthetic radio-browser.info export for bench_station_import.
+
+    gen_radio_browser.py <stations> <output.json>
+
+Entries look like the API's: long favicon and homepage URLs, every codec
+name radio-browser reports, a few HLS streams and failed checks, and about
+one URL in five repeated in another spelling. Deterministic.
+"""
+import json
+import random
+import sys
+
+CODECS = ["MP3", "AAC", "AAC+", "OGG", "FLAC", "UNKNOWN", "OPUS", ""]
+COUNTRIES = [
+    ("US", "The United States Of America", "Colorado"),
+    ("DE", "Germany", ""),
+    ("FR", "France", "Île-de-France"),
+    ("JP", "Japan", "Tōkyō"),
+]
+TAGS = ["jazz", "rock", "news", "talk", "classical", "pop", "college",
+        "community"]
+
+
+def station(i, streams):
+    n = i % streams
+    cc, country, state = random.choice(COUNTRIES)
+    scheme = random.choice(["http", "https"])
+    port = random.choice(["", ":80" if scheme == "http" else ":443", ":8000"])
+    host = f"stream{n}.example.{'com' if i % 3 else 'org'}"
+    path = random.choice(
+        [f"/live{n}", f"/s/{n}.mp3", f"/aac_{n}", f"/{n}/;", f"/radio{n}.pls"])
+    url = f"{scheme}://{host}{port}{path}"
+    return {
+        "changeuuid": "%036x" % i,
+        "stationuuid": "%036x" % (i + 1 << 64),
+        "serveruuid": None,
+        "name": f"Radio Ñumero {i} — " + "very long name " * random.randint(0, 6),
+        "url": url,
+        "url_resolved": url if random.random() < 0.8 else "",
+        "homepage": "https://example.com/" + "h" * random.randint(10, 300),
+        "favicon": "https://example.com/" + "f" * random.randint(10, 800),
+        "tags": ",".join(random.sample(TAGS, 3)),
+        "country": country,
+        "countrycode": cc,
+        "iso_3166_2": None,
+        "state": state,
+        "language": "english",
+        "languagecodes": "en",
+        "votes": random.randint(0, 1000),
+        "lastchangetime_iso8601": "2024-01-01T00:00:00Z",
+        "codec": random.choice(CODECS),
+        "bitrate": 128,
+        "hls": 1 if random.random() < 0.03 else 0,
+        "lastcheckok": 1 if random.random() < 0.9 else 0,
+        "geo_lat": None,
+        "geo_long": None,
+        "has_extended_info": False,
+    }
+
+
+def main():
+    count = int(sys.argv[1])
+    random.seed(1)
+    streams = max(1, count * 4 // 5)
+    with open(sys.argv[2], "w", encoding="utf-8") as f:
+        json.dump([station(i, streams) for i in range(count)], f,
+                  ensure_ascii=False, indent=1)
+
+
+if __name__ == "__main__":
+    main()
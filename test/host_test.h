@@ -0,0 +1,58 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+/*
+ * Minimal checks for the host tests: a failed CHECK reports the expression
+ * and carries on, RUN_TEST runs one case, and main returns
+ * host_test_result() so CTest sees the outcome.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+static int host_test_failures;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      host_test_failures++;                                                    \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long a_ = (long long)(a), b_ = (long long)(b);                        \
+    if (a_ != b_) {                                                            \
+      fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__,      \
+              __LINE__, #a, #b, a_, b_);                                       \
+      host_test_failures++;                                                    \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_STR(a, b)                                                        \
+  do {                                                                         \
+    const char *a_ = (a), *b_ = (b);                                           \
+    if (a_ == NULL || b_ == NULL || strcmp(a_, b_) != 0) {                     \
+      fprintf(stderr, "%s:%d: %s == \"%s\" failed: \"%s\"\n", __FILE__,        \
+              __LINE__, #a, b_ ? b_ : "(null)", a_ ? a_ : "(null)");           \
+      host_test_failures++;                                                    \
+    }                                                                          \
+  } while (0)
+
+#define RUN_TEST(fn)                                                           \
+  do {                                                                         \
+    int before_ = host_test_failures;                                          \
+    fn();                                                                      \
+    printf("%s %s\n", host_test_failures == before_ ? "PASS" : "FAIL", #fn);   \
+  } while (0)
+
+static inline int host_test_result(void) {
+  if (host_test_failures) {
+    printf("%d check(s) failed\n", host_test_failures);
+  }
+  return host_test_failures ? 1 : 0;
+}
+
+#endif // HOST_TEST_H
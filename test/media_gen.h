@@ -0,0 +1,103 @@
+#ifndef MEDIA_GEN_H
+#define MEDIA_GEN_H
+
+/*
+ * Synthetic audio files for local playback: FLAC with a STREAMINFO block
+ * and cover art, MP3 with an ID3v2 tag. Frames are all the same length and
+ * their payload never holds a sync byte (0xFF), so where a read lands is
+ * known to the byte. Nothing here decodes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define MEDIA_GEN_FLAC_BLOCK 4096 // samples per FLAC frame
+#define MEDIA_GEN_MP3_FRAME 417  // 128 kb/s at 44.1 kHz
+
+typedef struct {
+  long size;        // of the file
+  long audio_start; // offset of the first frame
+  long frame_len;
+} media_gen_t;
+
+static inline void media_gen_put24(uint8_t *p, uint32_t v) {
+  p[0] = v >> 16;
+  p[1] = v >> 8;
+  p[2] = v;
+}
+
+static inline void media_gen_frames(FILE *f, const uint8_t *header,
+                                    long frame_len, long frames) {
+  for (long t = 0; t < frames; t++) {
+    fwrite(header, 1, 4, f);
+    for (long i = 4; i < frame_len; i++) {
+      fputc((int)((i * 7 + t) & 0x7F), f);
+    }
+  }
+}
+
+// FLAC of seconds at rate, byte_rate bytes a second, with a picture block
+// of picture bytes after STREAMINFO
+static inline media_gen_t media_gen_flac(const char *path, uint32_t rate,
+                                         uint32_t seconds, uint32_t byte_rate,
+                                         uint32_t picture) {
+  media_gen_t gen = {0};
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return gen;
+  }
+  uint8_t head[42] = "fLaC";
+  media_gen_put24(head + 5, 34);
+  uint8_t *info = head + 8;
+  uint64_t samples = (uint64_t)rate * seconds;
+  info[10] = rate >> 12;
+  info[11] = rate >> 4;
+  info[12] = (rate & 0xF) << 4 | 1 << 1; // 2 channels, 16 bit
+  info[13] = 0xF0 | (uint8_t)(samples >> 32);
+  info[14] = samples >> 24;
+  info[15] = samples >> 16;
+  info[16] = samples >> 8;
+  info[17] = samples;
+  fwrite(head, 1, sizeof(head), f);
+  uint8_t block[4] = {0x80 | 6}; // the last one, a picture
+  media_gen_put24(block + 1, picture);
+  fwrite(block, 1, sizeof(block), f);
+  for (uint32_t i = 0; i < picture; i++) {
+    fputc(0x11, f);
+  }
+  gen.audio_start = ftell(f);
+  gen.frame_len = (long)((uint64_t)byte_rate * MEDIA_GEN_FLAC_BLOCK / rate);
+  static const uint8_t frame[4] = {0xFF, 0xF8, 0xC9, 0x18};
+  media_gen_frames(f, frame, gen.frame_len,
+                   (long)(samples / MEDIA_GEN_FLAC_BLOCK));
+  gen.size = ftell(f);
+  fclose(f);
+  return gen;
+}
+
+// MP3 of frames frames behind an ID3v2 tag of tag bytes
+static inline media_gen_t media_gen_mp3(const char *path, long frames,
+                                        uint32_t tag) {
+  media_gen_t gen = {0};
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return gen;
+  }
+  if (tag) {
+    uint8_t id3[10] = {'I', 'D', '3', 3, 0, 0, tag >> 21 & 0x7F,
+                       tag >> 14 & 0x7F, tag >> 7 & 0x7F, tag & 0x7F};
+    fwrite(id3, 1, sizeof(id3), f);
+    for (uint32_t i = 0; i < tag; i++) {
+      fputc(0, f);
+    }
+  }
+  gen.audio_start = ftell(f);
+  gen.frame_len = MEDIA_GEN_MP3_FRAME;
+  static const uint8_t frame[4] = {0xFF, 0xFB, 0x90, 0x64};
+  media_gen_frames(f, frame, gen.frame_len, frames);
+  gen.size = ftell(f);
+  fclose(f);
+  return gen;
+}
+
+#endif // MEDIA_GEN_H
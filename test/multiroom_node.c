@@ -0,0 +1,331 @@
+/* One radio in multi-room mode, on the host: multiroom.c as it is, between
+ * a synthetic MP3 station, a stand-in decoder and a DAC that notes what it
+ * plays. test_multiroom_loopback runs a leader and followers of it as
+ * processes on one machine:
+ *
+ *   multiroom_node leader|follower <seconds> <ppm> <offset_us> <log>
+ *
+ * The unit's esp_timer clock runs ppm fast and offset_us ahead, and so does
+ * its DAC, which comes off the same crystal. The station's frames carry
+ * their number; the decoder turns frame n into 1152 stereo frames with
+ * n + 1 on the left and the frame's sample index on the right, so the DAC
+ * can tell which media sample it plays. Every 10 ms the log gets a line
+ *
+ *   h <CLOCK_MONOTONIC us> <media sample being played>
+ *
+ * and at the end one with the unit's multiroom_get_stats(). */
+#include "app_config.h"
+#include "audio_element.h"
+#include "audio_pipeline_manager.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "input_bus.h"
+#include "multiroom.h"
+#include "multiroom_proto.h"
+#include "ringbuf.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RATE 44100
+#define FRAME_SAMPLES 1152
+// MPEG-1 layer III, 128 kb/s, 44.1 kHz, no CRC
+#define FRAME_BYTES 417
+// Every 4th frame decodes on its own; followers join at those
+#define SYNC_EVERY 4
+// The station's server bursts this much at ten times real time, then
+// sends in real time. The host has no task priorities to keep the leader
+// task ahead of a faster burst, and the tap would overflow.
+#define STATION_BURST_FRAMES 40
+#define STATION_BURST_SPEED 10
+#define HTTP_RB_SIZE (32 * 1024)
+#define PCM_RB_SIZE (16 * 1024)
+#define I2S_RB_SIZE (8 * 1024) // ADF's DEFAULT_PIPELINE_RINGBUF_SIZE
+#define DAC_PERIOD_US 2000
+#define LOG_PERIOD_US 10000
+
+app_runtime_config_t g_runtime_config;
+volatile uint64_t g_bytes_read = 0;
+
+static ringbuf_handle_t http_rb;
+static ringbuf_handle_t pcm_rb;
+static ringbuf_handle_t i2s_rb;
+static _Atomic(ringbuf_handle_t) multiroom_tap = NULL;
+static audio_element_handle_t codec_el;
+static audio_element_handle_t sync_el;
+static double crystal_ppm;
+static FILE *log_file;
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* ---------- what audio_pipeline_manager.c provides ---------- */
+
+const char *codec_type_to_string(codec_type_t codec) {
+  return codec == CODEC_TYPE_MP3 ? "mp3" : "other";
+}
+
+esp_err_t audio_pipeline_tap_insert(pipeline_tap_t tap, ringbuf_handle_t rb) {
+  if (tap != PIPELINE_TAP_MULTIROOM) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  atomic_store(&multiroom_tap, rb);
+  return ESP_OK;
+}
+
+/* ---------- station ---------- */
+
+static void make_frame(uint8_t *frame, uint32_t n) {
+  memset(frame, 0, FRAME_BYTES);
+  frame[0] = 0xff;
+  frame[1] = 0xfb;
+  frame[2] = 0x90;
+  // main_data_begin: 0 for a frame that needs no earlier ones
+  frame[4] = n % SYNC_EVERY == 0 ? 0x00 : 0x80;
+  for (int i = 0; i < 4; i++) {
+    frame[6 + i] = n >> (8 * i);
+  }
+}
+
+/* The HTTP reader: the station's frames into the decoder's ring, and a
+ * copy into the multi-room tap without ever waiting for it */
+static void *station_main(void *arg) {
+  int64_t start = monotonic_us();
+  uint8_t frame[FRAME_BYTES];
+  for (uint32_t n = 0;; n++) {
+    int64_t burst = MIN(n, STATION_BURST_FRAMES);
+    int64_t samples = burst * FRAME_SAMPLES / STATION_BURST_SPEED +
+                      (n - burst) * FRAME_SAMPLES;
+    int64_t due = start + samples * 1000000 / RATE;
+    int64_t wait = due - monotonic_us();
+    if (wait > 0) {
+      usleep(wait);
+    }
+    make_frame(frame, n);
+    ringbuf_handle_t tap = atomic_load(&multiroom_tap);
+    if (tap != NULL) {
+      rb_write(tap, (char *)frame, FRAME_BYTES, 0);
+    }
+    if (rb_write(http_rb, (char *)frame, FRAME_BYTES, portMAX_DELAY) < 0) {
+      return NULL;
+    }
+  }
+}
+
+/* ---------- decoder ---------- */
+
+static uint8_t codec_buf[4 * FRAME_BYTES];
+static size_t codec_len;
+
+static esp_err_t codec_open(audio_element_handle_t self) {
+  codec_len = 0;
+  // What the MP3 decoder reports with its music info
+  multiroom_playout_set_format(RATE, 16, 2);
+  return ESP_OK;
+}
+
+static int codec_frame(audio_element_handle_t self, const uint8_t *frame) {
+  static int16_t pcm[FRAME_SAMPLES * 2];
+  uint32_t n = (uint32_t)frame[6] | (uint32_t)frame[7] << 8 |
+               (uint32_t)frame[8] << 16 | (uint32_t)frame[9] << 24;
+  for (int i = 0; i < FRAME_SAMPLES; i++) {
+    pcm[2 * i] = (int16_t)((n + 1) & 0x7fff);
+    pcm[2 * i + 1] = (int16_t)i;
+  }
+  return audio_element_output(self, (char *)pcm, sizeof(pcm));
+}
+
+static int codec_process(audio_element_handle_t self, char *in_buffer,
+                         int in_len) {
+  int n = audio_element_input(self, (char *)codec_buf + codec_len,
+                              sizeof(codec_buf) - codec_len);
+  if (n <= 0) {
+    return n;
+  }
+  codec_len += n;
+  size_t pos = 0;
+  while (pos < codec_len) {
+    mr_frame_t f;
+    int r = mr_frame_parse(MR_FRAMING_MPEG, codec_buf + pos, codec_len - pos,
+                           &f);
+    if (r < 0) {
+      pos++;
+      continue;
+    }
+    if (r == 0 || pos + f.len > codec_len) {
+      break;
+    }
+    int ret = codec_frame(self, codec_buf + pos);
+    if (ret <= 0) {
+      return ret;
+    }
+    pos += f.len;
+  }
+  memmove(codec_buf, codec_buf + pos, codec_len - pos);
+  codec_len -= pos;
+  return n;
+}
+
+/* ---------- DAC ---------- */
+
+// Media sample of frame i of pcm, if it is one the decoder wrote and not
+// silence or an interpolation across a frame boundary
+static bool heard_sample(const int16_t *pcm, int frames, int i,
+                         int64_t *sample) {
+  if (i + 1 >= frames || pcm[2 * i] <= 0 || pcm[2 * i] != pcm[2 * i + 2]) {
+    return false;
+  }
+  int step = pcm[2 * i + 3] - pcm[2 * i + 1];
+  if (step < 0 || step > 2) {
+    return false;
+  }
+  *sample = (int64_t)(pcm[2 * i] - 1) * FRAME_SAMPLES + pcm[2 * i + 1];
+  return true;
+}
+
+/* i2s_stream_writer and the codec chip: takes frames at the crystal's
+ * rate, whether the ring has them or not */
+static void *dac_main(void *arg) {
+  static int16_t pcm[I2S_RB_SIZE / 2];
+  int64_t start = monotonic_us();
+  int64_t played = 0;
+  int64_t next_log = start;
+  for (;;) {
+    usleep(DAC_PERIOD_US);
+    int64_t now = monotonic_us();
+    int64_t due = (int64_t)((now - start) * (RATE * (1 + crystal_ppm / 1e6)) /
+                            1e6);
+    int want = (int)MIN(due - played, (int64_t)(sizeof(pcm) / 4));
+    played = due;
+    int n = rb_read(i2s_rb, (char *)pcm, want * 4, 0);
+    int frames = n > 0 ? n / 4 : 0;
+    if (now < next_log) {
+      continue;
+    }
+    // The last frame taken is the one playing now
+    for (int i = frames - 2; i >= 0 && i >= frames - 64; i--) {
+      int64_t sample;
+      if (heard_sample(pcm, frames, i, &sample)) {
+        fprintf(log_file, "h %" PRId64 " %" PRId64 "\n", now,
+                sample + (frames - 1 - i));
+        next_log = now + LOG_PERIOD_US;
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* ---------- pipeline ---------- */
+
+static void pipeline_start(bool follower) {
+  rb_reset(pcm_rb);
+  rb_reset(i2s_rb);
+  if (follower) {
+    // create_audio_pipeline() with MULTIROOM_SOURCE_URI
+    multiroom_source_prepare();
+  }
+  audio_element_run(codec_el);
+  audio_element_run(sync_el);
+}
+
+static void pipeline_stop(void) {
+  audio_element_stop(codec_el);
+  audio_element_stop(sync_el);
+  audio_element_wait_for_stop(codec_el);
+  audio_element_wait_for_stop(sync_el);
+}
+
+static void pipeline_init(bool follower) {
+  http_rb = rb_create(HTTP_RB_SIZE, 1);
+  pcm_rb = rb_create(PCM_RB_SIZE, 1);
+  i2s_rb = rb_create(I2S_RB_SIZE, 1);
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  cfg.open = codec_open;
+  cfg.process = codec_process;
+  cfg.tag = "mp3";
+  codec_el = audio_element_init(&cfg);
+  sync_el = multiroom_playout_init();
+  if (follower) {
+    audio_element_set_read_cb(codec_el, multiroom_source_read, NULL);
+  } else {
+    audio_element_set_input_ringbuf(codec_el, http_rb);
+  }
+  audio_element_set_output_ringbuf(codec_el, pcm_rb);
+  audio_element_set_input_ringbuf(sync_el, pcm_rb);
+  audio_element_set_output_ringbuf(sync_el, i2s_rb);
+}
+
+static void log_stats(void) {
+  multiroom_stats_t s;
+  multiroom_get_stats(&s);
+  fprintf(log_file,
+          "s synced=%d error_us=%" PRId32 " ppm=%" PRId32 " steps=%" PRIu32
+          " sent=%" PRIu32 " received=%" PRIu32 " lost=%" PRIu32
+          " late=%" PRIu32 " clock_delay_us=%" PRId32 " followers=%d\n",
+          s.synced, s.error_us, s.ppm, s.steps, s.packets_sent,
+          s.packets_received, s.packets_lost, s.packets_late,
+          s.clock_delay_us, s.followers);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 6 || (strcmp(argv[1], "leader") != 0 &&
+                    strcmp(argv[1], "follower") != 0)) {
+    fprintf(stderr,
+            "usage: %s leader|follower <seconds> <ppm> <offset_us> <log>\n",
+            argv[0]);
+    return 2;
+  }
+  bool follower = strcmp(argv[1], "follower") == 0;
+  int64_t end = monotonic_us() + (int64_t)(atof(argv[2]) * 1e6);
+  crystal_ppm = atof(argv[3]);
+  host_timer_set_clock(crystal_ppm, atoll(argv[4]));
+  log_file = fopen(argv[5], "w");
+  if (log_file == NULL) {
+    perror(argv[5]);
+    return 2;
+  }
+  setvbuf(log_file, NULL, _IOLBF, 0);
+
+  g_runtime_config.multiroom_mode =
+      follower ? MULTIROOM_FOLLOWER : MULTIROOM_LEADER;
+  if (input_bus_init() != ESP_OK || multiroom_init() != ESP_OK) {
+    return 1;
+  }
+  pipeline_init(follower);
+  pthread_t dac;
+  pthread_create(&dac, NULL, dac_main, NULL);
+  if (!follower) {
+    pipeline_start(false);
+    multiroom_attach(CODEC_TYPE_MP3);
+    pthread_t station;
+    pthread_create(&station, NULL, station_main, NULL);
+  }
+
+  // The dispatcher: a follower rebuilds its pipeline for every new session
+  while (monotonic_us() < end) {
+    input_event_t event;
+    if (!input_bus_receive(&event, pdMS_TO_TICKS(100))) {
+      continue;
+    }
+    if (event.type == INPUT_EVENT_FOLLOW && follower) {
+      pipeline_stop();
+      pipeline_start(true);
+    }
+    input_bus_complete(&event, ESP_OK);
+  }
+  log_stats();
+  fflush(log_file);
+  // The tasks, elements and the DAC still run; nothing is torn down
+  _exit(0);
+}
@@ -0,0 +1,27 @@
+#ifndef SSD1306_REFERENCE_H
+#define SSD1306_REFERENCE_H
+
+/* The per-pixel conversion the flush callback used before
+ * ssd1306_frame_convert(), as the reference for its output and speed */
+
+#include "ssd1306_frame.h"
+#include <stdbool.h>
+
+static inline void ssd1306_reference_convert(const uint8_t *px_map,
+                                             uint8_t *frame) {
+  const int hor_res = SSD1306_FRAME_WIDTH;
+  for (int y = 0; y < SSD1306_FRAME_HEIGHT; y++) {
+    for (int x = 0; x < hor_res; x++) {
+      bool chroma_color =
+          (px_map[(hor_res >> 3) * y + (x >> 3)] & 1 << (7 - x % 8));
+      uint8_t *buf = frame + hor_res * (y >> 3) + x;
+      if (chroma_color) {
+        (*buf) &= ~(1 << (y % 8));
+      } else {
+        (*buf) |= (1 << (y % 8));
+      }
+    }
+  }
+}
+
+#endif // SSD1306_REFERENCE_H
@@ -0,0 +1,105 @@
+#ifndef STATION_GEN_H
+#define STATION_GEN_H
+
+/*
+ * Synthetic station lists for the benchmarks, sized like radio-browser
+ * entries: 4 to 20 character names, a city, and a stream URL of 40 to 90
+ * characters. station_gen_named() makes names from a small vocabulary
+ * instead ("KXYZ Jazz", "Boston, Public Radio"), so searches have
+ * realistic hit counts. Deterministic for a given seed.
+ */
+
+#include "bench.h"
+#include "station_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  station_entry_t *entries;
+  char *strings;
+  int count;
+} station_gen_t;
+
+static const char *const station_gen_cities[] = {
+    "Seattle", "Crested Butte", "Durango", "Berkeley", "Salt Lake City",
+    "Missoula", "Princeton", "Portland", "Loyola Marymount", "Gunnison",
+    "Lisbon", "Montreal", "Auckland", "Hamburg", "Kyoto", "Nairobi"};
+
+#define STATION_GEN_STRINGS 192 // per station, with the terminators
+
+static inline void station_gen_word(char *out, int len, uint32_t *seed) {
+  for (int i = 0; i < len; i++) {
+    out[i] = (char)('a' + bench_rand(seed) % 26);
+  }
+  out[len] = '\0';
+}
+
+static inline bool station_gen(station_gen_t *gen, int count, uint32_t seed) {
+  gen->count = count;
+  gen->entries = calloc(count ? count : 1, sizeof(station_entry_t));
+  gen->strings = malloc((size_t)(count ? count : 1) * STATION_GEN_STRINGS);
+  if (gen->entries == NULL || gen->strings == NULL) {
+    free(gen->entries);
+    free(gen->strings);
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    char *s = gen->strings + (size_t)i * STATION_GEN_STRINGS;
+    char *call_sign = s, *uri = s + 24;
+    int name_len = 4 + bench_rand(&seed) % 17;
+    station_gen_word(call_sign, name_len, &seed);
+    call_sign[0] -= 'a' - 'A';
+    char host[24], path[40];
+    station_gen_word(host, 6 + bench_rand(&seed) % 12, &seed);
+    station_gen_word(path, 4 + bench_rand(&seed) % 36, &seed);
+    snprintf(uri, STATION_GEN_STRINGS - 24, "https://%s.streamguys1.com/%s%d",
+             host, path, i);
+    gen->entries[i] = (station_entry_t){
+        .id = (uint32_t)i + 1,
+        .call_sign = call_sign,
+        .origin = station_gen_cities[bench_rand(&seed) %
+                                     (sizeof(station_gen_cities) /
+                                      sizeof(station_gen_cities[0]))],
+        .uri = uri,
+        .codec = (codec_type_t)(bench_rand(&seed) % CODEC_TYPE_COUNT),
+    };
+  }
+  return true;
+}
+
+static const char *const station_gen_genres[] = {
+    "Jazz", "Rock", "Classic", "Public", "Radio", "FM", "Talk", "News",
+    "Country", "Indie", "Blues", "Metal", "Soul", "Hits", "Chill", "College",
+    "Community", "Sports", "Gospel", "Latin", "Folk", "Lounge", "Dance", "Pop"};
+
+#define STATION_GEN_PICK(list, seed)                                           \
+  (list)[bench_rand(seed) % (sizeof(list) / sizeof((list)[0]))]
+
+static inline bool station_gen_named(station_gen_t *gen, int count,
+                                     uint32_t seed) {
+  if (!station_gen(gen, count, seed)) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    char *s = gen->strings + (size_t)i * STATION_GEN_STRINGS;
+    char *call_sign = s + 120, *origin = s + 144;
+    snprintf(call_sign, 24, "%c%c%c%c %s", "KW"[bench_rand(&seed) % 2],
+             'A' + bench_rand(&seed) % 26, 'A' + bench_rand(&seed) % 26,
+             'A' + bench_rand(&seed) % 26,
+             STATION_GEN_PICK(station_gen_genres, &seed));
+    snprintf(origin, STATION_GEN_STRINGS - 144, "%s, %s %s",
+             STATION_GEN_PICK(station_gen_cities, &seed),
+             STATION_GEN_PICK(station_gen_genres, &seed),
+             bench_rand(&seed) % 3 ? "Radio" : "Network");
+    gen->entries[i].call_sign = call_sign;
+    gen->entries[i].origin = origin;
+  }
+  return true;
+}
+
+static inline void station_gen_free(station_gen_t *gen) {
+  free(gen->entries);
+  free(gen->strings);
+}
+
+#endif // STATION_GEN_H
@@ -0,0 +1,97 @@
+#ifndef STATION_INDEX_REFERENCE_H
+#define STATION_INDEX_REFERENCE_H
+
+/*
+ * The ranking station_index.h documents, computed by scanning every
+ * station: what the index must return, and the linear search it replaces
+ * in the benchmark.
+ */
+
+#include "station_data.h"
+#include "station_index.h"
+#include <string.h>
+
+// Case folds, turns punctuation into spaces and collapses them, as the
+// index does
+static inline void reference_normalize(char *dst, const char *src,
+                                       size_t max) {
+  size_t len = 0;
+  for (; *src != '\0' && len < max; src++) {
+    unsigned char c = (unsigned char)*src;
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    } else if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                 c >= 0x80)) {
+      c = ' ';
+    }
+    if (c == ' ' && (len == 0 || dst[len - 1] == ' ')) {
+      continue;
+    }
+    dst[len++] = (char)c;
+  }
+  while (len > 0 && dst[len - 1] == ' ') {
+    len--;
+  }
+  dst[len] = '\0';
+}
+
+static inline bool reference_word_prefix(const char *field, const char *q) {
+  size_t n = strlen(q);
+  for (const char *t = field; *t != '\0'; t++) {
+    if ((t == field || t[-1] == ' ') && *t != ' ' && strncmp(t, q, n) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline int reference_score(const station_t *st, const char *q) {
+  char call[STATION_CALL_SIGN_MAX + 1], origin[STATION_ORIGIN_MAX + 1];
+  reference_normalize(call, st->call_sign, STATION_CALL_SIGN_MAX);
+  reference_normalize(origin, st->origin, STATION_ORIGIN_MAX);
+  size_t n = strlen(q), call_len = strlen(call);
+  bool word = reference_word_prefix(call, q) || reference_word_prefix(origin, q);
+  int score;
+  if (strcmp(call, q) == 0) {
+    score = 1000;
+  } else if (strncmp(call, q, n) == 0) {
+    score = 800;
+  } else if (strncmp(origin, q, n) == 0) {
+    score = 600;
+  } else if (word) {
+    score = 400;
+  } else if (n >= 3 && (strstr(call, q) || strstr(origin, q))) {
+    score = 200; // substrings only count from three characters
+  } else {
+    return 0;
+  }
+  return score * 64 - (int)(call_len < 63 ? call_len : 63);
+}
+
+// Best matches first, ties to the lower index, as station_index_search()
+static inline int reference_search(const station_t *stations, int count,
+                                   const char *query, station_match_t *out,
+                                   int max) {
+  char q[STATION_ORIGIN_MAX + 1];
+  reference_normalize(q, query, STATION_ORIGIN_MAX);
+  if (q[0] == '\0') {
+    return 0;
+  }
+  int found = 0;
+  for (int i = 0; i < count; i++) {
+    int score = reference_score(&stations[i], q);
+    if (score == 0 || (found == max && score <= out[max - 1].score)) {
+      continue;
+    }
+    int k = found < max ? found++ : max - 1;
+    while (k > 0 && score > out[k - 1].score) {
+      out[k] = out[k - 1];
+      k--;
+    }
+    out[k].index = i;
+    out[k].score = score;
+  }
+  return found;
+}
+
+#endif // STATION_INDEX_REFERENCE_H
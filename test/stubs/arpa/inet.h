@@ -0,0 +1,7 @@
+#pragma once
+/* The C library's arpa/inet.h, with lwIP's reentrant inet_ntoa_r() */
+#include_next <arpa/inet.h>
+
+static inline char *inet_ntoa_r(struct in_addr addr, char *buf, int len) {
+  return (char *)inet_ntop(AF_INET, &addr, buf, (socklen_t)len);
+}
@@ -0,0 +1,107 @@
+#pragma once
+/* Host stand-in for ESP-ADF's audio_element.h: an element runs its
+ * process callback on a thread of its own between two ringbufs (or read
+ * and write callbacks), with ADF's return codes. No events or states;
+ * what goes to the multi-output slots is dropped. */
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "ringbuf.h"
+
+typedef struct audio_element *audio_element_handle_t;
+
+typedef enum {
+  AEL_IO_OK = ESP_OK,
+  AEL_IO_FAIL = ESP_FAIL,
+  AEL_IO_DONE = -2,
+  AEL_IO_ABORT = -3,
+  AEL_IO_TIMEOUT = -4,
+  AEL_PROCESS_FAIL = -5,
+} audio_element_err_t;
+
+typedef esp_err_t (*el_io_func)(audio_element_handle_t self);
+typedef audio_element_err_t (*process_func)(audio_element_handle_t self,
+                                            char *el_buffer, int el_buf_len);
+typedef audio_element_err_t (*stream_func)(audio_element_handle_t self,
+                                           char *buffer, int len,
+                                           TickType_t ticks_to_wait,
+                                           void *context);
+
+typedef struct {
+  el_io_func open;
+  el_io_func seek;
+  process_func process;
+  el_io_func close;
+  el_io_func destroy;
+  stream_func read;
+  stream_func write;
+  int buffer_len;
+  int task_stack;
+  int task_prio;
+  int task_core;
+  int out_rb_size;
+  void *data;
+  const char *tag;
+  bool stack_in_ext;
+  int multi_in_rb_num;
+  int multi_out_rb_num;
+} audio_element_cfg_t;
+
+#define DEFAULT_ELEMENT_BUFFER_LENGTH (1024)
+#define DEFAULT_ELEMENT_RINGBUF_SIZE (8 * 1024)
+#define DEFAULT_ELEMENT_STACK_SIZE (2 * 1024)
+#define DEFAULT_ELEMENT_TASK_PRIO (5)
+#define DEFAULT_ELEMENT_TASK_CORE (0)
+
+#define DEFAULT_AUDIO_ELEMENT_CONFIG()                                         \
+  {                                                                            \
+      .buffer_len = DEFAULT_ELEMENT_BUFFER_LENGTH,                             \
+      .task_stack = DEFAULT_ELEMENT_STACK_SIZE,                                \
+      .task_prio = DEFAULT_ELEMENT_TASK_PRIO,                                  \
+      .task_core = DEFAULT_ELEMENT_TASK_CORE,                                  \
+      .out_rb_size = DEFAULT_ELEMENT_RINGBUF_SIZE,                             \
+  }
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config);
+esp_err_t audio_element_deinit(audio_element_handle_t el);
+const char *audio_element_get_tag(audio_element_handle_t el);
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data);
+void *audio_element_getdata(audio_element_handle_t el);
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri);
+char *audio_element_get_uri(audio_element_handle_t el);
+
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el,
+                                          ringbuf_handle_t rb);
+esp_err_t audio_element_set_output_ringbuf(audio_element_handle_t el,
+                                           ringbuf_handle_t rb);
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el);
+ringbuf_handle_t audio_element_get_output_ringbuf(audio_element_handle_t el);
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn,
+                                    void *context);
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn,
+                                     void *context);
+// Waits of the input and the output; portMAX_DELAY until set
+esp_err_t audio_element_set_input_timeout(audio_element_handle_t el,
+                                          TickType_t timeout);
+esp_err_t audio_element_set_output_timeout(audio_element_handle_t el,
+                                           TickType_t timeout);
+
+/* From the process callback: the read callback or input ringbuf, and the
+ * write callback or output ringbuf (without either, output is dropped) */
+audio_element_err_t audio_element_input(audio_element_handle_t el,
+                                        char *buffer, int wanted_size);
+audio_element_err_t audio_element_output(audio_element_handle_t el,
+                                         char *buffer, int write_size);
+audio_element_err_t audio_element_multi_output(audio_element_handle_t el,
+                                               char *buffer, int write_size,
+                                               TickType_t ticks_to_wait);
+
+/* Opens the element and runs process until it returns AEL_IO_OK or an
+ * error other than AEL_IO_TIMEOUT, then closes it and marks its output
+ * ringbuf done; done too if it fails to open */
+esp_err_t audio_element_run(audio_element_handle_t el);
+// The element is under way from audio_element_run() already
+esp_err_t audio_element_resume(audio_element_handle_t el,
+                               float wait_for_rb_threshold, TickType_t timeout);
+// Aborts both ringbufs; the thread then ends
+esp_err_t audio_element_stop(audio_element_handle_t el);
+esp_err_t audio_element_wait_for_stop(audio_element_handle_t el);
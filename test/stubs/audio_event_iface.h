@@ -0,0 +1,3 @@
+#pragma once
+/* Host stand-in for ESP-ADF's audio_event_iface.h: only the handle type */
+typedef struct audio_event_iface *audio_event_iface_handle_t;
@@ -0,0 +1,3 @@
+#pragma once
+/* Host stand-in for ESP-ADF's audio_pipeline.h: only the handle type */
+typedef struct audio_pipeline *audio_pipeline_handle_t;
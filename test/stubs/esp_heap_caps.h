@@ -0,0 +1,29 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_heap_caps.h: one heap, capabilities
+ * ignored */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps) {
+  return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  return calloc(n, size);
+}
+
+static inline void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+  return realloc(ptr, size);
+}
+
+// Never short
+static inline size_t heap_caps_get_free_size(uint32_t caps) {
+  return SIZE_MAX;
+}
@@ -0,0 +1,69 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_http_client.h: plain HTTP/1.1 GETs over
+ * a socket, kept alive between requests to the same host as IDF's client
+ * keeps it. No TLS, no authentication, no request bodies. */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ESP_ERR_HTTP_BASE 0x7000
+#define ESP_ERR_HTTP_EAGAIN (ESP_ERR_HTTP_BASE + 7)
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum {
+  HTTP_EVENT_ERROR,
+  HTTP_EVENT_ON_CONNECTED,
+  HTTP_EVENT_HEADERS_SENT,
+  HTTP_EVENT_ON_HEADER,
+  HTTP_EVENT_ON_DATA,
+  HTTP_EVENT_ON_FINISH,
+  HTTP_EVENT_DISCONNECTED,
+} esp_http_client_event_id_t;
+
+typedef struct {
+  esp_http_client_event_id_t event_id;
+  esp_http_client_handle_t client;
+  void *data;
+  int data_len;
+  void *user_data;
+  char *header_key;
+  char *header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+typedef struct {
+  const char *url;
+  int timeout_ms;
+  http_event_handle_cb event_handler;
+  void *user_data;
+  int buffer_size;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(
+    const esp_http_client_config_t *config);
+// Another host or port closes the kept connection
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client,
+                                  const char *url);
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t client, char *url,
+                                  const int len);
+// Connects unless the connection is kept, and sends the request head
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+// The Content-Length; 0 for chunked bodies and bodies without a length
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+// -1 without a Content-Length
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+// Body bytes read, 0 at its end, -ESP_ERR_HTTP_EAGAIN after timeout_ms
+// without data, or -1
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer,
+                         int len);
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client);
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client,
+                                         int *len);
+// To the response's Location, resolved against the URL
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
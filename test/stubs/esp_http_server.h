@@ -0,0 +1,56 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_http_server.h: what a handler and a work
+ * item do with a session, on one end of a socketpair. There is no listening
+ * socket or URI matching; the test is the server task, calling handlers with
+ * host_httpd_call() and running queued work with host_httpd_run(). */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_INVALID -2
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+
+typedef void *httpd_handle_t;
+typedef void (*httpd_work_fn_t)(void *arg);
+typedef void (*httpd_free_ctx_fn_t)(void *ctx);
+
+typedef struct httpd_req {
+  httpd_handle_t handle;
+  const char *uri;
+  void *aux; // the session
+  void *user_ctx;
+  void *sess_ctx;
+  httpd_free_ctx_fn_t free_ctx;
+} httpd_req_t;
+
+typedef esp_err_t (*httpd_handler_t)(httpd_req_t *req);
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work,
+                           void *arg);
+// Blocking unless flags has MSG_DONTWAIT; HTTPD_SOCK_ERR_TIMEOUT when full
+int httpd_socket_send(httpd_handle_t handle, int sockfd, const char *buf,
+                      size_t buf_len, int flags);
+// Queues the close; the session's free_ctx runs from the work queue
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
+int httpd_send(httpd_req_t *req, const char *buf, size_t buf_len);
+int httpd_req_to_sockfd(httpd_req_t *req);
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field,
+                             const char *value);
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str);
+
+httpd_handle_t host_httpd_create(void);
+// Runs handler for uri on a session over fd, the server end of a socket.
+// The session keeps the handler's sess_ctx; it is closed if the handler
+// fails.
+esp_err_t host_httpd_call(httpd_handle_t handle, httpd_handler_t handler,
+                          const char *uri, int fd);
+// Runs queued work items in order, waiting up to wait_ms for the first.
+// Returns how many ran.
+int host_httpd_run(httpd_handle_t handle, int wait_ms);
+// Makes the next count httpd_queue_work() calls fail
+void host_httpd_fail_work(httpd_handle_t handle, int count);
+// Whether a session is open on fd
+bool host_httpd_is_open(httpd_handle_t handle, int fd);
@@ -0,0 +1,19 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_log.h. Errors and warnings go to stderr,
+ * info only with HOST_TEST_VERBOSE set in the environment. */
+#include <stdio.h>
+
+int host_log_enabled(char level);
+
+#define HOST_LOG(level, tag, fmt, ...)                                         \
+  do {                                                                         \
+    if (host_log_enabled(level)) {                                             \
+      fprintf(stderr, "%c %s: " fmt "\n", level, tag, ##__VA_ARGS__);          \
+    }                                                                          \
+  } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG('E', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG('W', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG('I', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) HOST_LOG('D', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) HOST_LOG('V', tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,5 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_random.h */
+#include <stdint.h>
+
+uint32_t esp_random(void);
@@ -0,0 +1,7 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_rom_crc.h: the ROM's little-endian
+ * CRC32, same values as on the chip so images written on the host load
+ * on the device */
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len);
@@ -0,0 +1,16 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_spiffs.h. Nothing is mounted: the host
+ * builds take their directories from compile definitions instead. */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+  const char *base_path;
+  const char *partition_label;
+  size_t max_files;
+  bool format_if_mount_failed;
+} esp_vfs_spiffs_conf_t;
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t *conf);
+esp_err_t esp_spiffs_info(const char *label, size_t *total, size_t *used);
@@ -0,0 +1,26 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_tls.h: plain TCP connections only, a TLS
+ * connect fails. timeout_ms bounds each read, as IDF's socket options do. */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ESP_TLS_ERR_SSL_WANT_READ -0x6900
+#define ESP_TLS_ERR_SSL_WANT_WRITE -0x6880
+
+typedef struct esp_tls esp_tls_t;
+
+typedef struct {
+  int timeout_ms;
+  bool is_plain_tcp;
+} esp_tls_cfg_t;
+
+esp_tls_t *esp_tls_init(void);
+// 1 once connected, -1 on failure
+int esp_tls_conn_new_sync(const char *hostname, int hostlen, int port,
+                          const esp_tls_cfg_t *cfg, esp_tls_t *tls);
+// Bytes received, 0 once closed, < 0 on error or timeout
+ssize_t esp_tls_conn_read(esp_tls_t *tls, void *data, size_t datalen);
+ssize_t esp_tls_conn_write(esp_tls_t *tls, const void *data, size_t datalen);
+int esp_tls_conn_destroy(esp_tls_t *tls);
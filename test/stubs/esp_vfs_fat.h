@@ -0,0 +1,10 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_vfs_fat.h: the card's size and free
+ * space are whatever the test says */
+#include "esp_err.h"
+#include <stdint.h>
+
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *total_bytes,
+                           uint64_t *free_bytes);
+// What esp_vfs_fat_info() reports from now on; a 32 GB card until set
+void host_vfs_fat_set_info(uint64_t total_bytes, uint64_t free_bytes);
@@ -0,0 +1,21 @@
+#pragma once
+/* Host stand-in for ESP-IDF's esp_wifi.h: the station's link, up unless a
+ * test takes it down */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ESP_ERR_WIFI_BASE 0x3000
+#define ESP_ERR_WIFI_NOT_CONNECT (ESP_ERR_WIFI_BASE + 15)
+
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t ssid[33];
+  uint8_t primary;
+  int8_t rssi;
+} wifi_ap_record_t;
+
+// ESP_ERR_WIFI_NOT_CONNECT while the link is down
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+
+void host_wifi_set_connected(bool connected);
@@ -0,0 +1,13 @@
+#ifndef HOST_STRLCPY_H
+#define HOST_STRLCPY_H
+
+/*
+ * strlcpy() for C libraries older than glibc 2.38. ESP-IDF's newlib has
+ * it; CMakeLists.txt force-includes this header when the host lacks it.
+ */
+
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#endif // HOST_STRLCPY_H
@@ -0,0 +1,1530 @@
+/* Host definitions behind the stand-in ESP-IDF, FreeRTOS and ESP-ADF
+ * headers */
+#define _GNU_SOURCE
+#include "audio_element.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_vfs_fat.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "ringbuf.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ---------- esp_err / esp_log ---------- */
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_INVALID_SIZE:
+    return "ESP_ERR_INVALID_SIZE";
+  case ESP_ERR_NOT_FOUND:
+    return "ESP_ERR_NOT_FOUND";
+  case ESP_ERR_NOT_SUPPORTED:
+    return "ESP_ERR_NOT_SUPPORTED";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  case ESP_ERR_INVALID_RESPONSE:
+    return "ESP_ERR_INVALID_RESPONSE";
+  case ESP_ERR_INVALID_CRC:
+    return "ESP_ERR_INVALID_CRC";
+  case ESP_ERR_INVALID_VERSION:
+    return "ESP_ERR_INVALID_VERSION";
+  case ESP_ERR_NOT_FINISHED:
+    return "ESP_ERR_NOT_FINISHED";
+  case ESP_ERR_NOT_ALLOWED:
+    return "ESP_ERR_NOT_ALLOWED";
+  default:
+    return "UNKNOWN ERROR";
+  }
+}
+
+int host_log_enabled(char level) {
+  static int verbose = -1;
+  if (verbose < 0) {
+    verbose = getenv("HOST_TEST_VERBOSE") != NULL;
+  }
+  return level == 'E' || level == 'W' || (verbose && level == 'I');
+}
+
+/* ---------- esp_rom_crc ---------- */
+
+// Table driven, as the ROM's
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+      }
+      table[i] = c;
+    }
+  }
+  crc = ~crc;
+  while (len--) {
+    crc = table[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/* ---------- esp_random ---------- */
+
+uint32_t esp_random(void) {
+  uint32_t r = 0;
+  if (getrandom(&r, sizeof(r), 0) != sizeof(r)) {
+    r = (uint32_t)rand();
+  }
+  return r;
+}
+
+/* ---------- C library ---------- */
+
+#ifdef HOST_NEEDS_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size > 0) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+/* ---------- SPIFFS ---------- */
+
+esp_err_t esp_vfs_spiffs_register(const esp_vfs_spiffs_conf_t *conf) {
+  return ESP_OK;
+}
+
+esp_err_t esp_spiffs_info(const char *label, size_t *total, size_t *used) {
+  *total = 0;
+  *used = 0;
+  return ESP_OK;
+}
+
+/* ---------- FAT ---------- */
+
+static uint64_t fat_total = 32ULL << 30;
+static uint64_t fat_free = 32ULL << 30;
+
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *total_bytes,
+                           uint64_t *free_bytes) {
+  host_critical_enter();
+  *total_bytes = fat_total;
+  *free_bytes = fat_free;
+  host_critical_exit();
+  return ESP_OK;
+}
+
+void host_vfs_fat_set_info(uint64_t total_bytes, uint64_t free_bytes) {
+  host_critical_enter();
+  fat_total = total_bytes;
+  fat_free = free_bytes;
+  host_critical_exit();
+}
+
+/* ---------- NVS ---------- */
+
+#define NVS_KEYS 16
+#define NVS_KEY_LEN 16 // NVS_KEY_NAME_MAX_SIZE
+
+static struct {
+  char key[NVS_KEY_LEN];
+  void *value;
+  size_t length;
+} nvs_blobs[NVS_KEYS];
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode,
+                   nvs_handle_t *handle) {
+  *handle = 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value,
+                       size_t *length) {
+  esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+  host_critical_enter();
+  for (int i = 0; i < NVS_KEYS; i++) {
+    if (nvs_blobs[i].value && strcmp(nvs_blobs[i].key, key) == 0) {
+      err = ESP_OK;
+      if (value && *length < nvs_blobs[i].length) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+      } else if (value) {
+        memcpy(value, nvs_blobs[i].value, nvs_blobs[i].length);
+      }
+      *length = nvs_blobs[i].length;
+      break;
+    }
+  }
+  host_critical_exit();
+  return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key,
+                       const void *value, size_t length) {
+  if (strlen(key) >= NVS_KEY_LEN) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  void *copy = malloc(length ? length : 1);
+  if (copy == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(copy, value, length);
+  esp_err_t err = ESP_ERR_NO_MEM; // no free key
+  host_critical_enter();
+  int slot = -1;
+  for (int i = 0; i < NVS_KEYS; i++) {
+    if (nvs_blobs[i].value && strcmp(nvs_blobs[i].key, key) == 0) {
+      slot = i;
+      break;
+    }
+    if (slot < 0 && nvs_blobs[i].value == NULL) {
+      slot = i;
+    }
+  }
+  if (slot >= 0) {
+    free(nvs_blobs[slot].value);
+    strcpy(nvs_blobs[slot].key, key);
+    nvs_blobs[slot].value = copy;
+    nvs_blobs[slot].length = length;
+    copy = NULL;
+    err = ESP_OK;
+  }
+  host_critical_exit();
+  free(copy);
+  return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) { return ESP_OK; }
+
+void nvs_close(nvs_handle_t handle) {}
+
+/* ---------- esp_timer ---------- */
+
+static double clock_ppm = 0;
+static int64_t clock_offset_us = 0;
+static int64_t clock_start_us = 0;
+
+static int64_t monotonic_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_timer_set_clock(double ppm, int64_t offset_us) {
+  clock_start_us = monotonic_us();
+  clock_ppm = ppm;
+  clock_offset_us = offset_us;
+}
+
+int64_t esp_timer_get_time(void) {
+  int64_t now = monotonic_us();
+  return now + (int64_t)((now - clock_start_us) * clock_ppm / 1e6) +
+         clock_offset_us;
+}
+
+struct esp_timer {
+  esp_timer_create_args_t args;
+};
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out) {
+  struct esp_timer *t = calloc(1, sizeof(*t));
+  if (t == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  t->args = *args;
+  *out = t;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) { return ESP_OK; }
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  free(timer);
+  return ESP_OK;
+}
+
+/* ---------- GPIO ---------- */
+
+int gpio_get_level(gpio_num_t gpio) { return 1; }
+esp_err_t gpio_install_isr_service(int flags) { return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type) {
+  return ESP_OK;
+}
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr, void *arg) {
+  return ESP_OK;
+}
+esp_err_t gpio_intr_enable(gpio_num_t gpio) { return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t gpio) { return ESP_OK; }
+esp_err_t gpio_wakeup_disable(gpio_num_t gpio) { return ESP_OK; }
+
+/* ---------- FreeRTOS ---------- */
+
+static pthread_mutex_t critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void host_critical_enter(void) { pthread_mutex_lock(&critical); }
+void host_critical_exit(void) { pthread_mutex_unlock(&critical); }
+
+TickType_t xTaskGetTickCount(void) {
+  return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  struct timespec ts = {.tv_sec = ticks / 1000,
+                        .tv_nsec = (long)(ticks % 1000) * 1000000};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+// When a wait of wait ticks from now ends, for cond_wait()
+static struct timespec deadline_after(TickType_t wait) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  if (wait != portMAX_DELAY) {
+    deadline.tv_sec += wait / 1000;
+    deadline.tv_nsec += (long)(wait % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+  }
+  return deadline;
+}
+
+// Waits once on cond, lock held; false once the deadline has passed
+static bool cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                      TickType_t wait, const struct timespec *deadline) {
+  if (wait == 0) {
+    return false;
+  }
+  if (wait == portMAX_DELAY) {
+    pthread_cond_wait(cond, lock);
+    return true;
+  }
+  return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+struct host_task {
+  pthread_mutex_t lock;
+  pthread_cond_t notified;
+  uint32_t notify;
+  TaskFunction_t fn;
+  void *arg;
+};
+
+static __thread struct host_task *current_task;
+
+static struct host_task *task_new(TaskFunction_t fn, void *arg) {
+  struct host_task *t = calloc(1, sizeof(*t));
+  if (t != NULL) {
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->notified, NULL);
+    t->fn = fn;
+    t->arg = arg;
+  }
+  return t;
+}
+
+static void *task_main(void *arg) {
+  current_task = arg;
+  current_task->fn(current_task->arg);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t priority, TaskHandle_t *out) {
+  struct host_task *t = task_new(fn, arg);
+  if (t == NULL) {
+    return pdFAIL;
+  }
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  int err = pthread_create(&thread, &attr, task_main, t);
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    free(t);
+    return pdFAIL;
+  }
+  if (out != NULL) {
+    *out = t;
+  }
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *out,
+                                   BaseType_t core) {
+  return xTaskCreate(fn, name, stack, arg, priority, out);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL || task == current_task) {
+    task = current_task;
+    current_task = NULL;
+    if (task != NULL) {
+      pthread_mutex_destroy(&task->lock);
+      pthread_cond_destroy(&task->notified);
+      free(task);
+    }
+    pthread_exit(NULL);
+  }
+}
+
+// Threads not started by xTaskCreate() get a task on first use
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (current_task == NULL) {
+    current_task = task_new(NULL, NULL);
+  }
+  return current_task;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait) {
+  struct host_task *t = xTaskGetCurrentTaskHandle();
+  struct timespec deadline = deadline_after(wait);
+  pthread_mutex_lock(&t->lock);
+  while (t->notify == 0 &&
+         cond_wait(&t->notified, &t->lock, wait, &deadline)) {
+  }
+  uint32_t value = t->notify;
+  if (value > 0) {
+    t->notify = clear ? 0 : value - 1;
+  }
+  pthread_mutex_unlock(&t->lock);
+  return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  pthread_mutex_lock(&task->lock);
+  task->notify++;
+  pthread_cond_signal(&task->notified);
+  pthread_mutex_unlock(&task->lock);
+  return pdPASS;
+}
+
+struct host_semaphore {
+  pthread_mutex_t lock;
+  pthread_cond_t given;
+  int count; // 0 or 1
+};
+
+static SemaphoreHandle_t semaphore_new(int count) {
+  struct host_semaphore *sem = calloc(1, sizeof(*sem));
+  if (sem != NULL) {
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->given, NULL);
+    sem->count = count;
+  }
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return semaphore_new(1); }
+
+// Created empty, as FreeRTOS's
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return semaphore_new(0); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+  struct timespec deadline = deadline_after(wait);
+  pthread_mutex_lock(&sem->lock);
+  while (sem->count == 0 &&
+         cond_wait(&sem->given, &sem->lock, wait, &deadline)) {
+  }
+  bool taken = sem->count > 0;
+  if (taken) {
+    sem->count--;
+  }
+  pthread_mutex_unlock(&sem->lock);
+  return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  pthread_mutex_lock(&sem->lock);
+  bool given = sem->count == 0;
+  if (given) {
+    sem->count = 1;
+    pthread_cond_signal(&sem->given);
+  }
+  pthread_mutex_unlock(&sem->lock);
+  return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  pthread_mutex_destroy(&sem->lock);
+  pthread_cond_destroy(&sem->given);
+  free(sem);
+}
+
+struct host_queue {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  UBaseType_t length, item_size, head, count;
+  uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  struct host_queue *q = calloc(1, sizeof(*q));
+  if (q == NULL) {
+    return NULL;
+  }
+  q->items = calloc(length, item_size);
+  if (q->items == NULL) {
+    free(q);
+    return NULL;
+  }
+  q->length = length;
+  q->item_size = item_size;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->changed, NULL);
+  return q;
+}
+
+void vQueueDelete(QueueHandle_t q) {
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->changed);
+  free(q->items);
+  free(q);
+}
+
+// Waits on the queue's condition until ready() or the timeout; lock held
+static bool queue_wait(struct host_queue *q, TickType_t wait,
+                       bool (*ready)(const struct host_queue *q)) {
+  struct timespec deadline = deadline_after(wait);
+  while (!ready(q)) {
+    if (!cond_wait(&q->changed, &q->lock, wait, &deadline)) {
+      return ready(q);
+    }
+  }
+  return true;
+}
+
+static bool has_room(const struct host_queue *q) {
+  return q->count < q->length;
+}
+
+static bool has_item(const struct host_queue *q) { return q->count > 0; }
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait) {
+  pthread_mutex_lock(&q->lock);
+  bool ok = queue_wait(q, wait, has_room);
+  if (ok) {
+    UBaseType_t tail = (q->head + q->count) % q->length;
+    memcpy(q->items + tail * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait) {
+  pthread_mutex_lock(&q->lock);
+  bool ok = queue_wait(q, wait, has_item);
+  if (ok) {
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->changed);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ok ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  pthread_mutex_lock(&q->lock);
+  UBaseType_t n = q->count;
+  pthread_mutex_unlock(&q->lock);
+  return n;
+}
+
+/* ---------- ESP-ADF ringbuf ---------- */
+
+struct ringbuf {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  char *buf;
+  int size;
+  int head; // next byte to read
+  int fill;
+  bool done;
+  bool aborted;
+};
+
+ringbuf_handle_t rb_create(int block_size, int n_blocks) {
+  struct ringbuf *rb = calloc(1, sizeof(*rb));
+  if (rb == NULL) {
+    return NULL;
+  }
+  rb->size = block_size * n_blocks;
+  rb->buf = malloc(rb->size);
+  if (rb->buf == NULL) {
+    free(rb);
+    return NULL;
+  }
+  pthread_mutex_init(&rb->lock, NULL);
+  pthread_cond_init(&rb->changed, NULL);
+  return rb;
+}
+
+esp_err_t rb_destroy(ringbuf_handle_t rb) {
+  pthread_mutex_destroy(&rb->lock);
+  pthread_cond_destroy(&rb->changed);
+  free(rb->buf);
+  free(rb);
+  return ESP_OK;
+}
+
+esp_err_t rb_abort(ringbuf_handle_t rb) {
+  pthread_mutex_lock(&rb->lock);
+  rb->aborted = true;
+  pthread_cond_broadcast(&rb->changed);
+  pthread_mutex_unlock(&rb->lock);
+  return ESP_OK;
+}
+
+esp_err_t rb_reset(ringbuf_handle_t rb) {
+  pthread_mutex_lock(&rb->lock);
+  rb->head = rb->fill = 0;
+  rb->done = rb->aborted = false;
+  pthread_cond_broadcast(&rb->changed);
+  pthread_mutex_unlock(&rb->lock);
+  return ESP_OK;
+}
+
+esp_err_t rb_done_write(ringbuf_handle_t rb) {
+  pthread_mutex_lock(&rb->lock);
+  rb->done = true;
+  pthread_cond_broadcast(&rb->changed);
+  pthread_mutex_unlock(&rb->lock);
+  return ESP_OK;
+}
+
+int rb_bytes_filled(ringbuf_handle_t rb) {
+  pthread_mutex_lock(&rb->lock);
+  int n = rb->fill;
+  pthread_mutex_unlock(&rb->lock);
+  return n;
+}
+
+int rb_bytes_available(ringbuf_handle_t rb) {
+  return rb->size - rb_bytes_filled(rb);
+}
+
+int rb_get_size(ringbuf_handle_t rb) { return rb->size; }
+
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks) {
+  int total = 0;
+  int ret = RB_OK;
+  pthread_mutex_lock(&rb->lock);
+  while (total < len) {
+    int n = len - total;
+    if (rb->fill < n) {
+      // Whole words while more is to come, as ADF's, for I2S
+      n = rb->done ? rb->fill : rb->fill & ~3;
+    }
+    if (n == 0) {
+      if (rb->done) {
+        ret = RB_DONE;
+        break;
+      }
+      if (rb->aborted) {
+        ret = RB_ABORT;
+        break;
+      }
+      struct timespec deadline = deadline_after(ticks);
+      if (!cond_wait(&rb->changed, &rb->lock, ticks, &deadline)) {
+        ret = RB_TIMEOUT;
+        break;
+      }
+      continue;
+    }
+    int first = rb->size - rb->head < n ? rb->size - rb->head : n;
+    memcpy(buf + total, rb->buf + rb->head, first);
+    memcpy(buf + total + first, rb->buf, n - first);
+    rb->head = (rb->head + n) % rb->size;
+    rb->fill -= n;
+    total += n;
+    pthread_cond_broadcast(&rb->changed);
+  }
+  pthread_mutex_unlock(&rb->lock);
+  return total > 0 ? total : ret;
+}
+
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks) {
+  int total = 0;
+  int ret = RB_OK;
+  pthread_mutex_lock(&rb->lock);
+  while (total < len) {
+    if (rb->aborted) {
+      ret = RB_ABORT;
+      break;
+    }
+    int room = rb->size - rb->fill;
+    int n = len - total < room ? len - total : room;
+    if (n == 0) {
+      struct timespec deadline = deadline_after(ticks);
+      if (!cond_wait(&rb->changed, &rb->lock, ticks, &deadline)) {
+        ret = RB_TIMEOUT;
+        break;
+      }
+      continue;
+    }
+    int tail = (rb->head + rb->fill) % rb->size;
+    int first = rb->size - tail < n ? rb->size - tail : n;
+    memcpy(rb->buf + tail, buf + total, first);
+    memcpy(rb->buf, buf + total + first, n - first);
+    rb->fill += n;
+    total += n;
+    pthread_cond_broadcast(&rb->changed);
+  }
+  pthread_mutex_unlock(&rb->lock);
+  return total > 0 ? total : ret;
+}
+
+/* ---------- ESP-ADF audio_element ---------- */
+
+struct audio_element {
+  audio_element_cfg_t cfg;
+  ringbuf_handle_t in;
+  ringbuf_handle_t out;
+  stream_func read_cb;
+  stream_func write_cb;
+  void *read_ctx;
+  void *write_ctx;
+  TickType_t input_wait;
+  TickType_t output_wait;
+  char *uri;
+  pthread_t thread;
+  bool running;
+  atomic_bool stopping;
+};
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config) {
+  struct audio_element *el = calloc(1, sizeof(*el));
+  if (el == NULL) {
+    return NULL;
+  }
+  el->cfg = *config;
+  if (el->cfg.buffer_len <= 0) {
+    el->cfg.buffer_len = DEFAULT_ELEMENT_BUFFER_LENGTH;
+  }
+  el->read_cb = config->read;
+  el->write_cb = config->write;
+  el->input_wait = portMAX_DELAY;
+  el->output_wait = portMAX_DELAY;
+  return el;
+}
+
+esp_err_t audio_element_deinit(audio_element_handle_t el) {
+  audio_element_stop(el);
+  audio_element_wait_for_stop(el);
+  if (el->cfg.destroy != NULL) {
+    el->cfg.destroy(el);
+  }
+  free(el->uri);
+  free(el);
+  return ESP_OK;
+}
+
+const char *audio_element_get_tag(audio_element_handle_t el) {
+  return el->cfg.tag;
+}
+
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data) {
+  el->cfg.data = data;
+  return ESP_OK;
+}
+
+void *audio_element_getdata(audio_element_handle_t el) { return el->cfg.data; }
+
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri) {
+  free(el->uri);
+  el->uri = uri ? strdup(uri) : NULL;
+  return uri == NULL || el->uri ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+char *audio_element_get_uri(audio_element_handle_t el) { return el->uri; }
+
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el,
+                                          ringbuf_handle_t rb) {
+  el->in = rb;
+  return ESP_OK;
+}
+
+esp_err_t audio_element_set_output_ringbuf(audio_element_handle_t el,
+                                           ringbuf_handle_t rb) {
+  el->out = rb;
+  return ESP_OK;
+}
+
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el) {
+  return el->in;
+}
+
+ringbuf_handle_t audio_element_get_output_ringbuf(audio_element_handle_t el) {
+  return el->out;
+}
+
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn,
+                                    void *context) {
+  el->read_cb = fn;
+  el->read_ctx = context;
+  return ESP_OK;
+}
+
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn,
+                                     void *context) {
+  el->write_cb = fn;
+  el->write_ctx = context;
+  return ESP_OK;
+}
+
+esp_err_t audio_element_set_input_timeout(audio_element_handle_t el,
+                                          TickType_t timeout) {
+  el->input_wait = timeout;
+  return ESP_OK;
+}
+
+esp_err_t audio_element_set_output_timeout(audio_element_handle_t el,
+                                           TickType_t timeout) {
+  el->output_wait = timeout;
+  return ESP_OK;
+}
+
+audio_element_err_t audio_element_input(audio_element_handle_t el,
+                                        char *buffer, int wanted_size) {
+  if (el->read_cb != NULL) {
+    return el->read_cb(el, buffer, wanted_size, el->input_wait, el->read_ctx);
+  }
+  if (el->in == NULL) {
+    return AEL_IO_FAIL;
+  }
+  // The ringbuf's codes are ADF's element codes
+  return rb_read(el->in, buffer, wanted_size, el->input_wait);
+}
+
+audio_element_err_t audio_element_output(audio_element_handle_t el,
+                                         char *buffer, int write_size) {
+  if (el->write_cb != NULL) {
+    return el->write_cb(el, buffer, write_size, el->output_wait,
+                        el->write_ctx);
+  }
+  if (el->out == NULL) {
+    return write_size;
+  }
+  return rb_write(el->out, buffer, write_size, el->output_wait);
+}
+
+audio_element_err_t audio_element_multi_output(audio_element_handle_t el,
+                                               char *buffer, int write_size,
+                                               TickType_t ticks_to_wait) {
+  return ESP_OK;
+}
+
+static void *element_main(void *arg) {
+  struct audio_element *el = arg;
+  char *buf = malloc(el->cfg.buffer_len);
+  if (buf == NULL ||
+      (el->cfg.open != NULL && el->cfg.open(el) != ESP_OK)) {
+    ESP_LOGE("AUDIO_ELEMENT", "[%s] failed to open",
+             el->cfg.tag ? el->cfg.tag : "?");
+    if (el->out != NULL) {
+      rb_done_write(el->out);
+    }
+    free(buf);
+    return NULL;
+  }
+  while (!atomic_load(&el->stopping)) {
+    int ret = el->cfg.process(el, buf, el->cfg.buffer_len);
+    if (ret <= 0 && ret != AEL_IO_TIMEOUT) {
+      break;
+    }
+  }
+  if (el->cfg.close != NULL) {
+    el->cfg.close(el);
+  }
+  if (el->out != NULL) {
+    rb_done_write(el->out);
+  }
+  free(buf);
+  return NULL;
+}
+
+esp_err_t audio_element_run(audio_element_handle_t el) {
+  if (el->running) {
+    return ESP_OK;
+  }
+  atomic_store(&el->stopping, false);
+  if (pthread_create(&el->thread, NULL, element_main, el) != 0) {
+    return ESP_FAIL;
+  }
+  el->running = true;
+  return ESP_OK;
+}
+
+esp_err_t audio_element_resume(audio_element_handle_t el,
+                               float wait_for_rb_threshold, TickType_t timeout) {
+  return el->running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t audio_element_stop(audio_element_handle_t el) {
+  atomic_store(&el->stopping, true);
+  if (el->in != NULL) {
+    rb_abort(el->in);
+  }
+  if (el->out != NULL) {
+    rb_abort(el->out);
+  }
+  return ESP_OK;
+}
+
+esp_err_t audio_element_wait_for_stop(audio_element_handle_t el) {
+  if (el->running) {
+    pthread_join(el->thread, NULL);
+    el->running = false;
+  }
+  return ESP_OK;
+}
+
+/* ---------- esp_http_client ---------- */
+
+struct esp_http_client {
+  esp_http_client_config_t cfg;
+  char url[1024];
+  char host[256];
+  int port;
+  int fd;         // -1 while not connected
+  char buf[4096]; // received, not taken yet
+  int buf_len;
+  int buf_off;
+  int status;
+  int64_t length; // -1 without a Content-Length
+  int64_t received;
+  bool chunked;
+  int64_t chunk_left;
+  bool chunk_crlf; // the line break after a chunk's data is due
+  bool complete;
+  char location[1024];
+};
+
+// Host and port of url into the client; another one closes the connection
+static void http_set_origin(esp_http_client_handle_t c, const char *url) {
+  const char *host = strstr(url, "://");
+  host = host ? host + 3 : url;
+  size_t len = strcspn(host, "/?#");
+  char name[sizeof(c->host)];
+  snprintf(name, sizeof(name), "%.*s", (int)len, host);
+  int port = strncmp(url, "https:", 6) == 0 ? 443 : 80;
+  char *colon = strchr(name, ':');
+  if (colon) {
+    port = atoi(colon + 1);
+    *colon = '\0';
+  }
+  if (c->fd >= 0 && (strcasecmp(name, c->host) != 0 || port != c->port)) {
+    esp_http_client_close(c);
+  }
+  strcpy(c->host, name);
+  c->port = port;
+}
+
+// More of the response into buf: bytes received, 0 once closed, -1, or
+// -2 after timeout_ms without any
+static int http_fill(esp_http_client_handle_t c) {
+  struct pollfd p = {.fd = c->fd, .events = POLLIN};
+  if (poll(&p, 1, c->cfg.timeout_ms) == 0) {
+    return -2;
+  }
+  int n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+  if (n > 0) {
+    c->buf_len = n;
+    c->buf_off = 0;
+  }
+  return n < 0 ? -1 : n;
+}
+
+// A line of the response without its line break; its length, or -1
+static int http_read_line(esp_http_client_handle_t c, char *line, int max) {
+  int n = 0;
+  for (;;) {
+    if (c->buf_off == c->buf_len && http_fill(c) <= 0) {
+      return -1;
+    }
+    char ch = c->buf[c->buf_off++];
+    if (ch == '\n') {
+      n -= n > 0 && line[n - 1] == '\r';
+      line[n] = '\0';
+      return n;
+    }
+    if (n < max - 1) {
+      line[n++] = ch;
+    }
+  }
+}
+
+esp_http_client_handle_t esp_http_client_init(
+    const esp_http_client_config_t *config) {
+  esp_http_client_handle_t c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    return NULL;
+  }
+  c->cfg = *config;
+  if (c->cfg.timeout_ms <= 0) {
+    c->cfg.timeout_ms = 5000;
+  }
+  c->fd = -1;
+  esp_http_client_set_url(c, config->url);
+  return c;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t c,
+                                  const char *url) {
+  snprintf(c->url, sizeof(c->url), "%s", url);
+  http_set_origin(c, c->url);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t c, char *url,
+                                  const int len) {
+  snprintf(url, len, "%s", c->url);
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t c, int write_len) {
+  if (c->fd < 0) {
+    char port[8];
+    snprintf(port, sizeof(port), "%d", c->port);
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *ai;
+    if (getaddrinfo(c->host, port, &hints, &ai) != 0) {
+      return ESP_FAIL;
+    }
+    c->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    bool ok = c->fd >= 0 && connect(c->fd, ai->ai_addr, ai->ai_addrlen) == 0;
+    freeaddrinfo(ai);
+    if (!ok) {
+      esp_http_client_close(c);
+      return ESP_FAIL;
+    }
+    c->buf_len = c->buf_off = 0;
+  }
+  const char *host = strstr(c->url, "://");
+  host = host ? host + 3 : c->url;
+  const char *path = host + strcspn(host, "/?#");
+  char head[1536];
+  int n = snprintf(head, sizeof(head),
+                   "GET %s%s HTTP/1.1\r\nHost: %s:%d\r\n"
+                   "User-Agent: ESP32 HTTP Client/1.0\r\n\r\n",
+                   *path == '/' ? "" : "/", path, c->host, c->port);
+  if (n >= (int)sizeof(head) || send(c->fd, head, n, MSG_NOSIGNAL) != n) {
+    esp_http_client_close(c);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t c) {
+  c->status = -1;
+  c->length = -1;
+  c->received = 0;
+  c->chunked = false;
+  c->chunk_left = 0;
+  c->chunk_crlf = false;
+  c->complete = false;
+  c->location[0] = '\0';
+  char line[2048];
+  if (c->fd < 0 || http_read_line(c, line, sizeof(line)) < 0) {
+    return ESP_FAIL;
+  }
+  const char *code = strchr(line, ' ');
+  c->status = code ? atoi(code + 1) : -1;
+  int n;
+  while ((n = http_read_line(c, line, sizeof(line))) > 0) {
+    char *value = strchr(line, ':');
+    if (value == NULL) {
+      continue;
+    }
+    *value++ = '\0';
+    value += strspn(value, " \t");
+    if (strcasecmp(line, "Content-Length") == 0) {
+      c->length = atoll(value);
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+      c->chunked = strcasecmp(value, "chunked") == 0;
+    } else if (strcasecmp(line, "Location") == 0) {
+      snprintf(c->location, sizeof(c->location), "%s", value);
+    }
+    esp_http_client_event_t evt = {.event_id = HTTP_EVENT_ON_HEADER,
+                                   .client = c,
+                                   .user_data = c->cfg.user_data,
+                                   .header_key = line,
+                                   .header_value = value};
+    if (c->cfg.event_handler) {
+      c->cfg.event_handler(&evt);
+    }
+  }
+  if (n < 0) {
+    return ESP_FAIL;
+  }
+  if (c->chunked) {
+    c->length = -1;
+  }
+  c->complete = c->length == 0;
+  return c->length > 0 ? c->length : 0;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t c) {
+  return c->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t c) {
+  return c->length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t c) {
+  return c->chunked;
+}
+
+int esp_http_client_read(esp_http_client_handle_t c, char *buffer, int len) {
+  if (c->complete || c->fd < 0) {
+    return 0;
+  }
+  if (c->chunked && c->chunk_left == 0) {
+    char line[64];
+    if (c->chunk_crlf && http_read_line(c, line, sizeof(line)) < 0) {
+      return -1;
+    }
+    c->chunk_crlf = false;
+    if (http_read_line(c, line, sizeof(line)) < 0) {
+      return -1;
+    }
+    c->chunk_left = strtoll(line, NULL, 16);
+    if (c->chunk_left == 0) {
+      // The last chunk, and the trailer up to an empty line
+      while (http_read_line(c, line, sizeof(line)) > 0) {
+      }
+      c->complete = true;
+      return 0;
+    }
+  }
+  int64_t left = c->chunked ? c->chunk_left
+                 : c->length >= 0 ? c->length - c->received
+                                  : INT64_MAX;
+  if (c->buf_off == c->buf_len) {
+    int n = http_fill(c);
+    if (n <= 0) {
+      return n == -2 ? -ESP_ERR_HTTP_EAGAIN : n;
+    }
+  }
+  int n = MIN((int64_t)MIN(len, c->buf_len - c->buf_off), left);
+  memcpy(buffer, c->buf + c->buf_off, n);
+  c->buf_off += n;
+  c->received += n;
+  if (c->chunked) {
+    c->chunk_left -= n;
+    c->chunk_crlf = c->chunk_left == 0;
+  } else if (c->length >= 0 && c->received == c->length) {
+    c->complete = true;
+  }
+  return n;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t c) {
+  return c->complete;
+}
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t c,
+                                         int *len) {
+  char buf[1024];
+  int n;
+  *len = 0;
+  while ((n = esp_http_client_read(c, buf, sizeof(buf))) > 0) {
+    *len += n;
+  }
+  return n == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t c) {
+  if (c->location[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  char url[sizeof(c->url) + sizeof(c->location)];
+  const char *host = strstr(c->url, "://");
+  host = host ? host + 3 : c->url;
+  const char *path = host + strcspn(host, "/?#");
+  if (strstr(c->location, "://") != NULL) {
+    snprintf(url, sizeof(url), "%s", c->location);
+  } else if (c->location[0] == '/') {
+    snprintf(url, sizeof(url), "%.*s%s", (int)(path - c->url), c->url,
+             c->location);
+  } else {
+    const char *dir = strrchr(path, '/');
+    int keep = dir ? (int)(dir + 1 - c->url) : (int)(path - c->url);
+    snprintf(url, sizeof(url), "%.*s%s%s", keep, c->url, dir ? "" : "/",
+             c->location);
+  }
+  return esp_http_client_set_url(c, url);
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t c) {
+  if (c->fd >= 0) {
+    close(c->fd);
+  }
+  c->fd = -1;
+  c->buf_len = c->buf_off = 0;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t c) {
+  esp_http_client_close(c);
+  free(c);
+  return ESP_OK;
+}
+
+/* ---------- esp_http_server ---------- */
+
+#define HTTPD_SESSIONS 8
+#define HTTPD_WORK_QUEUE 32
+
+struct host_session {
+  struct host_httpd *server;
+  int fd; // -1 while the slot is free
+  void *ctx;
+  httpd_free_ctx_fn_t free_ctx;
+  // Response head for httpd_resp_sendstr()
+  const char *status;
+  const char *type;
+  char hdrs[128];
+};
+
+struct host_httpd {
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  struct {
+    httpd_work_fn_t fn;
+    void *arg;
+  } work[HTTPD_WORK_QUEUE];
+  int work_head;
+  int work_count;
+  int fail_work;
+  struct host_session sessions[HTTPD_SESSIONS];
+};
+
+httpd_handle_t host_httpd_create(void) {
+  struct host_httpd *h = calloc(1, sizeof(*h));
+  if (h == NULL) {
+    return NULL;
+  }
+  pthread_mutex_init(&h->lock, NULL);
+  pthread_cond_init(&h->queued, NULL);
+  for (int i = 0; i < HTTPD_SESSIONS; i++) {
+    h->sessions[i].server = h;
+    h->sessions[i].fd = -1;
+  }
+  return h;
+}
+
+static struct host_session *session_find(struct host_httpd *h, int fd) {
+  for (int i = 0; fd >= 0 && i < HTTPD_SESSIONS; i++) {
+    if (h->sessions[i].fd == fd) {
+      return &h->sessions[i];
+    }
+  }
+  return NULL;
+}
+
+// As the server does: the context goes with the session
+static void session_close(struct host_session *s) {
+  if (s->fd < 0) {
+    return;
+  }
+  if (s->free_ctx) {
+    s->free_ctx(s->ctx);
+  } else {
+    free(s->ctx);
+  }
+  close(s->fd);
+  s->fd = -1;
+  s->ctx = NULL;
+  s->free_ctx = NULL;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work,
+                           void *arg) {
+  struct host_httpd *h = handle;
+  esp_err_t err = ESP_OK;
+  pthread_mutex_lock(&h->lock);
+  if (h->fail_work > 0) {
+    h->fail_work--;
+    err = ESP_FAIL;
+  } else if (h->work_count == HTTPD_WORK_QUEUE) {
+    err = ESP_FAIL;
+  } else {
+    int i = (h->work_head + h->work_count++) % HTTPD_WORK_QUEUE;
+    h->work[i].fn = work;
+    h->work[i].arg = arg;
+    pthread_cond_signal(&h->queued);
+  }
+  pthread_mutex_unlock(&h->lock);
+  return err;
+}
+
+void host_httpd_fail_work(httpd_handle_t handle, int count) {
+  struct host_httpd *h = handle;
+  pthread_mutex_lock(&h->lock);
+  h->fail_work = count;
+  pthread_mutex_unlock(&h->lock);
+}
+
+int host_httpd_run(httpd_handle_t handle, int wait_ms) {
+  struct host_httpd *h = handle;
+  int ran = 0;
+  pthread_mutex_lock(&h->lock);
+  struct timespec deadline = deadline_after(wait_ms);
+  while (h->work_count == 0 && cond_wait(&h->queued, &h->lock, wait_ms,
+                                         &deadline)) {
+  }
+  while (h->work_count > 0) {
+    httpd_work_fn_t fn = h->work[h->work_head].fn;
+    void *arg = h->work[h->work_head].arg;
+    h->work_head = (h->work_head + 1) % HTTPD_WORK_QUEUE;
+    h->work_count--;
+    pthread_mutex_unlock(&h->lock);
+    fn(arg);
+    ran++;
+    pthread_mutex_lock(&h->lock);
+  }
+  pthread_mutex_unlock(&h->lock);
+
+  // Peers that hung up
+  for (int i = 0; i < HTTPD_SESSIONS; i++) {
+    char c;
+    struct host_session *s = &h->sessions[i];
+    if (s->fd >= 0 && recv(s->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+      session_close(s);
+    }
+  }
+  return ran;
+}
+
+bool host_httpd_is_open(httpd_handle_t handle, int fd) {
+  return session_find(handle, fd) != NULL;
+}
+
+esp_err_t host_httpd_call(httpd_handle_t handle, httpd_handler_t handler,
+                          const char *uri, int fd) {
+  struct host_httpd *h = handle;
+  struct host_session *s = NULL;
+  for (int i = 0; s == NULL && i < HTTPD_SESSIONS; i++) {
+    if (h->sessions[i].fd < 0) {
+      s = &h->sessions[i];
+    }
+  }
+  if (s == NULL) {
+    close(fd);
+    return ESP_FAIL;
+  }
+  s->fd = fd;
+  s->status = "200 OK";
+  s->type = "text/html";
+  s->hdrs[0] = '\0';
+  httpd_req_t req = {.handle = handle, .uri = uri, .aux = s};
+  esp_err_t err = handler(&req);
+  s->ctx = req.sess_ctx;
+  s->free_ctx = req.free_ctx;
+  if (err != ESP_OK) {
+    session_close(s);
+  }
+  return err;
+}
+
+static void session_close_work(void *arg) { session_close(arg); }
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd) {
+  struct host_session *s = session_find(handle, sockfd);
+  if (s == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  return httpd_queue_work(handle, session_close_work, s);
+}
+
+int httpd_socket_send(httpd_handle_t handle, int sockfd, const char *buf,
+                      size_t buf_len, int flags) {
+  if (session_find(handle, sockfd) == NULL) {
+    return HTTPD_SOCK_ERR_INVALID;
+  }
+  ssize_t n = send(sockfd, buf, buf_len, flags | MSG_NOSIGNAL);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? HTTPD_SOCK_ERR_TIMEOUT
+                                                   : HTTPD_SOCK_ERR_FAIL;
+  }
+  return (int)n;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req) {
+  return ((struct host_session *)req->aux)->fd;
+}
+
+int httpd_send(httpd_req_t *req, const char *buf, size_t buf_len) {
+  int fd = httpd_req_to_sockfd(req);
+  for (size_t sent = 0; sent < buf_len;) {
+    ssize_t n = send(fd, buf + sent, buf_len - sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      return HTTPD_SOCK_ERR_FAIL;
+    }
+    sent += n;
+  }
+  return (int)buf_len;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status) {
+  ((struct host_session *)req->aux)->status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type) {
+  ((struct host_session *)req->aux)->type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *req, const char *field,
+                             const char *value) {
+  struct host_session *s = req->aux;
+  size_t len = strlen(s->hdrs);
+  snprintf(s->hdrs + len, sizeof(s->hdrs) - len, "%s: %s\r\n", field, value);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t *req, const char *str) {
+  struct host_session *s = req->aux;
+  char head[256];
+  int len = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\n"
+                     "Content-Length: %u\r\n%s\r\n",
+                     s->status, s->type, (unsigned)strlen(str), s->hdrs);
+  if (httpd_send(req, head, len) < 0 ||
+      httpd_send(req, str, strlen(str)) < 0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+/* ---------- esp_tls ---------- */
+
+struct esp_tls {
+  int fd; // -1 while not connected
+};
+
+esp_tls_t *esp_tls_init(void) {
+  esp_tls_t *tls = calloc(1, sizeof(*tls));
+  if (tls) {
+    tls->fd = -1;
+  }
+  return tls;
+}
+
+int esp_tls_conn_new_sync(const char *hostname, int hostlen, int port,
+                          const esp_tls_cfg_t *cfg, esp_tls_t *tls) {
+  if (!cfg->is_plain_tcp) {
+    return -1;
+  }
+  char host[256];
+  char service[8];
+  snprintf(host, sizeof(host), "%.*s", hostlen, hostname);
+  snprintf(service, sizeof(service), "%d", port);
+  struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                           .ai_socktype = SOCK_STREAM};
+  struct addrinfo *ai;
+  if (getaddrinfo(host, service, &hints, &ai) != 0) {
+    return -1;
+  }
+  tls->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+  struct timeval tv = {.tv_sec = cfg->timeout_ms / 1000,
+                       .tv_usec = cfg->timeout_ms % 1000 * 1000};
+  bool ok = tls->fd >= 0 &&
+            setsockopt(tls->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ==
+                0 &&
+            setsockopt(tls->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) ==
+                0 &&
+            connect(tls->fd, ai->ai_addr, ai->ai_addrlen) == 0;
+  freeaddrinfo(ai);
+  if (!ok && tls->fd >= 0) {
+    close(tls->fd);
+    tls->fd = -1;
+  }
+  return ok ? 1 : -1;
+}
+
+ssize_t esp_tls_conn_read(esp_tls_t *tls, void *data, size_t datalen) {
+  return recv(tls->fd, data, datalen, 0);
+}
+
+ssize_t esp_tls_conn_write(esp_tls_t *tls, const void *data, size_t datalen) {
+  return send(tls->fd, data, datalen, MSG_NOSIGNAL);
+}
+
+int esp_tls_conn_destroy(esp_tls_t *tls) {
+  if (tls && tls->fd >= 0) {
+    close(tls->fd);
+  }
+  free(tls);
+  return 0;
+}
+
+/* ---------- esp_wifi ---------- */
+
+static atomic_bool wifi_connected = true;
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+  if (!atomic_load(&wifi_connected)) {
+    return ESP_ERR_WIFI_NOT_CONNECT;
+  }
+  *ap_info = (wifi_ap_record_t){.ssid = "host", .primary = 1, .rssi = -50};
+  return ESP_OK;
+}
+
+void host_wifi_set_connected(bool connected) {
+  atomic_store(&wifi_connected, connected);
+}
@@ -0,0 +1,5 @@
+#pragma once
+/* Host stand-in for LVGL: the types the firmware's headers name, for
+ * modules that include screens.h without drawing anything */
+
+typedef struct _lv_display_t lv_display_t;
@@ -0,0 +1,4 @@
+#pragma once
+/* Host stand-in for lwIP's netdb.h: the host resolver */
+#include <netdb.h>
+#include <sys/socket.h>
@@ -0,0 +1,30 @@
+#pragma once
+/* Host stand-in for ESP-ADF's ringbuf.h: the byte ring elements are
+ * linked by, with its blocking and its codes */
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct ringbuf *ringbuf_handle_t;
+
+#define RB_OK (ESP_OK)
+#define RB_FAIL (ESP_FAIL)
+#define RB_DONE (-2)
+#define RB_ABORT (-3)
+#define RB_TIMEOUT (-4)
+
+ringbuf_handle_t rb_create(int block_size, int n_blocks);
+esp_err_t rb_destroy(ringbuf_handle_t rb);
+// Wakes the waiting reader and writer with RB_ABORT, until rb_reset()
+esp_err_t rb_abort(ringbuf_handle_t rb);
+// Empties the ring and clears the done and abort marks
+esp_err_t rb_reset(ringbuf_handle_t rb);
+int rb_bytes_available(ringbuf_handle_t rb);
+int rb_bytes_filled(ringbuf_handle_t rb);
+int rb_get_size(ringbuf_handle_t rb);
+/* Both wait up to ticks for every part of len they have to wait for, as
+ * ADF's do, and return the bytes moved if any, else RB_TIMEOUT, RB_DONE
+ * or RB_ABORT */
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks);
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks);
+// The reader gets RB_DONE once the ring is empty
+esp_err_t rb_done_write(ringbuf_handle_t rb);
@@ -0,0 +1,256 @@
+/* Gesture state machine fed with synthetic edge timings, driven the way
+ * button_gesture.c's timer does: at every deadline, until nothing is left */
+#include "button_gesture.h"
+#include "host_test.h"
+
+#define MS(ms) ((int64_t)(ms) * 1000)
+#define MAX_SEEN 32
+
+// The switches' timing in init_encoders()
+static const button_gesture_timing_t timing = {
+    .debounce_ms = 50,
+    .double_click_ms = 300,
+    .long_press_ms = 1500,
+    .repeat_ms = 1000,
+};
+
+static button_gesture_fsm_t fsm;
+static int64_t now_us;
+static struct {
+  button_gesture_t gesture;
+  int64_t at_ms;
+} seen[MAX_SEEN];
+static int seen_count;
+
+static void start(const button_gesture_timing_t *t) {
+  button_gesture_fsm_init(&fsm, t);
+  now_us = 0;
+  seen_count = 0;
+}
+
+// What the timer callback does when it fires
+static void fire(void) {
+  button_gesture_t g;
+  int guard = 0;
+  while ((g = button_gesture_fsm_timeout(&fsm, now_us)) !=
+         BUTTON_GESTURE_NONE) {
+    CHECK(seen_count < MAX_SEEN);
+    CHECK(++guard < MAX_SEEN);
+    if (seen_count >= MAX_SEEN || guard >= MAX_SEEN) {
+      return;
+    }
+    seen[seen_count].gesture = g;
+    seen[seen_count].at_ms = now_us / 1000;
+    seen_count++;
+  }
+}
+
+// Runs every deadline up to t_ms
+static void advance(int64_t t_ms) {
+  int guard = 0;
+  for (;;) {
+    int64_t deadline = button_gesture_fsm_next_deadline(&fsm);
+    if (deadline < 0 || deadline > MS(t_ms)) {
+      break;
+    }
+    CHECK(deadline >= now_us);
+    CHECK(++guard < 1000);
+    if (guard >= 1000) {
+      return;
+    }
+    now_us = deadline;
+    fire();
+  }
+  now_us = MS(t_ms);
+}
+
+static void edge(int64_t t_ms, bool pressed) {
+  advance(t_ms);
+  button_gesture_fsm_edge(&fsm, pressed, now_us);
+}
+
+// A press with contact bounce: n extra edges 1 ms apart after each change
+static void bouncy_edge(int64_t t_ms, bool pressed, int n) {
+  edge(t_ms, pressed);
+  for (int i = 1; i <= n; i++) {
+    edge(t_ms + i, i % 2 ? !pressed : pressed);
+  }
+}
+
+static void test_click_after_double_click_window(void) {
+  start(&timing);
+  edge(1000, true);
+  edge(1120, false);
+  advance(1400);
+  CHECK_EQ(seen_count, 0); // still within the double-click window
+  advance(5000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+  // The window counts from the release, not from when it was debounced
+  CHECK_EQ(seen[0].at_ms, 1120 + 300);
+  CHECK_EQ(button_gesture_fsm_next_deadline(&fsm), -1);
+}
+
+static void test_bounce_is_one_click(void) {
+  start(&timing);
+  bouncy_edge(1000, true, 6);
+  bouncy_edge(1200, false, 6);
+  advance(5000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+}
+
+static void test_glitch_shorter_than_debounce_is_ignored(void) {
+  start(&timing);
+  edge(1000, true);
+  edge(1030, false);
+  advance(5000);
+  CHECK_EQ(seen_count, 0);
+}
+
+static void test_double_click(void) {
+  start(&timing);
+  bouncy_edge(1000, true, 4);
+  bouncy_edge(1100, false, 4);
+  bouncy_edge(1250, true, 4);
+  bouncy_edge(1350, false, 4);
+  advance(5000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_DOUBLE_CLICK);
+  // Reported once the second release is debounced
+  CHECK_EQ(seen[0].at_ms, 1354 + 50);
+}
+
+static void test_second_press_too_late_is_two_clicks(void) {
+  start(&timing);
+  edge(1000, true);
+  edge(1100, false);
+  edge(1450, true); // 350 ms after the release
+  edge(1550, false);
+  advance(5000);
+  CHECK_EQ(seen_count, 2);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+  CHECK_EQ(seen[1].gesture, BUTTON_GESTURE_CLICK);
+}
+
+static void test_long_press_and_hold_repeat(void) {
+  start(&timing);
+  bouncy_edge(1000, true, 4);
+  advance(2503);
+  CHECK_EQ(seen_count, 0);
+  advance(5700);
+  // Long press 1.5 s after the press settled (its last bounce at 1004),
+  // repeats every second after it without drifting
+  CHECK_EQ(seen_count, 4);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_LONG_PRESS);
+  CHECK_EQ(seen[0].at_ms, 2504);
+  for (int i = 1; i < 4; i++) {
+    CHECK_EQ(seen[i].gesture, BUTTON_GESTURE_HOLD_REPEAT);
+    CHECK_EQ(seen[i].at_ms, 2504 + 1000 * i);
+  }
+  bouncy_edge(5700, false, 4);
+  advance(10000);
+  // Releasing ends the hold without a click
+  CHECK_EQ(seen_count, 4);
+  CHECK_EQ(button_gesture_fsm_next_deadline(&fsm), -1);
+}
+
+static void test_long_press_without_repeat(void) {
+  button_gesture_timing_t t = timing;
+  t.repeat_ms = 0;
+  start(&t);
+  edge(1000, true);
+  advance(9000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_LONG_PRESS);
+  edge(9000, false);
+  advance(12000);
+  CHECK_EQ(seen_count, 1);
+}
+
+static void test_release_at_long_press_deadline(void) {
+  // Released just after the long-press deadline, which passes while the
+  // release is still being debounced: the deadline came first and wins
+  start(&timing);
+  edge(1000, true);
+  edge(2510, false);
+  advance(5000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_LONG_PRESS);
+
+  // Released just before it: a click
+  start(&timing);
+  edge(1000, true);
+  edge(2490, false);
+  advance(5000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+}
+
+static void test_immediate_click_without_double_click(void) {
+  button_gesture_timing_t t = timing;
+  t.double_click_ms = 0;
+  start(&t);
+  edge(1000, true);
+  edge(1100, false);
+  advance(1150);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+  CHECK_EQ(seen[0].at_ms, 1150);
+}
+
+static void test_no_long_press_when_disabled(void) {
+  button_gesture_timing_t t = timing;
+  t.long_press_ms = 0;
+  start(&t);
+  edge(1000, true);
+  advance(9000);
+  CHECK_EQ(seen_count, 0);
+  edge(9000, false);
+  advance(12000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+}
+
+static void test_press_held_across_reset_is_swallowed(void) {
+  // As after light sleep: the press that woke the device is still held
+  start(&timing);
+  button_gesture_fsm_reset(&fsm, true, MS(1000));
+  now_us = MS(1000);
+  CHECK_EQ(button_gesture_fsm_next_deadline(&fsm), -1);
+  advance(4000);
+  edge(4000, false);
+  advance(6000);
+  CHECK_EQ(seen_count, 0);
+  // The next press is recognized again
+  edge(6000, true);
+  edge(6100, false);
+  advance(8000);
+  CHECK_EQ(seen_count, 1);
+  CHECK_EQ(seen[0].gesture, BUTTON_GESTURE_CLICK);
+}
+
+static void test_idle_has_no_deadline(void) {
+  start(&timing);
+  CHECK_EQ(button_gesture_fsm_next_deadline(&fsm), -1);
+  CHECK_EQ(button_gesture_fsm_timeout(&fsm, MS(100000)), BUTTON_GESTURE_NONE);
+  // A repeated level is not an edge
+  button_gesture_fsm_edge(&fsm, false, MS(1000));
+  CHECK_EQ(button_gesture_fsm_next_deadline(&fsm), -1);
+}
+
+int main(void) {
+  RUN_TEST(test_click_after_double_click_window);
+  RUN_TEST(test_bounce_is_one_click);
+  RUN_TEST(test_glitch_shorter_than_debounce_is_ignored);
+  RUN_TEST(test_double_click);
+  RUN_TEST(test_second_press_too_late_is_two_clicks);
+  RUN_TEST(test_long_press_and_hold_repeat);
+  RUN_TEST(test_long_press_without_repeat);
+  RUN_TEST(test_release_at_long_press_deadline);
+  RUN_TEST(test_immediate_click_without_double_click);
+  RUN_TEST(test_no_long_press_when_disabled);
+  RUN_TEST(test_press_held_across_reset_is_swallowed);
+  RUN_TEST(test_idle_has_no_deadline);
+  return host_test_result();
+}
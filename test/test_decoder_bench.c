@@ -0,0 +1,156 @@
+/* The decode benchmark's harness: decoder_bench.c against a stand-in
+ * decoder whose cost is known. It takes 100 bytes of the clip at a time
+ * and puts out 20 ms of stereo PCM for each after 2 ms, one of them after
+ * 30 ms. The clip is Ogg Opus built here; no Opus is decoded. */
+#include "decoder_bench.h"
+#include "decoder_registry.h"
+#include "host_test.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define READ_LEN 100
+#define CHUNK_PCM (48000 / 50 * 2 * 2)
+#define COST_US 2000
+#define SLOW_US 30000
+#define SLOW_CHUNK 10
+#define PRE_SKIP 312
+
+static int created;
+static bool fail_create;
+
+typedef struct {
+  int chunks;
+} fake_decoder_t;
+
+static audio_element_err_t fake_process(audio_element_handle_t el, char *buf,
+                                        int len) {
+  fake_decoder_t *f = audio_element_getdata(el);
+  int n = audio_element_input(el, buf, READ_LEN);
+  if (n <= 0) {
+    return n;
+  }
+  usleep(++f->chunks == SLOW_CHUNK ? SLOW_US : COST_US);
+  static char pcm[CHUNK_PCM];
+  return audio_element_output(el, pcm, sizeof(pcm));
+}
+
+static esp_err_t fake_destroy(audio_element_handle_t el) {
+  free(audio_element_getdata(el));
+  return ESP_OK;
+}
+
+audio_element_handle_t decoder_registry_create(const decoder_desc_t *d) {
+  CHECK_EQ(d->codec, CODEC_TYPE_OPUS);
+  if (fail_create) {
+    return NULL;
+  }
+  created++;
+  audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+  cfg.process = fake_process;
+  cfg.destroy = fake_destroy;
+  cfg.tag = "opus";
+  audio_element_handle_t el = audio_element_init(&cfg);
+  audio_element_setdata(el, calloc(1, sizeof(fake_decoder_t)));
+  return el;
+}
+
+/* ---------- clip ---------- */
+
+static uint8_t clip[64 * 1024];
+static size_t clip_len;
+
+// A page of packets of packet_len bytes, ending at granule
+static void add_page(const void *packet, size_t packet_len, int packets,
+                     uint64_t granule) {
+  uint8_t *p = clip + clip_len;
+  memcpy(p, "OggS", 4);
+  p[4] = 0;
+  p[5] = clip_len == 0 ? 0x02 : 0;
+  for (int i = 0; i < 8; i++) {
+    p[6 + i] = granule >> (8 * i);
+  }
+  memset(p + 14, 0, 12); // serial, sequence, CRC: not looked at
+  p[26] = packets;
+  memset(p + 27, packet_len, packets);
+  uint8_t *body = p + 27 + packets;
+  for (int i = 0; i < packets; i++) {
+    memcpy(body + i * packet_len, packet, packet_len);
+  }
+  clip_len += 27 + packets + packets * packet_len;
+}
+
+// Ten seconds of 20 ms packets, 50 to a page
+static void make_clip(const char *head) {
+  clip_len = 0;
+  uint8_t id[19] = {0};
+  memcpy(id, head, 8);
+  id[8] = 1;
+  id[9] = 2; // channels
+  id[10] = PRE_SKIP & 0xFF;
+  id[11] = PRE_SKIP >> 8;
+  add_page(id, sizeof(id), 1, 0);
+  add_page("OpusTags\0\0\0\0\0\0\0\0", 16, 1, 0);
+  uint8_t packet[20];
+  memset(packet, 0xFC, sizeof(packet));
+  for (int page = 1; page <= 10; page++) {
+    add_page(packet, sizeof(packet), 50, PRE_SKIP + page * 50 * 960);
+  }
+}
+
+/* ---------- tests ---------- */
+
+static void test_measures_the_decoder(void) {
+  make_clip("OpusHead");
+  created = 0;
+  decoder_bench_result_t r;
+  CHECK_EQ(decoder_bench_opus(clip, clip_len, 3, &r), ESP_OK);
+  CHECK_EQ(created, 3);
+  CHECK_EQ(r.audio_ms, 10000);
+  CHECK_EQ(r.channels, 2);
+  int chunks = (clip_len + READ_LEN - 1) / READ_LEN;
+  CHECK_EQ(r.pcm_bytes, (uint64_t)chunks * CHUNK_PCM);
+  // About 2 ms a chunk and one of 30 ms; sleeps only ever run long
+  int64_t least_ms = ((int64_t)(chunks - 2) * COST_US + SLOW_US) / 1000;
+  CHECK(r.decode_ms >= least_ms && r.decode_ms < 3 * least_ms);
+  CHECK_EQ(r.speed_x10, 10000 * 10 / r.decode_ms);
+  CHECK_EQ(r.cpu_permille, r.decode_ms * 1000 / 10000);
+  // The slow chunk: 30 ms for 20 ms of audio
+  CHECK(r.worst_permille >= SLOW_US / 20 && r.worst_permille < 3 * SLOW_US / 20);
+}
+
+// The length from the last page that is whole
+static void test_cut_off_clip(void) {
+  make_clip("OpusHead");
+  decoder_bench_result_t r;
+  CHECK_EQ(decoder_bench_opus(clip, clip_len - 10, 1, &r), ESP_OK);
+  CHECK_EQ(r.audio_ms, 9000);
+}
+
+static void test_not_opus(void) {
+  decoder_bench_result_t r;
+  make_clip("\x01vorbis\0");
+  CHECK_EQ(decoder_bench_opus(clip, clip_len, 1, &r), ESP_ERR_INVALID_ARG);
+  make_clip("OpusHead");
+  CHECK_EQ(decoder_bench_opus(clip + 1, clip_len - 1, 1, &r),
+           ESP_ERR_INVALID_ARG);
+  // Headers only: no audio to time
+  CHECK_EQ(decoder_bench_opus(clip, 27 + 1 + 19 + 27 + 1 + 16, 1, &r),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(decoder_bench_opus(clip, 0, 1, &r), ESP_ERR_INVALID_ARG);
+}
+
+static void test_decoder_fails(void) {
+  make_clip("OpusHead");
+  decoder_bench_result_t r;
+  fail_create = true;
+  CHECK_EQ(decoder_bench_opus(clip, clip_len, 1, &r), ESP_FAIL);
+  fail_create = false;
+}
+
+int main(void) {
+  RUN_TEST(test_measures_the_decoder);
+  RUN_TEST(test_cut_off_clip);
+  RUN_TEST(test_not_opus);
+  RUN_TEST(test_decoder_fails);
+  return host_test_result();
+}
@@ -0,0 +1,616 @@
+/* HLS: the playlist parser and the demuxer on their own, then the HLS
+ * source element against fixtures/hls/hls_server.py on this machine. The
+ * fixture's ADTS frames carry their variant, segment and index, so the
+ * audio the element puts out shows which segments it fetched, from which
+ * variant, and whether anything went missing on the way. */
+#define _GNU_SOURCE
+#include "audio_pipeline_manager.h"
+#include "esp_timer.h"
+#include "hls_playlist.h"
+#include "hls_stream.h"
+#include "host_test.h"
+#include "mpegts_demux.h"
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SEGMENT_S 2.0 // as the fixture's
+#define FRAMES_PER_S (44100 / 1024.0)
+
+extern char **environ;
+
+volatile uint64_t g_bytes_read;
+volatile int g_stream_buffer_fill;
+audio_pipeline_components_t audio_pipeline_components;
+
+const char *codec_type_to_string(codec_type_t codec) {
+  return codec == CODEC_TYPE_AAC ? "AAC" : "MP3";
+}
+
+/* ---------- fixture frames ---------- */
+
+static int frame_count(uint32_t seq) {
+  return (int)((seq + 1) * SEGMENT_S * FRAMES_PER_S) -
+         (int)(seq * SEGMENT_S * FRAMES_PER_S);
+}
+
+typedef struct {
+  int frames;
+  int gaps;      // places frames went missing
+  int switches;  // of variant
+  int bad;       // bytes outside frames
+  int first_variant;
+  int variant;   // of the last frame
+  uint32_t first_seq;
+  uint32_t seq;
+  int index;
+  bool ends_segment; // the last frame is the last of its segment
+} frames_t;
+
+// Walks the ADTS frames of data; a frame cut off at the end is left out
+static frames_t walk_frames(const uint8_t *data, size_t len) {
+  frames_t f = {.first_variant = -1, .variant = -1};
+  size_t off = 0;
+  while (off + 14 <= len) {
+    const uint8_t *p = data + off;
+    if (p[0] != 0xFF || (p[1] & 0xF6) != 0xF0) {
+      f.bad++;
+      off++;
+      continue;
+    }
+    size_t frame_len = (p[3] & 3) << 11 | p[4] << 3 | p[5] >> 5;
+    if (frame_len < 14 || off + frame_len > len) {
+      break;
+    }
+    int variant = p[7];
+    uint32_t seq = (uint32_t)p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+    int index = p[12] << 8 | p[13];
+    if (f.frames == 0) {
+      f.first_variant = variant;
+      f.first_seq = seq;
+    } else {
+      bool next = seq == f.seq ? index == f.index + 1
+                               : seq == f.seq + 1 && index == 0 &&
+                                     f.index == frame_count(f.seq) - 1;
+      f.gaps += !next;
+      f.switches += variant != f.variant;
+    }
+    f.variant = variant;
+    f.seq = seq;
+    f.index = index;
+    f.frames++;
+    off += frame_len;
+  }
+  f.ends_segment = f.frames > 0 && f.index == frame_count(f.seq) - 1;
+  return f;
+}
+
+// Frames of segments first to last
+static int frames_of(uint32_t first, uint32_t last) {
+  int n = 0;
+  for (uint32_t seq = first; seq <= last; seq++) {
+    n += frame_count(seq);
+  }
+  return n;
+}
+
+/* ---------- fixture server ---------- */
+
+static pid_t server_pid;
+static int server_port;
+
+static bool start_server(void) {
+  int out[2];
+  if (pipe(out) != 0) {
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, out[0]);
+  char *argv[] = {PYTHON3, HLS_SERVER, NULL};
+  bool ok = posix_spawn(&server_pid, PYTHON3, &actions, NULL, argv,
+                        environ) == 0;
+  posix_spawn_file_actions_destroy(&actions);
+  close(out[1]);
+  FILE *f = fdopen(out[0], "r");
+  ok = ok && fscanf(f, "%d", &server_port) == 1;
+  fclose(f);
+  return ok;
+}
+
+static void stop_server(void) {
+  kill(server_pid, SIGTERM);
+  waitpid(server_pid, NULL, 0);
+}
+
+// A segment the fixture writes, read back; free() it
+static uint8_t *fixture_segment(const char *kind, int seq, size_t *len) {
+  char path[64];
+  char seq_arg[16];
+  snprintf(path, sizeof(path), "hls_%s_%d.seg", kind, seq);
+  snprintf(seq_arg, sizeof(seq_arg), "%d", seq);
+  char *argv[] = {PYTHON3,         HLS_SERVER, "segment", (char *)kind,
+                  seq_arg,         path,       NULL};
+  pid_t pid;
+  int status = -1;
+  if (posix_spawn(&pid, PYTHON3, NULL, NULL, argv, environ) == 0) {
+    waitpid(pid, &status, 0);
+  }
+  CHECK_EQ(status, 0);
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    *len = 0;
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *data = malloc(*len);
+  CHECK_EQ(fread(data, 1, *len, f), *len);
+  fclose(f);
+  return data;
+}
+
+/* ---------- playlists ---------- */
+
+// Parses text fed chunk bytes at a time (0: at once)
+static void parse(hls_playlist_t *pl, const char *base, uint64_t from,
+                  const char *text, size_t chunk) {
+  hls_playlist_begin(pl, base, from);
+  size_t len = strlen(text);
+  chunk = chunk ? chunk : len;
+  for (size_t i = 0; i < len; i += chunk) {
+    hls_playlist_feed(pl, text + i, MIN(chunk, len - i));
+  }
+  hls_playlist_end(pl);
+}
+
+static const char *const master_text =
+    "#EXTM3U\r\n"
+    "#EXT-X-STREAM-INF:BANDWIDTH=64000,CODECS=\"mp4a.40.2\"\r\n"
+    "lo/index.m3u8\r\n"
+    "#EXT-X-STREAM-INF:CODECS=\"mp4a.40.2\",BANDWIDTH=192000\r\n"
+    "../hi/index.m3u8?token=a,b\r\n"
+    "#EXT-X-STREAM-INF:BANDWIDTH=500000,CODECS=\"avc1.4d401f,mp4a.40.2\"\r\n"
+    "http://cdn.example.com/video.m3u8";
+
+static void test_master_playlist(void) {
+  static hls_playlist_t pl;
+  for (size_t chunk = 0; chunk <= 7; chunk++) {
+    parse(&pl, "http://example.com/radio/live/master.m3u8?x=1",
+          HLS_FROM_LIVE_EDGE, master_text, chunk);
+    CHECK_EQ(pl.type, HLS_PLAYLIST_MASTER);
+    CHECK_EQ(pl.variant_count, 3);
+    CHECK_EQ(pl.segment_count, 0);
+    CHECK_STR(pl.variants[0].uri,
+              "http://example.com/radio/live/lo/index.m3u8");
+    CHECK_STR(pl.variants[1].uri,
+              "http://example.com/radio/hi/index.m3u8?token=a,b");
+    CHECK_STR(pl.variants[2].uri, "http://cdn.example.com/video.m3u8");
+    CHECK_EQ(pl.variants[1].bandwidth, 192000);
+    CHECK_STR(pl.variants[2].codecs, "avc1.4d401f,mp4a.40.2");
+  }
+
+  // Up when the next one takes at most 70%, down past 85%; never to video
+  CHECK_EQ(hls_variant_select(&pl, -1, 0), 0);
+  CHECK_EQ(hls_variant_select(&pl, 0, 0), 0);
+  CHECK_EQ(hls_variant_select(&pl, 0, 250000), 0);
+  CHECK_EQ(hls_variant_select(&pl, 0, 280000), 1);
+  CHECK_EQ(hls_variant_select(&pl, 0, 10000000), 1);
+  CHECK_EQ(hls_variant_select(&pl, 1, 230000), 1);
+  CHECK_EQ(hls_variant_select(&pl, 1, 220000), 0);
+  CHECK_EQ(hls_variant_select(&pl, 1, 10000), 0);
+
+  // Video listed first: the first audio-only variant to start with
+  parse(&pl, "http://example.com/m.m3u8", HLS_FROM_LIVE_EDGE,
+        "#EXTM3U\n#EXT-X-STREAM-INF:BANDWIDTH=900000,CODECS=\"avc1.64001f,"
+        "mp4a.40.2\"\nv.m3u8\n#EXT-X-STREAM-INF:BANDWIDTH=96000,CODECS="
+        "\"mp4a.40.5\"\na.m3u8\n",
+        0);
+  CHECK_EQ(hls_variant_select(&pl, -1, 0), 1);
+}
+
+// A live window of count segments from first, 2 s each
+static char *live_text(uint64_t first, int count, bool ended) {
+  static char text[8192];
+  int n = snprintf(text, sizeof(text),
+                   "#EXTM3U\n#EXT-X-TARGETDURATION:2\n"
+                   "#EXT-X-MEDIA-SEQUENCE:%llu\n",
+                   (unsigned long long)first);
+  for (int i = 0; i < count; i++) {
+    n += snprintf(text + n, sizeof(text) - n,
+                  "#EXTINF:2.000,\nseg%llu.ts\n",
+                  (unsigned long long)(first + i));
+  }
+  if (ended) {
+    snprintf(text + n, sizeof(text) - n, "#EXT-X-ENDLIST\n");
+  }
+  return text;
+}
+
+static void test_live_window(void) {
+  static hls_playlist_t pl;
+  const char *base = "http://example.com/live/v0/index.m3u8";
+  // Joined 3 segments from the end
+  parse(&pl, base, HLS_FROM_LIVE_EDGE, live_text(30, 6, false), 3);
+  CHECK_EQ(pl.type, HLS_PLAYLIST_MEDIA);
+  CHECK(!pl.ended);
+  CHECK_EQ(pl.target_duration_ms, 2000);
+  CHECK_EQ(pl.first_sequence, 30);
+  CHECK_EQ(pl.total_segments, 6);
+  CHECK_EQ(pl.segment_count, HLS_LIVE_START_SEGMENTS);
+  CHECK_EQ(pl.segments[0].sequence, 33);
+  CHECK_EQ(pl.segments[2].sequence, 35);
+  CHECK_EQ(pl.segments[0].duration_ms, 2000);
+  CHECK_STR(pl.segments[0].uri, "http://example.com/live/v0/seg33.ts");
+  // More than are kept, still the end
+  parse(&pl, base, HLS_FROM_LIVE_EDGE, live_text(100, 40, false), 5);
+  CHECK_EQ(pl.segment_count, HLS_LIVE_START_SEGMENTS);
+  CHECK_EQ(pl.segments[0].sequence, 137);
+  CHECK(!pl.truncated);
+  // A reload: the segments from the next one not fetched
+  parse(&pl, base, 34, live_text(31, 6, false), 0);
+  CHECK_EQ(pl.segment_count, 3);
+  CHECK_EQ(pl.segments[0].sequence, 34);
+  parse(&pl, base, 40, live_text(31, 6, false), 0);
+  CHECK_EQ(pl.segment_count, 0);
+}
+
+static void test_ended_playlist(void) {
+  static hls_playlist_t pl;
+  const char *base = "http://example.com/vod/index.m3u8";
+  // Too long to keep: the stream takes it again from the start
+  parse(&pl, base, HLS_FROM_LIVE_EDGE, live_text(0, 20, true), 0);
+  CHECK(pl.ended);
+  CHECK(pl.truncated);
+  CHECK_EQ(pl.segment_count, HLS_MAX_SEGMENTS);
+  parse(&pl, base, 0, live_text(0, 20, true), 0);
+  CHECK(pl.truncated);
+  CHECK_EQ(pl.segments[0].sequence, 0);
+  CHECK_EQ(pl.segments[HLS_MAX_SEGMENTS - 1].sequence, HLS_MAX_SEGMENTS - 1);
+  parse(&pl, base, HLS_MAX_SEGMENTS, live_text(0, 20, true), 0);
+  CHECK(!pl.truncated);
+  CHECK_EQ(pl.segment_count, 20 - HLS_MAX_SEGMENTS);
+  // All of a short one
+  parse(&pl, base, HLS_FROM_LIVE_EDGE, live_text(0, 5, true), 0);
+  CHECK(pl.ended);
+  CHECK(!pl.truncated);
+  CHECK_EQ(pl.segment_count, 5);
+}
+
+static void test_other_playlists(void) {
+  static hls_playlist_t pl;
+  const char *base = "http://example.com/a/list.m3u8";
+  parse(&pl, base, HLS_FROM_LIVE_EDGE,
+        "#EXTM3U\n#EXTINF:-1,Station\nhttp://s1.example.com/aac\n"
+        "http://s2.example.com/aac\n",
+        2);
+  CHECK_EQ(pl.type, HLS_PLAYLIST_PLAIN);
+  CHECK(pl.ended);
+  CHECK_EQ(pl.segment_count, 2);
+  CHECK_EQ(pl.segments[0].duration_ms, 0);
+  CHECK_STR(pl.segments[1].uri, "http://s2.example.com/aac");
+
+  parse(&pl, base, 0,
+        "#EXTM3U\n#EXT-X-TARGETDURATION:10\n#EXT-X-KEY:METHOD=NONE\n"
+        "#EXTINF:9.984,\na.ts\n#EXT-X-DISCONTINUITY\n#EXTINF:10,\nb.ts\n",
+        0);
+  CHECK(pl.unsupported == NULL);
+  CHECK_EQ(pl.segments[0].duration_ms, 9984);
+  CHECK(!pl.segments[0].discontinuity);
+  CHECK(pl.segments[1].discontinuity);
+  parse(&pl, base, 0,
+        "#EXTM3U\n#EXT-X-TARGETDURATION:6\n"
+        "#EXT-X-KEY:METHOD=AES-128,URI=\"k\"\n#EXTINF:6,\na.ts\n",
+        0);
+  CHECK_STR(pl.unsupported, "encrypted segments");
+  parse(&pl, base, 0,
+        "#EXTM3U\n#EXT-X-TARGETDURATION:6\n#EXT-X-MAP:URI=\"init.mp4\"\n"
+        "#EXTINF:6,\na.m4s\n",
+        0);
+  CHECK_STR(pl.unsupported, "fragmented MP4 segments");
+
+  // A line too long to keep is left out, the rest is read
+  static char text[2 * HLS_LINE_MAX];
+  int n = snprintf(text, sizeof(text), "#EXTM3U\n#EXT-X-TARGETDURATION:6\n"
+                                       "#EXTINF:6,\n");
+  memset(text + n, 'x', HLS_LINE_MAX + 10);
+  strcpy(text + n + HLS_LINE_MAX + 10, ".ts\n#EXTINF:6,\nb.ts\n");
+  parse(&pl, base, 0, text, 64);
+  CHECK_EQ(pl.segment_count, 1);
+  CHECK_STR(pl.segments[0].uri, "http://example.com/a/b.ts");
+  parse(&pl, base, 0, "", 0);
+  CHECK_EQ(pl.type, HLS_PLAYLIST_UNKNOWN);
+}
+
+static void test_resolve_uri(void) {
+  static const char *const cases[][3] = {
+      {"http://h.com/a/b/list.m3u8", "s1.ts", "http://h.com/a/b/s1.ts"},
+      {"http://h.com/a/b/list.m3u8?t=1", "s1.ts", "http://h.com/a/b/s1.ts"},
+      {"http://h.com/a/b/list.m3u8", "../c/s.ts", "http://h.com/a/c/s.ts"},
+      {"http://h.com/a/b/list.m3u8", "./../../../s.ts", "http://h.com/s.ts"},
+      {"http://h.com/a/b/list.m3u8", "/x/s.ts?k=v/..", "http://h.com/x/s.ts?k=v/.."},
+      {"https://h.com:8443/a/list.m3u8", "//cdn.com/s.ts", "https://cdn.com/s.ts"},
+      {"http://h.com", "s.ts", "http://h.com/s.ts"},
+      {"http://h.com/a/list.m3u8", "HTTPS://o.com/s.ts", "HTTPS://o.com/s.ts"},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    char out[HLS_URI_MAX];
+    CHECK(hls_resolve_uri(cases[i][0], cases[i][1], out, sizeof(out)));
+    CHECK_STR(out, cases[i][2]);
+  }
+  char small[16];
+  CHECK(!hls_resolve_uri("http://h.com/a/list.m3u8", "segment.ts", small,
+                         sizeof(small)));
+}
+
+/* ---------- demuxer ---------- */
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} sink_t;
+
+static int sink_out(void *ctx, const uint8_t *data, size_t len) {
+  sink_t *s = ctx;
+  if (s->len + len > s->cap) {
+    s->cap = MAX(s->cap * 2, s->len + len);
+    s->data = realloc(s->data, s->cap);
+  }
+  memcpy(s->data + s->len, data, len);
+  s->len += len;
+  return 0;
+}
+
+// Demuxes segment fed chunk bytes at a time
+static frames_t demux(mpegts_demux_t *d, const uint8_t *seg, size_t len,
+                      size_t chunk) {
+  sink_t sink = {0};
+  mpegts_demux_init(d, sink_out, &sink);
+  mpegts_demux_segment(d, false);
+  for (size_t i = 0; i < len; i += chunk) {
+    CHECK_EQ(mpegts_demux_feed(d, seg + i, MIN(chunk, len - i)), 0);
+  }
+  frames_t f = walk_frames(sink.data, sink.len);
+  CHECK_EQ(d->bytes_out, sink.len);
+  free(sink.data);
+  return f;
+}
+
+static void test_demux_ts(void) {
+  size_t len;
+  uint8_t *seg = fixture_segment("ts", 31, &len);
+  CHECK(seg != NULL && len % MPEGTS_PACKET_SIZE == 0);
+  if (seg == NULL) {
+    return;
+  }
+  static const size_t chunks[] = {1, 7, 188, 1000, 65536};
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    mpegts_demux_t d;
+    frames_t f = demux(&d, seg, len, chunks[i]);
+    CHECK_EQ(d.audio, MPEGTS_AUDIO_ADTS);
+    CHECK(!d.packed);
+    CHECK_EQ(d.packets, len / MPEGTS_PACKET_SIZE);
+    CHECK_EQ(d.cc_errors, 0);
+    CHECK_EQ(f.frames, frame_count(31));
+    CHECK_EQ(f.first_seq, 31);
+    CHECK_EQ(f.gaps, 0);
+    CHECK_EQ(f.bad, 0);
+  }
+
+  // A packet lost in the middle: counted, and the frames around it kept
+  size_t cut = 20 * MPEGTS_PACKET_SIZE;
+  memmove(seg + cut, seg + cut + MPEGTS_PACKET_SIZE,
+          len - cut - MPEGTS_PACKET_SIZE);
+  mpegts_demux_t d;
+  frames_t f = demux(&d, seg, len - MPEGTS_PACKET_SIZE, 500);
+  CHECK_EQ(d.cc_errors, 1);
+  CHECK_EQ(f.gaps, 1);
+  CHECK(f.frames < frame_count(31) && f.frames > frame_count(31) - 4);
+
+  // Junk between packets: skipped to the next sync byte, the rest kept
+  len -= MPEGTS_PACKET_SIZE;
+  uint8_t *shifted = malloc(len + 5);
+  memcpy(shifted, seg, cut);
+  memcpy(shifted + cut, "\x47junk", 5);
+  memcpy(shifted + cut + 5, seg + cut, len - cut);
+  f = demux(&d, shifted, len + 5, 188);
+  CHECK(d.resyncs > 0);
+  CHECK(f.ends_segment);
+  CHECK(f.frames > frame_count(31) - 8);
+  free(shifted);
+  free(seg);
+}
+
+static void test_demux_packed(void) {
+  size_t len;
+  uint8_t *seg = fixture_segment("packed", 5, &len);
+  CHECK(seg != NULL);
+  if (seg == NULL) {
+    return;
+  }
+  for (size_t chunk = 1; chunk <= 13; chunk += 3) {
+    mpegts_demux_t d;
+    frames_t f = demux(&d, seg, len, chunk);
+    CHECK(d.packed);
+    CHECK_EQ(d.packets, 0);
+    CHECK_EQ(f.frames, frame_count(5));
+    CHECK_EQ(f.bad, 0);
+    CHECK_EQ(f.gaps, 0);
+  }
+  free(seg);
+}
+
+/* ---------- the source element ---------- */
+
+typedef struct {
+  audio_element_handle_t el;
+  ringbuf_handle_t out;
+  sink_t sink;
+  bool done;
+} player_t;
+
+static void player_start(player_t *p, const char *path) {
+  memset(p, 0, sizeof(*p));
+  char uri[128];
+  snprintf(uri, sizeof(uri), "http://127.0.0.1:%d%s", server_port, path);
+  CHECK(hls_stream_is_source_uri(uri));
+  p->el = hls_stream_init(CODEC_TYPE_AAC, 0);
+  p->out = rb_create(16 * 1024, 1);
+  audio_element_set_output_ringbuf(p->el, p->out);
+  audio_element_set_uri(p->el, uri);
+  CHECK_EQ(audio_element_run(p->el), ESP_OK);
+}
+
+// What the element puts out, until it is done, for up to ms or until
+// frames whole segments have come
+static void player_read(player_t *p, int ms, int frames) {
+  char buf[4096];
+  int64_t until = esp_timer_get_time() + ms * 1000LL;
+  while (!p->done && esp_timer_get_time() < until) {
+    int n = rb_read(p->out, buf, sizeof(buf), 100);
+    if (n > 0) {
+      sink_out(&p->sink, (uint8_t *)buf, n);
+      frames_t f = walk_frames(p->sink.data, p->sink.len);
+      if (frames && f.frames >= frames && f.ends_segment) {
+        return;
+      }
+    } else if (n == RB_DONE || n == RB_ABORT) {
+      p->done = true;
+    }
+  }
+}
+
+static void player_stop(player_t *p) {
+  audio_element_deinit(p->el);
+  rb_destroy(p->out);
+  free(p->sink.data);
+}
+
+static void test_stream_vod(void) {
+  hls_stream_stats_t before, st;
+  hls_stream_get_stats(&before);
+  player_t p;
+  player_start(&p, "/vod/index.m3u8");
+  player_read(&p, 20000, 0);
+  CHECK(p.done);
+  frames_t f = walk_frames(p.sink.data, p.sink.len);
+  // Past the 16 segments a playlist keeps, to the end, with no ID3 tags
+  CHECK_EQ(f.frames, frames_of(0, 19));
+  CHECK_EQ(f.first_seq, 0);
+  CHECK_EQ(f.seq, 19);
+  CHECK_EQ(f.gaps, 0);
+  CHECK_EQ(f.bad, 0);
+  hls_stream_get_stats(&st);
+  CHECK_EQ(st.segments - before.segments, 20);
+  CHECK_EQ(st.skipped - before.skipped, 0);
+  CHECK_EQ(st.errors - before.errors, 0);
+  // Every request on one connection
+  CHECK_EQ(st.connections - before.connections, 1);
+  CHECK(st.requests - before.requests >= 21);
+  player_stop(&p);
+  hls_stream_get_stats(&st);
+  CHECK(!st.active);
+  CHECK_EQ(st.memory, 0);
+}
+
+static void test_stream_redirect(void) {
+  player_t p;
+  player_start(&p, "/redirect.m3u8");
+  player_read(&p, 10000, 0);
+  CHECK(p.done);
+  frames_t f = walk_frames(p.sink.data, p.sink.len);
+  CHECK_EQ(f.frames, frames_of(0, 2));
+  CHECK_EQ(f.gaps, 0);
+  CHECK_EQ(f.bad, 0);
+  player_stop(&p);
+}
+
+// Tried three times, then skipped: one segment missing, the rest played
+static void test_stream_skips_a_segment(void) {
+  hls_stream_stats_t before, st;
+  hls_stream_get_stats(&before);
+  player_t p;
+  player_start(&p, "/gone/index.m3u8");
+  player_read(&p, 15000, 0);
+  CHECK(p.done);
+  frames_t f = walk_frames(p.sink.data, p.sink.len);
+  CHECK_EQ(f.frames, frames_of(0, 3) - frame_count(2));
+  CHECK_EQ(f.gaps, 1);
+  CHECK_EQ(f.bad, 0);
+  CHECK_EQ(f.seq, 3);
+  hls_stream_get_stats(&st);
+  CHECK_EQ(st.skipped - before.skipped, 1);
+  CHECK_EQ(st.errors - before.errors, 3);
+  player_stop(&p);
+}
+
+static void test_stream_missing(void) {
+  hls_stream_stats_t before, st;
+  hls_stream_get_stats(&before);
+  player_t p;
+  player_start(&p, "/missing.m3u8");
+  player_read(&p, 10000, 0);
+  CHECK(p.done);
+  CHECK_EQ(p.sink.len, 0);
+  hls_stream_get_stats(&st);
+  CHECK_EQ(st.errors - before.errors, 1);
+  CHECK(!st.active);
+  player_stop(&p);
+}
+
+// Joins the live edge on the first audio variant, measures the link on the
+// first segment and moves up to 192 kb/s from the next one, seamlessly
+static void test_stream_live_switches_up(void) {
+  hls_stream_stats_t before, st;
+  hls_stream_get_stats(&before);
+  player_t p;
+  player_start(&p, "/live/master.m3u8");
+  player_read(&p, 10000, frames_of(0, 2));
+  hls_stream_get_stats(&st);
+  CHECK(st.active);
+  CHECK_EQ(st.variants, 3);
+  CHECK_EQ(st.variant, 1);
+  CHECK_EQ(st.variant_kbps, 192);
+  CHECK_EQ(st.target_ms, 2000);
+  CHECK(st.measured_kbps > 192 * 100 / HLS_BANDWIDTH_SHARE);
+  CHECK_EQ(st.switches - before.switches, 1);
+  CHECK(st.reloads > before.reloads);
+  frames_t f = walk_frames(p.sink.data, p.sink.len);
+  CHECK(!p.done);
+  CHECK(f.frames >= frames_of(0, 2));
+  CHECK_EQ(f.gaps, 0);
+  CHECK_EQ(f.bad, 0);
+  CHECK_EQ(f.switches, 1);
+  CHECK_EQ(f.first_variant, 0);
+  CHECK_EQ(f.variant, 1);
+  player_stop(&p);
+}
+
+int main(void) {
+  RUN_TEST(test_master_playlist);
+  RUN_TEST(test_live_window);
+  RUN_TEST(test_ended_playlist);
+  RUN_TEST(test_other_playlists);
+  RUN_TEST(test_resolve_uri);
+  RUN_TEST(test_demux_ts);
+  RUN_TEST(test_demux_packed);
+  CHECK(!hls_stream_is_source_uri("http://example.com/live.aac"));
+  CHECK(hls_stream_is_source_uri("http://example.com/LIVE.M3U8?token=1"));
+  if (!start_server()) {
+    printf("the HLS fixture server did not start\n");
+    return 1;
+  }
+  RUN_TEST(test_stream_vod);
+  RUN_TEST(test_stream_redirect);
+  RUN_TEST(test_stream_skips_a_segment);
+  RUN_TEST(test_stream_missing);
+  RUN_TEST(test_stream_live_switches_up);
+  stop_server();
+  return host_test_result();
+}
@@ -0,0 +1,91 @@
+/* Input bus: before and after input_bus_init() */
+#include "esp_timer.h"
+#include "host_test.h"
+#include "input_bus.h"
+
+static int completed;
+static esp_err_t completed_result;
+
+static void on_complete(const input_event_t *event, esp_err_t result,
+                        int64_t done_us) {
+  completed++;
+  completed_result = result;
+}
+
+static void test_receive_before_init_waits(void) {
+  input_event_t event;
+  CHECK(!input_bus_post_simple(INPUT_EVENT_CLICK, INPUT_SOURCE_BUTTON,
+                               INPUT_CONTROL_VOLUME, 0));
+  // A consumer started too early must not spin
+  int64_t start = esp_timer_get_time();
+  CHECK(!input_bus_receive(&event, pdMS_TO_TICKS(50)));
+  CHECK(esp_timer_get_time() - start >= 50 * 1000);
+}
+
+static void test_post_and_receive(void) {
+  CHECK_EQ(input_bus_init(), ESP_OK);
+  CHECK_EQ(input_bus_init(), ESP_OK); // a second call keeps the bus
+  CHECK(input_bus_post_simple(INPUT_EVENT_VOLUME_SET, INPUT_SOURCE_ENCODER,
+                              INPUT_CONTROL_VOLUME, 42));
+  CHECK(input_bus_post_simple(INPUT_EVENT_CLICK, INPUT_SOURCE_BUTTON,
+                              INPUT_CONTROL_STATION, 0));
+  input_event_t event;
+  CHECK(input_bus_receive(&event, 0));
+  CHECK_EQ(event.type, INPUT_EVENT_VOLUME_SET);
+  CHECK_EQ(event.source, INPUT_SOURCE_ENCODER);
+  CHECK_EQ(event.value, 42);
+  CHECK(event.timestamp_us > 0);
+  CHECK(input_bus_receive(&event, 0));
+  CHECK_EQ(event.type, INPUT_EVENT_CLICK);
+  CHECK_EQ(event.control, INPUT_CONTROL_STATION);
+  CHECK(!input_bus_receive(&event, 0));
+}
+
+static void test_full_bus_drops(void) {
+  int posted = 0;
+  while (posted < 100 && input_bus_post_simple(INPUT_EVENT_STATION_STEP,
+                                               INPUT_SOURCE_WEB,
+                                               INPUT_CONTROL_NONE, posted)) {
+    posted++;
+  }
+  CHECK(posted > 0 && posted < 100);
+  input_event_t event;
+  for (int i = 0; i < posted; i++) {
+    CHECK(input_bus_receive(&event, 0));
+    CHECK_EQ(event.value, i);
+  }
+  CHECK(!input_bus_receive(&event, 0));
+}
+
+static void test_completion_only_with_request_id(void) {
+  input_bus_set_complete_cb(on_complete);
+  input_event_t event = {.type = INPUT_EVENT_MUTE};
+  input_bus_complete(&event, ESP_OK);
+  CHECK_EQ(completed, 0);
+  event.request_id = input_bus_new_request_id();
+  CHECK(event.request_id != 0);
+  CHECK(input_bus_new_request_id() != event.request_id);
+  input_bus_complete(&event, ESP_ERR_INVALID_STATE);
+  CHECK_EQ(completed, 1);
+  CHECK_EQ(completed_result, ESP_ERR_INVALID_STATE);
+  input_bus_set_complete_cb(NULL);
+}
+
+static void test_user_sources_wake_the_display(void) {
+  CHECK(input_source_is_user(INPUT_SOURCE_BUTTON));
+  CHECK(input_source_is_user(INPUT_SOURCE_ENCODER));
+  CHECK(input_source_is_user(INPUT_SOURCE_WEB));
+  CHECK(input_source_is_user(INPUT_SOURCE_IR));
+  CHECK(!input_source_is_user(INPUT_SOURCE_MULTIROOM));
+  CHECK(!input_source_is_user(INPUT_SOURCE_SCHEDULE));
+  CHECK(!input_source_is_user(INPUT_SOURCE_PLAYER));
+}
+
+int main(void) {
+  RUN_TEST(test_receive_before_init_waits);
+  RUN_TEST(test_post_and_receive);
+  RUN_TEST(test_full_bus_drops);
+  RUN_TEST(test_completion_only_with_request_id);
+  RUN_TEST(test_user_sources_wake_the_display);
+  return host_test_result();
+}
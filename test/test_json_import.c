@@ -0,0 +1,135 @@
+/* Streaming JSON: the tokenizer fed in chunks of every small size, and
+ * the station list import and save on top of it. The store works in
+ * STATION_STORE_DIR, a scratch directory. */
+#include "host_test.h"
+#include "json_stream.h"
+#include "station_data.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char tokens[4096];
+static size_t tokens_len;
+
+// Writes each token as a short tag, e.g. K2(call_sign) for a key at depth 2
+static esp_err_t record_token(const json_token_t *token, void *ctx) {
+  static const char *const tags[] = {"{", "}", "[", "]", "K",
+                                     "S", "N", "B", "Z"};
+  size_t room = sizeof(tokens) - tokens_len;
+  int n = snprintf(tokens + tokens_len, room, "%s%d", tags[token->type],
+                   token->depth);
+  if (token->type == JSON_TOKEN_KEY || token->type == JSON_TOKEN_STRING) {
+    n += snprintf(tokens + tokens_len + n, room - n, "(%s)", token->str);
+  } else if (token->type == JSON_TOKEN_NUMBER) {
+    n += snprintf(tokens + tokens_len + n, room - n, "(%g)", token->number);
+  } else if (token->type == JSON_TOKEN_BOOL) {
+    n += snprintf(tokens + tokens_len + n, room - n, "(%d)", token->boolean);
+  }
+  tokens_len += n + snprintf(tokens + tokens_len + n, room - n, " ");
+  return ESP_OK;
+}
+
+static esp_err_t tokenize(const char *doc, size_t chunk) {
+  json_stream_t js;
+  json_stream_init(&js, record_token, NULL);
+  tokens_len = 0;
+  tokens[0] = '\0';
+  size_t len = strlen(doc);
+  esp_err_t ret = ESP_OK;
+  for (size_t i = 0; i < len && ret == ESP_OK; i += chunk) {
+    ret = json_stream_feed(&js, doc + i, len - i < chunk ? len - i : chunk);
+  }
+  return ret == ESP_OK ? json_stream_finish(&js) : ret;
+}
+
+static void test_tokens_independent_of_chunking(void) {
+  const char *doc = "[ {\"a\\u00e9\\n\":-1.5e2,\"b\":[true,false,null],"
+                    "\"c\":\"\\ud83d\\ude00\\\"x\"}, 42 ]";
+  CHECK_EQ(tokenize(doc, 1024), ESP_OK);
+  CHECK_STR(tokens, "[0 {1 K2(a\xc3\xa9\n) N2(-150) K2(b) [2 B3(1) B3(0) Z3 ]2 "
+                    "K2(c) S2(\xf0\x9f\x98\x80\"x) }1 N1(42) ]0 ");
+  char whole[sizeof(tokens)];
+  strcpy(whole, tokens);
+  for (size_t chunk = 1; chunk < 8; chunk++) {
+    CHECK_EQ(tokenize(doc, chunk), ESP_OK);
+    CHECK_STR(tokens, whole);
+  }
+}
+
+static void test_malformed_documents(void) {
+  CHECK_EQ(tokenize("[1,]", 1), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(tokenize("{\"a\" 1}", 1), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(tokenize("[1] x", 1), ESP_ERR_INVALID_ARG);
+  CHECK(tokenize("[", 1) != ESP_OK);
+  CHECK(tokenize("tru", 1) != ESP_OK);
+  CHECK_EQ(tokenize("[\"a\x01\"]", 1), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(tokenize("[[[[[[[[[1]]]]]]]]]", 3), ESP_ERR_INVALID_SIZE);
+  CHECK_EQ(tokenize("7", 1), ESP_OK);
+  CHECK_EQ(tokenize("{}", 1), ESP_OK);
+}
+
+static void test_import_assigns_ids_and_skips_unknown_members(void) {
+  CHECK_EQ(update_stations_from_json(
+               "[{\"call_sign\":\"A\",\"origin\":\"o\",\"uri\":\"http://x\","
+               "\"codec\":1,\"extra\":{\"z\":[1,2]}},"
+               "{\"id\":7,\"call_sign\":\"B\",\"origin\":\"\","
+               "\"uri\":\"https://y\",\"codec\":0}]"),
+           0);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_EQ(s->count, 2);
+  if (s->count == 2) {
+    CHECK_EQ(s->stations[1].id, 7);
+    CHECK_EQ(s->stations[0].id, 8);
+    CHECK_STR(s->stations[0].uri, "http://x");
+    CHECK_EQ(s->stations[0].codec, CODEC_TYPE_AAC);
+  }
+  station_snapshot_release(s);
+}
+
+static void test_invalid_station_keeps_the_list(void) {
+  static const char *const bad[] = {
+      "[{\"call_sign\":\"A\",\"origin\":\"o\",\"uri\":\"ftp://x\","
+      "\"codec\":1}]",
+      "[{\"call_sign\":\"A\",\"origin\":\"o\",\"uri\":\"http://x\","
+      "\"codec\":9}]",
+      "[{\"call_sign\":\"A\",\"uri\":\"http://x\",\"codec\":1}]",
+      "[{\"call_sign\":\"\",\"origin\":\"o\",\"uri\":\"http://x\","
+      "\"codec\":1}]",
+      "{}",
+  };
+  uint32_t version = station_data_version();
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    CHECK_EQ(update_stations_from_json(bad[i]), -1);
+  }
+  CHECK_EQ(station_data_version(), version);
+}
+
+static void test_error_names_the_station(void) {
+  station_json_import_t *import = station_json_import_begin();
+  const char *doc = "[{\"call_sign\":\"A\",\"origin\":\"o\",\"uri\":"
+                    "\"http://x\",\"codec\":1},{\"call_sign\":\"B\"}]";
+  CHECK(station_json_import_feed(import, doc, strlen(doc)) != ESP_OK);
+  CHECK_STR(station_json_import_error(import),
+            "station 2: call_sign, origin, uri and codec are required");
+  station_json_import_free(import);
+}
+
+static void test_save_reports_failure(void) {
+  // What POST /api/stations answers with a 500
+  remove(STATION_STORE_DIR "/stations.bin");
+  remove(STATION_STORE_DIR "/stations.jnl");
+  rmdir(STATION_STORE_DIR);
+  CHECK_EQ(save_station_data(), -1);
+  mkdir(STATION_STORE_DIR, 0755);
+  CHECK_EQ(save_station_data(), 0);
+}
+
+int main(void) {
+  RUN_TEST(test_tokens_independent_of_chunking);
+  RUN_TEST(test_malformed_documents);
+  RUN_TEST(test_import_assigns_ids_and_skips_unknown_members);
+  RUN_TEST(test_invalid_station_keeps_the_list);
+  RUN_TEST(test_error_names_the_station);
+  RUN_TEST(test_save_reports_failure);
+  return host_test_result();
+}
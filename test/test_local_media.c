@@ -0,0 +1,273 @@
+/* Local playback: local_media.c finds the folders under SD_CARD_MOUNT_POINT,
+ * a scratch directory, and feeds the files through its read-ahead ring to
+ * the decoder's read callback, read here as the decoder would. Checked are
+ * the bytes the decoder gets against the files, where seeks land, pausing,
+ * the end of a track, and the track lists. */
+#define _GNU_SOURCE
+#include "host_test.h"
+#include "local_media.h"
+#include "media_gen.h"
+#include "sd_card.h"
+#include <ftw.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALBUM SD_CARD_MOUNT_POINT "/Music/Album"
+#define PODCASTS SD_CARD_MOUNT_POINT "/Podcasts"
+#define RATE 44100
+#define FLAC_BYTE_RATE 110000
+#define SECONDS 10
+#define PICTURE (100 * 1024) // more than the first read
+
+static media_gen_t intro, song, outro, pod_a, pod_b;
+static uint64_t played; // file offset the decoder has read up to
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  return remove(path);
+}
+
+static void make_card(void) {
+  nftw(SD_CARD_MOUNT_POINT, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+  mkdir(SD_CARD_MOUNT_POINT, 0755);
+  mkdir(SD_CARD_MOUNT_POINT "/Music", 0755);
+  mkdir(ALBUM, 0755);
+  mkdir(PODCASTS, 0755);
+  intro = media_gen_flac(ALBUM "/1 Intro.flac", RATE, SECONDS, FLAC_BYTE_RATE,
+                         PICTURE);
+  song = media_gen_flac(ALBUM "/2 Song.flac", RATE, SECONDS, FLAC_BYTE_RATE,
+                        PICTURE);
+  outro = media_gen_mp3(ALBUM "/10 Outro.mp3", 400, 2000);
+  // Not played: cover art, and MP4
+  fclose(fopen(ALBUM "/cover.jpg", "w"));
+  fclose(fopen(ALBUM "/3 Bonus.m4a", "w"));
+  pod_a = media_gen_mp3(PODCASTS "/a.mp3", 100, 0);
+  pod_b = media_gen_mp3(PODCASTS "/b.mp3", 120, 0);
+  FILE *list = fopen(PODCASTS "/list.m3u", "w");
+  fputs("#EXTM3U\nb.mp3\nhttp://example.com/c.mp3\na.mp3\n", list);
+  fclose(list);
+}
+
+static uint8_t *read_file(const char *path, long *len) {
+  FILE *f = fopen(path, "rb");
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *buf = malloc(*len);
+  CHECK_EQ(fread(buf, 1, *len, f), *len);
+  fclose(f);
+  return buf;
+}
+
+// As the decoder: up to len bytes, waiting out the read-ahead. Returns
+// the bytes read, short only at the end of the file.
+static int decoder_read(uint8_t *buf, int len) {
+  int got = 0;
+  for (int tries = 0; got < len && tries < 100;) {
+    int n = local_media_source_read(NULL, (char *)buf + got, len - got, 100,
+                                    NULL);
+    if (n == AEL_IO_DONE) {
+      break;
+    }
+    if (n == AEL_IO_TIMEOUT) {
+      tries++;
+      continue;
+    }
+    CHECK(n > 0);
+    got += n;
+  }
+  played += got;
+  return got;
+}
+
+// Plays folder's track from the start, as a track change does
+static void play(int folder, int track) {
+  CHECK_EQ(local_media_play(folder, track), ESP_OK);
+  played = 0;
+}
+
+// Seeks, and checks the decoder next gets the frame at or after target
+static void check_seek(int seconds, const uint8_t *file, const media_gen_t *gen,
+                       int64_t target) {
+  CHECK_EQ(local_media_seek(seconds), ESP_OK);
+  if (target < gen->audio_start) {
+    target = gen->audio_start;
+  }
+  long frames = (target - gen->audio_start + gen->frame_len - 1) / gen->frame_len;
+  long lands = gen->audio_start + frames * gen->frame_len;
+  uint8_t buf[4096];
+  int n = decoder_read(buf, sizeof(buf));
+  if (lands >= gen->size) {
+    CHECK_EQ(n, 0);
+    CHECK(local_media_source_done());
+    return;
+  }
+  CHECK_EQ(n, MIN((long)sizeof(buf), gen->size - lands));
+  CHECK(memcmp(buf, file + lands, n) == 0);
+  played = lands + n;
+}
+
+static void test_finds_folders_and_tracks(void) {
+  for (int i = 0; i < 200 && !local_media_available(); i++) {
+    usleep(10 * 1000);
+  }
+  CHECK(local_media_available());
+  // A directory with a playlist is listed both ways
+  CHECK_EQ(local_media_folder_count(), 3);
+  char name[64];
+  CHECK(local_media_folder_name(0, name, sizeof(name)));
+  CHECK_STR(name, "Album");
+  CHECK(local_media_folder_name(1, name, sizeof(name)));
+  CHECK_STR(name, "Podcasts");
+  CHECK(local_media_folder_name(2, name, sizeof(name)));
+  CHECK_STR(name, "list");
+
+  // Numbers in names by value; files that aren't playable left out
+  media_tracks_t list;
+  CHECK_EQ(local_media_copy_tracks(0, &list), 3);
+  CHECK(strstr(media_track_path(&list, 0), "/1 Intro.flac") != NULL);
+  CHECK(strstr(media_track_path(&list, 1), "/2 Song.flac") != NULL);
+  CHECK(strstr(media_track_path(&list, 2), "/10 Outro.mp3") != NULL);
+  media_tracks_free(&list);
+  CHECK_EQ(local_media_copy_tracks(1, &list), 2);
+  CHECK(strstr(media_track_path(&list, 0), "/a.mp3") != NULL);
+  media_tracks_free(&list);
+  // A playlist in its own order, without URLs
+  CHECK_EQ(local_media_copy_tracks(2, &list), 2);
+  CHECK(strstr(media_track_path(&list, 0), "/b.mp3") != NULL);
+  CHECK(strstr(media_track_path(&list, 1), "/a.mp3") != NULL);
+  media_tracks_free(&list);
+  CHECK_EQ(local_media_copy_tracks(3, &list), -1);
+}
+
+// Through the ring several times over, byte for byte, to the end
+static void test_plays_a_file_whole(void) {
+  CHECK(!local_media_is_active());
+  CHECK_EQ(local_media_enter(), ESP_OK);
+  played = 0;
+  CHECK(local_media_is_active());
+  long len;
+  uint8_t *file = read_file(ALBUM "/1 Intro.flac", &len);
+  CHECK_EQ(len, intro.size);
+  CHECK(len > 2 * LOCAL_MEDIA_RING_SIZE);
+  uint8_t *got = malloc(len + 4096);
+  long total = 0;
+  int n;
+  while ((n = decoder_read(got + total, 4096)) > 0) {
+    total += n;
+  }
+  CHECK_EQ(total, len);
+  CHECK(memcmp(got, file, len) == 0);
+  CHECK(local_media_source_done());
+  free(got);
+  free(file);
+
+  local_media_stats_t st;
+  local_media_get_stats(&st);
+  CHECK(st.active);
+  CHECK_EQ(st.folder, 0);
+  CHECK_EQ(st.track, 0);
+  CHECK_EQ(st.tracks, 3);
+  CHECK_EQ(st.bytes_read, len);
+  CHECK(st.memory >= LOCAL_MEDIA_RING_SIZE);
+}
+
+// FLAC: by the STREAMINFO byte rate, to the next frame
+static void test_seek_lands_on_a_frame(void) {
+  play(0, 1);
+  long len;
+  uint8_t *file = read_file(ALBUM "/2 Song.flac", &len);
+  uint8_t buf[4096];
+  for (int i = 0; i < 32; i++) {
+    decoder_read(buf, sizeof(buf));
+  }
+  int64_t rate = (song.size - song.audio_start) / SECONDS;
+  int64_t at = played;
+  check_seek(3, file, &song, at + 3 * rate);
+  at = played;
+  check_seek(-1, file, &song, at - rate);
+  // Back past the start: the first frame, behind the cover art
+  check_seek(-60, file, &song, 0);
+  // Past the end: the track is over
+  check_seek(60, file, &song, song.size);
+
+  local_media_stats_t st;
+  local_media_get_stats(&st);
+  CHECK_EQ(st.seeks, 4);
+  free(file);
+}
+
+// MP3: the tag is skipped, the byte rate assumed until it is measured
+static void test_seek_in_mp3(void) {
+  play(0, 2);
+  long len;
+  uint8_t *file = read_file(ALBUM "/10 Outro.mp3", &len);
+  uint8_t buf[4096];
+  CHECK_EQ(decoder_read(buf, sizeof(buf)), sizeof(buf));
+  CHECK(memcmp(buf, file, sizeof(buf)) == 0);
+  int64_t at = played;
+  check_seek(2, file, &outro, at + 2 * 128000 / 8);
+  check_seek(-10, file, &outro, 0);
+  free(file);
+}
+
+static void test_pause_holds_the_place(void) {
+  play(2, 0);
+  long len;
+  uint8_t *file = read_file(PODCASTS "/b.mp3", &len);
+  CHECK_EQ(len, pod_b.size);
+  uint8_t buf[1000];
+  CHECK_EQ(decoder_read(buf, sizeof(buf)), sizeof(buf));
+  CHECK_EQ(local_media_pause(1), ESP_OK);
+  CHECK_EQ(local_media_source_read(NULL, (char *)buf, sizeof(buf), 50, NULL),
+           AEL_IO_TIMEOUT);
+  local_media_stats_t st;
+  local_media_get_stats(&st);
+  CHECK(st.paused);
+  CHECK_EQ(local_media_pause(-1), ESP_OK);
+  CHECK_EQ(decoder_read(buf, sizeof(buf)), sizeof(buf));
+  CHECK(memcmp(buf, file + sizeof(buf), sizeof(buf)) == 0);
+  free(file);
+}
+
+static void test_step_wraps_around(void) {
+  play(0, 0);
+  CHECK_EQ(local_media_step(-1), ESP_OK);
+  local_media_stats_t st;
+  local_media_get_stats(&st);
+  CHECK_EQ(st.track, 2);
+  char name[64];
+  CHECK(local_media_track_name(st.track, name, sizeof(name)));
+  CHECK_STR(name, "10 Outro");
+  CHECK_EQ(local_media_step(1), ESP_OK);
+  local_media_get_stats(&st);
+  CHECK_EQ(st.track, 0);
+  CHECK_EQ(local_media_play(0, 3), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(local_media_play(3, 0), ESP_ERR_INVALID_ARG);
+}
+
+static void test_leave(void) {
+  local_media_leave();
+  CHECK(!local_media_is_active());
+  CHECK_EQ(local_media_step(1), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(local_media_seek(10), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(local_media_pause(1), ESP_ERR_INVALID_STATE);
+  local_media_source_close();
+}
+
+int main(void) {
+  make_card();
+  CHECK(local_media_is_source_uri(LOCAL_MEDIA_URI_PREFIX "/sdcard/a.mp3"));
+  CHECK(!local_media_is_source_uri("http://example.com/a.mp3"));
+  CHECK_EQ(local_media_init(), ESP_OK);
+  RUN_TEST(test_finds_folders_and_tracks);
+  RUN_TEST(test_plays_a_file_whole);
+  RUN_TEST(test_seek_lands_on_a_frame);
+  RUN_TEST(test_seek_in_mp3);
+  RUN_TEST(test_pause_holds_the_place);
+  RUN_TEST(test_step_wraps_around);
+  RUN_TEST(test_leave);
+  return host_test_result();
+}
@@ -0,0 +1,184 @@
+/* Multi-room sync over the network stack: a leader and two followers, each
+ * a multiroom_node process with a crystal of its own, play the synthetic
+ * station over multicast and the clock exchange on this machine. What
+ * their DACs play is compared on CLOCK_MONOTONIC, which they share.
+ *
+ * Skipped (77) where multicast sent here is not looped back to this
+ * machine's own sockets, as in a network namespace without a route. */
+#define _GNU_SOURCE
+#include "host_test.h"
+#include "multiroom_proto.h"
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define RATE 44100
+#define MAX_SAMPLES 4096
+// From when a follower first plays until its skew is held to the limit
+#define SETTLE_US 6000000
+#define MAX_SKEW_US 5000
+
+extern char **environ;
+
+typedef struct {
+  const char *role;
+  double start_s; // after the first unit
+  double run_s;
+  const char *ppm;
+  const char *offset_us;
+  char log[64];
+  pid_t pid;
+  int64_t at_us[MAX_SAMPLES];
+  int64_t sample[MAX_SAMPLES];
+  int count;
+  char stats[256];
+} node_t;
+
+// The leader starts once one follower listens; the second joins late
+static node_t nodes[] = {
+    {.role = "follower", .start_s = 0, .run_s = 16, .ppm = "-40",
+     .offset_us = "1200000000"},
+    {.role = "leader", .start_s = 0.3, .run_s = 15.7, .ppm = "20",
+     .offset_us = "0"},
+    {.role = "follower", .start_s = 3, .run_s = 13, .ppm = "45",
+     .offset_us = "330000000"},
+};
+#define NODES (int)(sizeof(nodes) / sizeof(nodes[0]))
+#define LEADER 1
+
+static bool multicast_loops_back(void) {
+  int rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  int tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  int one = 1;
+  setsockopt(rx, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_port = htons(MR_DATA_PORT),
+                             .sin_addr.s_addr = htonl(INADDR_ANY)};
+  struct ip_mreq mreq = {.imr_interface.s_addr = htonl(INADDR_ANY)};
+  inet_aton(MR_GROUP_ADDR, &mreq.imr_multiaddr);
+  bool ok = bind(rx, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+            setsockopt(rx, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+                       sizeof(mreq)) == 0;
+  addr.sin_addr = mreq.imr_multiaddr;
+  ok = ok && sendto(tx, "probe", 5, 0, (struct sockaddr *)&addr,
+                    sizeof(addr)) == 5;
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(rx, &fds);
+  struct timeval tv = {.tv_sec = 0, .tv_usec = 500000};
+  ok = ok && select(rx + 1, &fds, NULL, NULL, &tv) == 1;
+  close(rx);
+  close(tx);
+  return ok;
+}
+
+static bool spawn(node_t *n, int index) {
+  snprintf(n->log, sizeof(n->log), "multiroom_node_%d.log", index);
+  char seconds[16];
+  snprintf(seconds, sizeof(seconds), "%.1f", n->run_s);
+  char *argv[] = {MULTIROOM_NODE,   (char *)n->role,      seconds,
+                  (char *)n->ppm, (char *)n->offset_us, n->log,
+                  NULL};
+  return posix_spawn(&n->pid, MULTIROOM_NODE, NULL, NULL, argv, environ) == 0;
+}
+
+static void read_log(node_t *n) {
+  FILE *f = fopen(n->log, "r");
+  CHECK(f != NULL);
+  if (f == NULL) {
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    long long at, sample;
+    if (sscanf(line, "h %lld %lld", &at, &sample) == 2 &&
+        n->count < MAX_SAMPLES) {
+      n->at_us[n->count] = at;
+      n->sample[n->count] = sample;
+      n->count++;
+    } else if (line[0] == 's') {
+      snprintf(n->stats, sizeof(n->stats), "%s", line + 2);
+    }
+  }
+  fclose(f);
+}
+
+// The leader's media sample at time t, from its nearest earlier note
+static bool leader_sample_at(int64_t t, double *sample) {
+  const node_t *l = &nodes[LEADER];
+  for (int i = l->count - 1; i >= 0; i--) {
+    if (l->at_us[i] <= t) {
+      if (t - l->at_us[i] > 50000) {
+        return false; // not playing then
+      }
+      *sample = l->sample[i] + (t - l->at_us[i]) * (RATE / 1e6);
+      return true;
+    }
+  }
+  return false;
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void check_follower(const node_t *n) {
+  static double skew[MAX_SAMPLES];
+  int count = 0;
+  int64_t first = 0, last = 0;
+  for (int i = 0; i < n->count; i++) {
+    double at_leader;
+    if (n->at_us[i] - n->at_us[0] >= SETTLE_US &&
+        leader_sample_at(n->at_us[i], &at_leader)) {
+      skew[count++] = fabs(n->sample[i] - at_leader) * 1e6 / RATE;
+      first = first ? first : n->at_us[i];
+      last = n->at_us[i];
+    }
+  }
+  // At least 5 s of the follower playing in step
+  CHECK(last - first >= 5000000);
+  if (count == 0) {
+    return;
+  }
+  qsort(skew, count, sizeof(skew[0]), compare_double);
+  printf("  %s (%s ppm): %d notes, skew median %.0f us, p99 %.0f us, "
+         "max %.0f us\n  %s",
+         n->log, n->ppm, count, skew[count / 2], skew[count * 99 / 100],
+         skew[count - 1], n->stats);
+  CHECK(skew[count - 1] < MAX_SKEW_US);
+}
+
+int main(void) {
+  if (!multicast_loops_back()) {
+    printf("multicast to %s does not loop back here, skipped\n",
+           MR_GROUP_ADDR);
+    return 77;
+  }
+  for (int i = 0; i < NODES; i++) {
+    double wait = nodes[i].start_s - (i > 0 ? nodes[i - 1].start_s : 0);
+    usleep((useconds_t)(wait * 1e6));
+    CHECK(spawn(&nodes[i], i));
+  }
+  for (int i = 0; i < NODES; i++) {
+    int status;
+    CHECK(waitpid(nodes[i].pid, &status, 0) == nodes[i].pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    read_log(&nodes[i]);
+  }
+  printf("  leader: %d notes\n  %s", nodes[LEADER].count,
+         nodes[LEADER].stats);
+  CHECK(nodes[LEADER].count > 0);
+  for (int i = 0; i < NODES; i++) {
+    if (i != LEADER) {
+      check_follower(&nodes[i]);
+    }
+  }
+  return host_test_result();
+}
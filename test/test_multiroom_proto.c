@@ -0,0 +1,324 @@
+/* Multi-room wire format, framing, clock filter, servo and resampler, and
+ * the three together: a leader and followers with drifting crystals, in
+ * simulated time */
+#include "host_test.h"
+#include "multiroom_proto.h"
+#include <math.h>
+#include <stdlib.h>
+
+// MPEG-1 layer III, 128 kb/s, 44.1 kHz, no CRC: 417 bytes, 1152 samples
+static const uint8_t mp3_header[4] = {0xff, 0xfb, 0x90, 0x00};
+
+static void test_packet_round_trip(void) {
+  uint8_t buf[MR_PACKET_MAX];
+  mr_packet_t p = {.session = 0xdeadbeef,
+                   .seq = 77,
+                   .t0_us = -5,
+                   .media_us = 123456789012LL,
+                   .duration_us = 26122,
+                   .codec = 1,
+                   .flags = MR_FLAG_SYNC_POINT,
+                   .payload_len = 1000};
+  mr_packet_t q;
+  mr_packet_encode(&p, buf);
+  CHECK(mr_packet_decode(&q, buf, MR_HEADER_LEN + 1000));
+  CHECK_EQ(q.session, p.session);
+  CHECK_EQ(q.seq, 77);
+  CHECK_EQ(q.t0_us, -5);
+  CHECK_EQ(q.media_us, p.media_us);
+  CHECK_EQ(q.duration_us, 26122);
+  CHECK_EQ(q.codec, 1);
+  CHECK_EQ(q.flags, MR_FLAG_SYNC_POINT);
+  // Shorter than the payload it announces
+  CHECK(!mr_packet_decode(&q, buf, MR_HEADER_LEN + 999));
+  // A clock message is not a data packet
+  mr_clock_msg_t m = {.seq = 1};
+  mr_clock_encode(&m, buf);
+  CHECK(!mr_packet_decode(&q, buf, MR_PACKET_MAX));
+}
+
+static void test_clock_round_trip(void) {
+  uint8_t buf[MR_CLOCK_LEN];
+  mr_clock_msg_t m = {.seq = 9,
+                      .t1_us = 1,
+                      .t2_us = -2,
+                      .t3_us = 3000000000000LL,
+                      .error_us = -700,
+                      .fill_ms = 480};
+  mr_clock_msg_t n;
+  mr_clock_encode(&m, buf);
+  CHECK(mr_clock_decode(&n, buf, MR_CLOCK_LEN));
+  CHECK_EQ(n.seq, 9);
+  CHECK_EQ(n.t1_us, 1);
+  CHECK_EQ(n.t2_us, -2);
+  CHECK_EQ(n.t3_us, 3000000000000LL);
+  CHECK_EQ(n.error_us, -700);
+  CHECK_EQ(n.fill_ms, 480);
+  CHECK(!mr_clock_decode(&n, buf, MR_CLOCK_LEN - 1));
+}
+
+static void test_mpeg_frames(void) {
+  uint8_t b[8] = {0};
+  memcpy(b, mp3_header, 4);
+  mr_frame_t f;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), 1);
+  CHECK_EQ(f.len, 417);
+  CHECK_EQ(f.duration_us, 26122);
+  CHECK(f.independent);
+  // main_data_begin reaches into earlier frames
+  b[4] = 0x80;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), 1);
+  CHECK(!f.independent);
+  // Padding
+  b[2] |= 0x02;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), 1);
+  CHECK_EQ(f.len, 418);
+  // The side information is needed to tell
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 5, &f), 0);
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 3, &f), 0);
+  // Free format and bad sample rates are not frames
+  b[2] = 0x00;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), -1);
+  b[2] = 0x9c;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), -1);
+  b[0] = 0xfe;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_MPEG, b, 8, &f), -1);
+}
+
+static void test_adts_frames(void) {
+  // AAC LC, 44.1 kHz, stereo, 371 bytes, one raw block
+  const uint8_t b[7] = {0xff, 0xf1, 0x50, 0x80, 0x2e, 0x7f, 0xfc};
+  mr_frame_t f;
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_ADTS, b, 7, &f), 1);
+  CHECK_EQ(f.len, 371);
+  CHECK_EQ(f.duration_us, 23219);
+  CHECK(f.independent);
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_ADTS, b, 6, &f), 0);
+  // An MP3 header is not ADTS
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_ADTS, mp3_header, 4, &f), 0);
+  uint8_t mp3[7] = {0xff, 0xfb, 0x90, 0, 0, 0, 0};
+  CHECK_EQ(mr_frame_parse(MR_FRAMING_ADTS, mp3, 7, &f), -1);
+}
+
+// An exchange with the leader offset_us ahead, d1 and d2 one-way delays
+static void exchange(mr_clock_t *c, int64_t t1, int64_t offset_us, int64_t d1,
+                     int64_t d2) {
+  int64_t t2 = t1 + offset_us + d1;
+  int64_t t3 = t2 + 100;
+  mr_clock_add(c, t1, t2, t3, t3 - offset_us + d2);
+}
+
+static void test_clock_filter_takes_shortest_round_trip(void) {
+  mr_clock_t c;
+  mr_clock_reset(&c);
+  // Queueing on the way out makes an exchange asymmetric
+  exchange(&c, 0, 5000000, 9000, 1000);
+  exchange(&c, 50000, 5000000, 1000, 1000);
+  exchange(&c, 100000, 5000000, 6000, 1000);
+  CHECK(!c.locked);
+  exchange(&c, 150000, 5000000, 1200, 1300);
+  CHECK(c.locked);
+  CHECK_EQ(c.offset_us, 5000000);
+  CHECK_EQ(c.delay_us, 2000);
+  // A leader clock that jumped is stepped to once its exchanges win
+  for (int i = 0; i < MR_CLOCK_WINDOW; i++) {
+    exchange(&c, 200000 + i * 250000, 5100000, 900, 900);
+  }
+  CHECK_EQ(c.offset_us, 5100000);
+  CHECK_EQ(c.steps, 1);
+  // A round trip that came out negative is ignored
+  mr_clock_add(&c, 1000, 0, 5000, 2000);
+  CHECK_EQ(c.offset_us, 5100000);
+}
+
+static void test_servo_steps_then_slews(void) {
+  mr_servo_t s;
+  mr_servo_reset(&s);
+  // The first measurement, and any beyond MR_SERVO_STEP_US, are jumped
+  CHECK_EQ(mr_servo_update(&s, -500000), -500000);
+  CHECK_EQ(s.steps, 1);
+  CHECK_EQ(mr_servo_update(&s, 3000), 0);
+  CHECK_EQ(mr_servo_update(&s, 3000), 0);
+  CHECK(s.ppm > 0); // late: play faster
+  CHECK(s.ppm <= MR_SERVO_MAX_PPM);
+  CHECK_EQ(mr_servo_update(&s, MR_SERVO_STEP_US + 1), MR_SERVO_STEP_US + 1);
+  CHECK_EQ(s.steps, 2);
+  for (int i = 0; i < 100; i++) {
+    mr_servo_update(&s, -15000);
+  }
+  CHECK_EQ(s.ppm, -MR_SERVO_MAX_PPM);
+}
+
+static void test_resampler_ratio(void) {
+  enum { BLOCK = 1152, BLOCKS = 1000 };
+  static int16_t in[BLOCK * 2];
+  static int16_t out[(BLOCK + BLOCK / 1000 + 2) * 2];
+  for (int ppm = -MR_SERVO_MAX_PPM; ppm <= MR_SERVO_MAX_PPM;
+       ppm += MR_SERVO_MAX_PPM) {
+    mr_resampler_t r;
+    mr_resampler_reset(&r, 2);
+    long total = 0;
+    bool in_range = true;
+    for (int b = 0; b < BLOCKS; b++) {
+      for (int i = 0; i < BLOCK; i++) {
+        in[2 * i] = (int16_t)(b * BLOCK + i);
+        in[2 * i + 1] = -1000;
+      }
+      size_t n = mr_resample(&r, in, BLOCK, out, ppm);
+      for (size_t i = 0; i < n; i++) {
+        in_range &= out[2 * i + 1] == -1000;
+      }
+      total += n;
+    }
+    long expected = (long)llround(BLOCK * BLOCKS / (1 + ppm / 1e6));
+    CHECK(labs(total - expected) <= 2);
+    CHECK(in_range);
+  }
+  // Unchanged at 0 ppm, a frame late: the last of a block is held over
+  mr_resampler_t r;
+  mr_resampler_reset(&r, 2);
+  for (int i = 0; i < BLOCK * 2; i++) {
+    in[i] = (int16_t)i;
+  }
+  CHECK_EQ(mr_resample(&r, in, BLOCK, out, 0), BLOCK - 1);
+  CHECK(memcmp(in, out, (BLOCK - 1) * 2 * sizeof(int16_t)) == 0);
+  CHECK_EQ(mr_resample(&r, in, BLOCK, out, 0), BLOCK);
+  CHECK_EQ(out[0], (BLOCK - 1) * 2);
+  CHECK_EQ(out[2], 0);
+}
+
+/* ---------- simulation ---------- */
+
+#define SIM_RATE 44100
+#define SIM_BLOCK 1152
+#define SIM_QUEUE 20000 // output frames, as the I2S ringbuf and DMA
+#define SIM_UNITS 4
+#define SIM_LATENCY_US 500000
+
+typedef struct {
+  double drift;   // local = T * (1 + drift) + offset
+  double offset;
+  double dac_ppm; // against the unit's own crystal
+  int64_t start_us;
+  mr_clock_t clock;
+  mr_servo_t servo;
+  mr_resampler_t rsp;
+  double queue[SIM_QUEUE]; // media time of each queued output frame
+  int queue_head;
+  int queue_len;
+  double dac_due;
+  double media_next; // media time of the next decoded frame
+  double heard;      // media time of the frame at the DAC
+  int64_t next_exchange;
+} sim_unit_t;
+
+static int64_t sim_local(const sim_unit_t *u, double t) {
+  return (int64_t)(t * (1 + u->drift) + u->offset);
+}
+
+// One-way delay on a busy Wi-Fi: 1.5-4.5 ms, one in ten queued up to 20 ms
+static double sim_delay(unsigned *seed) {
+  double d = 1500 + 3000.0 * rand_r(seed) / RAND_MAX;
+  if (rand_r(seed) % 10 == 0) {
+    d += 20000.0 * rand_r(seed) / RAND_MAX;
+  }
+  return d;
+}
+
+static void sim_queue(sim_unit_t *u, double media) {
+  if (u->queue_len < SIM_QUEUE) {
+    u->queue[(u->queue_head + u->queue_len++) % SIM_QUEUE] = media;
+  }
+}
+
+// What the playout element does with a decoded block, at leader time now
+static void sim_playout(sim_unit_t *u, double now) {
+  static const int16_t in[SIM_BLOCK];
+  static int16_t out[SIM_BLOCK + SIM_BLOCK / 1000 + 2];
+  double heard = u->media_next - u->queue_len * 1e6 / SIM_RATE;
+  int64_t step = mr_servo_update(&u->servo, (int64_t)(now - heard));
+  if (step > 0) {
+    u->media_next += step; // dropped
+    return;
+  }
+  for (int64_t i = 0; i < -step * SIM_RATE / 1000000; i++) {
+    sim_queue(u, -1); // silence
+  }
+  size_t n = mr_resample(&u->rsp, in, SIM_BLOCK, out, u->servo.ppm);
+  double duration = SIM_BLOCK * 1e6 / SIM_RATE;
+  for (size_t k = 0; k < n; k++) {
+    sim_queue(u, u->media_next + duration * k / n);
+  }
+  u->media_next += duration;
+}
+
+static void test_followers_converge(void) {
+  // Crystals within +-50 ppm; the followers start late, one by one
+  static sim_unit_t u[SIM_UNITS] = {
+      {.drift = 0, .offset = 0, .dac_ppm = 0, .start_us = 0},
+      {.drift = 40e-6, .offset = 1.2e9, .dac_ppm = -45, .start_us = 300000},
+      {.drift = -35e-6, .offset = -3.3e8, .dac_ppm = 30, .start_us = 1200000},
+      {.drift = 20e-6, .offset = 7e7, .dac_ppm = 10, .start_us = 2500000},
+  };
+  unsigned seed = 7;
+  for (int i = 0; i < SIM_UNITS; i++) {
+    mr_clock_reset(&u[i].clock);
+    mr_servo_reset(&u[i].servo);
+    mr_resampler_reset(&u[i].rsp, 1);
+  }
+  double worst = 0;
+  for (int64_t t = 0; t < 60000000; t += 1000) {
+    for (int i = 0; i < SIM_UNITS; i++) {
+      sim_unit_t *x = &u[i];
+      if (t < x->start_us) {
+        continue;
+      }
+      if (i > 0 && t >= x->next_exchange) {
+        double d1 = sim_delay(&seed);
+        double d2 = sim_delay(&seed);
+        int64_t t2 = (int64_t)(t + d1);
+        mr_clock_add(&x->clock, sim_local(x, t), t2, t2 + 80,
+                     sim_local(x, t + d1 + 80 + d2));
+        x->next_exchange = t + (x->clock.locked ? 250000 : 50000);
+      }
+      x->dac_due += SIM_RATE * (1 + x->dac_ppm * 1e-6) / 1000.0;
+      for (; x->dac_due >= 1 && x->queue_len > 0; x->dac_due -= 1) {
+        x->heard = x->queue[x->queue_head];
+        x->queue_head = (x->queue_head + 1) % SIM_QUEUE;
+        x->queue_len--;
+      }
+      if (x->queue_len == 0) {
+        x->dac_due = 0;
+      }
+      if (i > 0 && !x->clock.locked) {
+        continue;
+      }
+      double now = i == 0 ? t : sim_local(x, t) + x->clock.offset_us;
+      while (x->queue_len < 4096) {
+        sim_playout(x, now - SIM_LATENCY_US);
+      }
+    }
+    if (t >= 20000000 && t % 10000 == 0) {
+      for (int i = 1; i < SIM_UNITS; i++) {
+        worst = fmax(worst, fabs(u[i].heard - u[0].heard));
+      }
+    }
+  }
+  printf("  worst skew after 20 s: %.0f us\n", worst);
+  CHECK(worst < 5000);
+  for (int i = 1; i < SIM_UNITS; i++) {
+    CHECK(abs(u[i].servo.ppm) < MR_SERVO_MAX_PPM);
+  }
+}
+
+int main(void) {
+  RUN_TEST(test_packet_round_trip);
+  RUN_TEST(test_clock_round_trip);
+  RUN_TEST(test_mpeg_frames);
+  RUN_TEST(test_adts_frames);
+  RUN_TEST(test_clock_filter_takes_shortest_round_trip);
+  RUN_TEST(test_servo_steps_then_slews);
+  RUN_TEST(test_resampler_ratio);
+  RUN_TEST(test_followers_converge);
+  return host_test_result();
+}
@@ -0,0 +1,282 @@
+/* Pipeline graphs: parse and format round trips, each error /api/config
+ * answers 400 with (word for word, since the web page shows them), the
+ * empty graph standing for the default, and the choice between the
+ * configured graph and the default when the memory budget is short */
+#include "host_test.h"
+#include "pipeline_graph.h"
+
+// The graph text formats back to want
+static void check_round_trip(const char *text, const char *want) {
+  pipeline_graph_t g, again;
+  char err[PIPELINE_GRAPH_ERROR_LEN] = "";
+  CHECK(pipeline_graph_parse(text, &g, err, sizeof(err)));
+  CHECK_STR(err, "");
+  char buf[PIPELINE_GRAPH_MAX_LEN];
+  CHECK_EQ(pipeline_graph_format(&g, buf, sizeof(buf)), strlen(want));
+  CHECK_STR(buf, want);
+  CHECK(pipeline_graph_parse(buf, &again, NULL, 0));
+  CHECK_EQ(again.count, g.count);
+  CHECK(memcmp(again.stages, g.stages, g.count * sizeof(g.stages[0])) == 0);
+}
+
+static void check_rejected(const char *text, const char *want) {
+  pipeline_graph_t g;
+  char err[PIPELINE_GRAPH_ERROR_LEN] = "";
+  CHECK(!pipeline_graph_parse(text, &g, err, sizeof(err)));
+  CHECK_STR(err, want);
+  // Without room for the reason
+  CHECK(!pipeline_graph_parse(text, &g, NULL, 0));
+}
+
+/* ---------- parse and format ---------- */
+
+static void test_round_trip(void) {
+  check_round_trip(PIPELINE_GRAPH_DEFAULT, PIPELINE_GRAPH_DEFAULT);
+  check_round_trip("source:core=1:stack=6k:rb=16k,shift:rb=300000,"
+                   "codec:core=0:stack=8192,sync:rb=4K,i2s:stack=3000",
+                   "source:core=1:stack=6k:rb=16k,shift:rb=300000,"
+                   "codec:core=0:stack=8k,sync:rb=4k,i2s:stack=3000");
+  check_round_trip(" source , codec:rb=1k ,i2s ", "source,codec:rb=1k,i2s");
+  check_round_trip("source:rb=512k,codec:stack=32k,i2s:core=1",
+                   "source:rb=512k,codec:stack=32k,i2s:core=1");
+
+  pipeline_graph_t g;
+  CHECK(pipeline_graph_parse("source:core=1:rb=2k,codec,i2s", &g, NULL, 0));
+  CHECK_EQ(g.count, 3);
+  const pipeline_stage_t *st = pipeline_graph_find(&g, PIPELINE_STAGE_SOURCE);
+  CHECK(st != NULL);
+  CHECK_EQ(st->core, 1);
+  CHECK_EQ(st->stack, 0);
+  CHECK_EQ(st->rb, 2048);
+  st = pipeline_graph_find(&g, PIPELINE_STAGE_CODEC);
+  CHECK(st != NULL);
+  CHECK_EQ(st->core, -1); // its own default
+  CHECK(pipeline_graph_find(&g, PIPELINE_STAGE_SHIFT) == NULL);
+  CHECK(pipeline_graph_find(&g, PIPELINE_STAGE_SYNC) == NULL);
+  CHECK_STR(pipeline_stage_name(PIPELINE_STAGE_I2S), "i2s");
+  CHECK_STR(pipeline_stage_name(PIPELINE_STAGE_COUNT), "?");
+}
+
+static void test_empty_is_default(void) {
+  const char *texts[] = {NULL, "", "   "};
+  for (int i = 0; i < 3; i++) {
+    pipeline_graph_t g;
+    char buf[PIPELINE_GRAPH_MAX_LEN];
+    CHECK(pipeline_graph_parse(texts[i], &g, NULL, 0));
+    pipeline_graph_format(&g, buf, sizeof(buf));
+    CHECK_STR(buf, PIPELINE_GRAPH_DEFAULT);
+  }
+}
+
+// A short buffer gets as much as fits, and the length of the whole
+static void test_format_cut_short(void) {
+  pipeline_graph_t g;
+  CHECK(pipeline_graph_parse("source:rb=16k,codec,i2s", &g, NULL, 0));
+  char buf[10];
+  memset(buf, 'x', sizeof(buf));
+  CHECK_EQ(pipeline_graph_format(&g, buf, sizeof(buf)),
+           strlen("source:rb=16k,codec,i2s"));
+  CHECK_STR(buf, "source:rb");
+  CHECK_EQ(pipeline_graph_format(&g, NULL, 0),
+           strlen("source:rb=16k,codec,i2s"));
+}
+
+/* ---------- errors ---------- */
+
+static void test_order_and_stages(void) {
+  check_rejected("codec,source,i2s", "source must come before codec");
+  check_rejected("source,codec,i2s,sync", "sync must come before i2s");
+  check_rejected("source,codec,codec,i2s", "codec is listed twice");
+  check_rejected("source,eq,codec,i2s", "unknown stage 'eq'");
+  check_rejected("source,Codec,i2s", "unknown stage 'Codec'");
+  check_rejected("source,,codec,i2s", "empty stage");
+  check_rejected("source,codec,i2s,", "empty stage");
+  check_rejected("source,codec", "i2s is needed");
+  check_rejected("shift,codec,sync,i2s", "source is needed");
+  check_rejected("source,shift,sync,i2s", "codec is needed");
+  char text[PIPELINE_GRAPH_MAX_LEN + 1];
+  memset(text, ' ', sizeof(text) - 1);
+  text[sizeof(text) - 1] = '\0';
+  memcpy(text, "source,codec,i2s", 16);
+  check_rejected(text, "graph too long");
+  text[PIPELINE_GRAPH_MAX_LEN - 1] = '\0'; // 95 characters: fine
+  CHECK(pipeline_graph_parse(text, &(pipeline_graph_t){0}, NULL, 0));
+}
+
+static void test_params(void) {
+  // What a stage doesn't take
+  check_rejected("source,shift:core=1,codec,i2s", "shift takes no core");
+  check_rejected("source,shift:stack=4k,codec,i2s", "shift takes no stack");
+  check_rejected("source,codec,sync:stack=4k,i2s", "sync takes no stack");
+  check_rejected("source,codec,i2s:rb=4k", "i2s takes no rb");
+  check_rejected("source:prio=5,codec,i2s",
+                 "unknown parameter 'prio' of source");
+  check_rejected("source:,codec,i2s", "unknown parameter '' of source");
+  // Values
+  check_rejected("source:core,codec,i2s", "core of source needs a number");
+  check_rejected("source:core=,codec,i2s", "core of source needs a number");
+  check_rejected("source:core=-1,codec,i2s", "core of source needs a number");
+  check_rejected("source:core=1x,codec,i2s", "core of source needs a number");
+  check_rejected("source:rb=k,codec,i2s", "rb of source needs a number");
+  check_rejected("source:rb=4kk,codec,i2s", "rb of source needs a number");
+  check_rejected("source:rb= 4k,codec,i2s", "rb of source needs a number");
+}
+
+static void test_ranges(void) {
+  check_rejected("source:core=2,codec,i2s", "core of source is 0 or 1");
+  check_rejected("source,codec:stack=2047,i2s", "stack of codec is 2k to 32k");
+  check_rejected("source,codec:stack=33k,i2s", "stack of codec is 2k to 32k");
+  check_rejected("source,codec,i2s:stack=1k", "stack of i2s is 2k to 32k");
+  check_rejected("source:rb=1023,codec,i2s", "rb of source is 1k to 512k");
+  check_rejected("source,shift:rb=513k,codec,i2s", "rb of shift is 1k to 512k");
+  check_rejected("source,codec,sync:rb=0,i2s", "rb of sync is 1k to 512k");
+  // The edges themselves
+  check_round_trip("source:core=0:stack=2k:rb=1k,codec:stack=32k:rb=512k,i2s",
+                   "source:core=0:stack=2k:rb=1k,codec:stack=32k:rb=512k,i2s");
+}
+
+// Numbers past 32 bits, with or without k, are not numbers rather than
+// wrapping round to something in range
+static void test_overflow(void) {
+  // 2^32 + 4096, 2^32 KB + 4 KB
+  check_rejected("source:rb=4294971392,codec,i2s",
+                 "rb of source needs a number");
+  check_rejected("source:rb=4194308k,codec,i2s", "rb of source needs a number");
+  check_rejected("source:rb=4194304k,codec,i2s", "rb of source needs a number");
+  check_rejected("source,codec:stack=99999999999999999999999,i2s",
+                 "stack of codec needs a number");
+  check_rejected("source:core=4294967297,codec,i2s",
+                 "core of source needs a number");
+  // In 32 bits, out of range
+  check_rejected("source:rb=4194303k,codec,i2s", "rb of source is 1k to 512k");
+  check_rejected("source:rb=4294967295,codec,i2s",
+                 "rb of source is 1k to 512k");
+}
+
+/* ---------- memory budget ---------- */
+
+static void test_budget(void) {
+  const pipeline_budget_t free_mem = {
+      .internal = 100 * 1024, .psram = 1024 * 1024, .largest_internal = 40 * 1024};
+  pipeline_budget_t need = {.internal = 100 * 1024 - PIPELINE_INTERNAL_RESERVE,
+                            .psram = 1024 * 1024 - PIPELINE_PSRAM_RESERVE,
+                            .largest_internal = 40 * 1024};
+  // Leaving exactly the reserves
+  CHECK_EQ(pipeline_budget_check(&need, &free_mem, true), PIPELINE_FITS);
+  need.psram++;
+  CHECK_EQ(pipeline_budget_check(&need, &free_mem, true),
+           PIPELINE_SHORT_OF_PSRAM);
+  need.psram--;
+  need.internal++;
+  CHECK_EQ(pipeline_budget_check(&need, &free_mem, true),
+           PIPELINE_SHORT_OF_INTERNAL);
+  need.internal--;
+  // A stack bigger than any free block, with enough free in all
+  need.largest_internal++;
+  CHECK_EQ(pipeline_budget_check(&need, &free_mem, true),
+           PIPELINE_SHORT_OF_INTERNAL);
+  need.largest_internal--;
+
+  // Without PSRAM the rings are internal RAM too
+  pipeline_budget_t small = {.internal = 20 * 1024, .psram = 48 * 1024,
+                             .largest_internal = 8 * 1024};
+  pipeline_budget_t no_psram = {.internal = 100 * 1024,
+                                .largest_internal = 40 * 1024};
+  CHECK_EQ(pipeline_budget_check(&small, &no_psram, false), PIPELINE_FITS);
+  small.psram = 48 * 1024 + 1;
+  CHECK_EQ(pipeline_budget_check(&small, &no_psram, false),
+           PIPELINE_SHORT_OF_INTERNAL);
+  // Sums past 32 bits don't wrap round to fitting
+  pipeline_budget_t huge = {.internal = UINT32_MAX, .psram = UINT32_MAX};
+  CHECK_EQ(pipeline_budget_check(&huge, &free_mem, true),
+           PIPELINE_SHORT_OF_PSRAM);
+  huge.psram = 0;
+  CHECK_EQ(pipeline_budget_check(&huge, &free_mem, true),
+           PIPELINE_SHORT_OF_INTERNAL);
+}
+
+/* A stand-in for the pipeline manager's estimate: 4 KB of internal RAM a
+ * stage, and the rings given (16 KB where not) in PSRAM */
+typedef struct {
+  pipeline_budget_t free_mem;
+  int calls;
+} fake_heap_t;
+
+static bool fake_fits(const pipeline_graph_t *g, void *arg) {
+  fake_heap_t *heap = arg;
+  heap->calls++;
+  pipeline_budget_t need = {.largest_internal = 4096};
+  for (int i = 0; i < g->count; i++) {
+    need.internal += 4096;
+    need.psram += g->stages[i].rb ? g->stages[i].rb : 16 * 1024;
+  }
+  return pipeline_budget_check(&need, &heap->free_mem, true) == PIPELINE_FITS;
+}
+
+static void check_graph(const pipeline_graph_t *g, const char *want) {
+  char buf[PIPELINE_GRAPH_MAX_LEN];
+  pipeline_graph_format(g, buf, sizeof(buf));
+  CHECK_STR(buf, want);
+}
+
+static void test_choose(void) {
+  fake_heap_t heap = {
+      .free_mem = {.internal = 200 * 1024, .psram = 256 * 1024,
+                   .largest_internal = 64 * 1024}};
+  pipeline_graph_t g;
+  char err[PIPELINE_GRAPH_ERROR_LEN] = "";
+
+  const char *tuned = "source:rb=64k,codec:core=1,i2s";
+  CHECK_EQ(pipeline_graph_choose(tuned, fake_fits, &heap, &g, err,
+                                 sizeof(err)),
+           PIPELINE_GRAPH_CONFIGURED);
+  check_graph(&g, tuned);
+  CHECK_EQ(heap.calls, 1);
+
+  // Empty: the default, as configured
+  CHECK_EQ(pipeline_graph_choose("", fake_fits, &heap, &g, err, sizeof(err)),
+           PIPELINE_GRAPH_CONFIGURED);
+  check_graph(&g, PIPELINE_GRAPH_DEFAULT);
+
+  // Rejected: the default, and why, without asking about memory
+  heap.calls = 0;
+  CHECK_EQ(pipeline_graph_choose("source,codec,codec,i2s", fake_fits, &heap,
+                                 &g, err, sizeof(err)),
+           PIPELINE_GRAPH_REJECTED);
+  CHECK_STR(err, "codec is listed twice");
+  check_graph(&g, PIPELINE_GRAPH_DEFAULT);
+  CHECK_EQ(heap.calls, 0);
+
+  // 512 KB rings with 256 KB of PSRAM free: the default
+  CHECK_EQ(pipeline_graph_choose("source:rb=512k,codec,i2s", fake_fits, &heap,
+                                 &g, err, sizeof(err)),
+           PIPELINE_GRAPH_TOO_BIG);
+  check_graph(&g, PIPELINE_GRAPH_DEFAULT);
+  CHECK_EQ(heap.calls, 1);
+
+  // The same with the PSRAM for it
+  heap.free_mem.psram = 1024 * 1024;
+  CHECK_EQ(pipeline_graph_choose("source:rb=512k,codec,i2s", fake_fits, &heap,
+                                 &g, err, sizeof(err)),
+           PIPELINE_GRAPH_CONFIGURED);
+  check_graph(&g, "source:rb=512k,codec,i2s");
+
+  // Short of internal RAM for even three stages
+  heap.free_mem.internal = PIPELINE_INTERNAL_RESERVE + 8 * 1024;
+  CHECK_EQ(pipeline_graph_choose(tuned, fake_fits, &heap, &g, NULL, 0),
+           PIPELINE_GRAPH_TOO_BIG);
+  check_graph(&g, PIPELINE_GRAPH_DEFAULT);
+}
+
+int main(void) {
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_empty_is_default);
+  RUN_TEST(test_format_cut_short);
+  RUN_TEST(test_order_and_stages);
+  RUN_TEST(test_params);
+  RUN_TEST(test_ranges);
+  RUN_TEST(test_overflow);
+  RUN_TEST(test_budget);
+  RUN_TEST(test_choose);
+  return host_test_result();
+}
@@ -0,0 +1,590 @@
+/* Recorder: the collector and writer tasks save a synthetic station to real
+ * files under SD_CARD_MOUNT_POINT, a scratch directory. Checked are the
+ * files' bytes against the stream, file splits at station changes and full
+ * hours, stream headers for files started mid-stream, drops while the card
+ * stalls, failures, and schedules. time() is the test's (--wrap=time), and
+ * the card's writes can be held up or failed (--wrap=write). */
+#define _GNU_SOURCE
+#include "host_test.h"
+#include "app_config.h"
+#include "decoder_registry.h"
+#include "esp_vfs_fat.h"
+#include "input_bus.h"
+#include "recorder.h"
+#include "station_data.h"
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Frames and headers are whole words: the tap, like ADF's, hands out
+// whole words while more may follow
+#define MP3_FRAME 416
+#define FLAC_FRAME 1500
+#define OGG_PAGE (27 + 17 + 4004)
+#define FRAME_MAX OGG_PAGE
+#define HEAD_MAX 128
+#define SEQ_AT(codec) ((codec) == CODEC_TYPE_OGG ? 27 + 17 : 4)
+
+app_runtime_config_t g_runtime_config;
+int current_station = 0;
+
+const char *codec_type_to_string(codec_type_t codec) {
+  return decoder_registry_name(codec);
+}
+
+/* ---------- the card, the clock and the pipeline ---------- */
+
+esp_err_t sd_card_mount(void) {
+  return mkdir(SD_CARD_MOUNT_POINT, 0755) == 0 || errno == EEXIST ? ESP_OK
+                                                                  : ESP_FAIL;
+}
+
+bool sd_card_is_mounted(void) { return true; }
+
+static atomic_llong wall_clock;
+
+time_t __wrap_time(time_t *out) {
+  time_t now = (time_t)atomic_load(&wall_clock);
+  if (out) {
+    *out = now;
+  }
+  return now;
+}
+
+// 2026-10-19 (a Monday) at h:m:s UTC
+static time_t at(int h, int m, int s) {
+  struct tm tm = {.tm_year = 126, .tm_mon = 9, .tm_mday = 19,
+                  .tm_hour = h, .tm_min = m, .tm_sec = s};
+  return timegm(&tm);
+}
+
+static atomic_int stall_ms;  // the next write takes this long
+static atomic_bool fail_io;  // the next write fails
+
+ssize_t __real_write(int fd, const void *buf, size_t len);
+
+ssize_t __wrap_write(int fd, const void *buf, size_t len) {
+  int ms = atomic_exchange(&stall_ms, 0);
+  if (ms) {
+    usleep(ms * 1000);
+  }
+  if (atomic_exchange(&fail_io, false)) {
+    errno = EIO;
+    return -1;
+  }
+  return __real_write(fd, buf, len);
+}
+
+static ringbuf_handle_t tap;
+
+esp_err_t audio_pipeline_tap_insert(pipeline_tap_t which, ringbuf_handle_t rb) {
+  CHECK_EQ(which, PIPELINE_TAP_RECORDER);
+  tap = rb;
+  return ESP_OK;
+}
+
+void audio_pipeline_tap_remove(pipeline_tap_t which) { tap = NULL; }
+
+static const station_snapshot_t snapshot = {.count = 10};
+
+const station_snapshot_t *station_snapshot_acquire(void) { return &snapshot; }
+
+void station_snapshot_release(const station_snapshot_t *s) {}
+
+int station_snapshot_find_id(const station_snapshot_t *s, uint32_t id) {
+  return id == 55 ? 7 : -1;
+}
+
+/* ---------- the station ---------- */
+
+// A frame or Ogg page carrying its sequence number in 6-bit bytes, so that
+// neither it nor the payload ever looks like a sync
+static size_t make_frame(codec_type_t codec, uint32_t seq, uint8_t *out) {
+  size_t len;
+  size_t payload;
+  if (codec == CODEC_TYPE_OGG) {
+    len = OGG_PAGE;
+    memset(out, 0, 27);
+    memcpy(out, "OggS", 4);
+    uint64_t granule = 960 * ((uint64_t)seq + 1);
+    for (int i = 0; i < 8; i++) {
+      out[6 + i] = granule >> (8 * i);
+    }
+    out[26] = 17;
+    memset(out + 27, 250, 16);
+    out[27 + 16] = 4;
+    payload = 27 + 17;
+  } else {
+    len = codec == CODEC_TYPE_MP3 ? MP3_FRAME : FLAC_FRAME;
+    memcpy(out, codec == CODEC_TYPE_MP3 ? "\xFF\xFB\x90\x64" : "\xFF\xF8\x69\x08",
+           4);
+    payload = 4;
+  }
+  for (size_t i = payload; i < len; i++) {
+    out[i] = 0x20 + ((seq + i) & 0x1F);
+  }
+  for (int i = 0; i < 4; i++) {
+    out[payload + i] = seq >> (6 * i) & 0x3F;
+  }
+  return len;
+}
+
+static uint32_t frame_seq(codec_type_t codec, const uint8_t *frame) {
+  uint32_t seq = 0;
+  for (int i = 0; i < 4; i++) {
+    seq |= (uint32_t)frame[SEQ_AT(codec) + i] << (6 * i);
+  }
+  return seq;
+}
+
+// FLAC metadata or the Ogg header pages
+static size_t make_head(codec_type_t codec, uint8_t *out) {
+  if (codec == CODEC_TYPE_FLAC) {
+    memcpy(out, "fLaC\x00\x00\x00\x22", 8);
+    memset(out + 8, 0x11, 34);
+    memcpy(out + 42, "\x81\x00\x00\x02\x00\x00", 6); // last: padding
+    return 48;
+  }
+  if (codec == CODEC_TYPE_OGG) {
+    static const size_t body[2] = {19, 25};
+    size_t len = 0;
+    for (int i = 0; i < 2; i++) {
+      uint8_t *page = out + len;
+      memset(page, 0, 27);
+      memcpy(page, "OggS", 4);
+      page[5] = i == 0 ? 2 : 0; // beginning of stream
+      page[26] = 1;
+      page[27] = body[i];
+      memset(page + 28, i == 0 ? 'H' : 'T', body[i]);
+      len += 28 + body[i];
+    }
+    return len;
+  }
+  return 0;
+}
+
+// What the HTTP reader's third output would write to the tap
+static void feed(const uint8_t *data, size_t len) {
+  CHECK(tap != NULL);
+  if (tap) {
+    CHECK_EQ(rb_write(tap, (char *)data, len, portMAX_DELAY), len);
+  }
+}
+
+static void feed_head(codec_type_t codec) {
+  uint8_t head[HEAD_MAX];
+  feed(head, make_head(codec, head));
+}
+
+static void feed_frames(codec_type_t codec, uint32_t first, uint32_t count) {
+  uint8_t frame[FRAME_MAX];
+  for (uint32_t seq = first; seq < first + count; seq++) {
+    feed(frame, make_frame(codec, seq, frame));
+  }
+}
+
+// The stream as it was fed: the head if given, then frames first..
+static uint8_t *expected(codec_type_t codec, bool head, uint32_t first,
+                         uint32_t count, size_t *len) {
+  uint8_t *buf = malloc(HEAD_MAX + (size_t)count * FRAME_MAX);
+  *len = head ? make_head(codec, buf) : 0;
+  for (uint32_t seq = first; seq < first + count; seq++) {
+    *len += make_frame(codec, seq, buf + *len);
+  }
+  return buf;
+}
+
+/* ---------- driving the recorder ---------- */
+
+// Long enough for the collector to pick up a request between reads
+static void settle(void) { usleep(150 * 1000); }
+
+static void drain(void) {
+  for (int i = 0; i < 300 && tap && rb_bytes_filled(tap) > 0; i++) {
+    usleep(10 * 1000);
+  }
+  settle();
+}
+
+// A station change: the old pipeline goes, the new one connects
+static void tune(codec_type_t codec) {
+  recorder_detach();
+  settle();
+  recorder_attach(codec);
+}
+
+static bool wait_for(bool (*done)(void)) {
+  for (int i = 0; i < 500; i++) {
+    if (done()) {
+      return true;
+    }
+    usleep(10 * 1000);
+  }
+  return false;
+}
+
+static bool file_closed(void) {
+  recorder_stats_t st;
+  recorder_get_stats(&st);
+  return st.file[0] == '\0';
+}
+
+static bool stopped(void) { return !recorder_is_recording(); }
+
+static void stop(void) {
+  CHECK_EQ(recorder_record(0), ESP_OK);
+  CHECK(wait_for(file_closed));
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  return remove(path);
+}
+
+static void clear_card(void) {
+  nftw(RECORDER_DIR, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+static uint8_t *read_file(const char *name, size_t *len) {
+  char path[256];
+  snprintf(path, sizeof(path), RECORDER_DIR "/20261019/%s", name);
+  *len = 0;
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "%s missing\n", path);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *buf = malloc(*len ? *len : 1);
+  CHECK_EQ(fread(buf, 1, *len, f), *len);
+  fclose(f);
+  return buf;
+}
+
+static int count_files(void) {
+  int n = 0;
+  DIR *dir = opendir(RECORDER_DIR "/20261019");
+  for (struct dirent *e; dir && (e = readdir(dir));) {
+    n += e->d_name[0] != '.';
+  }
+  if (dir) {
+    closedir(dir);
+  }
+  return n;
+}
+
+static void check_file(const char *name, const uint8_t *want, size_t len) {
+  size_t got_len;
+  uint8_t *got = read_file(name, &got_len);
+  CHECK_EQ(got_len, len);
+  CHECK(got && got_len == len && memcmp(got, want, len) == 0);
+  free(got);
+}
+
+typedef struct {
+  int frames;     // whole and in sequence
+  int cuts;       // cut short, where audio was dropped
+  int gaps;       // frames missing after a cut
+  uint32_t first; // sequence numbers
+  uint32_t last;
+} scan_t;
+
+// Walks a file frame by frame from offset pos, resyncing after a cut
+static scan_t scan(codec_type_t codec, const uint8_t *buf, size_t len,
+                   size_t pos) {
+  scan_t r = {0};
+  stream_sync_t sync = decoder_registry_sync(codec);
+  uint8_t frame[FRAME_MAX];
+  while (pos < len) {
+    size_t n = len - pos >= SEQ_AT(codec) + 4
+                   ? make_frame(codec, frame_seq(codec, buf + pos), frame)
+                   : 0;
+    if (n == 0 || n > len - pos || memcmp(buf + pos, frame, n) != 0) {
+      r.cuts++;
+      pos++;
+      pos += stream_sync_find(sync, buf + pos, len - pos);
+      continue;
+    }
+    uint32_t seq = frame_seq(codec, buf + pos);
+    if (r.frames == 0) {
+      r.first = seq;
+    } else if (seq != r.last + 1) {
+      r.gaps++;
+    }
+    r.last = seq;
+    r.frames++;
+    pos += n;
+  }
+  return r;
+}
+
+/* ---------- tests ---------- */
+
+static void test_off_until_enabled(void) {
+  CHECK_EQ(recorder_record(1), ESP_ERR_INVALID_STATE);
+  CHECK(!recorder_is_recording());
+}
+
+static void test_schedules_validated(void) {
+  recorder_schedule_t slot = {
+      .days = 0x3E, .start_min = 7 * 60, .minutes = 90, .station_id = -1};
+  recorder_schedule_t bad = slot;
+  bad.days = 0x80;
+  CHECK_EQ(recorder_set_schedules(&bad, 1, 0), ESP_ERR_INVALID_ARG);
+  bad = slot;
+  bad.start_min = 24 * 60;
+  CHECK_EQ(recorder_set_schedules(&bad, 1, 0), ESP_ERR_INVALID_ARG);
+  bad = slot;
+  bad.minutes = 0;
+  CHECK_EQ(recorder_set_schedules(&bad, 1, 0), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(recorder_set_schedules(&slot, 1, 15 * 60), ESP_ERR_INVALID_ARG);
+  CHECK_EQ(recorder_set_schedules(&slot, RECORDER_MAX_SCHEDULES + 1, 0),
+           ESP_ERR_INVALID_ARG);
+
+  CHECK_EQ(recorder_set_schedules(&slot, 1, -300), ESP_OK);
+  recorder_schedule_t out[RECORDER_MAX_SCHEDULES];
+  int offset;
+  CHECK_EQ(recorder_get_schedules(out, RECORDER_MAX_SCHEDULES, &offset), 1);
+  CHECK_EQ(offset, -300);
+  CHECK_EQ(out[0].start_min, 7 * 60);
+  CHECK_EQ(recorder_set_schedules(NULL, 0, 0), ESP_OK);
+}
+
+// From the start of the stream, through both buffers several times
+static void test_records_the_stream(void) {
+  clear_card();
+  atomic_store(&wall_clock, at(10, 0, 0));
+  recorder_attach(CODEC_TYPE_MP3);
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  feed_frames(CODEC_TYPE_MP3, 0, 1000);
+  drain();
+  stop();
+
+  size_t len;
+  uint8_t *want = expected(CODEC_TYPE_MP3, false, 0, 1000, &len);
+  check_file("100000.mp3", want, len);
+  free(want);
+  recorder_stats_t st;
+  recorder_get_stats(&st);
+  CHECK_EQ(st.files, 1);
+  CHECK_EQ(st.bytes_written, len);
+  CHECK_EQ(st.bytes_dropped, 0);
+  CHECK_EQ(st.errors, 0);
+  CHECK(st.buffered_max >= 128 * 1024);
+}
+
+// A recording carries on into a new file, the new stream's head and all
+static void test_station_change_starts_a_file(void) {
+  clear_card();
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  feed_frames(CODEC_TYPE_MP3, 0, 100);
+  drain();
+  tune(CODEC_TYPE_FLAC);
+  // The new stream arrives as soon as it is tapped
+  feed_head(CODEC_TYPE_FLAC);
+  feed_frames(CODEC_TYPE_FLAC, 0, 200);
+  drain();
+  stop();
+
+  CHECK_EQ(count_files(), 2);
+  size_t len;
+  uint8_t *want = expected(CODEC_TYPE_MP3, false, 0, 100, &len);
+  check_file("100000.mp3", want, len);
+  free(want);
+  want = expected(CODEC_TYPE_FLAC, true, 0, 200, &len);
+  check_file("100000.flac", want, len);
+  free(want);
+}
+
+// Started mid-stream: the Ogg header pages first, then whole pages
+static void test_mid_stream_gets_the_head(void) {
+  clear_card();
+  tune(CODEC_TYPE_OGG);
+  feed_head(CODEC_TYPE_OGG);
+  feed_frames(CODEC_TYPE_OGG, 0, 50);
+  drain();
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  feed_frames(CODEC_TYPE_OGG, 50, 100);
+  drain();
+  stop();
+
+  size_t len;
+  uint8_t *got = read_file("100000.ogg", &len);
+  uint8_t head[HEAD_MAX];
+  size_t head_len = make_head(CODEC_TYPE_OGG, head);
+  CHECK(got && len > head_len && memcmp(got, head, head_len) == 0);
+  if (got && len > head_len) {
+    scan_t r = scan(CODEC_TYPE_OGG, got, len, head_len);
+    CHECK_EQ(r.cuts, 0);
+    CHECK_EQ(r.gaps, 0);
+    CHECK_EQ(r.first, 50);
+    CHECK_EQ(r.last, 149);
+  }
+  free(got);
+}
+
+// A new file at the full hour, cut at a frame, nothing lost between them
+static void test_splits_at_the_hour(void) {
+  clear_card();
+  tune(CODEC_TYPE_MP3);
+  atomic_store(&wall_clock, at(10, 59, 58));
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  feed_frames(CODEC_TYPE_MP3, 0, 100);
+  atomic_store(&wall_clock, at(11, 0, 0));
+  // Past the collector's next look at the clock
+  for (int i = 0; i < 30; i++) {
+    feed_frames(CODEC_TYPE_MP3, 100 + i * 10, 10);
+    usleep(50 * 1000);
+  }
+  drain();
+  stop();
+
+  CHECK_EQ(count_files(), 2);
+  size_t first_len, second_len, len;
+  uint8_t *first = read_file("105958.mp3", &first_len);
+  uint8_t *second = read_file("110000.mp3", &second_len);
+  uint8_t *want = expected(CODEC_TYPE_MP3, false, 0, 400, &len);
+  CHECK(first_len > 0 && first_len % MP3_FRAME == 0);
+  CHECK_EQ(first_len + second_len, len);
+  CHECK(first && second && first_len + second_len == len &&
+        memcmp(first, want, first_len) == 0 &&
+        memcmp(second, want + first_len, second_len) == 0);
+  free(first);
+  free(second);
+  free(want);
+}
+
+// Both buffers full while the card stalls: the rest is dropped and counted,
+// and the recording picks up again at a frame
+static void test_stall_drops_then_resumes(void) {
+  clear_card();
+  atomic_store(&wall_clock, at(12, 0, 0));
+  recorder_stats_t before;
+  recorder_get_stats(&before);
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  atomic_store(&stall_ms, 1000);
+  feed_frames(CODEC_TYPE_MP3, 0, 1000);
+  usleep(1200 * 1000);
+  for (int i = 0; i < 20; i++) {
+    feed_frames(CODEC_TYPE_MP3, 1000 + i * 50, 50);
+    usleep(5 * 1000);
+  }
+  drain();
+  stop();
+
+  recorder_stats_t st;
+  recorder_get_stats(&st);
+  CHECK(st.bytes_dropped > before.bytes_dropped);
+  CHECK(st.stall_max_ms >= 900);
+  size_t len;
+  uint8_t *got = read_file("120000.mp3", &len);
+  CHECK_EQ(len, st.bytes_written - before.bytes_written);
+  scan_t r = scan(CODEC_TYPE_MP3, got, len, 0);
+  CHECK(r.cuts >= 1);
+  CHECK(r.gaps >= 1);
+  CHECK_EQ(r.first, 0);
+  CHECK_EQ(r.last, 1999);
+  // Two buffers of whole frames at least made it
+  CHECK(r.frames >= 2 * 128 * 1024 / MP3_FRAME);
+  free(got);
+}
+
+// A failed write stops the recording rather than writing on past a hole
+static void test_write_error_stops(void) {
+  clear_card();
+  recorder_stats_t before;
+  recorder_get_stats(&before);
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  atomic_store(&fail_io, true);
+  feed_frames(CODEC_TYPE_MP3, 0, 400);
+  CHECK(wait_for(stopped));
+  CHECK(wait_for(file_closed));
+  recorder_stats_t st;
+  recorder_get_stats(&st);
+  CHECK_EQ(st.errors, before.errors + 1);
+  CHECK_EQ(st.bytes_written, before.bytes_written);
+}
+
+static void test_full_card_stops(void) {
+  clear_card();
+  host_vfs_fat_set_info(32ULL << 30, 1 << 20);
+  recorder_stats_t before;
+  recorder_get_stats(&before);
+  CHECK_EQ(recorder_record(1), ESP_OK);
+  settle();
+  feed_frames(CODEC_TYPE_MP3, 0, 20);
+  CHECK(wait_for(stopped));
+  recorder_stats_t st;
+  recorder_get_stats(&st);
+  CHECK_EQ(st.errors, before.errors + 1);
+  CHECK_EQ(st.files, before.files);
+  CHECK_EQ(count_files(), 0);
+  host_vfs_fat_set_info(32ULL << 30, 31ULL << 30);
+}
+
+// A slot tunes its station, records it from the start and ends on time
+static void test_schedule_tunes_and_records(void) {
+  clear_card();
+  // 08:00 UTC is 10:00 at UTC+2, a Monday
+  atomic_store(&wall_clock, at(8, 0, 0));
+  recorder_schedule_t slot = {.days = 1 << 1,
+                              .start_min = 10 * 60,
+                              .minutes = 2,
+                              .station_id = 55};
+  CHECK_EQ(recorder_set_schedules(&slot, 1, 120), ESP_OK);
+  input_event_t event;
+  CHECK(input_bus_receive(&event, 3000));
+  CHECK_EQ(event.type, INPUT_EVENT_STATION_SELECT);
+  CHECK_EQ(event.source, INPUT_SOURCE_SCHEDULE);
+  CHECK_EQ(event.value, 7);
+  CHECK(recorder_is_recording());
+  // The old station, still playing, is not recorded
+  feed_frames(CODEC_TYPE_OGG, 0, 10);
+  drain();
+  CHECK_EQ(count_files(), 0);
+
+  current_station = 7;
+  tune(CODEC_TYPE_MP3);
+  feed_frames(CODEC_TYPE_MP3, 0, 100);
+  drain();
+  atomic_store(&wall_clock, at(8, 2, 0));
+  CHECK(wait_for(stopped));
+  CHECK(wait_for(file_closed));
+
+  size_t len;
+  uint8_t *want = expected(CODEC_TYPE_MP3, false, 0, 100, &len);
+  check_file("100000.mp3", want, len);
+  free(want);
+  CHECK_EQ(recorder_set_schedules(NULL, 0, 0), ESP_OK);
+}
+
+int main(void) {
+  RUN_TEST(test_off_until_enabled);
+  CHECK_EQ(input_bus_init(), ESP_OK);
+  atomic_store(&wall_clock, at(9, 0, 0));
+  g_runtime_config.recorder_enabled = true;
+  CHECK_EQ(recorder_init(), ESP_OK);
+  RUN_TEST(test_schedules_validated);
+  RUN_TEST(test_records_the_stream);
+  RUN_TEST(test_station_change_starts_a_file);
+  RUN_TEST(test_mid_stream_gets_the_head);
+  RUN_TEST(test_splits_at_the_hour);
+  RUN_TEST(test_stall_drops_then_resumes);
+  RUN_TEST(test_write_error_stops);
+  RUN_TEST(test_full_card_stops);
+  RUN_TEST(test_schedule_tunes_and_records);
+  return host_test_result();
+}
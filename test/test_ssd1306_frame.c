@@ -0,0 +1,75 @@
+/* Page layout conversion and dirty page runs */
+#include "bench.h"
+#include "host_test.h"
+#include "ssd1306_frame.h"
+#include "ssd1306_reference.h"
+
+#define PX_BYTES (SSD1306_FRAME_WIDTH * SSD1306_FRAME_HEIGHT / 8)
+
+static uint8_t px[PX_BYTES];
+static uint8_t frame[SSD1306_FRAME_BYTES];
+static uint8_t expected[SSD1306_FRAME_BYTES];
+
+static void test_convert_matches_per_pixel(void) {
+  uint32_t seed = 1;
+  for (int round = 0; round < 200; round++) {
+    for (int i = 0; i < PX_BYTES; i++) {
+      px[i] = (uint8_t)bench_rand(&seed);
+    }
+    ssd1306_frame_convert(px, frame);
+    ssd1306_reference_convert(px, expected);
+    CHECK(memcmp(frame, expected, sizeof(frame)) == 0);
+  }
+}
+
+static void test_convert_orientation(void) {
+  // One dark LVGL pixel at (x 10, y 21): page 2, column 10, bit 5, inverted
+  memset(px, 0, sizeof(px));
+  px[21 * (SSD1306_FRAME_WIDTH / 8) + 10 / 8] = 0x80 >> (10 % 8);
+  ssd1306_frame_convert(px, frame);
+  for (int i = 0; i < SSD1306_FRAME_BYTES; i++) {
+    CHECK_EQ(frame[i], i == 2 * SSD1306_PAGE_BYTES + 10 ? 0xff & ~(1 << 5)
+                                                        : 0xff);
+  }
+}
+
+static void test_dirty_runs(void) {
+  ssd1306_run_t runs[SSD1306_FRAME_PAGES];
+  uint8_t sent[SSD1306_FRAME_BYTES];
+  memset(frame, 0x55, sizeof(frame));
+  memcpy(sent, frame, sizeof(sent));
+  CHECK_EQ(ssd1306_frame_dirty_runs(frame, sent, runs), 0);
+
+  // Unknown panel content: everything in one run
+  CHECK_EQ(ssd1306_frame_dirty_runs(frame, NULL, runs), 1);
+  CHECK_EQ(runs[0].first, 0);
+  CHECK_EQ(runs[0].end, SSD1306_FRAME_PAGES);
+
+  // One byte in pages 1, 2, 5 and 7
+  frame[1 * SSD1306_PAGE_BYTES + 127] ^= 1;
+  frame[2 * SSD1306_PAGE_BYTES] ^= 0x80;
+  frame[5 * SSD1306_PAGE_BYTES + 64] ^= 8;
+  frame[7 * SSD1306_PAGE_BYTES + 3] ^= 2;
+  CHECK_EQ(ssd1306_frame_dirty_runs(frame, sent, runs), 3);
+  CHECK_EQ(runs[0].first, 1);
+  CHECK_EQ(runs[0].end, 3);
+  CHECK_EQ(runs[1].first, 5);
+  CHECK_EQ(runs[1].end, 6);
+  CHECK_EQ(runs[2].first, 7);
+  CHECK_EQ(runs[2].end, 8);
+
+  // Every other page: the most runs there can be
+  memcpy(frame, sent, sizeof(frame));
+  for (int page = 0; page < SSD1306_FRAME_PAGES; page += 2) {
+    frame[page * SSD1306_PAGE_BYTES] ^= 1;
+  }
+  CHECK_EQ(ssd1306_frame_dirty_runs(frame, sent, runs),
+           SSD1306_FRAME_PAGES / 2);
+}
+
+int main(void) {
+  RUN_TEST(test_convert_matches_per_pixel);
+  RUN_TEST(test_convert_orientation);
+  RUN_TEST(test_dirty_runs);
+  return host_test_result();
+}
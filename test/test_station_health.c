@@ -0,0 +1,371 @@
+/* Station health prober against fixtures/health/health_server.py on this
+ * machine, with the prober's one-second tick passing at once
+ * (--wrap=vTaskDelay). One round over stations the fixture plays: codec and
+ * bitrate from MP3 and ADTS frames, past an ID3 tag, or from icy-br behind
+ * an "ICY 200" answer; a redirect to a PLS; a 404, a web page, a redirect
+ * loop and a silent server retried until dead. Then the saved table, the
+ * results loaded from the last one, and the mirror chosen from them. */
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/task.h"
+#include "host_test.h"
+#include "station_data.h"
+#include "station_health.h"
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HEALTH_FILE STATION_STORE_DIR "/health.bin"
+#define HEALTH_MAGIC 0x48544C48 // as in station_health.c
+#define SAVED_ROUND 5
+#define WAIT_MS 60000
+
+extern char **environ;
+
+volatile bool g_is_pipeline_running;
+int current_station = -1;
+volatile uint64_t g_bytes_read;
+
+/* ---------- the prober's clock ---------- */
+
+static _Atomic int64_t skipped_us;
+
+void __real_vTaskDelay(TickType_t ticks);
+
+// The prober only ever waits out its one-second tick: move the clock on by
+// it instead
+void __wrap_vTaskDelay(TickType_t ticks) {
+  host_timer_set_clock(0, atomic_fetch_add(&skipped_us, ticks * 1000LL) +
+                              ticks * 1000LL);
+  __real_vTaskDelay(1);
+}
+
+/* ---------- fixture server ---------- */
+
+static pid_t server_pid;
+static int server_port;
+
+static bool start_server(void) {
+  int out[2];
+  if (pipe(out) != 0) {
+    return false;
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, out[0]);
+  char *argv[] = {PYTHON3, HEALTH_SERVER, NULL};
+  bool ok = posix_spawn(&server_pid, PYTHON3, &actions, NULL, argv,
+                        environ) == 0;
+  posix_spawn_file_actions_destroy(&actions);
+  close(out[1]);
+  FILE *f = fdopen(out[0], "r");
+  ok = ok && fscanf(f, "%d", &server_port) == 1;
+  fclose(f);
+  return ok;
+}
+
+static void stop_server(void) {
+  kill(server_pid, SIGTERM);
+  waitpid(server_pid, NULL, 0);
+}
+
+/* ---------- stations ---------- */
+
+enum {
+  MP3,
+  AAC,
+  ID3,
+  REDIRECT,
+  ICY,
+  MISSING,
+  HTML,
+  LOOP,
+  SILENT,
+  SAVED, // probed in the saved round, not again
+  STATION_COUNT
+};
+
+static const struct {
+  const char *call_sign;
+  const char *path;
+} fixture[STATION_COUNT] = {
+    [MP3] = {"KMIR", "/mp3"},
+    [AAC] = {"KAAC", "/aac"},
+    [ID3] = {"KMIR", "/id3.mp3"},
+    [REDIRECT] = {"KPLS", "/redirect"},
+    [ICY] = {"KICY", "/icy"},
+    [MISSING] = {"KMIR", "/gone"},
+    [HTML] = {"KWEB", "/html"},
+    [LOOP] = {"KLUP", "/loop"},
+    [SILENT] = {"KQIT", "/silent"},
+    [SAVED] = {"KOLD", "/gone"},
+};
+
+// Ids from 100 on, so the saved table can name them before they exist
+#define STATION_ID(i) (100 + (uint32_t)(i))
+// In the saved table only; dropped once the list is in
+#define REMOVED_ID 99
+
+static void install_stations(void) {
+  station_entry_t entries[STATION_COUNT];
+  char uris[STATION_COUNT][64];
+  for (int i = 0; i < STATION_COUNT; i++) {
+    snprintf(uris[i], sizeof(uris[i]), "http://127.0.0.1:%d%s", server_port,
+             fixture[i].path);
+    entries[i] = (station_entry_t){.id = STATION_ID(i),
+                                   .call_sign = fixture[i].call_sign,
+                                   .origin = "Fixture",
+                                   .uri = uris[i],
+                                   .codec = CODEC_TYPE_MP3};
+  }
+  station_image_t image;
+  CHECK_EQ(station_image_build(entries, STATION_COUNT, &image), ESP_OK);
+  CHECK_EQ(station_data_install(&image), ESP_OK);
+}
+
+/* ---------- saved results ---------- */
+
+typedef struct {
+  uint32_t magic;
+  uint16_t record_size;
+  uint16_t round;
+  uint32_t count;
+  uint32_t crc;
+} health_file_header_t; // as in station_health.c
+
+static void write_results(const station_health_t *records, uint32_t count,
+                          uint16_t round) {
+  health_file_header_t header = {
+      .magic = HEALTH_MAGIC,
+      .record_size = sizeof(station_health_t),
+      .round = round,
+      .count = count,
+      .crc = esp_rom_crc32_le(0, (const uint8_t *)records,
+                              count * sizeof(*records))};
+  FILE *f = fopen(HEALTH_FILE, "wb");
+  CHECK(f != NULL);
+  CHECK_EQ(fwrite(&header, sizeof(header), 1, f), 1);
+  CHECK_EQ(fwrite(records, sizeof(*records), count, f), count);
+  CHECK_EQ(fclose(f), 0);
+}
+
+// The saved table; free() it
+static station_health_t *read_results(health_file_header_t *header) {
+  FILE *f = fopen(HEALTH_FILE, "rb");
+  CHECK(f != NULL);
+  if (f == NULL) {
+    return NULL;
+  }
+  station_health_t *records = NULL;
+  CHECK_EQ(fread(header, sizeof(*header), 1, f), 1);
+  if (header->count <= STATION_COUNT) {
+    records = calloc(header->count + 1, sizeof(*records));
+    CHECK_EQ(fread(records, sizeof(*records), header->count, f),
+             header->count);
+  }
+  fclose(f);
+  return records;
+}
+
+/* ---------- the prober ---------- */
+
+static station_health_stats_t stats(void) {
+  station_health_stats_t st;
+  station_health_get_stats(&st);
+  return st;
+}
+
+static bool waiting_for(const char *reason) {
+  const char *waiting = stats().waiting;
+  return waiting && strcmp(waiting, reason) == 0;
+}
+
+// Waits until the prober idles for reason
+static bool wait_until_waiting(const char *reason) {
+  for (int i = 0; i < WAIT_MS / 10 && !waiting_for(reason); i++) {
+    usleep(10 * 1000);
+  }
+  return waiting_for(reason);
+}
+
+static station_health_t result(int station) {
+  station_health_t h = {0};
+  CHECK(station_health_get(STATION_ID(station), &h));
+  return h;
+}
+
+/* ---------- tests ---------- */
+
+// Nothing goes out while the link is down
+static void test_waits_for_wifi(void) {
+  CHECK(wait_until_waiting("wifi"));
+  usleep(100 * 1000);
+  CHECK_EQ(stats().probes, 0);
+  CHECK_EQ(stats().round, SAVED_ROUND);
+  host_wifi_set_connected(true);
+}
+
+static void test_round(void) {
+  CHECK(wait_until_waiting("round done"));
+  station_health_stats_t st = stats();
+  CHECK_EQ(st.round, SAVED_ROUND);
+  CHECK_EQ(st.probed, 9);
+  CHECK_EQ(st.probes, 5 + 4 * STATION_HEALTH_DEAD_FAILS);
+  CHECK_EQ(st.failures, 4 * STATION_HEALTH_DEAD_FAILS);
+  CHECK_EQ(st.discarded, 0);
+  CHECK_EQ(st.dead, 4);
+  CHECK(st.bytes > 4 * 8192);
+}
+
+// The frames' bitrate over icy-br
+static void test_mp3(void) {
+  station_health_t h = result(MP3);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.round, SAVED_ROUND);
+  CHECK_EQ(h.codec, CODEC_TYPE_MP3);
+  CHECK_EQ(h.bitrate_kbps, 128);
+  CHECK(!h.icy_bitrate);
+  CHECK_EQ(h.fails, 0);
+  CHECK(h.connect_ms < 1000 && h.first_byte_ms < 1000);
+}
+
+static void test_adts(void) {
+  station_health_t h = result(AAC);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.codec, CODEC_TYPE_AAC);
+  CHECK_EQ(h.bitrate_kbps, 64);
+}
+
+// The frames in the tag's picture are not the stream's
+static void test_id3_skipped(void) {
+  station_health_t h = result(ID3);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.codec, CODEC_TYPE_MP3);
+  CHECK_EQ(h.bitrate_kbps, 192);
+}
+
+// A relative redirect to a playlist, then its stream
+static void test_redirect_and_playlist(void) {
+  station_health_t h = result(REDIRECT);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.codec, CODEC_TYPE_AAC);
+  CHECK_EQ(h.bitrate_kbps, 64);
+}
+
+// Opus has no bitrate of its own: icy-br, from a Shoutcast v1 head
+static void test_icy(void) {
+  station_health_t h = result(ICY);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.codec, CODEC_TYPE_OPUS);
+  CHECK_EQ(h.bitrate_kbps, 48);
+  CHECK(h.icy_bitrate);
+}
+
+static void test_dead(void) {
+  static const struct {
+    int station;
+    station_health_error_t error;
+  } cases[] = {
+      {MISSING, STATION_HEALTH_ERR_HTTP},
+      {HTML, STATION_HEALTH_ERR_NO_AUDIO},
+      {LOOP, STATION_HEALTH_ERR_REDIRECTS},
+      {SILENT, STATION_HEALTH_ERR_TIMEOUT},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    station_health_t h = result(cases[i].station);
+    CHECK_EQ(h.status, STATION_HEALTH_DEAD);
+    CHECK_EQ(h.error, cases[i].error);
+    CHECK_EQ(h.fails, STATION_HEALTH_DEAD_FAILS);
+    CHECK_EQ(h.round, SAVED_ROUND);
+    CHECK(station_health_is_dead(STATION_ID(cases[i].station)));
+  }
+  CHECK(!station_health_is_dead(STATION_ID(MP3)));
+}
+
+// The saved round's result stands; a station no longer listed is gone
+static void test_loaded(void) {
+  station_health_t h = result(SAVED);
+  CHECK_EQ(h.status, STATION_HEALTH_OK);
+  CHECK_EQ(h.bitrate_kbps, 320);
+  CHECK_EQ(h.first_byte_ms, 123);
+  CHECK(!station_health_get(REMOVED_ID, &h));
+}
+
+// The probed stations, saved at the end of the pass
+static void test_saved(void) {
+  health_file_header_t header;
+  station_health_t *records = read_results(&header);
+  CHECK(records != NULL);
+  if (records == NULL) {
+    return;
+  }
+  CHECK_EQ(header.magic, HEALTH_MAGIC);
+  CHECK_EQ(header.record_size, sizeof(station_health_t));
+  CHECK_EQ(header.round, SAVED_ROUND);
+  CHECK_EQ(header.count, STATION_COUNT);
+  CHECK_EQ(header.crc,
+           esp_rom_crc32_le(0, (const uint8_t *)records,
+                            header.count * sizeof(*records)));
+  for (uint32_t i = 0; i < header.count && i < STATION_COUNT; i++) {
+    station_health_t h = result(i);
+    CHECK_EQ(records[i].id, STATION_ID(i));
+    CHECK(memcmp(&records[i], &h, sizeof(h)) == 0);
+  }
+  free(records);
+}
+
+// The best of the KMIR mirrors: the faster bitrate over the dead one
+static void test_mirror(void) {
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_EQ(station_health_best_mirror(s, MISSING), ID3);
+  CHECK_EQ(station_health_best_mirror(s, MP3), ID3);
+  CHECK_EQ(station_health_best_mirror(s, ID3), ID3);
+  CHECK_EQ(station_health_best_mirror(s, AAC), AAC);
+  station_snapshot_release(s);
+
+  station_health_t mp3 = result(MP3), id3 = result(ID3), gone = result(MISSING);
+  CHECK(station_health_score(&id3) > station_health_score(&mp3));
+  CHECK(station_health_score(&mp3) > station_health_score(&gone));
+}
+
+int main(void) {
+  if (!start_server()) {
+    printf("the health fixture server did not start\n");
+    return 1;
+  }
+  mkdir(STATION_STORE_DIR, 0755);
+  remove(STATION_STORE_DIR "/health.tmp");
+  station_health_t saved[] = {
+      {.id = REMOVED_ID, .round = SAVED_ROUND, .status = STATION_HEALTH_DEAD,
+       .fails = STATION_HEALTH_DEAD_FAILS, .codec = CODEC_TYPE_MP3},
+      {.id = STATION_ID(SAVED), .round = SAVED_ROUND,
+       .status = STATION_HEALTH_OK, .first_byte_ms = 123, .bitrate_kbps = 320,
+       .codec = CODEC_TYPE_MP3},
+  };
+  write_results(saved, 2, SAVED_ROUND);
+
+  install_stations();
+  host_wifi_set_connected(false);
+  CHECK_EQ(station_health_init(), ESP_OK);
+  RUN_TEST(test_waits_for_wifi);
+  RUN_TEST(test_round);
+  RUN_TEST(test_mp3);
+  RUN_TEST(test_adts);
+  RUN_TEST(test_id3_skipped);
+  RUN_TEST(test_redirect_and_playlist);
+  RUN_TEST(test_icy);
+  RUN_TEST(test_dead);
+  RUN_TEST(test_loaded);
+  RUN_TEST(test_saved);
+  RUN_TEST(test_mirror);
+  stop_server();
+  return host_test_result();
+}
@@ -0,0 +1,314 @@
+/* Station import from the playlist and radio-browser fixtures in
+ * fixtures/import/, whole and fed in small chunks. The list is saved to
+ * STATION_STORE_DIR, a scratch directory. */
+#include "host_test.h"
+#include "station_data.h"
+#include "station_import.h"
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIXTURE(name) FIXTURE_DIR "/import/" name
+
+static station_import_stats_t stats;
+
+// Imports a fixture; chunk 0 reads it with station_import_feed_file()
+static esp_err_t import_fixture(const char *path,
+                                station_import_options_t options,
+                                size_t chunk) {
+  station_import_t *import = station_import_begin(&options);
+  CHECK(import != NULL);
+  if (import == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t ret = ESP_OK;
+  if (chunk == 0) {
+    ret = station_import_feed_file(import, path);
+  } else {
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    char buf[64];
+    size_t n;
+    while (f != NULL && ret == ESP_OK && (n = fread(buf, 1, chunk, f)) > 0) {
+      ret = station_import_feed(import, buf, n);
+    }
+    if (f != NULL) {
+      fclose(f);
+    }
+  }
+  if (ret == ESP_OK) {
+    ret = station_import_finish(import);
+  }
+  station_import_get_stats(import, &stats);
+  if (ret != ESP_OK) {
+    printf("    import: %s\n", station_import_error(import));
+  }
+  station_import_free(import);
+  // Every entry is counted once by outcome
+  CHECK_EQ(stats.entries, stats.added + stats.duplicates + stats.filtered +
+                              stats.unsupported + stats.invalid +
+                              stats.dropped);
+  return ret;
+}
+
+static esp_err_t import_text(const char *text,
+                             station_import_options_t options) {
+  station_import_t *import = station_import_begin(&options);
+  esp_err_t ret = station_import_feed(import, text, strlen(text));
+  if (ret == ESP_OK) {
+    ret = station_import_finish(import);
+  }
+  station_import_get_stats(import, &stats);
+  station_import_free(import);
+  return ret;
+}
+
+// Starts from a list of one station
+static void reset_list(void) {
+  CHECK_EQ(import_text("http://base.example.com/stream\n",
+                       (station_import_options_t){.replace = true}),
+           ESP_OK);
+  CHECK_EQ(stats.stations, 1);
+}
+
+// The station n places from the end of the list
+static const station_t *from_end(const station_snapshot_t *s, int n) {
+  return &s->stations[s->count - n];
+}
+
+static void test_m3u(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("stations.m3u"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.entries, 7);
+  CHECK_EQ(stats.added, 4);
+  CHECK_EQ(stats.duplicates, 1);
+  CHECK_EQ(stats.unsupported, 1);
+  CHECK_EQ(stats.invalid, 1);
+  CHECK_EQ(stats.stations, 5);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_STR(from_end(s, 4)->call_sign, "KPLU Jazz");
+  CHECK_STR(from_end(s, 4)->uri, "http://jazz.example.org:80/live");
+  CHECK_EQ(from_end(s, 4)->codec, CODEC_TYPE_MP3);
+  CHECK_STR(from_end(s, 3)->call_sign, "Shoutcast");
+  CHECK_STR(from_end(s, 3)->uri, "http://sc.example.net:8000/;");
+  CHECK_EQ(from_end(s, 2)->codec, CODEC_TYPE_AAC);
+  // Untitled entries are named after their host
+  CHECK_STR(from_end(s, 1)->call_sign, "untitled.example.com");
+  CHECK_EQ(from_end(s, 1)->codec, CODEC_TYPE_OGG);
+  CHECK(from_end(s, 1)->id > from_end(s, 2)->id);
+  station_snapshot_release(s);
+}
+
+static void test_pls(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("stations.pls"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.entries, 4);
+  CHECK_EQ(stats.added, 3);
+  CHECK_EQ(stats.duplicates, 1);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_STR(from_end(s, 3)->call_sign, "PLS One");
+  CHECK_EQ(from_end(s, 3)->codec, CODEC_TYPE_AAC);
+  // Title before File
+  CHECK_STR(from_end(s, 2)->call_sign, "PLS Two");
+  CHECK_EQ(from_end(s, 2)->codec, CODEC_TYPE_FLAC);
+  CHECK_STR(from_end(s, 1)->uri, "http://pls3.example.com/hls/index.m3u8");
+  CHECK_EQ(from_end(s, 1)->codec, CODEC_TYPE_AAC);
+  station_snapshot_release(s);
+}
+
+static void test_xspf(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("stations.xspf"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.entries, 4);
+  CHECK_EQ(stats.added, 3);
+  CHECK_EQ(stats.invalid, 1);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_STR(from_end(s, 3)->call_sign, "Tom & Jerry FM");
+  CHECK_STR(from_end(s, 3)->uri, "http://x1.example.com/a.mp3?x=1&y=2");
+  // The first of several locations
+  CHECK_STR(from_end(s, 2)->uri, "https://x2.example.com/opus");
+  CHECK_EQ(from_end(s, 2)->codec, CODEC_TYPE_OPUS);
+  // Namespace prefixes
+  CHECK_STR(from_end(s, 1)->uri, "http://x3.example.com/live.flac");
+  CHECK_STR(from_end(s, 1)->call_sign, "x3.example.com");
+  station_snapshot_release(s);
+}
+
+static void test_radio_browser(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.entries, 12);
+  CHECK_EQ(stats.added, 6);
+  CHECK_EQ(stats.duplicates, 1);
+  CHECK_EQ(stats.filtered, 1);   // failed its last check
+  CHECK_EQ(stats.unsupported, 3); // WMA, HLS without .m3u8, playlist link
+  CHECK_EQ(stats.invalid, 1);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_STR(from_end(s, 6)->call_sign, "KUNC Jazz");
+  CHECK_STR(from_end(s, 6)->origin, "Colorado, US");
+  CHECK_STR(from_end(s, 5)->origin, "Germany");
+  CHECK_EQ(from_end(s, 5)->codec, CODEC_TYPE_AAC);
+  // Escapes and control characters in names, codec from the URL
+  CHECK_STR(from_end(s, 4)->call_sign, "Radio \xc3\x91 \xe2\x80\x94 "
+                                       "\"quoted\" name");
+  CHECK_STR(from_end(s, 4)->origin, "\xc3\x8ele-de-France, FR");
+  CHECK_EQ(from_end(s, 4)->codec, CODEC_TYPE_OGG);
+  CHECK_STR(from_end(s, 3)->uri,
+            "https://hls.example.com/live/master.m3u8?token=1");
+  // Members longer than the tokenizer's strings are cut, not an error
+  CHECK_STR(from_end(s, 2)->call_sign, "Long strings");
+  CHECK_STR(from_end(s, 1)->call_sign, "KRCC");
+  CHECK_EQ(from_end(s, 1)->codec, CODEC_TYPE_MP3);
+  station_snapshot_release(s);
+}
+
+static void test_same_result_in_any_chunk_size(void) {
+  static const char *const fixtures[] = {
+      FIXTURE("stations.m3u"), FIXTURE("stations.pls"),
+      FIXTURE("stations.xspf"), FIXTURE("radio_browser.json")};
+  for (size_t f = 0; f < sizeof(fixtures) / sizeof(fixtures[0]); f++) {
+    reset_list();
+    CHECK_EQ(import_fixture(fixtures[f], (station_import_options_t){0}, 0),
+             ESP_OK);
+    station_import_stats_t whole = stats;
+    for (size_t chunk = 1; chunk < 8; chunk++) {
+      reset_list();
+      CHECK_EQ(import_fixture(fixtures[f], (station_import_options_t){0},
+                              chunk),
+               ESP_OK);
+      CHECK_EQ(memcmp(&stats, &whole, sizeof(stats)), 0);
+    }
+  }
+}
+
+static void test_radio_browser_filters(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){.tag = "JAZZ"}, 3),
+           ESP_OK);
+  CHECK_EQ(stats.added, 3); // KUNC, Radio Ñ, KRCC; the mirror is a duplicate
+  CHECK_EQ(stats.filtered, 8);
+
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){.country = "germany"},
+                          0),
+           ESP_OK);
+  CHECK_EQ(stats.added, 2);
+
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){.country = "us",
+                                                     .tag = "jazz",
+                                                     .include_broken = true},
+                          0),
+           ESP_OK);
+  CHECK_EQ(stats.added, 3); // KUNC, Broken, KRCC
+}
+
+static void test_limit_and_duplicates_of_the_list(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){.limit = 2}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.added, 2);
+  CHECK_EQ(stats.dropped, 4);
+  CHECK_EQ(stats.stations, 3);
+  // Stations already in the list count as duplicates
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.added, 4);
+  CHECK_EQ(stats.duplicates, 3);
+  CHECK_EQ(import_fixture(FIXTURE("radio_browser.json"),
+                          (station_import_options_t){0}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.added, 0);
+  CHECK_EQ(stats.stations, 7);
+}
+
+static void test_replace(void) {
+  reset_list();
+  CHECK_EQ(import_fixture(FIXTURE("stations.xspf"),
+                          (station_import_options_t){.replace = true}, 0),
+           ESP_OK);
+  CHECK_EQ(stats.stations, 3);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_STR(s->stations[0].call_sign, "Tom & Jerry FM");
+  station_snapshot_release(s);
+  // A replacement without a playable station keeps the list
+  CHECK(import_text("#EXTM3U\nftp://nothing.example.com/\n",
+                    (station_import_options_t){.replace = true}) != ESP_OK);
+  s = station_snapshot_acquire();
+  CHECK_EQ(s->count, 3);
+  station_snapshot_release(s);
+}
+
+static void test_rejected_input(void) {
+  reset_list();
+  CHECK_EQ(import_text("#EXTM3U\n#EXT-X-TARGETDURATION:6\nseg1.ts\n",
+                       (station_import_options_t){0}),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(import_text("[{\"name\":\"x\",\"url\":}]",
+                       (station_import_options_t){0}),
+           ESP_ERR_INVALID_ARG);
+  CHECK_EQ(import_text("{\"name\":\"x\"}", (station_import_options_t){0}),
+           ESP_ERR_INVALID_ARG);
+  station_import_t *import =
+      station_import_begin(&(station_import_options_t){0});
+  CHECK_EQ(station_import_feed_file(import, FIXTURE("missing.m3u")),
+           ESP_ERR_NOT_FOUND);
+  station_import_free(import);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_EQ(s->count, 1);
+  station_snapshot_release(s);
+}
+
+static void test_failed_save_restores_the_list(void) {
+  reset_list();
+  remove(STATION_STORE_DIR "/stations.bin");
+  remove(STATION_STORE_DIR "/stations.jnl");
+  rmdir(STATION_STORE_DIR);
+  CHECK_EQ(import_fixture(FIXTURE("stations.m3u"),
+                          (station_import_options_t){0}, 0),
+           ESP_FAIL);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_EQ(s->count, 1);
+  station_snapshot_release(s);
+  mkdir(STATION_STORE_DIR, 0755);
+}
+
+static void test_format_names(void) {
+  CHECK_EQ(station_import_format_from_name("radio-browser"),
+           STATION_IMPORT_RADIO_BROWSER);
+  CHECK_EQ(station_import_format_from_name("json"),
+           STATION_IMPORT_RADIO_BROWSER);
+  CHECK_EQ(station_import_format_from_name("m3u8"), STATION_IMPORT_M3U);
+  CHECK_EQ(station_import_format_from_name("PLS"), STATION_IMPORT_PLS);
+  CHECK_EQ(station_import_format_from_name("xspf"), STATION_IMPORT_XSPF);
+  CHECK_EQ(station_import_format_from_name("wma"), STATION_IMPORT_AUTO);
+}
+
+int main(void) {
+  mkdir(STATION_STORE_DIR, 0755);
+  RUN_TEST(test_m3u);
+  RUN_TEST(test_pls);
+  RUN_TEST(test_xspf);
+  RUN_TEST(test_radio_browser);
+  RUN_TEST(test_same_result_in_any_chunk_size);
+  RUN_TEST(test_radio_browser_filters);
+  RUN_TEST(test_limit_and_duplicates_of_the_list);
+  RUN_TEST(test_replace);
+  RUN_TEST(test_rejected_input);
+  RUN_TEST(test_failed_save_restores_the_list);
+  RUN_TEST(test_format_names);
+  return host_test_result();
+}
@@ -0,0 +1,115 @@
+/* Station search index against a linear scan with the same ranking */
+#include "host_test.h"
+#include "station_gen.h"
+#include "station_index.h"
+#include "station_index_reference.h"
+
+static const char *const queries[] = {
+    "k",        "w",       "wa",     "ch",        "kabc", "jazz",
+    "JAZZ fm",  "seattle", "salt l", "lake city", "xyzq", "o",
+    "rock rad", "network", "zz",     "a.b",       "9",    "  seattle ",
+    "hits",     "ubl",     "kx",     "ity, c",    "e",    "college radio"};
+
+static station_t *stations_of(const station_gen_t *gen) {
+  station_t *stations = calloc(gen->count, sizeof(station_t));
+  for (int i = 0; i < gen->count; i++) {
+    stations[i] = (station_t){.id = gen->entries[i].id,
+                              .call_sign = (char *)gen->entries[i].call_sign,
+                              .origin = (char *)gen->entries[i].origin,
+                              .uri = (char *)gen->entries[i].uri,
+                              .codec = gen->entries[i].codec};
+  }
+  return stations;
+}
+
+static void check_query(const station_index_t *index,
+                        const station_t *stations, int count, const char *q,
+                        int max) {
+  station_match_t got[STATION_INDEX_MAX_RESULTS], want[STATION_INDEX_MAX_RESULTS];
+  int found = station_index_search(index, q, got, max);
+  int expected = reference_search(stations, count, q, want, max);
+  CHECK_EQ(found, expected);
+  for (int i = 0; i < found && i < expected; i++) {
+    if (got[i].index != want[i].index || got[i].score != want[i].score) {
+      fprintf(stderr, "\"%s\" result %d: station %d score %d, expected %d %d\n",
+              q, i, got[i].index, got[i].score, want[i].index, want[i].score);
+      CHECK(false);
+      break;
+    }
+  }
+}
+
+static void test_matches_linear_scan(void) {
+  station_gen_t gen;
+  CHECK(station_gen_named(&gen, 3000, 35));
+  station_t *stations = stations_of(&gen);
+  station_index_t *index = station_index_build(stations, gen.count);
+  CHECK(index != NULL);
+  for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+    check_query(index, stations, gen.count, queries[i], 10);
+    check_query(index, stations, gen.count, queries[i],
+                STATION_INDEX_MAX_RESULTS);
+  }
+  station_index_stats_t stats;
+  station_index_get_stats(index, &stats);
+  CHECK_EQ(stats.stations, 3000);
+  CHECK(stats.trigrams > 0 && stats.words > 0 && stats.bytes > 0);
+  station_index_free(index);
+  free(stations);
+  station_gen_free(&gen);
+}
+
+static void test_ranking(void) {
+  station_t stations[] = {
+      {1, "Jazz FM", "Boston", "", 0},          // call sign prefix
+      {2, "KJAZ", "Jazz City", "", 0},          // origin prefix
+      {3, "WJZZ", "Smooth Jazz Radio", "", 0},  // word prefix
+      {4, "KUVO", "Denver, JazzAtNight", "", 0}, // word prefix, later
+      {5, "JAZZ", "Anywhere", "", 0},           // exact
+      {6, "KXJAZZ", "Nowhere", "", 0},          // substring only
+      {7, "KEXP", "Seattle", "", 0},            // no match
+  };
+  station_index_t *index = station_index_build(stations, 7);
+  station_match_t out[8];
+  CHECK_EQ(station_index_search(index, "jazz", out, 8), 6);
+  static const int order[] = {4, 0, 1, 2, 3, 5};
+  for (int i = 0; i < 6; i++) {
+    CHECK_EQ(out[i].index, order[i]);
+  }
+  // Two characters: word starts only, no substrings
+  CHECK_EQ(station_index_search(index, "ja", out, 8), 5);
+  station_index_free(index);
+}
+
+static void test_jump_initial(void) {
+  station_t stations[] = {
+      {1, "KEXP", "", "", 0}, {2, "Bravo", "", "", 0},
+      {3, "kbut", "", "", 0}, {4, "WFUV", "", "", 0},
+  };
+  station_index_t *index = station_index_build(stations, 4);
+  CHECK_EQ(station_index_jump_initial(index, 0, 1), 3);  // k -> w
+  CHECK_EQ(station_index_jump_initial(index, 3, 1), 1);  // w -> b, wraps
+  CHECK_EQ(station_index_jump_initial(index, 1, -1), 3); // b -> w, wraps
+  CHECK_EQ(station_index_jump_initial(index, 2, -1), 1); // k -> b
+  CHECK_EQ(station_index_jump_initial(index, 9, 1), 9);
+  station_index_free(index);
+}
+
+static void test_empty_and_missing_index(void) {
+  station_match_t out[4];
+  station_index_t *index = station_index_build(NULL, 0);
+  CHECK(index != NULL);
+  CHECK_EQ(station_index_search(index, "abc", out, 4), 0);
+  CHECK_EQ(station_index_search(index, "a", out, 4), 0);
+  station_index_free(index);
+  CHECK_EQ(station_index_search(NULL, "abc", out, 4), 0);
+  station_index_free(NULL);
+}
+
+int main(void) {
+  RUN_TEST(test_matches_linear_scan);
+  RUN_TEST(test_ranking);
+  RUN_TEST(test_jump_initial);
+  RUN_TEST(test_empty_and_missing_index);
+  return host_test_result();
+}
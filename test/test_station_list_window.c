@@ -0,0 +1,78 @@
+/* Station selection list rows: wrapping, short lists, step direction */
+#include "host_test.h"
+#include "station_list_window.h"
+
+static void test_center_row_is_selection(void) {
+  for (int count = 1; count <= 12; count++) {
+    for (int selected = 0; selected < count; selected++) {
+      CHECK_EQ(station_list_row_station(count, selected,
+                                        STATION_LIST_CENTER_ROW),
+               selected);
+    }
+  }
+}
+
+static void test_rows_wrap(void) {
+  int expected[STATION_LIST_ROWS] = {98, 99, 0, 1, 2};
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    CHECK_EQ(station_list_row_station(100, 0, r), expected[r]);
+  }
+  CHECK_EQ(station_list_row_station(100, 99, STATION_LIST_ROWS - 1), 1);
+}
+
+static void test_short_lists_show_each_station_once(void) {
+  for (int count = 1; count <= 12; count++) {
+    for (int selected = 0; selected < count; selected++) {
+      int seen[12] = {0};
+      int shown = 0, prev = -1;
+      for (int r = 0; r < STATION_LIST_ROWS; r++) {
+        int index = station_list_row_station(count, selected, r);
+        if (index < 0) {
+          continue;
+        }
+        CHECK(index < count);
+        CHECK_EQ(seen[index], 0);
+        seen[index] = 1;
+        // Shown rows are consecutive stations
+        if (prev >= 0) {
+          CHECK_EQ(index, (prev + 1) % count);
+        }
+        prev = index;
+        shown++;
+      }
+      CHECK_EQ(shown, count < STATION_LIST_ROWS ? count : STATION_LIST_ROWS);
+    }
+  }
+  // Two stations: the other one below the selection
+  CHECK_EQ(station_list_row_station(2, 0, STATION_LIST_CENTER_ROW - 1), -1);
+  CHECK_EQ(station_list_row_station(2, 0, STATION_LIST_CENTER_ROW + 1), 1);
+}
+
+static void test_empty_list_hides_every_row(void) {
+  for (int r = 0; r < STATION_LIST_ROWS; r++) {
+    CHECK_EQ(station_list_row_station(0, 0, r), -1);
+  }
+}
+
+static void test_step_takes_the_short_way(void) {
+  CHECK_EQ(station_list_step(100, 5, 6), 1);
+  CHECK_EQ(station_list_step(100, 6, 5), -1);
+  CHECK_EQ(station_list_step(100, 99, 0), 1);
+  CHECK_EQ(station_list_step(100, 0, 99), -1);
+  CHECK_EQ(station_list_step(100, 0, 50), 50);
+  CHECK_EQ(station_list_step(100, 10, 70), -40);
+  CHECK_EQ(station_list_step(3, 2, 0), 1);
+  CHECK_EQ(station_list_step(1, 0, 0), 0);
+  // Before the first fill the previous selection is -1
+  CHECK_EQ(station_list_step(100, -1, 0), 1);
+  CHECK_EQ(station_list_step(0, -1, 0), 1);
+}
+
+int main(void) {
+  RUN_TEST(test_center_row_is_selection);
+  RUN_TEST(test_rows_wrap);
+  RUN_TEST(test_short_lists_show_each_station_once);
+  RUN_TEST(test_empty_list_hides_every_row);
+  RUN_TEST(test_step_takes_the_short_way);
+  return host_test_result();
+}
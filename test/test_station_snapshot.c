@@ -0,0 +1,157 @@
+/* Station list snapshots under load: four readers acquire, read and release
+ * the list, some holding on to a few at a time, while 300 lists are
+ * published over it. Every snapshot a reader gets must be one whole list,
+ * and once the readers stop, only the current list may be left allocated,
+ * though the last old lists were released while others were acquiring. Built with
+ * ThreadSanitizer where the tests are sanitized. */
+#include "host_test.h"
+#include "station_data.h"
+#include "station_image.h"
+#include "station_index.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define READERS 4
+#define PUBLISHES 300
+#define STATIONS 8
+#define HELD 16 // lists a reader keeps at once
+
+// Search indexes live: one per list
+static atomic_int indexes;
+
+station_index_t *__real_station_index_build(const station_t *stations,
+                                            int count);
+void __real_station_index_free(station_index_t *index);
+
+station_index_t *__wrap_station_index_build(const station_t *stations,
+                                            int count) {
+  station_index_t *index = __real_station_index_build(stations, count);
+  if (index != NULL) {
+    atomic_fetch_add(&indexes, 1);
+  }
+  return index;
+}
+
+void __wrap_station_index_free(station_index_t *index) {
+  if (index != NULL) {
+    atomic_fetch_sub(&indexes, 1);
+  }
+  __real_station_index_free(index);
+}
+
+static atomic_bool stop_holders, stop;
+static atomic_int bad_snapshots;
+static atomic_long reads;
+
+// The stations of list g all name it
+static void check_snapshot(const station_snapshot_t *s) {
+  if (s->count == 0) {
+    return; // before the first list
+  }
+  int g = -1;
+  bool ok = s->count == STATIONS && s->index != NULL &&
+            sscanf(s->stations[0].call_sign, "G%d", &g) == 1;
+  for (int i = 0; ok && i < s->count; i++) {
+    char want[32];
+    snprintf(want, sizeof(want), "http://list%d.example/%d", g, i);
+    ok = strcmp(s->stations[i].uri, want) == 0 &&
+         strcmp(s->stations[i].call_sign, s->stations[0].call_sign) == 0 &&
+         station_snapshot_find_id(s, s->stations[i].id) == i;
+  }
+  if (!ok) {
+    atomic_fetch_add(&bad_snapshots, 1);
+  }
+}
+
+static void *reader_main(void *arg) {
+  int n = (int)(intptr_t)arg;
+  const station_snapshot_t *held[HELD] = {NULL};
+  int last = 0;
+  atomic_bool *done = n % 2 ? &stop_holders : &stop;
+  while (!atomic_load(done)) {
+    const station_snapshot_t *s = station_snapshot_acquire();
+    // Once the holders let go, the others only acquire, to keep the window
+    // busy while they do
+    if (!atomic_load(&stop_holders)) {
+      check_snapshot(s);
+    }
+    if (n % 2 == 0 || s == held[last]) {
+      station_snapshot_release(s);
+    } else {
+      // Keep the last few lists, so retired ones still have references
+      last = (last + 1) % HELD;
+      station_snapshot_release(held[last]);
+      held[last] = s;
+    }
+    atomic_fetch_add(&reads, 1);
+  }
+  for (int i = 0; i < HELD; i++) {
+    station_snapshot_release(held[i]);
+  }
+  return NULL;
+}
+
+static void publish(int g) {
+  char call_sign[16], uris[STATIONS][32];
+  station_entry_t entries[STATIONS];
+  snprintf(call_sign, sizeof(call_sign), "G%d", g);
+  for (int i = 0; i < STATIONS; i++) {
+    snprintf(uris[i], sizeof(uris[i]), "http://list%d.example/%d", g, i);
+    entries[i] = (station_entry_t){.call_sign = call_sign,
+                                   .origin = "Here",
+                                   .uri = uris[i],
+                                   .codec = CODEC_TYPE_MP3};
+  }
+  station_image_t image;
+  CHECK_EQ(station_image_build(entries, STATIONS, &image), ESP_OK);
+  CHECK_EQ(station_data_install(&image), ESP_OK);
+}
+
+static void test_readers_and_publishes(void) {
+  pthread_t readers[READERS];
+  for (int i = 0; i < READERS; i++) {
+    pthread_create(&readers[i], NULL, reader_main, (void *)(intptr_t)i);
+  }
+  for (int g = 0; g < PUBLISHES; g++) {
+    publish(g);
+    // Let the readers in between
+    long before = atomic_load(&reads);
+    while (atomic_load(&reads) < before + 50) {
+      sched_yield();
+    }
+  }
+  // The last references to old lists go while the others still acquire.
+  // Holding the current list keeps their releases from reclaiming, so
+  // nothing comes after to free what those last releases leave.
+  const station_snapshot_t *current = station_snapshot_acquire();
+  atomic_store(&stop_holders, true);
+  for (int i = 1; i < READERS; i += 2) {
+    pthread_join(readers[i], NULL);
+  }
+  atomic_store(&stop, true);
+  for (int i = 0; i < READERS; i += 2) {
+    pthread_join(readers[i], NULL);
+  }
+  CHECK_EQ(atomic_load(&bad_snapshots), 0);
+  CHECK(atomic_load(&reads) >= PUBLISHES * 50);
+  // Nothing but the current list
+  CHECK_EQ(atomic_load(&indexes), 1);
+  CHECK_STR(current->stations[0].call_sign, "G299");
+  station_snapshot_release(current);
+  CHECK_EQ(atomic_load(&indexes), 1);
+
+  free_station_data();
+  CHECK_EQ(atomic_load(&indexes), 0);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  CHECK_EQ(s->count, 0);
+  station_snapshot_release(s);
+}
+
+int main(void) {
+  RUN_TEST(test_readers_and_publishes);
+  return host_test_result();
+}
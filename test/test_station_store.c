@@ -0,0 +1,226 @@
+/* Station image and store: validation, full and journaled saves, and the
+ * crash cases the store recovers from at load. The store works in
+ * STATION_STORE_DIR, a scratch directory. */
+#include "host_test.h"
+#include "station_image.h"
+#include "station_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BASE_PATH STATION_STORE_DIR "/stations.bin"
+#define COMPACT_PATH STATION_STORE_DIR "/stations.new"
+#define JOURNAL_PATH STATION_STORE_DIR "/stations.jnl"
+
+static station_entry_t entries[] = {
+    {1, "KEXP", "Seattle", "https://kexp.streamguys1.com/kexp160.aac",
+     CODEC_TYPE_AAC},
+    {2, "KDUR", "Durango", "https://kdurradio.fortlewis.edu/stream",
+     CODEC_TYPE_MP3},
+    {3, "WMBR", "MIT", "https://wmbr.org:8002/hi", CODEC_TYPE_MP3},
+    {4, "KALX", "Berkeley", "https://stream.kalx.berkeley.edu:8443/kalx.mp3",
+     CODEC_TYPE_MP3},
+};
+#define ENTRY_COUNT ((int)(sizeof(entries) / sizeof(entries[0])))
+
+static void reset_dir(void) {
+  mkdir(STATION_STORE_DIR, 0755);
+  remove(BASE_PATH);
+  remove(COMPACT_PATH);
+  remove(JOURNAL_PATH);
+}
+
+static long file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Checks image against entries[0..count) in order
+static void check_matches(const station_image_t *image,
+                          const station_entry_t *expect, int count) {
+  CHECK_EQ(image->header->count, count);
+  for (int i = 0; i < count && i < (int)image->header->count; i++) {
+    const station_record_t *rec = &image->records[i];
+    CHECK_EQ(rec->id, expect[i].id);
+    CHECK_STR(station_image_str(image, rec->call_sign_off),
+              expect[i].call_sign);
+    CHECK_STR(station_image_str(image, rec->origin_off), expect[i].origin);
+    CHECK_STR(station_image_str(image, rec->uri_off), expect[i].uri);
+    CHECK_EQ(rec->codec, expect[i].codec);
+  }
+}
+
+static void test_build_assigns_missing_and_duplicate_ids(void) {
+  station_entry_t list[3] = {entries[0], entries[1], entries[2]};
+  list[1].id = 0;
+  list[2].id = 1;
+  station_image_t image;
+  CHECK_EQ(station_image_build(list, 3, &image), ESP_OK);
+  CHECK_EQ(image.records[0].id, 1);
+  CHECK(image.records[1].id > 1);
+  CHECK(image.records[2].id > 1);
+  CHECK(image.records[1].id != image.records[2].id);
+  station_image_free(&image);
+}
+
+static void test_adopt_rejects_damage(void) {
+  station_image_t image;
+  CHECK_EQ(station_image_build(entries, ENTRY_COUNT, &image), ESP_OK);
+
+  // An intact copy is accepted
+  void *copy = malloc(image.size);
+  memcpy(copy, image.block, image.size);
+  station_image_t adopted;
+  CHECK_EQ(station_image_adopt(copy, image.size, &adopted), ESP_OK);
+  check_matches(&adopted, entries, ENTRY_COUNT);
+  station_image_free(&adopted);
+
+  // One flipped bit in the arena fails the CRC
+  copy = malloc(image.size);
+  memcpy(copy, image.block, image.size);
+  ((uint8_t *)copy)[image.size - 3] ^= 0x10;
+  CHECK(station_image_adopt(copy, image.size, &adopted) != ESP_OK);
+
+  // So does a short file
+  copy = malloc(image.size);
+  memcpy(copy, image.block, image.size);
+  CHECK(station_image_adopt(copy, image.size - 1, &adopted) != ESP_OK);
+  station_image_free(&image);
+}
+
+static void test_load_without_image(void) {
+  reset_dir();
+  station_image_t image;
+  CHECK_EQ(station_store_load(&image), ESP_ERR_NOT_FOUND);
+}
+
+static void test_full_save_and_load(void) {
+  reset_dir();
+  station_image_t image, loaded;
+  CHECK_EQ(station_image_build(entries, ENTRY_COUNT, &image), ESP_OK);
+  CHECK_EQ(station_store_save(NULL, &image), ESP_OK);
+  CHECK_EQ(file_size(BASE_PATH), (long)image.size);
+  CHECK_EQ(file_size(JOURNAL_PATH), -1);
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, entries, ENTRY_COUNT);
+  station_image_free(&loaded);
+  station_image_free(&image);
+}
+
+// Saves entries, then list on top of it through the journal
+static void save_with_journal(const station_entry_t *list, int count) {
+  reset_dir();
+  station_image_t base, edited;
+  CHECK_EQ(station_image_build(entries, ENTRY_COUNT, &base), ESP_OK);
+  CHECK_EQ(station_store_save(NULL, &base), ESP_OK);
+  CHECK_EQ(station_image_build(list, count, &edited), ESP_OK);
+  CHECK_EQ(station_store_save(&base, &edited), ESP_OK);
+  CHECK_EQ(file_size(BASE_PATH), (long)base.size); // base left alone
+  CHECK(file_size(JOURNAL_PATH) > 0);
+  station_image_free(&edited);
+  station_image_free(&base);
+}
+
+static void test_journal_replays_edits(void) {
+  // Rename one, delete one, add one and reorder
+  station_entry_t list[] = {entries[3], entries[0], entries[1],
+                            {5, "KRCL", "Salt Lake City",
+                             "http://stream.xmission.com:8000/krcl-low",
+                             CODEC_TYPE_AAC}};
+  list[1].origin = "Seattle, WA";
+  save_with_journal(list, 4);
+  station_image_t loaded;
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, list, 4);
+  station_image_free(&loaded);
+}
+
+static void test_torn_journal_tail_is_dropped(void) {
+  station_entry_t list[ENTRY_COUNT];
+  memcpy(list, entries, sizeof(list));
+  list[0].origin = "Seattle, WA";
+  save_with_journal(list, ENTRY_COUNT);
+  // A crash in the middle of appending: add half a record's garbage
+  FILE *f = fopen(JOURNAL_PATH, "ab");
+  CHECK(f != NULL);
+  if (f != NULL) {
+    fwrite("\x01\x00\x00\x00\x40\x00", 1, 6, f);
+    fclose(f);
+  }
+  station_image_t loaded;
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, list, ENTRY_COUNT);
+  // The torn tail is compacted away so later appends stay reachable
+  CHECK_EQ(file_size(JOURNAL_PATH), -1);
+  CHECK_EQ(file_size(BASE_PATH), (long)loaded.size);
+  station_image_free(&loaded);
+}
+
+static void test_stale_journal_is_ignored(void) {
+  station_entry_t list[ENTRY_COUNT];
+  memcpy(list, entries, sizeof(list));
+  list[2].call_sign = "WMBR-FM";
+  save_with_journal(list, ENTRY_COUNT);
+  // Replace the base behind the journal's back
+  station_image_t other;
+  CHECK_EQ(station_image_build(entries, 2, &other), ESP_OK);
+  FILE *f = fopen(BASE_PATH, "wb");
+  CHECK(f != NULL);
+  if (f != NULL) {
+    fwrite(other.block, 1, other.size, f);
+    fclose(f);
+  }
+  station_image_t loaded;
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, entries, 2);
+  CHECK_EQ(file_size(JOURNAL_PATH), -1);
+  station_image_free(&loaded);
+  station_image_free(&other);
+}
+
+static void test_interrupted_compaction(void) {
+  // Complete stations.new: promoted over the base
+  reset_dir();
+  station_image_t base, next, loaded;
+  CHECK_EQ(station_image_build(entries, ENTRY_COUNT, &base), ESP_OK);
+  CHECK_EQ(station_store_save(NULL, &base), ESP_OK);
+  CHECK_EQ(station_image_build(entries + 1, ENTRY_COUNT - 1, &next), ESP_OK);
+  FILE *f = fopen(COMPACT_PATH, "wb");
+  CHECK(f != NULL);
+  if (f != NULL) {
+    fwrite(next.block, 1, next.size, f);
+    fclose(f);
+  }
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, entries + 1, ENTRY_COUNT - 1);
+  CHECK_EQ(file_size(COMPACT_PATH), -1);
+  station_image_free(&loaded);
+
+  // Half written: discarded, the base stays
+  CHECK_EQ(station_store_save(NULL, &base), ESP_OK);
+  f = fopen(COMPACT_PATH, "wb");
+  CHECK(f != NULL);
+  if (f != NULL) {
+    fwrite(next.block, 1, next.size / 2, f);
+    fclose(f);
+  }
+  CHECK_EQ(station_store_load(&loaded), ESP_OK);
+  check_matches(&loaded, entries, ENTRY_COUNT);
+  CHECK_EQ(file_size(COMPACT_PATH), -1);
+  station_image_free(&loaded);
+  station_image_free(&next);
+  station_image_free(&base);
+}
+
+int main(void) {
+  RUN_TEST(test_build_assigns_missing_and_duplicate_ids);
+  RUN_TEST(test_adopt_rejects_damage);
+  RUN_TEST(test_load_without_image);
+  RUN_TEST(test_full_save_and_load);
+  RUN_TEST(test_journal_replays_edits);
+  RUN_TEST(test_torn_journal_tail_is_dropped);
+  RUN_TEST(test_stale_journal_is_ignored);
+  RUN_TEST(test_interrupted_compaction);
+  return host_test_result();
+}
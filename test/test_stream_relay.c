@@ -0,0 +1,659 @@
+/* LAN relay: a stand-in HTTP reader feeds the relay's tap while listeners on
+ * socketpairs take the stream, with the test running the web server's work
+ * queue. Checked are listeners getting the stream byte for byte from the
+ * shared ring, across a station change that keeps them and codec changes
+ * that don't; a listener that stops reading dropped with only stream bytes
+ * sent, and one reading slower than the stream arrives; a listener whose
+ * bytes the relay task is overwriting, dropped before they go out, or as
+ * soon as a send raced it; late Ogg and FLAC
+ * listeners getting the stream header, then the stream from a page or frame
+ * start; refusals while off, idle or full. */
+#include "host_test.h"
+#include "app_config.h"
+#include "decoder_registry.h"
+#include "stream_relay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Frames and headers are whole words: the tap, like ADF's, hands out
+// whole words while more may follow
+#define MP3_FRAME 416
+#define FLAC_FRAME 1500
+#define OGG_PAGE (27 + 17 + 4004)
+#define FRAME_MAX OGG_PAGE
+#define HEAD_MAX 128
+// As in stream_relay.c
+#define RELAY_BUFFER_SIZE (128 * 1024)
+#define RELAY_READ_CHUNK 4096
+#define RELAY_MAX_LAG (RELAY_BUFFER_SIZE - 2 * RELAY_READ_CHUNK)
+#define RELAY_BURST (16 * 1024)
+#define RELAY_SEND_MAX 4096
+
+#define FEED_CHUNK 4096
+#define WAIT_MS 3000
+
+app_runtime_config_t g_runtime_config = {.relay_max_clients =
+                                             STREAM_RELAY_MAX_CLIENTS};
+
+const char *codec_type_to_string(codec_type_t codec) {
+  return decoder_registry_name(codec);
+}
+
+static ringbuf_handle_t tap;
+
+esp_err_t audio_pipeline_tap_insert(pipeline_tap_t which, ringbuf_handle_t rb) {
+  CHECK_EQ(which, PIPELINE_TAP_RELAY);
+  tap = rb;
+  return ESP_OK;
+}
+
+void audio_pipeline_tap_remove(pipeline_tap_t which) { tap = NULL; }
+
+static httpd_handle_t server;
+
+/* ---------- streams ---------- */
+
+// A frame or Ogg page carrying its sequence number in 6-bit bytes, so that
+// neither it nor the payload ever looks like a sync
+static size_t make_frame(codec_type_t codec, uint32_t seq, uint8_t *out) {
+  size_t len;
+  size_t payload;
+  if (codec == CODEC_TYPE_OGG) {
+    len = OGG_PAGE;
+    memset(out, 0, 27);
+    memcpy(out, "OggS", 4);
+    uint64_t granule = 960 * ((uint64_t)seq + 1);
+    for (int i = 0; i < 8; i++) {
+      out[6 + i] = granule >> (8 * i);
+    }
+    out[26] = 17;
+    memset(out + 27, 250, 16);
+    out[27 + 16] = 4;
+    payload = 27 + 17;
+  } else {
+    len = codec == CODEC_TYPE_MP3 ? MP3_FRAME : FLAC_FRAME;
+    memcpy(out, codec == CODEC_TYPE_MP3 ? "\xFF\xFB\x90\x64" : "\xFF\xF8\x69\x08",
+           4);
+    payload = 4;
+  }
+  for (size_t i = payload; i < len; i++) {
+    out[i] = 0x20 + ((seq + i) & 0x1F);
+  }
+  for (int i = 0; i < 4; i++) {
+    out[payload + i] = seq >> (6 * i) & 0x3F;
+  }
+  return len;
+}
+
+// FLAC metadata or the Ogg header pages
+static size_t make_head(codec_type_t codec, uint8_t *out) {
+  if (codec == CODEC_TYPE_FLAC) {
+    memcpy(out, "fLaC\x00\x00\x00\x22", 8);
+    memset(out + 8, 0x11, 34);
+    memcpy(out + 42, "\x81\x00\x00\x02\x00\x00", 6); // last: padding
+    return 48;
+  }
+  if (codec == CODEC_TYPE_OGG) {
+    static const size_t body[2] = {19, 25};
+    size_t len = 0;
+    for (int i = 0; i < 2; i++) {
+      uint8_t *page = out + len;
+      memset(page, 0, 27);
+      memcpy(page, "OggS", 4);
+      page[5] = i == 0 ? 2 : 0; // beginning of stream
+      page[26] = 1;
+      page[27] = body[i];
+      memset(page + 28, i == 0 ? 'H' : 'T', body[i]);
+      len += 28 + body[i];
+    }
+    return len;
+  }
+  return 0;
+}
+
+typedef struct {
+  codec_type_t codec;
+  uint8_t *data;
+  size_t len;
+  size_t head;     // header bytes at the start
+  size_t frame;    // bytes of each frame after it
+  size_t fed;      // bytes written to the tap so far
+} stream_t;
+
+// A station's stream: the header its codec has, then frames first..
+static void stream_make(stream_t *s, codec_type_t codec, uint32_t first,
+                        uint32_t frames) {
+  s->codec = codec;
+  s->data = malloc(HEAD_MAX + (size_t)frames * FRAME_MAX);
+  s->head = s->len = make_head(codec, s->data);
+  for (uint32_t seq = first; seq < first + frames; seq++) {
+    s->frame = make_frame(codec, seq, s->data + s->len);
+    s->len += s->frame;
+  }
+  s->fed = 0;
+}
+
+static bool frame_start(const stream_t *s, size_t pos) {
+  return pos >= s->head && (pos - s->head) % s->frame == 0;
+}
+
+/* ---------- listeners ---------- */
+
+typedef struct {
+  int fd;        // the listener's end
+  int server_fd; // the session's end
+  uint8_t *buf;  // response head, then the body as received
+  size_t len;
+  size_t body;  // where the body starts in buf, 0 until the head is in
+  size_t per_read; // bytes taken each time the test serves, 0 for none
+  bool closed;
+} listener_t;
+
+static listener_t *active[STREAM_RELAY_MAX_CLIENTS + 1];
+
+static void listener_read(listener_t *l, size_t max) {
+  while (max > 0 && !l->closed) {
+    l->buf = realloc(l->buf, l->len + MIN(max, 65536) + 1);
+    ssize_t n = recv(l->fd, l->buf + l->len, MIN(max, 65536), MSG_DONTWAIT);
+    if (n == 0) {
+      l->closed = true;
+    }
+    if (n <= 0) {
+      break;
+    }
+    l->len += n;
+    l->buf[l->len] = '\0';
+    max -= n;
+  }
+  if (l->body == 0 && l->buf != NULL) {
+    char *end = strstr((char *)l->buf, "\r\n\r\n");
+    l->body = end ? (size_t)((uint8_t *)end + 4 - l->buf) : 0;
+  }
+}
+
+static size_t body_len(const listener_t *l) {
+  return l->body ? l->len - l->body : 0;
+}
+
+// Runs the server task once and lets every listener read its share
+static void serve(void) {
+  host_httpd_run(server, 1);
+  for (size_t i = 0; i < sizeof(active) / sizeof(active[0]); i++) {
+    if (active[i]) {
+      listener_read(active[i], active[i]->per_read);
+    }
+  }
+}
+
+static void serve_for(int ms) {
+  for (int i = 0; i < ms; i++) {
+    serve();
+  }
+}
+
+// Serves until l has len bytes of body, or is closed
+static bool serve_until(listener_t *l, size_t len) {
+  for (int i = 0; i < WAIT_MS && body_len(l) < len && !l->closed; i++) {
+    serve();
+  }
+  return body_len(l) >= len;
+}
+
+static void serve_until_closed(listener_t *l) {
+  for (int i = 0; i < WAIT_MS && !l->closed; i++) {
+    serve();
+  }
+}
+
+/* Connects a listener that reads per_read bytes each time the test serves;
+ * a small socket buffer, so it holds up the relay soon. Returns the
+ * response status. */
+static int listener_open(listener_t *l, size_t per_read) {
+  int sv[2];
+  memset(l, 0, sizeof(*l));
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  l->fd = sv[0];
+  l->server_fd = sv[1];
+  l->per_read = per_read;
+  if (per_read != SIZE_MAX) {
+    int size = 4096;
+    setsockopt(l->server_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  }
+  host_httpd_call(server, stream_relay_handler, "/stream", l->server_fd);
+  for (int i = 0; i < WAIT_MS && l->body == 0 && !l->closed; i++) {
+    host_httpd_run(server, 1);
+    listener_read(l, SIZE_MAX);
+  }
+  CHECK(l->body > 0);
+  int status = 0;
+  if (l->buf == NULL || sscanf((char *)l->buf, "HTTP/1.1 %d", &status) != 1) {
+    return 0;
+  }
+  if (status == 200) {
+    for (size_t i = 0; i < sizeof(active) / sizeof(active[0]); i++) {
+      if (active[i] == NULL) {
+        active[i] = l;
+        break;
+      }
+    }
+  }
+  return status;
+}
+
+static void listener_close(listener_t *l) {
+  for (size_t i = 0; i < sizeof(active) / sizeof(active[0]); i++) {
+    if (active[i] == l) {
+      active[i] = NULL;
+    }
+  }
+  close(l->fd);
+  for (int i = 0; i < WAIT_MS && host_httpd_is_open(server, l->server_fd);
+       i++) {
+    host_httpd_run(server, 1);
+  }
+  CHECK(!host_httpd_is_open(server, l->server_fd));
+  free(l->buf);
+  l->buf = NULL;
+}
+
+static bool body_is(const listener_t *l, const uint8_t *data, size_t len) {
+  return body_len(l) == len && memcmp(l->buf + l->body, data, len) == 0;
+}
+
+/* ---------- the player ---------- */
+
+// What the HTTP reader's tee writes, serving between chunks
+static void feed(stream_t *s, size_t len) {
+  CHECK(tap != NULL);
+  size_t end = MIN(s->fed + len, s->len);
+  while (tap && s->fed < end) {
+    size_t n = MIN(FEED_CHUNK, end - s->fed);
+    CHECK_EQ(rb_write(tap, (char *)s->data + s->fed, n, portMAX_DELAY), n);
+    s->fed += n;
+    serve();
+  }
+}
+
+static void feed_all(stream_t *s) { feed(s, s->len); }
+
+// A station starts playing. The new connection takes longer than the relay
+// waits for the tap, so the previous stream's tail is behind it by then.
+static void tune(codec_type_t codec) {
+  stream_relay_detach();
+  serve_for(20);
+  stream_relay_attach(codec);
+  serve_for(150);
+}
+
+static uint64_t relay_bytes_in(void) {
+  stream_relay_stats_t st;
+  stream_relay_get_stats(&st);
+  return st.bytes_in;
+}
+
+// Serves until the relay has taken everything fed to the tap
+static void settle(uint64_t bytes_in) {
+  for (int i = 0; i < WAIT_MS && relay_bytes_in() < bytes_in; i++) {
+    serve();
+  }
+  serve_for(20);
+}
+
+// Feeds len more and waits for the relay task to publish it, without
+// running the server task
+static void take(stream_t *s, size_t len) {
+  uint64_t bytes_in = relay_bytes_in() + len;
+  CHECK(s->fed + len <= s->len);
+  CHECK_EQ(rb_write(tap, (char *)s->data + s->fed, len, portMAX_DELAY), len);
+  s->fed += len;
+  for (int i = 0; i < WAIT_MS && relay_bytes_in() < bytes_in; i++) {
+    usleep(1000);
+  }
+  CHECK_EQ(relay_bytes_in(), bytes_in);
+}
+
+/* How far the relay is behind with l, an MP3 listener that joined at start:
+ * what it has sent is what l read plus what waits in the socket */
+static size_t lag(const listener_t *l, uint64_t start) {
+  int queued = 0;
+  CHECK_EQ(ioctl(l->fd, FIONREAD, &queued), 0);
+  return relay_bytes_in() - start - body_len(l) - queued;
+}
+
+// Feeds s until l, not reading, is behind by len, or dropped
+static void stall_until(stream_t *s, listener_t *l, uint64_t start,
+                        size_t len) {
+  while (host_httpd_is_open(server, l->server_fd) && lag(l, start) < len) {
+    feed(s, len - lag(l, start));
+    settle(start + s->fed);
+  }
+}
+
+/* ---------- racing the relay ---------- */
+
+/* Once set, right after the relay's next send to race.on the relay task
+ * publishes race.len more of race.s, then copies race.partial more into the
+ * ring and waits for the rest of its chunk; race.reader reads what it has. */
+static struct {
+  listener_t *on;
+  stream_t *s;
+  size_t len;
+  size_t partial;
+  listener_t *reader;
+} race;
+
+int __real_httpd_socket_send(httpd_handle_t handle, int sockfd,
+                             const char *buf, size_t buf_len, int flags);
+
+int __wrap_httpd_socket_send(httpd_handle_t handle, int sockfd,
+                             const char *buf, size_t buf_len, int flags) {
+  int n = __real_httpd_socket_send(handle, sockfd, buf, buf_len, flags);
+  if (n > 0 && race.on && sockfd == race.on->server_fd) {
+    race.on = NULL;
+    take(race.s, race.len);
+    if (race.partial > 0) {
+      stream_t *s = race.s;
+      CHECK_EQ(rb_write(tap, (char *)s->data + s->fed, race.partial,
+                        portMAX_DELAY),
+               race.partial);
+      s->fed += race.partial;
+      usleep(10 * 1000);
+    }
+    listener_read(race.reader, SIZE_MAX);
+  }
+  return n;
+}
+
+/* ---------- tests ---------- */
+
+static void test_refused(void) {
+  listener_t l;
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 503);
+  CHECK(strstr((char *)l.buf, "{\"error\":\"nothing playing\"}") != NULL);
+  listener_close(&l);
+
+  g_runtime_config.relay_max_clients = 0;
+  stream_relay_apply_config();
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 404);
+  CHECK(strstr((char *)l.buf, "{\"error\":\"relay disabled\"}") != NULL);
+  listener_close(&l);
+  g_runtime_config.relay_max_clients = STREAM_RELAY_MAX_CLIENTS;
+  stream_relay_apply_config();
+
+  stream_relay_stats_t st;
+  stream_relay_get_stats(&st);
+  CHECK_EQ(st.rejected, 2);
+  CHECK_EQ(st.max_clients, STREAM_RELAY_MAX_CLIENTS);
+  CHECK_EQ(st.memory, RELAY_BUFFER_SIZE + 16 * 1024 + 16 * 1024);
+}
+
+static void test_station_change(void) {
+  stream_t a, b;
+  stream_make(&a, CODEC_TYPE_MP3, 0, 400);
+  stream_make(&b, CODEC_TYPE_MP3, 1000, 400);
+  tune(CODEC_TYPE_MP3);
+  listener_t l;
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 200);
+  CHECK(strstr((char *)l.buf, "Content-Type: audio/mpeg\r\n") != NULL);
+
+  // Both stations, byte for byte, and nothing of one taken for the other
+  feed_all(&a);
+  CHECK(serve_until(&l, a.len));
+  tune(CODEC_TYPE_MP3);
+  feed_all(&b);
+  CHECK(serve_until(&l, a.len + b.len));
+  uint8_t *both = malloc(a.len + b.len);
+  memcpy(both, a.data, a.len);
+  memcpy(both + a.len, b.data, b.len);
+  CHECK(body_is(&l, both, a.len + b.len));
+  CHECK(!l.closed);
+  free(both);
+
+  // Another codec: the listener's player could not follow
+  tune(CODEC_TYPE_AAC);
+  serve_until_closed(&l);
+  CHECK(l.closed);
+  CHECK_EQ(body_len(&l), a.len + b.len);
+  listener_close(&l);
+  free(a.data);
+  free(b.data);
+}
+
+static void test_chained_streams(void) {
+  // A second Ogg stream chains onto the first
+  stream_t a, b;
+  stream_make(&a, CODEC_TYPE_OGG, 0, 40);
+  stream_make(&b, CODEC_TYPE_OGG, 1000, 40);
+  tune(CODEC_TYPE_OGG);
+  listener_t l;
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 200);
+  CHECK(strstr((char *)l.buf, "Content-Type: audio/ogg\r\n") != NULL);
+  feed_all(&a);
+  CHECK(serve_until(&l, a.len));
+  tune(CODEC_TYPE_OGG);
+  feed_all(&b);
+  CHECK(serve_until(&l, a.len + b.len));
+  CHECK(body_len(&l) == a.len + b.len &&
+        memcmp(l.buf + l.body, a.data, a.len) == 0 &&
+        memcmp(l.buf + l.body + a.len, b.data, b.len) == 0);
+  CHECK(!l.closed);
+  listener_close(&l);
+  free(a.data);
+  free(b.data);
+
+  // A second FLAC stream does not
+  stream_make(&a, CODEC_TYPE_FLAC, 0, 40);
+  tune(CODEC_TYPE_FLAC);
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 200);
+  feed_all(&a);
+  CHECK(serve_until(&l, a.len));
+  CHECK(body_is(&l, a.data, a.len));
+  tune(CODEC_TYPE_FLAC);
+  serve_until_closed(&l);
+  CHECK(l.closed);
+  listener_close(&l);
+  free(a.data);
+}
+
+// Joins once more than the ring has passed: the header, then the stream
+// from a page or frame start within the burst
+static void late_joiner(codec_type_t codec, uint32_t frames) {
+  stream_t s;
+  stream_make(&s, codec, 0, frames);
+  tune(codec);
+  uint64_t start = relay_bytes_in();
+  feed(&s, s.len * 3 / 4);
+  settle(start + s.fed);
+  size_t joined_at = s.fed;
+  CHECK(joined_at > RELAY_BUFFER_SIZE);
+
+  listener_t l;
+  CHECK_EQ(listener_open(&l, SIZE_MAX), 200);
+  feed_all(&s);
+  settle(start + s.len);
+  CHECK(body_len(&l) > s.head);
+  CHECK(memcmp(l.buf + l.body, s.data, s.head) == 0);
+  size_t from = s.len - (body_len(&l) - s.head);
+  CHECK(frame_start(&s, from));
+  CHECK(from >= joined_at - RELAY_BURST);
+  CHECK(from < joined_at - RELAY_BURST + s.frame);
+  CHECK(memcmp(l.buf + l.body + s.head, s.data + from, s.len - from) == 0);
+  listener_close(&l);
+  free(s.data);
+}
+
+static void test_late_joiners(void) {
+  late_joiner(CODEC_TYPE_OGG, 60);
+  late_joiner(CODEC_TYPE_FLAC, 160);
+}
+
+static void test_slow_listeners_dropped(void) {
+  stream_t s;
+  stream_make(&s, CODEC_TYPE_MP3, 0, 1500);
+  tune(CODEC_TYPE_MP3);
+  stream_relay_stats_t before;
+  stream_relay_get_stats(&before);
+
+  // One keeps up, one stops reading, one reads half as fast as the stream
+  listener_t fast, stalled, slow;
+  CHECK_EQ(listener_open(&fast, SIZE_MAX), 200);
+  CHECK_EQ(listener_open(&stalled, 0), 200);
+  CHECK_EQ(listener_open(&slow, FEED_CHUNK / 2), 200);
+  feed_all(&s);
+  CHECK(serve_until(&fast, s.len));
+  CHECK(body_is(&fast, s.data, s.len));
+  CHECK(!fast.closed);
+
+  // What the others got was the stream until they were dropped; the slow
+  // one's last send may have raced the ring wrapping onto it
+  stalled.per_read = slow.per_read = SIZE_MAX;
+  serve_until_closed(&stalled);
+  serve_until_closed(&slow);
+  CHECK(stalled.closed && slow.closed);
+  CHECK(body_len(&stalled) < s.len - RELAY_BUFFER_SIZE / 2);
+  CHECK(memcmp(stalled.buf + stalled.body, s.data, body_len(&stalled)) == 0);
+  CHECK(body_len(&slow) < s.len);
+  size_t checked = body_len(&slow) > RELAY_SEND_MAX
+                       ? body_len(&slow) - RELAY_SEND_MAX
+                       : 0;
+  CHECK(memcmp(slow.buf + slow.body, s.data, checked) == 0);
+
+  stream_relay_stats_t after;
+  stream_relay_get_stats(&after);
+  CHECK_EQ(after.dropped_slow - before.dropped_slow, 2);
+  CHECK_EQ(after.listeners - before.listeners, 3);
+  CHECK_EQ(after.clients, 1);
+  listener_close(&stalled);
+  listener_close(&slow);
+  listener_close(&fast);
+  free(s.data);
+}
+
+static void test_lag_margin(void) {
+  stream_t s;
+  stream_make(&s, CODEC_TYPE_MP3, 0, 1000);
+  tune(CODEC_TYPE_MP3);
+  stream_relay_stats_t before;
+  stream_relay_get_stats(&before);
+  listener_t fast, l;
+  CHECK_EQ(listener_open(&fast, SIZE_MAX), 200);
+  CHECK_EQ(listener_open(&l, 0), 200);
+  uint64_t start = relay_bytes_in();
+
+  // While the relay sends to the listener ahead of it, the relay task
+  // publishes a chunk and starts the next over bytes l is due: l's position
+  // is already stale, and only the margin keeps those bytes from going out
+  stall_until(&s, &l, start,
+              RELAY_BUFFER_SIZE - 2 * RELAY_READ_CHUNK - 1024);
+  CHECK_EQ(lag(&l, start), RELAY_BUFFER_SIZE - 2 * RELAY_READ_CHUNK - 1024);
+  take(&s, RELAY_READ_CHUNK);
+  race.on = &fast;
+  race.s = &s;
+  race.len = RELAY_READ_CHUNK;
+  race.partial = 2048;
+  race.reader = &l;
+  host_httpd_run(server, 1);
+  CHECK(race.on == NULL);
+
+  l.per_read = SIZE_MAX;
+  serve_until_closed(&l);
+  CHECK(l.closed);
+  CHECK(memcmp(l.buf + l.body, s.data, body_len(&l)) == 0);
+  CHECK(serve_until(&fast, s.fed));
+  CHECK(body_is(&fast, s.data, s.fed));
+  stream_relay_stats_t after;
+  stream_relay_get_stats(&after);
+  CHECK_EQ(after.dropped_slow - before.dropped_slow, 1);
+  CHECK_EQ(after.clients, 1);
+  listener_close(&l);
+  listener_close(&fast);
+  free(s.data);
+}
+
+static void test_overrun_during_send(void) {
+  stream_t s;
+  stream_make(&s, CODEC_TYPE_MP3, 0, 1000);
+  tune(CODEC_TYPE_MP3);
+  stream_relay_stats_t before;
+  stream_relay_get_stats(&before);
+  listener_t l;
+  CHECK_EQ(listener_open(&l, 0), 200);
+  uint64_t start = relay_bytes_in();
+
+  // As far behind as it may be, it reads what it has; while the relay sends
+  // it more, the stream moves on over the rest of what it is due
+  stall_until(&s, &l, start, RELAY_MAX_LAG - RELAY_READ_CHUNK);
+  CHECK_EQ(lag(&l, start), RELAY_MAX_LAG - RELAY_READ_CHUNK);
+  listener_read(&l, SIZE_MAX);
+  take(&s, RELAY_READ_CHUNK);
+  race.on = &l;
+  race.s = &s;
+  race.len = 5 * RELAY_READ_CHUNK;
+  race.partial = 0;
+  race.reader = &l;
+  host_httpd_run(server, 1);
+  CHECK(race.on == NULL);
+
+  l.per_read = SIZE_MAX;
+  serve_until_closed(&l);
+  CHECK(l.closed);
+  CHECK(memcmp(l.buf + l.body, s.data, body_len(&l)) == 0);
+  stream_relay_stats_t after;
+  stream_relay_get_stats(&after);
+  CHECK_EQ(after.dropped_slow - before.dropped_slow, 1);
+  CHECK_EQ(after.clients, 0);
+  listener_close(&l);
+  free(s.data);
+}
+
+static void test_full(void) {
+  stream_t s;
+  stream_make(&s, CODEC_TYPE_MP3, 0, 100);
+  tune(CODEC_TYPE_MP3);
+  feed_all(&s);
+  listener_t l[STREAM_RELAY_MAX_CLIENTS + 1];
+  for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS; i++) {
+    CHECK_EQ(listener_open(&l[i], SIZE_MAX), 200);
+  }
+  listener_t *extra = &l[STREAM_RELAY_MAX_CLIENTS];
+  CHECK_EQ(listener_open(extra, SIZE_MAX), 503);
+  CHECK(strstr((char *)extra->buf, "Retry-After: 10\r\n") != NULL);
+  CHECK(strstr((char *)extra->buf, "{\"error\":\"too many listeners\"}") !=
+        NULL);
+  listener_close(extra);
+
+  // Fewer allowed: those over the limit stay, switched off: all go
+  g_runtime_config.relay_max_clients = 2;
+  stream_relay_apply_config();
+  CHECK_EQ(listener_open(extra, SIZE_MAX), 503);
+  listener_close(extra);
+  g_runtime_config.relay_max_clients = 0;
+  stream_relay_apply_config();
+  for (int i = 0; i < STREAM_RELAY_MAX_CLIENTS; i++) {
+    serve_until_closed(&l[i]);
+    CHECK(l[i].closed);
+    listener_close(&l[i]);
+  }
+  g_runtime_config.relay_max_clients = STREAM_RELAY_MAX_CLIENTS;
+  stream_relay_apply_config();
+  free(s.data);
+}
+
+int main(void) {
+  server = host_httpd_create();
+  CHECK_EQ(stream_relay_init(), ESP_OK);
+  CHECK_EQ(stream_relay_start(server), ESP_OK);
+  RUN_TEST(test_refused);
+  RUN_TEST(test_station_change);
+  RUN_TEST(test_chained_streams);
+  RUN_TEST(test_late_joiners);
+  RUN_TEST(test_slow_listeners_dropped);
+  RUN_TEST(test_lag_margin);
+  RUN_TEST(test_overrun_during_send);
+  RUN_TEST(test_full);
+  return host_test_result();
+}
@@ -0,0 +1,380 @@
+/* The time-shift element: timeshift.c between a station written into its
+ * input ringbuf in pieces of any size and a stand-in decoder reading its
+ * output. The station is MP3 frames that each carry their number, and the
+ * decoder checks every frame it gets byte for byte, so a cut frame or a
+ * jump shows. Pause, resume, seeks back and past both ends, live, and a
+ * pause longer than the one-minute ring holds. */
+#include "app_config.h"
+#include "host_test.h"
+#include "timeshift.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define FRAMES 4200
+#define FRAME_US (1152 * 1000000LL / 44100)
+#define MAX_GOT 16384
+// Seek points are 250 ms apart, 500 ms where a frame needs the reservoir
+#define POINT_FRAMES (500000 / FRAME_US + 1)
+
+app_runtime_config_t g_runtime_config;
+volatile int g_stream_buffer_fill;
+
+static atomic_bool shown_paused;
+static atomic_int shown_behind_s;
+
+void update_time_shift(bool paused, int behind_s) {
+  atomic_store(&shown_paused, paused);
+  atomic_store(&shown_behind_s, behind_s);
+}
+
+/* ---------- station ---------- */
+
+static uint8_t *stream;
+static size_t offsets[FRAMES + 1];
+
+static size_t frame_len(int n) { return offsets[n + 1] - offsets[n]; }
+
+// MPEG-1 layer III, 128 kb/s, 44.1 kHz; every fourth frame doesn't use
+// the bit reservoir. The number is in 7-bit pieces, so no 0xFF but the sync.
+static void make_stream(void) {
+  stream = malloc(FRAMES * 418);
+  size_t pos = 0;
+  for (int n = 0; n < FRAMES; n++) {
+    bool padding = n % 3 == 1;
+    size_t len = 417 + padding;
+    uint8_t *f = stream + pos;
+    offsets[n] = pos;
+    f[0] = 0xFF;
+    f[1] = 0xFB;
+    f[2] = 0x90 | padding << 1;
+    f[3] = 0;
+    f[4] = n % 4 == 0 ? 0 : 0x10;
+    f[5] = 0;
+    for (int i = 0; i < 4; i++) {
+      f[6 + i] = n >> (7 * i) & 0x7F;
+    }
+    for (size_t i = 10; i < len; i++) {
+      f[i] = (n * 31 + i * 7) % 0xFF;
+    }
+    pos += len;
+  }
+  offsets[FRAMES] = pos;
+}
+
+/* ---------- pipeline ---------- */
+
+static audio_element_handle_t el;
+static ringbuf_handle_t in_rb, out_rb;
+static pthread_t decoder;
+static int got[MAX_GOT];
+static atomic_int got_n;
+static atomic_bool bad_frame;
+static atomic_bool decoder_done;
+static uint64_t start_bytes; // stats.bytes_in at start()
+
+// The frames out of the element, in order
+static void *decoder_main(void *arg) {
+  static uint8_t buf[8192];
+  size_t fill = 0;
+  for (;;) {
+    // What is there, or wait for a byte
+    int want = rb_bytes_filled(out_rb);
+    want = want < 1 ? 1 : want;
+    want = want < (int)(sizeof(buf) - fill) ? want : (int)(sizeof(buf) - fill);
+    int n = rb_read(out_rb, (char *)buf + fill, want, portMAX_DELAY);
+    if (n <= 0) {
+      break;
+    }
+    fill += n;
+    size_t pos = 0;
+    while (fill - pos >= 10) {
+      const uint8_t *f = buf + pos;
+      int number = f[6] | f[7] << 7 | f[8] << 14 | f[9] << 21;
+      if (number >= FRAMES ||
+          memcmp(f, stream + offsets[number], 10) != 0) {
+        atomic_store(&bad_frame, true);
+        atomic_store(&decoder_done, true);
+        return NULL;
+      }
+      size_t len = frame_len(number);
+      if (fill - pos < len) {
+        break;
+      }
+      if (memcmp(f, stream + offsets[number], len) != 0) {
+        atomic_store(&bad_frame, true);
+        atomic_store(&decoder_done, true);
+        return NULL;
+      }
+      int i = atomic_load(&got_n);
+      if (i < MAX_GOT) {
+        got[i] = number;
+        atomic_store(&got_n, i + 1);
+      }
+      pos += len;
+    }
+    memmove(buf, buf + pos, fill - pos);
+    fill -= pos;
+  }
+  // Whatever is left is a frame cut off at the end
+  if (fill > 0) {
+    atomic_store(&bad_frame, true);
+  }
+  atomic_store(&decoder_done, true);
+  return NULL;
+}
+
+static void start(void) {
+  atomic_store(&got_n, 0);
+  atomic_store(&bad_frame, false);
+  atomic_store(&decoder_done, false);
+  timeshift_stats_t st;
+  timeshift_get_stats(&st);
+  start_bytes = st.bytes_in;
+  el = timeshift_element_init(CODEC_TYPE_MP3);
+  CHECK(el != NULL);
+  in_rb = rb_create(4096, 2);
+  out_rb = rb_create(4096, 2);
+  audio_element_set_input_ringbuf(el, in_rb);
+  audio_element_set_output_ringbuf(el, out_rb);
+  CHECK_EQ(audio_element_run(el), ESP_OK);
+  pthread_create(&decoder, NULL, decoder_main, NULL);
+}
+
+static bool wait_until(bool (*done)(void)) {
+  for (int i = 0; i < 5000; i++) {
+    if (done()) {
+      return true;
+    }
+    usleep(1000);
+  }
+  return false;
+}
+
+static bool decoder_ended(void) { return atomic_load(&decoder_done); }
+
+/* The station ends; the element plays out what it has and stops. One that
+ * doesn't, or whose output the decoder gave up on, is stopped. */
+static void finish(void) {
+  rb_done_write(in_rb);
+  CHECK(wait_until(decoder_ended));
+  audio_element_deinit(el);
+  pthread_join(decoder, NULL);
+  rb_destroy(in_rb);
+  rb_destroy(out_rb);
+  CHECK(!atomic_load(&bad_frame));
+}
+
+// Frames [from, to) of the station, in pieces of 1 to 3000 bytes
+static void write_frames(int from, int to) {
+  static uint32_t seed = 1;
+  size_t pos = offsets[from];
+  while (pos < offsets[to]) {
+    seed = seed * 1103515245 + 12345;
+    size_t n = 1 + (seed >> 8) % 3000;
+    n = n < offsets[to] - pos ? n : offsets[to] - pos;
+    int written = rb_write(in_rb, (char *)stream + pos, n, pdMS_TO_TICKS(5000));
+    if (written != (int)n) {
+      CHECK_EQ(written, n); // the element has stopped taking its input
+      return;
+    }
+    pos += n;
+  }
+}
+
+static int want_got;
+static bool got_enough(void) { return atomic_load(&got_n) >= want_got; }
+
+static bool is_paused(void) {
+  timeshift_stats_t st;
+  timeshift_get_stats(&st);
+  return st.paused;
+}
+
+static bool is_playing(void) { return !is_paused(); }
+
+static uint64_t want_bytes;
+static bool all_in(void) {
+  timeshift_stats_t st;
+  timeshift_get_stats(&st);
+  return st.bytes_in - start_bytes >= want_bytes;
+}
+
+// The element has taken frames [0, n) out of its input
+static void wait_for_input(int n) {
+  want_bytes = offsets[n];
+  CHECK(wait_until(all_in));
+}
+
+static void wait_for_frames(int n) {
+  want_got = n;
+  CHECK(wait_until(got_enough));
+}
+
+// got[from..] runs first, first + 1, ... up to last
+static void check_run(int from, int first, int last) {
+  CHECK_EQ(atomic_load(&got_n) - from >= last - first + 1, 1);
+  for (int i = 0; i <= last - first; i++) {
+    if (got[from + i] != first + i) {
+      CHECK_EQ(got[from + i], first + i);
+      break;
+    }
+  }
+}
+
+static int frame_at_or_after(size_t pos) {
+  int n = 0;
+  while (n < FRAMES && offsets[n] < pos) {
+    n++;
+  }
+  return n;
+}
+
+/* ---------- tests ---------- */
+
+static void test_live(void) {
+  timeshift_stats_t before, st;
+  timeshift_get_stats(&before);
+  start();
+  write_frames(0, 600);
+  finish();
+  CHECK_EQ(atomic_load(&got_n), 600);
+  check_run(0, 0, 599);
+  timeshift_get_stats(&st);
+  CHECK_EQ(st.bytes_in - before.bytes_in, offsets[600]);
+  CHECK(st.points > 0);
+  CHECK(!st.active);
+  CHECK_EQ(st.minutes, 1);
+  // Not playing: nothing to pause
+  CHECK_EQ(timeshift_pause(1), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(timeshift_seek(-30), ESP_ERR_INVALID_STATE);
+  CHECK_EQ(timeshift_live(), ESP_ERR_INVALID_STATE);
+}
+
+// The station keeps arriving while paused; playback goes on from the
+// frame after the last one played
+static void test_pause_resume(void) {
+  start();
+  write_frames(0, 100);
+  wait_for_frames(100);
+  CHECK_EQ(timeshift_pause(1), ESP_OK);
+  CHECK(wait_until(is_paused));
+  write_frames(100, 500);
+  usleep(100 * 1000);
+  CHECK_EQ(atomic_load(&got_n), 100);
+  timeshift_stats_t st;
+  timeshift_get_stats(&st);
+  CHECK_EQ(st.behind_s, 400 * FRAME_US / 1000000);
+  CHECK(atomic_load(&shown_paused));
+  CHECK_EQ(atomic_load(&shown_behind_s), st.behind_s);
+  CHECK_EQ(timeshift_pause(-1), ESP_OK); // toggles back
+  finish();
+  CHECK_EQ(atomic_load(&got_n), 500);
+  check_run(0, 0, 499);
+  CHECK(!atomic_load(&shown_paused));
+}
+
+static void test_seek_back(void) {
+  start();
+  write_frames(0, 1000);
+  wait_for_frames(1000);
+  CHECK_EQ(timeshift_seek(-10), ESP_OK);
+  // From a seek point no later than 10 s back, and not far before it
+  int target = (1000 * FRAME_US - 10000000) / FRAME_US;
+  wait_for_frames(1001);
+  int j = got[1000];
+  CHECK(j <= target && j >= target - POINT_FRAMES);
+  wait_for_frames(1000 + 1000 - j);
+  check_run(1000, j, 999);
+  write_frames(1000, 1010);
+  finish();
+  check_run(1000 + 1000 - j, 1000, 1009);
+}
+
+static void test_seek_past_ends(void) {
+  start();
+  write_frames(0, 400);
+  wait_for_frames(400);
+  CHECK_EQ(timeshift_pause(1), ESP_OK);
+  CHECK(wait_until(is_paused));
+  // Before the oldest audio: from the oldest seek point
+  CHECK_EQ(timeshift_seek(-600), ESP_OK);
+  CHECK_EQ(timeshift_pause(0), ESP_OK);
+  wait_for_frames(401);
+  CHECK(got[400] <= POINT_FRAMES);
+  int replayed = 400 - got[400];
+  wait_for_frames(400 + replayed);
+  check_run(400, got[400], 399);
+  // After the newest: to the live stream
+  CHECK_EQ(timeshift_pause(1), ESP_OK);
+  CHECK(wait_until(is_paused));
+  write_frames(400, 700);
+  wait_for_input(700);
+  CHECK_EQ(timeshift_seek(600), ESP_OK);
+  CHECK_EQ(timeshift_pause(0), ESP_OK);
+  CHECK(wait_until(is_playing));
+  usleep(50 * 1000);
+  CHECK_EQ(atomic_load(&got_n), 400 + replayed);
+  write_frames(700, 710);
+  finish();
+  CHECK_EQ(atomic_load(&got_n), 400 + replayed + 10);
+  check_run(400 + replayed, 700, 709);
+}
+
+static void test_live_while_paused(void) {
+  start();
+  write_frames(0, 100);
+  wait_for_frames(100);
+  CHECK_EQ(timeshift_pause(1), ESP_OK);
+  CHECK(wait_until(is_paused));
+  write_frames(100, 400);
+  wait_for_input(400);
+  CHECK_EQ(timeshift_live(), ESP_OK);
+  CHECK(wait_until(is_playing));
+  write_frames(400, 410);
+  finish();
+  CHECK_EQ(atomic_load(&got_n), 110);
+  check_run(100, 400, 409);
+  timeshift_stats_t st;
+  timeshift_get_stats(&st);
+  CHECK_EQ(st.behind_s, 0);
+}
+
+// Paused for longer than the ring holds: playback is moved on with the
+// oldest audio, from a seek point
+static void test_overrun(void) {
+  timeshift_stats_t before, st;
+  timeshift_get_stats(&before);
+  start();
+  write_frames(0, 100);
+  wait_for_frames(100);
+  CHECK_EQ(timeshift_pause(1), ESP_OK);
+  CHECK(wait_until(is_paused));
+  write_frames(100, FRAMES);
+  wait_for_input(FRAMES);
+  timeshift_get_stats(&st);
+  CHECK_EQ(st.overruns - before.overruns, 1);
+  CHECK(st.buffered_s <= TIMESHIFT_BYTES_PER_MINUTE / (128000 / 8));
+  CHECK_EQ(timeshift_pause(0), ESP_OK);
+  finish();
+  int oldest = frame_at_or_after(offsets[FRAMES] - TIMESHIFT_BYTES_PER_MINUTE);
+  int j = got[100];
+  CHECK(j >= oldest && j <= oldest + POINT_FRAMES);
+  CHECK_EQ(atomic_load(&got_n), 100 + FRAMES - j);
+  check_run(100, j, FRAMES - 1);
+}
+
+int main(void) {
+  make_stream();
+  g_runtime_config.timeshift_minutes = 1;
+  timeshift_init();
+  RUN_TEST(test_live);
+  RUN_TEST(test_pause_resume);
+  RUN_TEST(test_seek_back);
+  RUN_TEST(test_seek_past_ends);
+  RUN_TEST(test_live_while_paused);
+  RUN_TEST(test_overrun);
+  free(stream);
+  return host_test_result();
+}
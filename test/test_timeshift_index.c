@@ -0,0 +1,445 @@
+/* Time-shift frame index: synthetic MP3, ADTS, Ogg and FLAC streams, whose
+ * frame (page) starts and media times are known, go through a ring much
+ * smaller than the stream in chunks of random size, as timeshift.c appends
+ * them. After every scan each seek point must be a frame start with that
+ * frame's media time, the boundary a frame start with the time there, and
+ * ts_index_find() and ts_index_next() must agree with a search of the
+ * points. Payloads carry false sync words. */
+#include "host_test.h"
+#include "timeshift_index.h"
+#include <stdlib.h>
+
+#define RING_SIZE (16 * 1024)
+#define POINTS 16
+#define STREAM_MAX (512 * 1024)
+
+typedef struct {
+  uint64_t pos;
+  int64_t media_us;
+  bool point; // may be a seek point
+} truth_t;
+
+static uint8_t stream[STREAM_MAX];
+static size_t stream_len;
+static truth_t truth[16384];
+static int truth_n;
+static uint32_t seed;
+
+static uint32_t rnd(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void begin_stream(void) {
+  stream_len = 0;
+  truth_n = 0;
+  seed = 1;
+  // Before the index finds anything it stays at the start
+  truth[truth_n++] = (truth_t){0, 0, false};
+}
+
+static void mark(int64_t media_us, bool point) {
+  if (truth[truth_n - 1].pos == stream_len) {
+    truth_n--;
+  }
+  truth[truth_n++] = (truth_t){stream_len, media_us, point};
+}
+
+static void put(const void *data, size_t len) {
+  memcpy(stream + stream_len, data, len);
+  stream_len += len;
+}
+
+// Payload without 0xFF, so no sync word turns up but the ones put there
+static void put_payload(size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    stream[stream_len++] = rnd() % 0xFF;
+  }
+}
+
+static const truth_t *find_truth(uint64_t pos) {
+  int lo = 0, hi = truth_n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (truth[mid].pos < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < truth_n && truth[lo].pos == pos ? &truth[lo] : NULL;
+}
+
+/* ---------- checks ---------- */
+
+static const ts_point_t *point(const ts_index_t *x, size_t i) {
+  return &x->points[(x->head + i) % x->capacity];
+}
+
+static void check_find(const ts_index_t *x, int64_t media_us) {
+  ts_point_t got;
+  CHECK(ts_index_find(x, media_us, &got));
+  size_t want = 0;
+  for (size_t i = 0; i < x->count; i++) {
+    if (point(x, i)->media_us <= media_us) {
+      want = i;
+    }
+  }
+  CHECK_EQ(got.pos, point(x, want)->pos);
+}
+
+static void check_next(const ts_index_t *x, uint64_t pos) {
+  ts_point_t got = ts_index_next(x, pos);
+  ts_point_t want = {x->boundary, x->media_us};
+  for (size_t i = 0; i < x->count; i++) {
+    if (point(x, i)->pos > pos) {
+      if (point(x, i)->pos <= x->boundary) {
+        want = *point(x, i);
+      }
+      break;
+    }
+  }
+  CHECK_EQ(got.pos, want.pos);
+  CHECK_EQ(got.media_us, want.media_us);
+}
+
+// Returns false at the first wrong point, to keep the output short
+static bool check_index(const ts_index_t *x, uint64_t oldest) {
+  int failures = host_test_failures;
+  const truth_t *b = find_truth(x->boundary);
+  CHECK(b != NULL);
+  if (b != NULL) {
+    CHECK_EQ(x->media_us, b->media_us);
+  }
+  for (size_t i = 0; i < x->count; i++) {
+    const ts_point_t *p = point(x, i);
+    const truth_t *t = find_truth(p->pos);
+    CHECK(t != NULL && t->point);
+    if (t != NULL) {
+      CHECK_EQ(p->media_us, t->media_us);
+    }
+    CHECK(p->pos >= oldest && p->pos <= x->boundary);
+    if (i > 0) {
+      CHECK(p->pos > point(x, i - 1)->pos);
+      CHECK(p->media_us >= point(x, i - 1)->media_us);
+    }
+  }
+  if (x->count > 0) {
+    CHECK_EQ(ts_index_oldest(x).pos, point(x, 0)->pos);
+    check_find(x, INT64_MIN);
+    check_find(x, INT64_MAX);
+    check_next(x, 0);
+    for (size_t i = 0; i < x->count; i++) {
+      const ts_point_t *p = point(x, i);
+      check_find(x, p->media_us);
+      check_find(x, p->media_us - 1);
+      check_next(x, p->pos);
+      check_next(x, p->pos - 1);
+    }
+  } else {
+    ts_point_t none;
+    CHECK(!ts_index_find(x, 0, &none));
+    CHECK_EQ(ts_index_oldest(x).pos, x->boundary);
+  }
+  return host_test_failures == failures;
+}
+
+/* Appends the stream to the ring as timeshift.c does, up to max_chunk
+ * bytes at a time. Returns the distinct seek points made. */
+static int run_index(ts_format_t format, size_t max_chunk) {
+  static uint8_t ring[RING_SIZE];
+  static ts_point_t points[POINTS];
+  ts_index_t x;
+  ts_index_init(&x, format, ring, sizeof(ring), points, POINTS, 0);
+  uint64_t write_pos = 0;
+  uint64_t last_point = 0;
+  int made = 0;
+  uint32_t chunk_seed = 7;
+  while (write_pos < stream_len) {
+    chunk_seed = chunk_seed * 1103515245 + 12345;
+    size_t n = 1 + (chunk_seed >> 8) % max_chunk;
+    n = n < stream_len - write_pos ? n : stream_len - write_pos;
+    uint64_t oldest = 0;
+    if (write_pos + n > RING_SIZE) {
+      oldest = write_pos + n - RING_SIZE;
+      ts_index_forget(&x, oldest);
+    }
+    for (size_t i = 0; i < n; i++) {
+      ring[(write_pos + i) % RING_SIZE] = stream[write_pos + i];
+    }
+    write_pos += n;
+    ts_index_scan(&x, write_pos);
+    if (x.count > 0 && point(&x, x.count - 1)->pos != last_point) {
+      last_point = point(&x, x.count - 1)->pos;
+      made++;
+    }
+    if (!check_index(&x, oldest)) {
+      printf("  at %llu of %zu\n", (unsigned long long)write_pos, stream_len);
+      break;
+    }
+  }
+  return made;
+}
+
+/* ---------- MP3 ---------- */
+
+#define MP3_FRAME_US (1152 * 1000000LL / 44100)
+
+// MPEG-1 layer III, 128 kb/s, 44.1 kHz, no CRC
+static void put_mp3_header(bool padding, bool independent) {
+  uint8_t h[6] = {0xFF, 0xFB, 0x90 | padding << 1, 0x00,
+                  independent ? 0 : 0x10, 0};
+  put(h, sizeof(h));
+}
+
+static void make_mp3(int frames) {
+  begin_stream();
+  // Joined mid-frame: the tail of one, with a sync word its length doesn't
+  // confirm
+  put_payload(100);
+  put_mp3_header(false, true);
+  put_payload(200);
+  int64_t media = 0;
+  for (int i = 0; i < frames; i++) {
+    bool padding = i % 3 == 1;
+    mark(media, true);
+    put_mp3_header(padding, i % 5 == 0);
+    size_t start = stream_len;
+    put_payload(417 + padding - 6);
+    // A sync word in the audio data
+    memcpy(stream + start + 50, "\xFF\xFB\x90\x00", 4);
+    media += MP3_FRAME_US;
+  }
+  mark(media, false);
+}
+
+static void test_mp3(void) {
+  make_mp3(400);
+  CHECK(run_index(TS_FORMAT_MPEG, 3000) > 20);
+  // Byte at a time, as a slow station trickles in
+  make_mp3(60);
+  CHECK(run_index(TS_FORMAT_MPEG, 1) > 3);
+}
+
+/* ---------- ADTS ---------- */
+
+#define ADTS_FRAME_US (1024 * 1000000LL / 44100)
+
+static void put_adts_header(size_t len) {
+  uint8_t h[7] = {0xFF,
+                  0xF1,
+                  1 << 6 | 4 << 2,
+                  (uint8_t)(2 << 6 | len >> 11),
+                  (uint8_t)(len >> 3),
+                  (uint8_t)((len & 7) << 5 | 0x1F),
+                  0xFC};
+  put(h, sizeof(h));
+}
+
+static void test_adts(void) {
+  begin_stream();
+  put_payload(30);
+  put_adts_header(300); // false: nothing follows 300 bytes on
+  put_payload(120);
+  int64_t media = 0;
+  for (int i = 0; i < 500; i++) {
+    size_t len = 200 + rnd() % 400;
+    mark(media, true);
+    put_adts_header(len);
+    size_t start = stream_len;
+    put_payload(len - 7);
+    memcpy(stream + start + 20, "\xFF\xF1\x50\x80", 4);
+    media += ADTS_FRAME_US;
+  }
+  mark(media, false);
+  CHECK(run_index(TS_FORMAT_ADTS, 2500) > 20);
+}
+
+/* ---------- Ogg ---------- */
+
+static const uint64_t NO_GRANULE = UINT64_MAX;
+
+/* A page of a packet of len bytes, or of the start of one if it doesn't
+ * end here, after a whole packet of lead bytes (0 for none, < 255) */
+static void put_page(uint8_t flags, uint64_t granule, size_t lead,
+                     const void *body, size_t len, bool ends) {
+  uint8_t h[27 + 255];
+  memcpy(h, "OggS", 4);
+  h[4] = 0;
+  h[5] = flags;
+  for (int i = 0; i < 8; i++) {
+    h[6 + i] = granule >> (8 * i);
+  }
+  memset(h + 14, 0, 12);
+  size_t segments = 0;
+  if (lead > 0) {
+    h[27 + segments++] = lead;
+  }
+  for (size_t i = 0; i < len / 255; i++) {
+    h[27 + segments++] = 255;
+  }
+  if (ends) {
+    h[27 + segments++] = len % 255;
+  }
+  h[26] = segments;
+  put(h, 27 + segments);
+  put_payload(lead);
+  if (body != NULL) {
+    put(body, len);
+  } else {
+    put_payload(len);
+  }
+}
+
+// A logical stream of pages of audio_pages packets after its headers;
+// base is the media time it starts at. Returns the time it ends at.
+static int64_t put_ogg_stream(const char *head, size_t head_len,
+                              uint32_t rate, uint32_t granule_step,
+                              int audio_pages, int64_t base) {
+  mark(base, false);
+  put_page(0x02, 0, 0, head, head_len, true);
+  mark(base, false);
+  put_page(0, 0, 0, NULL, 40, true); // comment header
+  uint64_t granule = 0;
+  for (int i = 0; i < audio_pages; i++) {
+    int64_t at = base + (int64_t)(granule * 1000000 / rate);
+    mark(at, true);
+    if (i % 10 == 5) {
+      // A packet over two pages: the second page can't be a seek point.
+      // One without a granule position,
+      put_page(0, NO_GRANULE, 0, NULL, 510, false);
+      mark(at, false);
+      granule += granule_step;
+      put_page(0x01, granule, 0, NULL, 200, true);
+    } else if (i % 10 == 8) {
+      // and one after a long packet, which puts the second page far
+      // enough on for a point
+      granule += 3 * granule_step;
+      put_page(0, granule, 100, NULL, 510, false);
+      mark(base + (int64_t)(granule * 1000000 / rate), false);
+      granule += granule_step;
+      put_page(0x01, granule, 0, NULL, 200, true);
+    } else {
+      size_t start = stream_len + 27 + 3;
+      // A long last packet, so that the next stream's header pages come
+      // late enough for a point if they were taken for audio
+      granule += granule_step * (i == audio_pages - 1 ? 4 : 1);
+      put_page(0, granule, 0, NULL, 600, true);
+      // A false capture pattern in the packet
+      memcpy(stream + start + 100, "OggS\x01", 5);
+    }
+  }
+  return base + (int64_t)(granule * 1000000 / rate);
+}
+
+static void test_ogg_chained(void) {
+  begin_stream();
+  put_payload(60);
+  put("OggS\x01", 5); // a capture pattern with a wrong version
+  put_payload(60);
+  uint8_t vorbis[30] = {1, 'v', 'o', 'r', 'b', 'i', 's', 0, 0, 0, 0, 2};
+  uint32_t rate = 44100;
+  memcpy(vorbis + 12, &rate, 4); // little-endian host
+  int64_t end = put_ogg_stream((const char *)vorbis, sizeof(vorbis), 44100,
+                               4096, 120, 0);
+  // The station switches to Opus: a new BOS page, the granule from zero
+  uint8_t opus[19] = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2};
+  end = put_ogg_stream((const char *)opus, sizeof(opus), 48000, 960 * 5, 120,
+                       end);
+  mark(end, false);
+  CHECK(run_index(TS_FORMAT_OGG, 3000) > 20);
+  // Every point is checked against its logical stream's time; make sure
+  // some came from the second one
+  CHECK(end > 120 * 4096 * 1000000LL / 44100);
+}
+
+/* ---------- FLAC ---------- */
+
+#define FLAC_BLOCK 4096
+#define FLAC_FRAME_US (FLAC_BLOCK * 1000000LL / 44100)
+
+static uint8_t crc8(const uint8_t *buf, size_t len) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x80 ? (uint8_t)(crc << 1 ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// A fixed-block frame header: 4096 samples, 44.1 kHz, stereo, 16 bit
+static size_t flac_header(uint8_t *h, uint32_t number, bool good_crc) {
+  size_t p = 0;
+  h[p++] = 0xFF;
+  h[p++] = 0xF8;
+  h[p++] = 12 << 4 | 9;
+  h[p++] = 1 << 4 | 4 << 1;
+  if (number < 0x80) {
+    h[p++] = number;
+  } else {
+    h[p++] = 0xC0 | number >> 6;
+    h[p++] = 0x80 | (number & 0x3F);
+  }
+  h[p] = crc8(h, p) ^ (good_crc ? 0 : 0x5A);
+  return p + 1;
+}
+
+static void test_flac(void) {
+  begin_stream();
+  put("fLaC", 4);
+  uint8_t info[4 + 34] = {0, 0, 0, 34};
+  info[4 + 10] = 44100 >> 12;
+  info[4 + 11] = 44100 >> 4 & 0xFF;
+  info[4 + 12] = (44100 & 0xF) << 4 | 1 << 1;
+  put(info, sizeof(info));
+  uint8_t padding[4] = {0x81, 0, 0, 100}; // last block
+  put(padding, sizeof(padding));
+  put_payload(100);
+  int64_t media = 0;
+  for (uint32_t n = 0; n < 220; n++) {
+    uint8_t h[16];
+    mark(media, true);
+    put(h, flac_header(h, n, true));
+    size_t start = stream_len;
+    put_payload(1200 + rnd() % 600);
+    // The next frame's number with a bad CRC, then a header with a good CRC
+    // but a number out of step: neither may end this frame
+    size_t len = flac_header(h, n + 1, false);
+    memcpy(stream + start + 300, h, len);
+    len = flac_header(h, n + 5, true);
+    memcpy(stream + start + 700, h, len);
+    media += FLAC_FRAME_US;
+  }
+  CHECK(run_index(TS_FORMAT_FLAC, 4000) > 20);
+}
+
+/* ---------- no frames ---------- */
+
+// Bytes without a frame are let through once there are too many to hold
+static void test_gives_up(void) {
+  static uint8_t ring[RING_SIZE];
+  static ts_point_t points[POINTS];
+  ts_index_t x;
+  ts_index_init(&x, TS_FORMAT_MPEG, ring, sizeof(ring), points, POINTS, 0);
+  memset(ring, 0x55, sizeof(ring));
+  uint64_t pos = 0;
+  while (pos < TS_SYNC_GIVE_UP + 4096) {
+    pos += 4096;
+    ts_index_scan(&x, pos);
+  }
+  CHECK_EQ(x.count, 0);
+  CHECK(x.boundary > 0);
+  CHECK(pos - x.boundary <= TS_SYNC_GIVE_UP);
+  CHECK_EQ(x.media_us, 0);
+}
+
+int main(void) {
+  RUN_TEST(test_mp3);
+  RUN_TEST(test_adts);
+  RUN_TEST(test_ogg_chained);
+  RUN_TEST(test_flac);
+  RUN_TEST(test_gives_up);
+  return host_test_result();
+}
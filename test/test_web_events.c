@@ -0,0 +1,467 @@
+/* Web event stream: subscribers on socketpairs, with the test as the web
+ * server's task running the work items the event task queues. Checked are
+ * the snapshot a new subscriber gets and the diffs after it, the subscriber
+ * cap, changes coalesced into one update, command results after the state
+ * they changed, a reader whose socket is full catching up with a snapshot,
+ * a lost work item, and the disconnect of a reader stalled for
+ * WEB_EVENTS_STALL_MS (the clock is moved on for it). */
+#include "host_test.h"
+#include "esp_timer.h"
+#include "local_media.h"
+#include "recorder.h"
+#include "station_data.h"
+#include "station_image.h"
+#include "ui_state.h"
+#include "web_events.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define WAIT_MS 3000
+
+volatile int g_bitrate_kbps = 128;
+volatile bool g_is_pipeline_running = true;
+volatile int g_stream_buffer_fill = 87;
+int current_station = 0;
+
+bool recorder_is_recording(void) { return false; }
+
+void local_media_get_stats(local_media_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->folder = -1;
+}
+
+static httpd_handle_t server;
+static uint32_t station_id;
+static int64_t clock_offset_us;
+
+static int64_t now_ms(void) { return esp_timer_get_time() / 1000; }
+
+// Runs the server task for ms
+static void run_for(int ms) {
+  int64_t end = now_ms() + ms;
+  while (now_ms() < end) {
+    host_httpd_run(server, 5);
+  }
+}
+
+/* ---------- subscribers ---------- */
+
+typedef struct {
+  int fd;        // the subscriber's end
+  int server_fd; // the session's end
+  char buf[16384];
+  size_t len;
+  bool closed;
+  long seq; // state version it has, 0 before a snapshot
+} client_t;
+
+typedef struct {
+  long id; // -1 without one
+  char event[16];
+  char data[512];
+} sse_t;
+
+static void client_read(client_t *c) {
+  ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len,
+                   MSG_DONTWAIT);
+  if (n == 0) {
+    c->closed = true;
+  } else if (n > 0) {
+    c->len += n;
+    c->buf[c->len] = '\0';
+  }
+}
+
+static void client_consume(client_t *c, size_t n) {
+  memmove(c->buf, c->buf + n, c->len - n + 1);
+  c->len -= n;
+}
+
+// Reads until text has arrived; the response head or a refusal
+static bool client_wait_for(client_t *c, const char *text) {
+  int64_t end = now_ms() + WAIT_MS;
+  while (strstr(c->buf, text) == NULL && !c->closed && now_ms() < end) {
+    host_httpd_run(server, 5);
+    client_read(c);
+  }
+  return strstr(c->buf, text) != NULL;
+}
+
+// A subscriber; false if it was not given an event stream
+static bool client_open(client_t *c) {
+  int sv[2];
+  memset(c, 0, sizeof(*c));
+  CHECK_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  c->fd = sv[0];
+  c->server_fd = sv[1];
+  host_httpd_call(server, web_events_handler, "/api/events", c->server_fd);
+  if (!client_wait_for(c, "\r\n\r\n")) {
+    return false;
+  }
+  if (strncmp(c->buf, "HTTP/1.1 200 OK\r\n", 17) != 0) {
+    return false;
+  }
+  CHECK(strstr(c->buf, "Content-Type: text/event-stream\r\n") != NULL);
+  client_consume(c, strstr(c->buf, "\r\n\r\n") + 4 - c->buf);
+  return true;
+}
+
+// Hangs up and waits for the server to close the session
+static void client_close(client_t *c) {
+  close(c->fd);
+  int64_t end = now_ms() + WAIT_MS;
+  while (host_httpd_is_open(server, c->server_fd) && now_ms() < end) {
+    host_httpd_run(server, 5);
+  }
+  CHECK(!host_httpd_is_open(server, c->server_fd));
+}
+
+static bool is_snapshot(const sse_t *e) {
+  return strncmp(e->data, "{\"station\":", 11) == 0;
+}
+
+/* The next message with data. Blank lines (the filler of client_stall) and
+ * comments are skipped. A state message must be a snapshot, or a diff on top
+ * of the version the client has. */
+static bool next_event(client_t *c, sse_t *e, int timeout_ms) {
+  int64_t end = now_ms() + timeout_ms;
+  for (;;) {
+    client_consume(c, strspn(c->buf, "\n"));
+    char *sep = strstr(c->buf, "\n\n");
+    if (sep != NULL) {
+      *sep = '\0';
+      e->id = -1;
+      e->event[0] = e->data[0] = '\0';
+      for (char *line = c->buf; line != NULL;) {
+        char *next = strchr(line, '\n');
+        if (next) {
+          *next++ = '\0';
+        }
+        if (strncmp(line, "id: ", 4) == 0) {
+          e->id = atol(line + 4);
+        } else if (strncmp(line, "event: ", 7) == 0) {
+          snprintf(e->event, sizeof(e->event), "%s", line + 7);
+        } else if (strncmp(line, "data: ", 6) == 0) {
+          snprintf(e->data, sizeof(e->data), "%s", line + 6);
+        }
+        line = next;
+      }
+      client_consume(c, sep + 2 - c->buf);
+      if (e->data[0] == '\0') {
+        continue;
+      }
+      if (strcmp(e->event, "state") == 0) {
+        if (is_snapshot(e)) {
+          CHECK(e->id >= c->seq);
+        } else {
+          CHECK(c->seq > 0);
+          CHECK_EQ(e->id, c->seq + 1);
+        }
+        c->seq = e->id;
+      }
+      return true;
+    }
+    if (c->closed || now_ms() >= end) {
+      return false;
+    }
+    host_httpd_run(server, 5);
+    client_read(c);
+  }
+}
+
+// Fills the session's socket with blank lines, which a reader skips, so
+// what the stream sends next waits
+static void client_stall(client_t *c) {
+  int size = 4096;
+  setsockopt(c->server_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  char filler[256];
+  memset(filler, '\n', sizeof(filler));
+  while (send(c->server_fd, filler, sizeof(filler), MSG_DONTWAIT) > 0) {
+  }
+}
+
+/* ---------- helpers ---------- */
+
+static void snapshot_data(char *buf, size_t len, int volume) {
+  snprintf(buf, len,
+           "{\"station\":{\"index\":0,\"id\":%u,\"call_sign\":\"K\\\"XP\","
+           "\"origin\":\"Seattle\"},\"volume\":%d,\"muted\":false,"
+           "\"playing\":true,\"bitrate\":128,\"buffer\":87,\"paused\":false,"
+           "\"behind\":0,\"recording\":false,\"local\":false}",
+           (unsigned)station_id, volume);
+}
+
+
+// Moves every clock reading on, as if ms had passed at once
+static void skip_time(int ms) {
+  clock_offset_us += ms * 1000LL;
+  host_timer_set_clock(0, clock_offset_us);
+}
+
+/* ---------- tests ---------- */
+
+static void test_snapshot_then_diffs(void) {
+  ui_state_set_int(UI_FIELD_VOLUME, 30);
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  char want[512];
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_STR(e.event, "state");
+  snapshot_data(want, sizeof(want), 30);
+  CHECK_STR(e.data, want);
+  long id = e.id;
+  CHECK(id > 0);
+
+  ui_state_set_int(UI_FIELD_VOLUME, 31);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 1);
+  CHECK_STR(e.data, "{\"volume\":31}");
+
+  ui_state_set_int(UI_FIELD_MUTE, 1);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 2);
+  CHECK_STR(e.data, "{\"muted\":true}");
+  ui_state_set_int(UI_FIELD_MUTE, 0);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 3);
+
+  // Nothing without a change
+  CHECK(!next_event(&c, &e, 1500));
+  client_close(&c);
+}
+
+static void test_coalesced(void) {
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  CHECK(next_event(&c, &e, WAIT_MS));
+  ui_state_set_int(UI_FIELD_VOLUME, 40);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_STR(e.data, "{\"volume\":40}");
+  long id = e.id;
+
+  // Within EVENTS_MIN_INTERVAL_MS of that: one update with the last values
+  ui_state_set_int(UI_FIELD_VOLUME, 41);
+  usleep(8000);
+  ui_state_set_int(UI_FIELD_VOLUME, 42);
+  usleep(8000);
+  ui_state_set_int(UI_FIELD_MUTE, 1);
+  usleep(8000);
+  ui_state_set_int(UI_FIELD_VOLUME, 43);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 1);
+  CHECK_STR(e.data, "{\"volume\":43,\"muted\":true}");
+  CHECK(!next_event(&c, &e, 300));
+  ui_state_set_int(UI_FIELD_MUTE, 0);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  client_close(&c);
+}
+
+static void test_commands(void) {
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  CHECK(next_event(&c, &e, WAIT_MS));
+
+  ui_state_set_int(UI_FIELD_VOLUME, 35);
+  web_events_command_t done = {.request_id = 12,
+                               .command = "volume",
+                               .result = ESP_OK,
+                               .latency_us = 812345};
+  web_events_command_done(&done);
+  // The state it changed comes first
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_STR(e.event, "state");
+  CHECK_STR(e.data, "{\"volume\":35}");
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_STR(e.event, "command");
+  CHECK_EQ(e.id, -1);
+  CHECK_STR(e.data, "{\"request\":12,\"command\":\"volume\",\"status\":\"ok\","
+                    "\"latency_us\":812345}");
+
+  done = (web_events_command_t){.request_id = 13,
+                                .command = "station-select",
+                                .result = ESP_ERR_NO_MEM,
+                                .latency_us = 5};
+  web_events_command_done(&done);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_STR(e.data,
+            "{\"request\":13,\"command\":\"station-select\",\"status\":"
+            "\"error\",\"error\":\"ESP_ERR_NO_MEM\",\"latency_us\":5}");
+  client_close(&c);
+}
+
+static void test_subscriber_cap(void) {
+  client_t c[WEB_EVENTS_MAX_CLIENTS + 1];
+  sse_t e;
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    CHECK(client_open(&c[i]));
+  }
+  client_t *extra = &c[WEB_EVENTS_MAX_CLIENTS];
+  CHECK(!client_open(extra));
+  CHECK(client_wait_for(extra, "subscribers\"}"));
+  CHECK(strncmp(extra->buf, "HTTP/1.1 503 Service Unavailable\r\n", 34) == 0);
+  CHECK(strstr(extra->buf, "Retry-After: 10\r\n") != NULL);
+  CHECK(strstr(extra->buf, "\r\n\r\n{\"error\":\"too many subscribers\"}") !=
+        NULL);
+  client_close(extra);
+
+  // Everyone subscribed gets the same change
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    CHECK(next_event(&c[i], &e, WAIT_MS));
+    CHECK(is_snapshot(&e));
+  }
+  ui_state_set_int(UI_FIELD_VOLUME, 36);
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    CHECK(next_event(&c[i], &e, WAIT_MS));
+    CHECK_STR(e.data, "{\"volume\":36}");
+  }
+
+  // A slot that frees up is taken again
+  client_close(&c[0]);
+  CHECK(client_open(&c[0]));
+  for (int i = 0; i < WEB_EVENTS_MAX_CLIENTS; i++) {
+    client_close(&c[i]);
+  }
+}
+
+static void test_stalled_reader_catches_up(void) {
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  CHECK(next_event(&c, &e, WAIT_MS));
+  long id = e.id;
+
+  // More changes than a client can hold while its socket is full
+  client_stall(&c);
+  for (int v = 51; v <= 58; v++) {
+    ui_state_set_int(UI_FIELD_VOLUME, v);
+    run_for(80);
+  }
+
+  // What was queued, in order, then a snapshot of the last version
+  int diffs = 0;
+  bool caught_up = false;
+  while (!caught_up && next_event(&c, &e, WAIT_MS)) {
+    if (is_snapshot(&e)) {
+      char want[512];
+      snapshot_data(want, sizeof(want), 58);
+      CHECK_STR(e.data, want);
+      CHECK_EQ(e.id, id + 8);
+      caught_up = true;
+    } else {
+      diffs++;
+      char want[32];
+      snprintf(want, sizeof(want), "{\"volume\":%d}", 50 + diffs);
+      CHECK_STR(e.data, want);
+      CHECK_EQ(e.id, id + diffs);
+    }
+  }
+  CHECK(caught_up);
+  CHECK(diffs > 0 && diffs < 8);
+
+  // Diffs again from there
+  ui_state_set_int(UI_FIELD_VOLUME, 59);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 9);
+  CHECK_STR(e.data, "{\"volume\":59}");
+  client_close(&c);
+}
+
+static void test_lost_work_item(void) {
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  CHECK(next_event(&c, &e, WAIT_MS));
+  long id = e.id;
+
+  // The diff is never delivered: a snapshot of that version replaces it
+  host_httpd_fail_work(server, 1);
+  ui_state_set_int(UI_FIELD_VOLUME, 60);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK(is_snapshot(&e));
+  CHECK_EQ(e.id, id + 1);
+  CHECK(strstr(e.data, "\"volume\":60,") != NULL);
+
+  // The snapshot is lost too: retried on the next poll
+  host_httpd_fail_work(server, 2);
+  ui_state_set_int(UI_FIELD_VOLUME, 61);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK(is_snapshot(&e));
+  CHECK_EQ(e.id, id + 2);
+  CHECK(strstr(e.data, "\"volume\":61,") != NULL);
+
+  // A diff after a lost one is no use either, until the snapshot is there
+  host_httpd_fail_work(server, 2);
+  ui_state_set_int(UI_FIELD_VOLUME, 62);
+  run_for(100);
+  ui_state_set_int(UI_FIELD_VOLUME, 63);
+  while (next_event(&c, &e, WAIT_MS) && e.id != id + 4) {
+  }
+  CHECK_EQ(e.id, id + 4);
+  CHECK(strstr(e.data, "\"volume\":63") != NULL);
+
+  ui_state_set_int(UI_FIELD_VOLUME, 64);
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK_EQ(e.id, id + 5);
+  CHECK_STR(e.data, "{\"volume\":64}");
+  client_close(&c);
+}
+
+static void test_stalled_reader_closed(void) {
+  client_t c;
+  CHECK(client_open(&c));
+  sse_t e;
+  CHECK(next_event(&c, &e, WAIT_MS));
+
+  client_stall(&c);
+  ui_state_set_int(UI_FIELD_VOLUME, 65);
+  run_for(1500);
+  CHECK(host_httpd_is_open(server, c.server_fd));
+
+  skip_time(WEB_EVENTS_STALL_MS);
+  int64_t end = now_ms() + WAIT_MS;
+  while (host_httpd_is_open(server, c.server_fd) && now_ms() < end) {
+    host_httpd_run(server, 5);
+  }
+  CHECK(!host_httpd_is_open(server, c.server_fd));
+  // What was sent is still there to read, then the end
+  while (next_event(&c, &e, WAIT_MS)) {
+  }
+  CHECK(c.closed);
+  close(c.fd);
+
+  // Its slot is free again
+  CHECK(client_open(&c));
+  CHECK(next_event(&c, &e, WAIT_MS));
+  CHECK(is_snapshot(&e));
+  client_close(&c);
+}
+
+int main(void) {
+  station_entry_t station = {.call_sign = "K\"XP",
+                             .origin = "Seattle",
+                             .uri = "http://kexp.example/live",
+                             .codec = CODEC_TYPE_MP3};
+  station_image_t image;
+  CHECK_EQ(station_image_build(&station, 1, &image), ESP_OK);
+  CHECK_EQ(station_data_install(&image), ESP_OK);
+  const station_snapshot_t *s = station_snapshot_acquire();
+  station_id = s->stations[0].id;
+  station_snapshot_release(s);
+
+  server = host_httpd_create();
+  CHECK_EQ(web_events_start(server), ESP_OK);
+  RUN_TEST(test_snapshot_then_diffs);
+  RUN_TEST(test_coalesced);
+  RUN_TEST(test_commands);
+  RUN_TEST(test_subscriber_cap);
+  RUN_TEST(test_stalled_reader_catches_up);
+  RUN_TEST(test_lost_work_item);
+  RUN_TEST(test_stalled_reader_closed);
+  return host_test_result();
+}